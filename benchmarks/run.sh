@@ -0,0 +1,53 @@
+#!/bin/sh
+# Runs the reference jobs and collects the per-phase profiles.
+#
+# Usage: run.sh <directory of the binaries> <output directory> [job list] [job name filter]
+#
+# Every job is run in its own directory under the output directory,
+# where its output, checkpoint and JSON profile are left. The wall
+# times and exit codes of all jobs are collected in summary.json.
+
+if [ $# -lt 2 ]; then
+    echo "Usage: $0 bindir outdir [jobs] [filter]"
+    exit 1
+fi
+
+bindir=$(cd "$1" && pwd)
+mkdir -p "$2"
+outdir=$(cd "$2" && pwd)
+jobs=${3:-$(dirname "$0")/jobs.txt}
+filter=${4:-}
+
+summary="$outdir/summary.json"
+printf '{\n  "jobs": [' > "$summary"
+first=1
+
+grep -v '^#' "$jobs" | while read -r name prog args; do
+    [ -z "$name" ] && continue
+    case "$name" in
+        *"$filter"*) ;;
+        *) continue ;;
+    esac
+
+    jobdir="$outdir/$name"
+    mkdir -p "$jobdir"
+    echo "Running $name"
+    tstart=$(date +%s.%N)
+    (cd "$jobdir" && "$bindir/$prog" $args --profile=profile.json > output.log 2>&1)
+    status=$?
+    tend=$(date +%s.%N)
+    wall=$(awk "BEGIN {print $tend - $tstart}")
+    if [ $status -ne 0 ]; then
+        echo "  $name failed with exit code $status, see $jobdir/output.log"
+    else
+        echo "  done in $wall s"
+    fi
+
+    [ $first -eq 0 ] && printf ',' >> "$summary"
+    first=0
+    printf '\n    {"name": "%s", "program": "%s", "arguments": "%s", "status": %i, "wall": %s, "profile": "%s"}' \
+           "$name" "$prog" "$args" $status "$wall" "$name/profile.json" >> "$summary"
+done
+
+printf '\n  ]\n}\n' >> "$summary"
+echo "Summary written to $summary"
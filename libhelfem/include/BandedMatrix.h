@@ -0,0 +1,91 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#ifndef POLYNOMIAL_BASIS_BANDEDMATRIX_H
+#define POLYNOMIAL_BASIS_BANDEDMATRIX_H
+
+#include <armadillo>
+
+namespace helfem {
+  namespace polynomial_basis {
+    /**
+     * Square banded matrix. Finite element matrices only couple
+     * functions within the same element, so all entries lie within
+     * kd = Nprim-1 of the diagonal. The 2*kd+1 diagonals are stored
+     * LAPACK style: entry (i,j) with |i-j|<=kd is at band(kd+i-j,j).
+     */
+    class BandedMatrix {
+      /// Matrix size
+      size_t N;
+      /// Number of sub- and superdiagonals
+      size_t kd;
+      /// Band storage
+      arma::mat band;
+
+    public:
+      /// Dummy constructor
+      BandedMatrix();
+      /// Constructor, initializes to zero
+      BandedMatrix(size_t N, size_t kd);
+      /// Destructor
+      ~BandedMatrix();
+
+      /// Matrix size
+      size_t get_N() const;
+      /// Number of sub- and superdiagonals
+      size_t get_bandwidth() const;
+      /// Memory use of the band storage
+      size_t memory_size() const;
+
+      /// Set all entries to zero
+      void zeros();
+      /// Get entry; zero outside the band
+      double operator()(size_t i, size_t j) const;
+      /// Accumulate a dense block whose first row and column is ifirst
+      void add_block(size_t ifirst, const arma::mat & M);
+
+      /// Add another matrix of the same shape
+      BandedMatrix & operator+=(const BandedMatrix & rh);
+      /// Scale the matrix
+      BandedMatrix & operator*=(double fac);
+      /// Matrix product with a dense matrix or vector
+      arma::mat operator*(const arma::mat & X) const;
+
+      /// Convert to dense matrix
+      arma::mat dense() const;
+
+      /// Cholesky factorization A = L L^T of a symmetric positive
+      /// definite matrix; returns the lower triangular factor L
+      BandedMatrix chol() const;
+      /// Solve A X = B, where this matrix is the Cholesky factor of A
+      arma::mat chol_solve(const arma::mat & B) const;
+      /// Same as chol(), but returns false instead of throwing if the matrix is not positive definite
+      bool try_chol(BandedMatrix & L) const;
+    };
+
+    /**
+     * Solve the neig lowest eigenpairs of the generalized problem
+     * H C = S C E with symmetric banded H and positive definite S by
+     * shift-invert subspace iteration. The shift is placed below the
+     * spectrum, so H - sigma S is factorized with the banded Cholesky
+     * decomposition; time and memory are linear in the matrix size.
+     * The eigenvectors are S-orthonormal. Iterates until the relative
+     * residual norms are below convthr; throws if maxit iterations do
+     * not suffice.
+     */
+    void eig_gsym_banded(arma::vec & E, arma::mat & C, const BandedMatrix & H, const BandedMatrix & S, size_t neig, double convthr=1e-10, int maxit=500);
+  }
+}
+#endif
@@ -19,15 +19,24 @@
 #include <functional>
 #include <armadillo>
 #include <memory>
+#include <vector>
 #include "PolynomialBasis.h"
+#include "BandedMatrix.h"
 
 namespace helfem {
   namespace polynomial_basis {
+    /// Weight function evaluated at all quadrature points of an element in one call
+    typedef std::function<arma::vec(const arma::vec &)> vectorized_weight_t;
+
     /// Finite element basis set
     class FiniteElementBasis {
     protected:
       /// Polynomial basis
       std::shared_ptr<const polynomial_basis::PolynomialBasis> poly;
+      /// Distinct polynomial bases used in the elements; the first one is poly
+      std::vector<std::shared_ptr<const polynomial_basis::PolynomialBasis>> polys;
+      /// Index of the polynomial basis of each element in polys
+      arma::uvec el_poly;
 
       /// Element boundary values
       arma::vec bval;
@@ -53,18 +62,69 @@ namespace helfem {
       /// Used basis function indices in element
       arma::uvec basis_indices(size_t iel) const;
 
+      /// Reference points of the tabulation
+      arma::vec tab_x;
+      /// Primitive polynomials and their derivatives at tab_x for unit element length, for every polynomial basis
+      std::vector<std::vector<arma::mat>> tab_dnf;
+      /// Powers of element length carried by the primitives of every polynomial basis
+      std::vector<arma::ivec> tab_lpow;
+      /// Is the tabulation valid for the given points and derivative?
+      bool is_tabulated(const arma::vec & x, int n) const;
+      /// Quadrature nodes whose subinterval points are tabulated
+      arma::vec tab_sub_x;
+      /// Primitive polynomials at the subinterval points for unit element length, for every polynomial basis
+      std::vector<arma::mat> tab_sub_f;
+      /// Pick out the functions of the element from a unit-length tabulation of the primitives, and scale them
+      arma::mat scale_tabulated(const arma::mat & tab, int n, size_t iel) const;
+
+      /// Total quadrature weights in element, including the weight function
+      arma::vec element_weights(size_t iel, const arma::vec & xq, const arma::vec & wq, const std::function<double(double)> & f) const;
+      /// Same as above, with a vectorized weight function
+      arma::vec element_weights(size_t iel, const arma::vec & xq, const arma::vec & wq, const vectorized_weight_t & f) const;
+      /// Element matrix with the given total quadrature weights
+      arma::mat element_matrix(size_t iel, const std::function<arma::mat(arma::vec,size_t)> & eval_lh, const std::function<arma::mat(arma::vec,size_t)> & eval_rh, const arma::vec & xq, const arma::vec & wp) const;
+      /// Assemble element matrices into a dense global matrix
+      arma::mat assemble(const std::vector<arma::mat> & matel) const;
+      /// Assemble element vectors into a global vector
+      arma::vec assemble(const std::vector<arma::vec> & vecel) const;
+
     public:
       /// Dummy constructor
       FiniteElementBasis();
       /// Constructor
       FiniteElementBasis(const std::shared_ptr<const polynomial_basis::PolynomialBasis> &poly,
                          const arma::vec &bval, bool zero_func_left, bool zero_deriv_left, bool zero_func_right, bool zero_deriv_right);
+      /**
+       * Constructor with a varying polynomial order: element iel uses
+       * the basis polys[el_poly(iel)]. All the bases must have the
+       * same number of overlapping functions, so that the functions
+       * can be joined at the element boundaries.
+       */
+      FiniteElementBasis(const std::vector<std::shared_ptr<const polynomial_basis::PolynomialBasis>> &polys, const arma::uvec &el_poly,
+                         const arma::vec &bval, bool zero_func_left, bool zero_deriv_left, bool zero_func_right, bool zero_deriv_right);
       /// Destructor
       ~FiniteElementBasis();
 
-      /// Add an element boundary
+      /// Add an element boundary; the halves of a split element retain its polynomial basis
       void add_boundary(double r);
 
+      /// Tabulate the primitive polynomials and their derivatives up to
+      /// order nmax at the given reference points. All elements share
+      /// the reference points, so later evaluations at exactly these
+      /// points only pick out and scale the tabulated values.
+      void tabulate(const arma::vec & x, int nmax);
+      /// Tabulate the primitive polynomials at the subinterval points
+      /// of the quadrature nodes x, see eval_subinterval_f.
+      void tabulate_subintervals(const arma::vec & x);
+      /**
+       * Reference points of the cumulative inner integrals: the nodes
+       * x mapped onto every subinterval [x(i-1), x(i)] of [-1, 1], with
+       * x(-1)=-1. Subinterval i takes entries i*Nq to (i+1)*Nq-1.
+       */
+      static arma::vec subinterval_points(const arma::vec & x);
+      /// Evaluate the basis functions of the element at the subinterval points of x
+      arma::mat eval_subinterval_f(const arma::vec & x, size_t iel) const;
+
       /// Get the polynomial basis
       std::shared_ptr<polynomial_basis::PolynomialBasis>  get_poly() const;
       /// Get basis functions in element
@@ -75,6 +135,14 @@ namespace helfem {
       int get_poly_id() const;
       /// Get the number of nodes in the polynomial basis
       int get_poly_nnodes() const;
+      /// Do all elements use the same polynomial basis?
+      bool uniform_poly() const;
+      /// Get the numerical ids of the polynomial bases of the elements
+      arma::ivec get_element_poly_id() const;
+      /// Get the number of nodes in the polynomial bases of the elements
+      arma::ivec get_element_poly_nnodes() const;
+      /// Get the number of primitives in the polynomial basis of the element, before any are dropped at the boundaries
+      size_t get_poly_nprim(size_t iel) const;
 
       /// Get the used subset of primitives in the element
       arma::mat get_basis(const arma::mat &bas, size_t iel) const;
@@ -108,6 +176,8 @@ namespace helfem {
       size_t get_nbf() const;
       /// Get number of elements
       size_t get_nelem() const;
+      /// Get number of sub- and superdiagonals in global matrices
+      size_t get_bandwidth() const;
 
       /// Evaluate polynomials at given points
       void eval_f(const arma::vec & x, arma::mat & f, size_t iel) const;
@@ -151,6 +221,14 @@ namespace helfem {
       arma::mat matrix_element(int lhder, int rhder, const arma::vec & xq, const arma::vec & wq, const std::function<double(double)> & f) const;
       /// Same as above, but only in a single element
       arma::mat matrix_element(size_t iel, int lhder, int rhder, const arma::vec & xq, const arma::vec & wq, const std::function<double(double)> & f) const;
+      /// Same as above, but in banded storage
+      BandedMatrix matrix_element_banded(int lhder, int rhder, const arma::vec & xq, const arma::vec & wq, const std::function<double(double)> & f) const;
+      /// Same as above, but with the weight function tabulated at the quadrature nodes
+      arma::mat matrix_element_weighted(size_t iel, int lhder, int rhder, const arma::vec & xq, const arma::vec & wq, const arma::vec & fq) const;
+      /// Same as above, but the weight function is evaluated for all nodes of an element in one call
+      arma::mat matrix_element_vectorized(int lhder, int rhder, const arma::vec & xq, const arma::vec & wq, const vectorized_weight_t & f) const;
+      /// Same as above, but only in a single element
+      arma::mat matrix_element_vectorized(size_t iel, int lhder, int rhder, const arma::vec & xq, const arma::vec & wq, const vectorized_weight_t & f) const;
 
       /**
        * Compute vector elements in the finite element basis <lh|f|rh>
@@ -163,6 +241,10 @@ namespace helfem {
       arma::vec vector_element(int der, const arma::vec & xq, const arma::vec & wq, const std::function<double(double)> & f) const;
       /// Same as above, but only in a single element
       arma::vec vector_element(size_t iel, int der, const arma::vec & xq, const arma::vec & wq, const std::function<double(double)> & f) const;
+      /// Same as above, but the weight function is evaluated for all nodes of an element in one call
+      arma::vec vector_element_vectorized(int der, const arma::vec & xq, const arma::vec & wq, const vectorized_weight_t & f) const;
+      /// Same as above, but only in a single element
+      arma::vec vector_element_vectorized(size_t iel, int der, const arma::vec & xq, const arma::vec & wq, const vectorized_weight_t & f) const;
 
       /**
        * Compute matrix elements in the finite element basis <lh|f|rh>
@@ -174,8 +256,14 @@ namespace helfem {
        * f(r):  additional weight function, use nullptr for unit weight
        */
       arma::mat matrix_element(const std::function<arma::mat(arma::vec,size_t)> & eval_lh, const std::function<arma::mat(arma::vec,size_t)> & eval_rh, const arma::vec & xq, const arma::vec & wq, const std::function<double(double)> & f) const;
+      /// Same as above, but in banded storage
+      BandedMatrix matrix_element_banded(const std::function<arma::mat(arma::vec,size_t)> & eval_lh, const std::function<arma::mat(arma::vec,size_t)> & eval_rh, const arma::vec & xq, const arma::vec & wq, const std::function<double(double)> & f) const;
+      /// Assemble element matrices into banded storage
+      BandedMatrix assemble_banded(const std::vector<arma::mat> & matel) const;
       /// The driver function
       arma::mat matrix_element(size_t iel, const std::function<arma::mat(arma::vec,size_t)> & eval_lh, const std::function<arma::mat(arma::vec,size_t)> & eval_rh, const arma::vec & xq, const arma::vec & wq, const std::function<double(double)> & f) const;
+      /// The driver function for vectorized weight functions
+      arma::mat matrix_element_vectorized(size_t iel, const std::function<arma::mat(arma::vec,size_t)> & eval_lh, const std::function<arma::mat(arma::vec,size_t)> & eval_rh, const arma::vec & xq, const arma::vec & wq, const vectorized_weight_t & f) const;
 
       /**
        * Compute vector elements in the finite element basis <bf|f>
@@ -188,6 +276,8 @@ namespace helfem {
       arma::vec vector_element(const std::function<arma::mat(arma::vec,size_t)> & eval_bf, const arma::vec & xq, const arma::vec & wq, const std::function<double(double)> & f) const;
       /// The driver function
       arma::vec vector_element(size_t iel, const std::function<arma::mat(arma::vec,size_t)> & eval_bf, const arma::vec & xq, const arma::vec & wq, const std::function<double(double)> & f) const;
+      /// The driver function for vectorized weight functions
+      arma::vec vector_element_vectorized(size_t iel, const std::function<arma::mat(arma::vec,size_t)> & eval_bf, const arma::vec & xq, const arma::vec & wq, const vectorized_weight_t & f) const;
 
       /// Print out the basis functions
       void print(const std::string & str="") const;
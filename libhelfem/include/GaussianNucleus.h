@@ -36,6 +36,9 @@ namespace helfem {
       ~GaussianNucleus();
       /// Potential
       double V(double r) const override;
+      /// Potential at many points
+      void V(const arma::vec & r, arma::vec & out) const override;
+      using ModelPotential::V;
       /// Get mu
       double get_mu() const;
       /// Set mu
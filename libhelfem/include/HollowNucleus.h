@@ -33,6 +33,9 @@ namespace helfem {
       ~HollowNucleus();
       /// Potential
       double V(double r) const override;
+      /// Potential at many points
+      void V(const arma::vec & r, arma::vec & out) const override;
+      using ModelPotential::V;
       /// Get R
       double get_R() const;
       /// Set R
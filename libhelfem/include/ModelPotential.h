@@ -30,7 +30,9 @@ namespace helfem {
 
       /// Potential
       virtual double V(double r) const=0;
-      /// Potential
+      /// Potential at many points; override for a vectorized implementation
+      virtual void V(const arma::vec & r, arma::vec & out) const;
+      /// Potential at many points
       arma::vec V(const arma::vec & r) const;
     };
   }
@@ -61,6 +61,10 @@ namespace helfem {
 
       /// Get list of enabled primitives
       arma::uvec get_enabled() const;
+      /// Powers of the element length carried by the primitives:
+      /// eval_prim_dnf for length L equals the unit-length result with
+      /// primitive j scaled by L^p(j)
+      virtual arma::ivec get_length_powers() const;
       /// Drop first function(s); zero_deriv: also set derivatives to zero
       virtual void drop_first(bool zero_func, bool zero_deriv)=0;
       /// Drop last function(s); zero_deriv: also set derivatives to zero
@@ -42,9 +42,16 @@ namespace helfem {
 
         /// Derivatives of basis functions at origin
         std::vector<arma::rowvec> taylor_df;
+        /// Coefficients of the powers of r in the Taylor series of the functions and their first two derivatives
+        std::vector<arma::mat> taylor_coeff;
+        /// Form the Taylor coefficients
+        void form_taylor_coeff();
         /// Set the cutoff
         void set_small_r_taylor_cutoff();
 
+        /// Basis functions and their first two derivatives at the quadrature points of the first element, which holds the Taylor series
+        arma::mat bf_first, df_first, lf_first;
+
       public:
         /// Dummy constructor
         RadialBasis();
@@ -69,6 +76,12 @@ namespace helfem {
         int get_poly_id() const;
         /// Get number of nodes in polynomial basis
         int get_poly_nnodes() const;
+        /// Do all elements use the same polynomial basis?
+        bool uniform_poly() const;
+        /// Get polynomial basis identifiers of the elements
+        arma::ivec get_element_poly_id() const;
+        /// Get number of nodes in the polynomial bases of the elements
+        arma::ivec get_element_poly_nnodes() const;
         /// Get small r Taylor cutoff
         double get_small_r_taylor_cutoff() const;
         /// Get the order of the Taylor series
@@ -101,11 +114,20 @@ namespace helfem {
         /// Compute radial matrix elements <r^n> in element (overlap is n=0,
         /// nuclear is n=-1)
         arma::mat radial_integral(int n, size_t iel) const;
+        /// Compute the radial moments <r^L> and <r^{-L-1}> in element
+        /// for all L=0,...,Lmax in one pass
+        void radial_moments(int Lmax, size_t iel, std::vector<arma::mat> & rL, std::vector<arma::mat> & rm1L) const;
+
+        /// Metric whose contraction with the density matrix of the element gives the norm, with the r^2 volume element, of its ntail highest Legendre components; used to estimate the discretization error
+        arma::mat legendre_tail(size_t iel, int ntail) const;
 
         /// Compute Bessel i_L integral
         arma::mat bessel_il_integral(int L, double lambda, size_t iel) const;
         /// Compute Bessel k_L integral
         arma::mat bessel_kl_integral(int L, double lambda, size_t iel) const;
+        /// Compute the Bessel i_L and k_L integrals in element for
+        /// all L=0,...,Lmax in one pass
+        void bessel_integrals(int Lmax, double lambda, size_t iel, std::vector<arma::mat> & iL, std::vector<arma::mat> & kL) const;
 
         /// Compute overlap matrix in element
         arma::mat overlap(size_t iel) const;
@@ -124,14 +146,29 @@ namespace helfem {
 
         /// Compute primitive two-electron integral
         arma::mat twoe_integral(int L, size_t iel) const;
+        /// Compute primitive two-electron integrals for L=0,...,Lmax
+        std::vector<arma::mat> twoe_integrals(int Lmax, size_t iel) const;
         /// Compute primitive Yukawa-screened two-electron integral
         arma::mat yukawa_integral(int L, double lambda, size_t iel) const;
         /// Compute primitive complementary error function two-electron integral
         arma::mat erfc_integral(int L, double lambda, size_t iel,
                                 size_t jel) const;
+        /// Estimate the magnitude of the complementary error function two-electron integrals between two elements
+        double erfc_integral_bound(int L, double lambda, size_t iel,
+                                   size_t jel) const;
         /// Compute a spherically symmetric potential
         arma::mat spherical_potential(size_t iel) const;
 
+        /// Compute radial matrix <r^n> over all elements in banded storage
+        polynomial_basis::BandedMatrix radial_integral_banded(int n) const;
+        /// Compute primitive kinetic energy matrix (excluding l part) in
+        /// banded storage
+        polynomial_basis::BandedMatrix kinetic_banded() const;
+        /// Compute l part of kinetic energy matrix in banded storage
+        polynomial_basis::BandedMatrix kinetic_l_banded() const;
+        /// Compute the matrix of the absorbing potential (r-R0)^2 for r>R0 in banded storage
+        polynomial_basis::BandedMatrix absorbing_potential_banded(double R0) const;
+
         /// Compute cross-basis integral
         arma::mat radial_integral(const RadialBasis &rh, int n,
                                   bool lhder = false, bool rhder = false) const;
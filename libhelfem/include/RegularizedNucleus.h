@@ -35,6 +35,9 @@ namespace helfem {
       ~RegularizedNucleus();
       /// Potential
       double V(double r) const override;
+      /// Potential at many points
+      void V(const arma::vec & r, arma::vec & out) const override;
+      using ModelPotential::V;
       /// Get a
       double get_a() const;
       /// Get b
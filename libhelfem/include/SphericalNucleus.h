@@ -33,6 +33,9 @@ namespace helfem {
       ~SphericalNucleus();
       /// Potential
       double V(double r) const override;
+      /// Potential at many points
+      void V(const arma::vec & r, arma::vec & out) const override;
+      using ModelPotential::V;
       /// Get R0
       double get_R0() const;
       /// Set R0
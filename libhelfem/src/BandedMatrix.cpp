@@ -0,0 +1,259 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+
+#include "BandedMatrix.h"
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+namespace helfem {
+  namespace polynomial_basis {
+    BandedMatrix::BandedMatrix() : N(0), kd(0) {
+    }
+
+    BandedMatrix::BandedMatrix(size_t N_, size_t kd_) : N(N_), kd(std::min(kd_,N_ ? N_-1 : 0)) {
+      band.zeros(2*kd+1,N);
+    }
+
+    BandedMatrix::~BandedMatrix() {
+    }
+
+    size_t BandedMatrix::get_N() const {
+      return N;
+    }
+
+    size_t BandedMatrix::get_bandwidth() const {
+      return kd;
+    }
+
+    size_t BandedMatrix::memory_size() const {
+      return band.n_elem*sizeof(double);
+    }
+
+    void BandedMatrix::zeros() {
+      band.zeros();
+    }
+
+    double BandedMatrix::operator()(size_t i, size_t j) const {
+      if(i+kd<j || j+kd<i)
+        return 0.0;
+      return band(kd+i-j,j);
+    }
+
+    void BandedMatrix::add_block(size_t ifirst, const arma::mat & M) {
+      if(M.n_rows != M.n_cols) {
+        std::ostringstream oss;
+        oss << "Block is not square: " << M.n_rows << " x " << M.n_cols << "!\n";
+        throw std::logic_error(oss.str());
+      }
+      if(M.n_rows && M.n_rows-1>kd) {
+        std::ostringstream oss;
+        oss << "Block of size " << M.n_rows << " does not fit in bandwidth " << kd << "!\n";
+        throw std::logic_error(oss.str());
+      }
+      if(ifirst+M.n_rows>N) {
+        std::ostringstream oss;
+        oss << "Block at " << ifirst << " of size " << M.n_rows << " exceeds matrix size " << N << "!\n";
+        throw std::logic_error(oss.str());
+      }
+
+      for(size_t j=0;j<M.n_cols;j++)
+        for(size_t i=0;i<M.n_rows;i++)
+          band(kd+i-j,ifirst+j)+=M(i,j);
+    }
+
+    BandedMatrix & BandedMatrix::operator+=(const BandedMatrix & rh) {
+      if(N != rh.N || kd != rh.kd) {
+        std::ostringstream oss;
+        oss << "Can't add banded matrices of size " << N << " (bandwidth " << kd << ") and " << rh.N << " (bandwidth " << rh.kd << ")!\n";
+        throw std::logic_error(oss.str());
+      }
+      band+=rh.band;
+      return *this;
+    }
+
+    BandedMatrix & BandedMatrix::operator*=(double fac) {
+      band*=fac;
+      return *this;
+    }
+
+    arma::mat BandedMatrix::operator*(const arma::mat & X) const {
+      if(X.n_rows != N) {
+        std::ostringstream oss;
+        oss << "Can't multiply " << N << " x " << N << " banded matrix with " << X.n_rows << " x " << X.n_cols << " matrix!\n";
+        throw std::logic_error(oss.str());
+      }
+
+      arma::mat Y(N,X.n_cols,arma::fill::zeros);
+      for(size_t c=0;c<X.n_cols;c++)
+        for(size_t j=0;j<N;j++) {
+          size_t imin(j>kd ? j-kd : 0);
+          size_t imax(std::min(N-1,j+kd));
+          for(size_t i=imin;i<=imax;i++)
+            Y(i,c)+=band(kd+i-j,j)*X(j,c);
+        }
+
+      return Y;
+    }
+
+    arma::mat BandedMatrix::dense() const {
+      arma::mat M(N,N,arma::fill::zeros);
+      for(size_t j=0;j<N;j++) {
+        size_t imin(j>kd ? j-kd : 0);
+        size_t imax(std::min(N-1,j+kd));
+        for(size_t i=imin;i<=imax;i++)
+          M(i,j)=band(kd+i-j,j);
+      }
+      return M;
+    }
+
+    BandedMatrix BandedMatrix::chol() const {
+      BandedMatrix L;
+      if(!try_chol(L)) {
+        std::ostringstream oss;
+        oss << "Banded Cholesky factorization failed: matrix is not positive definite!\n";
+        throw std::runtime_error(oss.str());
+      }
+      return L;
+    }
+
+    bool BandedMatrix::try_chol(BandedMatrix & L) const {
+      // The factor has the same bandwidth as the matrix
+      L=BandedMatrix(N,kd);
+      for(size_t j=0;j<N;j++) {
+        size_t kmin(j>kd ? j-kd : 0);
+
+        // Diagonal element
+        double d(band(kd,j));
+        for(size_t k=kmin;k<j;k++)
+          d-=std::pow(L.band(kd+j-k,k),2);
+        if(!(d>0.0))
+          return false;
+        L.band(kd,j)=std::sqrt(d);
+
+        // Subdiagonal elements of the column
+        size_t imax(std::min(N-1,j+kd));
+        for(size_t i=j+1;i<=imax;i++) {
+          double s(band(kd+i-j,j));
+          for(size_t k=(i>kd ? i-kd : 0);k<j;k++)
+            s-=L.band(kd+i-k,k)*L.band(kd+j-k,k);
+          L.band(kd+i-j,j)=s/L.band(kd,j);
+        }
+      }
+      return true;
+    }
+
+    arma::mat BandedMatrix::chol_solve(const arma::mat & B) const {
+      if(B.n_rows != N) {
+        std::ostringstream oss;
+        oss << "Right-hand side has " << B.n_rows << " rows, expected " << N << "!\n";
+        throw std::logic_error(oss.str());
+      }
+
+      arma::mat X(B);
+      for(size_t c=0;c<X.n_cols;c++) {
+        // Forward substitution L y = b
+        for(size_t i=0;i<N;i++) {
+          double s(X(i,c));
+          for(size_t k=(i>kd ? i-kd : 0);k<i;k++)
+            s-=band(kd+i-k,k)*X(k,c);
+          X(i,c)=s/band(kd,i);
+        }
+        // Back substitution L^T x = y
+        for(size_t ii=N;ii>0;ii--) {
+          size_t i(ii-1);
+          double s(X(i,c));
+          size_t kmax(std::min(N-1,i+kd));
+          for(size_t k=i+1;k<=kmax;k++)
+            s-=band(kd+k-i,i)*X(k,c);
+          X(i,c)=s/band(kd,i);
+        }
+      }
+      return X;
+    }
+
+    void eig_gsym_banded(arma::vec & E, arma::mat & C, const BandedMatrix & H, const BandedMatrix & S, size_t neig, double convthr, int maxit) {
+      const size_t N(H.get_N());
+      if(S.get_N() != N) {
+        std::ostringstream oss;
+        oss << "Hamiltonian is " << N << " x " << N << " but overlap is " << S.get_N() << " x " << S.get_N() << "!\n";
+        throw std::logic_error(oss.str());
+      }
+      neig=std::min(neig,N);
+      if(neig==0) {
+        E.clear();
+        C.zeros(N,0);
+        return;
+      }
+
+      // The Rayleigh quotients of the basis functions bound the lowest
+      // eigenvalue from above; step down until H - sigma S is positive
+      // definite, which places sigma below the spectrum
+      double sigma(arma::datum::inf);
+      for(size_t i=0;i<N;i++)
+        sigma=std::min(sigma,H(i,i)/S(i,i));
+      BandedMatrix A, L;
+      for(double step=std::max(1.0,std::abs(sigma))*1e-3;;step*=2.0) {
+        sigma-=step;
+        A=S;
+        A*=-sigma;
+        A+=H;
+        if(A.try_chol(L))
+          break;
+      }
+
+      // Extra vectors make the convergence rate (E(neig-1)-sigma)/(E(p)-sigma)
+      const size_t p(std::min(N,std::max(2*neig,neig+8)));
+      // Smooth starting vectors overlap well with the low-lying states
+      arma::mat X(N,p);
+      for(size_t j=0;j<p;j++)
+        for(size_t i=0;i<N;i++)
+          X(i,j)=std::cos(M_PI*(j+0.5)*(i+0.5)/N);
+
+      arma::vec e;
+      for(int iit=0;iit<maxit;iit++) {
+        // Apply the inverse and orthonormalize by Rayleigh-Ritz
+        arma::mat Y(L.chol_solve(S*X));
+        arma::mat Ss(arma::trans(Y)*(S*Y));
+        arma::mat Hs(arma::trans(Y)*(H*Y));
+        arma::mat Ls;
+        if(!arma::chol(Ls,arma::symmatu(Ss),"lower"))
+          throw std::runtime_error("Subspace overlap is not positive definite in banded eigensolver!\n");
+        arma::mat Linv(arma::inv(arma::trimatl(Ls)));
+        arma::mat v;
+        arma::eig_sym(e,v,arma::symmatu(Linv*Hs*arma::trans(Linv)));
+        X=Y*(arma::trans(Linv)*v);
+
+        // Residuals of the wanted pairs
+        arma::mat Xw(X.cols(0,neig-1));
+        arma::mat R(H*Xw-(S*Xw)*arma::diagmat(e.subvec(0,neig-1)));
+        double rmax(0.0);
+        for(size_t i=0;i<neig;i++)
+          rmax=std::max(rmax,arma::norm(R.col(i),2)/std::max(1.0,std::abs(e(i))));
+        if(rmax<convthr) {
+          E=e.subvec(0,neig-1);
+          C=Xw;
+          return;
+        }
+      }
+
+      std::ostringstream oss;
+      oss << "Banded eigensolver did not converge in " << maxit << " iterations!\n";
+      throw std::runtime_error(oss.str());
+    }
+  }
+}
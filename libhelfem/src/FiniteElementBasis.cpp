@@ -16,6 +16,7 @@
 
 #include "FiniteElementBasis.h"
 #include <cfloat>
+#include <sstream>
 
 namespace helfem {
   namespace polynomial_basis {
@@ -25,6 +26,35 @@ namespace helfem {
     FiniteElementBasis::FiniteElementBasis(const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly_,
                                            const arma::vec &bval_, bool zero_func_left_, bool zero_deriv_left_, bool zero_func_right_, bool zero_deriv_right_) : bval(bval_), zero_func_left(zero_func_left_), zero_deriv_left(zero_deriv_left_), zero_func_right(zero_func_right_), zero_deriv_right(zero_deriv_right_) {
       poly = std::shared_ptr<const polynomial_basis::PolynomialBasis>(poly_->copy());
+      polys.push_back(poly);
+      el_poly.zeros(bval.n_elem ? bval.n_elem-1 : 0);
+      // Update list of basis functions
+      update_bf_list();
+      // Check that basis functions are continuous
+      check_bf_continuity();
+    }
+
+    FiniteElementBasis::FiniteElementBasis(const std::vector<std::shared_ptr<const polynomial_basis::PolynomialBasis>> & polys_, const arma::uvec & el_poly_,
+                                           const arma::vec &bval_, bool zero_func_left_, bool zero_deriv_left_, bool zero_func_right_, bool zero_deriv_right_) : el_poly(el_poly_), bval(bval_), zero_func_left(zero_func_left_), zero_deriv_left(zero_deriv_left_), zero_func_right(zero_func_right_), zero_deriv_right(zero_deriv_right_) {
+      if(polys_.empty())
+        throw std::logic_error("No polynomial basis given!\n");
+      if(bval.n_elem<2 || el_poly.n_elem!=bval.n_elem-1) {
+        std::ostringstream oss;
+        oss << "Polynomial basis given for " << el_poly.n_elem << " elements, but there are " << (bval.n_elem ? bval.n_elem-1 : 0) << "!\n";
+        throw std::logic_error(oss.str());
+      }
+      if(arma::max(el_poly)>=polys_.size())
+        throw std::logic_error("Element polynomial basis index out of bounds!\n");
+      for(size_t i=0;i<polys_.size();i++) {
+        if(polys_[i]->get_noverlap() != polys_[0]->get_noverlap()) {
+          std::ostringstream oss;
+          oss << "Polynomial bases with " << polys_[0]->get_noverlap() << " and " << polys_[i]->get_noverlap() << " overlapping functions can't be joined!\n";
+          throw std::logic_error(oss.str());
+        }
+        polys.push_back(std::shared_ptr<const polynomial_basis::PolynomialBasis>(polys_[i]->copy()));
+      }
+      poly = polys[0];
+
       // Update list of basis functions
       update_bf_list();
       // Check that basis functions are continuous
@@ -52,6 +82,7 @@ namespace helfem {
     void FiniteElementBasis::check_bf_continuity() const {
       if(get_nelem()==1)
         return;
+      // The bases are required to have the same overlap
       int noverlap(poly->get_noverlap());
 
       arma::vec dnorm(get_nelem()-1);
@@ -130,7 +161,20 @@ namespace helfem {
         arma::vec newbval(bval.n_elem + 1);
         newbval.subvec(0, bval.n_elem - 1) = bval;
         newbval(bval.n_elem) = r;
-        bval = arma::sort(newbval, "ascend");
+        newbval = arma::sort(newbval, "ascend");
+
+        // The new elements inherit the basis of the old element
+        // they lie in; one beyond the ends takes that of the outermost
+        arma::uvec newpoly(newbval.n_elem - 1);
+        for (size_t iel = 0; iel < newpoly.n_elem; iel++) {
+          double mid(0.5 * (newbval(iel) + newbval(iel + 1)));
+          size_t iold(0);
+          while (iold + 1 < el_poly.n_elem && bval(iold + 1) <= mid)
+            iold++;
+          newpoly(iel) = el_poly(iold);
+        }
+        bval = newbval;
+        el_poly = newpoly;
         update_bf_list();
       }
     }
@@ -198,6 +242,28 @@ namespace helfem {
       return poly->get_nnodes();
     }
 
+    bool FiniteElementBasis::uniform_poly() const {
+      return el_poly.n_elem==0 || arma::all(el_poly==el_poly(0));
+    }
+
+    arma::ivec FiniteElementBasis::get_element_poly_id() const {
+      arma::ivec id(el_poly.n_elem);
+      for(size_t iel=0;iel<el_poly.n_elem;iel++)
+        id(iel)=polys[el_poly(iel)]->get_id();
+      return id;
+    }
+
+    arma::ivec FiniteElementBasis::get_element_poly_nnodes() const {
+      arma::ivec nnodes(el_poly.n_elem);
+      for(size_t iel=0;iel<el_poly.n_elem;iel++)
+        nnodes(iel)=polys[el_poly(iel)]->get_nnodes();
+      return nnodes;
+    }
+
+    size_t FiniteElementBasis::get_poly_nprim(size_t iel) const {
+      return polys[el_poly(iel)]->get_nprim();
+    }
+
     arma::uvec FiniteElementBasis::basis_indices(size_t iel) const {
       std::shared_ptr<polynomial_basis::PolynomialBasis> p(get_basis(iel));
       return p->get_enabled();
@@ -210,7 +276,7 @@ namespace helfem {
 
     std::shared_ptr<polynomial_basis::PolynomialBasis>
     FiniteElementBasis::get_basis(size_t iel) const {
-      std::shared_ptr<polynomial_basis::PolynomialBasis> p(poly->copy());
+      std::shared_ptr<polynomial_basis::PolynomialBasis> p(polys[el_poly(iel)]->copy());
       if (iel == 0)
         p->drop_first(zero_func_left, zero_deriv_left);
       if (iel == bval.n_elem - 2)
@@ -231,7 +297,15 @@ namespace helfem {
     }
 
     size_t FiniteElementBasis::get_max_nprim() const {
-      return poly->get_nprim();
+      int nprim(0);
+      for(size_t i=0;i<polys.size();i++)
+        nprim=std::max(nprim,polys[i]->get_nprim());
+      return nprim;
+    }
+
+    size_t FiniteElementBasis::get_bandwidth() const {
+      // Functions only couple within an element
+      return get_max_nprim()-1;
     }
 
     size_t FiniteElementBasis::get_nprim(size_t iel) const {
@@ -250,9 +324,86 @@ namespace helfem {
       eval_dnf(x,d2f,2,iel);
     }
 
+    void FiniteElementBasis::tabulate(const arma::vec & x, int nmax) {
+      tab_x=x;
+      tab_lpow.resize(polys.size());
+      tab_dnf.resize(polys.size());
+      // Evaluate the full primitive set at unit length; the subset of
+      // functions and the length scaling are applied per element
+      for(size_t ip=0;ip<polys.size();ip++) {
+        tab_lpow[ip]=polys[ip]->get_length_powers();
+        tab_dnf[ip].resize(nmax+1);
+        const arma::uvec enabled(polys[ip]->get_enabled());
+        for(int n=0;n<=nmax;n++) {
+          tab_dnf[ip][n].zeros(x.n_elem,polys[ip]->get_nprim());
+          tab_dnf[ip][n].cols(enabled)=polys[ip]->eval_dnf(x,n,1.0);
+        }
+      }
+    }
+
+    arma::vec FiniteElementBasis::subinterval_points(const arma::vec & x) {
+      const size_t Nq(x.n_elem);
+      arma::vec xs(Nq*Nq);
+      for(size_t ip=0;ip<Nq;ip++) {
+        double lo(ip ? x(ip-1) : -1.0);
+        double hi(x(ip));
+        xs.subvec(ip*Nq,(ip+1)*Nq-1)=0.5*(hi+lo)*arma::ones<arma::vec>(Nq)+0.5*(hi-lo)*x;
+      }
+      return xs;
+    }
+
+    void FiniteElementBasis::tabulate_subintervals(const arma::vec & x) {
+      tab_sub_x=x;
+      tab_lpow.resize(polys.size());
+      tab_sub_f.resize(polys.size());
+      const arma::vec xs(subinterval_points(x));
+      for(size_t ip=0;ip<polys.size();ip++) {
+        tab_lpow[ip]=polys[ip]->get_length_powers();
+        const arma::uvec enabled(polys[ip]->get_enabled());
+        tab_sub_f[ip].zeros(xs.n_elem,polys[ip]->get_nprim());
+        tab_sub_f[ip].cols(enabled)=polys[ip]->eval_dnf(xs,0,1.0);
+      }
+    }
+
+    arma::mat FiniteElementBasis::eval_subinterval_f(const arma::vec & x, size_t iel) const {
+      bool tabulated(x.n_elem==tab_sub_x.n_elem && tab_sub_f.size()==polys.size());
+      for(size_t i=0;tabulated && i<x.n_elem;i++)
+        if(x(i)!=tab_sub_x(i))
+          tabulated=false;
+      if(tabulated)
+        return scale_tabulated(tab_sub_f[el_poly(iel)],0,iel);
+      return get_basis(iel)->eval_dnf(subinterval_points(x),0,scaling_factor(iel));
+    }
+
+    arma::mat FiniteElementBasis::scale_tabulated(const arma::mat & tab, int n, size_t iel) const {
+      const arma::uvec enabled(get_basis(iel)->get_enabled());
+      const arma::ivec & lpow(tab_lpow[el_poly(iel)]);
+      const double length(scaling_factor(iel));
+      arma::mat dnf(tab.cols(enabled));
+      // Primitive j scales as length^(p(j)-n)
+      for(size_t i=0;i<enabled.n_elem;i++) {
+        int pw=lpow(enabled(i))-n;
+        if(pw!=0)
+          dnf.col(i)*=std::pow(length,pw);
+      }
+      return dnf;
+    }
+
+    bool FiniteElementBasis::is_tabulated(const arma::vec & x, int n) const {
+      if(n<0 || tab_dnf.size()!=polys.size() || (size_t) n>=tab_dnf[0].size() || x.n_elem!=tab_x.n_elem)
+        return false;
+      // Must be exactly the same points
+      for(size_t i=0;i<x.n_elem;i++)
+        if(x(i)!=tab_x(i))
+          return false;
+      return true;
+    }
+
     void FiniteElementBasis::eval_dnf(const arma::vec & x, arma::mat & dnf, int n, size_t iel) const {
-      std::shared_ptr<polynomial_basis::PolynomialBasis> p(get_basis(iel));
-      p->eval_dnf(x,dnf,n,scaling_factor(iel));
+      if(is_tabulated(x,n))
+        dnf=scale_tabulated(tab_dnf[el_poly(iel)][n],n,iel);
+      else
+        get_basis(iel)->eval_dnf(x,dnf,n,scaling_factor(iel));
     }
 
     arma::mat FiniteElementBasis::eval_f(const arma::vec & x, size_t iel) const {
@@ -268,8 +419,9 @@ namespace helfem {
     }
 
     arma::mat FiniteElementBasis::eval_dnf(const arma::vec & x, int n, size_t iel) const {
-      std::shared_ptr<polynomial_basis::PolynomialBasis> p(get_basis(iel));
-      return p->eval_dnf(x,n,scaling_factor(iel));
+      arma::mat dnf;
+      eval_dnf(x,dnf,n,iel);
+      return dnf;
     }
 
     arma::mat FiniteElementBasis::matrix_element(const std::function<arma::mat(arma::vec,size_t)> & eval_lh, const std::function<arma::mat(arma::vec,size_t)> & eval_rh, const arma::vec & xq, const arma::vec & wq, const std::function<double(double)> & f) const {
@@ -282,6 +434,10 @@ namespace helfem {
         matel[iel] = matrix_element(iel, eval_lh, eval_rh, xq, wq, f);
       }
 
+      return assemble(matel);
+    }
+
+    arma::mat FiniteElementBasis::assemble(const std::vector<arma::mat> & matel) const {
       // Fill in the global matrix
       arma::mat M(get_nbf(),get_nbf(),arma::fill::zeros);
       for(size_t iel=0; iel<get_nelem(); iel++) {
@@ -296,28 +452,65 @@ namespace helfem {
       return M;
     }
 
-    arma::vec FiniteElementBasis::vector_element(const std::function<arma::mat(arma::vec,size_t)> & eval, const arma::vec & xq, const arma::vec & wq, const std::function<double(double)> & f) const {
+    arma::vec FiniteElementBasis::assemble(const std::vector<arma::vec> & vecel) const {
+      // Fill in the global vector
+      arma::vec V(get_nbf(),arma::fill::zeros);
+      for(size_t iel=0; iel<get_nelem(); iel++) {
+        // Indices in matrix
+        size_t ifirst, ilast;
+        get_idx(iel, ifirst, ilast);
+
+        // Accumulate
+        V.subvec(ifirst, ilast) += vecel[iel];
+      }
+
+      return V;
+    }
+
+    BandedMatrix FiniteElementBasis::matrix_element_banded(const std::function<arma::mat(arma::vec,size_t)> & eval_lh, const std::function<arma::mat(arma::vec,size_t)> & eval_rh, const arma::vec & xq, const arma::vec & wq, const std::function<double(double)> & f) const {
       // Compute matrix elements in parallel
-      std::vector<arma::vec> vecel(get_nelem());
+      std::vector<arma::mat> matel(get_nelem());
 #ifdef _OPENMP
 #pragma omp parallel for
 #endif
       for(size_t iel=0; iel<get_nelem(); iel++) {
-        vecel[iel] = vector_element(iel, eval, xq, wq, f);
+        matel[iel] = matrix_element(iel, eval_lh, eval_rh, xq, wq, f);
       }
 
-      // Fill in the global vector
-      arma::vec V(get_nbf(),arma::fill::zeros);
+      return assemble_banded(matel);
+    }
+
+    BandedMatrix FiniteElementBasis::assemble_banded(const std::vector<arma::mat> & matel) const {
+      if(matel.size() != get_nelem()) {
+        std::ostringstream oss;
+        oss << "Got " << matel.size() << " element matrices but there are " << get_nelem() << " elements!\n";
+        throw std::logic_error(oss.str());
+      }
+
+      BandedMatrix M(get_nbf(),get_bandwidth());
       for(size_t iel=0; iel<get_nelem(); iel++) {
         // Indices in matrix
         size_t ifirst, ilast;
         get_idx(iel, ifirst, ilast);
 
         // Accumulate
-        V.subvec(ifirst, ilast) += vecel[iel];
+        M.add_block(ifirst, matel[iel]);
       }
 
-      return V;
+      return M;
+    }
+
+    arma::vec FiniteElementBasis::vector_element(const std::function<arma::mat(arma::vec,size_t)> & eval, const arma::vec & xq, const arma::vec & wq, const std::function<double(double)> & f) const {
+      // Compute matrix elements in parallel
+      std::vector<arma::vec> vecel(get_nelem());
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+      for(size_t iel=0; iel<get_nelem(); iel++) {
+        vecel[iel] = vector_element(iel, eval, xq, wq, f);
+      }
+
+      return assemble(vecel);
     }
 
     arma::mat FiniteElementBasis::matrix_element(int lhder, int rhder, const arma::vec & xq, const arma::vec & wq, const std::function<double(double)> & f) const {
@@ -326,23 +519,92 @@ namespace helfem {
       return matrix_element(eval_lh, eval_rh, xq, wq, f);
     }
 
+    BandedMatrix FiniteElementBasis::matrix_element_banded(int lhder, int rhder, const arma::vec & xq, const arma::vec & wq, const std::function<double(double)> & f) const {
+      std::function<arma::mat(const arma::vec &,size_t)> eval_lh = [this,lhder](const arma::vec & x, size_t iel) {return this->eval_dnf(x, lhder, iel);};
+      std::function<arma::mat(const arma::vec &,size_t)> eval_rh = [this,rhder](const arma::vec & x, size_t iel) {return this->eval_dnf(x, rhder, iel);};
+      return matrix_element_banded(eval_lh, eval_rh, xq, wq, f);
+    }
+
     arma::mat FiniteElementBasis::matrix_element(size_t iel, int lhder, int rhder, const arma::vec & xq, const arma::vec & wq, const std::function<double(double)> & f) const {
       std::function<arma::mat(const arma::vec &,size_t)> eval_lh = [this,lhder](const arma::vec & x, size_t iel) {return this->eval_dnf(x, lhder, iel);};
       std::function<arma::mat(const arma::vec &,size_t)> eval_rh = [this,rhder](const arma::vec & x, size_t iel) {return this->eval_dnf(x, rhder, iel);};
       return matrix_element(iel, eval_lh, eval_rh, xq, wq, f);
     }
 
-    arma::mat FiniteElementBasis::matrix_element(size_t iel, const std::function<arma::mat(arma::vec,size_t)> & eval_lh, const std::function<arma::mat(arma::vec,size_t)> & eval_rh, const arma::vec & xq, const arma::vec & wq, const std::function<double(double)> & f) const {
-      // Get coordinate values
-      arma::vec r(eval_coord(xq, iel));
+    arma::mat FiniteElementBasis::matrix_element_vectorized(int lhder, int rhder, const arma::vec & xq, const arma::vec & wq, const vectorized_weight_t & f) const {
+      std::vector<arma::mat> matel(get_nelem());
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+      for(size_t iel=0; iel<get_nelem(); iel++) {
+        matel[iel] = matrix_element_vectorized(iel, lhder, rhder, xq, wq, f);
+      }
+      return assemble(matel);
+    }
+
+    arma::mat FiniteElementBasis::matrix_element_vectorized(size_t iel, int lhder, int rhder, const arma::vec & xq, const arma::vec & wq, const vectorized_weight_t & f) const {
+      std::function<arma::mat(const arma::vec &,size_t)> eval_lh = [this,lhder](const arma::vec & x, size_t iel) {return this->eval_dnf(x, lhder, iel);};
+      std::function<arma::mat(const arma::vec &,size_t)> eval_rh = [this,rhder](const arma::vec & x, size_t iel) {return this->eval_dnf(x, rhder, iel);};
+      return matrix_element_vectorized(iel, eval_lh, eval_rh, xq, wq, f);
+    }
+
+    arma::mat FiniteElementBasis::matrix_element_weighted(size_t iel, int lhder, int rhder, const arma::vec & xq, const arma::vec & wq, const arma::vec & fq) const {
+      if(fq.n_elem != xq.n_elem) {
+        std::ostringstream oss;
+        oss << "Weight function has " << fq.n_elem << " values but there are " << xq.n_elem << " quadrature points!\n";
+        throw std::logic_error(oss.str());
+      }
+      // Calculate total weight per point
+      arma::vec wp(wq%fq*scaling_factor(iel));
+
+      // Evaluate basis functions
+      arma::mat lhbf(eval_dnf(xq, lhder, iel));
+      arma::mat rhbf(eval_dnf(xq, rhder, iel));
+      // Include weight in the lh operand
+      for(size_t i=0;i<lhbf.n_cols;i++)
+        lhbf.col(i)%=wp;
+
+      return arma::trans(lhbf)*rhbf;
+    }
+
+    arma::vec FiniteElementBasis::element_weights(size_t iel, const arma::vec & xq, const arma::vec & wq, const std::function<double(double)> & f) const {
       // Calculate total weight per point
       arma::vec wp(wq*scaling_factor(iel));
       // Include the function
       if(f) {
-          for(size_t i=0; i<wp.n_elem; i++)
-            wp(i)*=f(r(i));
+        // Get coordinate values
+        arma::vec r(eval_coord(xq, iel));
+        for(size_t i=0; i<wp.n_elem; i++)
+          wp(i)*=f(r(i));
       }
+      return wp;
+    }
 
+    arma::vec FiniteElementBasis::element_weights(size_t iel, const arma::vec & xq, const arma::vec & wq, const vectorized_weight_t & f) const {
+      // Calculate total weight per point
+      arma::vec wp(wq*scaling_factor(iel));
+      // Include the function
+      if(f) {
+        arma::vec fq(f(eval_coord(xq, iel)));
+        if(fq.n_elem != wp.n_elem) {
+          std::ostringstream oss;
+          oss << "Weight function returned " << fq.n_elem << " values but there are " << wp.n_elem << " quadrature points!\n";
+          throw std::logic_error(oss.str());
+        }
+        wp%=fq;
+      }
+      return wp;
+    }
+
+    arma::mat FiniteElementBasis::matrix_element(size_t iel, const std::function<arma::mat(arma::vec,size_t)> & eval_lh, const std::function<arma::mat(arma::vec,size_t)> & eval_rh, const arma::vec & xq, const arma::vec & wq, const std::function<double(double)> & f) const {
+      return element_matrix(iel, eval_lh, eval_rh, xq, element_weights(iel, xq, wq, f));
+    }
+
+    arma::mat FiniteElementBasis::matrix_element_vectorized(size_t iel, const std::function<arma::mat(arma::vec,size_t)> & eval_lh, const std::function<arma::mat(arma::vec,size_t)> & eval_rh, const arma::vec & xq, const arma::vec & wq, const vectorized_weight_t & f) const {
+      return element_matrix(iel, eval_lh, eval_rh, xq, element_weights(iel, xq, wq, f));
+    }
+
+    arma::mat FiniteElementBasis::element_matrix(size_t iel, const std::function<arma::mat(arma::vec,size_t)> & eval_lh, const std::function<arma::mat(arma::vec,size_t)> & eval_rh, const arma::vec & xq, const arma::vec & wp) const {
       // Evaluate basis functions
       if(!eval_lh)
         throw std::logic_error("Need function for evaluating left-hand basis functions!\n");
@@ -359,22 +621,21 @@ namespace helfem {
     }
 
     arma::vec FiniteElementBasis::vector_element(size_t iel, const std::function<arma::mat(arma::vec,size_t)> & eval_bf, const arma::vec & xq, const arma::vec & wq, const std::function<double(double)> & f) const {
-      // Get coordinate values
-      arma::vec r(eval_coord(xq, iel));
-      // Calculate total weight per point
-      arma::vec wp(wq*scaling_factor(iel));
-      // Include the function
-      if(f) {
-          for(size_t i=0; i<wp.n_elem; i++)
-            wp(i)*=f(r(i));
-      }
+      // Evaluate basis functions
+      if(!eval_bf)
+        throw std::logic_error("Need function for evaluating basis functions!\n");
+      arma::mat bf = eval_bf(xq, iel);
+
+      return bf.t()*element_weights(iel, xq, wq, f);
+    }
 
+    arma::vec FiniteElementBasis::vector_element_vectorized(size_t iel, const std::function<arma::mat(arma::vec,size_t)> & eval_bf, const arma::vec & xq, const arma::vec & wq, const vectorized_weight_t & f) const {
       // Evaluate basis functions
       if(!eval_bf)
         throw std::logic_error("Need function for evaluating basis functions!\n");
       arma::mat bf = eval_bf(xq, iel);
 
-      return bf.t()*wp;
+      return bf.t()*element_weights(iel, xq, wq, f);
     }
 
     arma::vec FiniteElementBasis::vector_element(int der, const arma::vec & xq, const arma::vec & wq, const std::function<double(double)> & f) const {
@@ -387,6 +648,22 @@ namespace helfem {
       return vector_element(iel, eval_f, xq, wq, f);
     }
 
+    arma::vec FiniteElementBasis::vector_element_vectorized(int der, const arma::vec & xq, const arma::vec & wq, const vectorized_weight_t & f) const {
+      std::vector<arma::vec> vecel(get_nelem());
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+      for(size_t iel=0; iel<get_nelem(); iel++) {
+        vecel[iel] = vector_element_vectorized(iel, der, xq, wq, f);
+      }
+      return assemble(vecel);
+    }
+
+    arma::vec FiniteElementBasis::vector_element_vectorized(size_t iel, int der, const arma::vec & xq, const arma::vec & wq, const vectorized_weight_t & f) const {
+      std::function<arma::mat(const arma::vec &,size_t)> eval_f = [this,der](const arma::vec & x, size_t iel) {return this->eval_dnf(x, der, iel);};
+      return vector_element_vectorized(iel, eval_f, xq, wq, f);
+    }
+
     void FiniteElementBasis::print(const std::string & str) const {
       printf("%s",str.c_str());
       bval.print("bval");
@@ -36,6 +36,19 @@ namespace helfem {
       }
     }
 
+    void GaussianNucleus::V(const arma::vec & R, arma::vec & out) const {
+      const double taylorfac(-Z*M_2_SQRTPI*mu);
+      out.zeros(R.n_elem);
+      for(size_t i=0;i<R.n_elem;i++) {
+        if(R(i) <= Rcut) {
+          double mur2 = std::pow(mu*R(i),2);
+          out(i) = taylorfac*( 1.0 + (-1.0/3.0 + (1.0/10.0 - 1.0/42.0*mur2)*mur2)*mur2);
+        } else {
+          out(i) = -Z*erf(mu*R(i))/R(i);
+        }
+      }
+    }
+
     double GaussianNucleus::get_mu() const {
       return mu;
     }
@@ -87,6 +87,14 @@ namespace helfem {
       }
     }
 
+    arma::ivec GeneralHIPBasis::get_length_powers() const {
+      arma::ivec p(nprim,arma::fill::zeros);
+      for(int inode=0; inode<nnodes; inode++)
+        for(int ider=1;ider<=nder;ider++)
+          p((nder+1)*inode+ider)=ider;
+      return p;
+    }
+
     void GeneralHIPBasis::eval_prim_dnf(const arma::vec & x, arma::mat & dnf, int n, double element_length) const {
       // Evaluate the primitive LIP polynomials
       lip.eval_prim_dnf(x, dnf, n, dummy_length);
@@ -50,6 +50,8 @@ namespace helfem {
 
       /// Evaluate polynomials at given points
       void eval_prim_dnf(const arma::vec & x, arma::mat & dnf, int n, double element_length) const override;
+      /// The ith derivative functions carry i powers of the element length
+      arma::ivec get_length_powers() const override;
 
       /// Return polynomial nodes
       arma::vec get_nodes() const override;
@@ -26,6 +26,13 @@ namespace helfem {
       return new HIPBasis(*this);
     }
 
+    arma::ivec HIPBasis::get_length_powers() const {
+      arma::ivec p(nprim,arma::fill::zeros);
+      for(size_t fi=0;fi<x0.n_elem;fi++)
+        p(2*fi+1)=1;
+      return p;
+    }
+
     void HIPBasis::drop_first(bool func, bool deriv) {
       if(func && deriv) {
         // Drop both function and derivative
@@ -42,6 +42,8 @@ namespace helfem {
 
       /// Evaluate the basis functions
       void eval_prim_dnf(const arma::vec & x, arma::mat & dnf, int n, double element_length) const override;
+      /// The derivative functions carry one power of the element length
+      arma::ivec get_length_powers() const override;
     };
   }
 }
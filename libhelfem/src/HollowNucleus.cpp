@@ -31,6 +31,11 @@ namespace helfem {
       }
     }
 
+    void HollowNucleus::V(const arma::vec & r, arma::vec & out) const {
+      // The potential is constant inside the shell
+      out=-((double) Z)/arma::clamp(r,R,arma::datum::inf);
+    }
+
     double HollowNucleus::get_R() const {
       return R;
     }
@@ -1,5 +1,7 @@
 #include "LIPBasis.h"
+#include <algorithm>
 #include <cfloat>
+#include <sstream>
 
 namespace helfem {
   namespace polynomial_basis {
@@ -27,6 +29,133 @@ namespace helfem {
       id=id_;
       /// Number of nodes is
       nnodes=enabled.n_elem;
+
+      // Precompute the derivative data
+      form_differentiation();
+    }
+
+    void LIPBasis::form_differentiation() {
+      const size_t N(x0.n_elem);
+
+      // Barycentric weights
+      bw.ones(N);
+      for(size_t j=0;j<N;j++)
+        for(size_t k=0;k<N;k++)
+          if(k!=j)
+            bw(j)/=x0(j)-x0(k);
+
+      // Differentiation matrix D(k,j) = l_j'(x_k). The diagonal is
+      // given by the negative sum trick, since the derivatives of the
+      // polynomials sum up to zero
+      arma::mat D(N,N,arma::fill::zeros);
+      for(size_t k=0;k<N;k++) {
+        for(size_t j=0;j<N;j++)
+          if(j!=k)
+            D(k,j)=bw(j)/(bw(k)*(x0(k)-x0(j)));
+        D(k,k)=-arma::sum(D.row(k));
+      }
+
+      // The nth derivatives are polynomials of lower degree, which
+      // are reproduced exactly by interpolation from their nodal
+      // values: l_j^(n)(x) = sum_k l_k(x) (D^n)(k,j). Derivatives of
+      // order N and higher vanish identically.
+      Dpow.resize(N);
+      if(N)
+        Dpow[0].eye(N,N);
+      for(size_t n=1;n<N;n++)
+        Dpow[n]=D*Dpow[n-1];
+    }
+
+    /**
+     * Product form l_j(x) = bw(j) prod_{k!=j} (x-x0(k)), which is
+     * well-behaved also at the nodes. The products over k<j and k>j
+     * are accumulated in a forward and a backward sweep over the
+     * nodes, so the cost is O(N) per point instead of O(N^2). The
+     * innermost loops run over the contiguous points, and for N>0 the
+     * node loops have compile-time trip counts and get unrolled; N=0
+     * uses the runtime number of nodes.
+     */
+    template<size_t N>
+    static void lip_kernel(const double * x, size_t nx, const double * x0, const double * bw, size_t nnodes, double * f) {
+      const size_t nn(N ? N : nnodes);
+
+      // Forward sweep: f(:,j) = prod_{k<j} (x-x0(k))
+      std::vector<double> acc(nx, 1.0);
+      for(size_t j=0;j<nn;j++) {
+        double * fj = f + j*nx;
+        const double xj(x0[j]);
+        for(size_t ix=0;ix<nx;ix++) {
+          fj[ix]=acc[ix];
+          acc[ix]*=x[ix]-xj;
+        }
+      }
+
+      // Backward sweep: multiply in bw(j) prod_{k>j} (x-x0(k))
+      std::fill(acc.begin(), acc.end(), 1.0);
+      for(size_t j=nn;j-->0;) {
+        double * fj = f + j*nx;
+        const double xj(x0[j]);
+        const double bwj(bw[j]);
+        for(size_t ix=0;ix<nx;ix++) {
+          fj[ix]*=bwj*acc[ix];
+          acc[ix]*=x[ix]-xj;
+        }
+      }
+    }
+
+    arma::mat LIPBasis::eval_lip(const arma::vec & x) const {
+      arma::mat f(x.n_elem,x0.n_elem);
+      // Specialized kernels for the commonly used numbers of nodes
+      switch(x0.n_elem) {
+      case(10):
+        lip_kernel<10>(x.memptr(), x.n_elem, x0.memptr(), bw.memptr(), x0.n_elem, f.memptr());
+        break;
+      case(15):
+        lip_kernel<15>(x.memptr(), x.n_elem, x0.memptr(), bw.memptr(), x0.n_elem, f.memptr());
+        break;
+      case(20):
+        lip_kernel<20>(x.memptr(), x.n_elem, x0.memptr(), bw.memptr(), x0.n_elem, f.memptr());
+        break;
+      default:
+        lip_kernel<0>(x.memptr(), x.n_elem, x0.memptr(), bw.memptr(), x0.n_elem, f.memptr());
+      }
+      return f;
+    }
+
+    void LIPBasis::eval_prim_dnf(const arma::vec & x, arma::mat & dnf, int n, double element_length) const {
+      (void) element_length;
+      if(n<0) {
+        std::ostringstream oss;
+        oss << "Invalid derivative order " << n << "!\n";
+        throw std::logic_error(oss.str());
+      }
+
+      if((size_t) n>=x0.n_elem)
+        dnf.zeros(x.n_elem,x0.n_elem);
+      else if(n==0)
+        dnf=eval_lip(x);
+      else
+        dnf=eval_lip(x)*Dpow[n];
+    }
+
+    void LIPBasis::eval_prim_dnf_all(const arma::vec & x, std::vector<arma::mat> & dnf, int nmax) const {
+      if(nmax<0) {
+        std::ostringstream oss;
+        oss << "Invalid derivative order " << nmax << "!\n";
+        throw std::logic_error(oss.str());
+      }
+
+      // The function values are shared by all derivative orders
+      arma::mat f(eval_lip(x));
+      dnf.resize(nmax+1);
+      for(int n=0;n<=nmax;n++) {
+        if((size_t) n>=x0.n_elem)
+          dnf[n].zeros(x.n_elem,x0.n_elem);
+        else if(n==0)
+          dnf[n]=f;
+        else
+          dnf[n]=f*Dpow[n];
+      }
     }
 
     LIPBasis::~LIPBasis() {
@@ -18,6 +18,7 @@
 
 #include "PolynomialBasis.h"
 #include <armadillo>
+#include <vector>
 
 namespace helfem {
   namespace polynomial_basis {
@@ -26,6 +27,15 @@ namespace helfem {
     protected:
       /// Control nodes
       arma::vec x0;
+      /// Barycentric weights 1/prod_{k!=j} (x0(j)-x0(k))
+      arma::vec bw;
+      /// Powers of the nodal differentiation matrix: Dpow[n](k,j) is
+      /// the nth derivative of the jth polynomial at the kth node
+      std::vector<arma::mat> Dpow;
+      /// Form the barycentric weights and differentiation matrices
+      void form_differentiation();
+      /// Evaluate the polynomials at given points
+      arma::mat eval_lip(const arma::vec & x) const;
     public:
       /// Dummy constructor
       LIPBasis();
@@ -43,6 +53,8 @@ namespace helfem {
 
       /// Evaluate polynomials at given points
       void eval_prim_dnf(const arma::vec & x, arma::mat & dnf, int n, double element_length) const override;
+      /// Evaluate all derivatives up to order nmax at given points in one pass
+      void eval_prim_dnf_all(const arma::vec & x, std::vector<arma::mat> & dnf, int nmax) const;
 
       /// Return nodes
       arma::vec get_nodes() const override;
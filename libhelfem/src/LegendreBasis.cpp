@@ -1,5 +1,4 @@
 #include "LegendreBasis.h"
-#include "orthpoly.h"
 
 // Legendre polynomials
 extern "C" {
@@ -35,6 +34,9 @@ namespace helfem {
 
       /// Identifier is
       id=id_;
+
+      // Precompute the derivative coefficients
+      form_derivatives();
     }
 
     LegendreBasis::~LegendreBasis() {
@@ -50,53 +52,70 @@ namespace helfem {
       return x;
     }
 
+    void LegendreBasis::form_derivatives() {
+      // Derivative in the Legendre basis, P_l' = sum_{k<l, l-k odd} (2k+1) P_k
+      arma::mat D(lmax+1,lmax+1,arma::fill::zeros);
+      for(int l=1;l<=lmax;l++)
+        for(int k=l-1;k>=0;k-=2)
+          D(k,l)=2*k+1;
+
+      // Expansion coefficients of the derivatives of the shape
+      // functions; derivatives of order lmax+1 and higher vanish
+      Tder.resize(lmax+1);
+      Tder[0]=T;
+      for(int n=1;n<=lmax;n++)
+        Tder[n]=D*Tder[n-1];
+    }
+
     arma::mat LegendreBasis::f_eval(const arma::vec & x) const {
       // Memory for values
       arma::mat ft(x.n_elem,lmax+1);
-      // Fill in array
-      for(int l=0;l<=lmax;l++)
+      // Bonnet recursion l P_l = (2l-1) x P_{l-1} - (l-1) P_{l-2},
+      // run column-wise over all points at once
+      ft.col(0).ones();
+      if(lmax>=1)
+        ft.col(1)=x;
+      for(int l=2;l<=lmax;l++) {
+        const double * pm1 = ft.colptr(l-1);
+        const double * pm2 = ft.colptr(l-2);
+        double * p = ft.colptr(l);
+        const double c1((2.0*l-1.0)/l), c2((l-1.0)/l);
         for(size_t i=0;i<x.n_elem;i++)
-          ft(i,l) = oomph::Orthpoly::legendre(l, x(i));
+          p[i] = c1*x(i)*pm1[i] - c2*pm2[i];
+      }
       return ft;
     }
 
-    arma::mat LegendreBasis::df_eval(const arma::vec & x) const {
-      // Memory for values
-      arma::mat dt(x.n_elem,lmax+1);
-      // Fill in array
-      for(int l=0;l<=lmax;l++)
-        for(size_t i=0;i<x.n_elem;i++)
-          dt(i,l) = oomph::Orthpoly::dlegendre(l, x(i));
-      return dt;
-    }
+    void LegendreBasis::eval_prim_dnf(const arma::vec & x, arma::mat & dnf, int n, double element_length) const {
+      (void) element_length;
+      if(n<0) {
+        std::ostringstream oss;
+        oss << "Invalid derivative order " << n << "!\n";
+        throw std::logic_error(oss.str());
+      }
 
-    arma::mat LegendreBasis::d2f_eval(const arma::vec & x) const {
-      // Memory for values
-      arma::mat lt(x.n_elem,lmax+1);
-      // Fill in array
-      for(int l=0;l<=lmax;l++)
-        for(size_t i=0;i<x.n_elem;i++)
-          lt(i,l) = oomph::Orthpoly::ddlegendre(l, x(i));
-      return lt;
+      if(n>lmax)
+        dnf.zeros(x.n_elem,T.n_cols);
+      else
+        dnf=f_eval(x)*Tder[n];
     }
 
-    void LegendreBasis::eval_prim_dnf(const arma::vec & x, arma::mat & dnf, int n, double element_length) const {
-      (void) element_length;
-      switch(n) {
-      case(0):
-        dnf=f_eval(x)*T;
-        break;
-      case(1):
-        dnf=df_eval(x)*T;
-        break;
-      case(2):
-        dnf=d2f_eval(x)*T;
-        break;
-      default:
+    void LegendreBasis::eval_prim_dnf_all(const arma::vec & x, std::vector<arma::mat> & dnf, int nmax) const {
+      if(nmax<0) {
         std::ostringstream oss;
-        oss << n << "th order derivatives not implemented for Legendre basis functions!\n";
+        oss << "Invalid derivative order " << nmax << "!\n";
         throw std::logic_error(oss.str());
       }
+
+      // The Legendre table is shared by all derivative orders
+      arma::mat ft(f_eval(x));
+      dnf.resize(nmax+1);
+      for(int n=0;n<=nmax;n++) {
+        if(n>lmax)
+          dnf[n].zeros(x.n_elem,T.n_cols);
+        else
+          dnf[n]=ft*Tder[n];
+      }
     }
 
     void LegendreBasis::drop_first(bool func, bool deriv) {
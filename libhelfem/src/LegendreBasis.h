@@ -18,6 +18,7 @@
 
 #include "PolynomialBasis.h"
 #include <armadillo>
+#include <vector>
 
 namespace helfem {
   namespace polynomial_basis {/// Legendre functions
@@ -27,13 +28,14 @@ namespace helfem {
       int lmax;
       /// Transformation matrix
       arma::mat T;
+      /// Legendre expansion coefficients of the nth derivatives of
+      /// the shape functions, Tder[n] = D^n T
+      std::vector<arma::mat> Tder;
 
+      /// Form the derivative coefficient matrices
+      void form_derivatives();
       /// Evaluate Legendre polynomials
       arma::mat f_eval(const arma::vec & x) const;
-      /// Evaluate Legendre polynomials' derivatives
-      arma::mat df_eval(const arma::vec & x) const;
-      /// Evaluate Legendre polynomials' second derivatives
-      arma::mat d2f_eval(const arma::vec & x) const;
     public:
       /// Constructor
       LegendreBasis(int nfuncs, int id=3);
@@ -49,6 +51,8 @@ namespace helfem {
 
       /// Evaluate polynomials at given points
       void eval_prim_dnf(const arma::vec & x, arma::mat & f, int n, double element_length) const override;
+      /// Evaluate all derivatives up to order nmax at given points in one pass
+      void eval_prim_dnf_all(const arma::vec & x, std::vector<arma::mat> & dnf, int nmax) const;
     };
   }
 }
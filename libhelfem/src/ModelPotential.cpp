@@ -23,10 +23,15 @@ namespace helfem {
     ModelPotential::~ModelPotential() {
     }
 
-    arma::vec ModelPotential::V(const arma::vec & r) const {
-      arma::vec pot(r.n_elem);
+    void ModelPotential::V(const arma::vec & r, arma::vec & out) const {
+      out.zeros(r.n_elem);
       for(size_t i=0;i<r.n_elem;i++)
-        pot(i)=V(r(i));
+        out(i)=V(r(i));
+    }
+
+    arma::vec ModelPotential::V(const arma::vec & r) const {
+      arma::vec pot;
+      V(r,pot);
       return pot;
     }
   }
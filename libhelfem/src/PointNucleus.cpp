@@ -26,5 +26,9 @@ namespace helfem {
     double PointNucleus::V(double R) const {
       return -Z/R;
     }
+
+    void PointNucleus::V(const arma::vec & R, arma::vec & out) const {
+      out=-((double) Z)/R;
+    }
   }
 }
@@ -136,6 +136,11 @@ namespace helfem {
       df.save(dname,arma::raw_ascii);
     }
 
+    arma::ivec PolynomialBasis::get_length_powers() const {
+      arma::ivec p(nprim,arma::fill::zeros);
+      return p;
+    }
+
     arma::mat PolynomialBasis::eval_dnf(const arma::vec & x, int n, double element_length) const {
       arma::mat dnf;
       eval_dnf(x, dnf, n, element_length);
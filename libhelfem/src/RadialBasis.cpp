@@ -16,6 +16,7 @@
 #include "RadialBasis.h"
 #include "RadialPotential.h"
 #include "chebyshev.h"
+#include "erfc_expn.h"
 #include "quadrature.h"
 #include "utils.h"
 #include <cfloat>
@@ -38,6 +39,9 @@ namespace helfem {
           if (!std::isfinite(wq[i]))
             printf("wq[%i]=%e\n", (int)i, wq[i]);
         }
+        // The basis functions are always evaluated at the same nodes
+        fem.tabulate(xq, 2);
+        fem.tabulate_subintervals(xq);
 
         // Compute Taylor series at the origin
         arma::vec origin(1);
@@ -51,9 +55,44 @@ namespace helfem {
           // first derivative etc.
           taylor_df[i] = fem.eval_dnf(origin, i+1, iel);
         }
+        form_taylor_coeff();
 
         // Adjust cutoff
         set_small_r_taylor_cutoff();
+
+        // The quadrature points are fixed, so the first element, where
+        // the Taylor series is used, is only evaluated once
+        bf_first=get_bf(xq, 0);
+        df_first=get_df(xq, 0);
+        lf_first=get_lf(xq, 0);
+      }
+
+      void RadialBasis::form_taylor_coeff() {
+        // The series of B(r)/r is
+        //  [B(0) + B'(0)r + 1/2 B''(0) r^2 + ...]/r
+        //= B'(0) + 1/2 B''(0) r + 1/6 B'''(0) r^2 + ...
+        // so the zeroth term already corresponds to the first derivative
+        arma::vec fcoeff(taylor_order);
+        if(taylor_order>0)
+          fcoeff(0) = 1.0;
+        for(int i=1; i<taylor_order; i++)
+          fcoeff(i) = fcoeff(i-1)/(i+1);
+
+        // Differentiating c r^n gives c n r^(n-1), so the terms below
+        // ider vanish, and row k holds the coefficients of r^k
+        size_t nfun(taylor_order>0 ? taylor_df[0].n_elem : 0);
+        taylor_coeff.resize(3);
+        for(int ider=0; ider<3; ider++) {
+          int nterms(std::max(taylor_order-ider,0));
+          taylor_coeff[ider].zeros(nterms, nfun);
+          for(int k=0; k<nterms; k++) {
+            int i(k+ider);
+            double c(fcoeff(i));
+            for(int d=0; d<ider; d++)
+              c *= i-d;
+            taylor_coeff[ider].row(k) = c*taylor_df[i];
+          }
+        }
       }
 
       void RadialBasis::set_small_r_taylor_cutoff() {
@@ -174,6 +213,18 @@ namespace helfem {
         return fem.get_poly_nnodes();
       }
 
+      bool RadialBasis::uniform_poly() const {
+        return fem.uniform_poly();
+      }
+
+      arma::ivec RadialBasis::get_element_poly_id() const {
+        return fem.get_element_poly_id();
+      }
+
+      arma::ivec RadialBasis::get_element_poly_nnodes() const {
+        return fem.get_element_poly_nnodes();
+      }
+
       double RadialBasis::get_small_r_taylor_cutoff() const {
         return small_r_taylor_cutoff;
       }
@@ -187,16 +238,78 @@ namespace helfem {
       }
 
       arma::mat RadialBasis::radial_integral(int Rexp, size_t iel) const {
-        std::function<double(double)> rpowL = [Rexp](double r){return std::pow(r,Rexp+2);};
+        polynomial_basis::vectorized_weight_t rpowL = [Rexp](const arma::vec & r){return arma::vec(arma::pow(r,Rexp+2));};
         std::function<arma::mat(const arma::vec &,size_t)> radial_bf;
         radial_bf = [this](const arma::vec & xq_, size_t iel_) { return this->get_bf(xq_, iel_); };
-        arma::mat ret(fem.matrix_element(iel, radial_bf, radial_bf, xq, wq, rpowL));
+        arma::mat ret(fem.matrix_element_vectorized(iel, radial_bf, radial_bf, xq, wq, rpowL));
         if(ret.has_nan()) {
           printf("radial_integral(%i,%i) has NaN!\n",Rexp,(int) iel);
         }
         return ret;
       }
 
+      void RadialBasis::radial_moments(int Lmax, size_t iel, std::vector<arma::mat> & rL, std::vector<arma::mat> & rm1L) const {
+        // The basis functions are evaluated only once
+        arma::mat bf(get_bf(iel));
+        arma::vec r(get_r(iel));
+        arma::vec rinv(arma::ones<arma::vec>(r.n_elem)/r);
+
+        // The weights are updated recursively; r^2 comes from the
+        // volume element
+        arma::vec wbig(get_wrad(iel)%arma::square(r));
+        arma::vec wsmall(wbig%rinv);
+
+        rL.resize(Lmax+1);
+        rm1L.resize(Lmax+1);
+        arma::mat wbf;
+        for(int L=0;L<=Lmax;L++) {
+          wbf=bf;
+          wbf.each_col()%=wbig;
+          rL[L]=arma::trans(bf)*wbf;
+          wbf=bf;
+          wbf.each_col()%=wsmall;
+          rm1L[L]=arma::trans(bf)*wbf;
+          if(rL[L].has_nan() || rm1L[L].has_nan()) {
+            printf("radial_moments(%i,%i) has NaN!\n",L,(int) iel);
+          }
+
+          wbig%=r;
+          wsmall%=rinv;
+        }
+      }
+
+      arma::mat RadialBasis::legendre_tail(size_t iel, int ntail) const {
+        // The functions are polynomials of degree nprim-1 in the
+        // primitive coordinate, so their Legendre expansion is exact
+        const int nprim((int) fem.get_poly_nprim(iel));
+        ntail=std::max(1,std::min(ntail,nprim));
+
+        // Legendre polynomials at the quadrature points by recursion
+        arma::mat Pn(xq.n_elem,nprim);
+        Pn.col(0).ones();
+        if(nprim>1)
+          Pn.col(1)=xq;
+        for(int n=1;n+1<nprim;n++)
+          Pn.col(n+1)=((2*n+1)*xq%Pn.col(n)-n*Pn.col(n-1))/(n+1);
+
+        // Expansion coefficients of the highest components,
+        // a_n = (2n+1)/2 int P_n(x) f(x) dx
+        arma::mat bf(get_bf(iel));
+        arma::mat Ptail(Pn.tail_cols(ntail));
+        arma::mat wP(Ptail);
+        wP.each_col()%=wq;
+        arma::mat coeff(arma::trans(wP)*bf);
+        for(int i=0;i<ntail;i++)
+          coeff.row(i)*=(2*(nprim-ntail+i)+1)/2.0;
+
+        // Values of the tail at the quadrature points and its norm
+        arma::mat tail(Ptail*coeff);
+        arma::vec r(get_r(iel));
+        arma::mat wtail(tail);
+        wtail.each_col()%=get_wrad(iel)%arma::square(r);
+        return arma::trans(tail)*wtail;
+      }
+
       arma::mat RadialBasis::bessel_il_integral(int L, double lambda, size_t iel) const {
         std::function<double(double)> besselil = [L, lambda](double r) { return utils::bessel_il(r*lambda, L); };
         return fem.matrix_element(iel, false, false, xq, wq, besselil);
@@ -207,6 +320,28 @@ namespace helfem {
         return fem.matrix_element(iel, false, false, xq, wq, besselkl);
       }
 
+      void RadialBasis::bessel_integrals(int Lmax, double lambda, size_t iel, std::vector<arma::mat> & iL, std::vector<arma::mat> & kL) const {
+        // The basis functions and the Bessel functions for all L are
+        // evaluated only once
+        arma::mat bf(fem.eval_f(xq, iel));
+        arma::vec lr(lambda*get_r(iel));
+        arma::vec wp(get_wrad(iel));
+        arma::mat ilr(utils::bessel_il_array(lr, Lmax));
+        arma::mat klr(utils::bessel_kl_array(lr, Lmax));
+
+        iL.resize(Lmax+1);
+        kL.resize(Lmax+1);
+        arma::mat wbf;
+        for(int L=0;L<=Lmax;L++) {
+          wbf=bf;
+          wbf.each_col()%=wp%ilr.col(L);
+          iL[L]=arma::trans(wbf)*bf;
+          wbf=bf;
+          wbf.each_col()%=wp%klr.col(L);
+          kL[L]=arma::trans(wbf)*bf;
+        }
+      }
+
       arma::mat RadialBasis::radial_integral(const RadialBasis &rh, int n, bool lhder,
                                              bool rhder) const {
         modelpotential::RadialPotential rad(n);
@@ -321,23 +456,75 @@ namespace helfem {
       }
 
       arma::mat RadialBasis::nuclear(size_t iel) const {
-        std::function<double(double)> r = [](double r){return r;};
+        polynomial_basis::vectorized_weight_t r = [](const arma::vec & r_){return r_;};
         std::function<arma::mat(const arma::vec &,size_t)> radial_bf;
         radial_bf = [this](const arma::vec & xq_, size_t iel_) { return this->get_bf(xq_, iel_); };
-        return -fem.matrix_element(iel, radial_bf, radial_bf, xq, wq, r);
+        return -fem.matrix_element_vectorized(iel, radial_bf, radial_bf, xq, wq, r);
+      }
+
+      polynomial_basis::BandedMatrix RadialBasis::radial_integral_banded(int n) const {
+        std::vector<arma::mat> matel(Nel());
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+        for(size_t iel=0;iel<Nel();iel++)
+          matel[iel]=radial_integral(n,iel);
+        return fem.assemble_banded(matel);
+      }
+
+      polynomial_basis::BandedMatrix RadialBasis::kinetic_banded() const {
+        std::vector<arma::mat> matel(Nel());
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+        for(size_t iel=0;iel<Nel();iel++)
+          matel[iel]=kinetic(iel);
+        return fem.assemble_banded(matel);
+      }
+
+      polynomial_basis::BandedMatrix RadialBasis::kinetic_l_banded() const {
+        std::vector<arma::mat> matel(Nel());
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+        for(size_t iel=0;iel<Nel();iel++)
+          matel[iel]=kinetic_l(iel);
+        return fem.assemble_banded(matel);
+      }
+
+      polynomial_basis::BandedMatrix RadialBasis::absorbing_potential_banded(double R0) const {
+        polynomial_basis::vectorized_weight_t cap = [R0](const arma::vec & r){
+          arma::vec d(arma::clamp(r-R0,0.0,arma::datum::inf));
+          return arma::vec(arma::square(d)%arma::square(r));
+        };
+        std::function<arma::mat(const arma::vec &,size_t)> radial_bf;
+        radial_bf = [this](const arma::vec & xq_, size_t iel_) { return this->get_bf(xq_, iel_); };
+
+        // Only the elements reaching beyond R0 contribute
+        std::vector<arma::mat> matel(Nel());
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+        for(size_t iel=0;iel<Nel();iel++) {
+          if(fem.element_end(iel)>R0)
+            matel[iel]=fem.matrix_element_vectorized(iel, radial_bf, radial_bf, xq, wq, cap);
+          else
+            matel[iel].zeros(Nprim(iel),Nprim(iel));
+        }
+        return fem.assemble_banded(matel);
       }
 
       arma::mat RadialBasis::model_potential(const modelpotential::ModelPotential *model,
                                              size_t iel) const {
-        std::function<double(double)> modelpot = [model](double r) { return model->V(r); };
-        return fem.matrix_element(iel, false, false, xq, wq, modelpot);
+        polynomial_basis::vectorized_weight_t modelpot = [model](const arma::vec & r) { return model->V(r); };
+        return fem.matrix_element_vectorized(iel, false, false, xq, wq, modelpot);
       }
 
       arma::mat RadialBasis::nuclear_offcenter(size_t iel, double Rhalf, int L) const {
-        if (fem.element_begin(iel) <= Rhalf)
+        if (fem.element_begin(iel) >= Rhalf)
           return -sqrt(4.0 * M_PI / (2 * L + 1)) * radial_integral(-L - 1, iel) *
             std::pow(Rhalf, L);
-        else if (fem.element_end(iel) >= Rhalf)
+        else if (fem.element_end(iel) <= Rhalf)
           return -sqrt(4.0 * M_PI / (2 * L + 1)) * radial_integral(L, iel) *
             std::pow(Rhalf, -L - 1);
         else {
@@ -351,22 +538,33 @@ namespace helfem {
         double Rmin(fem.element_begin(iel));
         double Rmax(fem.element_end(iel));
 
-        // Integral by quadrature
-        std::shared_ptr<const polynomial_basis::PolynomialBasis> p(fem.get_basis(iel));
-        arma::mat tei(quadrature::twoe_integral(Rmin, Rmax, xq, wq, p, L));
+        // Integral by quadrature, with the tabulated functions
+        arma::mat tei(quadrature::twoe_integral(Rmin, Rmax, xq, wq, fem.eval_f(xq, iel), fem.eval_subinterval_f(xq, iel), L));
         if(tei.has_nan()) {
           printf("twoe_integral(%i,%i) has NaN!\n",L,(int) iel);
         }
         return tei;
       }
 
+      std::vector<arma::mat> RadialBasis::twoe_integrals(int Lmax, size_t iel) const {
+        double Rmin(fem.element_begin(iel));
+        double Rmax(fem.element_end(iel));
+
+        // Integral by quadrature, with the tabulated functions
+        std::vector<arma::mat> tei(quadrature::twoe_integrals(Rmin, Rmax, xq, wq, fem.eval_f(xq, iel), fem.eval_subinterval_f(xq, iel), Lmax));
+        for(size_t L=0;L<tei.size();L++)
+          if(tei[L].has_nan()) {
+            printf("twoe_integral(%i,%i) has NaN!\n",(int) L,(int) iel);
+          }
+        return tei;
+      }
+
       arma::mat RadialBasis::yukawa_integral(int L, double lambda, size_t iel) const {
         double Rmin(fem.element_begin(iel));
         double Rmax(fem.element_end(iel));
 
-        // Integral by quadrature
-        std::shared_ptr<const polynomial_basis::PolynomialBasis> p(fem.get_basis(iel));
-        arma::mat tei(quadrature::yukawa_integral(Rmin, Rmax, xq, wq, p, L, lambda));
+        // Integral by quadrature, with the tabulated functions
+        arma::mat tei(quadrature::yukawa_integral(Rmin, Rmax, xq, wq, fem.eval_f(xq, iel), fem.eval_subinterval_f(xq, iel), L, lambda));
 
         return tei;
       }
@@ -429,6 +627,31 @@ namespace helfem {
         return tei;
       }
 
+      double RadialBasis::erfc_integral_bound(int L, double mu, size_t iel, size_t kel) const {
+        // Quadrature rule used for the integrals
+        arma::vec xi, wi;
+        chebyshev::chebyshev(xq.n_elem, xi, wi);
+
+        // Largest integral of the absolute value of a product of two
+        // basis functions in the element
+        std::function<double(size_t)> product_bound = [this, &xi, &wi](size_t el) {
+          arma::mat absbf(arma::abs(fem.eval_f(xi, el)));
+          arma::mat prod(arma::trans(absbf)*arma::diagmat(wi)*absbf);
+          return 0.5*(fem.element_end(el)-fem.element_begin(el))*prod.max();
+        };
+
+        // The kernel decays with the distance of the points, so it is
+        // largest at the facing element boundaries
+        double ri[2]={fem.element_begin(iel), fem.element_end(iel)};
+        double rk[2]={fem.element_begin(kel), fem.element_end(kel)};
+        double kernel=0.0;
+        for(int i=0;i<2;i++)
+          for(int k=0;k<2;k++)
+            kernel=std::max(kernel, std::abs(atomic::erfc_expn::Phi(L,mu*ri[i],mu*rk[k])));
+
+        return kernel*product_bound(iel)*product_bound(kel);
+      }
+
       arma::mat RadialBasis::spherical_potential(size_t iel) const {
         double Rmin(fem.element_begin(iel));
         double Rmax(fem.element_end(iel));
@@ -441,60 +664,33 @@ namespace helfem {
       }
 
       arma::mat RadialBasis::get_bf(size_t iel) const {
+        if(iel==0 && bf_first.n_elem)
+          return bf_first;
         return get_bf(xq, iel);
       }
 
       void RadialBasis::get_taylor(const arma::vec & r, const arma::uvec & taylorind, arma::mat & val, int ider) const {
         if(taylorind[0]!=0 || taylorind[taylorind.n_elem-1] != taylorind.n_elem-1)
           throw std::logic_error("Taylor points not consecutive!\n");
-
-        // The series of B(r)/r is
-        //  [B(0) + B'(0)r + 1/2 B''(0) r^2 + ...]/r
-        //= B'(0) + 1/2 B''(0) r + 1/6 B'''(0) r^2 + ...
-
-        /*
-        if(taylor_order<3 || taylor_order>9) {
-          std::ostringstream oss;
-          oss << "Got taylor_order = " << taylor_order << ". Taylor expansion order needs to be 3 <= taylor_order <= 9.\n";
-          throw std::logic_error(oss.str());
+        if(ider<0 || ider>=(int) taylor_coeff.size())
+          throw std::logic_error("Taylor series only available up to the second derivative!\n");
+
+        // The series is evaluated in Horner form for all the points and
+        // functions at once
+        const arma::mat & coeff(taylor_coeff[ider]);
+        const size_t npts(taylorind.n_elem);
+        if(!coeff.n_rows) {
+          val.rows(0, npts-1).zeros();
+          return;
         }
-        */
-
-        // Coefficients of the various derivatives in the expansion of
-        // the function itself. Note that the zeroth element already
-        // corresponds to the first derivative!
-        arma::vec taylorcoeff(taylor_order);
-        taylorcoeff(0) = 1.0;
-        for(int i=1; i<taylor_order; i++)
-          taylorcoeff(i) = taylorcoeff(i-1)/(i+1);
-        // and the corresponding r exponents
-        arma::ivec rexp(arma::linspace<arma::ivec>(0,taylor_order-1,taylor_order));
-
-        // Compute derivatives: c r^n -> c n r^(n-1)
-        for(int i=0; i<taylor_order; i++) {
-          for(int d=0; d<ider; d++) {
-            taylorcoeff(i) *= rexp(i);
-            rexp(i)--;
-          }
+        const arma::vec rt(r.subvec(0, npts-1));
+        arma::mat acc(npts, val.n_cols);
+        acc.each_row() = coeff.row(coeff.n_rows-1);
+        for(size_t k=coeff.n_rows-1; k-- > 0;) {
+          acc.each_col() %= rt;
+          acc.each_row() += coeff.row(k);
         }
-
-        // Exponentiate r
-        std::vector<arma::vec> rexpval(taylor_order);
-        for(int i=ider; i < taylor_order; i++) {
-          if(rexp[i]<0)
-            throw std::logic_error("This should not have happened!\n");
-          rexpval[i] = arma::pow(r, rexp[i]);
-        }
-
-        // Collect results
-        for(size_t ifun = 0; ifun < val.n_cols; ifun++)
-          for(size_t ir = 0; ir < taylorind.n_elem; ir++) {
-            val(ir, ifun) = 0.0;
-            // Terms below this are zero
-            for(int iterm=ider;iterm < taylor_order;iterm++) {
-              val(ir, ifun) += taylorcoeff[iterm]*taylor_df[iterm](ifun)*rexpval[iterm](ir);
-            }
-          }
+        val.rows(0, npts-1) = acc;
       }
 
       arma::mat RadialBasis::get_bf(const arma::vec & x, size_t iel) const {
@@ -521,6 +717,8 @@ namespace helfem {
       }
 
       arma::mat RadialBasis::get_df(size_t iel) const {
+        if(iel==0 && df_first.n_elem)
+          return df_first;
         return get_df(xq ,iel);
       }
 
@@ -550,6 +748,8 @@ namespace helfem {
       }
 
       arma::mat RadialBasis::get_lf(size_t iel) const {
+        if(iel==0 && lf_first.n_elem)
+          return lf_first;
         return get_lf(xq, iel);
       }
 
@@ -26,5 +26,9 @@ namespace helfem {
     double RadialPotential::V(double R) const {
       return std::pow(R,n);
     }
+
+    void RadialPotential::V(const arma::vec & R, arma::vec & out) const {
+      out=arma::pow(R,n);
+    }
   }
 }
@@ -31,6 +31,9 @@ namespace helfem {
       ~RadialPotential();
       /// Potential
       double V(double r) const override;
+      /// Potential at many points
+      void V(const arma::vec & r, arma::vec & out) const override;
+      using ModelPotential::V;
     };
   }
 }
@@ -198,6 +198,17 @@ namespace helfem {
       return std::pow(Z,2)*val;
     }
 
+    void RegularizedNucleus::V(const arma::vec & r, arma::vec & out) const {
+      // Loop invariants of the scalar routine
+      const double Zr_taylor(std::cbrt(DBL_EPSILON));
+      const double Z2(std::pow(Z,2));
+      out.zeros(r.n_elem);
+      for(size_t i=0;i<r.n_elem;i++) {
+        double Zr=Z*r(i);
+        out(i)=Z2*((Zr <= Zr_taylor) ? modelpotential::V_taylor(a,b,Zr) : modelpotential::V_analytic(a,b,Zr));
+      }
+    }
+
     double RegularizedNucleus::get_a() const {
       return a;
     }
@@ -35,6 +35,13 @@ namespace helfem {
       }
     }
 
+    void SphericalNucleus::V(const arma::vec & r, arma::vec & out) const {
+      out=-((double) Z)/r;
+      arma::uvec idx(arma::find(r<R0));
+      if(idx.n_elem)
+        out(idx)=-Z/(2.0*R0)*(3.0-arma::square(r(idx)/R0));
+    }
+
     double SphericalNucleus::get_R0() const {
       return R0;
     }
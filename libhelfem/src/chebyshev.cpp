@@ -19,7 +19,7 @@ namespace helfem {
   namespace chebyshev {
     // Modified Gauss-Chebyshev quadrature of the second kind for calculating
     // \int_{-1}^{1} f(x) dx
-    void chebyshev(int n, arma::vec & x, arma::vec & w) {
+    static void chebyshev_evaluate(int n, arma::vec & x, arma::vec & w) {
       // Resize vectors to correct size
       x.zeros(n);
       w.zeros(n);
@@ -52,7 +52,7 @@ namespace helfem {
       w=reverse(w);
     }
 
-    void radial_chebyshev(int nrad, arma::vec & rad, arma::vec & wrad) {
+    static void radial_chebyshev_evaluate(int nrad, arma::vec & rad, arma::vec & wrad) {
       // Get Chebyshev nodes and weights for radial part
       arma::vec xc, wc;
       chebyshev(nrad,xc,wc);
@@ -74,5 +74,27 @@ namespace helfem {
         wrad(ixc) = w;
       }
     }
+
+    std::shared_ptr<const quadrature_rules::Rule> chebyshev_rule(int n) {
+      static quadrature_rules::RuleCache cache(chebyshev_evaluate);
+      return cache.get(n);
+    }
+
+    std::shared_ptr<const quadrature_rules::Rule> radial_chebyshev_rule(int n) {
+      static quadrature_rules::RuleCache cache(radial_chebyshev_evaluate);
+      return cache.get(n);
+    }
+
+    void chebyshev(int n, arma::vec & x, arma::vec & w) {
+      std::shared_ptr<const quadrature_rules::Rule> rule(chebyshev_rule(n));
+      x=rule->x;
+      w=rule->w;
+    }
+
+    void radial_chebyshev(int n, arma::vec & r, arma::vec & wr) {
+      std::shared_ptr<const quadrature_rules::Rule> rule(radial_chebyshev_rule(n));
+      r=rule->x;
+      wr=rule->w;
+    }
   }
 }
@@ -17,6 +17,8 @@
 #define CHEBYSHEV_H
 
 #include <armadillo>
+#include <memory>
+#include "quadrature_rules.h"
 
 namespace helfem {
   namespace chebyshev {
@@ -31,6 +33,11 @@ namespace helfem {
     /// integration in spherical coordinates, you need to plug in the
     /// r^2 factor as well.
     void radial_chebyshev(int n, arma::vec & r, arma::vec & wr);
+
+    /// Get the shared, cached n-point Gauss-Chebyshev rule
+    std::shared_ptr<const quadrature_rules::Rule> chebyshev_rule(int n);
+    /// Get the shared, cached n-point radial Gauss-Chebyshev rule
+    std::shared_ptr<const quadrature_rules::Rule> radial_chebyshev_rule(int n);
   }
 }
 
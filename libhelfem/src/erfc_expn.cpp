@@ -193,6 +193,150 @@ namespace helfem {
           return Phi_general(n,Xi,xi);
         }
       }
+
+      /// Number of D_nk terms in the short-range series
+      static const unsigned int NSHORT=32;
+
+      PhiTable::PhiTable(unsigned int n_) : n(n_) {
+        Fcoeff.resize(n+1);
+        for(unsigned int i=0;i<=n;i++) {
+          Fcoeff[i].resize(i+1);
+          for(unsigned int p=0;p<=i;p++)
+            Fcoeff[i][p]=factorial(i+p)/(factorial(p)*factorial(i-p));
+        }
+
+        D0coeff.resize(n+1);
+        for(unsigned int m=1;m<=n;m++)
+          D0coeff[m]=1.0/double_factorial(2*(n-m)+1);
+
+        Dcoeff.resize(NSHORT);
+        for(unsigned int k=1;k<NSHORT;k++) {
+          double kfac((2.0*n+1.0)/(factorial(k)*(2.0*(n+k)+1.0)));
+          Dcoeff[k].resize(k+1);
+          for(unsigned int m=1;m<=k;m++)
+            Dcoeff[k][m]=kfac*choose(m-k-1,m-1)/double_factorial(2*(n+k-m)+1);
+        }
+      }
+
+      void PhiTable::Dnk(double Xi, double * D) const {
+        double Xi2(Xi*Xi);
+        double prefac = std::exp(-Xi2)/sqrt(M_PI)*std::pow(2,n+1)*std::pow(Xi,2*n+1);
+
+        // k=0
+        double sum = 0.0;
+        double twoXi2m(1.0);
+        for(unsigned int m=1;m<=n;m++) {
+          twoXi2m*=2*Xi2;
+          sum += D0coeff[m]/twoXi2m;
+        }
+        D[0] = erfc(Xi) + prefac*sum;
+
+        // k>0; the powers (2 Xi^2)^(k-m) are tabulated once
+        double twoXi2pow[NSHORT];
+        twoXi2pow[0]=1.0;
+        for(unsigned int k=1;k<NSHORT;k++)
+          twoXi2pow[k]=twoXi2pow[k-1]*2*Xi2;
+        for(unsigned int k=1;k<NSHORT;k++) {
+          sum = 0.0;
+          for(unsigned int m=1;m<=k;m++)
+            sum += Dcoeff[k][m]*twoXi2pow[k-m];
+          D[k] = prefac*sum;
+        }
+      }
+
+      double PhiTable::Phi_short(double Xi, double xi, const double * D) const {
+        // this is a power series in xi
+        if(xi == 0.0 && n>0)
+          return 0.0;
+        else if(n == 0 && xi == 0.0 && Xi == 0.0)
+          return 1.0;
+
+        double xi2(xi*xi);
+        double xipow(std::pow(xi,n));
+        double Phi = 0.0;
+        double dPhi = 0.0;
+        const double tol=DBL_EPSILON;
+        for(unsigned int k=0; k+1<NSHORT; k+=2) {
+          // Unroll odd values so that we don't truncate too soon by
+          // accident
+          dPhi = D[k]*xipow + D[k+1]*xipow*xi2;
+          xipow*=xi2*xi2;
+          Phi += dPhi;
+          if(std::abs(dPhi) < tol*std::abs(Phi)) break;
+        }
+        if(std::abs(dPhi) >= tol*std::abs(Phi))
+          fprintf(stderr,"Warning - short-range Phi not converged at xi= %e: dPhi= %e, Phi= %e ratio %e\n",xi,dPhi,Phi,dPhi/Phi);
+
+        return Phi/std::pow(Xi,n+1);
+      }
+
+      double PhiTable::Phi_general(double Xi, double xi) const {
+        // Exponential factors are shared by all F_i
+        double explus(std::exp(-std::pow(Xi+xi,2)));
+        double exminus(std::exp(-std::pow(Xi-xi,2)));
+        double prefac(-1.0/(4.0*Xi*xi));
+
+        // F_i for i=0,...,n, equation (22)
+        std::vector<double> F(n+1);
+        for(unsigned int i=0;i<=n;i++) {
+          double Fi=0.0;
+          double prefacp(prefac);
+          for(unsigned int p=0;p<=i;p++) {
+            Fi += prefacp * Fcoeff[i][p] * ((((i-p)%2) ? -1.0 : 1.0) * explus - exminus);
+            prefacp*=prefac;
+          }
+          F[i]=2.0/sqrt(M_PI)*Fi;
+        }
+
+        double sum = 0.0;
+        double Xim(1.0), xim(1.0);
+        for(unsigned int m=1;m<=n;m++) {
+          Xim*=Xi;
+          xim*=xi;
+          sum += F[n-m]*((Xim*Xim + xim*xim)/(Xim*xim));
+        }
+
+        return F[n] + sum + Hn(n,Xi,xi);
+      }
+
+      double PhiTable::operator()(double Xi, double xi) const {
+        // Make sure arguments are in the correct order
+        if(Xi < xi)
+          std::swap(Xi,xi);
+
+        // See text on top of page 8624 of Angyan et al
+        if(xi < 0.4 || (Xi < 0.5 && xi < 2*Xi)) {
+          double D[NSHORT];
+          Dnk(Xi,D);
+          return Phi_short(Xi,xi,D);
+        } else {
+          return Phi_general(Xi,xi);
+        }
+      }
+
+      arma::mat PhiTable::operator()(const arma::vec & Xi, const arma::vec & xi) const {
+        // D_nk only depends on the larger argument, so it is
+        // evaluated once for every point
+        arma::mat DX(NSHORT,Xi.n_elem), Dx(NSHORT,xi.n_elem);
+        for(size_t i=0;i<Xi.n_elem;i++)
+          Dnk(Xi(i),DX.colptr(i));
+        for(size_t j=0;j<xi.n_elem;j++)
+          Dnk(xi(j),Dx.colptr(j));
+
+        arma::mat Phi(Xi.n_elem,xi.n_elem);
+        for(size_t j=0;j<xi.n_elem;j++)
+          for(size_t i=0;i<Xi.n_elem;i++) {
+            bool swap(Xi(i) < xi(j));
+            double big(swap ? xi(j) : Xi(i));
+            double small(swap ? Xi(i) : xi(j));
+            if(small < 0.4 || (big < 0.5 && small < 2*big))
+              Phi(i,j) = Phi_short(big,small,swap ? Dx.colptr(j) : DX.colptr(i));
+            else
+              Phi(i,j) = Phi_general(big,small);
+          }
+
+        return Phi;
+      }
     }
   }
 }
@@ -16,6 +16,9 @@
 #ifndef ATOMIC_ERFC_EXPN_H
 #define ATOMIC_ERFC_EXPN_H
 
+#include <armadillo>
+#include <vector>
+
 namespace helfem {
   namespace atomic {
     namespace erfc_expn {
@@ -33,6 +36,36 @@ namespace helfem {
        * interactions", J. Phys. A: Math. Gen. 39, 8613 (2006).
        */
       double Phi(unsigned int n, double Xi, double xi);
+
+      /**
+       * Phi of a fixed order with the series coefficients computed
+       * once, for evaluation over many pairs of points.
+       */
+      class PhiTable {
+        /// Order of the expansion
+        unsigned int n;
+        /// Coefficients (i+p)!/(p!(i-p)!) of F_i for i=0,...,n, equation (22)
+        std::vector< std::vector<double> > Fcoeff;
+        /// Coefficients 1/(2(n-m)+1)!! of D_n0, equation (28)
+        std::vector<double> D0coeff;
+        /// Coefficients of D_nk for k>0 including the k dependent prefactor, equation (29)
+        std::vector< std::vector<double> > Dcoeff;
+
+        /// Evaluate D_nk for all k used in the short-range series
+        void Dnk(double Xi, double * D) const;
+        /// Short-range series with precomputed D_nk(Xi)
+        double Phi_short(double Xi, double xi, const double * D) const;
+        /// General expansion
+        double Phi_general(double Xi, double xi) const;
+
+      public:
+        /// Constructor
+        PhiTable(unsigned int n);
+        /// Evaluate Phi(Xi, xi)
+        double operator()(double Xi, double xi) const;
+        /// Evaluate Phi(Xi(i), xi(j)) for all pairs of points
+        arma::mat operator()(const arma::vec & Xi, const arma::vec & xi) const;
+      };
     }
   }
 }
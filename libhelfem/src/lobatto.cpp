@@ -15,6 +15,8 @@
  */
 #include "lobatto.h"
 #include <cfloat>
+#include <cmath>
+#include <sstream>
 
 void lobatto_set(int order, arma::vec & xtab, arma::vec & weight)
 
@@ -585,7 +587,7 @@ void lobatto_set(int order, arma::vec & xtab, arma::vec & weight)
 }
 
 
-void lobatto_compute (int n, arma::vec & x, arma::vec & w)
+static void lobatto_evaluate (int n, arma::vec & x, arma::vec & w)
 
 /******************************************************************************/
 /*
@@ -657,11 +659,6 @@ void lobatto_compute (int n, arma::vec & x, arma::vec & w)
     Output, double W[N], the weights.
 */
 {
-  int i;
-  int j;
-  double test, error;
-  double tolerance;
-
   if ( n < 2 )
   {
     std::ostringstream oss;
@@ -679,65 +676,70 @@ void lobatto_compute (int n, arma::vec & x, arma::vec & w)
   x.resize(n);
   w.resize(n);
 
-  tolerance = 100.0 * DBL_EPSILON;
-/*
-  Initial estimate for the abscissas is the Chebyshev-Gauss-Lobatto nodes.
-*/
-  for ( i = 0; i < n; i++ )
-  {
-    x[i] = cos ( M_PI * ( double ) ( i ) / ( double ) ( n - 1 ) );
-  }
-
-   double xold[n];
-   double p[n*n];
-
-  do
+  /*
+    The nodes are refined one at a time with Newton's method in
+    extended precision, starting from the Chebyshev-Gauss-Lobatto
+    nodes; only the two highest Legendre polynomials are kept, so the
+    memory use is O(1) and the cost O(n^2).
+  */
+  const long double tolerance = DBL_EPSILON;
+  const int maxit = 100;
+  for ( int i = 0; i < n; i++ )
   {
-    for ( i = 0; i < n; i++ )
-    {
-      xold[i] = x[i];
-    }
-    for ( i = 0; i < n; i++ )
+    long double xi = cosl ( M_PI * ( long double ) ( i ) / ( long double ) ( n - 1 ) );
+    long double pn = 0.0, pnm = 0.0;
+    for ( int it = 0; it <= maxit; it++ )
     {
-      p[i+0*n] = 1.0;
-    }
-    for ( i = 0; i < n; i++ )
-    {
-      p[i+1*n] = x[i];
-    }
+      // Legendre polynomials P_{n-1} and P_{n-2}
+      long double p0 = 1.0, p1 = xi;
+      for ( int j = 2; j <= n-1; j++ )
+      {
+        long double p2 = ( ( long double ) ( 2 * j - 1 ) * xi * p1
+                         - ( long double ) ( j - 1 ) * p0 ) / ( long double ) ( j );
+        p0 = p1;
+        p1 = p2;
+      }
+      pn = p1;
+      pnm = p0;
 
-    for ( j = 2; j <= n-1; j++ )
-    {
-      for ( i = 0; i < n; i++)
+      if ( it == maxit )
       {
-        p[i+j*n] = ( ( double ) ( 2 * j - 1 ) * x[i] * p[i+(j-1)*n]
-                   + ( double ) (   - j + 1 ) *        p[i+(j-2)*n] )
-                   / ( double ) (     j     );
+        std::ostringstream oss;
+        oss << "Newton iteration for the " << n << "-point Lobatto rule did not converge.\n";
+        throw std::runtime_error(oss.str());
       }
-    }
 
-    for ( i = 0; i < n; i++ )
-    {
-      x[i] = xold[i] - ( x[i] * p[i+(n-1)*n] - p[i+(n-2)*n] )
-           / ( ( double ) ( n ) * p[i+(n-1)*n] );
+      long double dx = ( xi * pn - pnm ) / ( ( long double ) ( n ) * pn );
+      xi -= dx;
+      if ( fabsl(dx) <= tolerance )
+        break;
     }
 
-    error = 0.0;
-    for ( i = 0; i < n; i++ )
+    // Nodes are returned in ascending order; the weight uses the
+    // polynomial evaluated at the converged node
+    long double p0 = 1.0, p1 = xi;
+    for ( int j = 2; j <= n-1; j++ )
     {
-      test = fabs(x[i] - xold[i]);
-      if(test>error)
-	error=test;
+      long double p2 = ( ( long double ) ( 2 * j - 1 ) * xi * p1
+                       - ( long double ) ( j - 1 ) * p0 ) / ( long double ) ( j );
+      p0 = p1;
+      p1 = p2;
     }
+    x[n-1-i] = xi;
+    w[n-1-i] = 2.0 / ( ( long double ) ( ( n - 1 ) * n ) * p1 * p1 );
+  }
+}
 
-  } while ( tolerance < error );
-
-  // Reverse order of x
-  x = arma::reverse(x);
+std::shared_ptr<const helfem::quadrature_rules::Rule> lobatto_rule (int n)
+{
+  static helfem::quadrature_rules::RuleCache cache(lobatto_evaluate);
+  return cache.get(n);
+}
 
-  for ( i = 0; i < n; i++ )
-  {
-    w[i] = 2.0 / ( ( double ) ( ( n - 1 ) * n ) * pow ( p[i+(n-1)*n], 2 ) );
-  }
+void lobatto_compute (int n, arma::vec & x, arma::vec & w)
+{
+  std::shared_ptr<const helfem::quadrature_rules::Rule> rule(lobatto_rule(n));
+  x = rule->x;
+  w = rule->w;
 }
 /******************************************************************************/
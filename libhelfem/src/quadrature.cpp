@@ -14,6 +14,7 @@
  * of the License, or (at your option) any later version.
  */
 #include "quadrature.h"
+#include "FiniteElementBasis.h"
 #include "erfc_expn.h"
 #include "chebyshev.h"
 #include "utils.h"
@@ -57,54 +58,69 @@ namespace helfem {
       return inner;
     }
 
-    arma::mat twoe_inner_integral(double rmin, double rmax, const arma::vec & x, const arma::vec & wx, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, const std::function<double(double,double)> & fsmallbig, const std::function<double(double)> & fbig) {
+    arma::mat twoe_inner_integral(double rmin, double rmax, const arma::vec & x, const arma::vec & wx, const arma::mat & sbf, const std::function<double(double,double)> & fsmallbig, const std::function<double(double)> & fbig) {
+      const size_t Nq(x.n_elem);
+      const size_t Nbf(sbf.n_cols);
       // Midpoint is at
       double rmid(0.5*(rmax+rmin));
       // and half-length of interval is
       double rlen(0.5*(rmax-rmin));
       // r values are then
-      arma::vec r(rmid*arma::ones<arma::vec>(x.n_elem)+rlen*x);
-
-      // Compute the "inner" integrals as function of r.
-      // Every subinterval uses a fresh nquad points!
-      arma::mat inner(x.n_elem,std::pow(poly->get_nbf(),2));
-      inner.row(0)=arma::trans(twoe_inner_integral_wrk(rmin, r(0), rmin, rmax, x, wx, poly, fsmallbig, fbig));
-      for(size_t ip=1;ip<x.n_elem;ip++)
-        inner.row(ip)=arma::trans(twoe_inner_integral_wrk(r(ip-1), r(ip), rmin, rmax, x, wx, poly, fsmallbig, fbig));
+      arma::vec r(rmid*arma::ones<arma::vec>(Nq)+rlen*x);
+
+      // Compute the "inner" integrals as function of r. Every
+      // subinterval uses a fresh nquad points, at which the
+      // polynomials have been evaluated beforehand
+      arma::mat inner(Nq,Nbf*Nbf);
+      for(size_t ip=0;ip<Nq;ip++) {
+        double slo(ip ? r(ip-1) : rmin);
+        double shi(r(ip));
+        double smid(0.5*(shi+slo));
+        double slen(0.5*(shi-slo));
+
+        // Total weight per point
+        arma::vec wp(Nq);
+        for(size_t i=0;i<Nq;i++)
+          wp(i)=wx(i)*slen*fsmallbig(smid+slen*x(i),shi);
+
+        const arma::mat ssub(sbf.rows(ip*Nq,(ip+1)*Nq-1));
+        arma::mat wbf(ssub);
+        wbf.each_col()%=wp;
+        inner.row(ip)=arma::trans(arma::vectorise(arma::trans(wbf)*ssub));
+      }
 
       // For numerical stability, each integral segment is scaled by
       // R^(-L-1), since first integrating r^L and then multiplying by
       // R^(-L-1) is unstable for small R and large L due to loss of
       // precision. We undo the conversion here
-      for(size_t ip=1;ip<x.n_elem;ip++)
+      for(size_t ip=1;ip<Nq;ip++)
         inner.row(ip) += inner.row(ip-1)*(fbig(r(ip))/fbig(r(ip-1)));
 
       return inner;
     }
 
-    arma::mat twoe_inner_integral(double rmin, double rmax, const arma::vec & x, const arma::vec & wx, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, int L) {
-      // Kernel functions
-      std::function<double(double,double)> fsmallbig = [L](double r, double R) {return std::pow(r/R,L)/R;};
-      std::function<double(double)> fbig = [L](double r) {return std::pow(r,-L-1);};
-      return twoe_inner_integral(rmin, rmax, x, wx, poly, fsmallbig, fbig);
+    arma::mat twoe_inner_integral(double rmin, double rmax, const arma::vec & x, const arma::vec & wx, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, const std::function<double(double,double)> & fsmallbig, const std::function<double(double)> & fbig) {
+      double rlen(0.5*(rmax-rmin));
+      arma::mat sbf(poly->eval_dnf(polynomial_basis::FiniteElementBasis::subinterval_points(x),0,rlen));
+      return twoe_inner_integral(rmin, rmax, x, wx, sbf, fsmallbig, fbig);
     }
 
-    arma::mat twoe_integral(double rmin, double rmax, const arma::vec & x, const arma::vec & wx, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, int L) {
-#ifndef ARMA_NO_DEBUG
-      if(x.n_elem != wx.n_elem) {
-        std::ostringstream oss;
-        oss << "x and wx not compatible: " << x.n_elem << " vs " << wx.n_elem << "!\n";
-        throw std::logic_error(oss.str());
-      }
-#endif
-      // and half-length of interval is
-      double rlen(0.5*(rmax-rmin));
+    /// Kernel functions of the inner Coulomb integral
+    static void coulomb_kernel(int L, std::function<double(double,double)> & fsmallbig, std::function<double(double)> & fbig) {
+      fsmallbig = [L](double r, double R) {return std::pow(r/R,L)/R;};
+      fbig = [L](double r) {return std::pow(r,-L-1);};
+    }
 
-      // Compute the inner integrals
-      arma::mat inner(twoe_inner_integral(rmin, rmax, x, wx, poly, L));
+    /// Kernel functions of the inner Yukawa integral
+    static void yukawa_kernel(int L, double lambda, std::function<double(double,double)> & fsmallbig, std::function<double(double)> & fbig) {
+      fsmallbig = [L, lambda](double r, double R) {return utils::bessel_il(r*lambda,L)*utils::bessel_kl(R*lambda,L);};
+      fbig = [L, lambda](double r) {return utils::bessel_kl(r*lambda,L);};
+    }
 
-      // Evaluate basis functions at quadrature points
-      arma::mat bf(poly->eval_dnf(x,0,rlen));
+    /// Outer integral of the inner integrals, plus the mirrored term
+    static arma::mat twoe_outer_integral(double rmin, double rmax, const arma::vec & wx, const arma::mat & bf, const arma::mat & inner) {
+      // and half-length of interval is
+      double rlen(0.5*(rmax-rmin));
 
       // Product functions
       arma::mat bfprod(bf.n_rows,bf.n_cols*bf.n_cols);
@@ -125,14 +141,19 @@ namespace helfem {
       return ints;
     }
 
-    arma::mat yukawa_inner_integral(double rmin, double rmax, const arma::vec & x, const arma::vec & wx, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, int L, double lambda) {
-      // Kernel functions
-      std::function<double(double,double)> fsmallbig = [L, lambda](double r, double R) {return utils::bessel_il(r*lambda,L)*utils::bessel_kl(R*lambda,L);};
-      std::function<double(double)> fbig = [L, lambda](double r) {return utils::bessel_kl(r*lambda,L);};
+    arma::mat twoe_inner_integral(double rmin, double rmax, const arma::vec & x, const arma::vec & wx, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, int L) {
+      std::function<double(double,double)> fsmallbig;
+      std::function<double(double)> fbig;
+      coulomb_kernel(L, fsmallbig, fbig);
       return twoe_inner_integral(rmin, rmax, x, wx, poly, fsmallbig, fbig);
     }
 
-    arma::mat yukawa_integral(double rmin, double rmax, const arma::vec & x, const arma::vec & wx, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, int L, double lambda) {
+    arma::mat twoe_integral(double rmin, double rmax, const arma::vec & x, const arma::vec & wx, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, int L) {
+      double rlen(0.5*(rmax-rmin));
+      return twoe_integral(rmin, rmax, x, wx, poly->eval_dnf(x,0,rlen), poly->eval_dnf(polynomial_basis::FiniteElementBasis::subinterval_points(x),0,rlen), L);
+    }
+
+    arma::mat twoe_integral(double rmin, double rmax, const arma::vec & x, const arma::vec & wx, const arma::mat & bf, const arma::mat & sbf, int L) {
 #ifndef ARMA_NO_DEBUG
       if(x.n_elem != wx.n_elem) {
         std::ostringstream oss;
@@ -140,32 +161,130 @@ namespace helfem {
         throw std::logic_error(oss.str());
       }
 #endif
-      // and half-length of interval is
+      // Compute the inner integrals
+      std::function<double(double,double)> fsmallbig;
+      std::function<double(double)> fbig;
+      coulomb_kernel(L, fsmallbig, fbig);
+      arma::mat inner(twoe_inner_integral(rmin, rmax, x, wx, sbf, fsmallbig, fbig));
+
+      return twoe_outer_integral(rmin, rmax, wx, bf, inner);
+    }
+
+    std::vector<arma::mat> twoe_integrals(double rmin, double rmax, const arma::vec & x, const arma::vec & wx, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, int Lmax) {
       double rlen(0.5*(rmax-rmin));
+      return twoe_integrals(rmin, rmax, x, wx, poly->eval_dnf(x,0,rlen), poly->eval_dnf(polynomial_basis::FiniteElementBasis::subinterval_points(x),0,rlen), Lmax);
+    }
 
-      // Compute the inner integrals
-      arma::mat inner(yukawa_inner_integral(rmin, rmax, x, wx, poly, L, lambda));
+    std::vector<arma::mat> twoe_integrals(double rmin, double rmax, const arma::vec & x, const arma::vec & wx, const arma::mat & bf, const arma::mat & sbf, int Lmax) {
+#ifndef ARMA_NO_DEBUG
+      if(x.n_elem != wx.n_elem) {
+        std::ostringstream oss;
+        oss << "x and wx not compatible: " << x.n_elem << " vs " << wx.n_elem << "!\n";
+        throw std::logic_error(oss.str());
+      }
+#endif
+      const size_t NL(Lmax+1);
+      const size_t Nq(x.n_elem);
 
-      // Evaluate basis functions at quadrature points
-      arma::mat bf(poly->eval_dnf(x, 0, rlen));
+      // Midpoint is at
+      double rmid(0.5*(rmax+rmin));
+      // and half-length of interval is
+      double rlen(0.5*(rmax-rmin));
+      // r values are then
+      arma::vec r(rmid*arma::ones<arma::vec>(Nq)+rlen*x);
+
+      // Basis function products at the quadrature points
+      const size_t Nbf(bf.n_cols);
+      arma::mat bfprod(Nq,Nbf*Nbf);
+      for(size_t fi=0;fi<Nbf;fi++)
+        for(size_t fj=0;fj<Nbf;fj++)
+          bfprod.col(fi*Nbf+fj)=bf.col(fi)%bf.col(fj);
+
+      // Inner integrals for all L, stored side by side: (Nq, Nbf^2 * NL)
+      arma::mat inner(Nq,Nbf*Nbf*NL);
+      for(size_t ip=0;ip<Nq;ip++) {
+        // Subinterval
+        double slo(ip ? r(ip-1) : rmin);
+        double shi(r(ip));
+        double smid(0.5*(shi+slo));
+        double slen(0.5*(shi-slo));
+        arma::vec rs(smid*arma::ones<arma::vec>(Nq)+slen*x);
+
+        // Products of the polynomials at the subinterval points
+        const arma::mat sbf_ip(sbf.rows(ip*Nq,(ip+1)*Nq-1));
+        arma::mat sprod(Nq,Nbf*Nbf);
+        for(size_t fi=0;fi<Nbf;fi++)
+          for(size_t fj=0;fj<Nbf;fj++)
+            sprod.col(fi*Nbf+fj)=sbf_ip.col(fi)%sbf_ip.col(fj);
+
+        // Weights (r/R)^L / R for all L
+        arma::mat wl(Nq,NL);
+        for(size_t i=0;i<Nq;i++) {
+          double rr(rs(i)/shi);
+          double w(wx(i)*slen/shi);
+          for(size_t L=0;L<NL;L++) {
+            wl(i,L)=w;
+            w*=rr;
+          }
+        }
+
+        // All L values in one product
+        arma::mat blk(arma::trans(sprod)*wl);
+        for(size_t L=0;L<NL;L++)
+          inner.submat(ip,L*Nbf*Nbf,ip,(L+1)*Nbf*Nbf-1)=arma::trans(blk.col(L));
+      }
+
+      // Undo the R^(-L-1) scaling used for numerical stability
+      for(size_t L=0;L<NL;L++)
+        for(size_t ip=1;ip<Nq;ip++) {
+          double fac(std::pow(r(ip)/r(ip-1),-(double) L-1.0));
+          inner.submat(ip,L*Nbf*Nbf,ip,(L+1)*Nbf*Nbf-1) += fac*inner.submat(ip-1,L*Nbf*Nbf,ip-1,(L+1)*Nbf*Nbf-1);
+        }
 
-      // Product functions
-      arma::mat bfprod(bf.n_rows,bf.n_cols*bf.n_cols);
-      for(size_t fi=0;fi<bf.n_cols;fi++)
-        for(size_t fj=0;fj<bf.n_cols;fj++)
-          bfprod.col(fi*bf.n_cols+fj)=bf.col(fi)%bf.col(fj);
       // Put in the weights for the outer integral
       arma::vec wp(wx*rlen);
       for(size_t i=0;i<bfprod.n_cols;i++)
         bfprod.col(i)%=wp;
 
-      // Integrals are then
+      // Outer integrals for all L in one product
       arma::mat ints(arma::trans(bfprod)*inner);
-      // but we are still missing the second term which can be
-      // obtained as simply as
-      ints+=arma::trans(ints);
 
-      return ints;
+      std::vector<arma::mat> ret(NL);
+      for(size_t L=0;L<NL;L++) {
+        ret[L]=ints.cols(L*Nbf*Nbf,(L+1)*Nbf*Nbf-1);
+        ret[L]+=arma::trans(ret[L]);
+      }
+
+      return ret;
+    }
+
+    arma::mat yukawa_inner_integral(double rmin, double rmax, const arma::vec & x, const arma::vec & wx, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, int L, double lambda) {
+      std::function<double(double,double)> fsmallbig;
+      std::function<double(double)> fbig;
+      yukawa_kernel(L, lambda, fsmallbig, fbig);
+      return twoe_inner_integral(rmin, rmax, x, wx, poly, fsmallbig, fbig);
+    }
+
+    arma::mat yukawa_integral(double rmin, double rmax, const arma::vec & x, const arma::vec & wx, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, int L, double lambda) {
+      double rlen(0.5*(rmax-rmin));
+      return yukawa_integral(rmin, rmax, x, wx, poly->eval_dnf(x,0,rlen), poly->eval_dnf(polynomial_basis::FiniteElementBasis::subinterval_points(x),0,rlen), L, lambda);
+    }
+
+    arma::mat yukawa_integral(double rmin, double rmax, const arma::vec & x, const arma::vec & wx, const arma::mat & bf, const arma::mat & sbf, int L, double lambda) {
+#ifndef ARMA_NO_DEBUG
+      if(x.n_elem != wx.n_elem) {
+        std::ostringstream oss;
+        oss << "x and wx not compatible: " << x.n_elem << " vs " << wx.n_elem << "!\n";
+        throw std::logic_error(oss.str());
+      }
+#endif
+      // Compute the inner integrals
+      std::function<double(double,double)> fsmallbig;
+      std::function<double(double)> fbig;
+      yukawa_kernel(L, lambda, fsmallbig, fbig);
+      arma::mat inner(twoe_inner_integral(rmin, rmax, x, wx, sbf, fsmallbig, fbig));
+
+      return twoe_outer_integral(rmin, rmax, wx, bf, inner);
     }
 
     arma::mat erfc_integral(double rmini, double rmaxi, const arma::mat & bfi, const arma::vec & xi, const arma::vec & wi, double rmink, double rmaxk, const arma::mat & bfk, const arma::vec & xk, const arma::vec & wk, int L, double mu) {
@@ -193,10 +312,8 @@ namespace helfem {
       arma::vec rk(rmidk*arma::ones<arma::vec>(xk.n_elem)+rlenk*xk);
 
       // Green's function
-      arma::mat Fn(ri.n_elem,rk.n_elem);
-      for(size_t i=0;i<ri.n_elem;i++)
-        for(size_t k=0;k<rk.n_elem;k++)
-          Fn(i,k) = atomic::erfc_expn::Phi(L,mu*ri(i),mu*rk(k));
+      atomic::erfc_expn::PhiTable Phi(L);
+      arma::mat Fn(Phi(mu*ri,mu*rk));
 
       // Product functions
       arma::mat bfprodij(bfi.n_rows,bfi.n_cols*bfi.n_cols);
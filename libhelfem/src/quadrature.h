@@ -53,6 +53,22 @@ namespace helfem {
      * Note that the routine needs the polynomial representation.
      */
     arma::mat twoe_integral(double rmin, double rmax, const arma::vec & x, const arma::vec & wx, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, int L);
+    /**
+     * Same as above, with the basis functions bf tabulated at the
+     * quadrature points x and sbf at the subinterval points, see
+     * FiniteElementBasis::subinterval_points.
+     */
+    arma::mat twoe_integral(double rmin, double rmax, const arma::vec & x, const arma::vec & wx, const arma::mat & bf, const arma::mat & sbf, int L);
+
+    /**
+     * Computes the primitive two-electron in-element integrals for
+     * all L=0,...,Lmax at once. The polynomials are only evaluated
+     * once, and the L values are handled as a batch with matrix
+     * products.
+     */
+    std::vector<arma::mat> twoe_integrals(double rmin, double rmax, const arma::vec & x, const arma::vec & wx, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, int Lmax);
+    /// Same as above, with tabulated basis functions as in twoe_integral
+    std::vector<arma::mat> twoe_integrals(double rmin, double rmax, const arma::vec & x, const arma::vec & wx, const arma::mat & bf, const arma::mat & sbf, int Lmax);
 
     /**
      * Computes the inner in-element two-electron Yukawa integral:
@@ -66,6 +82,8 @@ namespace helfem {
      * Note that the routine needs the polynomial representation.
      */
     arma::mat yukawa_integral(double rmin, double rmax, const arma::vec & x, const arma::vec & wx, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, int L, double lambda);
+    /// Same as above, with tabulated basis functions as in twoe_integral
+    arma::mat yukawa_integral(double rmin, double rmax, const arma::vec & x, const arma::vec & wx, const arma::mat & bf, const arma::mat & sbf, int L, double lambda);
 
     /**
      * Computes a primitive two-electron complementary error function
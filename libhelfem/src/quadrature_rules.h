@@ -0,0 +1,84 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#ifndef QUADRATURE_RULES_H
+#define QUADRATURE_RULES_H
+
+#include <armadillo>
+#include <map>
+#include <memory>
+
+namespace helfem {
+  namespace quadrature_rules {
+    /// Nodes and weights of a quadrature rule
+    struct Rule {
+      /// Nodes
+      arma::vec x;
+      /// Weights
+      arma::vec w;
+    };
+
+    /// Function computing the nodes and weights of an n-point rule
+    typedef void (*rule_function_t)(int n, arma::vec & x, arma::vec & w);
+
+    /**
+     * Process-wide registry of quadrature rules of one type, keyed by
+     * the order. The rules are computed on first request and handed
+     * out as shared, immutable objects afterwards. Lookups and
+     * insertions are serialized; the computation itself runs outside
+     * the lock so that different orders can be built concurrently.
+     */
+    class RuleCache {
+      /// Function used to compute the rules
+      rule_function_t compute;
+      /// Computed rules
+      std::map<int, std::shared_ptr<const Rule>> rules;
+
+    public:
+      /// Constructor
+      RuleCache(rule_function_t compute_) : compute(compute_) {}
+
+      /// Get the n-point rule
+      std::shared_ptr<const Rule> get(int n) {
+        std::shared_ptr<const Rule> rule;
+#ifdef _OPENMP
+#pragma omp critical(helfem_quadrature_rules)
+#endif
+        {
+          auto it = rules.find(n);
+          if(it != rules.end())
+            rule = it->second;
+        }
+        if(rule)
+          return rule;
+
+        std::shared_ptr<Rule> newrule(std::make_shared<Rule>());
+        compute(n, newrule->x, newrule->w);
+
+#ifdef _OPENMP
+#pragma omp critical(helfem_quadrature_rules)
+#endif
+        {
+          // Another thread may have beaten us to it
+          auto res = rules.insert(std::make_pair(n, std::shared_ptr<const Rule>(newrule)));
+          rule = res.first->second;
+        }
+        return rule;
+      }
+    };
+  }
+}
+
+#endif
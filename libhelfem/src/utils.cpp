@@ -15,6 +15,9 @@
  */
 #include "utils.h"
 #include <cmath>
+#include <cstdio>
+#include <algorithm>
+#include <vector>
 
 extern "C" {
 #include <gsl/gsl_sf_bessel.h>
@@ -69,27 +72,51 @@ namespace helfem {
       return ret;
     }
 
-    arma::mat product_tei(const arma::mat & ijint, const arma::mat & klint) {
-      const size_t Ni(ijint.n_rows);
-      const size_t Nj(ijint.n_cols);
-      const size_t Nk(klint.n_rows);
-      const size_t Nl(klint.n_cols);
-
-      arma::mat teiblock(Ni*Nj,Nk*Nl);
-      teiblock.zeros();
-
-      // Form block
-      for(size_t fk=0;fk<Nk;fk++)
-        for(size_t fl=0;fl<Nl;fl++) {
-          // Use temp variable
-          double kl(klint(fk,fl));
-
-          for(size_t fi=0;fi<Ni;fi++)
-            for(size_t fj=0;fj<Nj;fj++)
-              // (ij|kl) in Armadillo compatible indexing
-              teiblock(fj*Ni+fi,fl*Nk+fk)=kl*ijint(fi,fj);
-        }
+    arma::mat bessel_il_array(const arma::vec & r, int Lmax) {
+      // GSL runs the recurrence over L for the scaled functions, so
+      // the exponential only needs to be evaluated once per point
+      arma::mat ret(r.n_elem, Lmax+1);
+      std::vector<double> il(Lmax+1);
+      for(size_t i=0; i<r.n_elem; i++) {
+        gsl_sf_bessel_il_scaled_array(Lmax, r(i), il.data());
+        double scale(exp(std::abs(r(i))));
+        for(int L=0; L<=Lmax; L++)
+          ret(i,L) = scale*il[L];
+      }
+      return ret;
+    }
+
+    arma::mat bessel_kl_array(const arma::vec & r, int Lmax) {
+      // Same as above; see bessel_kl for the normalization
+      arma::mat ret(r.n_elem, Lmax+1);
+      std::vector<double> kl(Lmax+1);
+      for(size_t i=0; i<r.n_elem; i++) {
+        gsl_sf_bessel_kl_scaled_array(Lmax, r(i), kl.data());
+        double scale(exp(-r(i)) / M_PI_2);
+        for(int L=0; L<=Lmax; L++)
+          ret(i,L) = scale*kl[L];
+      }
+      return ret;
+    }
+
+    void product_tei(const arma::mat & ijint, const arma::mat & klint, arma::mat & teiblock) {
+      // In Armadillo compatible indexing (ij|kl) is the outer product
+      // of the vectorized matrices, so every column of the block is a
+      // scaled copy of ijint that is written contiguously
+      teiblock.set_size(ijint.n_elem,klint.n_elem);
+      const double * ij(ijint.memptr());
+      const size_t Nij(ijint.n_elem);
+      for(size_t fkl=0;fkl<klint.n_elem;fkl++) {
+        const double kl(klint(fkl));
+        double * col(teiblock.colptr(fkl));
+        for(size_t fij=0;fij<Nij;fij++)
+          col[fij]=kl*ij[fij];
+      }
+    }
 
+    arma::mat product_tei(const arma::mat & ijint, const arma::mat & klint) {
+      arma::mat teiblock;
+      product_tei(ijint,klint,teiblock);
       return teiblock;
     }
 
@@ -127,7 +154,25 @@ namespace helfem {
       printf("%e %e %e\n",jinorm,lknorm,jilknorm);
     }
 
-    arma::mat exchange_tei(const arma::mat & tei, size_t Ni, size_t Nj, size_t Nk, size_t Nl) {
+    /// Transpose the column-major nr x nc matrix in into out in square tiles, so that both stay in cache; the inner loop writes contiguously
+    static void transpose_tiled(const double * in, size_t nr, size_t nc, double * out) {
+      const size_t tile(16);
+      for(size_t r0=0;r0<nr;r0+=tile) {
+        const size_t r1(std::min(r0+tile,nr));
+        for(size_t c0=0;c0<nc;c0+=tile) {
+          const size_t c1(std::min(c0+tile,nc));
+          for(size_t r=r0;r<r1;r++) {
+            double * o(out+r*nc);
+            for(size_t c=c0;c<c1;c++)
+              o[c]=in[c*nr+r];
+          }
+        }
+      }
+    }
+
+    void exchange_tei(const arma::mat & tei, size_t Ni, size_t Nj, size_t Nk, size_t Nl, arma::mat & ktei) {
+      if(&tei == &ktei)
+        throw std::logic_error("exchange_tei can not be done in place!\n");
 #ifndef ARMA_NO_DEBUG
       if(tei.n_rows != Ni*Nj) {
         std::ostringstream oss;
@@ -141,22 +186,173 @@ namespace helfem {
       }
 #endif
 
-      arma::mat ktei(Nj*Nk,Ni*Nl);
-      ktei.zeros();
-      for(size_t ii=0;ii<Ni;ii++)
-        for(size_t jj=0;jj<Nj;jj++)
-          for(size_t kk=0;kk<Nk;kk++)
-            for(size_t ll=0;ll<Nl;ll++)
-              // (ik|jl) in Armadillo compatible indexing
-              ktei(kk*Nj+jj,ll*Ni+ii)=tei(jj*Ni+ii,ll*Nk+kk);
+      ktei.set_size(Nj*Nk,Ni*Nl);
+      if(!ktei.n_elem)
+        return;
+      // For fixed l, the (ij|kl) are a contiguous Ni x (Nj Nk) matrix
+      // whose transpose is the contiguous block of (jk|il)
+      for(size_t ll=0;ll<Nl;ll++)
+        transpose_tiled(tei.colptr(ll*Nk),Ni,Nj*Nk,ktei.colptr(ll*Ni));
+    }
 
+    arma::mat exchange_tei(const arma::mat & tei, size_t Ni, size_t Nj, size_t Nk, size_t Nl) {
+      arma::mat ktei;
+      exchange_tei(tei,Ni,Nj,Nk,Nl,ktei);
       return ktei;
     }
 
+    bool lowrank_tei(const arma::mat & tei, double thr, arma::mat & A, arma::mat & B) {
+      arma::mat U, V;
+      arma::vec sval;
+      if(!arma::svd_econ(U,sval,V,tei))
+        throw std::runtime_error("SVD of two-electron integrals failed!\n");
+
+      // Singular values are in descending order
+      arma::uword rank=0;
+      while(rank<sval.n_elem && sval(rank)>=thr)
+        rank++;
+      if(rank*(tei.n_rows+tei.n_cols) >= tei.n_elem)
+        return false;
+
+      if(rank) {
+        A=U.cols(0,rank-1)*arma::diagmat(sval.subvec(0,rank-1));
+        B=V.cols(0,rank-1);
+      } else {
+        A.zeros(tei.n_rows,0);
+        B.zeros(tei.n_cols,0);
+      }
+      return true;
+    }
+
+    arma::mat lowrank_exchange(const arma::mat & A, const arma::mat & B, const arma::mat & P) {
+      const size_t Ni(P.n_rows);
+      const size_t Nk(P.n_cols);
+      if(A.n_rows != Ni*Ni || B.n_rows != Nk*Nk || A.n_cols != B.n_cols) {
+        std::ostringstream oss;
+        oss << "Low-rank integrals (" << A.n_rows << "," << A.n_cols << ") and (" << B.n_rows << "," << B.n_cols << ") do not match the (" << Ni << "," << Nk << ") density block!\n";
+        throw std::logic_error(oss.str());
+      }
+
+      // K(jk) = sum_r sum_il A_r(i,j) P(i,l) B_r(k,l)
+      arma::mat K(Ni,Nk,arma::fill::zeros);
+      for(size_t r=0;r<A.n_cols;r++) {
+        const arma::mat Ar(const_cast<double *>(A.colptr(r)),Ni,Ni,false,true);
+        const arma::mat Br(const_cast<double *>(B.colptr(r)),Nk,Nk,false,true);
+        K+=arma::trans(Ar)*P*arma::trans(Br);
+      }
+      return K;
+    }
+
+    size_t pair_count(size_t N, bool sym) {
+      return sym ? N*(N+1)/2 : N*(N-1)/2;
+    }
+
+    arma::mat pair_pack(const arma::mat & M, size_t N, bool sym) {
+      if(M.n_rows != N*N) {
+        std::ostringstream oss;
+        oss << "Invalid input matrix: was supposed to get " << N*N << " rows but got " << M.n_rows << "!\n";
+        throw std::logic_error(oss.str());
+      }
+
+      const double isq2(1.0/std::sqrt(2.0));
+      arma::mat P(pair_count(N,sym),M.n_cols);
+      size_t ip=0;
+      for(size_t jj=0;jj<N;jj++) {
+        if(sym)
+          P.row(ip++)=M.row(jj*N+jj);
+        for(size_t ii=jj+1;ii<N;ii++) {
+          if(sym)
+            P.row(ip++)=isq2*(M.row(jj*N+ii)+M.row(ii*N+jj));
+          else
+            P.row(ip++)=isq2*(M.row(jj*N+ii)-M.row(ii*N+jj));
+        }
+      }
+
+      return P;
+    }
+
+    arma::mat pair_unpack(const arma::mat & P, size_t N, bool sym) {
+      if(P.n_rows != pair_count(N,sym)) {
+        std::ostringstream oss;
+        oss << "Invalid input matrix: was supposed to get " << pair_count(N,sym) << " rows but got " << P.n_rows << "!\n";
+        throw std::logic_error(oss.str());
+      }
+
+      const double isq2(1.0/std::sqrt(2.0));
+      arma::mat M(N*N,P.n_cols,arma::fill::zeros);
+      size_t ip=0;
+      for(size_t jj=0;jj<N;jj++) {
+        if(sym)
+          M.row(jj*N+jj)=P.row(ip++);
+        for(size_t ii=jj+1;ii<N;ii++) {
+          M.row(jj*N+ii)=isq2*P.row(ip);
+          M.row(ii*N+jj)=(sym ? isq2 : -isq2)*P.row(ip);
+          ip++;
+        }
+      }
+
+      return M;
+    }
+
+    arma::mat pair_pack_tei(const arma::mat & tei, size_t N, bool rowsym, bool colsym) {
+      return arma::trans(pair_pack(arma::trans(pair_pack(tei,N,rowsym)),N,colsym));
+    }
+
+    size_t pair_index(size_t i, size_t j, size_t N, bool sym) {
+      // Pairs are ordered with j running slowest
+      if(i<j)
+        std::swap(i,j);
+      if(sym)
+        return j*N - (j*(j-1))/2 + (i-j);
+      else
+        return j*(N-1) - (j*(j-1))/2 + (i-j-1);
+    }
+
+    template<typename T> static void pair_tei_tile_wrk(const arma::Mat<T> & tei, size_t N, size_t l, arma::Mat<T> & tile, double fac, size_t off_bra, size_t off_ket) {
+      if(tile.n_rows != N*N || tile.n_cols != N) {
+        std::ostringstream oss;
+        oss << "Invalid tile: was supposed to be " << N*N << " x " << N << " but got " << tile.n_rows << " x " << tile.n_cols << "!\n";
+        throw std::logic_error(oss.str());
+      }
+
+      // The off-diagonal pair functions carry a 1/sqrt(2) weight
+      const double isq2(1.0/std::sqrt(2.0));
+      for(size_t kk=0;kk<N;kk++) {
+        const double kfac((kk==l) ? fac : fac*isq2);
+        const T * col(tei.colptr(off_ket+pair_index(kk,l,N,true)));
+        for(size_t jj=0;jj<N;jj++)
+          for(size_t ii=0;ii<N;ii++)
+            tile(jj*N+ii,kk)=(T) (((ii==jj) ? kfac : kfac*isq2)*col[off_bra+pair_index(ii,jj,N,true)]);
+      }
+    }
+
+    void pair_tei_tile(const arma::mat & tei, size_t N, size_t l, arma::mat & tile, double fac, size_t off_bra, size_t off_ket) {
+      pair_tei_tile_wrk<double>(tei,N,l,tile,fac,off_bra,off_ket);
+    }
+
+    void pair_tei_tile(const arma::fmat & tei, size_t N, size_t l, arma::fmat & tile, double fac, size_t off_bra, size_t off_ket) {
+      pair_tei_tile_wrk<float>(tei,N,l,tile,fac,off_bra,off_ket);
+    }
+
     int stricmp(const std::string & str1, const std::string & str2) {
       return strcasecmp(str1.c_str(),str2.c_str());
     }
 
+    std::string hash_data(const arma::vec & x) {
+      const unsigned char * p((const unsigned char *) x.memptr());
+      const size_t N(x.n_elem*sizeof(double));
+
+      unsigned long long h(14695981039346656037ULL);
+      for(size_t i=0;i<N;i++) {
+        h^=p[i];
+        h*=1099511628211ULL;
+      }
+
+      char str[17];
+      snprintf(str,sizeof(str),"%016llx",h);
+      return std::string(str);
+    }
+
     arma::mat invh(arma::mat S, bool chol) {
       // Get the basis function norms
       arma::vec bfnormlz(arma::pow(arma::diagvec(S),-0.5));
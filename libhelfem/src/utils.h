@@ -37,18 +37,48 @@ namespace helfem {
     double bessel_kl(double x, int L);
     /// Modified Bessel function
     arma::vec bessel_kl(const arma::vec & x, int L);
+    /// Modified Bessel functions i_L(x) for L=0,...,Lmax, stored column-wise
+    arma::mat bessel_il_array(const arma::vec & x, int Lmax);
+    /// Modified Bessel functions k_L(x) for L=0,...,Lmax, stored column-wise
+    arma::mat bessel_kl_array(const arma::vec & x, int Lmax);
 
     /// Form two-electron integrals from product of large-r and small-r radial moment matrices
     arma::mat product_tei(const arma::mat & big, const arma::mat & small);
+    /// Same as above, writing into tei whose memory is reused if it already has the right size
+    void product_tei(const arma::mat & big, const arma::mat & small, arma::mat & tei);
 
     /// Check that the two-electron integral has proper symmetry i<->j and k<->l
     void check_tei_symmetry(const arma::mat & tei, size_t Ni, size_t Nj, size_t Nk, size_t Nl);
 
     /// Permute indices (ij|kl) -> (jk|il)
     arma::mat exchange_tei(const arma::mat & tei, size_t Ni, size_t Nj, size_t Nk, size_t Nl);
+    /// Same as above, writing into ktei whose memory is reused if it already has the right size; ktei must not be tei
+    void exchange_tei(const arma::mat & tei, size_t Ni, size_t Nj, size_t Nk, size_t Nl, arma::mat & ktei);
+    /// Truncated singular value decomposition (ij|kl) = sum_r A(ij,r) B(kl,r), keeping singular values above thr; returns false if the factors would take more storage than tei
+    bool lowrank_tei(const arma::mat & tei, double thr, arma::mat & A, arma::mat & B);
+    /// Exchange contraction K(jk) = sum_il (ij|kl) P(il) of integrals factorized by lowrank_tei
+    arma::mat lowrank_exchange(const arma::mat & A, const arma::mat & B, const arma::mat & P);
+
+    /// Number of symmetric (i>=j) or antisymmetric (i>j) index pairs of N functions
+    size_t pair_count(size_t N, bool sym);
+    /// Transform the rows of M, indexed by the vectorized pair (i,j) of N functions, to the orthonormal pair-symmetric or antisymmetric combinations
+    arma::mat pair_pack(const arma::mat & M, size_t N, bool sym);
+    /// Inverse of pair_pack: back-transform the rows of P to the vectorized pair (i,j)
+    arma::mat pair_unpack(const arma::mat & P, size_t N, bool sym);
+    /// Project an (N^2 x N^2) two-electron integral block onto the pair-symmetric or antisymmetric subspaces of its rows and columns
+    arma::mat pair_pack_tei(const arma::mat & tei, size_t N, bool rowsym, bool colsym);
+    /// Index of the pair (i,j) in the pair-symmetric (i>=j) or antisymmetric (i>j) ordering of pair_pack
+    size_t pair_index(size_t i, size_t j, size_t N, bool sym);
+    /// Unpack fac*(ij|kl) for a fixed l into tile(i+j*N,k) from the pair-symmetric integral block of tei starting at (off_bra, off_ket)
+    void pair_tei_tile(const arma::mat & tei, size_t N, size_t l, arma::mat & tile, double fac=1.0, size_t off_bra=0, size_t off_ket=0);
+    /// Single-precision version of pair_tei_tile
+    void pair_tei_tile(const arma::fmat & tei, size_t N, size_t l, arma::fmat & tile, double fac=1.0, size_t off_bra=0, size_t off_ket=0);
 
     /// Case independent string comparison
     int stricmp(const std::string & str1, const std::string & str2);
+
+    /// 64-bit FNV-1a hash of the binary representation of the data, in hexadecimal
+    std::string hash_data(const arma::vec & x);
   }
 }
 
@@ -21,6 +21,12 @@
 #include "../general/gaunt.h"
 #include "utils.h"
 #include "../general/scf_helpers.h"
+#include "../general/timer.h"
+#include "../general/profiler.h"
+#include "../general/memtrack.h"
+#include "../general/numa.h"
+#include "../general/threads.h"
+#include <algorithm>
 #include <cassert>
 #include <cfloat>
 #include <helfem.h>
@@ -32,10 +38,13 @@
 namespace helfem {
   namespace atomic {
     namespace basis {
-      TwoDBasis::TwoDBasis() {
+      TwoDBasis::TwoDBasis() : tei_storage(scratch::TEI_INCORE), tei_budget(0), tei_ncache(0), tei_ndom(0), screen_thr(10*DBL_EPSILON), coulomb_nactive(0), coulomb_ntot(0), rs_thr(0.0), N_Lmom(0) {
       }
 
-      TwoDBasis::TwoDBasis(int Z_, modelpotential::nuclear_model_t model_, double Rrms_, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, bool zeroder_, int n_quad, const arma::vec & bval, int taylor_order, const arma::ivec & lval_, const arma::ivec & mval_, int Zl_, int Zr_, double Rhalf_) {
+      TwoDBasis::TwoDBasis(int Z_, modelpotential::nuclear_model_t model_, double Rrms_, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, bool zeroder_, int n_quad, const arma::vec & bval, int taylor_order, const arma::ivec & lval_, const arma::ivec & mval_, int Zl_, int Zr_, double Rhalf_) : TwoDBasis(Z_, model_, Rrms_, std::vector<std::shared_ptr<const polynomial_basis::PolynomialBasis>>(1,poly), arma::zeros<arma::uvec>(bval.n_elem ? bval.n_elem-1 : 0), zeroder_, n_quad, bval, taylor_order, lval_, mval_, Zl_, Zr_, Rhalf_) {
+      }
+
+      TwoDBasis::TwoDBasis(int Z_, modelpotential::nuclear_model_t model_, double Rrms_, const std::vector<std::shared_ptr<const polynomial_basis::PolynomialBasis>> & polys, const arma::uvec & el_poly, bool zeroder_, int n_quad, const arma::vec & bval, int taylor_order, const arma::ivec & lval_, const arma::ivec & mval_, int Zl_, int Zr_, double Rhalf_) : tei_storage(scratch::TEI_INCORE), tei_budget(0), tei_ncache(0), tei_ndom(0), screen_thr(10*DBL_EPSILON), coulomb_nactive(0), coulomb_ntot(0), rs_thr(0.0), N_Lmom(0) {
         // Nuclear charge
         Z=Z_;
         Zl=Zl_;
@@ -49,12 +58,110 @@ namespace helfem {
         bool zero_deriv_left=false;
         bool zero_func_right=true;
         zeroder=zeroder_;
-        polynomial_basis::FiniteElementBasis fem(poly, bval, zero_func_left, zero_deriv_left, zero_func_right, zeroder);
+        polynomial_basis::FiniteElementBasis fem(polys, el_poly, bval, zero_func_left, zero_deriv_left, zero_func_right, zeroder);
         radial=RadialBasis(fem, n_quad, taylor_order);
 
         // Construct angular basis
         lval=lval_;
         mval=mval_;
+
+        // Gaunt coefficient table; the field couplings go up to cos^4
+        int gmax(std::max(arma::max(lval),arma::max(mval)));
+        gaunt=gaunt::shared_table(gmax,std::max(2*gmax,4),gmax);
+
+        // Angular couplings in exchange
+        form_exchange_couplings();
+        // Radial moments for the one-electron operators and the
+        // two-electron integrals
+        compute_moments();
+      }
+
+      void TwoDBasis::compute_moments() {
+        // The off-center nuclei need L up to 2 lmax, and the
+        // quadrupole needs L=2
+        N_Lmom=std::max(2*arma::max(lval),(arma::sword) 2)+1;
+        size_t Nel(radial.Nel());
+
+        disjoint_L.resize(Nel*N_Lmom);
+        disjoint_m1L.resize(Nel*N_Lmom);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,1)
+#endif
+        for(size_t iel=0;iel<Nel;iel++) {
+          std::vector<arma::mat> rL, rm1L;
+          radial.radial_moments(N_Lmom-1,iel,rL,rm1L);
+          for(size_t L=0;L<N_Lmom;L++) {
+            disjoint_L[L*Nel+iel]=rL[L];
+            disjoint_m1L[L*Nel+iel]=rm1L[L];
+          }
+        }
+      }
+
+      arma::mat TwoDBasis::radial_moment(int n) const {
+        size_t Nel(radial.Nel());
+        size_t L(n>=0 ? n : -n-1);
+        if(L>=N_Lmom) {
+          std::ostringstream oss;
+          oss << "Radial moment " << n << " has not been computed!\n";
+          throw std::logic_error(oss.str());
+        }
+        const std::vector<arma::mat> & mom(n>=0 ? disjoint_L : disjoint_m1L);
+
+        size_t Nrad(radial.Nbf());
+        arma::mat O(Nrad,Nrad,arma::fill::zeros);
+        for(size_t iel=0;iel<Nel;iel++) {
+          size_t ifirst, ilast;
+          radial.get_idx(iel,ifirst,ilast);
+          O.submat(ifirst,ifirst,ilast,ilast)+=mom[L*Nel+iel];
+        }
+        return O;
+      }
+
+      void TwoDBasis::form_exchange_couplings() {
+        exch_cpl.clear();
+        exch_cpl.resize(lval.n_elem*lval.n_elem);
+        for(size_t jang=0;jang<lval.n_elem;jang++) {
+          int lj(lval(jang));
+          int mj(mval(jang));
+          for(size_t kang=0;kang<lval.n_elem;kang++) {
+            int lk(lval(kang));
+            int mk(mval(kang));
+
+            std::vector<exchange_coupling_t> & list(exch_cpl[jang*lval.n_elem+kang]);
+            for(size_t iang=0;iang<lval.n_elem;iang++) {
+              int li(lval(iang));
+              int mi(mval(iang));
+              for(size_t lang=0;lang<lval.n_elem;lang++) {
+                int ll(lval(lang));
+                int ml(mval(lang));
+
+                // LH m value
+                int M(mj-mi);
+                // RH m value
+                int Mp(mk-ml);
+                if(M!=Mp)
+                  continue;
+
+                // M values match. Loop over possible couplings
+                int Lmin=std::max(std::max(std::abs(li-lj),std::abs(lk-ll)),abs(M));
+                int Lmax=std::min(li+lj,lk+ll);
+                for(int L=Lmin;L<=Lmax;L++) {
+                  // Calculate total coupling coefficient
+                  double cpl(gaunt->coeff(lj,mj,L,M,li,mi)*gaunt->coeff(lk,mk,L,M,ll,ml));
+                  if(cpl==0.0)
+                    continue;
+
+                  exchange_coupling_t c;
+                  c.iang=iang;
+                  c.lang=lang;
+                  c.L=L;
+                  c.cpl=cpl;
+                  list.push_back(c);
+                }
+              }
+            }
+          }
+        }
       }
 
       TwoDBasis::~TwoDBasis() {
@@ -108,6 +215,18 @@ namespace helfem {
         return radial.get_poly_nnodes();
       }
 
+      bool TwoDBasis::uniform_poly() const {
+        return radial.uniform_poly();
+      }
+
+      arma::ivec TwoDBasis::get_element_poly_id() const {
+        return radial.get_element_poly_id();
+      }
+
+      arma::ivec TwoDBasis::get_element_poly_nnodes() const {
+        return radial.get_element_poly_nnodes();
+      }
+
       int TwoDBasis::get_zeroder() const {
         return zeroder;
       }
@@ -223,6 +342,94 @@ namespace helfem {
         return idx;
       }
 
+      arma::ivec TwoDBasis::shell_mirror() const {
+        arma::ivec mirror(lval.n_elem);
+        mirror.fill(-1);
+        for(size_t iang=0;iang<lval.n_elem;iang++)
+          for(size_t jang=0;jang<lval.n_elem;jang++)
+            if(lval(jang)==lval(iang) && mval(jang)==-mval(iang)) {
+              mirror(iang)=jang;
+              break;
+            }
+        return mirror;
+      }
+
+      arma::uvec TwoDBasis::mirror_indices() const {
+        arma::ivec mirror(shell_mirror());
+        if(arma::any(mirror<0))
+          return arma::uvec();
+
+        size_t Nrad(radial.Nbf());
+        arma::uvec perm(Ndummy());
+        for(size_t iang=0;iang<lval.n_elem;iang++)
+          for(size_t k=0;k<Nrad;k++)
+            perm(iang*Nrad+k)=mirror(iang)*Nrad+k;
+        return perm;
+      }
+
+      arma::ivec TwoDBasis::get_sym_mirror(int symm) const {
+        std::vector<arma::uvec> idx(get_sym_idx(symm));
+        arma::ivec mirror(idx.size());
+        mirror.fill(-1);
+
+        arma::uvec perm(mirror_indices());
+        if(!perm.n_elem)
+          return mirror;
+
+        // Symmetry block of every basis function
+        arma::uvec block(Nbf());
+        for(size_t isym=0;isym<idx.size();isym++)
+          block(idx[isym]).fill(isym);
+
+        for(size_t isym=0;isym<idx.size();isym++) {
+          if(!idx[isym].n_elem)
+            continue;
+          size_t jsym(block(perm(idx[isym](0))));
+          // The first block of the pair is solved
+          if(jsym<isym && idx[jsym].n_elem==idx[isym].n_elem)
+            mirror(isym)=jsym;
+        }
+        return mirror;
+      }
+
+      bool TwoDBasis::mirror_symmetric(const std::vector<arma::mat> & P) const {
+        arma::uvec perm(mirror_indices());
+        if(!perm.n_elem)
+          return false;
+        for(size_t id=0;id<P.size();id++) {
+          double thr(100*DBL_EPSILON*std::max(1.0,arma::abs(P[id]).max()));
+          if(arma::abs(P[id]-P[id](perm,perm)).max()>thr)
+            return false;
+        }
+        return true;
+      }
+
+      bool TwoDBasis::mirror_canonical(size_t jang, size_t kang) const {
+        return mval(jang)>0 || (mval(jang)==0 && mval(kang)>=0);
+      }
+
+      std::vector< std::pair<size_t,size_t> > TwoDBasis::exchange_pairs(bool mirrored) const {
+        std::vector< std::pair<size_t,size_t> > pairs;
+        for(size_t jang=0;jang<lval.n_elem;jang++)
+          for(size_t kang=0;kang<lval.n_elem;kang++)
+            if(!mirrored || mirror_canonical(jang,kang))
+              pairs.push_back(std::make_pair(jang,kang));
+        return pairs;
+      }
+
+      void TwoDBasis::mirror_fill(std::vector<arma::mat> & K) const {
+        arma::ivec mirror(shell_mirror());
+        size_t Nrad(radial.Nbf());
+        for(size_t jang=0;jang<lval.n_elem;jang++)
+          for(size_t kang=0;kang<lval.n_elem;kang++) {
+            if(mirror_canonical(jang,kang))
+              continue;
+            size_t jm(mirror(jang)), km(mirror(kang));
+            for(size_t id=0;id<K.size();id++)
+              K[id].submat(jang*Nrad,kang*Nrad,(jang+1)*Nrad-1,(kang+1)*Nrad-1)=K[id].submat(jm*Nrad,km*Nrad,(jm+1)*Nrad-1,(km+1)*Nrad-1);
+          }
+      }
+
       arma::mat TwoDBasis::Shalf(bool chol, int sym) const {
         // Form overlap matrix
         arma::mat S(overlap());
@@ -238,18 +445,16 @@ namespace helfem {
           // Half-inverse is
           return arma::diagmat(bfinvnormlz) * arma::chol(S);
 
+        } else if(sym) {
+          // S is block diagonal in the symmetries
+          return arma::diagmat(bfinvnormlz)*scf::form_Shalf(S,get_sym_idx(sym));
+
         } else {
           arma::vec Sval;
           arma::mat Svec;
-          if(sym) {
-            // Symmetries
-            std::vector<arma::uvec> midx(get_sym_idx(sym));
-            scf::eig_sym_sub(Sval,Svec,S,midx);
-          } else {
-            if(!arma::eig_sym(Sval,Svec,S)) {
-              S.save("S.dat",arma::raw_ascii);
-              throw std::logic_error("Diagonalization of overlap matrix failed\n");
-            }
+          if(!arma::eig_sym(Sval,Svec,S)) {
+            S.save("S.dat",arma::raw_ascii);
+            throw std::logic_error("Diagonalization of overlap matrix failed\n");
           }
           printf("Smallest eigenvalue of overlap matrix is % e, condition number %e\n",Sval(0),Sval(Sval.n_elem-1)/Sval(0));
 
@@ -268,22 +473,9 @@ namespace helfem {
         if(sym==0) {
           return scf::form_Sinvh(S,chol);
         } else {
-          // Get basis function indices
-          std::vector<arma::uvec> midx(get_sym_idx(sym));
-          // Construct Sinvh in each subblock
-          arma::mat Sinvh(Nbf(),Nbf(),arma::fill::zeros);
-          size_t ioff=0;
-          for(size_t i=0;i<midx.size();i++) {
-            if(!midx[i].n_elem)
-              continue;
-
-            // Column indices
-            arma::uvec cidx(arma::linspace<arma::uvec>(ioff,ioff+midx[i].n_elem-1,midx[i].n_elem));
-            Sinvh(midx[i],cidx)=scf::form_Sinvh(S(midx[i],midx[i]),chol);
-            // Increment offset
-            ioff += midx[i].n_elem;
-          }
-          return Sinvh;
+          // Construct Sinvh in each subblock; the columns of the blocks
+          // are given by scf::block_columns
+          return scf::form_Sinvh(S,get_sym_idx(sym),chol);
         }
       }
 
@@ -301,22 +493,15 @@ namespace helfem {
 
       arma::mat TwoDBasis::radial_integral(int Rexp) const {
         // Build radial elements
-        size_t Nrad(radial.Nbf());
-        arma::mat Orad(Nrad,Nrad);
-        Orad.zeros();
-
-        // Loop over elements
-        for(size_t iel=0;iel<radial.Nel();iel++) {
-          // Where are we in the matrix?
-          size_t ifirst, ilast;
-          radial.get_idx(iel,ifirst,ilast);
-	  Orad.submat(ifirst,ifirst,ilast,ilast)+=radial.radial_integral(Rexp,iel);
-        }
+        arma::mat Orad(radial.radial_integral_banded(Rexp).dense());
 
         // Full overlap matrix
         arma::mat O(Ndummy(),Ndummy());
         O.zeros();
         // Fill elements
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
         for(size_t iang=0;iang<lval.n_elem;iang++)
           set_sub(O,iang,iang,Orad);
 
@@ -327,6 +512,21 @@ namespace helfem {
         return radial_integral(0);
       }
 
+      arma::mat TwoDBasis::absorbing_potential(double R0) const {
+        // The potential is spherically symmetric
+        arma::mat Wrad(radial.absorbing_potential_banded(R0).dense());
+
+        arma::mat W(Ndummy(),Ndummy());
+        W.zeros();
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+        for(size_t iang=0;iang<lval.n_elem;iang++)
+          set_sub(W,iang,iang,Wrad);
+
+        return remove_boundaries(W);
+      }
+
       arma::mat TwoDBasis::overlap(const TwoDBasis & rh) const {
         // Full overlap matrix
         arma::mat S(Ndummy(),rh.Ndummy());
@@ -345,25 +545,16 @@ namespace helfem {
 
       arma::mat TwoDBasis::kinetic() const {
         // Build radial kinetic energy matrix
-        size_t Nrad(radial.Nbf());
-        arma::mat Trad(Nrad,Nrad);
-        Trad.zeros();
-        arma::mat Trad_l(Nrad,Nrad);
-        Trad_l.zeros();
-
-        // Loop over elements
-        for(size_t iel=0;iel<radial.Nel();iel++) {
-          // Where are we in the matrix?
-          size_t ifirst, ilast;
-          radial.get_idx(iel,ifirst,ilast);
-          Trad.submat(ifirst,ifirst,ilast,ilast)+=radial.kinetic(iel);
-          Trad_l.submat(ifirst,ifirst,ilast,ilast)+=radial.kinetic_l(iel);
-        }
+        arma::mat Trad(radial.kinetic_banded().dense());
+        arma::mat Trad_l(radial.kinetic_l_banded().dense());
 
         // Full kinetic energy matrix
         arma::mat T(Ndummy(),Ndummy());
         T.zeros();
         // Fill elements
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
         for(size_t iang=0;iang<lval.n_elem;iang++) {
           set_sub(T,iang,iang,Trad);
           if(lval(iang)>0) {
@@ -387,17 +578,11 @@ namespace helfem {
           V.zeros();
 
           if(Z!=0.0) {
-            size_t Nrad(radial.Nbf());
-            arma::mat Vrad(Nrad,Nrad);
-            Vrad.zeros();
-            // Loop over elements
-            for(size_t iel=0;iel<radial.Nel();iel++) {
-              // Where are we in the matrix?
-              size_t ifirst, ilast;
-              radial.get_idx(iel,ifirst,ilast);
-              Vrad.submat(ifirst,ifirst,ilast,ilast)+=radial.radial_integral(-1,iel);
-            }
+            arma::mat Vrad(radial.radial_integral_banded(-1).dense());
             // Fill elements
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
             for(size_t iang=0;iang<lval.n_elem;iang++)
               set_sub(V,iang,iang,-Z*Vrad);
           }
@@ -407,21 +592,32 @@ namespace helfem {
             size_t Nrad(radial.Nbf());
             int Lmax(2*arma::max(lval));
             std::vector<arma::mat> Vaux(Lmax+1);
+            // Multipole expansion of the off-center nuclei from the
+            // cached radial moments
+            size_t Nel(radial.Nel());
+            arma::vec bval(radial.get_bval());
+            for(size_t iel=0;iel<Nel;iel++)
+              if(bval(iel)<Rhalf && bval(iel+1)>Rhalf)
+                throw std::logic_error("Nucleus placed within element!\n");
 #ifdef _OPENMP
 #pragma omp parallel for
 #endif
             for(int L=0;L<=Lmax;L++) {
+              double Lfac(-sqrt(4.0*M_PI/(2*L+1)));
+              double Rbig(std::pow(Rhalf,L));
+              double Rsmall(std::pow(Rhalf,-L-1));
               Vaux[L].zeros(Nrad,Nrad);
-              for(size_t iel=0;iel<radial.Nel();iel++) {
+              for(size_t iel=0;iel<Nel;iel++) {
                 // Where are we in the matrix?
                 size_t ifirst, ilast;
                 radial.get_idx(iel,ifirst,ilast);
-                Vaux[L].submat(ifirst,ifirst,ilast,ilast)+=radial.nuclear_offcenter(iel,Rhalf,L);
+                if(bval(iel)>=Rhalf)
+                  Vaux[L].submat(ifirst,ifirst,ilast,ilast)+=Lfac*Rbig*disjoint_m1L[L*Nel+iel];
+                else
+                  Vaux[L].submat(ifirst,ifirst,ilast,ilast)+=Lfac*Rsmall*disjoint_L[L*Nel+iel];
               }
             }
 
-            int gmax(std::max(arma::max(lval),arma::max(mval)));
-            gaunt::Gaunt gaunt(gmax,2*gmax,gmax);
 
             /// Loop over basis set
 #ifdef _OPENMP
@@ -441,7 +637,7 @@ namespace helfem {
 
                 // Loop over L
                 for(int L=std::abs(li-lj);L<=li+lj;L++) {
-                  double cpl(gaunt.coeff(li,mi,L,0,lj,mj));
+                  double cpl(gaunt->coeff(li,mi,L,0,lj,mj));
                   if(cpl==0.0)
                     continue;
 
@@ -461,16 +657,26 @@ namespace helfem {
         V.zeros();
 
 	size_t Nrad(radial.Nbf());
+	// The elements share their boundary functions, so the element
+	// matrices are computed in parallel and summed up afterwards
+	std::vector<arma::mat> Vel(radial.Nel());
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,1)
+#endif
+	for(size_t iel=0;iel<radial.Nel();iel++)
+	  Vel[iel]=radial.model_potential(pot,iel);
 	arma::mat Vrad(Nrad,Nrad);
 	Vrad.zeros();
-	// Loop over elements
 	for(size_t iel=0;iel<radial.Nel();iel++) {
 	  // Where are we in the matrix?
 	  size_t ifirst, ilast;
 	  radial.get_idx(iel,ifirst,ilast);
-	  Vrad.submat(ifirst,ifirst,ilast,ilast)+=radial.model_potential(pot,iel);
+	  Vrad.submat(ifirst,ifirst,ilast,ilast)+=Vel[iel];
 	}
 	// Fill elements
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
 	for(size_t iang=0;iang<lval.n_elem;iang++)
 	  set_sub(V,iang,iang,Vrad);
 
@@ -479,36 +685,25 @@ namespace helfem {
 
       arma::mat TwoDBasis::dipole_z() const {
         // Build radial elements
-        size_t Nrad(radial.Nbf());
-        arma::mat Orad(Nrad,Nrad);
-        Orad.zeros();
+        arma::mat Orad(radial_moment(1));
 
         // Full electric couplings
         arma::mat V(Ndummy(),Ndummy());
         V.zeros();
 
-        // Loop over elements
-        for(size_t iel=0;iel<radial.Nel();iel++) {
-          // Where are we in the matrix?
-          size_t ifirst, ilast;
-          radial.get_idx(iel,ifirst,ilast);
-          Orad.submat(ifirst,ifirst,ilast,ilast)+=radial.radial_integral(1,iel);
-        }
-
-        int gmax(std::max(arma::max(lval),arma::max(mval)));
-        gaunt::Gaunt gaunt(gmax,1,gmax);
-
         // Fill elements
+#ifdef _OPENMP
+#pragma omp parallel for collapse(2)
+#endif
         for(size_t iang=0;iang<lval.n_elem;iang++) {
-          int li(lval(iang));
-          int mi(mval(iang));
-
           for(size_t jang=0;jang<lval.n_elem;jang++) {
+            int li(lval(iang));
+            int mi(mval(iang));
             int lj(lval(jang));
             int mj(mval(jang));
 
             // Calculate coupling
-            double cpl(gaunt.cosine_coupling(lj,mj,li,mi));
+            double cpl(gaunt->cosine_coupling(lj,mj,li,mi));
             if(cpl!=0.0)
               set_sub(V,iang,jang,Orad*cpl);
           }
@@ -519,36 +714,25 @@ namespace helfem {
 
       arma::mat TwoDBasis::quadrupole_zz() const {
         // Build radial elements
-        size_t Nrad(radial.Nbf());
-        arma::mat Orad(Nrad,Nrad);
-        Orad.zeros();
+        arma::mat Orad(radial_moment(2));
 
         // Full electric couplings
         arma::mat V(Ndummy(),Ndummy());
         V.zeros();
 
-        // Loop over elements
-        for(size_t iel=0;iel<radial.Nel();iel++) {
-          // Where are we in the matrix?
-          size_t ifirst, ilast;
-          radial.get_idx(iel,ifirst,ilast);
-          Orad.submat(ifirst,ifirst,ilast,ilast)+=radial.radial_integral(2,iel);
-        }
-
-        int gmax(std::max(arma::max(lval),arma::max(mval)));
-        gaunt::Gaunt gaunt(gmax,2,gmax);
-
         // Fill elements
+#ifdef _OPENMP
+#pragma omp parallel for collapse(2)
+#endif
         for(size_t iang=0;iang<lval.n_elem;iang++) {
-          int li(lval(iang));
-          int mi(mval(iang));
-
           for(size_t jang=0;jang<lval.n_elem;jang++) {
+            int li(lval(iang));
+            int mi(mval(iang));
             int lj(lval(jang));
             int mj(mval(jang));
 
             // Calculate coupling
-            double cpl(gaunt.coeff(lj,mj,2,0,li,mi));
+            double cpl(gaunt->coeff(lj,mj,2,0,li,mi));
             if(cpl!=0.0) {
               const double c0(2.0/5.0*sqrt(5.0*M_PI));
               cpl*=c0;
@@ -562,39 +746,26 @@ namespace helfem {
 
       arma::mat TwoDBasis::Bz_field(double B) const {
         // Build radial elements
-        size_t Nrad(radial.Nbf());
-        arma::mat O0rad(Nrad,Nrad);
-        O0rad.zeros();
-        arma::mat O2rad(Nrad,Nrad);
-        O2rad.zeros();
-
-        // Loop over elements
-        for(size_t iel=0;iel<radial.Nel();iel++) {
-          // Where are we in the matrix?
-          size_t ifirst, ilast;
-          radial.get_idx(iel,ifirst,ilast);
-          O0rad.submat(ifirst,ifirst,ilast,ilast)+=radial.radial_integral(0,iel);
-          O2rad.submat(ifirst,ifirst,ilast,ilast)+=radial.radial_integral(2,iel);
-        }
+        arma::mat O0rad(radial_moment(0));
+        arma::mat O2rad(radial_moment(2));
 
         // Full coupling
         arma::mat V(Ndummy(),Ndummy());
         V.zeros();
 
-        int gmax(std::max(arma::max(lval),arma::max(mval)));
-        gaunt::Gaunt gaunt(gmax,4,gmax);
-
         // Fill elements
+#ifdef _OPENMP
+#pragma omp parallel for collapse(2)
+#endif
         for(size_t iang=0;iang<lval.n_elem;iang++) {
-          int li(lval(iang));
-          int mi(mval(iang));
-
           for(size_t jang=0;jang<lval.n_elem;jang++) {
+            int li(lval(iang));
+            int mi(mval(iang));
             int lj(lval(jang));
             int mj(mval(jang));
 
             // Calculate coupling
-            double cpl(gaunt.sine2_coupling(lj,mj,li,mi));
+            double cpl(gaunt->sine2_coupling(lj,mj,li,mi));
             if(cpl!=0.0) {
               set_sub(V,iang,jang,B*B/8.0*O2rad*cpl);
             }
@@ -615,7 +786,7 @@ namespace helfem {
       size_t TwoDBasis::mem_1el_aux() const {
         size_t Nel(radial.Nel());
         size_t Nprim(radial.max_Nprim());
-        size_t N_L(2*arma::max(lval)+1);
+        size_t N_L(std::max(2*arma::max(lval),(arma::sword) 2)+1);
 
         return 2*N_L*Nel*Nprim*Nprim*sizeof(double);
       }
@@ -628,130 +799,396 @@ namespace helfem {
         // Number of primitive functions per element
         size_t Nprim(radial.max_Nprim());
 
+        // Number of symmetric primitive pairs
+        size_t Nsym(utils::pair_count(Nprim,true));
+
         // Memory use is thus
         //return 2*N_L*Nel*Nel*Nprim*Nprim*Nprim*Nprim*sizeof(double);
-        // No off-diagonal storage
-        return 2*N_L*Nel*Nprim*Nprim*Nprim*Nprim*sizeof(double);
+        // No off-diagonal storage. The integrals only live in the
+        // pair-symmetric subspace, and the exchange-ordered integrals
+        // are derived from them on the fly
+        return N_L*Nel*Nsym*Nsym*sizeof(double);
       }
 
 
-      void TwoDBasis::compute_tei(bool exchange) {
-        // Number of distinct L values is
-        size_t N_L(2*arma::max(lval)+1);
+      void TwoDBasis::set_tei_storage(size_t budget, const std::string & scratchdir, bool direct, size_t ncache) {
+        tei_budget=budget;
+        tei_scratch=scratchdir;
+        tei_storage=direct ? scratch::TEI_RECOMPUTE : scratch::choose_storage(mem_2el_aux(),tei_budget,tei_scratch);
+        tei_ncache=ncache;
+        tei_lru.clear();
+        memory::set("TEI cache",0);
+      }
+
+      void TwoDBasis::set_screening(double thr) {
+        screen_thr=std::max(thr,10*DBL_EPSILON);
+      }
+
+      void TwoDBasis::get_coulomb_channels(size_t & nactive, size_t & ntot) const {
+        nactive=coulomb_nactive;
+        ntot=coulomb_ntot;
+      }
+
+      arma::mat TwoDBasis::block_norms(const std::vector<arma::mat> & P, size_t first, size_t last) const {
+        size_t Nrad(radial.Nbf());
+        arma::mat bdens(lval.n_elem,lval.n_elem,arma::fill::zeros);
+        for(size_t id=0;id<P.size();id++)
+          for(size_t iang=0;iang<lval.n_elem;iang++)
+            for(size_t lang=0;lang<lval.n_elem;lang++)
+              bdens(iang,lang)=std::max(bdens(iang,lang),arma::norm(P[id].submat(iang*Nrad+first,lang*Nrad+first,iang*Nrad+last,lang*Nrad+last),"fro"));
+        return bdens;
+      }
+
+      arma::uvec TwoDBasis::element_order() const {
         size_t Nel(radial.Nel());
+        arma::uvec order(Nel);
+        std::vector<bool> done(Nel,false);
+        size_t n=0;
+        // Cached elements first, so that they are used before they are evicted
+        for(std::list< std::pair< size_t, std::vector<arma::mat> > >::const_iterator it=tei_lru.begin();it!=tei_lru.end();++it) {
+          order(n++)=it->first;
+          done[it->first]=true;
+        }
+        for(size_t iel=0;iel<Nel;iel++)
+          if(!done[iel])
+            order(n++)=iel;
+        return order;
+      }
 
-        // Compute disjoint integrals
-        disjoint_L.resize(Nel*N_L);
-        disjoint_m1L.resize(Nel*N_L);
-        for(size_t L=0;L<N_L;L++)
-          for(size_t iel=0;iel<Nel;iel++) {
-            disjoint_L[L*Nel+iel]=radial.radial_integral(L,iel);
-            disjoint_m1L[L*Nel+iel]=radial.radial_integral(-L-1,iel);
-          }
+      scratch::tei_storage_t TwoDBasis::get_tei_storage() const {
+        return tei_storage;
+      }
+
+      void TwoDBasis::set_tei_single(bool single) {
+        prim_tei_single.clear();
+        memory::set("TEI single",0);
+        if(!single)
+          return;
+        if(tei_storage!=scratch::TEI_INCORE || !prim_tei.size()) {
+          printf("Single-precision integrals need in-core storage; staying in double precision\n");
+          return;
+        }
 
-        // Form two-electron integrals
-        prim_tei.resize(Nel*Nel*N_L);
+        size_t nsingle=0;
+        prim_tei_single.resize(prim_tei.size());
+        for(size_t i=0;i<prim_tei.size();i++)
+          nsingle+=prim_tei[i].n_elem;
+        if(tei_domains.size()) {
+          // The copies are made by the team that contracts them
+          size_t N_L(2*arma::max(lval)+1);
+          size_t Nel(radial.Nel());
+          const int nin(numa::team_size(tei_domains.size()));
 #ifdef _OPENMP
-#pragma omp parallel for collapse(2)
+#pragma omp parallel num_threads(tei_domains.size()) proc_bind(spread)
 #endif
-        for(size_t L=0;L<N_L;L++) {
-          for(size_t iel=0;iel<Nel;iel++) {
-            // In-element integral
-            prim_tei[Nel*Nel*L + iel*Nel + iel]=radial.twoe_integral(L,iel);
-
-            /*
-              for(size_t jel=0;jel<Nel;jel++) {
-	      // Disjoint integrals. When r(iel)>r(jel), iel gets -1-L, jel gets L.
-	      const arma::mat & iint=(iel>jel) ? disjoint_m1L[L*Nel+iel] : disjoint_L[L*Nel+iel];
-	      const arma::mat & jint=(iel>jel) ? disjoint_L[L*Nel+jel] : disjoint_m1L[L*Nel+jel];
-
-	      // Store integrals
-	      prim_tei[Nel*Nel*L + iel*Nel + jel]=utils::product_tei(iint,jint);
-              }
+          {
+#ifdef _OPENMP
+            const size_t idom(omp_get_thread_num());
+#else
+            const size_t idom(0);
+#endif
+            const arma::uvec & elems(tei_domains[idom]);
+#ifdef _OPENMP
+#pragma omp parallel for collapse(2) schedule(dynamic,1) num_threads(nin) proc_bind(close)
+#endif
+            for(size_t L=0;L<N_L;L++)
+              for(size_t i=0;i<elems.n_elem;i++) {
+                const size_t idx(Nel*Nel*L + elems(i)*Nel + elems(i));
+                prim_tei_single[idx]=arma::conv_to<arma::fmat>::from(prim_tei[idx]);
               }
-            */
           }
+        } else {
+          for(size_t i=0;i<prim_tei.size();i++)
+            if(prim_tei[i].n_elem)
+              prim_tei_single[i]=arma::conv_to<arma::fmat>::from(prim_tei[i]);
         }
+        memory::set("TEI single",nsingle*sizeof(float));
+      }
 
-        /*
-          The exchange matrix is given by
-          K(jk) = (ij|kl) P(il)
-          i.e. the complex conjugation hits i and l as
-          in the density matrix.
+      void TwoDBasis::set_numa(size_t ndom) {
+        tei_ndom=numa::setup(ndom);
+      }
 
-          To get this in the proper order, we permute the integrals
-          K(jk) = (jk;il) P(il)
-          so we don't have to reform the permutations in the exchange routine.
-        */
-        if(exchange) {
-          prim_ktei.resize(Nel*Nel*N_L);
+      void TwoDBasis::partition_tei() {
+        tei_domains.clear();
+        if(tei_ndom<2 || tei_storage!=scratch::TEI_INCORE)
+          return;
+
+        size_t Nel(radial.Nel());
+        arma::vec cost(Nel);
+        for(size_t iel=0;iel<Nel;iel++)
+          cost(iel)=std::pow((double) radial.Nprim(iel),4);
+        tei_domains=numa::partition(cost,tei_ndom);
+      }
+
+      void TwoDBasis::distribute_tei() {
+        partition_tei();
+        if(!tei_domains.size() || !prim_tei.size())
+          return;
+
+        // The blocks are copied into memory that is first touched by
+        // the team of their domain
+        size_t N_L(2*arma::max(lval)+1);
+        size_t Nel(radial.Nel());
+        const int nin(numa::team_size(tei_domains.size()));
 #ifdef _OPENMP
-#pragma omp parallel for collapse(2)
+#pragma omp parallel num_threads(tei_domains.size()) proc_bind(spread)
+#endif
+        {
+#ifdef _OPENMP
+          const size_t idom(omp_get_thread_num());
+#else
+          const size_t idom(0);
+#endif
+          const arma::uvec & elems(tei_domains[idom]);
+#ifdef _OPENMP
+#pragma omp parallel for collapse(2) schedule(dynamic,1) num_threads(nin) proc_bind(close)
 #endif
           for(size_t L=0;L<N_L;L++)
-            for(size_t iel=0;iel<Nel;iel++) {
-              // Diagonal integrals
-              size_t Ni(radial.Nprim(iel));
-              prim_ktei[Nel*Nel*L + iel*Nel + iel]=utils::exchange_tei(prim_tei[Nel*Nel*L + iel*Nel + iel],Ni,Ni,Ni,Ni);
-
-              // Off-diagonal integrals (not used since faster to contract
-              // the integrals in factorized form)
-              /*
-                for(size_t jel=0;jel<iel;jel++) {
-                size_t Nj(radial.Nprim(jel));
-                prim_ktei[Nel*Nel*L + iel*Nel + jel]=utils::exchange_tei(prim_tei[Nel*Nel*L + iel*Nel + jel],Ni,Ni,Nj,Nj);
-                }
-                for(size_t jel=iel+1;jel<Nel;jel++) {
-                size_t Nj(radial.Nprim(jel));
-                prim_ktei[Nel*Nel*L + iel*Nel + jel]=utils::exchange_tei(prim_tei[Nel*Nel*L + iel*Nel + jel],Ni,Ni,Nj,Nj);
-                }
-              */
+            for(size_t i=0;i<elems.n_elem;i++) {
+              const size_t idx(Nel*Nel*L + elems(i)*Nel + elems(i));
+              arma::mat local(prim_tei[idx]);
+              prim_tei[idx].swap(local);
             }
         }
       }
 
-      void TwoDBasis::compute_yukawa(double lambda_) {
-        lambda=lambda_;
-        yukawa=true;
+      bool TwoDBasis::get_tei_single() const {
+        return prim_tei_single.size()>0;
+      }
+
+      std::vector<const arma::fmat *> TwoDBasis::element_tei_single(size_t iel) const {
+        std::vector<const arma::fmat *> ret;
+        if(!prim_tei_single.size())
+          return ret;
 
-        // Number of distinct L values is
         size_t N_L(2*arma::max(lval)+1);
         size_t Nel(radial.Nel());
-
-        // Compute disjoint integrals
-        disjoint_iL.resize(Nel*N_L);
-        disjoint_kL.resize(Nel*N_L);
+        ret.resize(N_L);
         for(size_t L=0;L<N_L;L++)
-          for(size_t iel=0;iel<Nel;iel++) {
-            disjoint_iL[L*Nel+iel]=radial.bessel_il_integral(L,lambda,iel);
-            disjoint_kL[L*Nel+iel]=radial.bessel_kl_integral(L,lambda,iel);
-          }
+          ret[L]=&prim_tei_single[Nel*Nel*L + iel*Nel + iel];
+        return ret;
+      }
 
-        /*
-          The exchange matrix is given by
-          K(jk) = (ij|kl) P(il)
-          i.e. the complex conjugation hits i and l as
-          in the density matrix.
+      std::vector<const arma::mat *> TwoDBasis::element_tei(const std::vector<arma::mat> & tei, size_t iel, std::vector<arma::mat> & work) const {
+        size_t N_L(2*arma::max(lval)+1);
+        size_t Nel(radial.Nel());
 
-          To get this in the proper order, we permute the integrals
-          K(jk) = (jk;il) P(il)
-          so we don't have to reform the permutations in the exchange routine.
-        */
-        rs_ktei.resize(Nel*Nel*N_L);
+        std::vector<const arma::mat *> ret(N_L);
+        if(tei.size()) {
+          for(size_t L=0;L<N_L;L++)
+            ret[L]=&tei[Nel*Nel*L + iel*Nel + iel];
+        } else {
+          // Recently used elements are reused from the cache
+          for(std::list< std::pair< size_t, std::vector<arma::mat> > >::iterator it=tei_lru.begin();it!=tei_lru.end();++it)
+            if(it->first==iel) {
+              tei_lru.splice(tei_lru.begin(),tei_lru,it);
+              for(size_t L=0;L<N_L;L++)
+                ret[L]=&tei_lru.front().second[L];
+              return ret;
+            }
+
+          // Recompute the Coulomb integrals
+          size_t Ni(radial.Nprim(iel));
+          work.resize(N_L);
 #ifdef _OPENMP
-#pragma omp parallel for collapse(2)
+#pragma omp parallel for schedule(dynamic,1)
 #endif
-        for(size_t L=0;L<N_L;L++)
-          for(size_t iel=0;iel<Nel;iel++) {
-            // Diagonal integrals
-            size_t Ni(radial.Nprim(iel));
-            rs_ktei[Nel*Nel*L + iel*Nel + iel]=utils::exchange_tei(radial.yukawa_integral(L,lambda,iel),Ni,Ni,Ni,Ni);
+          for(size_t L=0;L<N_L;L++)
+            work[L]=utils::pair_pack_tei(radial.twoe_integral(L,iel),Ni,true,true);
+          // Store in the cache, evicting the least recently used element
+          if(tei_ncache) {
+            tei_lru.push_front(std::make_pair(iel,std::vector<arma::mat>()));
+            std::swap(tei_lru.front().second,work);
+            while(tei_lru.size()>tei_ncache)
+              tei_lru.pop_back();
+            size_t ncached=0;
+            for(std::list< std::pair< size_t, std::vector<arma::mat> > >::const_iterator cit=tei_lru.begin();cit!=tei_lru.end();++cit)
+              for(size_t i=0;i<cit->second.size();i++)
+                ncached+=cit->second[i].n_elem;
+            memory::set("TEI cache",ncached*sizeof(double));
+            for(size_t L=0;L<N_L;L++)
+              ret[L]=&tei_lru.front().second[L];
+            return ret;
           }
+          for(size_t L=0;L<N_L;L++)
+            ret[L]=&work[L];
+        }
+        return ret;
       }
 
-      void TwoDBasis::compute_erfc(double mu) {
-        lambda=mu;
+      void TwoDBasis::compute_tei(bool verbose) {
+        // Number of distinct L values is
+        size_t N_L(2*arma::max(lval)+1);
+        size_t Nel(radial.Nel());
+
+        // The cost of an element scales as Nprim^4, so the elements
+        // are handed out largest first to minimize the idle tail
+        arma::vec cost(Nel);
+        for(size_t iel=0;iel<Nel;iel++)
+          cost(iel)=std::pow((double) radial.Nprim(iel),4);
+        arma::uvec order(arma::stable_sort_index(cost,"descend"));
+#ifdef _OPENMP
+        arma::vec thrtime(omp_get_max_threads(),arma::fill::zeros);
+#else
+        arma::vec thrtime(1,arma::fill::zeros);
+#endif
+
+        // The disjoint integrals are the radial moments, which were
+        // already computed along with the basis
+        if(N_Lmom<N_L)
+          throw std::logic_error("Radial moments have not been computed!\n");
+
+        printf("Primitive two-electron integrals are %s\n",scratch::storage_name(tei_storage).c_str());
+        fflush(stdout);
+        memory::set("TEI",tei_storage==scratch::TEI_INCORE ? mem_2el_aux() : 0);
+        prim_tei.clear();
+        prim_tei_single.clear();
+        memory::set("TEI single",0);
+        tei_map.reset();
+        partition_tei();
+        if(tei_storage==scratch::TEI_RECOMPUTE)
+          return;
+        if(tei_storage==scratch::TEI_MMAP) {
+          // The blocks are laid out element by element, which is the
+          // order in which they are streamed by the contractions
+          std::vector<size_t> offset(Nel*N_L);
+          size_t ntot=0;
+          for(size_t iel=0;iel<Nel;iel++) {
+            size_t Nsym(utils::pair_count(radial.Nprim(iel),true));
+            for(size_t L=0;L<N_L;L++) {
+              offset[iel*N_L+L]=ntot;
+              ntot+=Nsym*Nsym;
+            }
+          }
+          tei_map=std::make_shared<scratch::MappedFile>(tei_scratch,ntot);
+
+          // The matrices are constructed in place so that they keep
+          // pointing to the mapped memory
+          prim_tei.reserve(Nel*Nel*N_L);
+          for(size_t L=0;L<N_L;L++)
+            for(size_t iel=0;iel<Nel;iel++)
+              for(size_t jel=0;jel<Nel;jel++) {
+                if(iel==jel) {
+                  size_t Nsym(utils::pair_count(radial.Nprim(iel),true));
+                  prim_tei.emplace_back(tei_map->memptr(offset[iel*N_L+L]),Nsym,Nsym,false,true);
+                } else
+                  prim_tei.emplace_back();
+              }
+        }
+
+        // Form two-electron integrals. All L values of an element are
+        // computed in one batch, since the polynomials don't depend on L.
+        // Due to the i<->j and k<->l symmetry, the integrals are stored
+        // in the pair-symmetric subspace only; the exchange routines
+        // unpack them one tile at a time.
+        if(tei_storage==scratch::TEI_INCORE)
+          prim_tei.resize(Nel*Nel*N_L);
+        if(tei_domains.size()) {
+          // Each element is computed, and so first touched, by the team
+          // of the domain that contracts it later on
+          const int nin(numa::team_size(tei_domains.size()));
+#ifdef _OPENMP
+#pragma omp parallel num_threads(tei_domains.size()) proc_bind(spread)
+#endif
+          {
+#ifdef _OPENMP
+            const size_t idom(omp_get_thread_num());
+#else
+            const size_t idom(0);
+#endif
+            // Largest first within the domain
+            const arma::vec dcost(cost(tei_domains[idom]));
+            arma::uvec elems(tei_domains[idom](arma::stable_sort_index(dcost,"descend")));
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,1) num_threads(nin) proc_bind(close)
+#endif
+            for(size_t it=0;it<elems.n_elem;it++) {
+              Timer ttask;
+              compute_tei_element(elems(it));
+#ifdef _OPENMP
+              thrtime(idom*nin+omp_get_thread_num())+=ttask.get();
+#else
+              thrtime(0)+=ttask.get();
+#endif
+            }
+          }
+        } else {
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,1)
+#endif
+          for(size_t it=0;it<order.n_elem;it++) {
+            Timer ttask;
+            compute_tei_element(order(it));
+#ifdef _OPENMP
+            thrtime(omp_get_thread_num())+=ttask.get();
+#else
+            thrtime(0)+=ttask.get();
+#endif
+          }
+        }
+        if(verbose)
+          scf::print_load_balance("Primitive two-electron integrals",thrtime);
+      }
+
+      void TwoDBasis::compute_tei_element(size_t iel) {
+        size_t N_L(2*arma::max(lval)+1);
+        size_t Nel(radial.Nel());
+        size_t Ni(radial.Nprim(iel));
+        std::vector<arma::mat> tei(radial.twoe_integrals(N_L-1,iel));
+        for(size_t L=0;L<N_L;L++) {
+          // In-element integral
+          const size_t idx(Nel*Nel*L + iel*Nel + iel);
+          prim_tei[idx]=utils::pair_pack_tei(tei[L],Ni,true,true);
+          // The disjoint integrals factorize, and are contracted from
+          // disjoint_L and disjoint_m1L in coulomb and exchange
+        }
+      }
+
+      void TwoDBasis::compute_yukawa(double lambda_) {
+        lambda=lambda_;
+        yukawa=true;
+        rs_thr=0.0;
+        rs_lowrank_a.clear();
+        rs_lowrank_b.clear();
+
+        // Number of distinct L values is
+        size_t N_L(2*arma::max(lval)+1);
+        size_t Nel(radial.Nel());
+
+        // Compute disjoint integrals
+        disjoint_iL.resize(Nel*N_L);
+        disjoint_kL.resize(Nel*N_L);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,1)
+#endif
+        for(size_t iel=0;iel<Nel;iel++) {
+          std::vector<arma::mat> iL, kL;
+          radial.bessel_integrals(N_L-1,lambda,iel,iL,kL);
+          for(size_t L=0;L<N_L;L++) {
+            disjoint_iL[L*Nel+iel]=iL[L];
+            disjoint_kL[L*Nel+iel]=kL[L];
+          }
+        }
+
+        // In-element integrals are stored in the pair-symmetric
+        // subspace, like the Coulomb integrals
+        rs_tei.resize(Nel*Nel*N_L);
+#ifdef _OPENMP
+#pragma omp parallel for collapse(2)
+#endif
+        for(size_t L=0;L<N_L;L++)
+          for(size_t iel=0;iel<Nel;iel++) {
+            // Diagonal integrals
+            size_t Ni(radial.Nprim(iel));
+            rs_tei[Nel*Nel*L + iel*Nel + iel]=utils::pair_pack_tei(radial.yukawa_integral(L,lambda,iel),Ni,true,true);
+          }
+      }
+
+      void TwoDBasis::compute_erfc(double mu, double thr) {
+        lambda=mu;
         yukawa=false;
+        rs_thr=thr;
 
         // Number of distinct L values is
         size_t N_L(2*arma::max(lval)+1);
@@ -762,6 +1199,11 @@ namespace helfem {
         disjoint_kL.clear();
 
         /*
+          The in-element integrals are stored in the pair-symmetric
+          subspace, like the Coulomb integrals. The off-diagonal
+          integrals don't factorize and have no pair symmetry, so
+          they are stored in full, and sorted for exchange
+
           The exchange matrix is given by
           K(jk) = (ij|kl) P(il)
           i.e. the complex conjugation hits i and l as
@@ -770,137 +1212,235 @@ namespace helfem {
           To get this in the proper order, we permute the integrals
           K(jk) = (jk;il) P(il)
           so we don't have to reform the permutations in the exchange routine.
+
+          The short-range kernel decays quickly with the distance of
+          the elements, so pairs whose integrals are estimated to be
+          below the threshold are skipped altogether. The kernel is
+          smooth between elements that do not touch, so the integrals
+          of such pairs are numerically of low rank and are stored as
+          a truncated singular value decomposition when that is smaller.
         */
-        rs_ktei.resize(Nel*Nel*N_L);
+        rs_tei.assign(Nel*Nel*N_L,arma::mat());
+        rs_lowrank_a.assign(Nel*Nel*N_L,arma::mat());
+        rs_lowrank_b.assign(Nel*Nel*N_L,arma::mat());
+        size_t nscreen=0, nlowrank=0;
 #ifdef _OPENMP
-#pragma omp parallel for collapse(2)
+#pragma omp parallel for collapse(2) schedule(dynamic) reduction(+:nscreen,nlowrank)
 #endif
         for(size_t L=0;L<N_L;L++)
           for(size_t iel=0;iel<Nel;iel++) {
             for(size_t kel=0;kel<Nel;kel++) {
-              // Diagonal integrals
               size_t Ni(radial.Nprim(iel));
               size_t Nk(radial.Nprim(kel));
-              rs_ktei[Nel*Nel*L + iel*Nel + kel]=utils::exchange_tei(radial.erfc_integral(L,lambda,iel,kel),Ni,Ni,Nk,Nk);
+              const size_t idx(Nel*Nel*L + iel*Nel + kel);
+              if(iel == kel) {
+                rs_tei[idx]=utils::pair_pack_tei(radial.erfc_integral(L,lambda,iel,kel),Ni,true,true);
+                continue;
+              }
+              if(thr>0.0 && radial.erfc_integral_bound(L,lambda,iel,kel)<thr) {
+                nscreen++;
+                continue;
+              }
+              arma::mat tei(radial.erfc_integral(L,lambda,iel,kel));
+              if(std::abs((int) iel - (int) kel)>1 && utils::lowrank_tei(tei,thr,rs_lowrank_a[idx],rs_lowrank_b[idx]))
+                nlowrank++;
+              else
+                utils::exchange_tei(tei,Ni,Ni,Nk,Nk,rs_tei[idx]);
             }
           }
+        if(thr>0.0)
+          printf("%i of %i off-diagonal range-separated element pair integrals screened, %i stored in low-rank form\n",(int) nscreen,(int) (N_L*Nel*(Nel-1)),(int) nlowrank);
       }
 
       arma::mat TwoDBasis::coulomb(const arma::mat & P0) const {
-        if(!prim_tei.size())
+        return coulomb(std::vector<arma::mat>(1,P0))[0];
+      }
+
+      std::vector<arma::mat> TwoDBasis::coulomb(const std::vector<arma::mat> & P0) const {
+        profiler::Region prof("Coulomb");
+        // The channels and elements are threaded, so BLAS runs serially
+        threads::KernelPhase phase;
+        if(poisson_chol.size()) {
+          coulomb_nactive=coulomb_ntot=0;
+          return coulomb_poisson(P0);
+        }
+        if(!prim_tei.size() && tei_storage!=scratch::TEI_RECOMPUTE)
           throw std::logic_error("Primitive teis have not been computed!\n");
 
-        // Extend to boundaries
-        arma::mat P(expand_boundaries(P0));
+        // Number of densities
+        const size_t Nd(P0.size());
+        const std::vector<arma::mat> & P(P0);
+        for(size_t id=0;id<Nd;id++)
+          if(P[id].n_rows != Ndummy() || P[id].n_cols != Ndummy())
+            throw std::logic_error("Density matrix does not have expected size!\n");
 
         // Number of radial elements
         size_t Nel(radial.Nel());
         // Number of radial functions
         size_t Nrad(radial.Nbf());
-        // Gaunt coefficient table
-        int gmax(std::max(arma::max(lval),arma::max(mval)));
-        gaunt::Gaunt gaunt(gmax,2*gmax,gmax);
 
         // maximal M value
         int Mmax=arma::max(mval)-arma::min(mval);
 
-        // Radial helper matrices
-        std::vector< std::vector<arma::mat> > Paux(2*arma::max(lval)+1);
+        // List of (L,M) coupling channels
+        std::vector< std::pair<int,int> > channels;
+        // Radial helper matrices; the slices hold the densities
+        std::vector< std::vector<arma::cube> > Paux(2*arma::max(lval)+1);
+        std::vector< std::vector<arma::cube> > Jaux(2*arma::max(lval)+1);
         for(int L=0;L<(int) Paux.size();L++) {
           Paux[L].resize(2*Mmax+1);
-          for(int M=-std::min(L,Mmax);M<=std::min(L,Mmax);M++) {
-            Paux[L][M+Mmax].zeros(Nrad,Nrad);
-          }
-        }
-
-        // Form radial helpers: contract ket
-        for(size_t kang=0;kang<lval.n_elem;kang++) {
-          for(size_t lang=0;lang<lval.n_elem;lang++) {
-            // l and m values
-            int lk(lval(kang));
-            int mk(mval(kang));
-            int ll(lval(lang));
-            int ml(mval(lang));
-            // RH m value
-            int M(mk-ml);
-            // M values match. Loop over possible couplings
-            int Lmin=std::max(std::abs(lk-ll),abs(M));
-            int Lmax=lk+ll;
-            for(int L=Lmin;L<=Lmax;L++) {
-              // Calculate coupling coefficient
-              double cpl(gaunt.coeff(lk,mk,L,M,ll,ml));
-              // Increment
-              Paux[L][M+Mmax]+=cpl*P.submat(kang*Nrad,lang*Nrad,(kang+1)*Nrad-1,(lang+1)*Nrad-1);
-            }
-          }
-        }
-
-        // Helper matrices
-        std::vector< std::vector<arma::mat> > Jaux(2*arma::max(lval)+1);
-        for(int L=0;L<(int) Jaux.size();L++) {
           Jaux[L].resize(2*Mmax+1);
           for(int M=-std::min(L,Mmax);M<=std::min(L,Mmax);M++) {
-            Jaux[L][M+Mmax].zeros(Nrad,Nrad);
+            Paux[L][M+Mmax].zeros(Nrad,Nrad,Nd);
+            Jaux[L][M+Mmax].zeros(Nrad,Nrad,Nd);
+            channels.push_back(std::make_pair(L,M));
           }
         }
-        // Contract integrals
-        for(int L=0;L<(int) Paux.size();L++) {
-          const double Lfac=4.0*M_PI/(2*L+1);
 
-          for(int M=-std::min(L,Mmax);M<=std::min(L,Mmax);M++) {
-            for(size_t jel=0;jel<Nel;jel++) {
-              size_t jfirst, jlast;
-              radial.get_idx(jel,jfirst,jlast);
-              size_t Nj(jlast-jfirst+1);
-
-              // Get density submatrices
-              arma::mat Psub(Paux[L][M+Mmax].submat(jfirst,jfirst,jlast,jlast));
+        // Density block norms, maximized over the densities
+        arma::mat bdens(block_norms(P,0,Nrad-1));
 
-              // Contract integrals
-              double jsmall = Lfac*arma::trace(disjoint_L[L*Nel+jel]*Psub);
-              double jbig = Lfac*arma::trace(disjoint_m1L[L*Nel+jel]*Psub);
+        // Form radial helpers: contract ket. Each channel is handled by
+        // a single thread, so no synchronization is necessary
+        arma::uvec chactive(channels.size(),arma::fill::zeros);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+        for(size_t ich=0;ich<channels.size();ich++) {
+          const int L(channels[ich].first);
+          const int M(channels[ich].second);
+          arma::cube & Pch(Paux[L][M+Mmax]);
+          channel_density(P,bdens,L,M,Pch);
+          // Channels whose density multipole vanishes do not contribute
+          chactive(ich)=(arma::abs(arma::vectorise(Pch)).max()>=screen_thr);
+        }
+        std::vector< std::pair<int,int> > active;
+        for(size_t ich=0;ich<channels.size();ich++)
+          if(chactive(ich))
+            active.push_back(channels[ich]);
+        coulomb_nactive=active.size();
+        coulomb_ntot=channels.size();
 
-              // Increment J: jel>iel
-              for(size_t iel=0;iel<jel;iel++) {
-                size_t ifirst, ilast;
-                radial.get_idx(iel,ifirst,ilast);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+        for(size_t ich=0;ich<active.size();ich++) {
+          const int L(active[ich].first);
+          const int M(active[ich].second);
+          const double Lfac=4.0*M_PI/(2*L+1);
+          const arma::cube & Pch(Paux[L][M+Mmax]);
+          arma::cube & Jch(Jaux[L][M+Mmax]);
+
+          // Contract disjoint integrals for all elements at once
+          arma::mat jsmall(Nel,Nd), jbig(Nel,Nd);
+          for(size_t jel=0;jel<Nel;jel++) {
+            size_t jfirst, jlast;
+            radial.get_idx(jel,jfirst,jlast);
+            for(size_t id=0;id<Nd;id++) {
+              arma::mat Psub(Pch.slice(id).submat(jfirst,jfirst,jlast,jlast));
+              jsmall(jel,id) = Lfac*scf::trace_product(disjoint_L[L*Nel+jel],Psub);
+              jbig(jel,id) = Lfac*scf::trace_product(disjoint_m1L[L*Nel+jel],Psub);
+            }
+          }
 
-                const arma::mat & iint=disjoint_L[L*Nel+iel];
-                Jaux[L][M+Mmax].submat(ifirst,ifirst,ilast,ilast)+=jbig*iint;
-              }
+          // Element iel sees the jbig terms of all the elements
+          // above it, and the jsmall terms of all those below it;
+          // these are just cumulative sums
+          arma::mat jabove(Nel,Nd), jbelow(Nel,Nd);
+          jabove.row(Nel-1).zeros();
+          for(size_t iel=Nel-1;iel>0;iel--)
+            jabove.row(iel-1)=jabove.row(iel)+jbig.row(iel);
+          jbelow.row(0).zeros();
+          for(size_t iel=1;iel<Nel;iel++)
+            jbelow.row(iel)=jbelow.row(iel-1)+jsmall.row(iel-1);
 
-              // Increment J: jel<iel
-              for(size_t iel=jel+1;iel<Nel;iel++) {
-                size_t ifirst, ilast;
-                radial.get_idx(iel,ifirst,ilast);
+          for(size_t iel=0;iel<Nel;iel++) {
+            size_t ifirst, ilast;
+            radial.get_idx(iel,ifirst,ilast);
 
-                const arma::mat & iint=disjoint_m1L[L*Nel+iel];
-                Jaux[L][M+Mmax].submat(ifirst,ifirst,ilast,ilast)+=jsmall*iint;
-              }
+            // Disjoint contribution
+            for(size_t id=0;id<Nd;id++)
+              Jch.slice(id).submat(ifirst,ifirst,ilast,ilast)+=jabove(iel,id)*disjoint_L[L*Nel+iel] + jbelow(iel,id)*disjoint_m1L[L*Nel+iel];
+          }
+        }
 
-              // In-element contribution
-              {
-                size_t iel=jel;
-                size_t ifirst=jfirst;
-                size_t ilast=jlast;
-                size_t Ni=Nj;
+        // In-element contributions
+        if(tei_domains.size() && prim_tei.size()) {
+          // Each domain contracts the elements it holds
+          const int nin(numa::team_size(tei_domains.size()));
+#ifdef _OPENMP
+#pragma omp parallel num_threads(tei_domains.size()) proc_bind(spread)
+#endif
+          {
+#ifdef _OPENMP
+            const size_t idom(omp_get_thread_num());
+#else
+            const size_t idom(0);
+#endif
+            std::vector<arma::mat> teiwork;
+            for(size_t parity=0;parity<2;parity++) {
+              for(size_t i=0;i<tei_domains[idom].n_elem;i++)
+                if(tei_domains[idom](i)%2==parity)
+                  coulomb_element(P,tei_domains[idom](i),teiwork,active,Paux,Jaux,nin);
+#ifdef _OPENMP
+#pragma omp barrier
+#endif
+            }
+          }
+        } else {
+          // The elements are handled one at a time so that out-of-core
+          // integrals are streamed sequentially, and recomputed
+          // integrals are only held for a single element.
+#ifdef _OPENMP
+          const int nth(omp_get_max_threads());
+#else
+          const int nth(1);
+#endif
+          std::vector<arma::mat> teiwork;
+          arma::uvec elorder(element_order());
+          for(size_t iiel=0;iiel<Nel;iiel++)
+            coulomb_element(P,elorder(iiel),teiwork,active,Paux,Jaux,nth);
+        }
 
-                // Contract integrals
-                Psub.reshape(Nj*Nj,1);
+        return assemble_coulomb(Jaux,Nd);
+      }
 
-                const size_t idx(Nel*Nel*L + iel*Nel + jel);
-                arma::mat Jsub(Lfac*(prim_tei[idx]*Psub));
-                Jsub.reshape(Ni,Ni);
+      void TwoDBasis::channel_density(const std::vector<arma::mat> & P, const arma::mat & bdens, int L, int M, arma::cube & Pch) const {
+        const size_t Nrad(radial.Nbf());
+        for(size_t kang=0;kang<lval.n_elem;kang++) {
+          for(size_t lang=0;lang<lval.n_elem;lang++) {
+            // l and m values
+            int lk(lval(kang));
+            int mk(mval(kang));
+            int ll(lval(lang));
+            int ml(mval(lang));
+            // Check that the channel couples
+            if(mk-ml != M || L<std::abs(lk-ll) || L>lk+ll)
+              continue;
+            // Do we have any density in this block?
+            if(bdens(kang,lang)<screen_thr)
+              continue;
 
-                Jaux[L][M+Mmax].submat(ifirst,ifirst,ilast,ilast)+=Jsub;
-              }
-            }
+            // Calculate coupling coefficient
+            double cpl(gaunt->coeff(lk,mk,L,M,ll,ml));
+            if(cpl!=0.0)
+              for(size_t id=0;id<P.size();id++)
+                Pch.slice(id)+=cpl*P[id].submat(kang*Nrad,lang*Nrad,(kang+1)*Nrad-1,(lang+1)*Nrad-1);
           }
         }
+      }
 
-        // Full Coulomb matrix
-        arma::mat J(Ndummy(),Ndummy());
-        J.zeros();
+      std::vector<arma::mat> TwoDBasis::assemble_coulomb(const std::vector< std::vector<arma::cube> > & Jaux, size_t Nd) const {
+        const size_t Nrad(radial.Nbf());
+        const int Mmax=arma::max(mval)-arma::min(mval);
+
+        // Full Coulomb matrices
+        std::vector<arma::mat> J(Nd);
+        for(size_t id=0;id<Nd;id++)
+          J[id].zeros(Ndummy(),Ndummy());
+#ifdef _OPENMP
+#pragma omp parallel for collapse(2)
+#endif
         for(size_t iang=0;iang<lval.n_elem;iang++) {
           for(size_t jang=0;jang<lval.n_elem;jang++) {
             // l and m values
@@ -915,36 +1455,246 @@ namespace helfem {
             int Lmax=lj+li;
             for(int L=Lmin;L<=Lmax;L++) {
               // Coupling
-              double cpl(gaunt.coeff(lj,mj,L,M,li,mi));
+              double cpl(gaunt->coeff(lj,mj,L,M,li,mi));
               if(cpl!=0.0) {
-                J.submat(iang*Nrad,jang*Nrad,(iang+1)*Nrad-1,(jang+1)*Nrad-1)+=cpl*Jaux[L][M+Mmax];
+                for(size_t id=0;id<Nd;id++)
+                  J[id].submat(iang*Nrad,jang*Nrad,(iang+1)*Nrad-1,(jang+1)*Nrad-1)+=cpl*Jaux[L][M+Mmax].slice(id);
               }
             }
           }
         }
 
-        return remove_boundaries(J);
+        return J;
+      }
+
+      void TwoDBasis::set_poisson(bool poisson) {
+        poisson_chol.clear();
+        poisson_bf.clear();
+        poisson_r.clear();
+        poisson_w.clear();
+        if(!poisson)
+          return;
+
+        // The radial functions B(r) = r bf(r) vanish at the origin and
+        // at Rmax. Writing the potential of a density multipole as
+        // V_L(r) = U_L(r)/r, the Poisson equation becomes
+        //   U_L'' - L(L+1)/r^2 U_L = -(2L+1) rho_L(r)/r
+        // whose Galerkin form in the radial functions is
+        //   2 (T + L(L+1) T_l) c = (2L+1) b,
+        // T and T_l being the kinetic matrices and b the projection
+        // of the source. The matrices are banded, so the factors and
+        // the solutions cost O(Nrad) per channel.
+        size_t N_L(2*arma::max(lval)+1);
+        polynomial_basis::BandedMatrix T(radial.kinetic_banded());
+        polynomial_basis::BandedMatrix Tl(radial.kinetic_l_banded());
+        poisson_chol.resize(N_L);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+        for(size_t L=0;L<N_L;L++) {
+          polynomial_basis::BandedMatrix A(Tl);
+          A*=L*(L+1);
+          A+=T;
+          A*=2.0;
+          poisson_chol[L]=A.chol();
+        }
+
+        size_t Nel(radial.Nel());
+        poisson_bf.resize(Nel);
+        poisson_r.resize(Nel);
+        poisson_w.resize(Nel);
+        for(size_t iel=0;iel<Nel;iel++) {
+          poisson_bf[iel]=radial.get_bf(iel);
+          poisson_r[iel]=radial.get_r(iel);
+          poisson_w[iel]=radial.get_wrad(iel);
+        }
+      }
+
+      bool TwoDBasis::get_poisson() const {
+        return poisson_chol.size()>0;
+      }
+
+      bool TwoDBasis::have_tei() const {
+        return prim_tei.size() || tei_storage==scratch::TEI_RECOMPUTE;
+      }
+
+      std::vector<arma::mat> TwoDBasis::coulomb_poisson(const std::vector<arma::mat> & P) const {
+        const size_t Nd(P.size());
+        for(size_t id=0;id<Nd;id++)
+          if(P[id].n_rows != Ndummy() || P[id].n_cols != Ndummy())
+            throw std::logic_error("Density matrix does not have expected size!\n");
+
+        const size_t Nel(radial.Nel());
+        const size_t Nrad(radial.Nbf());
+        const int Mmax=arma::max(mval)-arma::min(mval);
+        // Practical infinity
+        const double Rmax(arma::max(radial.get_bval()));
+
+        std::vector< std::pair<int,int> > channels;
+        std::vector< std::vector<arma::cube> > Jaux(2*arma::max(lval)+1);
+        for(int L=0;L<(int) Jaux.size();L++) {
+          Jaux[L].resize(2*Mmax+1);
+          for(int M=-std::min(L,Mmax);M<=std::min(L,Mmax);M++) {
+            Jaux[L][M+Mmax].zeros(Nrad,Nrad,Nd);
+            channels.push_back(std::make_pair(L,M));
+          }
+        }
+        arma::mat bdens(block_norms(P,0,Nrad-1));
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+        for(size_t ich=0;ich<channels.size();ich++) {
+          const int L(channels[ich].first);
+          const int M(channels[ich].second);
+          const double Lfac=4.0*M_PI/(2*L+1);
+          arma::cube Pch(Nrad,Nrad,Nd,arma::fill::zeros);
+          channel_density(P,bdens,L,M,Pch);
+          if(arma::abs(arma::vectorise(Pch)).max()<screen_thr)
+            continue;
+          arma::cube & Jch(Jaux[L][M+Mmax]);
+
+          // Source terms and multipole moments of the radial densities
+          // rho(r) = r^2 sum_kl P_kl bf_k(r) bf_l(r)
+          arma::mat b(Nrad,Nd,arma::fill::zeros);
+          arma::rowvec Q(Nd,arma::fill::zeros);
+          for(size_t iel=0;iel<Nel;iel++) {
+            size_t ifirst, ilast;
+            radial.get_idx(iel,ifirst,ilast);
+            const arma::mat & bf(poisson_bf[iel]);
+            const arma::vec & r(poisson_r[iel]);
+            const arma::vec & w(poisson_w[iel]);
+            arma::mat rho(r.n_elem,Nd);
+            for(size_t id=0;id<Nd;id++)
+              rho.col(id)=arma::square(r)%arma::sum((bf*Pch.slice(id).submat(ifirst,ifirst,ilast,ilast))%bf,1);
+            b.rows(ifirst,ilast)+=bf.t()*(rho.each_col()%w);
+            Q+=arma::sum(rho.each_col()%(w%arma::pow(r,L)),0);
+          }
+
+          // U_L(r) = sum_n c_n B_n(r) + Q_L r^(L+1) / Rmax^(2L+1), where
+          // the second term carries the boundary condition at Rmax
+          arma::mat c(poisson_chol[L].chol_solve((2*L+1)*b));
+          const double hfac(std::pow(Rmax,-(2*L+1)));
+
+          // J_ij = Lfac int B_i B_j U_L / r dr
+          for(size_t iel=0;iel<Nel;iel++) {
+            size_t ifirst, ilast;
+            radial.get_idx(iel,ifirst,ilast);
+            const arma::mat & bf(poisson_bf[iel]);
+            const arma::vec & r(poisson_r[iel]);
+            const arma::vec & w(poisson_w[iel]);
+            const arma::vec rL1(arma::pow(r,L+1));
+            for(size_t id=0;id<Nd;id++) {
+              arma::vec U(r%(bf*c.submat(ifirst,id,ilast,id))+Q(id)*hfac*rL1);
+              arma::mat wbf(bf.each_col()%(w%r%U));
+              Jch.slice(id).submat(ifirst,ifirst,ilast,ilast)+=Lfac*bf.t()*wbf;
+            }
+          }
+        }
+
+        return assemble_coulomb(Jaux,Nd);
+      }
+
+      void TwoDBasis::coulomb_element(const std::vector<arma::mat> & P, size_t iel, std::vector<arma::mat> & teiwork, const std::vector< std::pair<int,int> > & channels, const std::vector< std::vector<arma::cube> > & Paux, std::vector< std::vector<arma::cube> > & Jaux, int nthr) const {
+        const size_t Nd(P.size());
+        int Mmax=arma::max(mval)-arma::min(mval);
+
+        size_t ifirst, ilast;
+        radial.get_idx(iel,ifirst,ilast);
+        size_t Ni(ilast-ifirst+1);
+        // Skip elements without density
+        if(block_norms(P,ifirst,ilast).max()<screen_thr)
+          return;
+        std::vector<const arma::mat *> tei(element_tei(prim_tei,iel,teiwork));
+        std::vector<const arma::fmat *> teif(element_tei_single(iel));
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) num_threads(nthr)
+#endif
+        for(size_t ich=0;ich<channels.size();ich++) {
+          const int L(channels[ich].first);
+          const int M(channels[ich].second);
+          const double Lfac=4.0*M_PI/(2*L+1);
+          const arma::cube & Pch(Paux[L][M+Mmax]);
+          arma::cube & Jch(Jaux[L][M+Mmax]);
+
+          // In-element contribution of all densities in one pass
+          arma::mat Psub(Ni*Ni,Nd);
+          for(size_t id=0;id<Nd;id++)
+            Psub.col(id)=arma::vectorise(Pch.slice(id).submat(ifirst,ifirst,ilast,ilast));
+          // The integrals are stored in the pair-symmetric subspace
+          arma::mat Ppair(utils::pair_pack(Psub,Ni,true));
+          arma::mat Jpair;
+          if(teif.size())
+            Jpair=arma::conv_to<arma::mat>::from((*teif[L])*arma::conv_to<arma::fmat>::from(Ppair));
+          else
+            Jpair=(*tei[L])*Ppair;
+          arma::mat Jin(Lfac*utils::pair_unpack(Jpair,Ni,true));
+          for(size_t id=0;id<Nd;id++)
+            Jch.slice(id).submat(ifirst,ifirst,ilast,ilast)+=arma::reshape(Jin.col(id),Ni,Ni);
+        }
       }
 
       arma::mat TwoDBasis::exchange(const arma::mat & P0) const {
-        if(!prim_ktei.size())
+        return exchange(std::vector<arma::mat>(1,P0))[0];
+      }
+
+      std::vector<arma::mat> TwoDBasis::exchange(const std::vector<arma::mat> & P0) const {
+        if(!prim_tei.size() && tei_storage!=scratch::TEI_RECOMPUTE)
           throw std::logic_error("Primitive teis have not been computed!\n");
 
-        // Extend to boundaries
-        arma::mat P(expand_boundaries(P0));
+        arma::vec Lfac(2*arma::max(lval)+1);
+        for(size_t L=0;L<Lfac.n_elem;L++)
+          Lfac(L)=4.0*M_PI/(2*L+1);
+        return exchange_wrk(P0, prim_tei, disjoint_L, disjoint_m1L, Lfac, true);
+      }
 
-        // Gaunt coefficient table
-        int gmax(std::max(arma::max(lval),arma::max(mval)));
-        gaunt::Gaunt gaunt(gmax,2*gmax,gmax);
+      arma::mat TwoDBasis::rs_exchange(const arma::mat & P0) const {
+        return rs_exchange(std::vector<arma::mat>(1,P0))[0];
+      }
+
+      std::vector<arma::mat> TwoDBasis::rs_exchange(const std::vector<arma::mat> & P0) const {
+        if(!rs_tei.size())
+          throw std::logic_error("Primitive teis have not been computed!\n");
+
+        arma::vec Lfac(2*arma::max(lval)+1);
+        for(size_t L=0;L<Lfac.n_elem;L++)
+          Lfac(L) = yukawa ? 4.0*M_PI*lambda :  4.0*M_PI*lambda/(2*L+1);
+        // The error function kernel does not factorize
+        return exchange_wrk(P0, rs_tei, disjoint_iL, disjoint_kL, Lfac, yukawa, rs_lowrank_a, rs_lowrank_b);
+      }
+
+      std::vector<arma::mat> TwoDBasis::exchange_wrk(const std::vector<arma::mat> & P0, const std::vector<arma::mat> & tei, const std::vector<arma::mat> & disjoint_small, const std::vector<arma::mat> & disjoint_big, const arma::vec & Lfac, bool factorizes, const std::vector<arma::mat> & lowrank_a, const std::vector<arma::mat> & lowrank_b) const {
+        profiler::Region prof("Exchange");
+        // The GEMMs are called from the threads, so BLAS runs serially
+        threads::KernelPhase phase;
+        // Number of densities
+        const size_t Nd(P0.size());
+        const std::vector<arma::mat> & P(P0);
+        for(size_t id=0;id<Nd;id++)
+          if(P[id].n_rows != Ndummy() || P[id].n_cols != Ndummy())
+            throw std::logic_error("Density matrix does not have expected size!\n");
 
         // Number of radial elements
         size_t Nel(radial.Nel());
         // Number of radial basis functions
         size_t Nrad(radial.Nbf());
 
-        // Full exchange matrix
-        arma::mat K(Ndummy(),Ndummy());
-        K.zeros();
+        // Density block norms, maximized over the densities
+        arma::mat bdens(block_norms(P,0,Nrad-1));
+        // For densities that are invariant under m -> -m, so is the
+        // exchange matrix, and only half of the angular pairs are built
+        const bool mirrored(mirror_symmetric(P));
+
+        // Full exchange matrices
+        std::vector<arma::mat> K(Nd);
+        for(size_t id=0;id<Nd;id++)
+          K[id].zeros(Ndummy(),Ndummy());
+
+        // Angular pairs to build
+        const std::vector< std::pair<size_t,size_t> > pairs(exchange_pairs(mirrored));
+        // Number of L channels
+        const size_t N_L(2*arma::max(lval)+1);
 
         // Helper memory
 #ifdef _OPENMP
@@ -956,341 +1706,360 @@ namespace helfem {
         std::vector<arma::vec> mem_Psub(nth);
         std::vector<arma::vec> mem_T(nth);
 
-#ifdef _OPENMP
-#pragma omp parallel
-#endif
-        {
-#ifdef _OPENMP
-          const int ith(omp_get_thread_num());
-#else
-          const int ith(0);
-#endif
-          // These are only small submatrices!
-          mem_Psub[ith].zeros(radial.max_Nprim()*radial.max_Nprim());
-          mem_Ksub[ith].zeros(radial.max_Nprim()*radial.max_Nprim());
-          mem_T[ith].zeros(radial.max_Nprim()*radial.max_Nprim());
+        // Radial helpers of the pair (jang,kang): angular sums of the
+        // density over the couplings. A channel is only allocated when
+        // it is first coupled, and it is overwritten instead of cleared
+        // on the first coupling of each pair. The slices hold the
+        // densities.
+        auto pair_density = [&](size_t jang, size_t kang, std::vector<arma::cube> & Rmat, std::vector<bool> & couple) {
+          std::fill(couple.begin(),couple.end(),false);
+
+          // Perform angular sums over the nonzero couplings
+          const std::vector<exchange_coupling_t> & list(exch_cpl[jang*lval.n_elem+kang]);
+          for(size_t ic=0;ic<list.size();ic++) {
+            size_t iang(list[ic].iang);
+            size_t lang(list[ic].lang);
+            int L(list[ic].L);
+
+            // Do we have any density in this block?
+            if(bdens(iang,lang)<screen_thr)
+              continue;
 
-          // Increment
-#ifdef _OPENMP
-#pragma omp for collapse(2)
-#endif
-          for(size_t jang=0;jang<lval.n_elem;jang++) {
-            for(size_t kang=0;kang<lval.n_elem;kang++) {
-              int lj(lval(jang));
-              int mj(mval(jang));
-
-              int lk(lval(kang));
-              int mk(mval(kang));
-
-              // Form radial helpers
-              size_t N_L(2*arma::max(lval)+1);
-              std::vector<arma::mat> Rmat(N_L);
-              for(size_t i=0;i<N_L;i++) {
-                Rmat[i].zeros(Nrad,Nrad);
-              }
-              // Is there a coupling to the channel?
-              std::vector<bool> couple(N_L,false);
+            const double fac(Lfac(L)*list[ic].cpl);
+            if(!couple[L])
+              Rmat[L].set_size(Nrad,Nrad,Nd);
+            for(size_t id=0;id<Nd;id++) {
+              if(couple[L])
+                Rmat[L].slice(id)+=fac*P[id].submat(iang*Nrad,lang*Nrad,(iang+1)*Nrad-1,(lang+1)*Nrad-1);
+              else
+                Rmat[L].slice(id)=fac*P[id].submat(iang*Nrad,lang*Nrad,(iang+1)*Nrad-1,(lang+1)*Nrad-1);
+            }
+            couple[L]=true;
+          }
+        };
 
-              // Perform angular sums
-              for(size_t iang=0;iang<lval.n_elem;iang++) {
-                int li(lval(iang));
-                int mi(mval(iang));
+        // Disjoint contributions of the pair (jang,kang) to the output element iel
+        auto pair_element = [&](size_t jang, size_t kang, size_t iel, const std::vector<arma::cube> & Rmat, const std::vector<bool> & couple, int ith) {
+          size_t ifirst, ilast;
+          radial.get_idx(iel,ifirst,ilast);
 
-                for(size_t lang=0;lang<lval.n_elem;lang++) {
-                  int ll(lval(lang));
-                  int ml(mval(lang));
+          // Input
+          for(size_t jel=0;jel<Nel;jel++) {
+            size_t jfirst, jlast;
+            radial.get_idx(jel,jfirst,jlast);
 
-                  // LH m value
-                  int M(mj-mi);
-                  // RH m value
-                  int Mp(mk-ml);
-                  if(M!=Mp)
-                    continue;
+            // Number of functions in the two elements
+            size_t Ni(ilast-ifirst+1);
+            size_t Nj(jlast-jfirst+1);
 
-                  // Do we have any density in this block?
-                  double bdens(arma::norm(P.submat(iang*Nrad,lang*Nrad,(iang+1)*Nrad-1,(lang+1)*Nrad-1),"fro"));
-                  //printf("(%i %i) (%i %i) density block norm %e\n",li,mi,ll,ml,bdens);
-                  if(bdens<10*DBL_EPSILON)
-                    continue;
+            // In-element blocks are handled separately below
+            if(iel == jel)
+              continue;
 
-                  // M values match. Loop over possible couplings
-                  int Lmin=std::max(std::max(std::abs(li-lj),std::abs(lk-ll)),abs(M));
-                  int Lmax=std::min(li+lj,lk+ll);
-
-                  for(int L=Lmin;L<=Lmax;L++) {
-                    // Calculate total coupling coefficient
-                    double cpl(gaunt.coeff(lj,mj,L,M,li,mi)*gaunt.coeff(lk,mk,L,M,ll,ml));
-                    if(cpl==0.0)
-                      continue;
-
-                    // L factor
-                    double Lfac=4.0*M_PI/(2*L+1);
-                    Rmat[L]+=(Lfac*cpl)*P.submat(iang*Nrad,lang*Nrad,(iang+1)*Nrad-1,(lang+1)*Nrad-1);
-                    couple[L]=true;
-                  }
-                }
-              }
+            if(!factorizes) {
+              /*
+                The exchange matrix is given by
+                K(jk) = (ij|kl) P(il)
+                i.e. the complex conjugation hits i and l as
+                in the density matrix.
 
-              // Loop over elements: output
-              for(size_t iel=0;iel<Nel;iel++) {
-                size_t ifirst, ilast;
-                radial.get_idx(iel,ifirst,ilast);
+                To get this in the proper order, we permute the integrals
+                K(jk) = (jk;il) P(il)
+              */
 
-                // Input
-                for(size_t jel=0;jel<Nel;jel++) {
-                  size_t jfirst, jlast;
-                  radial.get_idx(jel,jfirst,jlast);
-
-                  // Number of functions in the two elements
-                  size_t Ni(ilast-ifirst+1);
-                  size_t Nj(jlast-jfirst+1);
-
-                  if(iel == jel) {
-                    /*
-                      The exchange matrix is given by
-                      K(jk) = (ij|kl) P(il)
-                      i.e. the complex conjugation hits i and l as
-                      in the density matrix.
-
-                      To get this in the proper order, we permute the integrals
-                      K(jk) = (jk;il) P(il)
-                    */
-
-                    // Exchange submatrix
-                    arma::mat Ksub(mem_Ksub[ith].memptr(),Ni*Nj,1,false,true);
-                    Ksub.zeros();
-
-                    for(size_t L=0;L<N_L;L++) {
-                      if(!couple[L])
-                        continue;
-                      Ksub+=prim_ktei[Nel*Nel*L + iel*Nel + jel]*arma::vectorise(Rmat[L].submat(ifirst,jfirst,ilast,jlast));
-                    }
-                    Ksub.reshape(Ni,Nj);
-
-                    // Increment global exchange matrix
-                    K.submat(jang*Nrad+ifirst,kang*Nrad+jfirst,jang*Nrad+ilast,kang*Nrad+jlast)-=Ksub;
-
-                    //arma::vec Ptgt(arma::vectorise(P.submat(jang*Nrad+ifirst,kang*Nrad+jfirst,jang*Nrad+ilast,kang*Nrad+jlast)));
-                    //printf("(%i %i) (%i %i) (%i %i) (%i %i) [%i %i]\n",li,mi,lj,mj,lk,mk,ll,ml,L,M);
-                    //printf("Element %i - %i contribution to exchange energy % .10e\n",(int) iel,(int) jel,-0.5*arma::dot(Ksub,Ptgt));
-
-                  } else {
-                    // Exchange submatrix
-                    arma::mat Ksub(mem_Ksub[ith].memptr(),Ni,Nj,false,true);
-                    Ksub.zeros();
-
-                    for(size_t L=0;L<N_L;L++) {
-                      if(!couple[L])
-                        continue;
-
-                      // Disjoint integrals. When r(iel)>r(jel), iel gets -1-L, jel gets L.
-                      const arma::mat & iint=(iel>jel) ? disjoint_m1L[L*Nel+iel] : disjoint_L[L*Nel+iel];
-                      const arma::mat & jint=(iel>jel) ? disjoint_L[L*Nel+jel] : disjoint_m1L[L*Nel+jel];
-
-                      // Get density submatrix (Niel x Njel)
-                      arma::mat Psub(mem_Psub[ith].memptr(),Ni,Nj,false,true);
-                      Psub=Rmat[L].submat(ifirst,jfirst,ilast,jlast);
-
-                      // Calculate helper
-                      arma::mat T(mem_T[ith].memptr(),Ni,Nj,false,true);
-                      // (Niel x Njel) = (Niel x Njel) x (Njel x Njel)
-                      T=Psub*arma::trans(jint);
-
-                      // Increment
-                      Ksub+=iint*T;
-                    }
-
-                    K.submat(jang*Nrad+ifirst,kang*Nrad+jfirst,jang*Nrad+ilast,kang*Nrad+jlast)-=Ksub;
-                  }
+              // Exchange submatrices of all densities
+              arma::mat Ksub(mem_Ksub[ith].memptr(),Ni*Nj,Nd,false,true);
+              Ksub.zeros();
+              // Stacked densities
+              arma::mat Psub(mem_Psub[ith].memptr(),Ni*Nj,Nd,false,true);
+
+              for(size_t L=0;L<N_L;L++) {
+                if(!couple[L])
+                  continue;
+                const size_t idx(Nel*Nel*L + iel*Nel + jel);
+                if(tei[idx].n_elem) {
+                  for(size_t id=0;id<Nd;id++)
+                    Psub.col(id)=arma::vectorise(Rmat[L].slice(id).submat(ifirst,jfirst,ilast,jlast));
+                  // All densities in one pass over the integrals
+                  Ksub+=tei[idx]*Psub;
+                } else if(lowrank_a.size() && lowrank_a[idx].n_cols) {
+                  for(size_t id=0;id<Nd;id++)
+                    Ksub.col(id)+=arma::vectorise(utils::lowrank_exchange(lowrank_a[idx],lowrank_b[idx],Rmat[L].slice(id).submat(ifirst,jfirst,ilast,jlast)));
                 }
+                // otherwise the pair has been screened out
               }
-            }
-          }
-        }
 
-        return remove_boundaries(K);
-      }
+              // Increment global exchange matrices
+              for(size_t id=0;id<Nd;id++)
+                K[id].submat(jang*Nrad+ifirst,kang*Nrad+jfirst,jang*Nrad+ilast,kang*Nrad+jlast)-=arma::reshape(Ksub.col(id),Ni,Nj);
 
-      arma::mat TwoDBasis::rs_exchange(const arma::mat & P0) const {
-        if(!rs_ktei.size())
-          throw std::logic_error("Primitive teis have not been computed!\n");
+            } else {
+              for(size_t id=0;id<Nd;id++) {
+                // Exchange submatrix
+                arma::mat Ksub(mem_Ksub[ith].memptr(),Ni,Nj,false,true);
+                Ksub.zeros();
 
-        // Extend to boundaries
-        arma::mat P(expand_boundaries(P0));
+                for(size_t L=0;L<N_L;L++) {
+                  if(!couple[L])
+                    continue;
 
-        // Gaunt coefficient table
-        int gmax(std::max(arma::max(lval),arma::max(mval)));
-        gaunt::Gaunt gaunt(gmax,2*gmax,gmax);
+                  // Disjoint integrals. When r(iel)>r(jel), iel gets the big and jel the small part.
+                  const arma::mat & iint=(iel>jel) ? disjoint_big[L*Nel+iel] : disjoint_small[L*Nel+iel];
+                  const arma::mat & jint=(iel>jel) ? disjoint_small[L*Nel+jel] : disjoint_big[L*Nel+jel];
 
-        // Number of radial elements
-        size_t Nel(radial.Nel());
-        // Number of radial basis functions
-        size_t Nrad(radial.Nbf());
+                  // Get density submatrix (Niel x Njel)
+                  arma::mat Psub(mem_Psub[ith].memptr(),Ni,Nj,false,true);
+                  Psub=Rmat[L].slice(id).submat(ifirst,jfirst,ilast,jlast);
 
-        // Full exchange matrix
-        arma::mat K(Ndummy(),Ndummy());
-        K.zeros();
+                  // Calculate helper
+                  arma::mat T(mem_T[ith].memptr(),Ni,Nj,false,true);
+                  // (Niel x Njel) = (Niel x Njel) x (Njel x Njel)
+                  T=Psub*arma::trans(jint);
 
-        // Helper memory
+                  // Increment
+                  Ksub+=iint*T;
+                }
+
+                K[id].submat(jang*Nrad+ifirst,kang*Nrad+jfirst,jang*Nrad+ilast,kang*Nrad+jlast)-=Ksub;
+              }
+            }
+          }
+        };
+
+        // With fewer angular pairs than threads, the output elements of
+        // the pairs are distributed over the threads as well
+        if(pairs.size() >= (size_t) nth) {
 #ifdef _OPENMP
-        const int nth(omp_get_max_threads());
+#pragma omp parallel
+#endif
+          {
+#ifdef _OPENMP
+            const int ith(omp_get_thread_num());
 #else
-        const int nth(1);
+            const int ith(0);
 #endif
-        std::vector<arma::vec> mem_Ksub(nth);
-        std::vector<arma::vec> mem_Psub(nth);
-        std::vector<arma::vec> mem_T(nth);
+            // These are only small submatrices!
+            mem_Psub[ith].zeros(radial.max_Nprim()*radial.max_Nprim()*Nd);
+            mem_Ksub[ith].zeros(radial.max_Nprim()*radial.max_Nprim()*Nd);
+            mem_T[ith].zeros(radial.max_Nprim()*radial.max_Nprim()*radial.max_Nprim());
+
+            // Radial helpers are reused over the angular pairs
+            std::vector<arma::cube> Rmat(N_L);
+            std::vector<bool> couple(N_L);
 
 #ifdef _OPENMP
-#pragma omp parallel
+#pragma omp for schedule(dynamic)
 #endif
-        {
+            for(size_t ip=0;ip<pairs.size();ip++) {
+              pair_density(pairs[ip].first,pairs[ip].second,Rmat,couple);
+              for(size_t iel=0;iel<Nel;iel++)
+                pair_element(pairs[ip].first,pairs[ip].second,iel,Rmat,couple,ith);
+            }
+          }
+        } else {
+          for(int ith=0;ith<nth;ith++) {
+            mem_Psub[ith].zeros(radial.max_Nprim()*radial.max_Nprim()*Nd);
+            mem_Ksub[ith].zeros(radial.max_Nprim()*radial.max_Nprim()*Nd);
+            mem_T[ith].zeros(radial.max_Nprim()*radial.max_Nprim()*radial.max_Nprim());
+          }
+
+          // Radial helpers of all the pairs
+          std::vector< std::vector<arma::cube> > Rmat(pairs.size(),std::vector<arma::cube>(N_L));
+          std::vector< std::vector<bool> > couple(pairs.size(),std::vector<bool>(N_L));
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+          for(size_t ip=0;ip<pairs.size();ip++)
+            pair_density(pairs[ip].first,pairs[ip].second,Rmat[ip],couple[ip]);
+
+          // Adjacent elements share a radial function, so the even
+          // elements are done before the odd ones to keep the updates
+          // disjoint
+          for(size_t parity=0;parity<2;parity++) {
+            const size_t ntask((Nel+1-parity)/2);
+#ifdef _OPENMP
+#pragma omp parallel for collapse(2) schedule(dynamic)
+#endif
+            for(size_t ip=0;ip<pairs.size();ip++)
+              for(size_t itask=0;itask<ntask;itask++) {
 #ifdef _OPENMP
-          const int ith(omp_get_thread_num());
+                const int ith(omp_get_thread_num());
 #else
-          const int ith(0);
+                const int ith(0);
 #endif
-          // These are only small submatrices!
-          mem_Psub[ith].zeros(radial.max_Nprim()*radial.max_Nprim());
-          mem_Ksub[ith].zeros(radial.max_Nprim()*radial.max_Nprim());
-          mem_T[ith].zeros(radial.max_Nprim()*radial.max_Nprim());
+                pair_element(pairs[ip].first,pairs[ip].second,2*itask+parity,Rmat[ip],couple[ip],ith);
+              }
+          }
+        }
 
-          // Increment
+        /*
+          In-element contributions. The in-element integrals are stored
+          in Coulomb order in the pair-symmetric subspace. They are
+          unpacked one l at a time to the tile (ij,k), which contracts
+          with the column P(i,l) to give K(jk) = (ij|kl) P(il).
+        */
+        if(tei_domains.size() && tei.size()) {
+          // Each domain contracts the elements it holds
+          const int nin(numa::team_size(tei_domains.size()));
 #ifdef _OPENMP
-#pragma omp for collapse(2)
+#pragma omp parallel num_threads(tei_domains.size()) proc_bind(spread)
 #endif
-          for(size_t jang=0;jang<lval.n_elem;jang++) {
-            for(size_t kang=0;kang<lval.n_elem;kang++) {
-              int lj(lval(jang));
-              int mj(mval(jang));
-
-              int lk(lval(kang));
-              int mk(mval(kang));
-
-              // Form radial helpers
-              size_t N_L(2*arma::max(lval)+1);
-              std::vector<arma::mat> Rmat(N_L);
-              for(size_t i=0;i<N_L;i++) {
-                Rmat[i].zeros(Nrad,Nrad);
-              }
-              // Is there a coupling to the channel?
-              std::vector<bool> couple(N_L,false);
+          {
+#ifdef _OPENMP
+            const size_t idom(omp_get_thread_num());
+#else
+            const size_t idom(0);
+#endif
+            std::vector<arma::mat> teiwork;
+            for(size_t parity=0;parity<2;parity++) {
+              for(size_t i=0;i<tei_domains[idom].n_elem;i++)
+                if(tei_domains[idom](i)%2==parity)
+                  exchange_element(P,tei_domains[idom](i),tei,teiwork,Lfac,mirrored,mem_T,idom*nin,K,nin);
+#ifdef _OPENMP
+#pragma omp barrier
+#endif
+            }
+          }
+        } else {
+          // The elements are handled one at a time so that out-of-core
+          // integrals are streamed sequentially, and recomputed
+          // integrals are only held for a single element.
+          std::vector<arma::mat> teiwork;
+          arma::uvec elorder(element_order());
+          for(size_t iiel=0;iiel<Nel;iiel++)
+            exchange_element(P,elorder(iiel),tei,teiwork,Lfac,mirrored,mem_T,0,K,nth);
+        }
 
-              // Perform angular sums
-              for(size_t iang=0;iang<lval.n_elem;iang++) {
-                int li(lval(iang));
-                int mi(mval(iang));
+        // Pairs that were skipped are copied from their mirror images
+        if(mirrored)
+          mirror_fill(K);
 
-                for(size_t lang=0;lang<lval.n_elem;lang++) {
-                  int ll(lval(lang));
-                  int ml(mval(lang));
+        return K;
+      }
 
-                  // LH m value
-                  int M(mj-mi);
-                  // RH m value
-                  int Mp(mk-ml);
-                  if(M!=Mp)
-                    continue;
+      void TwoDBasis::exchange_element(const std::vector<arma::mat> & P, size_t iel, const std::vector<arma::mat> & tei, std::vector<arma::mat> & teiwork, const arma::vec & Lfac, bool mirrored, std::vector<arma::vec> & mem_T, size_t ioff, std::vector<arma::mat> & K, int nthr) const {
+        const size_t Nd(P.size());
+        size_t Nrad(radial.Nbf());
 
-                  // Do we have any density in this block?
-                  double bdens(arma::norm(P.submat(iang*Nrad,lang*Nrad,(iang+1)*Nrad-1,(lang+1)*Nrad-1),"fro"));
-                  //printf("(%i %i) (%i %i) density block norm %e\n",li,mi,ll,ml,bdens);
-                  if(bdens<10*DBL_EPSILON)
-                    continue;
+        size_t ifirst, ilast;
+        radial.get_idx(iel,ifirst,ilast);
+        size_t Ni(ilast-ifirst+1);
+        // Density block norms within the element
+        arma::mat edens(block_norms(P,ifirst,ilast));
+        if(edens.max()<screen_thr)
+          return;
+        std::vector<const arma::mat *> teiel(element_tei(tei,iel,teiwork));
+        // The range-separated integrals are only kept in double precision
+        std::vector<const arma::fmat *> teif;
+        if(&tei==&prim_tei)
+          teif=element_tei_single(iel);
+
+        const size_t N_L(2*arma::max(lval)+1);
+        // Angular pairs to build
+        const std::vector< std::pair<size_t,size_t> > pairs(exchange_pairs(mirrored));
+
+        // Angular sums of the element block of the density of the pair (jang,kang)
+        auto pair_density = [&](size_t jang, size_t kang, std::vector<arma::mat> & Psub, std::vector<bool> & couple) {
+          std::fill(couple.begin(),couple.end(),false);
+
+          const std::vector<exchange_coupling_t> & list(exch_cpl[jang*lval.n_elem+kang]);
+          for(size_t ic=0;ic<list.size();ic++) {
+            size_t iang(list[ic].iang);
+            size_t lang(list[ic].lang);
+            int L(list[ic].L);
+            if(edens(iang,lang)<screen_thr)
+              continue;
 
-                  // M values match. Loop over possible couplings
-                  int Lmin=std::max(std::max(std::abs(li-lj),std::abs(lk-ll)),abs(M));
-                  int Lmax=std::min(li+lj,lk+ll);
-
-                  for(int L=Lmin;L<=Lmax;L++) {
-                    // Calculate total coupling coefficient
-                    double cpl(gaunt.coeff(lj,mj,L,M,li,mi)*gaunt.coeff(lk,mk,L,M,ll,ml));
-                    if(cpl==0.0)
-                      continue;
-
-                    // L factor
-                    double Lfac = yukawa ? 4.0*M_PI*lambda :  4.0*M_PI*lambda/(2*L+1);
-                    Rmat[L]+=(Lfac*cpl)*P.submat(iang*Nrad,lang*Nrad,(iang+1)*Nrad-1,(lang+1)*Nrad-1);
-                    couple[L]=true;
-                  }
-                }
+            const double fac(Lfac(L)*list[ic].cpl);
+            if(!couple[L])
+              Psub[L].zeros(Ni*Ni,Nd);
+            for(size_t id=0;id<Nd;id++)
+              Psub[L].col(id)+=fac*arma::vectorise(P[id].submat(iang*Nrad+ifirst,lang*Nrad+ifirst,iang*Nrad+ilast,lang*Nrad+ilast));
+            couple[L]=true;
+          }
+        };
+
+        // Contract the tiles lbeg,...,lend-1 into Ksub; returns false if the pair does not couple
+        auto pair_tiles = [&](const std::vector<arma::mat> & Psub, const std::vector<bool> & couple, size_t lbeg, size_t lend, arma::mat & tile, arma::fmat & tilef, arma::mat & Ksub) {
+          Ksub.zeros();
+          bool any=false;
+          for(size_t L=0;L<N_L;L++) {
+            if(!couple[L])
+              continue;
+            any=true;
+            for(size_t l=lbeg;l<lend;l++) {
+              if(teif.size()) {
+                utils::pair_tei_tile(*teif[L],Ni,l,tilef);
+                Ksub+=arma::conv_to<arma::mat>::from(arma::trans(arma::fmat(tilef.memptr(),Ni,Ni*Ni,false,true))*arma::conv_to<arma::fmat>::from(Psub[L].rows(l*Ni,(l+1)*Ni-1)));
+              } else {
+                utils::pair_tei_tile(*teiel[L],Ni,l,tile);
+                Ksub+=arma::trans(arma::mat(tile.memptr(),Ni,Ni*Ni,false,true))*Psub[L].rows(l*Ni,(l+1)*Ni-1);
               }
+            }
+          }
+          return any;
+        };
+
+        // Increment global exchange matrices
+        auto add_pair = [&](size_t jang, size_t kang, const arma::mat & Ksub) {
+          for(size_t id=0;id<Nd;id++)
+            K[id].submat(jang*Nrad+ifirst,kang*Nrad+ifirst,jang*Nrad+ilast,kang*Nrad+ilast)-=arma::reshape(Ksub.col(id),Ni,Ni);
+        };
+
+        // With fewer angular pairs than threads, the tiles of each pair
+        // are distributed over the threads as well
+        const bool split(pairs.size() < (size_t) nthr);
+        std::vector< std::vector<arma::mat> > Psplit(split ? pairs.size() : 0,std::vector<arma::mat>(N_L));
+        std::vector< std::vector<bool> > csplit(split ? pairs.size() : 0,std::vector<bool>(N_L));
+        if(split) {
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) num_threads(nthr)
+#endif
+          for(size_t ip=0;ip<pairs.size();ip++)
+            pair_density(pairs[ip].first,pairs[ip].second,Psplit[ip],csplit[ip]);
+        }
 
-              // Loop over elements: output
-              for(size_t iel=0;iel<Nel;iel++) {
-                size_t ifirst, ilast;
-                radial.get_idx(iel,ifirst,ilast);
-
-                // Input
-                for(size_t jel=0;jel<Nel;jel++) {
-                  size_t jfirst, jlast;
-                  radial.get_idx(jel,jfirst,jlast);
-
-                  // Number of functions in the two elements
-                  size_t Ni(ilast-ifirst+1);
-                  size_t Nj(jlast-jfirst+1);
-
-                  // error function does not factorize
-                  if(!yukawa || iel == jel) {
-                    /*
-                      The exchange matrix is given by
-                      K(jk) = (ij|kl) P(il)
-                      i.e. the complex conjugation hits i and l as
-                      in the density matrix.
-
-                      To get this in the proper order, we permute the integrals
-                      K(jk) = (jk;il) P(il)
-                    */
-
-                    // Exchange submatrix
-                    arma::mat Ksub(mem_Ksub[ith].memptr(),Ni*Nj,1,false,true);
-                    Ksub.zeros();
-
-                    for(size_t L=0;L<N_L;L++) {
-                      if(!couple[L])
-                        continue;
-                      Ksub+=rs_ktei[Nel*Nel*L + iel*Nel + jel]*arma::vectorise(Rmat[L].submat(ifirst,jfirst,ilast,jlast));
-                    }
-                    Ksub.reshape(Ni,Nj);
-
-                    // Increment global exchange matrix
-                    K.submat(jang*Nrad+ifirst,kang*Nrad+jfirst,jang*Nrad+ilast,kang*Nrad+jlast)-=Ksub;
-
-                  } else {
-                    // Exchange submatrix
-                    arma::mat Ksub(mem_Ksub[ith].memptr(),Ni,Nj,false,true);
-                    Ksub.zeros();
-
-                    for(size_t L=0;L<N_L;L++) {
-                      if(!couple[L])
-                        continue;
-
-                      // Disjoint integrals. When r(iel)>r(jel), iel gets -1-L, jel gets L.
-                      const arma::mat & iint=(iel>jel) ? disjoint_kL[L*Nel+iel] : disjoint_iL[L*Nel+iel];
-                      const arma::mat & jint=(iel>jel) ? disjoint_iL[L*Nel+jel] : disjoint_kL[L*Nel+jel];
-
-                      // Get density submatrix (Niel x Njel)
-                      arma::mat Psub(mem_Psub[ith].memptr(),Ni,Nj,false,true);
-                      Psub=Rmat[L].submat(ifirst,jfirst,ilast,jlast);
-
-                      // Calculate helper
-                      arma::mat T(mem_T[ith].memptr(),Ni,Nj,false,true);
-                      // (Niel x Njel) = (Niel x Njel) x (Njel x Njel)
-                      T=Psub*arma::trans(jint);
-
-                      // Increment
-                      Ksub+=iint*T;
-                    }
-
-                    K.submat(jang*Nrad+ifirst,kang*Nrad+jfirst,jang*Nrad+ilast,kang*Nrad+jlast)-=Ksub;
-                  }
+#ifdef _OPENMP
+#pragma omp parallel num_threads(nthr)
+#endif
+        {
+#ifdef _OPENMP
+          const size_t ith(ioff+omp_get_thread_num());
+#else
+          const size_t ith(ioff);
+#endif
+          arma::mat Ksub(Ni*Ni,Nd);
+          arma::mat tile(mem_T[ith].memptr(),Ni*Ni,Ni,false,true);
+          arma::fmat tilef;
+          if(teif.size())
+            tilef.set_size(Ni*Ni,Ni);
+
+          if(!split) {
+            std::vector<arma::mat> Psub(N_L);
+            std::vector<bool> couple(N_L);
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+            for(size_t ip=0;ip<pairs.size();ip++) {
+              pair_density(pairs[ip].first,pairs[ip].second,Psub,couple);
+              if(pair_tiles(Psub,couple,0,Ni,tile,tilef,Ksub))
+                add_pair(pairs[ip].first,pairs[ip].second,Ksub);
+            }
+          } else {
+#ifdef _OPENMP
+#pragma omp for collapse(2) schedule(dynamic)
+#endif
+            for(size_t ip=0;ip<pairs.size();ip++)
+              for(size_t l=0;l<Ni;l++) {
+                if(pair_tiles(Psplit[ip],csplit[ip],l,l+1,tile,tilef,Ksub)) {
+#ifdef _OPENMP
+#pragma omp critical(exchange_element_add)
+#endif
+                  add_pair(pairs[ip].first,pairs[ip].second,Ksub);
                 }
               }
-            }
           }
         }
-
-        return remove_boundaries(K);
       }
 
       arma::mat TwoDBasis::remove_boundaries(const arma::mat & Fnob) const {
@@ -1300,6 +2069,10 @@ namespace helfem {
           throw std::logic_error(oss.str());
         }
 
+        // The layouts coincide, so no index gather is needed
+        if(Nbf()==Ndummy())
+          return Fnob;
+
         // Get indices
         arma::uvec idx(pure_indices());
 
@@ -1319,6 +2092,10 @@ namespace helfem {
           throw std::logic_error(oss.str());
         }
 
+        // The layouts coincide, so no index scatter is needed
+        if(Nbf()==Ndummy())
+          return Ppure;
+
         // Get indices
         arma::uvec idx(pure_indices());
 
@@ -1334,15 +2111,59 @@ namespace helfem {
       }
 
       std::vector<arma::mat> TwoDBasis::get_prim_tei() const {
-        return prim_tei;
+        // Unpack the in-element integrals from the pair-symmetric subspace
+        size_t Nel(radial.Nel());
+        std::vector<arma::mat> tei(prim_tei.size());
+        for(size_t i=0;i<prim_tei.size();i++) {
+          if(!prim_tei[i].n_elem)
+            continue;
+          size_t Ni(radial.Nprim((i%(Nel*Nel))/Nel));
+          tei[i]=arma::trans(utils::pair_unpack(arma::trans(utils::pair_unpack(prim_tei[i],Ni,true)),Ni,true));
+        }
+        return tei;
+      }
+
+      std::string TwoDBasis::tei_fingerprint() const {
+        // Parameters that determine the radial integrals
+        arma::vec par(6);
+        par(0)=get_poly_id();
+        par(1)=get_poly_nnodes();
+        par(2)=get_nquad();
+        par(3)=2*arma::max(lval)+1;
+        par(4)=zeroder;
+        par(5)=get_taylor_order();
+        arma::vec key(arma::join_cols(par,get_bval()));
+        // The element orders only enter when they vary, so that the
+        // fingerprints of uniform bases are unchanged
+        if(!uniform_poly())
+          key=arma::join_cols(key,arma::conv_to<arma::vec>::from(arma::join_cols(get_element_poly_id(),get_element_poly_nnodes())));
+
+        return "atomic_" + utils::hash_data(key);
+      }
+
+      void TwoDBasis::eval_sph(const arma::vec & cth, const arma::vec & phi, arma::cx_mat & sph, arma::cx_mat & sph_th, arma::cx_mat & sph_phi, bool deriv) const {
+        // Evaluate all the spherical harmonics at once
+        arma::cx_mat Y, dYth, dYphi;
+        ::spherical_harmonics(arma::max(lval),cth,phi,Y,dYth,dYphi,deriv);
+
+        // and pick out the ones in the basis
+        arma::uvec idx(lval.n_elem);
+        for(size_t i=0;i<lval.n_elem;i++)
+          idx(i)=::spherical_harmonics_index(lval(i),mval(i));
+        sph=Y.rows(idx);
+        if(deriv) {
+          sph_th=dYth.rows(idx);
+          sph_phi=dYphi.rows(idx);
+        }
       }
 
       arma::cx_mat TwoDBasis::eval_bf(size_t iel, double cth, double phi) const {
-        // Evaluate spherical harmonics
-        arma::cx_vec sph(lval.n_elem);
-        for(size_t i=0;i<lval.n_elem;i++)
-          sph(i)=::spherical_harmonics(lval(i),mval(i),cth,phi);
+        arma::cx_mat sph, sph_th, sph_phi;
+        eval_sph(arma::vec({cth}),arma::vec({phi}),sph,sph_th,sph_phi,false);
+        return eval_bf(iel,arma::cx_vec(sph.col(0)));
+      }
 
+      arma::cx_mat TwoDBasis::eval_bf(size_t iel, const arma::cx_vec & sph) const {
         // Evaluate radial functions
         arma::mat rad(radial.get_bf(iel));
 
@@ -1354,12 +2175,72 @@ namespace helfem {
         return bf;
       }
 
+      void TwoDBasis::eval_radial(size_t iel, arma::mat & bf, arma::mat & df, bool deriv) const {
+        bf=radial.get_bf(iel);
+        if(deriv)
+          df=radial.get_df(iel);
+        else
+          df.reset();
+      }
+
+      arma::cx_mat TwoDBasis::eval_bf(const arma::mat & points) const {
+        if(points.n_cols != 3) {
+          std::ostringstream oss;
+          oss << "Points should be given as rows of (r, cth, phi), but " << points.n_cols << " columns were given!\n";
+          throw std::logic_error(oss.str());
+        }
+
+        // Sort the points into the radial elements
+        arma::vec bval(radial.get_bval());
+        const size_t Nel(bval.n_elem-1);
+        std::vector< std::vector<arma::uword> > elpts(Nel);
+        for(size_t ip=0;ip<points.n_rows;ip++) {
+          double r(points(ip,0));
+          if(r<bval(0) || r>bval(Nel))
+            continue;
+          size_t iel(std::upper_bound(bval.begin(),bval.end(),r)-bval.begin());
+          iel=std::min(iel-1,Nel-1);
+          elpts[iel].push_back(ip);
+        }
+
+        // Angular functions at all the points
+        arma::cx_mat sph, sph_th, sph_phi;
+        eval_sph(points.col(1),points.col(2),sph,sph_th,sph_phi,false);
+        sph=arma::strans(sph);
+
+        arma::cx_mat bf(points.n_rows,Nbf(),arma::fill::zeros);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,1)
+#endif
+        for(size_t iel=0;iel<Nel;iel++) {
+          if(!elpts[iel].size())
+            continue;
+          arma::uvec idx(arma::conv_to<arma::uvec>::from(elpts[iel]));
+
+          // Primitive coordinates and radial functions
+          arma::vec r(points.col(0));
+          arma::vec x(2.0*(r(idx)-bval(iel))/(bval(iel+1)-bval(iel)) - 1.0);
+          arma::cx_mat rad(arma::conv_to<arma::cx_mat>::from(radial.get_bf(x,iel)));
+          arma::cx_mat sphsub(sph.rows(idx));
+
+          size_t ifirst, ilast;
+          radial.get_idx(iel,ifirst,ilast);
+          for(size_t i=0;i<lval.n_elem;i++) {
+            arma::uvec cols(arma::linspace<arma::uvec>(i*radial.Nbf()+ifirst,i*radial.Nbf()+ilast,ilast-ifirst+1));
+            bf.submat(idx,cols)=rad.each_col()%sphsub.col(i);
+          }
+        }
+
+        return bf;
+      }
+
       void TwoDBasis::eval_df(size_t iel, double cth, double phi, arma::cx_mat & dr, arma::cx_mat & dth, arma::cx_mat & dphi) const {
-        // Evaluate spherical harmonics
-        arma::cx_vec sph(lval.n_elem);
-        for(size_t i=0;i<lval.n_elem;i++)
-          sph(i)=::spherical_harmonics(lval(i),mval(i),cth,phi);
+        arma::cx_mat sph, sph_th, sph_phi;
+        eval_sph(arma::vec({cth}),arma::vec({phi}),sph,sph_th,sph_phi,true);
+        eval_df(iel,arma::cx_vec(sph.col(0)),arma::cx_vec(sph_th.col(0)),arma::cx_vec(sph_phi.col(0)),dr,dth,dphi);
+      }
 
+      void TwoDBasis::eval_df(size_t iel, const arma::cx_vec & sph, const arma::cx_vec & sph_th, const arma::cx_vec & sph_phi, arma::cx_mat & dr, arma::cx_mat & dth, arma::cx_mat & dphi) const {
         // Evaluate radial functions
         arma::mat frad(radial.get_bf(iel));
         arma::mat drad(radial.get_df(iel));
@@ -1369,35 +2250,21 @@ namespace helfem {
         dth.zeros(frad.n_rows,lval.n_elem*frad.n_cols);
         dphi.zeros(frad.n_rows,lval.n_elem*frad.n_cols);
 
-        // Radial one is easy
-        for(size_t i=0;i<lval.n_elem;i++)
-          dr.cols(i*frad.n_cols,(i+1)*frad.n_cols-1)=sph(i)*drad;
-        // and so is phi
-        for(size_t i=0;i<lval.n_elem;i++)
-          dphi.cols(i*frad.n_cols,(i+1)*frad.n_cols-1)=std::complex<double>(0.0,mval(i))*sph(i)*frad;
-        // but theta is nastier
+        // The angular derivatives are already in the angular factors
         for(size_t i=0;i<lval.n_elem;i++) {
-          // cot th = 1/tan th = cos th / sin th
-          double cotth=cth/sqrt(1.0-cth*cth);
-
-          int l(lval(i));
-          int m(mval(i));
-
-          // Angular factor
-          std::complex<double> angfac(m*cotth*sph(i));
-          if(mval(i)<lval(i))
-            angfac+=sqrt((l-m)*(l+m+1))*std::exp(std::complex<double>(0,-phi))*::spherical_harmonics(lval(i),mval(i)+1,cth,phi);
-
-          dth.cols(i*frad.n_cols,(i+1)*frad.n_cols-1)=angfac*frad;
+          dr.cols(i*frad.n_cols,(i+1)*frad.n_cols-1)=sph(i)*drad;
+          dth.cols(i*frad.n_cols,(i+1)*frad.n_cols-1)=sph_th(i)*frad;
+          dphi.cols(i*frad.n_cols,(i+1)*frad.n_cols-1)=sph_phi(i)*frad;
         }
       }
 
       arma::cx_mat TwoDBasis::eval_lf(size_t iel, double cth, double phi) const {
-        // Evaluate spherical harmonics
-        arma::cx_vec sph(lval.n_elem);
-        for(size_t i=0;i<lval.n_elem;i++)
-          sph(i)=::spherical_harmonics(lval(i),mval(i),cth,phi);
+        arma::cx_mat sph, sph_th, sph_phi;
+        eval_sph(arma::vec({cth}),arma::vec({phi}),sph,sph_th,sph_phi,false);
+        return eval_lf(iel,arma::cx_vec(sph.col(0)));
+      }
 
+      arma::cx_mat TwoDBasis::eval_lf(size_t iel, const arma::cx_vec & sph) const {
         // Evaluate radial functions
         arma::vec r(radial.get_r(iel));
         arma::mat frad(radial.get_bf(iel));
@@ -1460,8 +2327,7 @@ namespace helfem {
         // Total number of radial functions
         size_t Nrad(radial.Nbf());
 
-        // Expand density matrix to boundary conditions
-        arma::mat P(expand_boundaries(P0));
+        const arma::mat & P(P0);
 
         // Loop over angular momentum
         double nucden=0.0;
@@ -1486,8 +2352,7 @@ namespace helfem {
         // Total number of radial functions
         size_t Nrad(radial.Nbf());
 
-        // Expand density matrix to boundary conditions
-        arma::mat P(expand_boundaries(P0));
+        const arma::mat & P(P0);
 
         // Loop over angular momentum
         double nucden=0.0;
@@ -1504,6 +2369,27 @@ namespace helfem {
 
         return den;
       }
+
+      arma::vec TwoDBasis::element_error(const arma::mat & P) const {
+        // Total number of radial functions
+        size_t Nrad(radial.Nbf());
+
+        arma::vec err(radial.Nel(),arma::fill::zeros);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,1)
+#endif
+        for(size_t iel=0;iel<radial.Nel();iel++) {
+          size_t ifirst, ilast;
+          radial.get_idx(iel,ifirst,ilast);
+          arma::mat tail(radial.legendre_tail(iel,2));
+          // The angular shells are orthogonal, so their contributions add up
+          for(size_t iam=0;iam<lval.n_elem;iam++)
+            err(iel)+=arma::accu(tail%P.submat(Nrad*iam+ifirst,Nrad*iam+ifirst,Nrad*iam+ilast,Nrad*iam+ilast));
+        }
+
+        // The tails are nonnegative up to roundoff
+        return arma::sqrt(arma::clamp(err,0.0,DBL_MAX));
+      }
     }
   }
 }
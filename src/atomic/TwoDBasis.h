@@ -19,13 +19,22 @@
 #include <armadillo>
 #include "../general/model_potential.h"
 #include "../general/sap.h"
+#include "../general/gaunt.h"
+#include "../general/scratch.h"
 #include <RadialBasis.h>
+#include <list>
+#include <memory>
+
+class Checkpoint;
 
 namespace helfem {
   namespace atomic {
     namespace basis {
       /// Two-dimensional basis set
       class TwoDBasis {
+        /// Integral cache accesses the integral arrays
+        friend class ::Checkpoint;
+
         /// Nuclear charge
         int Z;
         /// Nuclear model
@@ -54,20 +63,109 @@ namespace helfem {
         /// Zero out derivative at practical infinity?
         bool zeroder;
 
-        /// Auxiliary integrals
+        /// Auxiliary integrals: radial moments <r^L> and <r^{-L-1}>
+        /// per element, indexed as L*Nel+iel
         std::vector<arma::mat> disjoint_L, disjoint_m1L;
+        /// Compute the radial moments
+        void compute_moments();
+        /// Get the assembled radial moment <r^L> (n>=0) or <r^{-L-1}> (n<0, L=-n-1)
+        arma::mat radial_moment(int n) const;
         /// Auxiliary integrals for Yukawa separation
         std::vector<arma::mat> disjoint_iL, disjoint_kL;
-        /// Primitive two-electron integrals: <Nel^2 * (2L+1)>
+        /// Primitive two-electron integrals: <Nel^2 * (2L+1)>, in the pair-symmetric subspace
         std::vector<arma::mat> prim_tei;
-        /// Primitive two-electron integrals: <Nel^2 * (2L+1)> sorted for exchange
-        std::vector<arma::mat> prim_ktei;
-        /// Primitive range-separated two-electron integrals: <Nel^2 * (2L+1)> sorted for exchange
-        std::vector<arma::mat> rs_ktei;
+        /// Single-precision copies of the in-element blocks of prim_tei, used in the early SCF iterations
+        std::vector<arma::fmat> prim_tei_single;
+        /// Storage of the primitive two-electron integrals
+        scratch::tei_storage_t tei_storage;
+        /// Memory budget for the primitive two-electron integrals in bytes, zero for unlimited
+        size_t tei_budget;
+        /// Scratch directory for out-of-core integrals
+        std::string tei_scratch;
+        /// Memory map backing out-of-core integrals
+        std::shared_ptr<scratch::MappedFile> tei_map;
+        /// Number of recomputed elements kept in the cache
+        size_t tei_ncache;
+        /// Cache of recomputed in-element integrals, most recently used element first
+        mutable std::list< std::pair< size_t, std::vector<arma::mat> > > tei_lru;
+        /// Order in which the elements are contracted: cached elements first
+        arma::uvec element_order() const;
+        /// Number of NUMA domains requested for the in-core integrals
+        size_t tei_ndom;
+        /// Elements whose integrals live in each NUMA domain; empty when the integrals are not distributed
+        std::vector<arma::uvec> tei_domains;
+        /// Form tei_domains for the current storage
+        void partition_tei();
+        /// Compute the in-element integrals of element iel for all L into prim_tei
+        void compute_tei_element(size_t iel);
+        /// Threshold for skipping density blocks in the Coulomb and exchange builds
+        double screen_thr;
+        /// Number of active and total (L,M) channels in the last Coulomb build
+        mutable size_t coulomb_nactive, coulomb_ntot;
+        /// Norms of the angular blocks of the densities restricted to the radial functions first to last, maximized over the densities
+        arma::mat block_norms(const std::vector<arma::mat> & P, size_t first, size_t last) const;
+        /// Index of the shell with the same l and opposite m for every angular shell, -1 if the basis has no such shell
+        arma::ivec shell_mirror() const;
+        /// Are the densities invariant under m -> -m?
+        bool mirror_symmetric(const std::vector<arma::mat> & P) const;
+        /// Is (jang,kang) the representative of its pair of exchange blocks related by m -> -m?
+        bool mirror_canonical(size_t jang, size_t kang) const;
+        /// Angular pairs (jang,kang) of the exchange matrix that are built, i.e. the representative ones if mirrored
+        std::vector< std::pair<size_t,size_t> > exchange_pairs(bool mirrored) const;
+        /// Copy the exchange blocks of the pairs that are not representative from their mirror images
+        void mirror_fill(std::vector<arma::mat> & K) const;
+        /// Get the single-precision in-element integrals of element iel for all L; empty if they are not in use
+        std::vector<const arma::fmat *> element_tei_single(size_t iel) const;
+        /// Get the in-element integrals of element iel for all L, recomputing them into work if tei is empty
+        std::vector<const arma::mat *> element_tei(const std::vector<arma::mat> & tei, size_t iel, std::vector<arma::mat> & work) const;
+        /// Primitive range-separated two-electron integrals: <Nel^2 * (2L+1)>. In-element blocks are stored as prim_tei, off-diagonal ones sorted for exchange
+        std::vector<arma::mat> rs_tei;
+        /// Low-rank factors (ij|kl) = sum_r A(ij,r) B(kl,r) of off-diagonal range-separated integrals that are not stored in rs_tei; element pairs with neither are screened out
+        std::vector<arma::mat> rs_lowrank_a, rs_lowrank_b;
+        /// Screening threshold of the range-separated integrals
+        double rs_thr;
+        /// Number of L values in the radial moments
+        size_t N_Lmom;
+
+        /// Nonzero angular coupling in the exchange matrix
+        typedef struct {
+          /// Bra angular function
+          size_t iang;
+          /// Ket angular function
+          size_t lang;
+          /// Coupling channel
+          int L;
+          /// Product of Gaunt coefficients
+          double cpl;
+        } exchange_coupling_t;
+        /// Gaunt coefficient table, shared by all the basis sets of the same size
+        std::shared_ptr<const gaunt::Gaunt> gaunt;
+        /// List of nonzero exchange couplings for (jang, kang), stored at jang*Nang+kang
+        std::vector< std::vector<exchange_coupling_t> > exch_cpl;
+        /// Form the list of nonzero exchange couplings
+        void form_exchange_couplings();
+        /// Exchange driver: primitive integrals tei, disjoint factors for
+        /// the smaller and bigger radial coordinate, and L prefactors
+        std::vector<arma::mat> exchange_wrk(const std::vector<arma::mat> & P, const std::vector<arma::mat> & tei, const std::vector<arma::mat> & disjoint_small, const std::vector<arma::mat> & disjoint_big, const arma::vec & Lfac, bool factorizes, const std::vector<arma::mat> & lowrank_a=std::vector<arma::mat>(), const std::vector<arma::mat> & lowrank_b=std::vector<arma::mat>()) const;
+        /// Radial density of the (L,M) channel, one slice per density; bdens are the block norms of the densities
+        void channel_density(const std::vector<arma::mat> & P, const arma::mat & bdens, int L, int M, arma::cube & Pch) const;
+        /// Assemble the Coulomb matrices from the radial potentials of the (L,M) channels
+        std::vector<arma::mat> assemble_coulomb(const std::vector< std::vector<arma::cube> > & Jaux, size_t Nd) const;
+        /// Cholesky factors of the radial Poisson operators -d^2/dr^2 + L(L+1)/r^2 for L=0,...,2 lmax; empty unless the Poisson solver is used for J
+        std::vector<polynomial_basis::BandedMatrix> poisson_chol;
+        /// Basis functions, radii and weights at the quadrature points of every element, for the Poisson solver
+        std::vector<arma::mat> poisson_bf;
+        std::vector<arma::vec> poisson_r, poisson_w;
+        /// Form the Coulomb matrices with the Poisson solver
+        std::vector<arma::mat> coulomb_poisson(const std::vector<arma::mat> & P) const;
+        /// In-element Coulomb contribution of element iel to the radial helpers of the (L,M) channels, using nthr threads
+        void coulomb_element(const std::vector<arma::mat> & P, size_t iel, std::vector<arma::mat> & teiwork, const std::vector< std::pair<int,int> > & channels, const std::vector< std::vector<arma::cube> > & Paux, std::vector< std::vector<arma::cube> > & Jaux, int nthr) const;
+        /// In-element exchange contribution of element iel, using nthr threads whose work arrays start at mem_T[ioff]
+        void exchange_element(const std::vector<arma::mat> & P, size_t iel, const std::vector<arma::mat> & tei, std::vector<arma::mat> & teiwork, const arma::vec & Lfac, bool mirrored, std::vector<arma::vec> & mem_T, size_t ioff, std::vector<arma::mat> & K, int nthr) const;
 
         /// Add to radial submatrix
         void add_sub(arma::mat & M, size_t iang, size_t jang, const arma::mat & Msub) const;
-        /// Set radial submatrix
+        /// Set radial submatrix. The (iang,jang) blocks do not overlap, so the fill loops over them run in parallel with every thread writing its own blocks
         void set_sub(arma::mat & M, size_t iang, size_t jang, const arma::mat & Msub) const;
         /// Get radial submatrix
         arma::mat get_sub(const arma::mat & M, size_t iang, size_t jang) const;
@@ -76,6 +174,8 @@ namespace helfem {
         TwoDBasis();
         /// Constructor
         TwoDBasis(int Z, modelpotential::nuclear_model_t model, double Rrms, const std::shared_ptr<const polynomial_basis::PolynomialBasis> &poly, bool zeroder, int n_quad, const arma::vec & bval, int taylor_order, const arma::ivec & lval, const arma::ivec & mval, int Zl, int Zr, double Rhalf);
+        /// Constructor with a varying polynomial order: element iel uses polys[el_poly(iel)]
+        TwoDBasis(int Z, modelpotential::nuclear_model_t model, double Rrms, const std::vector<std::shared_ptr<const polynomial_basis::PolynomialBasis>> &polys, const arma::uvec & el_poly, bool zeroder, int n_quad, const arma::vec & bval, int taylor_order, const arma::ivec & lval, const arma::ivec & mval, int Zl, int Zr, double Rhalf);
         /// Destructor
         ~TwoDBasis();
 
@@ -106,6 +206,12 @@ namespace helfem {
         int get_poly_id() const;
         /// Get number of nodes in polynomial
         int get_poly_nnodes() const;
+        /// Do all elements use the same polynomial basis?
+        bool uniform_poly() const;
+        /// Get polynomial basis identifiers of the elements
+        arma::ivec get_element_poly_id() const;
+        /// Get number of nodes in the polynomials of the elements
+        arma::ivec get_element_poly_nnodes() const;
         /// Is derivative zeroed at infinity?
         int get_zeroder() const;
 
@@ -123,16 +229,38 @@ namespace helfem {
         /// Memory for auxiliary two-electron integrals
         size_t mem_2el_aux() const;
 
-        /// Compute two-electron integrals
-        void compute_tei(bool exchange);
+        /// Set memory budget in bytes (zero for unlimited) and scratch directory for the primitive two-electron integrals. Direct mode always recomputes them, keeping the ncache most recently used elements
+        void set_tei_storage(size_t budget, const std::string & scratch, bool direct=false, size_t ncache=0);
+        /// Get storage of the primitive two-electron integrals
+        scratch::tei_storage_t get_tei_storage() const;
+        /// Set threshold for skipping density blocks in the Coulomb and exchange builds; the default is 10*DBL_EPSILON
+        void set_screening(double thr);
+        /// Get the number of (L,M) channels that survived the density screening in the last Coulomb build, and the total number; both are zero if it was not screened
+        void get_coulomb_channels(size_t & nactive, size_t & ntot) const;
+        /// Compute two-electron integrals; verbose prints thread load balance
+        void compute_tei(bool verbose=false);
+        /// Contract the in-element integrals in single precision? Only available for in-core integrals, which are kept in both precisions while this is on
+        void set_tei_single(bool single);
+        /// Are the in-element integrals contracted in single precision?
+        bool get_tei_single() const;
+        /// Distribute the in-core integrals over ndom NUMA domains, zero for none; takes effect in compute_tei
+        void set_numa(size_t ndom);
+        /// Move the in-core integrals to the NUMA domains that contract them, e.g. after they have been read from disk
+        void distribute_tei();
+        /// Form the Coulomb matrix by solving the radial Poisson equation of every density multipole instead of from the primitive integrals, which are then only needed for exact exchange
+        void set_poisson(bool poisson);
+        /// Is the Coulomb matrix formed with the Poisson solver?
+        bool get_poisson() const;
+        /// Have the primitive two-electron integrals been set up?
+        bool have_tei() const;
         /// Compute range-separated two-electron integrals
         void compute_yukawa(double lambda);
-        /// Compute range-separated two-electron integrals
-        void compute_erfc(double mu);
+        /// Compute range-separated two-electron integrals; element pairs below thr are skipped, and distant pairs are stored in low-rank form
+        void compute_erfc(double mu, double thr=1e-12);
 
         /// Number of basis functions
         size_t Nbf() const;
-        /// Number of dummy basis functions
+        /// Number of dummy basis functions; the pure and dummy layouts coincide in the atomic basis, so matrices in either are used as they are
         size_t Ndummy() const;
 
         /// Number of radial functions
@@ -164,6 +292,8 @@ namespace helfem {
         arma::mat dipole_z() const;
         /// Form quadrupole coupling matrix
         arma::mat quadrupole_zz() const;
+        /// Form the matrix of the absorbing potential (r-R0)^2 for r>R0
+        arma::mat absorbing_potential(double R0) const;
 
         /// Compute overlap matrix
         arma::mat overlap(const TwoDBasis & rh) const;
@@ -176,13 +306,21 @@ namespace helfem {
 
         /// Form Coulomb matrix
         arma::mat coulomb(const arma::mat & P) const;
+        /// Form Coulomb matrices of several densities in one pass over the integrals
+        std::vector<arma::mat> coulomb(const std::vector<arma::mat> & P) const;
         /// Form exchange matrix
         arma::mat exchange(const arma::mat & P) const;
+        /// Form exchange matrices of several densities in one pass over the integrals
+        std::vector<arma::mat> exchange(const std::vector<arma::mat> & P) const;
         /// Form range-separated exchange matrix
         arma::mat rs_exchange(const arma::mat & P) const;
+        /// Form range-separated exchange matrices of several densities in one pass
+        std::vector<arma::mat> rs_exchange(const std::vector<arma::mat> & P) const;
 
         /// Get primitive integrals
         std::vector<arma::mat> get_prim_tei() const;
+        /// Fingerprint of the parameters that determine the primitive integrals
+        std::string tei_fingerprint() const;
 
         /// Get l values
         arma::ivec get_l() const;
@@ -194,6 +332,10 @@ namespace helfem {
         arma::uvec lm_indices(int l, int m) const;
         /// Get indices for wanted symmetry
         std::vector<arma::uvec> get_sym_idx(int isym) const;
+        /// Permutation taking every basis function to its partner with opposite m; empty if the basis is not closed under m -> -m
+        arma::uvec mirror_indices() const;
+        /// For every block of get_sym_idx(isym), the earlier block with opposite m whose orbitals it shares, or -1 if the block is solved itself
+        arma::ivec get_sym_mirror(int isym) const;
 
         /// Evaluate basis functions
         arma::cx_mat eval_bf(size_t iel, double cth, double phi) const;
@@ -201,6 +343,26 @@ namespace helfem {
         void eval_df(size_t iel, double cth, double phi, arma::cx_mat & dr, arma::cx_mat & dth, arma::cx_mat & dphi) const;
         /// Evaluate Laplacian of basis functions
         arma::cx_mat eval_lf(size_t iel, double cth, double phi) const;
+        /// Evaluate the angular functions at all the points at once; column i
+        /// holds the values (and theta and phi derivatives, if wanted) at the i:th point
+        void eval_sph(const arma::vec & cth, const arma::vec & phi, arma::cx_mat & sph, arma::cx_mat & sph_th, arma::cx_mat & sph_phi, bool deriv) const;
+        /// Evaluate basis functions from precomputed angular functions
+        arma::cx_mat eval_bf(size_t iel, const arma::cx_vec & sph) const;
+        /// Evaluate the radial functions of the element, and their derivatives if wanted, at the quadrature points; the basis functions are their products with the angular functions
+        void eval_radial(size_t iel, arma::mat & bf, arma::mat & df, bool deriv) const;
+        /**
+         * Evaluate basis functions at arbitrary points, given as rows of
+         * (r, cos theta, phi). The points are sorted into radial
+         * elements with a binary search, and the functions in each
+         * element are evaluated at all of its points at once. Row i of
+         * the returned matrix holds the values at the i:th point;
+         * points outside the basis give zero rows.
+         */
+        arma::cx_mat eval_bf(const arma::mat & points) const;
+        /// Evaluate basis functions derivatives from precomputed angular functions
+        void eval_df(size_t iel, const arma::cx_vec & sph, const arma::cx_vec & sph_th, const arma::cx_vec & sph_phi, arma::cx_mat & dr, arma::cx_mat & dth, arma::cx_mat & dphi) const;
+        /// Evaluate Laplacian of basis functions from precomputed angular functions
+        arma::cx_mat eval_lf(size_t iel, const arma::cx_vec & sph) const;
         /// Get list of basis function indices in element
         arma::uvec bf_list(size_t iel) const;
 
@@ -215,6 +377,8 @@ namespace helfem {
         arma::vec nuclear_density(const arma::mat & P) const;
         /// Electron density gradient at nuclei
         arma::vec nuclear_density_gradient(const arma::mat & P) const;
+        /// Discretization error indicator of every radial element: the norm of the density in the two highest Legendre components of the element
+        arma::vec element_error(const arma::mat & P) const;
       };
     }
   }
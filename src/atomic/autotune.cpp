@@ -0,0 +1,348 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#include "../general/cmdline.h"
+#include "../general/elements.h"
+#include "../general/model_potential.h"
+#include "../general/scf_helpers.h"
+#include "../general/timer.h"
+#include "basis.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+
+/**
+ * Automatic choice of the radial basis for the atomic program. The
+ * occupied orbitals of the neutral atom in the aufbau order are
+ * solved in a fixed one-electron potential, either the bare nucleus
+ * whose energies are known exactly or the SAP screened nucleus
+ * referenced against the largest grid, on element grids of growing
+ * size. For every number of nodes the smallest number of elements
+ * that reproduces the orbital energies to the wanted accuracy is
+ * found, after which the cheapest of these according to the memory
+ * and operation count of the SCF procedure is reported together
+ * with the smallest sufficient quadrature.
+ */
+
+using namespace helfem;
+
+/// Radial grid parameters
+typedef struct {
+  /// Primitive basis
+  int primbas;
+  /// Number of nodes per element
+  int nnodes;
+  /// Number of elements
+  int nelem;
+  /// Number of quadrature points
+  int nquad;
+} grid_t;
+
+/// Fixed parameters of the radial grid
+typedef struct {
+  /// Practical infinity
+  double Rmax;
+  /// Type of grid
+  int igrid;
+  /// Grid parameter
+  double zexp;
+} gridpars_t;
+
+/// Estimated cost of an SCF calculation in a grid
+typedef struct {
+  /// Number of radial functions
+  size_t Nrad;
+  /// Number of basis functions
+  size_t Nbf;
+  /// Memory for the one-electron matrices and their auxiliary integrals
+  size_t mem_1el;
+  /// Memory for the two-electron integrals
+  size_t mem_2el;
+  /// Floating point operations for the two-electron integrals
+  double work_tei;
+  /// Floating point operations per SCF iteration
+  double work_iter;
+} cost_t;
+
+/// Parse a comma separated list of integers
+static std::vector<int> parse_list(const std::string & str) {
+  std::vector<int> ret;
+  std::istringstream iss(str);
+  std::string entry;
+  while(std::getline(iss,entry,',')) {
+    if(!entry.size())
+      continue;
+    std::istringstream ess(entry);
+    int val;
+    if(!(ess >> val) || val<2) {
+      std::ostringstream oss;
+      oss << "Invalid number of nodes \"" << entry << "\"!\n";
+      throw std::logic_error(oss.str());
+    }
+    ret.push_back(val);
+  }
+  return ret;
+}
+
+/// Number of occupied shells of each l in the ground state of the neutral atom, filled in the Madelung order
+static arma::ivec occupied_shells(int Z) {
+  std::vector<int> nsh;
+  int nel=0;
+  for(int s=1;nel<Z;s++)
+    // Within the same n+l the highest l is filled first
+    for(int l=(s-1)/2;l>=0 && nel<Z;l--) {
+      if((int) nsh.size()<=l)
+        nsh.resize(l+1,0);
+      nsh[l]++;
+      nel+=2*(2*l+1);
+    }
+  return arma::conv_to<arma::ivec>::from(nsh);
+}
+
+/// Construct the basis set in the given grid
+static atomic::basis::TwoDBasis form_basis(int Z, const grid_t & grid, const gridpars_t & pars, int lmax, int mmax) {
+  auto poly(std::shared_ptr<const polynomial_basis::PolynomialBasis>(polynomial_basis::get_basis(grid.primbas,grid.nnodes)));
+  arma::vec bval(atomic::basis::normal_grid(grid.nelem,pars.Rmax,pars.igrid,pars.zexp));
+  arma::ivec lval, mval;
+  atomic::basis::angular_basis(lmax,mmax,lval,mval);
+  return atomic::basis::TwoDBasis(Z, modelpotential::POINT_NUCLEUS, 0.0, poly, false, grid.nquad, bval, poly->get_nprim()-1, lval, mval, 0, 0, 0.0);
+}
+
+/// Default quadrature used by the atomic program
+static int default_nquad(int primbas, int nnodes) {
+  std::shared_ptr<const polynomial_basis::PolynomialBasis> poly(polynomial_basis::get_basis(primbas,nnodes));
+  return 5*poly->get_nbf();
+}
+
+/// Lowest nshell(l) orbital energies for every l in the model potential; false if the basis does not have enough functions
+static bool orbital_energies(int Z, const grid_t & grid, const gridpars_t & pars, bool sap, const arma::ivec & nshell, arma::vec & E) {
+  atomic::basis::TwoDBasis basis(form_basis(Z,grid,pars,nshell.n_elem-1,0));
+
+  arma::mat S(basis.overlap());
+  arma::mat H(basis.kinetic());
+  if(sap) {
+    modelpotential::SAPAtom model(Z);
+    H+=basis.model_potential(&model);
+  } else {
+    H+=basis.nuclear();
+  }
+
+  E.zeros(arma::sum(nshell));
+  size_t ioff=0;
+  for(size_t l=0;l<nshell.n_elem;l++) {
+    arma::uvec idx(basis.lm_indices(l,0));
+    if(idx.n_elem < (size_t) nshell(l))
+      return false;
+    arma::vec El;
+    arma::mat Cl;
+    scf::eig_gsym(El,Cl,H(idx,idx),scf::form_Sinvh(S(idx,idx)));
+    E.subvec(ioff,ioff+nshell(l)-1)=El.subvec(0,nshell(l)-1);
+    ioff+=nshell(l);
+  }
+  return true;
+}
+
+/// Estimate the cost of the SCF calculation with the given angular basis
+static cost_t estimate_cost(int Z, const grid_t & grid, const gridpars_t & pars, int lmax, int mmax) {
+  atomic::basis::TwoDBasis basis(form_basis(Z,grid,pars,lmax,mmax));
+
+  cost_t cost;
+  cost.Nrad=basis.Nrad();
+  cost.Nbf=basis.Nbf();
+  cost.mem_1el=10*basis.mem_1el()+basis.mem_1el_aux();
+  cost.mem_2el=basis.mem_2el_aux();
+
+  // The integrals are stored per element and L in the pair-symmetric
+  // subspace; each block is formed from the inner integrals on the
+  // quadrature
+  double N_L(2*lmax+1);
+  double nblock((double) cost.mem_2el/(sizeof(double)*N_L*grid.nelem));
+  cost.work_tei=2.0*N_L*grid.nelem*grid.nquad*nblock;
+  // Every integral is contracted once for each angular shell in the
+  // Fock build, and the Fock matrix is diagonalized in every shell
+  double nrad((double) cost.Nrad);
+  cost.work_iter=2.0*basis.Nang()*cost.mem_2el/sizeof(double) + 10.0*basis.Nang()*nrad*nrad*nrad;
+  return cost;
+}
+
+/// Measure the floating point rate of the machine with a matrix product
+static double flop_rate() {
+  const size_t N=500;
+  arma::mat A(N,N,arma::fill::randu);
+  arma::mat B(N,N,arma::fill::randu);
+  // Warm up
+  arma::mat C(A*B);
+  Timer t;
+  const int nrep=5;
+  for(int i=0;i<nrep;i++)
+    C+=A*B;
+  double tmul(std::max(t.get(),DBL_EPSILON));
+  return 2.0*nrep*N*N*N/tmul;
+}
+
+int main(int argc, char **argv) {
+  cmdline::parser parser;
+  parser.add<std::string>("Z", 0, "nuclear charge", true);
+  parser.add<double>("target", 0, "wanted accuracy of the orbital energies", false, 1e-6);
+  parser.add<std::string>("potential", 0, "one-electron potential: sap for the screened nucleus, coulomb for the bare nucleus", false, "sap");
+  parser.add<int>("lmax", 0, "maximum l quantum number of the SCF calculation", false, -1);
+  parser.add<int>("mmax", 0, "maximum m quantum number of the SCF calculation", false, 0);
+  parser.add<double>("Rmax", 0, "practical infinity in au", false, 40.0);
+  parser.add<int>("grid", 0, "type of grid: 1 for linear, 2 for quadratic, 3 for polynomial, 4 for exponential", false, 4);
+  parser.add<double>("zexp", 0, "parameter in radial grid", false, 2.0);
+  parser.add<int>("primbas", 0, "primitive radial basis", false, 4);
+  parser.add<std::string>("nnodes", 0, "comma separated list of numbers of nodes to consider", false, "6,8,10,12,15,20");
+  parser.add<int>("maxelem", 0, "maximum number of elements to consider", false, 50);
+  parser.add<int>("iterations", 0, "number of SCF iterations assumed in the time estimate", false, 20);
+  parser.parse_check(argc, argv);
+
+  int Z(get_Z(parser.get<std::string>("Z")));
+  double target(parser.get<double>("target"));
+  std::string potential(parser.get<std::string>("potential"));
+  int lmax(parser.get<int>("lmax"));
+  int mmax(parser.get<int>("mmax"));
+  gridpars_t pars;
+  pars.Rmax=parser.get<double>("Rmax");
+  pars.igrid=parser.get<int>("grid");
+  pars.zexp=parser.get<double>("zexp");
+  int primbas(parser.get<int>("primbas"));
+  std::vector<int> nnodes(parse_list(parser.get<std::string>("nnodes")));
+  int maxelem(parser.get<int>("maxelem"));
+  int niter(parser.get<int>("iterations"));
+
+  if(Z<1)
+    throw std::logic_error("The autotuner needs a nuclear charge!\n");
+  if(target<=0.0)
+    throw std::logic_error("The target accuracy must be positive!\n");
+  if(potential!="sap" && potential!="coulomb") {
+    std::ostringstream oss;
+    oss << "Unknown potential " << potential << "!\n";
+    throw std::logic_error(oss.str());
+  }
+  if(!nnodes.size() || maxelem<1)
+    throw std::logic_error("No grids to consider!\n");
+  bool sap(potential=="sap");
+
+  // Orbitals to converge
+  arma::ivec nshell(occupied_shells(Z));
+  if(lmax<0)
+    lmax=nshell.n_elem-1;
+  printf("Converging the lowest");
+  for(size_t l=0;l<nshell.n_elem;l++)
+    printf(" %i %c",(int) nshell(l),"spdfghik"[l]);
+  printf(" orbitals of Z=%i in the %s potential to %e\n",Z,sap ? "SAP" : "bare nuclear",target);
+  printf("Grid %i with zexp=%.3f and Rmax=%.3f\n",pars.igrid,pars.zexp,pars.Rmax);
+  fflush(stdout);
+
+  // Reference energies
+  arma::vec Eref;
+  if(sap) {
+    grid_t ref;
+    ref.primbas=primbas;
+    ref.nnodes=*std::max_element(nnodes.begin(),nnodes.end());
+    ref.nelem=maxelem;
+    ref.nquad=default_nquad(primbas,ref.nnodes);
+    if(!orbital_energies(Z,ref,pars,sap,nshell,Eref))
+      throw std::logic_error("Reference grid is too small!\n");
+    printf("Reference energies from %i elements with %i nodes\n",ref.nelem,ref.nnodes);
+  } else {
+    Eref.zeros(arma::sum(nshell));
+    size_t ioff=0;
+    for(size_t l=0;l<nshell.n_elem;l++)
+      for(int i=0;i<nshell(l);i++) {
+        int n(l+1+i);
+        Eref(ioff++)=-0.5*Z*Z/(n*n);
+      }
+  }
+
+  double rate(flop_rate());
+  printf("Measured %.3f Gflop/s for the time estimates\n\n",rate/1e9);
+
+  printf("%6s %6s %6s %8s %12s %12s %12s\n","nnodes","nelem","nquad","Nbf","error","memory","time/s");
+  fflush(stdout);
+
+  // Smallest sufficient grid for each number of nodes
+  std::vector<grid_t> grids;
+  std::vector<cost_t> costs;
+  std::vector<double> errors;
+  for(size_t in=0;in<nnodes.size();in++) {
+    grid_t grid;
+    grid.primbas=primbas;
+    grid.nnodes=nnodes[in];
+    grid.nquad=default_nquad(primbas,grid.nnodes);
+    bool found=false;
+    for(grid.nelem=1;grid.nelem<=maxelem;grid.nelem++) {
+      arma::vec E;
+      if(!orbital_energies(Z,grid,pars,sap,nshell,E))
+        continue;
+      double err(arma::max(arma::abs(E-Eref)));
+      if(err<=target) {
+        found=true;
+        grids.push_back(grid);
+        errors.push_back(err);
+        break;
+      }
+    }
+    if(!found) {
+      printf("%6i %6s %6s %8s %12s %12s %12s\n",grid.nnodes,"-","-","-","not reached","-","-");
+      continue;
+    }
+    costs.push_back(estimate_cost(Z,grids.back(),pars,lmax,mmax));
+    const cost_t & c(costs.back());
+    double t((c.work_tei+niter*c.work_iter)/rate);
+    printf("%6i %6i %6i %8i %12.3e %12s %12.3e\n",grid.nnodes,grid.nelem,grid.nquad,(int) c.Nbf,errors.back(),scf::memory_size(c.mem_1el+c.mem_2el).c_str(),t);
+    fflush(stdout);
+  }
+  if(!grids.size())
+    throw std::logic_error("None of the grids reaches the target accuracy; increase maxelem or nnodes.\n");
+
+  // Pick the cheapest grid
+  size_t imin=0;
+  for(size_t i=1;i<grids.size();i++)
+    if(costs[i].work_tei+niter*costs[i].work_iter < costs[imin].work_tei+niter*costs[imin].work_iter)
+      imin=i;
+  grid_t best(grids[imin]);
+  if(sap && best.nnodes==*std::max_element(nnodes.begin(),nnodes.end()) && best.nelem==maxelem)
+    printf("\nWarning: the chosen grid coincides with the reference grid.\n");
+
+  // Smallest quadrature that does not change the energies beyond a
+  // tenth of the target
+  arma::vec Edef;
+  orbital_energies(Z,best,pars,sap,nshell,Edef);
+  std::shared_ptr<const polynomial_basis::PolynomialBasis> poly(polynomial_basis::get_basis(primbas,best.nnodes));
+  int nquad_def(best.nquad);
+  for(int nquad=2*poly->get_nbf();nquad<nquad_def;nquad++) {
+    grid_t trial(best);
+    trial.nquad=nquad;
+    arma::vec E;
+    if(orbital_energies(Z,trial,pars,sap,nshell,E) && arma::max(arma::abs(E-Edef))<=0.1*target) {
+      best.nquad=nquad;
+      break;
+    }
+  }
+
+  cost_t cost(estimate_cost(Z,best,pars,lmax,mmax));
+  printf("\nRecommended grid: --nnodes=%i --nelem=%i --nquad=%i --primbas=%i --grid=%i --zexp=%.3f --Rmax=%.3f\n",best.nnodes,best.nelem,best.nquad,best.primbas,pars.igrid,pars.zexp,pars.Rmax);
+  printf("With lmax=%i and mmax=%i the basis has %i functions\n",lmax,mmax,(int) cost.Nbf);
+  printf("One-electron matrices require %s\n",scf::memory_size(cost.mem_1el).c_str());
+  printf("Two-electron integrals require %s\n",scf::memory_size(cost.mem_2el).c_str());
+  printf("Estimated time: %.3e s for the integrals, %.3e s per SCF iteration\n",cost.work_tei/rate,cost.work_iter/rate);
+
+  return 0;
+}
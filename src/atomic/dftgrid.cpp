@@ -24,6 +24,8 @@
 #include "../general/dftfuncs.h"
 // Angular quadrature
 #include "../general/angular.h"
+#include "../general/profiler.h"
+#include "../general/memtrack.h"
 
 // OpenMP parallellization for XC calculations
 #ifdef _OPENMP
@@ -33,14 +35,17 @@
 namespace helfem {
   namespace atomic {
     namespace dftgrid {
-      DFTGridWorker::DFTGridWorker() {
+      DFTGridWorker::DFTGridWorker() : xcpool(NULL), lang(0), mang(0), real_bf(false), sumfac(false), sf_tables(false), rPv(8), cPv(8) {
       }
 
-      DFTGridWorker::DFTGridWorker(const helfem::atomic::basis::TwoDBasis * basp_, int lang, int mang) : basp(basp_) {
+      DFTGridWorker::DFTGridWorker(const helfem::atomic::basis::TwoDBasis * basp_, int lang_, int mang_) : basp(basp_), xcpool(NULL), lang(lang_), mang(mang_), sumfac(false), sf_tables(false), rPv(8), cPv(8) {
         do_grad=false;
         do_tau=false;
         do_lapl=false;
 
+        // Spherical harmonics are real if only m=0 functions are present
+        real_bf=arma::all(basp->get_mval()==0);
+
         // Get angular grid
         helfem::angular::angular_chebyshev(lang,mang,cth,phi,wang);
       }
@@ -48,23 +53,242 @@ namespace helfem {
       DFTGridWorker::~DFTGridWorker() {
       }
 
-      void DFTGridWorker::update_density(const arma::mat & P0) {
+      template<> std::vector<arma::mat> & DFTGridWorker::Pv_work<double>() {
+        return rPv;
+      }
+
+      template<> std::vector<arma::cx_mat> & DFTGridWorker::Pv_work< std::complex<double> >() {
+        return cPv;
+      }
+
+      /*
+        Sum-factorized kernel. The basis functions of an element are
+        products chi_{aj}(r,Omega) = R_j(r) Y_a(Omega), so the density
+        rho(r,Omega) = sum_{ab} Re[Y_a conj(Y_b)] D_ab(r) with
+        D_ab(r) = sum_{jk} R_j(r) P_{aj,bk} R_k(r), and the Fock matrix
+        follows from the same two contractions in reverse. The cube D
+        holds D_ab in slice a, column b; X and A are the (possibly
+        differentiated) radial and angular factors of the bra, and Z
+        and B those of the ket.
+      */
+
+      /// Radial stage of the density: D_ab(r) = sum_jk X_j(r) P_{aj,bk} Z_k(r)
+      static void sf_radial_density(const arma::mat & P, const arma::mat & X, const arma::mat & Z, size_t nang, arma::cube & D) {
+        const size_t Nrad(X.n_cols);
+        D.zeros(X.n_rows,nang,nang);
+        for(size_t a=0;a<nang;a++) {
+          arma::mat XP(X*P.rows(a*Nrad,(a+1)*Nrad-1));
+          for(size_t b=0;b<nang;b++)
+            D.slice(a).col(b)=arma::sum(XP.cols(b*Nrad,(b+1)*Nrad-1)%Z,1);
+        }
+      }
+
+      /// Angular stage of the density: n(r,Omega) = sum_ab Re[A_a(Omega) conj(B_b(Omega))] D_ab(r), Nr x Na
+      static void sf_angular_density(const arma::cube & D, const arma::mat & Are, const arma::mat & Aim, const arma::mat & Bre, const arma::mat & Bim, arma::mat & n) {
+        const bool cplx(Aim.n_elem && Bim.n_elem);
+        n.zeros(D.n_rows,Bre.n_cols);
+        arma::mat t;
+        for(size_t a=0;a<D.n_slices;a++) {
+          t=D.slice(a)*Bre;
+          t.each_row()%=arma::rowvec(Are.row(a));
+          n+=t;
+          if(cplx) {
+            t=D.slice(a)*Bim;
+            t.each_row()%=arma::rowvec(Aim.row(a));
+            n+=t;
+          }
+        }
+      }
+
+      /// Angular stage of the potential: V_ab(r) = sum_Omega v(r,Omega) Re[A_a(Omega) conj(B_b(Omega))]
+      static void sf_angular_potential(const arma::mat & v, const arma::mat & Are, const arma::mat & Aim, const arma::mat & Bre, const arma::mat & Bim, arma::cube & V) {
+        const bool cplx(Aim.n_elem && Bim.n_elem);
+        V.zeros(v.n_rows,Bre.n_rows,Are.n_rows);
+        arma::mat t;
+        for(size_t a=0;a<Are.n_rows;a++) {
+          t=v;
+          t.each_row()%=arma::rowvec(Are.row(a));
+          V.slice(a)=t*arma::trans(Bre);
+          if(cplx) {
+            t=v;
+            t.each_row()%=arma::rowvec(Aim.row(a));
+            V.slice(a)+=t*arma::trans(Bim);
+          }
+        }
+      }
+
+      /// Radial stage of the potential: H_{aj,bk} += sum_r X_j(r) V_ab(r) Z_k(r)
+      static void sf_radial_potential(const arma::cube & V, const arma::mat & X, const arma::mat & Z, arma::mat & H) {
+        const size_t Nrad(X.n_cols);
+        for(size_t a=0;a<V.n_slices;a++)
+          for(size_t b=0;b<V.n_cols;b++) {
+            arma::mat ZV(Z);
+            ZV.each_col()%=arma::vec(V.slice(a).col(b));
+            H.submat(a*Nrad,b*Nrad,(a+1)*Nrad-1,(b+1)*Nrad-1)+=arma::trans(X)*ZV;
+          }
+      }
+
+      void DFTGridWorker::sf_density(const arma::mat & P, arma::rowvec & n, arma::mat & gn) const {
+        const size_t nang(sf_y_re.n_rows);
+        arma::cube D;
+        sf_radial_density(P,sf_rad,sf_rad,nang,D);
+        arma::mat m;
+        sf_angular_density(D,sf_y_re,sf_y_im,sf_y_re,sf_y_im,m);
+        n=arma::trans(arma::vectorise(m));
+
+        if(do_grad) {
+          gn.zeros(3,n.n_elem);
+          arma::cube Dr;
+          sf_radial_density(P,sf_drad,sf_rad,nang,Dr);
+          sf_angular_density(Dr,sf_y_re,sf_y_im,sf_y_re,sf_y_im,m);
+          gn.row(0)=2.0*arma::trans(arma::vectorise(m))/scale_r;
+          sf_angular_density(D,sf_th_re,sf_th_im,sf_y_re,sf_y_im,m);
+          gn.row(1)=2.0*arma::trans(arma::vectorise(m))/scale_theta;
+          sf_angular_density(D,sf_ph_re,sf_ph_im,sf_y_re,sf_y_im,m);
+          gn.row(2)=2.0*arma::trans(arma::vectorise(m))/scale_phi;
+        } else
+          gn.reset();
+      }
+
+      void DFTGridWorker::sf_increment_lda(arma::mat & H, const arma::rowvec & v) const {
+        arma::cube V;
+        sf_angular_potential(arma::reshape(arma::mat(v),sf_rad.n_rows,sf_y_re.n_cols),sf_y_re,sf_y_im,sf_y_re,sf_y_im,V);
+        sf_radial_potential(V,sf_rad,sf_rad,H);
+      }
+
+      void DFTGridWorker::sf_increment_gga(arma::mat & H, const arma::mat & gn) const {
+        const size_t Nr(sf_rad.n_rows), Na(sf_y_re.n_cols);
+        // The gradient couples the derivative in the bra to the
+        // function in the ket, and then vice versa
+        arma::mat Hh(H.n_rows,H.n_cols,arma::fill::zeros);
+        arma::cube V;
+        sf_angular_potential(arma::reshape(arma::mat(gn.col(0)),Nr,Na),sf_y_re,sf_y_im,sf_y_re,sf_y_im,V);
+        sf_radial_potential(V,sf_drad,sf_rad,Hh);
+        sf_angular_potential(arma::reshape(arma::mat(gn.col(1)),Nr,Na),sf_th_re,sf_th_im,sf_y_re,sf_y_im,V);
+        sf_radial_potential(V,sf_rad,sf_rad,Hh);
+        sf_angular_potential(arma::reshape(arma::mat(gn.col(2)),Nr,Na),sf_ph_re,sf_ph_im,sf_y_re,sf_y_im,V);
+        sf_radial_potential(V,sf_rad,sf_rad,Hh);
+        H+=Hh+arma::trans(Hh);
+      }
+
+      void DFTGridWorker::reserve(size_t nbf, size_t npts) {
+        // Armadillo keeps the allocation when a matrix is later
+        // resized to fewer elements, so sizing the arrays for the
+        // largest element once makes the rest of the elements free
+        // The sum-factorized kernel does not need the function tables
+        const bool tables(!sumfac || do_tau || do_lapl);
+        if(tables && real_bf) {
+          rbf.set_size(nbf,npts);
+          if(do_grad) {
+            rbf_rho.set_size(nbf,npts);
+            rbf_theta.set_size(nbf,npts);
+            rbf_phi.set_size(nbf,npts);
+          }
+          if(do_lapl)
+            rbf_lapl.set_size(nbf,npts);
+        }
+        // The complex arrays are also used to evaluate the functions
+        if(tables) {
+          bf.set_size(nbf,npts);
+          if(do_grad) {
+            bf_rho.set_size(nbf,npts);
+            bf_theta.set_size(nbf,npts);
+            bf_phi.set_size(nbf,npts);
+          }
+          if(do_lapl)
+            bf_lapl.set_size(nbf,npts);
+        }
+
+        // The density matrices
+        Pel.set_size(nbf,nbf);
+        Pael.set_size(nbf,nbf);
+        Pbel.set_size(nbf,nbf);
+        // The derivative contractions are only needed for tau and the laplacian
+        size_t npv((do_tau || do_lapl) ? rPv.size() : 2);
+        for(size_t i=0;i<npv;i++) {
+          if(real_bf)
+            rPv[i].set_size(nbf,npts);
+          else
+            cPv[i].set_size(nbf,npts);
+        }
+
+        // and the density and the functional
+        wtot.set_size(npts);
+        scale_r.set_size(npts);
+        scale_theta.set_size(npts);
+        scale_phi.set_size(npts);
+        rho.set_size(2,npts);
+        exc.set_size(npts);
+        exc_wrk.set_size(npts);
+        vxc.set_size(2,npts);
+        vxc_wrk.set_size(2,npts);
+        if(do_grad) {
+          grho.set_size(6,npts);
+          sigma.set_size(3,npts);
+          vsigma.set_size(3,npts);
+          vsigma_wrk.set_size(3,npts);
+        }
+        if(do_tau || do_lapl)
+          tau.set_size(2,npts);
+        if(do_tau) {
+          vtau.set_size(2,npts);
+          vtau_wrk.set_size(2,npts);
+        }
+        if(do_lapl) {
+          lapl.set_size(2,npts);
+          vlapl.set_size(2,npts);
+          vlapl_wrk.set_size(2,npts);
+        }
+      }
+
+      void DFTGridWorker::release_unused() {
+        if(!do_grad) {
+          bf_rho.reset();
+          bf_theta.reset();
+          bf_phi.reset();
+          rbf_rho.reset();
+          rbf_theta.reset();
+          rbf_phi.reset();
+          grho.reset();
+          sigma.reset();
+          vsigma.reset();
+          vsigma_wrk.reset();
+        }
+        if(!do_tau) {
+          vtau.reset();
+          vtau_wrk.reset();
+        }
+        if(!do_tau && !do_lapl)
+          tau.reset();
+        if(!do_lapl) {
+          bf_lapl.reset();
+          rbf_lapl.reset();
+          lapl.reset();
+          vlapl.reset();
+          vlapl_wrk.reset();
+        }
+      }
+
+      template<typename T> void DFTGridWorker::update_density_t(const arma::mat & P0, const arma::Mat<T> & f, const arma::Mat<T> & f_rho, const arma::Mat<T> & f_theta, const arma::Mat<T> & f_phi, const arma::Mat<T> & f_lapl) {
         // Update values of density
         if(!P0.n_elem) {
           throw std::runtime_error("Error - density matrix is empty!\n");
         }
-        arma::mat P(basp->expand_boundaries(P0)(bf_ind,bf_ind));
+        arma::mat & P(Pel);
+        P=P0(bf_ind,bf_ind);
 
         // Non-polarized calculation.
         polarized=false;
 
         // Update density vector
-        Pv=P*arma::conj(bf);
+        std::vector< arma::Mat<T> > & work(Pv_work<T>());
+        arma::Mat<T> & Pv(work[0]);
+        Pv=P*arma::conj(f);
 
         // Calculate density
         rho.zeros(1,wtot.n_elem);
         for(size_t ip=0;ip<wtot.n_elem;ip++)
-          rho(0,ip)=std::real(arma::dot(Pv.col(ip),bf.col(ip)));
+          rho(0,ip)=std::real(arma::dot(Pv.col(ip),f.col(ip)));
 
         // Calculate gradient
         if(do_grad) {
@@ -72,9 +296,9 @@ namespace helfem {
           sigma.zeros(1,wtot.n_elem);
           for(size_t ip=0;ip<wtot.n_elem;ip++) {
             // Calculate values
-            double g_rad=grho(0,ip)=2.0*std::real(arma::dot(Pv.col(ip),bf_rho.col(ip)))/scale_r(ip);
-            double g_th=grho(1,ip)=2.0*std::real(arma::dot(Pv.col(ip),bf_theta.col(ip)))/scale_theta(ip);
-            double g_phi=grho(2,ip)=2.0*std::real(arma::dot(Pv.col(ip),bf_phi.col(ip)))/scale_phi(ip);
+            double g_rad=grho(0,ip)=2.0*std::real(arma::dot(Pv.col(ip),f_rho.col(ip)))/scale_r(ip);
+            double g_th=grho(1,ip)=2.0*std::real(arma::dot(Pv.col(ip),f_theta.col(ip)))/scale_theta(ip);
+            double g_phi=grho(2,ip)=2.0*std::real(arma::dot(Pv.col(ip),f_phi.col(ip)))/scale_phi(ip);
             // Compute sigma as well
             sigma(0,ip)=g_rad*g_rad + g_th*g_th + g_phi*g_phi;
           }
@@ -86,16 +310,19 @@ namespace helfem {
           tau.zeros(1,wtot.n_elem);
 
           // Update helpers
-          Pv_rho=P*arma::conj(bf_rho);
-          Pv_theta=P*arma::conj(bf_theta);
-          Pv_phi=P*arma::conj(bf_phi);
+          arma::Mat<T> & Pv_rho(work[2]);
+          arma::Mat<T> & Pv_theta(work[3]);
+          arma::Mat<T> & Pv_phi(work[4]);
+          Pv_rho=P*arma::conj(f_rho);
+          Pv_theta=P*arma::conj(f_theta);
+          Pv_phi=P*arma::conj(f_phi);
 
           // Calculate values
           for(size_t ip=0;ip<wtot.n_elem;ip++) {
             // Gradient term
-            double kinrho(std::real(arma::dot(Pv_rho.col(ip),bf_rho.col(ip)))/std::pow(scale_r(ip),2));
-            double kintheta(std::real(arma::dot(Pv_theta.col(ip),bf_theta.col(ip)))/std::pow(scale_theta(ip),2));
-            double kinphi(std::real(arma::dot(Pv_phi.col(ip),bf_phi.col(ip)))/std::pow(scale_phi(ip),2));
+            double kinrho(std::real(arma::dot(Pv_rho.col(ip),f_rho.col(ip)))/std::pow(scale_r(ip),2));
+            double kintheta(std::real(arma::dot(Pv_theta.col(ip),f_theta.col(ip)))/std::pow(scale_theta(ip),2));
+            double kinphi(std::real(arma::dot(Pv_phi.col(ip),f_phi.col(ip)))/std::pow(scale_phi(ip),2));
             double kin(kinrho + kintheta + kinphi);
 
             // Store values
@@ -108,12 +335,12 @@ namespace helfem {
             // Calculate values
             for(size_t ip=0;ip<wtot.n_elem;ip++) {
               // Gradient term
-              double kinrho(std::real(arma::dot(Pv_rho.col(ip),bf_rho.col(ip)))/std::pow(scale_r(ip),2));
-              double kintheta(std::real(arma::dot(Pv_theta.col(ip),bf_theta.col(ip)))/std::pow(scale_theta(ip),2));
-              double kinphi(std::real(arma::dot(Pv_phi.col(ip),bf_phi.col(ip)))/std::pow(scale_phi(ip),2));
+              double kinrho(std::real(arma::dot(Pv_rho.col(ip),f_rho.col(ip)))/std::pow(scale_r(ip),2));
+              double kintheta(std::real(arma::dot(Pv_theta.col(ip),f_theta.col(ip)))/std::pow(scale_theta(ip),2));
+              double kinphi(std::real(arma::dot(Pv_phi.col(ip),f_phi.col(ip)))/std::pow(scale_phi(ip),2));
               double kin(kinrho + kintheta + kinphi);
               // Laplacian term
-              double lap(std::real(arma::dot(Pv.col(ip),bf_lapl.col(ip))));
+              double lap(std::real(arma::dot(Pv.col(ip),f_lapl.col(ip))));
 
               // Store values
               lapl(0,ip)=2.0*(kin + lap);
@@ -122,7 +349,32 @@ namespace helfem {
         }
       }
 
-      void DFTGridWorker::update_density(const arma::mat & Pa0, const arma::mat & Pb0) {
+      void DFTGridWorker::update_density(const arma::mat & P) {
+        if(sf_tables) {
+          if(!P.n_elem) {
+            throw std::runtime_error("Error - density matrix is empty!\n");
+          }
+          Pel=P(bf_ind,bf_ind);
+          polarized=false;
+
+          arma::rowvec n;
+          arma::mat gn;
+          sf_density(Pel,n,gn);
+          rho=n;
+          if(do_grad) {
+            grho=gn;
+            sigma=arma::sum(arma::square(gn),0);
+          }
+          return;
+        }
+
+        if(real_bf)
+          update_density_t<double>(P,rbf,rbf_rho,rbf_theta,rbf_phi,rbf_lapl);
+        else
+          update_density_t< std::complex<double> >(P,bf,bf_rho,bf_theta,bf_phi,bf_lapl);
+      }
+
+      template<typename T> void DFTGridWorker::update_density_t(const arma::mat & Pa0, const arma::mat & Pb0, const arma::Mat<T> & f, const arma::Mat<T> & f_rho, const arma::Mat<T> & f_theta, const arma::Mat<T> & f_phi, const arma::Mat<T> & f_lapl) {
         if(!Pa0.n_elem || !Pb0.n_elem) {
           throw std::runtime_error("Error - density matrix is empty!\n");
         }
@@ -131,17 +383,22 @@ namespace helfem {
         polarized=true;
 
         // Update density vector
-        arma::mat Pa(basp->expand_boundaries(Pa0)(bf_ind,bf_ind));
-        arma::mat Pb(basp->expand_boundaries(Pb0)(bf_ind,bf_ind));
+        arma::mat & Pa(Pael);
+        arma::mat & Pb(Pbel);
+        Pa=Pa0(bf_ind,bf_ind);
+        Pb=Pb0(bf_ind,bf_ind);
 
-        Pav=Pa*arma::conj(bf);
-        Pbv=Pb*arma::conj(bf);
+        std::vector< arma::Mat<T> > & work(Pv_work<T>());
+        arma::Mat<T> & Pav(work[0]);
+        arma::Mat<T> & Pbv(work[1]);
+        Pav=Pa*arma::conj(f);
+        Pbv=Pb*arma::conj(f);
 
         // Calculate density
         rho.zeros(2,wtot.n_elem);
         for(size_t ip=0;ip<wtot.n_elem;ip++) {
-          rho(0,ip)=std::real(arma::dot(Pav.col(ip),bf.col(ip)));
-          rho(1,ip)=std::real(arma::dot(Pbv.col(ip),bf.col(ip)));
+          rho(0,ip)=std::real(arma::dot(Pav.col(ip),f.col(ip)));
+          rho(1,ip)=std::real(arma::dot(Pbv.col(ip),f.col(ip)));
 
           /*
             double na=compute_density(Pa0,*basp,grid[ip].r);
@@ -157,13 +414,13 @@ namespace helfem {
           grho.zeros(6,wtot.n_elem);
           sigma.zeros(3,wtot.n_elem);
           for(size_t ip=0;ip<wtot.n_elem;ip++) {
-            double ga_rad=grho(0,ip)=2.0*std::real(arma::dot(Pav.col(ip),bf_rho.col(ip)))/scale_r(ip);
-            double ga_th=grho(1,ip)=2.0*std::real(arma::dot(Pav.col(ip),bf_theta.col(ip)))/scale_theta(ip);
-            double ga_phi=grho(2,ip)=2.0*std::real(arma::dot(Pav.col(ip),bf_phi.col(ip)))/scale_phi(ip);
+            double ga_rad=grho(0,ip)=2.0*std::real(arma::dot(Pav.col(ip),f_rho.col(ip)))/scale_r(ip);
+            double ga_th=grho(1,ip)=2.0*std::real(arma::dot(Pav.col(ip),f_theta.col(ip)))/scale_theta(ip);
+            double ga_phi=grho(2,ip)=2.0*std::real(arma::dot(Pav.col(ip),f_phi.col(ip)))/scale_phi(ip);
 
-            double gb_rad=grho(3,ip)=2.0*std::real(arma::dot(Pbv.col(ip),bf_rho.col(ip)))/scale_r(ip);
-            double gb_th=grho(4,ip)=2.0*std::real(arma::dot(Pbv.col(ip),bf_theta.col(ip)))/scale_theta(ip);
-            double gb_phi=grho(5,ip)=2.0*std::real(arma::dot(Pbv.col(ip),bf_phi.col(ip)))/scale_phi(ip);
+            double gb_rad=grho(3,ip)=2.0*std::real(arma::dot(Pbv.col(ip),f_rho.col(ip)))/scale_r(ip);
+            double gb_th=grho(4,ip)=2.0*std::real(arma::dot(Pbv.col(ip),f_theta.col(ip)))/scale_theta(ip);
+            double gb_phi=grho(5,ip)=2.0*std::real(arma::dot(Pbv.col(ip),f_phi.col(ip)))/scale_phi(ip);
 
             // Compute sigma as well
             sigma(0,ip)=ga_rad*ga_rad + ga_th*ga_th + ga_phi*ga_phi;
@@ -178,25 +435,31 @@ namespace helfem {
           tau.resize(2,wtot.n_elem);
 
           // Update helpers
-          Pav_rho=Pa*arma::conj(bf_rho);
-          Pav_theta=Pa*arma::conj(bf_theta);
-          Pav_phi=Pa*arma::conj(bf_phi);
-
-          Pbv_rho=Pb*arma::conj(bf_rho);
-          Pbv_theta=Pb*arma::conj(bf_theta);
-          Pbv_phi=Pb*arma::conj(bf_phi);
+          arma::Mat<T> & Pav_rho(work[2]);
+          arma::Mat<T> & Pav_theta(work[3]);
+          arma::Mat<T> & Pav_phi(work[4]);
+          Pav_rho=Pa*arma::conj(f_rho);
+          Pav_theta=Pa*arma::conj(f_theta);
+          Pav_phi=Pa*arma::conj(f_phi);
+
+          arma::Mat<T> & Pbv_rho(work[5]);
+          arma::Mat<T> & Pbv_theta(work[6]);
+          arma::Mat<T> & Pbv_phi(work[7]);
+          Pbv_rho=Pb*arma::conj(f_rho);
+          Pbv_theta=Pb*arma::conj(f_theta);
+          Pbv_phi=Pb*arma::conj(f_phi);
 
           // Calculate values
           for(size_t ip=0;ip<wtot.n_elem;ip++) {
             // Gradient term
-            double kinar=std::real(arma::dot(Pav_rho.col(ip),bf_rho.col(ip)))/std::pow(scale_r(ip),2);
-            double kinath=std::real(arma::dot(Pav_theta.col(ip),bf_theta.col(ip)))/std::pow(scale_theta(ip),2);
-            double kinaphi=std::real(arma::dot(Pav_phi.col(ip),bf_phi.col(ip)))/std::pow(scale_phi(ip),2);
+            double kinar=std::real(arma::dot(Pav_rho.col(ip),f_rho.col(ip)))/std::pow(scale_r(ip),2);
+            double kinath=std::real(arma::dot(Pav_theta.col(ip),f_theta.col(ip)))/std::pow(scale_theta(ip),2);
+            double kinaphi=std::real(arma::dot(Pav_phi.col(ip),f_phi.col(ip)))/std::pow(scale_phi(ip),2);
             double kina(kinar + kinath + kinaphi);
 
-            double kinbr=std::real(arma::dot(Pbv_rho.col(ip),bf_rho.col(ip)))/std::pow(scale_r(ip),2);
-            double kinbth=std::real(arma::dot(Pbv_theta.col(ip),bf_theta.col(ip)))/std::pow(scale_theta(ip),2);
-            double kinbphi=std::real(arma::dot(Pbv_phi.col(ip),bf_phi.col(ip)))/std::pow(scale_phi(ip),2);
+            double kinbr=std::real(arma::dot(Pbv_rho.col(ip),f_rho.col(ip)))/std::pow(scale_r(ip),2);
+            double kinbth=std::real(arma::dot(Pbv_theta.col(ip),f_theta.col(ip)))/std::pow(scale_theta(ip),2);
+            double kinbphi=std::real(arma::dot(Pbv_phi.col(ip),f_phi.col(ip)))/std::pow(scale_phi(ip),2);
             double kinb(kinbr + kinbth + kinbphi);
 
             // Store values
@@ -209,19 +472,19 @@ namespace helfem {
             // Calculate values
             for(size_t ip=0;ip<wtot.n_elem;ip++) {
               // Gradient term
-              double kinar=std::real(arma::dot(Pav_rho.col(ip),bf_rho.col(ip)))/std::pow(scale_r(ip),2);
-              double kinath=std::real(arma::dot(Pav_theta.col(ip),bf_theta.col(ip)))/std::pow(scale_theta(ip),2);
-              double kinaphi=std::real(arma::dot(Pav_phi.col(ip),bf_phi.col(ip)))/std::pow(scale_phi(ip),2);
+              double kinar=std::real(arma::dot(Pav_rho.col(ip),f_rho.col(ip)))/std::pow(scale_r(ip),2);
+              double kinath=std::real(arma::dot(Pav_theta.col(ip),f_theta.col(ip)))/std::pow(scale_theta(ip),2);
+              double kinaphi=std::real(arma::dot(Pav_phi.col(ip),f_phi.col(ip)))/std::pow(scale_phi(ip),2);
               double kina(kinar + kinath + kinaphi);
 
-              double kinbr=std::real(arma::dot(Pbv_rho.col(ip),bf_rho.col(ip)))/std::pow(scale_r(ip),2);
-              double kinbth=std::real(arma::dot(Pbv_theta.col(ip),bf_theta.col(ip)))/std::pow(scale_theta(ip),2);
-              double kinbphi=std::real(arma::dot(Pbv_phi.col(ip),bf_phi.col(ip)))/std::pow(scale_phi(ip),2);
+              double kinbr=std::real(arma::dot(Pbv_rho.col(ip),f_rho.col(ip)))/std::pow(scale_r(ip),2);
+              double kinbth=std::real(arma::dot(Pbv_theta.col(ip),f_theta.col(ip)))/std::pow(scale_theta(ip),2);
+              double kinbphi=std::real(arma::dot(Pbv_phi.col(ip),f_phi.col(ip)))/std::pow(scale_phi(ip),2);
               double kinb(kinbr + kinbth + kinbphi);
 
               // Laplacian term
-              double lapa(std::real(arma::dot(Pav.col(ip),bf_lapl.col(ip))));
-              double lapb(std::real(arma::dot(Pbv.col(ip),bf_lapl.col(ip))));
+              double lapa(std::real(arma::dot(Pav.col(ip),f_lapl.col(ip))));
+              double lapb(std::real(arma::dot(Pbv.col(ip),f_lapl.col(ip))));
 
               // Store values
               lapl(0,ip)=2.0*(kina + lapa);
@@ -231,6 +494,36 @@ namespace helfem {
         }
       }
 
+      void DFTGridWorker::update_density(const arma::mat & Pa, const arma::mat & Pb) {
+        if(sf_tables) {
+          if(!Pa.n_elem || !Pb.n_elem) {
+            throw std::runtime_error("Error - density matrix is empty!\n");
+          }
+          Pael=Pa(bf_ind,bf_ind);
+          Pbel=Pb(bf_ind,bf_ind);
+          polarized=true;
+
+          arma::rowvec na, nb;
+          arma::mat ga, gb;
+          sf_density(Pael,na,ga);
+          sf_density(Pbel,nb,gb);
+          rho=arma::join_cols(na,nb);
+          if(do_grad) {
+            grho=arma::join_cols(ga,gb);
+            sigma.zeros(3,na.n_elem);
+            sigma.row(0)=arma::sum(arma::square(ga),0);
+            sigma.row(1)=arma::sum(ga%gb,0);
+            sigma.row(2)=arma::sum(arma::square(gb),0);
+          }
+          return;
+        }
+
+        if(real_bf)
+          update_density_t<double>(Pa,Pb,rbf,rbf_rho,rbf_theta,rbf_phi,rbf_lapl);
+        else
+          update_density_t< std::complex<double> >(Pa,Pb,bf,bf_rho,bf_theta,bf_phi,bf_lapl);
+      }
+
       double DFTGridWorker::compute_Nel() const {
         double nel=0.0;
         if(!polarized) {
@@ -246,7 +539,7 @@ namespace helfem {
 
       double DFTGridWorker::compute_laplsum() const {
         double sum=0.0;
-        if(lapl.n_cols == wtot.n_elem) {
+        if(do_lapl && lapl.n_cols == wtot.n_elem) {
           if(!polarized) {
             for(size_t ip=0;ip<wtot.n_elem;ip++)
               sum+=wtot(ip)*lapl(0,ip);
@@ -274,6 +567,21 @@ namespace helfem {
         return ekin;
       }
 
+      double DFTGridWorker::max_density() const {
+        if(!rho.n_elem)
+          return 0.0;
+        return arma::max(arma::sum(rho,0));
+      }
+
+      double DFTGridWorker::max_gradient() const {
+        if(!do_grad || !grho.n_elem)
+          return 0.0;
+        arma::mat g(grho.rows(0,2));
+        if(polarized)
+          g+=grho.rows(3,5);
+        return std::sqrt(arma::max(arma::sum(arma::square(g),0)));
+      }
+
       void DFTGridWorker::init_xc() {
         // Size of grid.
         const size_t N=wtot.n_elem;
@@ -392,12 +700,6 @@ namespace helfem {
         const size_t N=wtot.n_elem;
 
         // Work arrays - exchange and correlation are computed separately
-        arma::rowvec exc_wrk;
-        arma::mat vxc_wrk;
-        arma::mat vsigma_wrk;
-        arma::mat vlapl_wrk;
-        arma::mat vtau_wrk;
-
         if(has_exc(func_id))
           exc_wrk.zeros(exc.n_elem);
         if(pot) {
@@ -417,24 +719,10 @@ namespace helfem {
         else
           nspin=XC_POLARIZED;
 
-        // Initialize libxc worker
-        xc_func_type func;
-        if(xc_func_init(&func, func_id, nspin) != 0) {
-          std::ostringstream oss;
-          oss << "Functional "<<func_id<<" not found!";
-          throw std::runtime_error(oss.str());
-        }
-        // Set density threshold
-        xc_func_set_dens_threshold(&func, thr);
-
-        // Set parameters
-        if(p.n_elem) {
-          // Check sanity
-          if(p.n_elem != (arma::uword) xc_func_info_get_n_ext_params((xc_func_info_type *)func.info))
-            throw std::logic_error("Incompatible number of parameters!\n");
-          arma::vec phlp(p);
-          xc_func_set_ext_params(&func, phlp.memptr());
-        }
+        // Get libxc worker; functionals are kept in the pool between calls
+        XCFunctionalPool localpool;
+        XCFunctionalPool & pool(xcpool ? *xcpool : localpool);
+        xc_func_type *func(pool.get(func_id, nspin, thr, arma::conv_to< std::vector<double> >::from(p)));
 
         // Evaluate functionals.
         if(has_exc(func_id)) {
@@ -444,20 +732,20 @@ namespace helfem {
               double * taup = mgga_t ? tau.memptr() : NULL;
               double * vlaplp = mgga_l ? vlapl_wrk.memptr() : NULL;
               double * vtaup = mgga_t ? vtau_wrk.memptr() : NULL;
-              xc_mgga_exc_vxc(&func, N, rho.memptr(), sigma.memptr(), laplp, taup, exc_wrk.memptr(), vxc_wrk.memptr(), vsigma_wrk.memptr(), vlaplp, vtaup);
+              xc_mgga_exc_vxc(func, N, rho.memptr(), sigma.memptr(), laplp, taup, exc_wrk.memptr(), vxc_wrk.memptr(), vsigma_wrk.memptr(), vlaplp, vtaup);
             } else if(gga) // GGA
-              xc_gga_exc_vxc(&func, N, rho.memptr(), sigma.memptr(), exc_wrk.memptr(), vxc_wrk.memptr(), vsigma_wrk.memptr());
+              xc_gga_exc_vxc(func, N, rho.memptr(), sigma.memptr(), exc_wrk.memptr(), vxc_wrk.memptr(), vsigma_wrk.memptr());
             else // LDA
-              xc_lda_exc_vxc(&func, N, rho.memptr(), exc_wrk.memptr(), vxc_wrk.memptr());
+              xc_lda_exc_vxc(func, N, rho.memptr(), exc_wrk.memptr(), vxc_wrk.memptr());
           } else {
             if(mgga_t || mgga_l) { // meta-GGA
               double * laplp = mgga_l ? lapl.memptr() : NULL;
               double * taup = mgga_t ? tau.memptr() : NULL;
-              xc_mgga_exc(&func, N, rho.memptr(), sigma.memptr(), laplp, taup, exc_wrk.memptr());
+              xc_mgga_exc(func, N, rho.memptr(), sigma.memptr(), laplp, taup, exc_wrk.memptr());
             } else if(gga) // GGA
-              xc_gga_exc(&func, N, rho.memptr(), sigma.memptr(), exc_wrk.memptr());
+              xc_gga_exc(func, N, rho.memptr(), sigma.memptr(), exc_wrk.memptr());
             else // LDA
-              xc_lda_exc(&func, N, rho.memptr(), exc_wrk.memptr());
+              xc_lda_exc(func, N, rho.memptr(), exc_wrk.memptr());
           }
 
         } else {
@@ -467,11 +755,11 @@ namespace helfem {
               double * taup = mgga_t ? tau.memptr() : NULL;
               double * vlaplp = mgga_l ? vlapl_wrk.memptr() : NULL;
               double * vtaup = mgga_t ? vtau_wrk.memptr() : NULL;
-              xc_mgga_vxc(&func, N, rho.memptr(), sigma.memptr(), laplp, taup, vxc_wrk.memptr(), vsigma_wrk.memptr(), vlaplp, vtaup);
+              xc_mgga_vxc(func, N, rho.memptr(), sigma.memptr(), laplp, taup, vxc_wrk.memptr(), vsigma_wrk.memptr(), vlaplp, vtaup);
             } else if(gga) // GGA
-              xc_gga_vxc(&func, N, rho.memptr(), sigma.memptr(), vxc_wrk.memptr(), vsigma_wrk.memptr());
+              xc_gga_vxc(func, N, rho.memptr(), sigma.memptr(), vxc_wrk.memptr(), vsigma_wrk.memptr());
             else // LDA
-              xc_lda_vxc(&func, N, rho.memptr(), vxc_wrk.memptr());
+              xc_lda_vxc(func, N, rho.memptr(), vxc_wrk.memptr());
           }
         }
 
@@ -487,9 +775,67 @@ namespace helfem {
             vsigma+=vsigma_wrk;
           vxc+=vxc_wrk;
         }
+      }
+
+      void DFTGridWorker::pack_density(const std::vector<DFTGridWorker *> & workers) {
+        const DFTGridWorker & first(*workers[0]);
+        polarized=first.polarized;
+        do_grad=first.do_grad;
+        do_tau=first.do_tau;
+        do_lapl=first.do_lapl;
+        xcpool=first.xcpool;
+        release_unused();
+
+        size_t N=0;
+        for(size_t i=0;i<workers.size();i++)
+          N+=workers[i]->wtot.n_elem;
+        wtot.set_size(N);
+        rho.set_size(first.rho.n_rows,N);
+        sigma.set_size(first.sigma.n_rows,first.sigma.n_elem ? N : 0);
+        tau.set_size(first.tau.n_rows,first.tau.n_elem ? N : 0);
+        lapl.set_size(first.lapl.n_rows,first.lapl.n_elem ? N : 0);
+
+        size_t off=0;
+        for(size_t i=0;i<workers.size();i++) {
+          const DFTGridWorker & w(*workers[i]);
+          const size_t n(w.wtot.n_elem);
+          if(!n)
+            continue;
+          wtot.subvec(off,off+n-1)=w.wtot;
+          rho.cols(off,off+n-1)=w.rho;
+          if(sigma.n_elem)
+            sigma.cols(off,off+n-1)=w.sigma;
+          if(tau.n_elem)
+            tau.cols(off,off+n-1)=w.tau;
+          if(lapl.n_elem)
+            lapl.cols(off,off+n-1)=w.lapl;
+          off+=n;
+        }
+
+        init_xc();
+      }
 
-        // Free functional
-        xc_func_end(&func);
+      void DFTGridWorker::unpack_xc(const std::vector<DFTGridWorker *> & workers) const {
+        size_t off=0;
+        for(size_t i=0;i<workers.size();i++) {
+          DFTGridWorker & w(*workers[i]);
+          const size_t n(w.wtot.n_elem);
+          w.init_xc();
+          w.do_gga=do_gga;
+          w.do_mgga_t=do_mgga_t;
+          w.do_mgga_l=do_mgga_l;
+          if(!n)
+            continue;
+          w.exc=exc.subvec(off,off+n-1);
+          w.vxc=vxc.cols(off,off+n-1);
+          if(vsigma.n_elem)
+            w.vsigma=vsigma.cols(off,off+n-1);
+          if(vtau.n_elem)
+            w.vtau=vtau.cols(off,off+n-1);
+          if(vlapl.n_elem)
+            w.vlapl=vlapl.cols(off,off+n-1);
+          off+=n;
+        }
       }
 
       double DFTGridWorker::eval_Exc() const {
@@ -500,34 +846,47 @@ namespace helfem {
         return arma::sum(wtot%exc%dens);
       }
 
-      void DFTGridWorker::eval_overlap(arma::mat & So) const {
+      template<typename T> void DFTGridWorker::eval_overlap_t(arma::mat & So, const arma::Mat<T> & f) const {
         // Calculate in subspace
         arma::mat S(bf_ind.n_elem,bf_ind.n_elem);
         S.zeros();
-        increment_lda< std::complex<double> >(S,wtot,bf);
+        increment_lda<T>(S,wtot,f);
         // Increment
         So.submat(bf_ind,bf_ind)+=S;
       }
 
-      void DFTGridWorker::eval_kinetic(arma::mat & To) const {
+      void DFTGridWorker::eval_overlap(arma::mat & S) const {
+        if(real_bf)
+          eval_overlap_t<double>(S,rbf);
+        else
+          eval_overlap_t< std::complex<double> >(S,bf);
+      }
+
+      template<typename T> void DFTGridWorker::eval_kinetic_t(arma::mat & To, const arma::Mat<T> & f_rho, const arma::Mat<T> & f_theta, const arma::Mat<T> & f_phi) const {
         // Calculate in subspace
-        arma::mat T(bf_ind.n_elem,bf_ind.n_elem);
-        T.zeros();
-        increment_lda< std::complex<double> >(T,wtot/arma::square(scale_r),bf_rho);
-        increment_lda< std::complex<double> >(T,wtot/arma::square(scale_theta),bf_theta);
-        increment_lda< std::complex<double> >(T,wtot/arma::square(scale_phi),bf_phi);
+        arma::mat Tsub(bf_ind.n_elem,bf_ind.n_elem);
+        Tsub.zeros();
+        increment_lda<T>(Tsub,wtot/arma::square(scale_r),f_rho);
+        increment_lda<T>(Tsub,wtot/arma::square(scale_theta),f_theta);
+        increment_lda<T>(Tsub,wtot/arma::square(scale_phi),f_phi);
         // Increment
-        To.submat(bf_ind,bf_ind)+=0.5*T;
+        To.submat(bf_ind,bf_ind)+=0.5*Tsub;
       }
 
-      void DFTGridWorker::eval_Fxc(arma::mat & Ho) const {
+      void DFTGridWorker::eval_kinetic(arma::mat & To) const {
+        if(real_bf)
+          eval_kinetic_t<double>(To,rbf_rho,rbf_theta,rbf_phi);
+        else
+          eval_kinetic_t< std::complex<double> >(To,bf_rho,bf_theta,bf_phi);
+      }
+
+      template<typename T> void DFTGridWorker::eval_Fxc_t(arma::mat & H, const arma::Mat<T> & f, const arma::Mat<T> & f_rho, const arma::Mat<T> & f_theta, const arma::Mat<T> & f_phi, const arma::Mat<T> & f_lapl) const {
         if(polarized) {
           throw std::runtime_error("Refusing to compute restricted Fock matrix with unrestricted density.\n");
         }
 
-        // Work matrix
-        arma::mat H(bf_ind.n_elem,bf_ind.n_elem);
-        H.zeros();
+        // Block in the functions of the element
+        H.zeros(bf_ind.n_elem,bf_ind.n_elem);
 
         {
           // LDA potential
@@ -535,7 +894,10 @@ namespace helfem {
           // Multiply weights into potential
           vrho%=wtot;
           // Increment matrix
-          increment_lda< std::complex<double> >(H,vrho,bf);
+          if(sf_tables)
+            sf_increment_lda(H,vrho);
+          else
+            increment_lda<T>(H,vrho,f);
         }
 
         if(do_gga) {
@@ -551,7 +913,10 @@ namespace helfem {
             gr(i,2)*=2.0*wtot(i)*vs(i)/scale_phi(i);
           }
           // Increment matrix
-          increment_gga< std::complex<double> >(H,gr,bf,bf_rho,bf_theta,bf_phi);
+          if(sf_tables)
+            sf_increment_gga(H,gr);
+          else
+            increment_gga<T>(H,gr,f,f_rho,f_theta,f_phi);
         }
 
         if(do_mgga_t || do_mgga_l) {
@@ -562,27 +927,40 @@ namespace helfem {
             vtl += 2.0*vlapl.row(0);
           vtl %= wtot;
 
-          increment_lda< std::complex<double> >(H,vtl/arma::square(scale_r),bf_rho);
-          increment_lda< std::complex<double> >(H,vtl/arma::square(scale_theta),bf_theta);
-          increment_lda< std::complex<double> >(H,vtl/arma::square(scale_phi),bf_phi);
+          increment_lda<T>(H,vtl/arma::square(scale_r),f_rho);
+          increment_lda<T>(H,vtl/arma::square(scale_theta),f_theta);
+          increment_lda<T>(H,vtl/arma::square(scale_phi),f_phi);
         }
         if(do_mgga_l) {
           arma::rowvec vl(vlapl.row(0)%wtot);
-          increment_mgga_lapl< std::complex<double> >(H,vl,bf,bf_lapl);
+          increment_mgga_lapl<T>(H,vl,f,f_lapl);
         }
+      }
 
+      void DFTGridWorker::eval_Fxc_block(arma::mat & H) const {
+        if(real_bf)
+          eval_Fxc_t<double>(H,rbf,rbf_rho,rbf_theta,rbf_phi,rbf_lapl);
+        else
+          eval_Fxc_t< std::complex<double> >(H,bf,bf_rho,bf_theta,bf_phi,bf_lapl);
+      }
+
+      void DFTGridWorker::eval_Fxc(arma::mat & Ho) const {
+        arma::mat H;
+        eval_Fxc_block(H);
         Ho(bf_ind,bf_ind)+=H;
       }
 
-      void DFTGridWorker::eval_Fxc(arma::mat & Hao, arma::mat & Hbo, bool beta) const {
+      template<typename T> void DFTGridWorker::eval_Fxc_t(arma::mat & Ha, arma::mat & Hb, bool beta, const arma::Mat<T> & f, const arma::Mat<T> & f_rho, const arma::Mat<T> & f_theta, const arma::Mat<T> & f_phi, const arma::Mat<T> & f_lapl) const {
         if(!polarized) {
           throw std::runtime_error("Refusing to compute unrestricted Fock matrix with restricted density.\n");
         }
 
-        arma::mat Ha, Hb;
+        // Blocks in the functions of the element
         Ha.zeros(bf_ind.n_elem,bf_ind.n_elem);
         if(beta)
           Hb.zeros(bf_ind.n_elem,bf_ind.n_elem);
+        else
+          Hb.reset();
 
         {
           // LDA potential
@@ -590,12 +968,18 @@ namespace helfem {
           // Multiply weights into potential
           vrhoa%=wtot;
           // Increment matrix
-          increment_lda< std::complex<double> >(Ha,vrhoa,bf);
+          if(sf_tables)
+            sf_increment_lda(Ha,vrhoa);
+          else
+            increment_lda<T>(Ha,vrhoa,f);
 
           if(beta) {
             arma::rowvec vrhob(vxc.row(1));
             vrhob%=wtot;
-            increment_lda< std::complex<double> >(Hb,vrhob,bf);
+            if(sf_tables)
+              sf_increment_lda(Hb,vrhob);
+            else
+              increment_lda<T>(Hb,vrhob,f);
           }
         }
         if(Ha.has_nan() || (beta && Hb.has_nan()))
@@ -621,7 +1005,10 @@ namespace helfem {
             gr_a(i,2)=wtot(i)*(2.0*vs_aa(i)*gr_a0(i,2) + vs_ab(i)*gr_b0(i,2))/scale_phi(i);
           }
           // Increment matrix
-          increment_gga< std::complex<double> >(Ha,gr_a,bf,bf_rho,bf_theta,bf_phi);
+          if(sf_tables)
+            sf_increment_gga(Ha,gr_a);
+          else
+            increment_gga<T>(Ha,gr_a,f,f_rho,f_theta,f_phi);
 
           if(beta) {
             arma::rowvec vs_bb(vsigma.row(2));
@@ -631,7 +1018,10 @@ namespace helfem {
               gr_b(i,1)=wtot(i)*(2.0*vs_bb(i)*gr_b0(i,1) + vs_ab(i)*gr_a0(i,1))/scale_theta(i);
               gr_b(i,2)=wtot(i)*(2.0*vs_bb(i)*gr_b0(i,2) + vs_ab(i)*gr_a0(i,2))/scale_phi(i);
             }
-            increment_gga< std::complex<double> >(Hb,gr_b,bf,bf_rho,bf_theta,bf_phi);
+            if(sf_tables)
+              sf_increment_gga(Hb,gr_b);
+            else
+              increment_gga<T>(Hb,gr_b,f,f_rho,f_theta,f_phi);
           }
         }
 
@@ -644,9 +1034,9 @@ namespace helfem {
             vtl_a += 2.0*vlapl.row(0);
           vtl_a %= wtot;
 
-          increment_lda< std::complex<double> >(Ha,vtl_a/arma::square(scale_r),bf_rho);
-          increment_lda< std::complex<double> >(Ha,vtl_a/arma::square(scale_theta),bf_theta);
-          increment_lda< std::complex<double> >(Ha,vtl_a/arma::square(scale_phi),bf_phi);
+          increment_lda<T>(Ha,vtl_a/arma::square(scale_r),f_rho);
+          increment_lda<T>(Ha,vtl_a/arma::square(scale_theta),f_theta);
+          increment_lda<T>(Ha,vtl_a/arma::square(scale_phi),f_phi);
           if(beta) {
             arma::rowvec vtl_b(wtot.n_elem, arma::fill::zeros);
             if(do_mgga_t)
@@ -655,23 +1045,39 @@ namespace helfem {
               vtl_b += 2.0*vlapl.row(1);
             vtl_b %= wtot;
 
-            increment_lda< std::complex<double> >(Hb,vtl_b/arma::square(scale_r),bf_rho);
-            increment_lda< std::complex<double> >(Hb,vtl_b/arma::square(scale_theta),bf_theta);
-            increment_lda< std::complex<double> >(Hb,vtl_b/arma::square(scale_phi),bf_phi);
+            increment_lda<T>(Hb,vtl_b/arma::square(scale_r),f_rho);
+            increment_lda<T>(Hb,vtl_b/arma::square(scale_theta),f_theta);
+            increment_lda<T>(Hb,vtl_b/arma::square(scale_phi),f_phi);
           }
         }
         if(do_mgga_l) {
           arma::rowvec vl_a(vlapl.row(0)%wtot);
           arma::rowvec vl_b(vlapl.row(1)%wtot);
-          increment_mgga_lapl< std::complex<double> >(Ha,vl_a,bf,bf_lapl);
-          increment_mgga_lapl< std::complex<double> >(Hb,vl_b,bf,bf_lapl);
+          increment_mgga_lapl<T>(Ha,vl_a,f,f_lapl);
+          if(beta)
+            increment_mgga_lapl<T>(Hb,vl_b,f,f_lapl);
         }
+      }
+
+      void DFTGridWorker::eval_Fxc_block(arma::mat & Ha, arma::mat & Hb, bool beta) const {
+        if(real_bf)
+          eval_Fxc_t<double>(Ha,Hb,beta,rbf,rbf_rho,rbf_theta,rbf_phi,rbf_lapl);
+        else
+          eval_Fxc_t< std::complex<double> >(Ha,Hb,beta,bf,bf_rho,bf_theta,bf_phi,bf_lapl);
+      }
 
+      void DFTGridWorker::eval_Fxc(arma::mat & Hao, arma::mat & Hbo, bool beta) const {
+        arma::mat Ha, Hb;
+        eval_Fxc_block(Ha,Hb,beta);
         Hao(bf_ind,bf_ind)+=Ha;
         if(beta)
           Hbo(bf_ind,bf_ind)+=Hb;
       }
 
+      const arma::uvec & DFTGridWorker::get_bf_ind() const {
+        return bf_ind;
+      }
+
       void DFTGridWorker::check_grad_tau_lapl(int x_func, int c_func) {
         // Do we need gradients?
         do_grad=false;
@@ -693,6 +1099,16 @@ namespace helfem {
           do_lapl=do_lapl || laplacian_needed(x_func);
         if(c_func>0)
           do_lapl=do_lapl || laplacian_needed(c_func);
+
+        release_unused();
+      }
+
+      bool DFTGridWorker::is_real() const {
+        return real_bf;
+      }
+
+      void DFTGridWorker::set_sumfac(bool sumfac_) {
+        sumfac=sumfac_;
       }
 
       void DFTGridWorker::get_grad_tau_lapl(bool & grad_, bool & tau_, bool & lap_) const {
@@ -701,13 +1117,27 @@ namespace helfem {
         lap_=do_lapl;
       }
 
+      void DFTGridWorker::set_xcpool(XCFunctionalPool *pool) {
+        xcpool=pool;
+      }
+
       void DFTGridWorker::set_grad_tau_lapl(bool grad_, bool tau_, bool lap_) {
         do_grad=grad_;
         do_tau=tau_;
         do_lapl=lap_;
+        release_unused();
+      }
+
+      void DFTGridWorker::set_angular(int lang_, int mang_) {
+        if(lang_==lang && mang_==mang)
+          return;
+        lang=lang_;
+        mang=mang_;
+        helfem::angular::angular_chebyshev(lang,mang,cth,phi,wang);
       }
 
       void DFTGridWorker::compute_bf(size_t iel) {
+        profiler::Region prof("compute_bf");
         // Update function list
         bf_ind=basp->bf_list(iel);
 
@@ -742,12 +1172,45 @@ namespace helfem {
             wtot(idx)=wang(ia)*wrad(ir)*std::pow(r(ir),2);
           }
 
+        // Angular functions at all the angular points
+        arma::cx_mat sph, sph_th, sph_phi;
+        basp->eval_sph(cth, phi, sph, sph_th, sph_phi, do_grad);
+
+        // The sum-factorized kernel only needs the factors; tau and
+        // the laplacian still go through the full tables
+        sf_tables=(sumfac && !do_tau && !do_lapl);
+        if(sf_tables) {
+          basp->eval_radial(iel, sf_rad, sf_drad, do_grad);
+          if(sph.n_rows*sf_rad.n_cols != bf_ind.n_elem) {
+            std::ostringstream oss;
+            oss << "Mismatch! Have " << bf_ind.n_elem << " basis function indices but " << sph.n_rows*sf_rad.n_cols << " basis functions!\n";
+            throw std::logic_error(oss.str());
+          }
+          sf_y_re=arma::real(sph);
+          if(real_bf)
+            sf_y_im.reset();
+          else
+            sf_y_im=arma::imag(sph);
+          if(do_grad) {
+            sf_th_re=arma::real(sph_th);
+            sf_ph_re=arma::real(sph_phi);
+            if(real_bf) {
+              sf_th_im.reset();
+              sf_ph_im.reset();
+            } else {
+              sf_th_im=arma::imag(sph_th);
+              sf_ph_im=arma::imag(sph_phi);
+            }
+          }
+          return;
+        }
+
         // Compute basis function values
         bf.zeros(bf_ind.n_elem,wtot.n_elem);
         // Loop over angular grid
         for(size_t ia=0;ia<cth.n_elem;ia++) {
           // Evaluate basis functions at angular point
-          arma::cx_mat abf(basp->eval_bf(iel, cth(ia), phi(ia)));
+          arma::cx_mat abf(basp->eval_bf(iel, arma::cx_vec(sph.col(ia))));
           if(abf.n_cols != bf_ind.n_elem) {
             std::ostringstream oss;
             oss << "Mismatch! Have " << bf_ind.n_elem << " basis function indices but " << abf.n_cols << " basis functions!\n";
@@ -765,7 +1228,7 @@ namespace helfem {
 
           for(size_t ia=0;ia<cth.n_elem;ia++) {
             // Evaluate basis functions at angular point
-            basp->eval_df(iel, cth(ia), phi(ia), dr, dth, dphi);
+            basp->eval_df(iel, arma::cx_vec(sph.col(ia)), arma::cx_vec(sph_th.col(ia)), arma::cx_vec(sph_phi.col(ia)), dr, dth, dphi);
             if(dr.n_cols != bf_ind.n_elem) {
               std::ostringstream oss;
               oss << "Mismatch! Have " << bf_ind.n_elem << " basis function indices but " << dr.n_cols << " basis functions!\n";
@@ -783,7 +1246,7 @@ namespace helfem {
           // Loop over angular grid
           for(size_t ia=0;ia<cth.n_elem;ia++) {
             // Evaluate basis functions at angular point
-            arma::cx_mat alf(basp->eval_lf(iel, cth(ia), phi(ia)));
+            arma::cx_mat alf(basp->eval_lf(iel, arma::cx_vec(sph.col(ia))));
             if(alf.n_cols != bf_ind.n_elem) {
               std::ostringstream oss;
               oss << "Mismatch! Have " << bf_ind.n_elem << " basis function indices but " << alf.n_cols << " basis functions!\n";
@@ -793,138 +1256,572 @@ namespace helfem {
             bf_lapl.cols(ia*wrad.n_elem,(ia+1)*wrad.n_elem-1)=arma::trans(alf);
           }
         }
+
+        if(real_bf) {
+          // Switch to real-valued storage; the complex arrays are kept for the next element
+          rbf=arma::real(bf);
+          if(do_grad) {
+            rbf_rho=arma::real(bf_rho);
+            rbf_theta=arma::real(bf_theta);
+            rbf_phi=arma::real(bf_phi);
+          }
+          if(do_lapl)
+            rbf_lapl=arma::real(bf_lapl);
+        }
+      }
+
+      void DFTGridWorker::save_bf(bf_cache_t & c) const {
+        c.bf_ind=bf_ind;
+        c.wtot=wtot;
+        c.scale_r=scale_r;
+        c.scale_theta=scale_theta;
+        c.scale_phi=scale_phi;
+        if(real_bf) {
+          c.rbf=rbf;
+          if(do_grad) {
+            c.rbf_rho=rbf_rho;
+            c.rbf_theta=rbf_theta;
+            c.rbf_phi=rbf_phi;
+          }
+          if(do_lapl)
+            c.rbf_lapl=rbf_lapl;
+        } else {
+          c.bf=bf;
+          if(do_grad) {
+            c.bf_rho=bf_rho;
+            c.bf_theta=bf_theta;
+            c.bf_phi=bf_phi;
+          }
+          if(do_lapl)
+            c.bf_lapl=bf_lapl;
+        }
+        c.valid=true;
+      }
+
+      void DFTGridWorker::load_bf(const bf_cache_t & c) {
+        sf_tables=false;
+        bf_ind=c.bf_ind;
+        wtot=c.wtot;
+        scale_r=c.scale_r;
+        scale_theta=c.scale_theta;
+        scale_phi=c.scale_phi;
+        if(real_bf) {
+          rbf=c.rbf;
+          if(do_grad) {
+            rbf_rho=c.rbf_rho;
+            rbf_theta=c.rbf_theta;
+            rbf_phi=c.rbf_phi;
+          }
+          if(do_lapl)
+            rbf_lapl=c.rbf_lapl;
+        } else {
+          bf=c.bf;
+          if(do_grad) {
+            bf_rho=c.bf_rho;
+            bf_theta=c.bf_theta;
+            bf_phi=c.bf_phi;
+          }
+          if(do_lapl)
+            bf_lapl=c.bf_lapl;
+        }
       }
 
-      DFTGrid::DFTGrid() {
+      DFTGrid::DFTGrid() : adapt_tol(0.0), adapt_lmin(0), cache_budget(0), cache_grad(false), cache_lapl(false), screen(false), batch_points(4096), sumfac(false) {
       }
 
-      DFTGrid::DFTGrid(const helfem::atomic::basis::TwoDBasis * basp_, int lang_, int mang_) : basp(basp_), lang(lang_), mang(mang_) {
+      DFTGrid::DFTGrid(const helfem::atomic::basis::TwoDBasis * basp_, int lang_, int mang_) : basp(basp_), lang(lang_), mang(mang_), adapt_tol(0.0), adapt_lmin(0), cache_budget(0), cache_grad(false), cache_lapl(false), screen(false), batch_points(4096), sumfac(false) {
         arma::vec cth, phi, wang;
         helfem::angular::angular_chebyshev(lang,mang,cth,phi,wang);
+        nang=wang.n_elem;
         printf("DFT angular grid of order l=%i m=%i has %i points\n",lang,mang,(int) wang.n_elem);
       }
 
-      DFTGrid::~DFTGrid() {
+      void DFTGrid::set_cache(size_t budget) {
+        cache_budget=budget;
+        cache.clear();
+        cache_allowed.clear();
+        memory::set("DFT cache",0);
       }
 
-      void DFTGrid::eval_Fxc(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, const arma::mat & P, arma::mat & H, double & Exc, double & Nel, double & Ekin, double thr) {
-        H.zeros(P.n_rows,P.n_rows);
+      void DFTGrid::prepare_cache(const DFTGridWorker & grid) {
+        if(!cache_budget || sumfac)
+          return;
+
+        bool grad, tau, lapl;
+        grid.get_grad_tau_lapl(grad,tau,lapl);
+        if(cache.size()==basp->get_rad_Nel() && grad==cache_grad && lapl==cache_lapl)
+          return;
+
+        // (Re)initialize the cache
+        cache_grad=grad;
+        cache_lapl=lapl;
+        cache.assign(basp->get_rad_Nel(),bf_cache_t());
+        cache_allowed.assign(basp->get_rad_Nel(),false);
+        for(size_t iel=0;iel<cache.size();iel++)
+          cache[iel].valid=false;
+
+        // Number of stored arrays
+        size_t narr=1+(grad ? 3 : 0)+(lapl ? 1 : 0);
+        // Store elements until budget is exhausted; the rest are recomputed
+        size_t used=0;
+        size_t ncache=0;
+        for(size_t iel=0;iel<cache.size();iel++) {
+          size_t npts(basp->get_wrad(iel).n_elem*element_nang(iel));
+          size_t mem(narr*basp->bf_list(iel).n_elem*npts*(grid.is_real() ? sizeof(double) : sizeof(std::complex<double>)));
+          if(used+mem>cache_budget)
+            break;
+          used+=mem;
+          cache_allowed[iel]=true;
+          ncache++;
+        }
+        printf("DFT basis function cache holds %i of %i elements, using %.1f MB\n",(int) ncache,(int) cache.size(),used/(1024.0*1024.0));
+        memory::set("DFT cache",used);
+        fflush(stdout);
+      }
+
+      void DFTGrid::compute_bf(DFTGridWorker & grid, size_t iel) {
+        if(cache_budget && !sumfac && cache_allowed[iel]) {
+          if(cache[iel].valid) {
+            grid.load_bf(cache[iel]);
+          } else {
+            grid.compute_bf(iel);
+            grid.save_bf(cache[iel]);
+          }
+        } else {
+          grid.compute_bf(iel);
+        }
+      }
+
+      void DFTGrid::set_batch(size_t npts) {
+        batch_points=npts;
+      }
+
+      void DFTGrid::set_sumfac(bool sumfac_) {
+        sumfac=sumfac_;
+      }
+
+      void DFTGrid::set_adaptive(double tol, int lmin) {
+        adapt_tol=tol;
+        adapt_lmin=std::max(1,std::min(lmin,lang));
+        el_lang.clear();
+        el_nang.clear();
+      }
+
+      int DFTGrid::element_lang(size_t iel) const {
+        return el_lang.n_elem ? el_lang(iel) : lang;
+      }
+
+      size_t DFTGrid::element_nang(size_t iel) const {
+        return el_nang.n_elem ? el_nang(iel) : nang;
+      }
+
+      void DFTGrid::adapt_angular(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, const arma::mat & P, double thr) {
+        if(adapt_tol<=0.0 || el_lang.n_elem==basp->get_rad_Nel())
+          return;
+
+        el_lang.ones(basp->get_rad_Nel());
+        el_lang*=lang;
+        el_nang.ones(basp->get_rad_Nel());
+        el_nang*=nang;
+
+        // Trial rules between lmin and the full rule
+        const int ntrial=4;
+        int dl(std::max(1,(lang-adapt_lmin)/ntrial));
+        prepare_xcpools();
 
-        double exc=0.0;
-        double ekin=0.0;
-        double nel=0.0;
-        double lapl=0;
 #ifdef _OPENMP
-#pragma omp parallel reduction(+:exc,nel,lapl)
+#pragma omp parallel
 #endif
         {
           DFTGridWorker grid(basp,lang,mang);
           grid.check_grad_tau_lapl(x_func,c_func);
+          grid.set_sumfac(sumfac);
+          grid.set_xcpool(thread_xcpool());
 
 #ifdef _OPENMP
-#pragma omp for
+#pragma omp for schedule(dynamic)
 #endif
-          for(size_t iel=0;iel<basp->get_rad_Nel();iel+=2) {
+          for(size_t iel=0;iel<basp->get_rad_Nel();iel++) {
+            // Reference values with the full rule. The electron count
+            // is integrated exactly already by small rules, so the
+            // pruning is based on the functional instead
+            arma::mat Fref;
+            grid.set_angular(lang,mang);
             grid.compute_bf(iel);
             grid.update_density(P);
-            nel+=grid.compute_Nel();
-            ekin+=grid.compute_Ekin();
-            lapl+=grid.compute_laplsum();
-
             grid.init_xc();
             if(x_func>0)
-              grid.compute_xc(x_func, x_pars, thr);
+              grid.compute_xc(x_func,x_pars,thr);
             if(c_func>0)
-              grid.compute_xc(c_func, c_pars, thr);
+              grid.compute_xc(c_func,c_pars,thr);
+            double Eref(grid.eval_Exc());
+            grid.eval_Fxc_block(Fref);
+
+            // Use the smallest rule that reproduces both the energy and
+            // the Fock matrix block of the element
+            for(int l=adapt_lmin;l<lang;l+=dl) {
+              arma::mat F;
+              grid.set_angular(l,mang);
+              grid.compute_bf(iel);
+              grid.update_density(P);
+              grid.init_xc();
+              if(x_func>0)
+                grid.compute_xc(x_func,x_pars,thr);
+              if(c_func>0)
+                grid.compute_xc(c_func,c_pars,thr);
+              grid.eval_Fxc_block(F);
+              if(std::abs(grid.eval_Exc()-Eref)<adapt_tol && arma::abs(F-Fref).max()<adapt_tol) {
+                arma::vec cth, phi, wang;
+                helfem::angular::angular_chebyshev(l,mang,cth,phi,wang);
+                el_lang(iel)=l;
+                el_nang(iel)=wang.n_elem;
+                break;
+              }
+            }
+          }
+        }
+
+        // Grid has changed
+        cache.clear();
+        cache_allowed.clear();
+
+        size_t nfull(0), npruned(0);
+        for(size_t iel=0;iel<basp->get_rad_Nel();iel++) {
+          nfull+=basp->get_wrad(iel).n_elem*nang;
+          npruned+=basp->get_wrad(iel).n_elem*el_nang(iel);
+        }
+        printf("Angular pruning reduced the DFT grid from %i to %i points\n",(int) nfull,(int) npruned);
+        fflush(stdout);
+      }
+
+      void DFTGrid::set_screening(bool screen_) {
+        screen=screen_;
+        scr_rho.clear();
+        scr_grad.clear();
+        scr_pnorm.clear();
+      }
+
+      void DFTGrid::prepare_screening() {
+        if(!screen || scr_pnorm.n_elem==basp->get_rad_Nel())
+          return;
+        scr_rho.zeros(basp->get_rad_Nel());
+        scr_grad.zeros(basp->get_rad_Nel());
+        // Zero norm means no data are available
+        scr_pnorm.zeros(basp->get_rad_Nel());
+      }
+
+      double DFTGrid::density_norm(const arma::mat & P, size_t iel) const {
+        if(!screen)
+          return 0.0;
+        arma::uvec idx(basp->bf_list(iel));
+        return arma::abs(P(idx,idx)).max();
+      }
+
+      bool DFTGrid::skip_element(size_t iel, double pnorm, double thr) const {
+        if(!screen || scr_pnorm(iel)==0.0)
+          return false;
+        // Scale the old estimates by the change in the density matrix
+        double fac(pnorm/scr_pnorm(iel));
+        return fac*scr_rho(iel)<thr && fac*scr_grad(iel)<thr;
+      }
+
+      void DFTGrid::update_screening(size_t iel, const DFTGridWorker & grid, double pnorm) {
+        if(!screen)
+          return;
+        scr_rho(iel)=grid.max_density();
+        scr_grad(iel)=grid.max_gradient();
+        scr_pnorm(iel)=pnorm;
+      }
+
+      void DFTGrid::prepare_xcpools() {
+#ifdef _OPENMP
+        size_t nth(omp_get_max_threads());
+#else
+        size_t nth(1);
+#endif
+        while(xcpools.size()<nth)
+          xcpools.push_back(std::make_shared<XCFunctionalPool>());
+      }
+
+      XCFunctionalPool * DFTGrid::thread_xcpool() const {
+#ifdef _OPENMP
+        return xcpools[omp_get_thread_num()].get();
+#else
+        return xcpools[0].get();
+#endif
+      }
+
+      void DFTGrid::prepare_workers(size_t n, int x_func, int c_func) {
+#ifdef _OPENMP
+        size_t nth(omp_get_max_threads());
+#else
+        size_t nth(1);
+#endif
+        if(workers.size()<nth)
+          workers.resize(nth);
+
+        // Size of the largest element
+        size_t nbf=0, npts=0;
+        for(size_t iel=0;iel<basp->get_rad_Nel();iel++) {
+          nbf=std::max(nbf,(size_t) basp->bf_list(iel).n_elem);
+          npts=std::max(npts,(size_t) (basp->get_wrad(iel).n_elem*element_nang(iel)));
+        }
+
+        for(size_t ith=0;ith<workers.size();ith++) {
+          while(workers[ith].size()<n+1)
+            workers[ith].push_back(DFTGridWorker(basp,lang,mang));
+          for(size_t i=0;i<workers[ith].size();i++) {
+            workers[ith][i].set_sumfac(sumfac);
+            workers[ith][i].check_grad_tau_lapl(x_func,c_func);
+            // The packing worker holds the points of a whole batch and sizes itself
+            if(i+1<workers[ith].size())
+              workers[ith][i].reserve(nbf,npts);
+          }
+        }
+      }
+
+      std::vector<DFTGridWorker> & DFTGrid::thread_workers() {
+#ifdef _OPENMP
+        return workers[omp_get_thread_num()];
+#else
+        return workers[0];
+#endif
+      }
+
+      DFTGrid::~DFTGrid() {
+      }
+
+      arma::uvec DFTGrid::element_order() const {
+        // The cost is proportional to the number of grid points times
+        // the number of basis functions in the element
+        arma::vec cost(basp->get_rad_Nel());
+        for(size_t iel=0;iel<cost.n_elem;iel++)
+          cost(iel)=(double) basp->get_wrad(iel).n_elem*element_nang(iel)*basp->bf_list(iel).n_elem;
+        return arma::stable_sort_index(cost,"descend");
+      }
 
-            exc+=grid.eval_Exc();
-            grid.eval_Fxc(H);
+      std::vector<arma::uvec> DFTGrid::element_batches(const arma::uvec & order) const {
+        std::vector<arma::uvec> batches;
+        std::vector<arma::uword> batch;
+        size_t npts=0;
+        for(size_t io=0;io<order.n_elem;io++) {
+          const size_t iel(order(io));
+          batch.push_back(iel);
+          npts+=basp->get_wrad(iel).n_elem*element_nang(iel);
+          if(npts>=batch_points || io+1==order.n_elem) {
+            batches.push_back(arma::conv_to<arma::uvec>::from(batch));
+            batch.clear();
+            npts=0;
           }
+        }
+        return batches;
+      }
+
+      void DFTGrid::compute_xc(const std::vector<DFTGridWorker *> & grids, DFTGridWorker & packed, int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, double thr) const {
+        if(grids.size()==1) {
+          grids[0]->init_xc();
+          if(x_func>0)
+            grids[0]->compute_xc(x_func, x_pars, thr);
+          if(c_func>0)
+            grids[0]->compute_xc(c_func, c_pars, thr);
+          return;
+        }
+
+        // libxc has a sizable overhead per call, so the points of all
+        // the elements are handed to it at once
+        packed.pack_density(grids);
+        if(x_func>0)
+          packed.compute_xc(x_func, x_pars, thr);
+        if(c_func>0)
+          packed.compute_xc(c_func, c_pars, thr);
+        packed.unpack_xc(grids);
+      }
+
+      void DFTGrid::add_blocks(const std::vector<arma::mat> & blocks, const std::vector<arma::uvec> & ind, arma::mat & H) const {
+        // Adjacent elements share the boundary functions, so the even
+        // and the odd elements are added in separate passes
+        for(size_t ioff=0;ioff<2;ioff++) {
 #ifdef _OPENMP
-#pragma omp for
+#pragma omp parallel for schedule(dynamic,1)
 #endif
-          for(size_t iel=1;iel<basp->get_rad_Nel();iel+=2) {
-            grid.compute_bf(iel);
-            grid.update_density(P);
-            nel+=grid.compute_Nel();
-            ekin+=grid.compute_Ekin();
-            lapl+=grid.compute_laplsum();
+          for(size_t iel=ioff;iel<blocks.size();iel+=2)
+            if(blocks[iel].n_elem)
+              H(ind[iel],ind[iel])+=blocks[iel];
+        }
+      }
 
-            grid.init_xc();
-            if(x_func>0)
-              grid.compute_xc(x_func, x_pars, thr);
-            if(c_func>0)
-              grid.compute_xc(c_func, c_pars, thr);
+      void DFTGrid::eval_Fxc(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, const arma::mat & P, arma::mat & H, double & Exc, double & Nel, double & Ekin, double thr) {
+        profiler::Region prof("XC");
+        H.zeros(P.n_rows,P.n_rows);
+
+        double exc=0.0;
+        double ekin=0.0;
+        double nel=0.0;
+        double lapl=0;
+        size_t nscreen=0;
+        adapt_angular(x_func,x_pars,c_func,c_pars,P,thr);
+        prepare_screening();
+        prepare_xcpools();
+
+        // Every element writes its own block of the Fock matrix, so
+        // the elements can be processed in any order. They are
+        // grouped into batches for the functional evaluation
+        std::vector<arma::uvec> batches(element_batches(element_order()));
+        size_t maxbatch=0;
+        for(size_t ib=0;ib<batches.size();ib++)
+          maxbatch=std::max(maxbatch,(size_t) batches[ib].n_elem);
+        prepare_workers(maxbatch,x_func,c_func);
+        std::vector<arma::mat> Hel(basp->get_rad_Nel());
+        std::vector<arma::uvec> Hind(basp->get_rad_Nel());
+#ifdef _OPENMP
+#pragma omp parallel reduction(+:exc,nel,lapl,nscreen)
+#endif
+        {
+          // One worker for every element in the batch, and one for packing them
+          std::vector<DFTGridWorker> & grids(thread_workers());
+          for(size_t i=0;i<grids.size();i++)
+            grids[i].set_xcpool(thread_xcpool());
+#ifdef _OPENMP
+#pragma omp single
+#endif
+          prepare_cache(grids[0]);
 
-            exc+=grid.eval_Exc();
-            grid.eval_Fxc(H);
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic,1)
+#endif
+          for(size_t ib=0;ib<batches.size();ib++) {
+            std::vector<DFTGridWorker *> active;
+            std::vector<size_t> active_el;
+            for(size_t k=0;k<batches[ib].n_elem;k++) {
+              const size_t iel(batches[ib](k));
+              double pnorm(density_norm(P,iel));
+              if(skip_element(iel,pnorm,thr)) {
+                nscreen++;
+                continue;
+              }
+              DFTGridWorker & grid(grids[active.size()]);
+              grid.set_angular(element_lang(iel),mang);
+              compute_bf(grid,iel);
+              grid.update_density(P);
+              update_screening(iel,grid,pnorm);
+              nel+=grid.compute_Nel();
+              ekin+=grid.compute_Ekin();
+              lapl+=grid.compute_laplsum();
+              active.push_back(&grid);
+              active_el.push_back(iel);
+            }
+            if(!active.size())
+              continue;
+
+            compute_xc(active, grids.back(), x_func, x_pars, c_func, c_pars, thr);
+            for(size_t k=0;k<active.size();k++) {
+              exc+=active[k]->eval_Exc();
+              active[k]->eval_Fxc_block(Hel[active_el[k]]);
+              Hind[active_el[k]]=active[k]->get_bf_ind();
+            }
           }
         }
 
+        add_blocks(Hel,Hind,H);
+
         // Save outputs
         Exc=exc;
         Ekin=ekin;
         Nel=nel;
 
+        if(screen)
+          printf("%i of %i radial elements screened out\n",(int) nscreen,(int) basp->get_rad_Nel());
         printf("Integral over laplacian %e\n",lapl);
       }
 
       void DFTGrid::eval_Fxc(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, const arma::mat & Pa, const arma::mat & Pb, arma::mat & Ha, arma::mat & Hb, double & Exc, double & Nel, double & Ekin, bool beta, double thr) {
+        profiler::Region prof("XC");
         Ha.zeros(Pa.n_rows,Pa.n_rows);
         Hb.zeros(Pb.n_rows,Pb.n_rows);
 
         double exc=0.0;
         double nel=0.0;
         double ekin=0.0;
+        size_t nscreen=0;
+        // The rules are chosen once, from the total density
+        adapt_angular(x_func,x_pars,c_func,c_pars,Pa+Pb,thr);
+        prepare_screening();
+        arma::mat Ptot;
+        if(screen)
+          Ptot=Pa+Pb;
+        prepare_xcpools();
+
+        // Every element writes its own blocks of the Fock matrices, so
+        // the elements can be processed in any order. They are
+        // grouped into batches for the functional evaluation
+        std::vector<arma::uvec> batches(element_batches(element_order()));
+        size_t maxbatch=0;
+        for(size_t ib=0;ib<batches.size();ib++)
+          maxbatch=std::max(maxbatch,(size_t) batches[ib].n_elem);
+        prepare_workers(maxbatch,x_func,c_func);
+        std::vector<arma::mat> Hela(basp->get_rad_Nel()), Helb(basp->get_rad_Nel());
+        std::vector<arma::uvec> Hind(basp->get_rad_Nel());
 #ifdef _OPENMP
-#pragma omp parallel reduction(+:exc,nel)
+#pragma omp parallel reduction(+:exc,nel,nscreen)
 #endif
         {
-          DFTGridWorker grid(basp,lang,mang);
-          grid.check_grad_tau_lapl(x_func,c_func);
-
+          // One worker for every element in the batch, and one for packing them
+          std::vector<DFTGridWorker> & grids(thread_workers());
+          for(size_t i=0;i<grids.size();i++)
+            grids[i].set_xcpool(thread_xcpool());
 #ifdef _OPENMP
-#pragma omp for
+#pragma omp single
 #endif
-          for(size_t iel=0;iel<basp->get_rad_Nel();iel+=2) {
-            grid.compute_bf(iel);
-            grid.update_density(Pa,Pb);
-            nel+=grid.compute_Nel();
-            ekin+=grid.compute_Ekin();
+          prepare_cache(grids[0]);
 
-            grid.init_xc();
-            if(x_func>0)
-              grid.compute_xc(x_func, x_pars, thr);
-            if(c_func>0)
-              grid.compute_xc(c_func, c_pars, thr);
-
-            exc+=grid.eval_Exc();
-            grid.eval_Fxc(Ha,Hb,beta);
-          }
 #ifdef _OPENMP
-#pragma omp for
+#pragma omp for schedule(dynamic,1)
 #endif
-          for(size_t iel=1;iel<basp->get_rad_Nel();iel+=2) {
-            grid.compute_bf(iel);
-            grid.update_density(Pa,Pb);
-            nel+=grid.compute_Nel();
-            ekin+=grid.compute_Ekin();
-
-            grid.init_xc();
-            if(x_func>0)
-              grid.compute_xc(x_func, x_pars, thr);
-            if(c_func>0)
-              grid.compute_xc(c_func, c_pars, thr);
-
-            exc+=grid.eval_Exc();
-            grid.eval_Fxc(Ha,Hb,beta);
+          for(size_t ib=0;ib<batches.size();ib++) {
+            std::vector<DFTGridWorker *> active;
+            std::vector<size_t> active_el;
+            for(size_t k=0;k<batches[ib].n_elem;k++) {
+              const size_t iel(batches[ib](k));
+              double pnorm(density_norm(Ptot,iel));
+              if(skip_element(iel,pnorm,thr)) {
+                nscreen++;
+                continue;
+              }
+              DFTGridWorker & grid(grids[active.size()]);
+              grid.set_angular(element_lang(iel),mang);
+              compute_bf(grid,iel);
+              grid.update_density(Pa,Pb);
+              update_screening(iel,grid,pnorm);
+              nel+=grid.compute_Nel();
+              ekin+=grid.compute_Ekin();
+              active.push_back(&grid);
+              active_el.push_back(iel);
+            }
+            if(!active.size())
+              continue;
+
+            compute_xc(active, grids.back(), x_func, x_pars, c_func, c_pars, thr);
+            for(size_t k=0;k<active.size();k++) {
+              exc+=active[k]->eval_Exc();
+              active[k]->eval_Fxc_block(Hela[active_el[k]],Helb[active_el[k]],beta);
+              Hind[active_el[k]]=active[k]->get_bf_ind();
+            }
           }
         }
 
+        add_blocks(Hela,Hind,Ha);
+        if(beta)
+          add_blocks(Helb,Hind,Hb);
+
         // Save outputs
         Exc=exc;
         Ekin=ekin;
         Nel=nel;
+
+        if(screen) {
+          printf("%i of %i radial elements screened out\n",(int) nscreen,(int) basp->get_rad_Nel());
+          fflush(stdout);
+        }
       }
 
       arma::mat DFTGrid::eval_overlap() {
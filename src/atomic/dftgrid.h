@@ -18,17 +18,39 @@
 #define ATOMIC_DFTGRID_H
 
 #include "basis.h"
+#include <memory>
+#include "../general/dftfuncs.h"
 
 namespace helfem {
   namespace atomic {
     namespace dftgrid {
 
+      /// Basis function values in an element, stored across calls
+      typedef struct {
+        /// Is the entry filled in?
+        bool valid;
+        /// List of basis functions in element
+        arma::uvec bf_ind;
+        /// Total quadrature weight
+        arma::rowvec wtot;
+        /// Scale factors
+        arma::rowvec scale_r, scale_theta, scale_phi;
+        /// Function values, gradients and laplacians
+        arma::cx_mat bf, bf_rho, bf_theta, bf_phi, bf_lapl;
+        /// Same for real-valued functions
+        arma::mat rbf, rbf_rho, rbf_theta, rbf_phi, rbf_lapl;
+      } bf_cache_t;
+
       /// Worker class
       class DFTGridWorker {
       protected:
         /// Basis set
         const helfem::atomic::basis::TwoDBasis *basp;
+        /// Pool of libxc functionals, optional
+        XCFunctionalPool *xcpool;
 
+        /// Angular rule
+        int lang, mang;
         /// Angular grid
         arma::vec cth, phi, wang;
         /// Total quadrature weight
@@ -50,11 +72,25 @@ namespace helfem {
         /// Values of laplacians in grid points, (3*Nbf) * Ngrid
         arma::cx_mat bf_lapl;
 
-        /// Density helper matrices: P_{uv} chi_v, and P_{uv} nabla(chi_v)
-        arma::cx_mat Pv, Pv_rho, Pv_theta, Pv_phi;
-        /// Same for spin-polarized
-        arma::cx_mat Pav, Pav_rho, Pav_theta, Pav_phi;
-        arma::cx_mat Pbv, Pbv_rho, Pbv_theta, Pbv_phi;
+        /// Are the basis functions real? True when only m=0 is present
+        bool real_bf;
+        /// Real-valued versions of the above, used when real_bf is set
+        arma::mat rbf, rbf_rho, rbf_theta, rbf_phi, rbf_lapl;
+
+        /// Use the sum-factorized kernel when the functional allows it?
+        bool sumfac;
+        /// Does the current element use the sum-factorized tables instead of the ones above?
+        bool sf_tables;
+        /// Radial functions of the element and their derivatives at the radial quadrature points, Nr x Nrad
+        arma::mat sf_rad, sf_drad;
+        /// Real and imaginary parts of the angular functions and their theta and phi derivatives, Nang x Na; the imaginary parts are empty for real functions
+        arma::mat sf_y_re, sf_y_im, sf_th_re, sf_th_im, sf_ph_re, sf_ph_im;
+        /// Density and its gradient (in rows r, theta, phi) from the sum-factorized tables
+        void sf_density(const arma::mat & P, arma::rowvec & n, arma::mat & gn) const;
+        /// LDA-type increment from the sum-factorized tables
+        void sf_increment_lda(arma::mat & H, const arma::rowvec & vxc) const;
+        /// GGA-type increment from the sum-factorized tables
+        void sf_increment_gga(arma::mat & H, const arma::mat & gn) const;
 
         /// Is gradient needed?
         bool do_grad;
@@ -73,6 +109,19 @@ namespace helfem {
         /// Meta-GGA lapl used? (Set in compute_xc, only affects eval_Fxc)
         bool do_mgga_l;
 
+        /// Density matrices in the functions of the element
+        arma::mat Pel, Pael, Pbel;
+        /// Density matrices contracted with the basis functions and their derivatives
+        std::vector<arma::mat> rPv;
+        std::vector<arma::cx_mat> cPv;
+        /// Get the contraction work arrays of the given type
+        template<typename T> std::vector< arma::Mat<T> > & Pv_work();
+        /// Work arrays for a single functional in compute_xc
+        arma::rowvec exc_wrk;
+        arma::mat vxc_wrk, vsigma_wrk, vlapl_wrk, vtau_wrk;
+        /// Release the arrays of quantities the functional does not need
+        void release_unused();
+
         // LDA stuff:
 
         /// Density, Nrho x Npts
@@ -103,6 +152,19 @@ namespace helfem {
         /// Functional derivative of energy wrt kinetic energy density
         arma::mat vtau;
 
+        /// Update values of density, restricted calculation
+        template<typename T> void update_density_t(const arma::mat & P, const arma::Mat<T> & f, const arma::Mat<T> & f_rho, const arma::Mat<T> & f_theta, const arma::Mat<T> & f_phi, const arma::Mat<T> & f_lapl);
+        /// Update values of density, unrestricted calculation
+        template<typename T> void update_density_t(const arma::mat & Pa, const arma::mat & Pb, const arma::Mat<T> & f, const arma::Mat<T> & f_rho, const arma::Mat<T> & f_theta, const arma::Mat<T> & f_phi, const arma::Mat<T> & f_lapl);
+        /// Evaluate overlap matrix
+        template<typename T> void eval_overlap_t(arma::mat & S, const arma::Mat<T> & f) const;
+        /// Evaluate kinetic energy matrix
+        template<typename T> void eval_kinetic_t(arma::mat & To, const arma::Mat<T> & f_rho, const arma::Mat<T> & f_theta, const arma::Mat<T> & f_phi) const;
+        /// Evaluate the element block of the Fock matrix, restricted calculation
+        template<typename T> void eval_Fxc_t(arma::mat & H, const arma::Mat<T> & f, const arma::Mat<T> & f_rho, const arma::Mat<T> & f_theta, const arma::Mat<T> & f_phi, const arma::Mat<T> & f_lapl) const;
+        /// Evaluate the element blocks of the Fock matrices, unrestricted calculation
+        template<typename T> void eval_Fxc_t(arma::mat & Ha, arma::mat & Hb, bool beta, const arma::Mat<T> & f, const arma::Mat<T> & f_rho, const arma::Mat<T> & f_theta, const arma::Mat<T> & f_phi, const arma::Mat<T> & f_lapl) const;
+
       public:
         /// Dummy constructor
         DFTGridWorker();
@@ -117,11 +179,23 @@ namespace helfem {
         void get_grad_tau_lapl(bool & grad, bool & tau, bool & lapl) const;
         /// Set necessity of computing gradient and laplacians, necessary for compute_bf!
         void set_grad_tau_lapl(bool grad, bool tau, bool lapl);
+        /// Use the given libxc functional pool in compute_xc
+        void set_xcpool(XCFunctionalPool *pool);
+        /// Switch the angular rule, necessary for compute_bf!
+        void set_angular(int lang, int mang);
+        /// Are real-valued basis functions used?
+        bool is_real() const;
+        /// Evaluate LDA and GGA functionals from the radial and angular factors of the basis functions instead of their values on the grid, necessary for compute_bf!
+        void set_sumfac(bool sumfac);
 
         /// Compute basis functions on grid points
         void compute_bf(size_t iel);
-        /// Free memory
-        void free();
+        /// Store basis functions in cache
+        void save_bf(bf_cache_t & cache) const;
+        /// Get basis functions from cache
+        void load_bf(const bf_cache_t & cache);
+        /// Allocate the work arrays for elements with up to nbf functions and npts points
+        void reserve(size_t nbf, size_t npts);
 
         /// Update values of density, restricted calculation
         void update_density(const arma::mat & P);
@@ -134,6 +208,10 @@ namespace helfem {
         double compute_laplsum() const;
         /// Compute kinetic energy
         double compute_Ekin() const;
+        /// Maximum value of the total density on the grid
+        double max_density() const;
+        /// Maximum norm of the total density gradient on the grid
+        double max_gradient() const;
 
         /// Initialize XC arrays
         void init_xc();
@@ -147,6 +225,10 @@ namespace helfem {
         void zero_Exc();
         /// Numerical clean up of xc
         void check_xc();
+        /// Gather the density of the workers into a single grid, and initialize its XC arrays
+        void pack_density(const std::vector<DFTGridWorker *> & workers);
+        /// Hand the XC energy density and potential back to the workers the density was gathered from
+        void unpack_xc(const std::vector<DFTGridWorker *> & workers) const;
 
         /// Evaluate overlap matrix
         void eval_overlap(arma::mat & S) const;
@@ -157,6 +239,12 @@ namespace helfem {
         void eval_Fxc(arma::mat & H) const;
         /// Evaluate Fock matrix, unrestricted calculation
         void eval_Fxc(arma::mat & Ha, arma::mat & Hb, bool beta=true) const;
+        /// Evaluate the Fock matrix in the basis functions of the element, restricted calculation
+        void eval_Fxc_block(arma::mat & H) const;
+        /// Evaluate the Fock matrices in the basis functions of the element, unrestricted calculation
+        void eval_Fxc_block(arma::mat & Ha, arma::mat & Hb, bool beta=true) const;
+        /// Basis functions of the current element
+        const arma::uvec & get_bf_ind() const;
       };
 
       /// Wrapper routine
@@ -164,8 +252,73 @@ namespace helfem {
       private:
         /// Pointer to basis set
         const helfem::atomic::basis::TwoDBasis * basp;
+        /// libxc functional pools, one per thread
+        std::vector< std::shared_ptr<XCFunctionalPool> > xcpools;
+        /// Make sure there is a pool for every thread
+        void prepare_xcpools();
+        /// Get the pool of the calling thread
+        XCFunctionalPool * thread_xcpool() const;
+        /// Workers of each thread, kept between calls so that their work arrays are reused
+        std::vector< std::vector<DFTGridWorker> > workers;
+        /// Make sure every thread has n workers for the batches of the functional, plus one for packing them
+        void prepare_workers(size_t n, int x_func, int c_func);
+        /// Get the workers of the calling thread
+        std::vector<DFTGridWorker> & thread_workers();
         /// Angular rule
         int lang, mang;
+        /// Number of angular points
+        size_t nang;
+
+        /// Tolerance for adaptive angular pruning, zero to disable
+        double adapt_tol;
+        /// Smallest angular rule allowed in pruning
+        int adapt_lmin;
+        /// Theta rule and number of angular points in each radial element; empty before pruning
+        arma::ivec el_lang;
+        arma::uvec el_nang;
+        /// Choose the angular rule for each radial element from the convergence of its exchange-correlation energy and Fock matrix block
+        void adapt_angular(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, const arma::mat & P, double thr);
+        /// Number of angular points in element
+        size_t element_nang(size_t iel) const;
+
+        /// Memory budget for the basis function cache in bytes
+        size_t cache_budget;
+        /// Cached basis function values
+        std::vector<bf_cache_t> cache;
+        /// Which elements may be cached
+        std::vector<bool> cache_allowed;
+        /// Gradients and laplacians stored in cache
+        bool cache_grad, cache_lapl;
+        /// Prepare cache for the given functional
+        void prepare_cache(const DFTGridWorker & grid);
+        /// Compute basis functions, or get them from the cache
+        void compute_bf(DFTGridWorker & grid, size_t iel);
+
+        /// Screen elements based on the density of the previous evaluation?
+        bool screen;
+        /// Maximum density, density gradient and density matrix element in each element at the last evaluation
+        arma::vec scr_rho, scr_grad, scr_pnorm;
+        /// Initialize screening data
+        void prepare_screening();
+        /// Maximum density matrix element in the element
+        double density_norm(const arma::mat & P, size_t iel) const;
+        /// Can the element be skipped?
+        bool skip_element(size_t iel, double pnorm, double thr) const;
+        /// Store screening data for element
+        void update_screening(size_t iel, const DFTGridWorker & grid, double pnorm);
+
+        /// Order in which the elements are processed, most expensive first
+        arma::uvec element_order() const;
+        /// Target number of grid points in a libxc call
+        size_t batch_points;
+        /// Use the sum-factorized kernel?
+        bool sumfac;
+        /// Group the elements into batches of about batch_points points, in the given order
+        std::vector<arma::uvec> element_batches(const arma::uvec & order) const;
+        /// Initialize the XC arrays of the workers and evaluate the functionals, in a single libxc call per functional on the packed worker
+        void compute_xc(const std::vector<DFTGridWorker *> & grids, DFTGridWorker & packed, int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, double thr) const;
+        /// Add the element blocks into the full matrix
+        void add_blocks(const std::vector<arma::mat> & blocks, const std::vector<arma::uvec> & ind, arma::mat & H) const;
 
       public:
         /// Dummy constructor
@@ -180,6 +333,19 @@ namespace helfem {
         /// Compute Fock matrix, exchange-correlation energy and integrated electron density, unrestricted case
         void eval_Fxc(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, const arma::mat & Pa, const arma::mat & Pb, arma::mat & Ha, arma::mat & Hb, double & Exc, double & Nel, double & Ekin, bool beta, double thr);
 
+        /// Keep basis function values in memory across calls, up to the given number of bytes
+        void set_cache(size_t budget);
+        /// Skip elements whose density was below the threshold in the previous call
+        void set_screening(bool screen);
+        /// Prune the theta rule per radial element, down to lmin, as long as the element's exchange-correlation energy and Fock matrix elements change less than tol
+        void set_adaptive(double tol, int lmin);
+        /// Theta rule used in element
+        int element_lang(size_t iel) const;
+        /// Evaluate the functionals on batches of elements with about npts grid points; 0 for one element at a time
+        void set_batch(size_t npts);
+        /// Contract the density and the potential separately over the radial and the angular factors of the basis functions, for LDA and GGA functionals; the basis function cache is not used
+        void set_sumfac(bool sumfac);
+
         /// Evaluate overlap
         arma::mat eval_overlap();
         /// Evaluate kinetic energy matrix
@@ -207,6 +373,17 @@ namespace helfem {
         H+=arma::real(fhlp*arma::trans(f));
       }
 
+      /**
+       * Complex basis functions: since the weights are real, the real
+       * part of f W f^H is Re(f) W Re(f)^T + Im(f) W Im(f)^T. Splitting
+       * the table takes two real matrix products instead of the four
+       * hidden in a complex one, half of which would be thrown away.
+       */
+      template<> inline void increment_lda< std::complex<double> >(arma::mat & H, const arma::rowvec & vxc, const arma::cx_mat & f) {
+        increment_lda<double>(H,vxc,arma::mat(arma::real(f)));
+        increment_lda<double>(H,vxc,arma::mat(arma::imag(f)));
+      }
+
       /// BLAS routine for GGA-type quadrature
       template<typename T> void increment_gga(arma::mat & H, const arma::mat & gn, const arma::Mat<T> & f, arma::Mat<T> f_x, arma::Mat<T> f_y, arma::Mat<T> f_z) {
         if(gn.n_cols!=3) {
@@ -253,6 +430,12 @@ namespace helfem {
         H+=arma::real(gamma*arma::trans(f) + f*arma::trans(gamma));
       }
 
+      /// Complex basis functions: split into real and imaginary parts as in increment_lda
+      template<> inline void increment_gga< std::complex<double> >(arma::mat & H, const arma::mat & gn, const arma::cx_mat & f, arma::cx_mat f_x, arma::cx_mat f_y, arma::cx_mat f_z) {
+        increment_gga<double>(H,gn,arma::mat(arma::real(f)),arma::real(f_x),arma::real(f_y),arma::real(f_z));
+        increment_gga<double>(H,gn,arma::mat(arma::imag(f)),arma::imag(f_x),arma::imag(f_y),arma::imag(f_z));
+      }
+
       /// BLAS routine for meta-GGA-type quadrature
       template<typename T> void increment_mgga_lapl(arma::mat & H, const arma::rowvec & vlapl, const arma::Mat<T> & f, const arma::Mat<T> & l) {
         if(f.n_cols != vlapl.n_elem) {
@@ -278,6 +461,12 @@ namespace helfem {
             fhlp(i,j)*=vlapl(j);
         H+=arma::real(fhlp*arma::trans(l)+l*arma::trans(fhlp));
       }
+
+      /// Complex basis functions: split into real and imaginary parts as in increment_lda
+      template<> inline void increment_mgga_lapl< std::complex<double> >(arma::mat & H, const arma::rowvec & vlapl, const arma::cx_mat & f, const arma::cx_mat & l) {
+        increment_mgga_lapl<double>(H,vlapl,arma::mat(arma::real(f)),arma::mat(arma::real(l)));
+        increment_mgga_lapl<double>(H,vlapl,arma::mat(arma::imag(f)),arma::mat(arma::imag(l)));
+      }
     }
   }
 }
@@ -0,0 +1,103 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#include "../general/dftfuncs.h"
+#include "../general/model_potential.h"
+#include "../general/scf_helpers.h"
+#include "basis.h"
+#include "dftgrid.h"
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+using namespace helfem;
+
+/**
+ * Test of the adaptive angular pruning of the DFT grid. An oxygen
+ * atom with the 2p electrons in the m=0 orbital has a non-spherical
+ * density, whose electron count is integrated exactly already by
+ * the smallest angular rules. The exchange-correlation energy is
+ * not, and especially the GGA needs a larger rule in the element
+ * at the nucleus, where the gradient of the density is large.
+ */
+
+/// Angular rules chosen by the pruning for the functional
+static arma::ivec pruned_rules(const atomic::basis::TwoDBasis & basis, const arma::mat & P, const std::string & xc, int ldft, int mdft, int lmin, double tol) {
+  int x_func, c_func;
+  ::parse_xc_func(x_func, c_func, xc);
+
+  atomic::dftgrid::DFTGrid grid(&basis,ldft,mdft);
+  grid.set_adaptive(tol,lmin);
+
+  arma::mat H;
+  double Exc, Nel, Ekin;
+  grid.eval_Fxc(x_func, arma::vec(), c_func, arma::vec(), P, H, Exc, Nel, Ekin, 1e-12);
+  printf("%s: Exc = % .12f, Nel = %.12f\n",xc.c_str(),Exc,Nel);
+
+  arma::ivec rules(basis.get_rad_Nel());
+  for(size_t iel=0;iel<rules.n_elem;iel++)
+    rules(iel)=grid.element_lang(iel);
+  return rules;
+}
+
+int main(int argc, char **argv) {
+  if(argc!=1 && argc!=2) {
+    printf("Usage: %s (tol)\n",argv[0]);
+    return 1;
+  }
+  double tol(argc==2 ? atof(argv[1]) : 1e-8);
+
+  const int Z=8;
+  const int lmax=1;
+  auto poly(std::shared_ptr<const polynomial_basis::PolynomialBasis>(polynomial_basis::get_basis(4,15)));
+  arma::vec bval(atomic::basis::normal_grid(10,40.0,4,2.0));
+  arma::ivec lval, mval;
+  atomic::basis::angular_basis(lmax,0,lval,mval);
+  atomic::basis::TwoDBasis basis(Z, modelpotential::POINT_NUCLEUS, 0.0, poly, false, 5*poly->get_nbf(), bval, poly->get_nprim()-1, lval, mval, 0, 0, 0.0);
+
+  // Doubly occupied 1s, 2s and 2p0 orbitals of the bare nucleus
+  arma::mat S(basis.overlap());
+  arma::mat Hcore(basis.kinetic()+basis.nuclear());
+  arma::mat P(arma::zeros<arma::mat>(basis.Nbf(),basis.Nbf()));
+  for(int l=0;l<=lmax;l++) {
+    arma::uvec idx(basis.lm_indices(l,0));
+    arma::vec El;
+    arma::mat Cl;
+    scf::eig_gsym(El,Cl,Hcore(idx,idx),scf::form_Sinvh(S(idx,idx)));
+    int nocc(l==0 ? 2 : 1);
+    arma::mat C(arma::zeros<arma::mat>(basis.Nbf(),nocc));
+    C.rows(idx)=Cl.cols(0,nocc-1);
+    P+=2.0*C*C.t();
+  }
+
+  // Default rules of the atomic program
+  const int ldft=4*lmax+10;
+  const int mdft=5;
+  const int lmin=2*lmax;
+
+  arma::ivec lda(pruned_rules(basis,P,"lda_x-lda_c_pw",ldft,mdft,lmin,tol));
+  arma::ivec gga(pruned_rules(basis,P,"gga_x_pbe-gga_c_pbe",ldft,mdft,lmin,tol));
+
+  printf("%4s %6s %6s\n","iel","LDA","GGA");
+  for(size_t iel=0;iel<lda.n_elem;iel++)
+    printf("%4i %6i %6i\n",(int) iel,(int) lda(iel),(int) gga(iel));
+
+  if(gga(0)<=lmin) {
+    printf("The GGA was integrated with the smallest rule l=%i in the element at the nucleus!\n",lmin);
+    return 1;
+  }
+  printf("The GGA needs l=%i in the element at the nucleus.\n",(int) gga(0));
+  return 0;
+}
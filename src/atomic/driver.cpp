@@ -0,0 +1,2137 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#include "driver.h"
+#include "../general/checkpoint.h"
+#include "../general/constants.h"
+#include "../general/diis.h"
+#include "../general/dftfuncs.h"
+#include "../general/elements.h"
+#include "../general/timer.h"
+#include "../general/profiler.h"
+#include "../general/resume.h"
+#include "../general/telemetry.h"
+#include "../general/memtrack.h"
+#include "../general/scf_helpers.h"
+#include "../general/soscf.h"
+#include "../general/threads.h"
+#include "utils.h"
+#include <cfloat>
+#include <climits>
+#include <cstdio>
+#include <sstream>
+
+namespace helfem {
+  namespace atomic {
+    /// Print out the angular character of the orbitals
+
+    static void classify_orbitals(const arma::mat & C, const arma::ivec & lvals, const arma::ivec & mvals, const std::vector<arma::uvec> & lmidx) {
+      for(size_t io=0;io<C.n_cols;io++) {
+        arma::vec orb(C.col(io));
+
+        arma::vec ochar(mvals.n_elem);
+        for(size_t c=0;c<mvals.n_elem;c++) {
+          ochar(c)=arma::norm(orb(lmidx[c]),"fro");
+        }
+        ochar/=arma::sum(ochar);
+
+        // Orbital symmetry is then
+        arma::uword oidx;
+        ochar.max(oidx);
+
+        // Classification
+        std::ostringstream cl;
+
+        printf("Orbital %2i: l=%1i m=%+1i %6.2f %%\n",(int) (io+1),(int) lvals(oidx),(int) mvals(oidx),100.0*ochar(oidx));
+      }
+    }
+
+    /// Scale the matrix elements by the basis function norms
+    static void normalize_matrix(arma::mat & M, const arma::vec & norm) {
+      if(M.n_rows != norm.n_elem) throw std::logic_error("Incompatible dimensions!\n");
+      if(M.n_cols != norm.n_elem) throw std::logic_error("Incompatible dimensions!\n");
+      for(size_t i=0;i<M.n_rows;i++)
+        for(size_t j=0;j<M.n_cols;j++)
+          M(i,j)*=norm(i)*norm(j);
+    }
+
+    void Driver::add_options(cmdline::parser & parser) {
+      // full option name, no short option, description, argument required
+      parser.add<std::string>("Z", 0, "nuclear charge", true);
+      parser.add<std::string>("Zl", 0, "left-hand nuclear charge", false, "");
+      parser.add<std::string>("Zr", 0, "right-hand nuclear charge", false, "");
+      parser.add<double>("Rmid", 0, "distance of nuclei from center", false, 0.0);
+      parser.add<bool>("angstrom", 0, "input distances in angstrom", false, false);
+      parser.add<int>("nela", 0, "number of alpha electrons", false, 0);
+      parser.add<int>("nelb", 0, "number of beta  electrons", false, 0);
+      parser.add<int>("Q", 0, "charge state", false, 0);
+      parser.add<int>("M", 0, "spin multiplicity", false, 0);
+      parser.add<int>("lmax", 0, "maximum l quantum number", true);
+      parser.add<int>("mmax", 0, "maximum m quantum number", true);
+      parser.add<double>("Rmax", 0, "practical infinity in au", false, 40.0);
+      parser.add<int>("grid", 0, "type of grid: 1 for linear, 2 for quadratic, 3 for polynomial, 4 for exponential", false, 4);
+      parser.add<int>("grid0", 0, "type of grid: 1 for linear, 2 for quadratic, 3 for polynomial, 4 for exponential", false, 4);
+      parser.add<double>("zexp", 0, "parameter in radial grid", false, 2.0);
+      parser.add<double>("zexp0", 0, "parameter in radial grid", false, 2.0);
+      parser.add<int>("nelem", 0, "number of elements", true);
+      parser.add<int>("nelem0", 0, "number of elements between center and off-center nuclei", false, 0);
+      parser.add<int>("nnodes", 0, "number of nodes per element", false, 15);
+      parser.add<int>("nnodes_outer", 0, "number of nodes in the elements beyond Router; 0 to use nnodes everywhere", false, 0);
+      parser.add<double>("Router", 0, "radius in bohr from which on the elements use nnodes_outer nodes", false, 0.0);
+      parser.add<int>("nquad", 0, "number of quadrature points", false, 0);
+      parser.add<int>("maxit", 0, "maximum number of iterations", false, 50);
+      parser.add<int>("incfock", 0, "build Coulomb and exchange from the density change, with a full rebuild every n iterations; 0 to disable", false, 0);
+      parser.add<double>("incthr", 0, "density block screening threshold in incremental Fock builds", false, 1e-10);
+      parser.add<double>("rsthr", 0, "screening and low-rank truncation threshold for range-separated element pair integrals", false, 1e-12);
+      parser.add<double>("convthr", 0, "convergence threshold", false, 1e-7);
+      parser.add<double>("Ez", 0, "electric dipole field", false, 0.0);
+      parser.add<double>("Qzz", 0, "electric quadrupole field", false, 0.0);
+      parser.add<double>("Bz", 0, "magnetic dipole field", false, 0.0);
+      parser.add<bool>("diag", 0, "exact diagonalization", false, 1);
+      parser.add<std::string>("method", 0, "method to use", false, "HF");
+      parser.add<int>("ldft", 0, "theta rule for dft quadrature (0 for auto)", false, 0);
+      parser.add<int>("mdft", 0, "phi rule for dft quadrature (0 for auto)", false, 0);
+      parser.add<double>("dftthr", 0, "density threshold for dft", false, 1e-12);
+      parser.add<double>("dftadapt", 0, "tolerance for the exchange-correlation energy and Fock matrix elements per radial element in adaptive angular pruning (0 to disable)", false, 0.0);
+      parser.add<bool>("dftscreen", 0, "skip radial elements whose density was below dftthr on the previous iteration", false, false);
+      parser.add<int>("dftbatch", 0, "number of grid points to evaluate the functional on in a single libxc call (0 for one radial element at a time)", false, 4096);
+      parser.add<bool>("dftsumfac", 0, "evaluate LDA and GGA functionals with sum factorization over the radial and angular parts of the basis functions", false, false);
+      parser.add<bool>("verbose", 0, "print additional timing and load balance information", false, false);
+      parser.add<double>("dftcache", 0, "memory in MB for storing dft basis function values between iterations", false, 0.0);
+      parser.add<int>("restricted", 0, "spin-restricted orbitals", false, -1);
+      parser.add<int>("symmetry", 0, "force orbital symmetry", false, 1);
+      parser.add<bool>("blockdiis", 0, "store the DIIS history in the orbital symmetry blocks", false, false);
+      parser.add<bool>("diissingle", 0, "store the DIIS history in single precision", false, false);
+      parser.add<double>("mixedthr", 0, "DIIS error below which the Coulomb and exchange builds switch from single- to double-precision integrals; 0 for double precision throughout", false, 0.0);
+      parser.add<int>("davidson", 0, "solve the orbitals with the Davidson method including n virtual orbitals; negative for full diagonalization", false, -1);
+      parser.add<double>("davidsonthr", 0, "residual threshold for the Davidson method", false, 1e-7);
+      parser.add<int>("primbas", 0, "primitive radial basis", false, 4);
+      parser.add<double>("diiseps", 0, "when to start mixing in diis", false, 1e-2);
+      parser.add<double>("diisthr", 0, "when to switch over fully to diis", false, 1e-3);
+      parser.add<int>("diisorder", 0, "length of diis history", false, 5);
+      parser.add<int>("soscf", 0, "switch to the second-order solver when the DIIS error has not improved in n iterations; 0 to disable", false, 0);
+      parser.add<int>("readocc", 0, "read occupations from file, use until nth build", false, 0);
+      parser.add<std::string>("occfile", 0, "file to read the occupations from", false, "occs.dat");
+      parser.add<int>("hadapt", 0, "number of rounds of radial grid refinement: the calculation is repeated on grids where the elements with the largest error indicators are split", false, 0);
+      parser.add<double>("hadapt_frac", 0, "split the elements whose error indicator exceeds this fraction of the largest one", false, 0.5);
+      parser.add<double>("hadapt_tol", 0, "stop refining the grid once all the element error indicators are below this", false, 0.0);
+      parser.add<int>("mlevels", 0, "number of levels in coarse-to-fine SCF: the calculation is first converged on coarser grids, each halving the number of elements and dropping mlnodes nodes, and the orbitals are projected onto the next finer one", false, 1);
+      parser.add<int>("mlnodes", 0, "number of nodes dropped per coarser level", false, 4);
+      parser.add<double>("mlconvthr", 0, "convergence threshold on the coarse levels", false, 1e-5);
+      parser.add<std::string>("occscan", 0, "comma separated list of occupation files to run calculations with after the ground state, each starting from the ground state orbitals, all collected in the save checkpoint", false, "");
+      parser.add<double>("perturb", 0, "randomly perturb initial guess", false, 0.0);
+      parser.add<int>("seed", 0, "seed for random perturbation", false, 0);
+      parser.add<int>("iguess", 0, "guess: 0 for core, 1 for GSZ, 2 for SAP, 3 for TF", false, 2);
+      parser.add<int>("finitenuc", 0, "finite nuclear model", false, 0);
+      parser.add<double>("Rrms", 0, "finite nuclear rms radius", false, 0.0);
+      parser.add<std::string>("load", 0, "load guess from checkpoint", false, "");
+      parser.add<bool>("polarizability", 0, "compute the static dipole polarizability from the coupled-perturbed equations", false, false);
+      parser.add<double>("respthr", 0, "residual threshold for the response equations", false, 1e-7);
+      parser.add<int>("tdsteps", 0, "number of real-time propagation steps after the SCF; 0 to disable", false, 0);
+      parser.add<double>("tddt", 0, "time step of the real-time propagation", false, 0.05);
+      parser.add<double>("tdfield", 0, "amplitude of the time-dependent electric field along z", false, 0.0);
+      parser.add<double>("tdomega", 0, "frequency of the time-dependent field; 0 for a static field switched on at t=0", false, 0.057);
+      parser.add<double>("tdcycles", 0, "number of cycles in the sin^2 envelope of the field; 0 for a continuous wave", false, 0.0);
+      parser.add<double>("tdcap", 0, "strength of the absorbing potential -i tdcap (r-R0)^2", false, 0.0);
+      parser.add<double>("tdcapr", 0, "onset R0 of the absorbing potential; 0 for 0.8 Rmax", false, 0.0);
+      parser.add<int>("tdkrylov", 0, "maximal Krylov subspace dimension of the propagator", false, 16);
+      parser.add<bool>("tdcorrector", 0, "correct the extrapolated midpoint Fock matrix with a second build in every step", false, false);
+      parser.add<std::string>("tdfile", 0, "file to write the time, field, dipole moment and number of electrons into", false, "td.dat");
+      parser.add<std::string>("fieldscan", 0, "comma separated list of field values to run calculations at, all collected in the save checkpoint", false, "");
+      parser.add<std::string>("scanfield", 0, "field to scan: Ez, Qzz or Bz", false, "Ez");
+      parser.add<std::string>("save", 0, "save calculation to checkpoint, empty for none", false, "helfem.chk");
+      parser.add<std::string>("teicache", 0, "cache file for two-electron integrals", false, "");
+      parser.add<double>("mem_budget", 0, "memory budget for primitive two-electron integrals in GiB, 0 for unlimited", false, 0.0);
+      parser.add<double>("memory", 0, "total memory budget in GiB used to plan the TEI storage, DIIS history length and DFT cache; 0 to use the individual settings", false, 0.0);
+      parser.add<std::string>("scratch", 0, "scratch directory for out-of-core two-electron integrals", false, "");
+      parser.add<bool>("direct", 0, "recompute primitive two-electron integrals whenever they are needed", false, false);
+      parser.add<int>("tei_cache", 0, "number of recomputed elements of two-electron integrals to keep in memory", false, 0);
+      parser.add<int>("numa", 0, "number of NUMA domains over which the in-core two-electron integrals are distributed; 0 for none", false, 0);
+      parser.add<int>("threads_outer", 0, "number of OpenMP threads in the parallel kernels; 0 for the OpenMP default", false, 0);
+      parser.add<int>("threads_blas", 0, "number of BLAS threads in the serial phases, BLAS runs on one thread inside the parallel kernels; 0 for the BLAS default", false, 0);
+      parser.add<std::string>("coulomb", 0, "Coulomb engine: tei for the primitive two-electron integrals, poisson for solving the radial Poisson equation, in which case the integrals are only formed for exact exchange", false, "tei");
+      parser.add<int>("chkpt_every", 0, "write SCF checkpoint every n iterations", false, 1);
+      parser.add<bool>("chkpt_minimal", 0, "only checkpoint the data needed for a restart", false, false);
+      parser.add<int>("chkpt_virtuals", 0, "number of virtual orbitals checkpointed on top of the occupied ones during the SCF, negative for all", false, -1);
+      parser.add<int>("chkpt_virtuals_final", 0, "number of virtual orbitals checkpointed on top of the occupied ones on convergence, negative for all", false, -1);
+      parser.add<std::string>("chkpt_final", 0, "comma separated list of SCF entries that are only checkpointed on convergence from P, Pa, Pb, J, Ka, Kb, XCa, XCb, Fa, Fb, Ca, Cb, Ea and Eb, or all", false, "");
+      parser.add<std::string>("resume", 0, "file for the resumable SCF snapshot; an existing snapshot is resumed from, and it is removed once the SCF loop ends", false, "");
+      parser.add<int>("resume_every", 0, "write the resumable SCF snapshot every n iterations", false, 1);
+      parser.add<std::string>("chkpt_codec", 0, "compression of checkpoint entries as a comma separated list of category=codec, with categories basis, scf and other and codecs none, deflate[:level] and zstd[:level] optionally prefixed by shuffle+", false, "");
+      parser.add<std::string>("chkpt_matrices", 0, "comma separated list of one-electron matrices to store in the checkpoint from S, T, Vnuc, Sinvh, Sh, dip, quad, Vel, Vmag and H0, or all", false, "");
+      parser.add<bool>("chkpt_inplace", 0, "overwrite checkpoint entries of unchanged shape in place, so that the file does not grow over the iterations", false, true);
+      parser.add<bool>("chkpt_skip", 0, "do not store the overlap, kinetic and nuclear attraction matrices in the checkpoint, they are recomputed from the basis set when read", false, false);
+      parser.add<std::string>("x_pars", 0, "file for parameters for exchange functional", false, "");
+      parser.add<std::string>("c_pars", 0, "file for parameters for correlation functional", false, "");
+      parser.add<bool>("maverage", 0, "average Fock matrix over m values", false, false);
+      parser.add<double>("dampfock", 0, "damping factor for off-diagonal elents", false, 0.7);
+      parser.add<double>("dampthr", 0, "damping threshold", false, 0.1);
+      parser.add<bool>("zeroder", 0, "zero derivative at Rmax?", false, false);
+      parser.add<int>("taylor_order", 0, "order of Taylor expansion near the nucleus", false, -1);
+      parser.add<bool>("server", 0, "after the first job, read further jobs from stdin, one per line in command line syntax, reusing the basis set and integrals", false, false);
+      parser.add<std::string>("profile", 0, "write a profile of the run in the given file, CSV if it ends in .csv and JSON otherwise", false, "");
+      parser.add<std::string>("telemetry", 0, "append a JSON record of every SCF iteration to the given file", false, "");
+    }
+
+    /// Options that define the basis set and integrals
+    static const char * fixed_options[] = {"Z", "Zl", "Zr", "Rmid", "angstrom", "lmax", "mmax", "Rmax", "grid", "grid0", "zexp", "zexp0", "nelem", "nelem0", "nnodes", "nnodes_outer", "Router", "nquad", "primbas", "finitenuc", "Rrms", "zeroder", "taylor_order", "diag", "symmetry", "ldft", "mdft", "dftcache", "rsthr", "teicache", "mem_budget", "memory", "scratch", "direct", "tei_cache", "numa", "threads_outer", "threads_blas", "coulomb", "hadapt", "hadapt_frac", "hadapt_tol", "mlevels", "mlnodes", "server", "profile", "telemetry"};
+
+    bool Driver::changes_basis(const std::vector<std::string> & args, size_t istart, std::string & name) {
+      for(size_t i=istart;i<args.size();i++) {
+        if(args[i].compare(0,2,"--")!=0)
+          continue;
+        name=args[i].substr(2,args[i].find('=')-2);
+        for(size_t j=0;j<sizeof(fixed_options)/sizeof(fixed_options[0]);j++)
+          if(name==fixed_options[j])
+            return true;
+      }
+      return false;
+    }
+
+    Driver::Driver(const cmdline::parser & parser, const arma::vec & bgrid) {
+      // Get parameters of the basis set and the integrals
+      double Rmax(parser.get<double>("Rmax"));
+      int igrid(parser.get<int>("grid"));
+      int igrid0(parser.get<int>("grid0"));
+      double zexp(parser.get<double>("zexp"));
+      double zexp0(parser.get<double>("zexp0"));
+      double rsthr(parser.get<double>("rsthr"));
+
+      bool diag(parser.get<bool>("diag"));
+      int symm(parser.get<int>("symmetry"));
+      bool diissingle(parser.get<bool>("diissingle"));
+      int diisorder=parser.get<int>("diisorder");
+
+      int primbas(parser.get<int>("primbas"));
+      // Number of elements
+      int Nelem0(parser.get<int>("nelem0"));
+      int Nelem(parser.get<int>("nelem"));
+      // Number of nodes
+      int Nnodes(parser.get<int>("nnodes"));
+      int Nnodes_outer(parser.get<int>("nnodes_outer"));
+      double Router(parser.get<double>("Router"));
+      int taylor_order(parser.get<int>("taylor_order"));
+
+      // Order of quadrature rule
+      int Nquad(parser.get<int>("nquad"));
+      // Angular grid
+      int lmax(parser.get<int>("lmax"));
+      int mmax(parser.get<int>("mmax"));
+
+      bool verbose(parser.get<bool>("verbose"));
+      double dftcache(parser.get<double>("dftcache"));
+
+      int finitenuc(parser.get<int>("finitenuc"));
+      double Rrms(parser.get<double>("Rrms"));
+
+      // Nuclear charge
+      int Z(get_Z(parser.get<std::string>("Z")));
+      int Zl(get_Z(parser.get<std::string>("Zl")));
+      int Zr(get_Z(parser.get<std::string>("Zr")));
+      double Rhalf(parser.get<double>("Rmid"));
+
+      std::string teicache(parser.get<std::string>("teicache"));
+      double mem_budget(parser.get<double>("mem_budget"));
+      double memory_budget(parser.get<double>("memory"));
+      std::string scratchdir(parser.get<std::string>("scratch"));
+      bool direct(parser.get<bool>("direct"));
+      int tei_cache(parser.get<int>("tei_cache"));
+      int numa(parser.get<int>("numa"));
+      bool zeroder(parser.get<bool>("zeroder"));
+      std::string coulomb(parser.get<std::string>("coulomb"));
+      if(coulomb!="tei" && coulomb!="poisson") {
+        std::ostringstream oss;
+        oss << "Unknown Coulomb engine " << coulomb << "!\n";
+        throw std::logic_error(oss.str());
+      }
+
+      if(parser.get<bool>("angstrom")) {
+        // Convert to atomic units
+        Rhalf*=ANGSTROMINBOHR;
+      }
+
+      atomic::basis::TwoDBasis & basis(setup.basis);
+
+      // Get primitive basis
+      auto poly(std::shared_ptr<const polynomial_basis::PolynomialBasis>(polynomial_basis::get_basis(primbas,Nnodes)));
+      std::vector<std::shared_ptr<const polynomial_basis::PolynomialBasis>> polys(1,poly);
+      if(Nnodes_outer>0 && Nnodes_outer!=Nnodes)
+        polys.push_back(std::shared_ptr<const polynomial_basis::PolynomialBasis>(polynomial_basis::get_basis(primbas,Nnodes_outer)));
+
+      // The quadrature has to be sufficient for the highest order
+      int maxnbf(0);
+      for(size_t ip=0;ip<polys.size();ip++)
+        maxnbf=std::max(maxnbf,polys[ip]->get_nbf());
+      if(Nquad==0)
+        // Set default value
+        Nquad=5*maxnbf;
+      else if(Nquad<2*maxnbf)
+        throw std::logic_error("Insufficient radial quadrature.\n");
+
+      // Set default order of Taylor expansion
+      if(taylor_order==-1)
+        taylor_order = poly->get_nprim()-1;
+
+      printf("Using %i point quadrature rule.\n",Nquad);
+      printf("Angular grid spanning from l=0..%i, m=%i..%i.\n",lmax,-mmax,mmax);
+
+      // Construct the angular basis
+      arma::ivec lval, mval;
+      atomic::basis::angular_basis(lmax,mmax,lval,mval);
+      // and the radial one
+      arma::vec bval(bgrid.n_elem ? bgrid : atomic::basis::form_grid((modelpotential::nuclear_model_t) finitenuc, Rrms, Nelem, Rmax, igrid, zexp, Nelem0, igrid0, zexp0, Z, Zl, Zr, Rhalf));
+      Nelem=bval.n_elem-1;
+      Rmax=bval(bval.n_elem-1);
+
+      // Elements that begin beyond Router use the outer basis. The
+      // first element always keeps the main basis, since the small-r
+      // Taylor series is formed from it
+      arma::uvec el_poly(arma::zeros<arma::uvec>(Nelem));
+      if(polys.size()>1) {
+        for(int iel=1;iel<Nelem;iel++)
+          if(bval(iel)>=Router)
+            el_poly(iel)=1;
+        int Nouter((int) arma::accu(el_poly));
+        printf("%i elements use %i nodes and %i elements %i nodes.\n",Nelem-Nouter,Nnodes,Nouter,Nnodes_outer);
+      }
+
+      basis=atomic::basis::TwoDBasis(Z, (modelpotential::nuclear_model_t) finitenuc, Rrms, polys, el_poly, zeroder, Nquad, bval, taylor_order, lval, mval, Zl, Zr, Rhalf);
+      printf("Basis set consists of %i angular shells composed of %i radial functions, totaling %i basis functions\n",(int) basis.Nang(), (int) basis.Nrad(), (int) basis.Nbf());
+      printf("%ith order Taylor series used to evaluate basis functions for r <= %e, error %e\n",taylor_order, basis.get_small_r_taylor_cutoff(), basis.get_taylor_diff());
+
+      printf("One-electron matrix requires %s\n",scf::memory_size(basis.mem_1el()).c_str());
+      printf("Auxiliary one-electron integrals require %s\n",scf::memory_size(basis.mem_1el_aux()).c_str());
+      printf("Auxiliary two-electron integrals require %s\n",scf::memory_size(basis.mem_2el_aux()).c_str());
+      size_t tei_budget((size_t) (mem_budget*1024.0*1024.0*1024.0));
+      setup.plan_diisorder=0;
+      if(memory_budget>0.0) {
+        // Divide the memory between the subsystems. The DIIS history
+        // holds four matrices and the error vector per entry
+        memory::plan_t plan(memory::make_plan((size_t) (memory_budget*1024.0*1024.0*1024.0), 10*basis.mem_1el()+basis.mem_1el_aux(), basis.mem_2el_aux(), (diissingle ? 3 : 5)*basis.mem_1el(), diisorder, true));
+        memory::print_plan(plan);
+        // Any budget below the need keeps the integrals out of core
+        tei_budget = plan.tei_incore ? 0 : 1;
+        setup.plan_diisorder=plan.diisorder;
+        dftcache=plan.grid/(1024.0*1024.0);
+      }
+      basis.set_tei_storage(tei_budget,scratchdir,direct,(size_t) std::max(tei_cache,0));
+      basis.set_numa((size_t) std::max(numa,0));
+
+      double Enucr=(Rhalf>0) ? Z*(Zl+Zr)/Rhalf + Zl*Zr/(2*Rhalf) : 0.0;
+      printf("Central nuclear charge is %i\n",Z);
+      printf("Left- and right-hand nuclear charges are %i and %i at distance % .3f from center\n",Zl,Zr,Rhalf);
+      printf("Nuclear repulsion energy is %e\n",Enucr);
+
+      // The half-inverse overlap is formed in the symmetry of the first
+      // job, see run_job
+      if(symm==2 && (parser.get<double>("Ez")!=0.0 || parser.get<double>("Qzz")!=0.0 || parser.get<double>("Bz")!=0.0))
+        symm=1;
+
+      arma::ivec & lvals(setup.lvals);
+      arma::ivec & mvals(setup.mvals);
+      lvals=basis.get_l();
+      mvals=basis.get_m();
+      std::vector<arma::uvec> & lmidx(setup.lmidx);
+      lmidx.resize(lvals.n_elem);
+      for(size_t i=0;i<lmidx.size();i++)
+        lmidx[i]=basis.lm_indices(lvals(i),mvals(i));
+
+      // For m averaging
+      std::vector< std::vector<arma::uvec> > & l_idx(setup.l_idx);
+      l_idx.resize(arma::max(lvals)+1);
+      for(int l=0; l< (int) l_idx.size(); l++)
+        for(int m=-l;m<=l;m++)
+          l_idx[l].push_back(basis.lm_indices(l,m));
+
+      Timer timer;
+
+      // The one-electron matrices are formed when first needed
+      MatrixStore & mats(setup.matrices);
+      mats.declare("S",[&basis]() { return basis.overlap(); });
+      mats.declare("T",[&basis]() { return basis.kinetic(); });
+      mats.declare("Vnuc",[&basis,Zl,Zr]() {
+          Timer tnuc;
+          if(Zl!=0 || Zr !=0)
+            printf("Computing nuclear attraction integrals\n");
+          arma::mat Vnuc(basis.nuclear());
+          if(Zl!=0 || Zr !=0)
+            printf("Done in %.6f\n",tnuc.get());
+          return Vnuc;
+        });
+      mats.declare("dip",[&basis]() { return basis.dipole_z(); });
+      mats.declare("quad",[&basis]() { return basis.quadrupole_zz(); });
+      for(int iguess=0;iguess<4;iguess++)
+        mats.declare(guess_entry(iguess),[this,iguess]() { return guess_potential(iguess); });
+      const arma::mat & S(mats.get("S"));
+
+      // Get half-inverse
+      timer.set();
+      arma::mat & Sinvh(setup.Sinvh);
+      Sinvh=basis.Sinvh(!diag,symm);
+      printf("Half-inverse formed in %.6f\n",timer.get());
+      {
+        arma::mat Smo(Sinvh.t()*S*Sinvh);
+        Smo-=arma::eye<arma::mat>(Smo.n_rows,Smo.n_cols);
+        printf("Orbital orthonormality deviation is %e\n",arma::norm(Smo,"fro"));
+      }
+      arma::mat & Sh(setup.Sh);
+      Sh=basis.Shalf(!diag,symm);
+      printf("Half-overlap formed in %.6f\n",timer.get());
+      {
+        arma::mat Smo(Sh.t()*Sinvh);
+        Smo-=arma::eye<arma::mat>(Smo.n_rows,Smo.n_cols);
+        printf("Half-overlap error is %e\n",arma::norm(Smo,"fro"));
+      }
+
+      setup.teicache=teicache;
+      setup.verbose=verbose;
+      if(coulomb=="poisson") {
+        // The integrals are only needed for exact exchange, and are
+        // formed when a hybrid functional is first used
+        basis.set_poisson(true);
+        printf("Coulomb matrix is formed with the radial Poisson solver\n");
+      } else {
+        // The guess only needs the one-electron matrices
+        start_tei();
+      }
+
+      setup.Z=Z;
+      setup.Zl=Zl;
+      setup.Zr=Zr;
+      setup.Rhalf=Rhalf;
+      setup.Enucr=Enucr;
+      setup.Rmax=Rmax;
+      setup.Nelem=Nelem;
+      setup.lmax=lmax;
+      setup.mmax=mmax;
+      setup.diag=diag;
+      setup.symm=symm;
+      setup.have_grid=false;
+      setup.ldft=parser.get<int>("ldft");
+      setup.mdft=parser.get<int>("mdft");
+      setup.dftcache=dftcache;
+      setup.rs_kernel=0;
+      setup.rs_omega=0.0;
+      setup.rsthr=rsthr;
+    }
+
+    Driver::~Driver() {
+      // The worker refers to the basis set
+      if(teijob.valid())
+        teijob.wait();
+    }
+
+    void Driver::form_grid() {
+      if(setup.have_grid)
+        return;
+      const int lmax(setup.lmax), mmax(setup.mmax);
+      int ldft(setup.ldft), mdft(setup.mdft);
+
+      // These would appear to give reasonably converged values
+      if(ldft==0)
+        // Default value: we have 2*lmax from the bra and ket and 2 from
+        // the volume element, and allow for 2*lmax from the
+        // density/potential. Add in 10 more for a bit more accuracy.
+        ldft=4*lmax+10;
+      if(ldft<2*lmax)
+        throw std::logic_error("Increase ldft to guarantee accuracy of quadrature!\n");
+
+      if(mdft==0)
+        // Default value: we have 2*mmax from the bra and ket, and allow
+        // for 2*mmax from the density/potential. Add in 5 to make
+        // sure quadrature is still accurate for mmax=0
+        mdft=4*mmax+5;
+      if(mdft<2*mmax)
+        throw std::logic_error("Increase mdft to guarantee accuracy of quadrature!\n");
+
+      // Form grid
+      setup.grid=helfem::atomic::dftgrid::DFTGrid(&setup.basis,ldft,mdft);
+      setup.grid.set_cache(setup.dftcache*1024*1024);
+      setup.have_grid=true;
+
+      // Basis function norms
+      const arma::mat & S(setup.matrices.get("S"));
+      const arma::mat & T(setup.matrices.get("T"));
+      arma::vec bfnorm(arma::pow(arma::diagvec(S),-0.5));
+
+      // Check accuracy of grid
+      double Sthr=1e-10;
+      double Tthr=1e-8;
+      bool inacc=false;
+      {
+        arma::mat Sdft(setup.grid.eval_overlap());
+        Sdft-=S;
+        normalize_matrix(Sdft,bfnorm);
+
+        double Serr(arma::norm(Sdft,"fro"));
+        printf("Error in overlap matrix evaluated through xc grid is %e\n",Serr);
+        fflush(stdout);
+        if(Serr>=Sthr)
+          inacc=true;
+      }
+      {
+        arma::mat Tdft(setup.grid.eval_kinetic());
+        // Compute relative error
+        for(size_t j=0;j<Tdft.n_cols;j++)
+          for(size_t i=0;i<Tdft.n_rows;i++)
+            Tdft(i,j)=std::abs(Tdft(i,j)-T(i,j))/(1+std::abs(T(i,j)));
+
+        double Terr(arma::norm(Tdft,"fro"));
+        printf("Relative error in kinetic matrix evaluated through xc grid is %e\n",Terr);
+        fflush(stdout);
+        if(Terr>=Tthr)
+          inacc=true;
+      }
+      if(inacc)
+        printf("Warning - possibly inaccurate quadrature!\n");
+      printf("\n");
+    }
+
+    void Driver::build_tei() {
+      atomic::basis::TwoDBasis & basis(setup.basis);
+      profiler::Region ptei("Integrals");
+      if(setup.teicache.size()) {
+        // Integrals only depend on the radial basis, so they can be reused
+        Checkpoint teichk(setup.teicache,true,false);
+        // Out-of-core and recomputed integrals are not cached
+        if(basis.get_tei_storage()!=scratch::TEI_INCORE) {
+          basis.compute_tei(setup.verbose);
+        } else if(teichk.read_tei(basis)) {
+          printf("Primitive integrals read from %s\n",setup.teicache.c_str());
+        } else {
+          basis.compute_tei(setup.verbose);
+          teichk.write_tei(basis);
+        }
+      } else {
+        basis.compute_tei(setup.verbose);
+      }
+    }
+
+    void Driver::form_tei() {
+      if(teijob.valid()) {
+        wait_tei();
+        return;
+      }
+      if(setup.basis.have_tei())
+        return;
+
+      printf("Computing two-electron integrals\n");
+      fflush(stdout);
+      Timer timer;
+      build_tei();
+      printf("Done in %.6f\n",timer.get());
+    }
+
+    void Driver::start_tei() {
+      if(teijob.valid() || setup.basis.have_tei())
+        return;
+      // The guess potential is cached in the same file, and HDF5 is
+      // not thread safe
+      if(setup.teicache.size()) {
+        form_tei();
+        return;
+      }
+
+      printf("Computing two-electron integrals in the background\n");
+      fflush(stdout);
+      // A new thread starts out with the default team size
+      const int nth(threads::outer_threads());
+      teijob=std::async(std::launch::async,[this,nth]() {
+          threads::set_policy(nth,0);
+          Timer timer;
+          build_tei();
+          teitime=timer.get();
+        });
+    }
+
+    void Driver::wait_tei() {
+      if(!teijob.valid())
+        return;
+      Timer timer;
+      // Rethrows any error from the worker
+      teijob.get();
+      printf("Two-electron integrals formed in %.6f, waited %.6f for them\n",teitime,timer.get());
+      fflush(stdout);
+    }
+
+    std::string Driver::guess_entry(int iguess) {
+      static const char * names[]={"core", "GSZ", "SAP", "TF"};
+      if(iguess<0 || iguess>=(int) (sizeof(names)/sizeof(names[0])))
+        throw std::logic_error("Unsupported guess\n");
+      return std::string("guess_")+names[iguess];
+    }
+
+    arma::mat Driver::guess_potential(int iguess) const {
+      const atomic::basis::TwoDBasis & basis(setup.basis);
+
+      // The potential only depends on the nuclear charge and the basis
+      std::string key;
+      if(setup.teicache.size()) {
+        arma::vec par(arma::join_cols(arma::vec({(double) setup.Z}),arma::conv_to<arma::vec>::from(arma::join_cols(basis.get_lval(),basis.get_mval()))));
+        key=basis.tei_fingerprint()+"_"+guess_entry(iguess)+"_"+utils::hash_data(par);
+      }
+      if(key.size() && file_exists(setup.teicache)) {
+        Checkpoint teichk(setup.teicache,false);
+        if(teichk.exist(key)) {
+          arma::mat V;
+          teichk.read(key,V);
+          printf("Guess potential read from %s\n",setup.teicache.c_str());
+          return V;
+        }
+      }
+
+      modelpotential::ModelPotential * model;
+      switch(iguess) {
+      case(0):
+        model = new modelpotential::PointNucleus(setup.Z);
+        break;
+      case(1):
+        model = new modelpotential::GSZAtom(setup.Z);
+        break;
+      case(2):
+        model = new modelpotential::SAPAtom(setup.Z);
+        break;
+      case(3):
+        model = new modelpotential::TFAtom(setup.Z);
+        break;
+      default:
+        throw std::logic_error("Unsupported guess\n");
+      }
+      arma::mat V(basis.model_potential(model));
+      delete model;
+
+      if(key.size()) {
+        Checkpoint teichk(setup.teicache,true,false);
+        teichk.write(key,V);
+      }
+      return V;
+    }
+
+    void Driver::form_rs_tei(bool yukawa, bool erfc, double omega) {
+      int kernel(yukawa ? 2 : (erfc ? 1 : 0));
+      if(!kernel || (kernel==setup.rs_kernel && omega==setup.rs_omega))
+        return;
+
+      atomic::basis::TwoDBasis & basis(setup.basis);
+      printf("Computing range-separated two-electron integrals\n");
+      fflush(stdout);
+      Timer timer;
+      if(setup.teicache.size()) {
+        Checkpoint teichk(setup.teicache,true,false);
+        if(teichk.read_rs_tei(basis,yukawa,omega,setup.rsthr)) {
+          printf("Range-separated integrals read from %s\n",setup.teicache.c_str());
+        } else {
+          if(yukawa)
+            basis.compute_yukawa(omega);
+          else
+            basis.compute_erfc(omega,setup.rsthr);
+          teichk.write_rs_tei(basis);
+        }
+      } else {
+        if(yukawa)
+          basis.compute_yukawa(omega);
+        else
+          basis.compute_erfc(omega,setup.rsthr);
+      }
+      setup.rs_kernel=kernel;
+      setup.rs_omega=omega;
+      printf("Done in %.6f\n",timer.get());
+    }
+
+    double Driver::run(const cmdline::parser & parser, bool restart) {
+      result.converged=false;
+      result.alpha_zz=0.0;
+
+      // The basis set and the integrals are shared between the jobs
+      atomic::basis::TwoDBasis & basis(setup.basis);
+      const int Z(setup.Z), Zl(setup.Zl), Zr(setup.Zr);
+      const double Enucr(setup.Enucr);
+      const arma::mat & S(setup.matrices.get("S"));
+      const arma::mat & T(setup.matrices.get("T"));
+      const arma::mat & Vnuc(setup.matrices.get("Vnuc"));
+      const arma::mat & dip(setup.matrices.get("dip"));
+      const arma::mat & quad(setup.matrices.get("quad"));
+      const arma::ivec & lvals(setup.lvals);
+      const arma::ivec & mvals(setup.mvals);
+      const std::vector<arma::uvec> & lmidx(setup.lmidx);
+      const std::vector< std::vector<arma::uvec> > & l_idx(setup.l_idx);
+
+      // Get parameters
+      double Ez(parser.get<double>("Ez"));
+      double Qzz(parser.get<double>("Qzz"));
+      double Bz(parser.get<double>("Bz"));
+
+      int maxit(parser.get<int>("maxit"));
+      int incfock(parser.get<int>("incfock"));
+      double incthr(parser.get<double>("incthr"));
+      double convthr(parser.get<double>("convthr"));
+
+      int restr(parser.get<int>("restricted"));
+      int symm(parser.get<int>("symmetry"));
+      bool blockdiis(parser.get<bool>("blockdiis"));
+      bool diissingle(parser.get<bool>("diissingle"));
+      double mixedthr(parser.get<double>("mixedthr"));
+      int soscfstall(parser.get<int>("soscf"));
+      int davidson(parser.get<int>("davidson"));
+      double davidsonthr(parser.get<double>("davidsonthr"));
+      int iguess(parser.get<int>("iguess"));
+      bool maverage(parser.get<bool>("maverage"));
+      bool polarizability(parser.get<bool>("polarizability"));
+      double respthr(parser.get<double>("respthr"));
+      int tdsteps(parser.get<int>("tdsteps"));
+      double tddt(parser.get<double>("tddt"));
+      double tdfield(parser.get<double>("tdfield"));
+      double tdomega(parser.get<double>("tdomega"));
+      double tdcycles(parser.get<double>("tdcycles"));
+      double tdcap(parser.get<double>("tdcap"));
+      double tdcapr(parser.get<double>("tdcapr"));
+      int tdkrylov(parser.get<int>("tdkrylov"));
+      bool tdcorrector(parser.get<bool>("tdcorrector"));
+      std::string tdfile(parser.get<std::string>("tdfile"));
+
+      double dftthr(parser.get<double>("dftthr"));
+      double dftadapt(parser.get<double>("dftadapt"));
+      bool dftscreen(parser.get<bool>("dftscreen"));
+      int dftbatch(parser.get<int>("dftbatch"));
+      bool dftsumfac(parser.get<bool>("dftsumfac"));
+
+      // Number of occupied states
+      int nela(parser.get<int>("nela"));
+      int nelb(parser.get<int>("nelb"));
+      int Q(parser.get<int>("Q"));
+      int M(parser.get<int>("M"));
+
+      double diiseps=parser.get<double>("diiseps");
+      double diisthr=parser.get<double>("diisthr");
+      int diisorder=parser.get<int>("diisorder");
+      if(setup.plan_diisorder>0)
+        diisorder=setup.plan_diisorder;
+
+      std::string method(parser.get<std::string>("method"));
+
+      double perturb=parser.get<double>("perturb");
+      int seed=parser.get<int>("seed");
+
+      std::string save(parser.get<std::string>("save"));
+      std::string load(parser.get<std::string>("load"));
+      int chkpt_every(parser.get<int>("chkpt_every"));
+      bool chkpt_minimal(parser.get<bool>("chkpt_minimal"));
+      int chkpt_virtuals(parser.get<int>("chkpt_virtuals"));
+      int chkpt_virtuals_final(parser.get<int>("chkpt_virtuals_final"));
+      std::string chkpt_final(parser.get<std::string>("chkpt_final"));
+      if(chkpt_every<1)
+        throw std::logic_error("chkpt_every must be positive!\n");
+      std::string resume(parser.get<std::string>("resume"));
+      int resume_every(parser.get<int>("resume_every"));
+      if(resume_every<1)
+        throw std::logic_error("resume_every must be positive!\n");
+
+      std::string xparf(parser.get<std::string>("x_pars"));
+      std::string cparf(parser.get<std::string>("c_pars"));
+
+      double dampfock(parser.get<double>("dampfock"));
+      double dampthr(parser.get<double>("dampthr"));
+
+      // Set parameters if necessary
+      arma::vec xpars, cpars;
+      if(xparf.size()) {
+        xpars = scf::parse_xc_params(xparf);
+        xpars.t().print("Exchange functional parameters");
+      }
+      if(cparf.size()) {
+        cpars = scf::parse_xc_params(cparf);
+        cpars.t().print("Correlation functional parameters");
+      }
+
+      // Open checkpoint in save mode
+      Checkpoint chkpt(save,true);
+      chkpt.set_codecs(parser.get<std::string>("chkpt_codec"));
+      chkpt.set_skip_regenerable(parser.get<bool>("chkpt_skip"));
+      chkpt.set_inplace(parser.get<bool>("chkpt_inplace"));
+      // One-electron matrices are only stored on request, since they
+      // are recomputed from the basis set
+      std::string chkmats(parser.get<std::string>("chkpt_matrices"));
+
+      // Read occupations from file?
+      int readocc=parser.get<int>("readocc");
+      if(readocc<0)
+        readocc=INT_MAX;
+      arma::imat occs;
+      if(readocc) {
+        std::string occfile(parser.get<std::string>("occfile"));
+        if(!occs.load(occfile,arma::raw_ascii)) {
+          std::ostringstream oss;
+          oss << "Could not read occupations from " << occfile << "!\n";
+          throw std::runtime_error(oss.str());
+        }
+        if(parser.get<int>("symmetry") == 2 && occs.n_cols != 4) {
+          throw std::logic_error("Must have four columns in occupation data to use full atomic symmetry.\n");
+        }
+        if(parser.get<int>("symmetry") == 1 && occs.n_cols != 3) {
+          throw std::logic_error("Must have three columns in occupation data to use axial symmetry.\n");
+        }
+      }
+
+      scf::parse_nela_nelb(nela,nelb,Q,M,Z+Zl+Zr);
+      if(restr==-1) {
+        // If number of electrons differs then unrestrict
+        restr=(nela==nelb);
+      }
+      chkpt.write("nela",nela);
+      chkpt.write("nelb",nelb);
+
+      std::vector<std::string> rcalc(2);
+      rcalc[0]="unrestricted";
+      rcalc[1]="restricted";
+
+      printf("Running %s %s calculation with Rmax=%e and %i elements.\n",rcalc[restr].c_str(),method.c_str(),setup.Rmax,setup.Nelem);
+      printf("Number of electrons is %i %i\n",nela,nelb);
+
+      chkpt.write(basis);
+      if(MatrixStore::listed(chkmats,"S"))
+        chkpt.write_regenerable("S",S);
+      if(MatrixStore::listed(chkmats,"T"))
+        chkpt.write_regenerable("T",T);
+
+      // Symmetry indices
+      std::vector<arma::uvec> dsym;
+      if(symm==2 && (Ez!=0.0 || Qzz!=0.0)) {
+        printf("Warning - asked for full orbital symmetry in presence of electric field. Relaxing restriction.\n");
+        symm=1;
+      }
+      if(symm==2 && Bz!=0.0) {
+        printf("Warning - asked for full orbital symmetry in presence of magnetic field. Relaxing restriction.\n");
+        symm=1;
+      }
+      if(symm)
+        dsym=basis.get_sym_idx(symm);
+      // With m averaging the Fock blocks of +m and -m coincide, so
+      // only one block of each pair is diagonalized. The ROHF update
+      // depends on the density and does not preserve this.
+      arma::ivec dmirror;
+      if(symm && maverage && !(restr && nela!=nelb)) {
+        dmirror=basis.get_sym_mirror(symm);
+        printf("%i symmetry blocks are mirrored from opposite m\n",(int) arma::sum(dmirror>=0));
+      }
+
+      // The half-inverse overlap is formed in the orbital symmetry
+      arma::mat Sinvh(setup.Sinvh), Sh(setup.Sh);
+      if(symm!=setup.symm) {
+        Sinvh=basis.Sinvh(!setup.diag,symm);
+        Sh=basis.Shalf(!setup.diag,symm);
+      }
+      // The half-inverse is formed block by block, so the columns of
+      // each symmetry are known without scanning it
+      std::vector<arma::uvec> dcols;
+      if(symm)
+        dcols=scf::block_columns(dsym);
+      if(MatrixStore::listed(chkmats,"Sinvh")) {
+        chkpt.write_regenerable("Sinvh",Sinvh);
+        // Needed to form the same half-inverse again
+        chkpt.write("Sinvh_chol",!setup.diag);
+        chkpt.write("Sinvh_symm",symm);
+      }
+      if(MatrixStore::listed(chkmats,"Sh"))
+        chkpt.write("Sh",Sh);
+      if(MatrixStore::listed(chkmats,"Vnuc"))
+        chkpt.write_regenerable("Vuc",Vnuc);
+      if(MatrixStore::listed(chkmats,"dip"))
+        chkpt.write("dip",dip);
+      if(MatrixStore::listed(chkmats,"quad"))
+        chkpt.write("quad",quad);
+
+      // Forced occupations?
+      arma::ivec occnuma, occnumb;
+      std::vector<arma::uvec> occsym;
+      if(readocc) {
+        // Number of occupied alpha orbitals is first column
+        occnuma=occs.col(0);
+        // Number of occupied beta orbitals is second column
+        occnumb=occs.col(1);
+        // l and m values are third and fourth column
+        if(symm==1)
+          for(size_t i=0;i<occs.n_rows;i++)
+            occsym.push_back(basis.m_indices(occs(i,2)));
+        else if(symm==2)
+          for(size_t i=0;i<occs.n_rows;i++)
+            occsym.push_back(basis.lm_indices(occs(i,2),occs(i,3)));
+        else
+          throw std::logic_error("Not implemented!\n");
+
+        // Check consistency of values
+        if(arma::sum(occnuma) != nela) {
+          std::ostringstream oss;
+          oss << "Specified alpha occupations don't match wanted spin state.\n";
+          oss << "Occupying " << arma::sum(occnuma) << " orbitals but should have " << nela << " orbitals.\n";
+          throw std::logic_error(oss.str());
+        }
+        if(arma::sum(occnumb) != nelb) {
+          std::ostringstream oss;
+          oss << "Specified alpha occupations don't match wanted spin state.\n";
+          oss << "Occupying " << arma::sum(occnumb) << " orbitals but should have " << nelb << " orbitals.\n";
+          throw std::logic_error(oss.str());
+        }
+      }
+
+      // Functional
+      int x_func, c_func;
+      ::parse_xc_func(x_func, c_func, method);
+      ::print_info(x_func, c_func);
+      if(!is_supported(x_func))
+        throw std::logic_error("The specified exchange functional is not currently supported in HelFEM.\n");
+      if(!is_supported(c_func))
+        throw std::logic_error("The specified correlation functional is not currently supported in HelFEM.\n");
+
+      bool dft=(x_func>0 || c_func>0);
+
+      bool erfc, yukawa;
+      is_range_separated(x_func, erfc, yukawa);
+      // Fraction of exact exchange
+      double kfrac, kshort, omega;
+      range_separation(x_func, omega, kfrac, kshort);
+      if(omega!=0.0) {
+        printf("\nUsing range-separated exchange with range-separation constant omega = % .3f.\n",omega);
+        printf("Using % .3f %% short-range and % .3f %% long-range exchange.\n",(kfrac+kshort)*100,kfrac*100);
+        if(yukawa) {
+          printf("Using the Yukawa kernel for range separation.\n");
+        } else {
+          printf("Using the error function kernel for range separation.\n");
+        }
+      } else if(kfrac!=0.0)
+        printf("\nUsing hybrid exchange with % .3f %% of exact exchange.\n",kfrac*100);
+      else
+        printf("\nA pure exchange functional used, no exact exchange.\n");
+
+      Timer timer;
+
+      // The DFT grid is formed on the first job that needs it
+      if(dft) {
+        form_grid();
+        setup.grid.set_screening(dftscreen);
+        setup.grid.set_adaptive(dftadapt,2*setup.lmax);
+        setup.grid.set_batch((size_t) std::max(dftbatch,0));
+        setup.grid.set_sumfac(dftsumfac);
+      }
+      helfem::atomic::dftgrid::DFTGrid & grid(setup.grid);
+
+      // Electric field coupling (minus sign cancels one from charge)
+      arma::mat Vel(Ez*dip + Qzz*quad/3.0);
+      if(MatrixStore::listed(chkmats,"Vel"))
+        chkpt.write("Vel",Vel);
+      // Magnetic field coupling
+      arma::mat Vmag(basis.Bz_field(Bz));
+      if(MatrixStore::listed(chkmats,"Vmag"))
+        chkpt.write("Vmag",Vmag);
+      // Form Hamiltonian
+      arma::mat H0(T+Vnuc+Vel+Vmag);
+      if(MatrixStore::listed(chkmats,"H0"))
+        chkpt.write("H0",H0);
+
+      printf("One-electron matrices formed in %.6f\n",timer.get());
+
+      // Occupied and virtual orbitals
+      arma::mat Caocc, Cbocc, Cavirt, Cbvirt;
+      arma::vec Ea, Eb;
+      // Number of eigenenergies to print
+      arma::uword nena(std::min((arma::uword) nela+4,Sinvh.n_cols));
+      arma::uword nenb(std::min((arma::uword) nelb+4,Sinvh.n_cols));
+
+      // With the Poisson solver, exact exchange is the only user of the
+      // integrals, which are then formed while the guess is built
+      if(kfrac!=0.0)
+        start_tei();
+
+      bool usediis=true, useadiis=true, diiscomb=false;
+      uDIIS diis(S,Sinvh,diiscomb,usediis,diiseps,diisthr,useadiis,true,diisorder);
+      if(blockdiis && symm) {
+        // The Fock matrices are block diagonal in the symmetry
+        diis.set_blocks(dsym);
+        printf("DIIS history is stored in %i symmetry blocks\n",(int) dsym.size());
+      }
+      diis.set_single(diissingle);
+
+      // An interrupted calculation is resumed from its snapshot, which
+      // holds the orbitals, the DIIS history and the state of the loop
+      scf::resume_t rstate;
+      bool resuming=resume.size() && scf::read_resume(resume,rstate,diis,Sinvh.n_rows,nela,nelb);
+
+      // Guess orbitals
+      timer.set();
+      profiler::Region pguess("Guess");
+      {
+        arma::mat Ca, Cb;
+        if(resuming) {
+          printf("Resuming from iteration %i of snapshot %s\n",rstate.iter,resume.c_str());
+          Ca=rstate.Ca;
+          Cb=rstate.Cb;
+          Ea=rstate.Ea;
+          Eb=rstate.Eb;
+        } else if(restart && result.Ca.n_elem) {
+          printf("Guess orbitals from the previous calculation\n");
+          // The basis set is the same, so the orbitals can be used as such
+          Ca=result.Ca;
+          Cb=result.Cb;
+          Ea=result.Ea;
+          Eb=result.Eb;
+        } else if(load.size()) {
+          printf("Guess orbitals from checkpoint\n");
+
+          // Load checkpoint
+          Checkpoint loadchk(load,false);
+          // Old basis set
+          atomic::basis::TwoDBasis oldbasis;
+          loadchk.read(oldbasis);
+
+          // Large matrices are only used read-only, so they don't need to be copied
+          const arma::mat oldSinvh(loadchk.map("Sinvh"));
+
+          // Interbasis overlap
+          arma::mat S12(basis.overlap(oldbasis));
+
+          switch(iguess) {
+          case(0):
+            printf("Guess orbitals from Fock matrix projection\n");
+    	{
+    	  // Convert to orthonormal basis
+    	  S12=arma::trans(Sinvh)*S12*oldSinvh;
+    	  // Helper
+    	  arma::mat SSinvh(S*Sinvh);
+
+    	  // Fock matrix
+    	  arma::mat F;
+
+    	  // Load Fock matrix and project onto the old orthogonal basis
+    	  F=arma::trans(oldSinvh)*loadchk.map("Fa")*oldSinvh;
+    	  // Project onto the new basis
+    	  F=S12*F*arma::trans(S12);
+    	  // Go back to original basis
+    	  F=SSinvh*F*arma::trans(SSinvh);
+    	  // Diagonalize
+    	  if(symm)
+    	    scf::eig_gsym_sub(Ea,Ca,F,Sinvh,dsym);
+    	  else
+    	    scf::eig_gsym(Ea,Ca,F,Sinvh);
+
+    	  // Load Fock matrix and project onto the old orthogonal basis
+    	  F=arma::trans(oldSinvh)*loadchk.map("Fb")*oldSinvh;
+    	  // Project onto the new basis
+    	  F=S12*F*arma::trans(S12);
+    	  // Go back to original basis
+    	  F=SSinvh*F*arma::trans(SSinvh);
+    	  // Diagonalize
+    	  if(symm)
+    	    scf::eig_gsym_sub(Eb,Cb,F,Sinvh,dsym);
+    	  else
+    	    scf::eig_gsym(Eb,Cb,F,Sinvh);
+    	}
+            break;
+
+          case(1):
+          default:
+            // Project lowest orbitals
+            printf("Guess orbitals from previous calculation\n");
+            {
+    	  // Projector
+    	  arma::mat P((Sinvh*arma::trans(Sinvh))*S12);
+
+    	  // Alpha orbitals; project onto new basis: C1 = S11^-1 S12 C2.
+    	  // The orbitals come with their energies, and virtuals that
+    	  // were not stored are recomputed
+    	  arma::mat Cold;
+    	  loadchk.read_orbitals("a",Cold,Ea);
+    	  Ca=P*Cold;
+
+    	  // Beta orbitals
+    	  loadchk.read_orbitals("b",Cold,Eb);
+    	  Cb=P*Cold;
+
+    	  // Run Gram-Schmidt to make sure orbitals are orthonormal
+    	  for(int ia=0;ia<nela;ia++) {
+    	    for(int ja=0;ja<ia;ja++)
+    	      Ca.col(ia)-= Ca.col(ja)*(arma::trans(Ca.col(ja))*S*Ca.col(ia));
+    	    Ca.col(ia) /= sqrt(arma::as_scalar(arma::trans(Ca.col(ia))*S*Ca.col(ia)));
+    	  }
+
+    	  for(int ib=0;ib<nelb;ib++) {
+    	    for(int jb=0;jb<ib;jb++)
+    	      Cb.col(ib) -= Cb.col(jb)*(arma::trans(Cb.col(jb))*S*Cb.col(ib));
+    	    Cb.col(ib) /= sqrt(arma::as_scalar(arma::trans(Cb.col(ib))*S*Cb.col(ib)));
+    	  }
+    	}
+    	break;
+          }
+        } else {
+          switch(iguess) {
+          case(0):
+            // Use core guess
+            printf("Guess orbitals from core Hamiltonian\n");
+            break;
+
+          case(1):
+            // Use GSZ guess
+            printf("Guess orbitals from GSZ screened nucleus\n");
+            break;
+
+          case(2):
+            // Use SAP guess
+            printf("Guess orbitals from SAP screened nucleus\n");
+            break;
+
+          case(3):
+            // Use Thomas-Fermi guess
+            printf("Guess orbitals from Thomas-Fermi nucleus\n");
+            break;
+
+          default:
+            throw std::logic_error("Unsupported guess\n");
+          }
+
+          // Form guess Hamiltonian; the potential is formed once and
+          // kept for the later jobs
+          arma::mat Hguess(T+Vel+Vmag+setup.matrices.get(guess_entry(iguess)));
+
+          // Diagonalize the hamiltonian
+          if(symm)
+            scf::eig_gsym_sub(Ea,Ca,Hguess,Sinvh,dsym);
+          else
+            scf::eig_gsym(Ea,Ca,Hguess,Sinvh);
+
+          // Beta guess is the same as the alpha guess
+          Cb=Ca;
+          Eb=Ea;
+
+          // Enforce occupation according to specified symmetry
+          if(readocc) {
+    	scf::enforce_occupations(Ca,Ea,S,occnuma,occsym);
+    	if(restr && nela==nelb)
+    	  Cb=Ca;
+    	else
+    	  scf::enforce_occupations(Cb,Eb,S,occnumb,occsym);
+          }
+        }
+
+        // Perturb guess
+        if(perturb && !resuming) {
+          // Generate norb x norb rotation matrix
+          arma::arma_rng::set_seed(seed);
+          Ca*=scf::perturbation_matrix(Ca.n_cols,perturb);
+          if(restr && nela==nelb) {
+            Cb=Ca;
+          } else {
+            Cb*=scf::perturbation_matrix(Cb.n_cols,perturb);
+          }
+          printf("Guess orbitals perturbed by %e\n",perturb);
+        }
+
+        // Alpha orbitals
+        Caocc=Ca.cols(0,nela-1);
+        if(Ca.n_cols>(size_t) nela)
+          Cavirt=Ca.cols(nela,Ca.n_cols-1);
+
+        // Beta guess
+        if(nelb)
+          Cbocc=Cb.cols(0,nelb-1);
+        if(Cb.n_cols>(size_t) nelb)
+          Cbvirt=Cb.cols(nelb,Cb.n_cols-1);
+
+        Ea.subvec(0,nena-1).t().print("Alpha orbital energies");
+        Eb.subvec(0,nenb-1).t().print("Beta  orbital energies");
+
+        printf("\n");
+        printf("Alpha orbital symmetries\n");
+        classify_orbitals(Caocc,lvals,mvals,lmidx);
+        if(nelb>0) {
+          printf("\n");
+          printf("Beta orbital symmetries\n");
+          classify_orbitals(Cbocc,lvals,mvals,lmidx);
+        }
+        printf("\n");
+      }
+      pguess.close();
+      printf("Initial guess performed in %.6f\n",timer.get());
+
+      // The first Fock build needs the integrals
+      wait_tei();
+      form_rs_tei(yukawa,erfc,omega);
+
+      double Ekin=0.0, Epot=0.0, Ecoul=0.0, Exx=0.0, Exc=0.0, Eefield=0.0, Emfield=0.0, Etot=0.0;
+      double Eold=resuming ? rstate.Etot : 0.0;
+
+      // The early iterations contract single-precision integrals
+      if(resuming ? rstate.tei_single : mixedthr>0.0)
+        basis.set_tei_single(true);
+      // Is a full Fock build needed on the next iteration? The
+      // previous densities are not in the snapshot
+      bool fullbuild=resuming;
+
+      // Second-order solver, used once DIIS stalls
+      scf::SOSCF soscf;
+      double diisbest=resuming ? rstate.diisbest : DBL_MAX;
+      int nstall=resuming ? rstate.nstall : 0;
+      double diiserr;
+
+      // Density matrices
+      arma::mat P, Pa, Pb;
+      // Densities and Coulomb and exchange matrices of the previous iteration
+      arma::mat Pold, Paold, Pbold, Jold, Kaold, Kbold;
+
+      // SCF data is written out in the background
+      CheckpointWriter chkwriter(chkpt);
+      chkwriter.set_final(chkpt_final);
+
+      for(int i=resuming ? rstate.iter+1 : 1;i<=maxit;i++) {
+        printf("\n**** Iteration %i ****\n\n",i);
+        {
+          std::ostringstream phase;
+          phase << "iteration " << i;
+          profiler::mark(phase.str());
+        }
+        profiler::Region pscf("SCF");
+        // Timings for the telemetry
+        double tJ=0.0, tK=0.0, txc=0.0, tdiis=0.0, tdiag=0.0;
+        double tio(chkwriter.caller_time()), tiobg(chkwriter.io_time());
+        bool diissolved=false;
+        // Write checkpoint on this iteration?
+        bool chkiter=(i%chkpt_every==0) || (i==maxit);
+        // Write auxiliary matrices as well?
+        bool chkfull=chkiter && !chkpt_minimal;
+
+        // Form density matrix
+        scf::form_density(Pa,Caocc,nela);
+        scf::form_density(Pb,Cbocc,nelb);
+        if(Pb.n_rows == 0)
+          Pb.zeros(Pa.n_rows,Pa.n_cols);
+        P=Pa+Pb;
+
+        if(chkfull) {
+          chkwriter.write("P",P);
+          chkwriter.write("Pa",Pa);
+          chkwriter.write("Pb",Pb);
+        }
+
+        printf("Tr Pa = %f\n",scf::trace_symm(Pa,S));
+        if(nelb)
+          printf("Tr Pb = %f\n",scf::trace_symm(Pb,S));
+        fflush(stdout);
+
+        // The one-electron energies are evaluated in one pass over P
+        {
+          arma::vec Eone(scf::trace_symm(P,{&T,&Vnuc,&Vel,&Vmag}));
+          Ekin=Eone(0);
+          Epot=Eone(1);
+          Eefield=Eone(2);
+          Emfield=Eone(3)-Bz/2.0*(nela-nelb);
+        }
+
+        // In an incremental build only the change of the density is
+        // contracted, and its negligible blocks are skipped. A full build
+        // is done every incfock iterations to stop the errors from piling up
+        bool incbuild=(incfock>0) && ((i-1)%incfock!=0) && !fullbuild;
+        fullbuild=false;
+        basis.set_screening(incbuild ? incthr : 0.0);
+        arma::mat dP(incbuild ? arma::mat(P-Pold) : P);
+        arma::mat dPa(incbuild ? arma::mat(Pa-Paold) : Pa);
+        arma::mat dPb(incbuild ? arma::mat(Pb-Pbold) : Pb);
+        if(incbuild)
+          printf("Incremental Fock build\n");
+
+        profiler::Region pfock("Fock");
+        // Form Coulomb matrix
+        timer.set();
+        arma::mat J(basis.coulomb(dP));
+        if(incbuild)
+          J+=Jold;
+        tJ=timer.get();
+        Ecoul=0.5*scf::trace_symm(P,J);
+        printf("Coulomb energy %.10e % .6f\n",Ecoul,tJ);
+        {
+          size_t nactive, ntot;
+          basis.get_coulomb_channels(nactive,ntot);
+          if(nactive<ntot)
+            printf("%i of %i (L,M) channels active in the Coulomb build\n",(int) nactive,(int) ntot);
+        }
+        fflush(stdout);
+
+        if(chkfull)
+          chkwriter.write("J",J);
+
+        // Form exchange matrix
+        timer.set();
+        arma::mat Ka, Kb;
+        if(kfrac!=0.0 || kshort!=0.0) {
+          Ka.zeros(Caocc.n_rows,Caocc.n_rows);
+          Kb.zeros(Caocc.n_rows,Caocc.n_rows);
+          if(nelb && !(restr && nela==nelb)) {
+            // Contract both spin densities in a single pass
+            std::vector<arma::mat> Pab(2);
+            Pab[0]=dPa;
+            Pab[1]=dPb;
+            if(kfrac!=0.0) {
+              std::vector<arma::mat> Kab(basis.exchange(Pab));
+              Ka+=kfrac*Kab[0];
+              Kb+=kfrac*Kab[1];
+            }
+            if(omega!=0.0) {
+              std::vector<arma::mat> Kab(basis.rs_exchange(Pab));
+              Ka+=kshort*Kab[0];
+              Kb+=kshort*Kab[1];
+            }
+          } else {
+            if(kfrac!=0.0)
+              Ka+=kfrac*basis.exchange(dPa);
+            if(omega!=0.0)
+              Ka+=kshort*basis.rs_exchange(dPa);
+            if(nelb)
+              Kb=Ka;
+          }
+          if(incbuild) {
+            Ka+=Kaold;
+            Kb+=Kbold;
+          }
+
+          tK=timer.get();
+          Exx=0.5*scf::trace_symm(Pa,Ka);
+          if(Kb.n_rows == Pb.n_rows && Kb.n_cols == Pb.n_cols)
+            Exx+=0.5*scf::trace_symm(Pb,Kb);
+          printf("Exchange energy %.10e % .6f\n",Exx,tK);
+        } else {
+          Exx=0.0;
+        }
+        fflush(stdout);
+
+        // Store for the next incremental build
+        Pold=P;
+        Paold=Pa;
+        Pbold=Pb;
+        Jold=J;
+        Kaold=Ka;
+        Kbold=Kb;
+
+        if(chkfull) {
+          chkwriter.write("Ka",Ka);
+          chkwriter.write("Kb",Kb);
+        }
+
+        // Exchange-correlation
+        Exc=0.0;
+        arma::mat XCa, XCb;
+        if(dft) {
+          timer.set();
+          double nelnum;
+          double ekin;
+          if(restr && nela==nelb) {
+            grid.eval_Fxc(x_func, xpars, c_func, cpars, P, XCa, Exc, nelnum, ekin, dftthr);
+            XCb=XCa;
+          } else {
+            grid.eval_Fxc(x_func, xpars, c_func, cpars, Pa, Pb, XCa, XCb, Exc, nelnum, ekin, nelb>0, dftthr);
+          }
+          txc=timer.get();
+          printf("DFT energy %.10e % .6f\n",Exc,txc);
+          printf("Error in integrated number of electrons % e\n",nelnum-nela-nelb);
+          if(ekin!=0.0)
+            printf("Error in integral of kinetic energy density % e\n",ekin-Ekin);
+        }
+        fflush(stdout);
+        if(chkfull) {
+          chkwriter.write("XCa",XCa);
+          chkwriter.write("XCb",XCb);
+        }
+
+        pfock.close();
+
+        // Fock matrices
+        arma::mat Fa(H0+J);
+        arma::mat Fb(H0+J);
+        if(Ka.n_rows == Fa.n_rows) {
+          Fa+=Ka;
+        }
+        if(Kb.n_rows == Fb.n_rows) {
+          Fb+=Kb;
+        }
+        if(dft) {
+          Fa+=XCa;
+          if(nelb>0) {
+            Fb+=XCb;
+          }
+        }
+        if(Bz!=0.0) {
+          // Add in the B*Sz term
+          Fa-=Bz*S/2.0;
+          Fb+=Bz*S/2.0;
+        }
+
+        // m averaging?
+        if(maverage) {
+          Fa=scf::fock_symmetry_average(Fa,l_idx);
+          Fb=scf::fock_symmetry_average(Fb,l_idx);
+        }
+        // Enforce symmetry of Fock matrix
+        if(symm) {
+          Fa=scf::enforce_fock_symmetry(Fa,dsym);
+          Fb=scf::enforce_fock_symmetry(Fb,dsym);
+        }
+
+        // ROHF update to Fock matrix
+        if(restr && nela!=nelb)
+          scf::ROHF_update(Fa,Fb,P,Sh,Sinvh,nela,nelb);
+
+        // The Fock matrices are checkpointed together with the
+        // orbitals, but DIIS extrapolates them before convergence is
+        // known, so keep the current ones
+        arma::mat Fa_chk(Fa), Fb_chk(Fb);
+
+        // Update energy
+        Etot=Ekin+Epot+Eefield+Emfield+Ecoul+Exx+Exc+Enucr;
+        double dE=Etot-Eold;
+
+        printf("Total energy is % .10f\n",Etot);
+        if(i>1)
+          printf("Energy changed by %e\n",dE);
+        Eold=Etot;
+        fflush(stdout);
+
+        /*
+          S.print("S");
+          T.print("T");
+          Vnuc.print("Vnuc");
+          Ca.print("Ca");
+          Pa.print("Pa");
+          J.print("J");
+          Ka.print("Ka");
+
+          arma::mat Jmo(Ca.t()*J*Ca);
+          arma::mat Kmo(Ca.t()*Ka*Ca);
+          Jmo.submat(0,0,10,10).print("Jmo");
+          Kmo.submat(0,0,10,10).print("Kmo");
+
+          Kmo+=Jmo;
+          Kmo.print("Jmo+Kmo");
+
+          Fa.print("Fa");
+          arma::mat Fao(Sinvh.t()*Fa*Sinvh);
+          Fao.print("Fao");
+          Sinvh.print("Sinvh");
+        */
+
+        /*
+          arma::mat Jmo(Ca.t()*J*Ca);
+          arma::mat Kmo(Ca.t()*Ka*Ca);
+          arma::mat Fmo(Ca.t()*Fa*Ca);
+          Jmo=Jmo.submat(0,0,4,4);
+          Kmo=Kmo.submat(0,0,4,4);
+          Fmo=Fmo.submat(0,0,4,4);
+          Jmo.print("J");
+          Kmo.print("K");
+          Fmo.print("F");
+        */
+
+        // Update DIIS
+        timer.set();
+        diis.update(Fa,Fb,Pa,Pb,Etot,diiserr);
+        tdiis=timer.get();
+        printf("DIIS error is %e, update done in %.6f\n",diiserr,tdiis);
+        fflush(stdout);
+
+        // Has DIIS stalled? The second-order solver needs all the
+        // virtual orbitals, and a Fock matrix that does not go through
+        // the ROHF update
+        if(soscfstall>0 && !soscf.active() && i>=readocc && davidson<0 && !(restr && nela!=nelb)) {
+          if(diiserr<diisbest) {
+            diisbest=diiserr;
+            nstall=0;
+          } else if(++nstall>=soscfstall) {
+            printf("DIIS error has not improved in %i iterations, switching to the second-order solver\n",nstall);
+            soscf.reset(arma::join_rows(Caocc,Cavirt),arma::join_rows(Cbocc,Cbvirt),nela,nelb,restr && nela==nelb);
+          }
+        }
+
+        // Solve DIIS to get Fock update
+        if(!soscf.active()) {
+          timer.set();
+          diis.solve_F(Fa,Fb);
+          diissolved=true;
+          tdiis+=timer.get();
+          printf("DIIS solution done in %.6f\n",timer.get());
+          fflush(stdout);
+        }
+
+        // Have we converged? Note that DIIS error is still wrt full space, not active space.
+        bool convd=(diiserr<convthr) && (std::abs(dE)<convthr);
+        // Switch to double precision once the DIIS error is small
+        // enough; the calculation can't converge before that
+        if(basis.get_tei_single() && (diiserr<mixedthr || convd)) {
+          printf("Switching to double-precision integrals\n");
+          basis.set_tei_single(false);
+          fullbuild=true;
+          convd=false;
+        }
+
+        // Damping?
+        bool damped=(dampfock != 1.0 && diiserr >= dampthr && !soscf.active());
+        if(damped) {
+          printf("Damping off-diagonal elements of Fock matrix by % .3f\n",dampfock);
+          if(nela && Fa.n_rows > (size_t) nela) {
+            arma::mat Ca(arma::join_rows(Caocc, Cavirt));
+            arma::mat focka_mo(Ca.t()*Fa*Ca);
+            focka_mo.submat(0,nela,nela-1,focka_mo.n_rows-1) *= dampfock;
+            focka_mo.submat(nela,0,focka_mo.n_rows-1,nela-1) *= dampfock;
+            Fa = S*Ca*focka_mo*Ca.t()*S;
+          }
+          if(nelb && Fb.n_rows > (size_t) nelb) {
+            arma::mat Cb(arma::join_rows(Cbocc, Cbvirt));
+            arma::mat fockb_mo(Cb.t()*Fb*Cb);
+            fockb_mo.submat(0,nelb,nelb-1,fockb_mo.n_rows-1) *= dampfock;
+            fockb_mo.submat(nelb,0,fockb_mo.n_rows-1,nelb-1) *= dampfock;
+            Fb = S*Cb*fockb_mo*Cb.t()*S;
+          }
+        }
+
+        // Diagonalize Fock matrix to get new orbitals
+        timer.set();
+        profiler::Region pdiag("Diagonalization");
+        arma::mat Ca, Cb;
+        // The Davidson solver is warm-started from the current orbitals;
+        // the full solution is needed while the occupations are enforced
+        bool iterdiag=(davidson>=0) && (i>=readocc);
+        // The second-order solver rotates the orbitals directly; on
+        // convergence the Fock matrix is diagonalized for canonical orbitals
+        bool sostep=soscf.active() && !convd;
+        if(sostep) {
+          soscf.step(Fa,Fb,Etot,Ca,Ea,Cb,Eb);
+        } else if(iterdiag) {
+          size_t neig(nela+davidson);
+          if(symm)
+            scf::eig_davidson_sub(Ea,Ca,Fa,S,Sinvh,dsym,dcols,arma::join_rows(Caocc,Cavirt),neig,3*neig,maxit,davidsonthr);
+          else
+            scf::eig_davidson(Ea,Ca,Fa,S,Sinvh,arma::join_rows(Caocc,Cavirt),neig,3*neig,maxit,davidsonthr);
+        } else if(symm)
+          scf::eig_gsym_sub(Ea,Ca,Fa,Sinvh,dsym,dcols,dmirror);
+        else
+          scf::eig_gsym(Ea,Ca,Fa,Sinvh);
+        // Enforce occupation according to specified symmetry
+        if(i<readocc) {
+          scf::enforce_occupations(Ca,Ea,S,occnuma,occsym);
+        }
+
+        if(sostep) {
+          // The beta orbitals were rotated along with the alpha orbitals
+        } else if(restr && nela==nelb) {
+          Eb=Ea;
+          Cb=Ca;
+        } else if(iterdiag) {
+          size_t neig(std::max(nelb,1)+davidson);
+          if(symm)
+            scf::eig_davidson_sub(Eb,Cb,Fb,S,Sinvh,dsym,dcols,arma::join_rows(Cbocc,Cbvirt),neig,3*neig,maxit,davidsonthr);
+          else
+            scf::eig_davidson(Eb,Cb,Fb,S,Sinvh,arma::join_rows(Cbocc,Cbvirt),neig,3*neig,maxit,davidsonthr);
+        } else {
+          if(symm)
+            scf::eig_gsym_sub(Eb,Cb,Fb,Sinvh,dsym,dcols,dmirror);
+          else
+            scf::eig_gsym(Eb,Cb,Fb,Sinvh);
+        }
+        // Enforce occupation according to specified symmetry
+        if(i<readocc) {
+          scf::enforce_occupations(Cb,Eb,S,occnumb,occsym);
+        }
+
+        pdiag.close();
+
+        // The orbitals are always saved on convergence. Restarts only
+        // need the occupied ones, and the missing virtuals are
+        // recomputed by Checkpoint::read_orbitals
+        if(chkiter || convd) {
+          const int nvirt(convd ? chkpt_virtuals_final : chkpt_virtuals);
+          chkwriter.write("Ca",scf::lowest_orbitals(Ca,nela,nvirt));
+          chkwriter.write("Cb",scf::lowest_orbitals(Cb,nelb,nvirt));
+          chkwriter.write("Ea",scf::lowest_orbitals(Ea,nela,nvirt));
+          chkwriter.write("Eb",scf::lowest_orbitals(Eb,nelb,nvirt));
+          chkwriter.write("Fa",std::move(Fa_chk));
+          chkwriter.write("Fb",std::move(Fb_chk));
+        }
+
+        Caocc=Ca.cols(0,nela-1);
+        if(Ca.n_cols>(size_t) nela)
+          Cavirt=Ca.cols(nela,Ca.n_cols-1);
+        if(nelb>0)
+          Cbocc=Cb.cols(0,nelb-1);
+        if(Cb.n_cols>(size_t) nelb)
+          Cbvirt=Cb.cols(nelb,Cb.n_cols-1);
+        tdiag=timer.get();
+        if(sostep)
+          printf("Second-order orbital update done in %.6f\n",timer.get());
+        else if(iterdiag)
+          printf("Davidson diagonalization done in %.6f\n",timer.get());
+        else if(symm)
+          printf("Subspace diagonalization done in %.6f\n",timer.get());
+        else
+          printf("Full diagonalization done in %.6f\n",timer.get());
+
+        if(Ea.n_elem>(size_t)nela)
+          printf("Alpha HOMO-LUMO gap is % .3f eV\n",(Ea(nela)-Ea(nela-1))*HARTREEINEV);
+        if(nelb && Eb.n_elem>(size_t)nelb)
+          printf("Beta  HOMO-LUMO gap is % .3f eV\n",(Eb(nelb)-Eb(nelb-1))*HARTREEINEV);
+        fflush(stdout);
+
+        printf("\n");
+        printf("Alpha orbital symmetries\n");
+        classify_orbitals(Caocc,lvals,mvals,lmidx);
+        if(nelb>0) {
+          printf("\n");
+          printf("Beta orbital symmetries\n");
+          classify_orbitals(Cbocc,lvals,mvals,lmidx);
+        }
+        printf("\n");
+
+        if(telemetry::enabled()) {
+          telemetry::Record rec("atomic");
+          rec.add("iteration",i);
+          rec.add("energy",Etot);
+          rec.add("dE",dE);
+          rec.add("diis_error",diiserr);
+          if(diissolved) {
+            rec.add("diis_weights",diis.get_last_weights());
+            rec.add("diis_fraction",diis.get_last_diis_fraction());
+          }
+          rec.add("solver",sostep ? "soscf" : (iterdiag ? "davidson" : "diag"));
+          rec.add("incremental",incbuild);
+          rec.add("damped",damped);
+          rec.add("converged",convd);
+          rec.add("t_J",tJ);
+          rec.add("t_K",tK);
+          rec.add("t_XC",txc);
+          rec.add("t_diag",tdiag);
+          rec.add("t_DIIS",tdiis);
+          rec.add("t_IO",chkwriter.caller_time()-tio);
+          rec.add("t_IO_background",chkwriter.io_time()-tiobg);
+          rec.write();
+        }
+
+        // The snapshot is written synchronously, so that it is complete
+        // when the job is preempted
+        if(resume.size() && !convd && i%resume_every==0) {
+          timer.set();
+          rstate.iter=i;
+          rstate.Etot=Etot;
+          rstate.diisbest=diisbest;
+          rstate.nstall=nstall;
+          rstate.tei_single=basis.get_tei_single();
+          rstate.Ca=arma::join_rows(Caocc,Cavirt);
+          rstate.Cb=arma::join_rows(Cbocc,Cbvirt);
+          rstate.Ea=Ea;
+          rstate.Eb=Eb;
+          scf::write_resume(resume,rstate,diis,nela,nelb);
+          printf("Resumable snapshot written in %.6f\n",timer.get());
+          fflush(stdout);
+        }
+
+        result.converged=convd;
+        if(convd)
+          break;
+      }
+      // A calculation that has run to the end is not resumed
+      if(resume.size())
+        std::remove(resume.c_str());
+      if(result.converged)
+        chkwriter.write_final();
+      chkwriter.wait();
+      profiler::mark("post-SCF");
+      basis.set_tei_single(false);
+
+      // Store the results
+      result.Etot=Etot;
+      result.Ea=Ea;
+      result.Eb=Eb;
+      result.Ca=arma::join_rows(Caocc,Cavirt);
+      result.Cb=arma::join_rows(Cbocc,Cbvirt);
+      result.Pa=Pa;
+      result.Pb=Pb;
+      result.eldip=-scf::trace_symm(dip,P);
+      result.elquad=-scf::trace_symm(quad,P);
+
+      printf("%-21s energy: % .16f\n","Kinetic",Ekin);
+      printf("%-21s energy: % .16f\n","Nuclear attraction",Epot);
+      printf("%-21s energy: % .16f\n","Nuclear repulsion",Enucr);
+      printf("%-21s energy: % .16f\n","Coulomb",Ecoul);
+      printf("%-21s energy: % .16f\n","Exact exchange",Exx);
+      printf("%-21s energy: % .16f\n","Exchange-correlation",Exc);
+      printf("%-21s energy: % .16f\n","Electric field",Eefield);
+      printf("%-21s energy: % .16f\n","Magnetic field",Emfield);
+      printf("%-21s energy: % .16f\n","Total",Etot);
+      printf("%-21s energy: % .16f\n","Virial ratio",-Etot/Ekin);
+
+      printf("\n");
+      printf("Electronic dipole     moment % .16e\n",-scf::trace_symm(dip,P));
+      printf("Electronic quadrupole moment % .16e\n",-scf::trace_symm(quad,P));
+
+      if(polarizability) {
+        // Static dipole polarizability from the coupled-perturbed
+        // equations, solved with preconditioned conjugate gradients
+        profiler::Region presp("Response");
+        Timer tresp;
+        if(restr && nela!=nelb)
+          throw std::logic_error("The response equations are not implemented for restricted open-shell references.\n");
+        if(result.Ca.n_cols != Sinvh.n_cols || result.Cb.n_cols != Sinvh.n_cols)
+          throw std::logic_error("The response equations need all the orbitals; turn off the Davidson solver.\n");
+        // Closed-shell systems only need the alpha spin
+        bool same(restr && nela==nelb);
+        basis.set_screening(0.0);
+        if(dft)
+          grid.set_screening(false);
+
+        // Occupied and virtual orbitals
+        arma::mat Coa(result.Ca.cols(0,nela-1)), Cva(result.Ca.cols(nela,result.Ca.n_cols-1));
+        arma::mat Cob, Cvb(result.Cb.cols(nelb,result.Cb.n_cols-1));
+        if(nelb)
+          Cob=result.Cb.cols(0,nelb-1);
+        // Orbital energy differences
+        arma::mat Da(Cva.n_cols,Coa.n_cols), Db(Cvb.n_cols,Cob.n_cols);
+        for(size_t i=0;i<Da.n_cols;i++)
+          for(size_t a=0;a<Da.n_rows;a++)
+            Da(a,i)=result.Ea(nela+a)-result.Ea(i);
+        for(size_t i=0;i<Db.n_cols;i++)
+          for(size_t a=0;a<Db.n_rows;a++)
+            Db(a,i)=result.Eb(nelb+a)-result.Eb(i);
+
+        // Residuals for zero initial response, preconditioned residuals and search directions
+        arma::mat Ra(-Cva.t()*dip*Coa), Rb(-Cvb.t()*dip*Cob);
+        arma::mat Ua(arma::zeros<arma::mat>(Ra.n_rows,Ra.n_cols)), Ub(arma::zeros<arma::mat>(Rb.n_rows,Rb.n_cols));
+        arma::mat Za(Ra/Da), Zb(Rb/Db);
+        arma::mat Sa(Za), Sb(Zb);
+        double rz(arma::dot(Ra,Za)+(same ? 0.0 : arma::dot(Rb,Zb)));
+
+        int iresp;
+        double rnorm=0.0;
+        for(iresp=1;iresp<=maxit;iresp++) {
+          // Density change of the search direction
+          arma::mat P1a(Cva*Sa*Coa.t());
+          P1a+=arma::trans(P1a);
+          arma::mat P1b;
+          if(same) {
+            P1b=P1a;
+          } else {
+            P1b=Cvb*Sb*Cob.t();
+            P1b+=arma::trans(P1b);
+          }
+
+          // and the Fock matrix change it causes
+          arma::mat Ga(basis.coulomb(P1a+P1b));
+          arma::mat Gb(Ga);
+          if(kfrac!=0.0 || kshort!=0.0) {
+            arma::mat Ka(arma::zeros<arma::mat>(Ga.n_rows,Ga.n_cols)), Kb(arma::zeros<arma::mat>(Ga.n_rows,Ga.n_cols));
+            if(same) {
+            if(kfrac!=0.0)
+              Ka+=kfrac*basis.exchange(P1a);
+            if(omega!=0.0)
+              Ka+=kshort*basis.rs_exchange(P1a);
+              Kb=Ka;
+            } else {
+              // Contract both spin densities in a single pass
+              std::vector<arma::mat> Pab(2);
+              Pab[0]=P1a;
+              Pab[1]=P1b;
+              if(kfrac!=0.0) {
+                std::vector<arma::mat> Kab(basis.exchange(Pab));
+                Ka+=kfrac*Kab[0];
+                Kb+=kfrac*Kab[1];
+              }
+              if(omega!=0.0) {
+                std::vector<arma::mat> Kab(basis.rs_exchange(Pab));
+                Ka+=kshort*Kab[0];
+                Kb+=kshort*Kab[1];
+              }
+            }
+            Ga+=Ka;
+            Gb+=Kb;
+          }
+          if(dft) {
+            // The exchange-correlation kernel is applied by central differences of the potential
+            double h(1e-4/std::max(1.0,arma::abs(P1a+P1b).max()));
+            double Exc0, nel0, ekin0;
+            arma::mat XCap, XCbp, XCam, XCbm;
+            if(same) {
+              grid.eval_Fxc(x_func, xpars, c_func, cpars, P+h*(P1a+P1b), XCap, Exc0, nel0, ekin0, dftthr);
+              grid.eval_Fxc(x_func, xpars, c_func, cpars, P-h*(P1a+P1b), XCam, Exc0, nel0, ekin0, dftthr);
+              XCbp=XCap;
+              XCbm=XCam;
+            } else {
+              grid.eval_Fxc(x_func, xpars, c_func, cpars, Pa+h*P1a, Pb+h*P1b, XCap, XCbp, Exc0, nel0, ekin0, nelb>0, dftthr);
+              grid.eval_Fxc(x_func, xpars, c_func, cpars, Pa-h*P1a, Pb-h*P1b, XCam, XCbm, Exc0, nel0, ekin0, nelb>0, dftthr);
+            }
+            Ga+=(XCap-XCam)/(2.0*h);
+            if(nelb)
+              Gb+=(XCbp-XCbm)/(2.0*h);
+          }
+
+          // Apply the orbital Hessian
+          arma::mat Aa(Da%Sa + Cva.t()*Ga*Coa);
+          arma::mat Ab;
+          if(!same)
+            Ab=Db%Sb + Cvb.t()*Gb*Cob;
+          double sAs(arma::dot(Sa,Aa)+(same ? 0.0 : arma::dot(Sb,Ab)));
+          double step(rz/sAs);
+
+          Ua+=step*Sa;
+          Ra-=step*Aa;
+          if(!same) {
+            Ub+=step*Sb;
+            Rb-=step*Ab;
+          }
+          rnorm=std::sqrt(arma::dot(Ra,Ra)+(same ? 0.0 : arma::dot(Rb,Rb)));
+          printf("Response iteration %3i: residual norm %e\n",iresp,rnorm);
+          fflush(stdout);
+          if(rnorm<respthr)
+            break;
+
+          // New search direction
+          Za=Ra/Da;
+          if(!same)
+            Zb=Rb/Db;
+          double rznew(arma::dot(Ra,Za)+(same ? 0.0 : arma::dot(Rb,Zb)));
+          Sa=Za+(rznew/rz)*Sa;
+          if(!same)
+            Sb=Zb+(rznew/rz)*Sb;
+          rz=rznew;
+        }
+        if(rnorm>=respthr)
+          printf("Warning - response equations did not converge in %i iterations!\n",maxit);
+
+        // First-order density
+        arma::mat P1a(Cva*Ua*Coa.t());
+        P1a+=arma::trans(P1a);
+        arma::mat P1b;
+        if(same) {
+          P1b=P1a;
+        } else {
+          P1b=Cvb*Ub*Cob.t();
+          P1b+=arma::trans(P1b);
+        }
+        result.alpha_zz=-scf::trace_symm(dip,arma::mat(P1a+P1b));
+        printf("\nStatic dipole polarizability alpha_zz % .16e\n",result.alpha_zz);
+        printf("Response equations solved in %.6f\n",tresp.get());
+      }
+
+      if(tdsteps>0) {
+        // Real-time propagation of the occupied orbitals. The orbitals
+        // are propagated in the orthonormal basis with the midpoint
+        // Fock matrix extrapolated from the last two steps, so every
+        // step takes a single Fock build
+        profiler::Region ptd("Propagation");
+        Timer ttd;
+        if(result.Ca.n_cols < (arma::uword) nela || result.Cb.n_cols < (arma::uword) nelb)
+          throw std::logic_error("Missing occupied orbitals for the propagation.\n");
+        // Closed-shell systems only need the alpha spin
+        const bool same(restr && nela==nelb);
+        basis.set_screening(0.0);
+        if(dft)
+          grid.set_screening(false);
+
+        // Absorbing potential
+        arma::mat W;
+        if(tdcap!=0.0) {
+          double R0(tdcapr>0.0 ? tdcapr : 0.8*setup.Rmax);
+          W=basis.absorbing_potential(R0);
+          printf("Absorbing potential of strength %e beyond r = %.6f\n",tdcap,R0);
+        }
+
+        // The field along z conserves m, so the orthonormal basis is
+        // split in m blocks, within which the orbitals stay
+        std::vector<arma::uvec> tdblk;
+        if(symm) {
+          std::vector<arma::uvec> midx(basis.get_sym_idx(1));
+          std::vector< std::vector<arma::uword> > cols(midx.size());
+          for(size_t c=0;c<Sinvh.n_cols;c++) {
+            arma::vec col(Sinvh.col(c));
+            size_t ib(0);
+            double nb(-1.0);
+            for(size_t b=0;b<midx.size();b++) {
+              double n(arma::norm(col.elem(midx[b]),2));
+              if(n>nb) {
+                nb=n;
+                ib=b;
+              }
+            }
+            cols[ib].push_back(c);
+          }
+          for(size_t b=0;b<cols.size();b++)
+            if(cols[b].size())
+              tdblk.push_back(arma::uvec(cols[b]));
+        } else {
+          tdblk.push_back(arma::linspace<arma::uvec>(0,Sinvh.n_cols-1,Sinvh.n_cols));
+        }
+        std::vector<arma::cx_mat> Xblk(tdblk.size());
+        for(size_t b=0;b<tdblk.size();b++)
+          Xblk[b]=arma::conv_to<arma::cx_mat>::from(arma::mat(Sinvh.cols(tdblk[b])));
+        printf("Propagating in %i blocks of the orthonormal basis\n",(int) tdblk.size());
+
+        // Orbitals in the orthonormal basis, and the blocks they are in
+        auto td_orbitals = [&](const arma::mat & C, std::vector<arma::uvec> & oblk) {
+          arma::mat c(Sinvh.t()*S*C);
+          std::vector< std::vector<arma::uword> > list(tdblk.size());
+          for(size_t io=0;io<c.n_cols;io++) {
+            size_t ib(0);
+            double nb(-1.0);
+            for(size_t b=0;b<tdblk.size();b++) {
+              arma::vec col(c.col(io));
+              double n(arma::norm(col.elem(tdblk[b]),2));
+              if(n>nb) {
+                nb=n;
+                ib=b;
+              }
+            }
+            list[ib].push_back(io);
+          }
+          oblk.resize(tdblk.size());
+          for(size_t b=0;b<tdblk.size();b++)
+            oblk[b]=arma::uvec(list[b]);
+          return arma::cx_mat(arma::conv_to<arma::cx_mat>::from(c));
+        };
+        std::vector<arma::uvec> oblka, oblkb;
+        arma::cx_mat ca(td_orbitals(result.Ca.cols(0,nela-1),oblka)), cb;
+        if(nelb && !same)
+          cb=td_orbitals(result.Cb.cols(0,nelb-1),oblkb);
+
+        // Field-free Fock matrices of the complex densities. The
+        // densities are Hermitian, so the Coulomb and exchange-correlation
+        // potentials follow from the real part; exchange is linear, and
+        // the real and imaginary parts are contracted in one batch
+        const arma::cx_mat Sinvhc(arma::conv_to<arma::cx_mat>::from(Sinvh));
+        auto td_fock = [&](const arma::cx_mat & oa, const arma::cx_mat & ob, arma::cx_mat & Ga, arma::cx_mat & Gb, arma::mat & Ptot) {
+          arma::cx_mat Cao(Sinvhc*oa);
+          arma::cx_mat Pac(Cao*Cao.t());
+          arma::mat PaR(arma::real(Pac)), PaI(arma::imag(Pac)), PbR, PbI;
+          if(same) {
+            PbR=PaR;
+          } else if(nelb) {
+            arma::cx_mat Cbo(Sinvhc*ob);
+            arma::cx_mat Pbc(Cbo*Cbo.t());
+            PbR=arma::real(Pbc);
+            PbI=arma::imag(Pbc);
+          } else {
+            PbR.zeros(PaR.n_rows,PaR.n_cols);
+            PbI.zeros(PaR.n_rows,PaR.n_cols);
+          }
+          Ptot=PaR+PbR;
+
+          arma::mat J(basis.coulomb(Ptot));
+          arma::mat Fra(H0+J), Frb(H0+J);
+          arma::mat Fia(arma::zeros<arma::mat>(J.n_rows,J.n_cols)), Fib(Fia);
+          if(kfrac!=0.0 || kshort!=0.0) {
+            std::vector<arma::mat> Pk;
+            Pk.push_back(PaR);
+            Pk.push_back(PaI);
+            if(!same && nelb) {
+              Pk.push_back(PbR);
+              Pk.push_back(PbI);
+            }
+            for(int ik=0;ik<2;ik++) {
+              double kf(ik ? kshort : kfrac);
+              if(kf==0.0 || (ik && omega==0.0))
+                continue;
+              std::vector<arma::mat> K(ik ? basis.rs_exchange(Pk) : basis.exchange(Pk));
+              Fra+=kf*K[0];
+              Fia+=kf*K[1];
+              if(Pk.size()==4) {
+                Frb+=kf*K[2];
+                Fib+=kf*K[3];
+              } else if(same) {
+                Frb+=kf*K[0];
+                Fib+=kf*K[1];
+              }
+            }
+          }
+          if(dft) {
+            double Exc0, nel0, ekin0;
+            arma::mat XCa0, XCb0;
+            if(same) {
+              grid.eval_Fxc(x_func, xpars, c_func, cpars, Ptot, XCa0, Exc0, nel0, ekin0, dftthr);
+              Fra+=XCa0;
+              Frb+=XCa0;
+            } else {
+              grid.eval_Fxc(x_func, xpars, c_func, cpars, PaR, PbR, XCa0, XCb0, Exc0, nel0, ekin0, nelb>0, dftthr);
+              Fra+=XCa0;
+              if(nelb)
+                Frb+=XCb0;
+            }
+          }
+          if(Bz!=0.0) {
+            Fra-=Bz*S/2.0;
+            Frb+=Bz*S/2.0;
+          }
+          if(W.n_elem) {
+            Fia-=tdcap*W;
+            Fib-=tdcap*W;
+          }
+          Ga=arma::cx_mat(Fra,Fia);
+          Gb=arma::cx_mat(Frb,Fib);
+        };
+
+        // Field along z
+        const double Tpulse((tdcycles>0.0 && tdomega>0.0) ? 2.0*M_PI*tdcycles/tdomega : 0.0);
+        auto td_efield = [&](double t) {
+          if(tdomega==0.0)
+            return tdfield;
+          if(Tpulse>0.0)
+            return t<Tpulse ? tdfield*std::pow(std::sin(M_PI*t/Tpulse),2)*std::sin(tdomega*t) : 0.0;
+          return tdfield*std::sin(tdomega*t);
+        };
+
+        // Propagate the orbitals of every block
+        const arma::cx_mat dipc(arma::conv_to<arma::cx_mat>::from(dip));
+        auto td_step = [&](arma::cx_mat & c, const arma::cx_mat & F, const std::vector<arma::uvec> & oblk) {
+          int nsub(1);
+          for(size_t b=0;b<tdblk.size();b++) {
+            if(!oblk[b].n_elem)
+              continue;
+            arma::cx_mat Fb(Xblk[b].t()*F*Xblk[b]);
+            arma::cx_mat cblk(c.submat(tdblk[b],oblk[b]));
+            nsub=std::max(nsub,scf::expm_krylov(Fb,cblk,tddt,(size_t) std::max(tdkrylov,2),1e-12));
+            c.submat(tdblk[b],oblk[b])=cblk;
+          }
+          return nsub;
+        };
+
+        FILE *tdout=fopen(tdfile.c_str(),"w");
+        if(!tdout) {
+          std::ostringstream oss;
+          oss << "Error opening " << tdfile << " for writing!\n";
+          throw std::runtime_error(oss.str());
+        }
+        fprintf(tdout,"# time field dipole electrons\n");
+
+        arma::cx_mat Ga, Gb, Gaold, Gbold;
+        arma::mat Ptot;
+        td_fock(ca,cb,Ga,Gb,Ptot);
+        Gaold=Ga;
+        Gbold=Gb;
+        printf("\n%6s %12s %14s %22s %18s %s\n","step","time","field","dipole","electrons","substeps");
+        auto td_record = [&](int istep, int nsub) {
+          double t(istep*tddt);
+          double d(-scf::trace_symm(dip,Ptot));
+          double nel(scf::trace_symm(S,Ptot));
+          printf("%6i %12.6f % e % .15e %18.12f %i\n",istep,t,td_efield(t),d,nel,nsub);
+          fprintf(tdout,"% .10e % .10e % .16e % .16e\n",t,td_efield(t),d,nel);
+          fflush(stdout);
+        };
+        td_record(0,0);
+
+        for(int istep=1;istep<=tdsteps;istep++) {
+          double tmid((istep-0.5)*tddt);
+          arma::cx_mat ca0(ca), cb0(cb);
+
+          // Midpoint Fock matrices by linear extrapolation
+          arma::cx_mat Fa(1.5*Ga-0.5*Gaold+td_efield(tmid)*dipc), Fb;
+          int nsub(td_step(ca,Fa,oblka));
+          if(cb.n_elem) {
+            Fb=1.5*Gb-0.5*Gbold+td_efield(tmid)*dipc;
+            nsub=std::max(nsub,td_step(cb,Fb,oblkb));
+          }
+          Gaold=Ga;
+          Gbold=Gb;
+          td_fock(ca,cb,Ga,Gb,Ptot);
+
+          if(tdcorrector) {
+            // Repeat with the midpoint of the old and new Fock matrices
+            ca=ca0;
+            cb=cb0;
+            Fa=0.5*(Gaold+Ga)+td_efield(tmid)*dipc;
+            nsub=std::max(nsub,td_step(ca,Fa,oblka));
+            if(cb.n_elem) {
+              Fb=0.5*(Gbold+Gb)+td_efield(tmid)*dipc;
+              nsub=std::max(nsub,td_step(cb,Fb,oblkb));
+            }
+            td_fock(ca,cb,Ga,Gb,Ptot);
+          }
+          td_record(istep,nsub);
+        }
+        fclose(tdout);
+        printf("Real-time propagation of %i steps done in %.6f, results written to %s\n",tdsteps,ttd.get(),tdfile.c_str());
+      }
+
+      // Electron density at nucleus
+      if(Z!=0) {
+        double nanuc=basis.nuclear_density(Pa)(0);
+        double nbnuc=basis.nuclear_density(Pb)(0);
+        double nnuc=basis.nuclear_density(P)(0);
+
+        double dnanuc=basis.nuclear_density_gradient(Pa)(0);
+        double dnbnuc=basis.nuclear_density_gradient(Pb)(0);
+        double dnnuc=basis.nuclear_density_gradient(P)(0);
+
+        printf("Electron density          at nucleus % .10e % .10e % .10e\n",nanuc,nbnuc,nnuc);
+        printf("Electron density gradient at nucleus % .10e % .10e % .10e\n",dnanuc,dnbnuc,dnnuc);
+        printf("Cusp condition is %.10f\n",-1.0/(2*Z)*dnnuc/nnuc);
+      }
+
+      // Calculate <r^2> matrix
+      arma::mat rinvmat(basis.radial_integral(-1));
+      arma::mat rmat(basis.radial_integral(1));
+      arma::mat rsqmat(basis.radial_integral(2));
+      arma::mat rcbmat(basis.radial_integral(3));
+      // rms sizes
+      arma::vec rinva(arma::ones<arma::vec>(Caocc.n_cols)/arma::diagvec(arma::trans(Caocc)*rinvmat*Caocc));
+      arma::vec ra(arma::diagvec(arma::trans(Caocc)*rmat*Caocc));
+      arma::vec rmsa(arma::sqrt(arma::diagvec(arma::trans(Caocc)*rsqmat*Caocc)));
+      arma::vec rcba(arma::pow(arma::diagvec(arma::trans(Caocc)*rcbmat*Caocc),1.0/3.0));
+
+      arma::vec rinvb, rb, rmsb, rcbb;
+      if(nelb) {
+        rinvb=arma::ones<arma::vec>(Cbocc.n_cols)/arma::diagvec(arma::trans(Cbocc)*rinvmat*Cbocc);
+        rb=arma::diagvec(arma::trans(Cbocc)*rmat*Cbocc);
+        rmsb=arma::sqrt(arma::diagvec(arma::trans(Cbocc)*rsqmat*Cbocc));
+        rcbb=arma::pow(arma::diagvec(arma::trans(Cbocc)*rcbmat*Cbocc),1.0/3.0);
+      }
+
+      printf("\nOccupied orbital analysis:\n");
+      printf("Alpha orbitals\n");
+      printf("%2s %13s %12s %12s %12s %12s\n","io","energy","1/<r^-1>","<r>","sqrt(<r^2>)","cbrt(<r^3>)");
+      for(int io=0;io<nela;io++) {
+        printf("%2i % e %e %e %e %e\n",(int) io+1, Ea(io), rinva(io), ra(io), rmsa(io), rcba(io));
+      }
+      printf("Beta orbitals\n");
+      for(int io=0;io<nelb;io++) {
+        printf("%2i % e %e %e %e %e\n",(int) io+1, Eb(io), rinvb(io), rb(io), rmsb(io), rcbb(io));
+      }
+
+      /*
+      // Test orthonormality
+      arma::mat Smo(Ca.t()*S*Ca);
+      Smo-=arma::eye<arma::mat>(Smo.n_rows,Smo.n_cols);
+      printf("Alpha orthonormality deviation is %e\n",arma::norm(Smo,"fro"));
+      Smo=(Cb.t()*S*Cb);
+      Smo-=arma::eye<arma::mat>(Smo.n_rows,Smo.n_cols);
+      printf("Beta orthonormality deviation is %e\n",arma::norm(Smo,"fro"));
+      */
+
+      return Etot;
+    }
+
+    const scf_result_t & Driver::get_result() const {
+      return result;
+    }
+
+    void Driver::set_result(const scf_result_t & res) {
+      result=res;
+    }
+
+    const basis::TwoDBasis & Driver::get_basis() const {
+      return setup.basis;
+    }
+
+    const arma::mat & Driver::get_overlap() const {
+      return setup.matrices.get("S");
+    }
+  }
+}
@@ -0,0 +1,160 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+
+#ifndef ATOMIC_DRIVER_H
+#define ATOMIC_DRIVER_H
+
+#include "../general/cmdline.h"
+#include "../general/matrixstore.h"
+#include "basis.h"
+#include "dftgrid.h"
+#include <future>
+#include <string>
+#include <vector>
+
+namespace helfem {
+  namespace atomic {
+    /// Results of a self-consistent field calculation
+    typedef struct {
+      /// Total energy
+      double Etot;
+      /// Did the calculation converge?
+      bool converged;
+      /// Orbital energies
+      arma::vec Ea, Eb;
+      /// Orbital coefficients
+      arma::mat Ca, Cb;
+      /// Density matrices
+      arma::mat Pa, Pb;
+      /// Electronic dipole and quadrupole moments
+      double eldip, elquad;
+      /// Static dipole polarizability, if it was computed
+      double alpha_zz;
+    } scf_result_t;
+
+    /**
+     * Self-consistent field driver. The basis set and the integrals
+     * are formed once in the constructor and kept in memory, so any
+     * number of calculations can be run in them without file I/O.
+     * The calculations are specified with the same options as the
+     * atomic program; an empty save option disables checkpointing.
+     */
+    class Driver {
+      /// Basis set and integrals shared by all calculations
+      typedef struct {
+        /// Basis set, including the two-electron integrals
+        atomic::basis::TwoDBasis basis;
+        /// Nuclear charges
+        int Z, Zl, Zr;
+        /// Distance of the off-center nuclei from the center
+        double Rhalf;
+        /// Nuclear repulsion energy
+        double Enucr;
+        /// Practical infinity and number of radial elements
+        double Rmax;
+        int Nelem;
+        /// Angular basis
+        int lmax, mmax;
+        /// Exact diagonalization?
+        bool diag;
+        /// Symmetry the half-inverse overlap was formed in
+        int symm;
+
+        /// Overlap (S), kinetic (T), nuclear attraction (Vnuc), dipole (dip) and quadrupole (quad) matrices, formed on first access
+        MatrixStore matrices;
+        /// Half-inverse and half overlap matrices
+        arma::mat Sinvh, Sh;
+        /// Angular quantum numbers of the shells and their indices
+        arma::ivec lvals, mvals;
+        std::vector<arma::uvec> lmidx;
+        /// Indices of the m channels of every l, for m averaging
+        std::vector< std::vector<arma::uvec> > l_idx;
+
+        /// DFT grid, formed when first needed
+        helfem::atomic::dftgrid::DFTGrid grid;
+        bool have_grid;
+        int ldft, mdft;
+        double dftcache;
+
+        /// Range-separated integrals in the basis: 0 for none, 1 for erfc, 2 for Yukawa
+        int rs_kernel;
+        /// and their range-separation parameter
+        double rs_omega;
+        /// Screening threshold for the range-separated integrals
+        double rsthr;
+        /// Cache file for the two-electron integrals
+        std::string teicache;
+        /// Print out the load balance of the integrals?
+        bool verbose;
+
+        /// Length of the DIIS history from the memory plan, 0 if not planned
+        int plan_diisorder;
+      } setup_t;
+      setup_t setup;
+      /// Results of the last calculation
+      scf_result_t result;
+      /// Two-electron integrals being formed in the background
+      std::future<void> teijob;
+      /// and the time it took to form them
+      double teitime;
+
+      /// Form the DFT grid unless it already exists
+      void form_grid();
+      /// Compute or read in the primitive two-electron integrals
+      void build_tei();
+      /// Make sure the basis holds the primitive two-electron integrals
+      void form_tei();
+      /// Start forming the primitive two-electron integrals in the background
+      void start_tei();
+      /// Wait for the integrals started in the background, if any
+      void wait_tei();
+      /// Name of the guess potential in the matrix store
+      static std::string guess_entry(int iguess);
+      /// Form the guess potential: 0 for the bare nucleus, 1 for GSZ, 2 for SAP, 3 for Thomas-Fermi. The matrix is cached in the integral cache, if there is one
+      arma::mat guess_potential(int iguess) const;
+      /// Make sure the basis holds the range-separated integrals for the kernel
+      void form_rs_tei(bool yukawa, bool erfc, double omega);
+
+    public:
+      /// Declare the options of the calculation
+      static void add_options(cmdline::parser & parser);
+      /// Check whether the options, starting at index istart, change the basis set; the offending option is returned in name
+      static bool changes_basis(const std::vector<std::string> & args, size_t istart, std::string & name);
+
+      /// Constructor, forms the basis set and the integrals. The element boundaries bval replace the grid given by the options, unless empty
+      Driver(const cmdline::parser & parser, const arma::vec & bval=arma::vec());
+      /// Destructor
+      ~Driver();
+      /// The DFT grid points to the basis set, so the driver can't be copied
+      Driver(const Driver & rhs) = delete;
+      Driver & operator=(const Driver & rhs) = delete;
+
+      /// Run a calculation, returns the total energy. With restart, the calculation starts from the orbitals of the last one
+      double run(const cmdline::parser & parser, bool restart=false);
+      /// Get the results of the last calculation
+      const scf_result_t & get_result() const;
+      /// Replace the results of the last calculation, which the next restarted calculation starts from
+      void set_result(const scf_result_t & res);
+
+      /// Get the basis set
+      const basis::TwoDBasis & get_basis() const;
+      /// Get the overlap matrix
+      const arma::mat & get_overlap() const;
+    };
+  }
+}
+
+#endif
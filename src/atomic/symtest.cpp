@@ -0,0 +1,81 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#include "../general/model_potential.h"
+#include "../general/scf_helpers.h"
+#include "basis.h"
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+
+using namespace helfem;
+
+/**
+ * Test of the symmetry-blocked eigensolver: the blocks with negative
+ * m reuse the eigenvectors of their +m partners, which has to give
+ * the same eigenpairs as solving every block.
+ */
+
+/// Solve the core Hamiltonian with and without mirroring, returns the largest deviation
+static double compare(const atomic::basis::TwoDBasis & basis, bool chol, int symm) {
+  arma::mat S(basis.overlap());
+  arma::mat H(basis.kinetic()+basis.nuclear());
+  arma::mat Sinvh(basis.Sinvh(chol,symm));
+  std::vector<arma::uvec> idx(basis.get_sym_idx(symm));
+  std::vector<arma::uvec> cols(scf::block_columns(idx));
+  arma::ivec mirror(basis.get_sym_mirror(symm));
+
+  arma::vec E, Em;
+  arma::mat C, Cm;
+  scf::eig_gsym_sub(E,C,H,Sinvh,idx,cols,arma::ivec(),false);
+  scf::eig_gsym_sub(Em,Cm,H,Sinvh,idx,cols,mirror,false);
+
+  // Same energies, and the mirrored vectors are orthonormal
+  // eigenvectors; the energies span orders of magnitude, so the
+  // deviations are relative to the largest one
+  double Emax(std::max(1.0,arma::abs(E).max()));
+  double dE(arma::abs(E-Em).max()/Emax);
+  double res(arma::abs(H*Cm-S*Cm*arma::diagmat(Em)).max()/Emax);
+  double orth(arma::abs(Cm.t()*S*Cm-arma::eye<arma::mat>(Cm.n_cols,Cm.n_cols)).max());
+  printf("chol=%i symm=%i: %i mirrored blocks, energy difference %e, residual %e, orthonormality %e\n",(int) chol,symm,(int) arma::sum(mirror>=0),dE,res,orth);
+
+  return std::max(dE,std::max(res,orth));
+}
+
+int main(int argc, char **argv) {
+  (void) argc;
+  (void) argv;
+
+  const int Z=10;
+  const int lmax=3;
+  const int mmax=2;
+  auto poly(std::shared_ptr<const polynomial_basis::PolynomialBasis>(polynomial_basis::get_basis(4,10)));
+  arma::vec bval(atomic::basis::normal_grid(5,40.0,4,2.0));
+  arma::ivec lval, mval;
+  atomic::basis::angular_basis(lmax,mmax,lval,mval);
+  atomic::basis::TwoDBasis basis(Z, modelpotential::POINT_NUCLEUS, 0.0, poly, false, 5*poly->get_nbf(), bval, poly->get_nprim()-1, lval, mval, 0, 0, 0.0);
+
+  double maxdiff=0.0;
+  for(int chol=0;chol<2;chol++)
+    for(int symm=1;symm<=2;symm++)
+      maxdiff=std::max(maxdiff,compare(basis,chol,symm));
+
+  if(maxdiff>1e-8) {
+    printf("Mirrored and unmirrored eigenpairs differ by %e!\n",maxdiff);
+    return 1;
+  }
+  printf("Mirrored and unmirrored eigenpairs agree.\n");
+  return 0;
+}
@@ -22,6 +22,11 @@
 #include "../general/gsz.h"
 #include "utils.h"
 #include "../general/timer.h"
+#include "../general/profiler.h"
+#include "../general/memtrack.h"
+#include "../general/numa.h"
+#include "../general/threads.h"
+#include "../general/mpi_helpers.h"
 #include "../general/scf_helpers.h"
 #include <algorithm>
 #include <cassert>
@@ -46,6 +51,9 @@ namespace helfem {
           if(!std::isfinite(wq[i]))
             printf("wq[%i]=%e\n",(int) i, wq[i]);
         }
+        // The basis functions are always evaluated at the same nodes
+        fem.tabulate(xq, 2);
+        fem.tabulate_subintervals(xq);
       }
 
       RadialBasis::~RadialBasis() {
@@ -90,15 +98,20 @@ namespace helfem {
       }
 
       arma::mat RadialBasis::radial_integral(int m, int n) const {
-        std::function<double(double)> chsh;
+        polynomial_basis::vectorized_weight_t chsh;
         if(m!=0 && n!=0) {
-          chsh = [m, n](double mu) { return std::pow(std::sinh(mu), m)*std::pow(std::cosh(mu), n); };
+          chsh = [m, n](const arma::vec & mu) { return arma::vec(arma::pow(arma::sinh(mu), m)%arma::pow(arma::cosh(mu), n)); };
         } else if(m!=0 && n==0) {
-          chsh = [m](double mu) { return std::pow(std::sinh(mu), m); };
+          chsh = [m](const arma::vec & mu) { return arma::vec(arma::pow(arma::sinh(mu), m)); };
         } else if(m==0 && n!=0) {
-          chsh = [n](double mu) { return std::pow(std::cosh(mu), n); };
+          chsh = [n](const arma::vec & mu) { return arma::vec(arma::pow(arma::cosh(mu), n)); };
         }
-        return fem.matrix_element(false, false, xq, wq, chsh);
+        return fem.matrix_element_vectorized(false, false, xq, wq, chsh);
+      }
+
+      arma::mat RadialBasis::kinetic() const {
+        std::function<double(double)> sinhmu = [](double mu) {return std::sinh(mu);};
+        return fem.matrix_element(true, true, xq, wq, sinhmu);
       }
 
       arma::mat RadialBasis::overlap(const RadialBasis & rh, int n) const {
@@ -190,38 +203,32 @@ namespace helfem {
         return S;
       }
 
-      arma::mat RadialBasis::Plm_integral(int k, size_t iel, int L, int M, const legendretable::LegendreTable & legtab) const {
-        std::function<double(double)> Plm;
-        if(k!=0) {
-          Plm = [legtab, k, L, M](double mu) { return std::sinh(mu)*std::pow(std::cosh(mu), k)*legtab.get_Plm(L,M,cosh(mu)); };
-        } else {
-          Plm = [legtab, L, M](double mu) { return std::sinh(mu)*legtab.get_Plm(L,M,cosh(mu)); };
-        }
-        return fem.matrix_element(iel, false, false, xq, wq, Plm);
+      arma::vec RadialBasis::get_chmu(size_t iel) const {
+        return arma::cosh(fem.eval_coord(xq, iel));
       }
 
-      arma::mat RadialBasis::Qlm_integral(int k, size_t iel, int L, int M, const legendretable::LegendreTable & legtab) const {
-        std::function<double(double)> Qlm;
-        if(k!=0) {
-          Qlm = [legtab, k, L, M](double mu) { return std::sinh(mu)*std::pow(std::cosh(mu), k)*legtab.get_Qlm(L,M,cosh(mu)); };
-        } else {
-          Qlm = [legtab, L, M](double mu) { return std::sinh(mu)*legtab.get_Qlm(L,M,cosh(mu)); };
-        }
-        return fem.matrix_element(iel, false, false, xq, wq, Qlm);
+      arma::mat RadialBasis::legendre_integral(int k, size_t iel, const arma::vec & flm) const {
+        arma::vec mu(fem.eval_coord(xq, iel));
+        arma::vec fq(arma::sinh(mu)%flm);
+        if(k!=0)
+          fq%=arma::pow(arma::cosh(mu),k);
+        return fem.matrix_element_weighted(iel, false, false, xq, wq, fq);
       }
 
-      arma::mat RadialBasis::kinetic() const {
-        std::function<double(double)> sinhmu = [](double mu) {return std::sinh(mu);};
-        return fem.matrix_element(true, true, xq, wq, sinhmu);
+      arma::mat RadialBasis::Plm_integral(int k, size_t iel, int L, int M, const legendretable::LegendreTable & legtab) const {
+        return legendre_integral(k, iel, legtab.get_Plm(L,M,get_chmu(iel)));
+      }
+
+      arma::mat RadialBasis::Qlm_integral(int k, size_t iel, int L, int M, const legendretable::LegendreTable & legtab) const {
+        return legendre_integral(k, iel, legtab.get_Qlm(L,M,get_chmu(iel)));
       }
 
       arma::mat RadialBasis::twoe_integral(int alpha, int beta, size_t iel, int L, int M, const legendretable::LegendreTable & legtab) const {
         double mumin=fem.element_begin(iel);
         double mumax=fem.element_end(iel);
 
-        // Integral by quadrature
-        std::shared_ptr<const helfem::polynomial_basis::PolynomialBasis> p(fem.get_basis(iel));
-        arma::mat tei(quadrature::twoe_integral(mumin,mumax,alpha,beta,xq,wq,p,L,M,legtab));
+        // Integral by quadrature, with the tabulated functions
+        arma::mat tei(quadrature::twoe_integral(mumin,mumax,alpha,beta,xq,wq,fem.eval_f(xq,iel),fem.eval_subinterval_f(xq,iel),L,M,legtab));
 
         return tei;
       }
@@ -301,14 +308,18 @@ namespace helfem {
         }
       }
 
-      TwoDBasis::TwoDBasis() {
+      TwoDBasis::TwoDBasis() : tei_storage(scratch::TEI_INCORE), tei_budget(0), tei_ncache(0), tei_ndom(0), screen_thr(10*DBL_EPSILON), coulomb_nactive(0), coulomb_ntot(0) {
+        lpad=0;
+        lpadthr=0.0;
       }
 
-      TwoDBasis::TwoDBasis(int Z1_, int Z2_, double Rhalf_, const std::shared_ptr<const polynomial_basis::PolynomialBasis> &poly, int n_quad, const arma::vec & bval, const arma::ivec & lval_, const arma::ivec & mval_, int lpad, bool legendre) {
+      TwoDBasis::TwoDBasis(int Z1_, int Z2_, double Rhalf_, const std::shared_ptr<const polynomial_basis::PolynomialBasis> &poly, int n_quad, const arma::vec & bval, const arma::ivec & lval_, const arma::ivec & mval_, int lpad_, bool legendre, double lpadthr_) : tei_storage(scratch::TEI_INCORE), tei_budget(0), tei_ncache(0), tei_ndom(0), screen_thr(10*DBL_EPSILON), coulomb_nactive(0), coulomb_ntot(0) {
         // Nuclear charge
         Z1=Z1_;
         Z2=Z2_;
         Rhalf=Rhalf_;
+        lpad=lpad_;
+        lpadthr=lpadthr_;
 
         // Construct radial basis
         bool zero_func_left=false; // sigma orbitals are allowed to reach the nucleus; this is cleaned up for non-sigma orbitals elsewhere in the code
@@ -320,6 +331,7 @@ namespace helfem {
         // Angular basis
         lval=lval_;
         mval=mval_;
+        form_pure_offsets();
 
         // Gaunt coefficients
         int gmax(arma::max(lval)+2);
@@ -394,11 +406,11 @@ namespace helfem {
           fflush(stdout);
 
           // Fill table with necessary values
-          legtab=legendretable::LegendreTable(Lmax+lpad,Lmax,Mmax);
-          arma::vec chmu(radial.get_chmu_quad());
-          for(size_t i=0;i<chmu.n_elem;i++)
-            legtab.compute(chmu(i));
+          legtab=legendretable::LegendreTable(Lmax+lpad,Lmax,Mmax,lpadthr);
+          legtab.compute(radial.get_chmu_quad());
           printf("done (% .3f s)\n",t.get());
+          if(lpadthr>0.0)
+            printf("Legendre padding chosen automatically, largest padding is %i\n",legtab.get_padding());
           fflush(stdout);
 
         } else {
@@ -426,6 +438,10 @@ namespace helfem {
         return Rhalf;
       }
 
+      void TwoDBasis::set_Rhalf(double Rhalf_) {
+        Rhalf=Rhalf_;
+      }
+
       arma::ivec TwoDBasis::get_lval() const {
         return lval;
       }
@@ -454,6 +470,26 @@ namespace helfem {
         return radial.get_poly_nnodes();
       }
 
+      std::string TwoDBasis::tei_fingerprint() const {
+        // Parameters that determine the radial integrals; Rhalf only
+        // enters as an overall prefactor
+        arma::vec par(4+2*lm_map.size());
+        par(0)=get_poly_id();
+        par(1)=get_poly_nnodes();
+        par(2)=get_nquad();
+        par(3)=lpad;
+        for(size_t ilm=0;ilm<lm_map.size();ilm++) {
+          par(4+2*ilm)=lm_map[ilm].first;
+          par(5+2*ilm)=lm_map[ilm].second;
+        }
+        // The automatic padding is only recorded when it is used, so
+        // that the old caches stay valid
+        if(lpadthr>0.0)
+          par=arma::join_cols(par,arma::vec({lpadthr}));
+
+        return "diatomic_" + utils::hash_data(arma::join_cols(par,get_bval()));
+      }
+
       size_t TwoDBasis::Ndummy() const {
         return lval.n_elem*radial.Nbf();
       }
@@ -587,6 +623,89 @@ namespace helfem {
         return idx;
       }
 
+      arma::ivec TwoDBasis::shell_mirror() const {
+        arma::ivec mirror(lval.n_elem);
+        mirror.fill(-1);
+        for(size_t iang=0;iang<lval.n_elem;iang++)
+          for(size_t jang=0;jang<lval.n_elem;jang++)
+            if(lval(jang)==lval(iang) && mval(jang)==-mval(iang)) {
+              mirror(iang)=jang;
+              break;
+            }
+        return mirror;
+      }
+
+      arma::uvec TwoDBasis::mirror_indices() const {
+        arma::ivec mirror(shell_mirror());
+        if(arma::any(mirror<0))
+          return arma::uvec();
+
+        // The shells that are related by m -> -m have the same number
+        // of functions in the pure layout
+        arma::uvec perm(Nbf());
+        for(size_t iang=0;iang<lval.n_elem;iang++) {
+          size_t nsh(radial.Nbf()-pure_first(iang));
+          for(size_t k=0;k<nsh;k++)
+            perm(pure_offset(iang)+k)=pure_offset(mirror(iang))+k;
+        }
+        return perm;
+      }
+
+      arma::ivec TwoDBasis::get_sym_mirror(int symm) const {
+        std::vector<arma::uvec> idx(get_sym_idx(symm));
+        arma::ivec mirror(idx.size());
+        mirror.fill(-1);
+
+        arma::uvec perm(mirror_indices());
+        if(!perm.n_elem)
+          return mirror;
+
+        // Symmetry block of every basis function
+        arma::uvec block(Nbf());
+        for(size_t isym=0;isym<idx.size();isym++)
+          block(idx[isym]).fill(isym);
+
+        for(size_t isym=0;isym<idx.size();isym++) {
+          if(!idx[isym].n_elem)
+            continue;
+          size_t jsym(block(perm(idx[isym](0))));
+          // The first block of the pair is solved
+          if(jsym<isym && idx[jsym].n_elem==idx[isym].n_elem)
+            mirror(isym)=jsym;
+        }
+        return mirror;
+      }
+
+      bool TwoDBasis::mirror_symmetric(const std::vector<arma::mat> & P) const {
+        arma::uvec perm(mirror_indices());
+        if(!perm.n_elem)
+          return false;
+        for(size_t id=0;id<P.size();id++) {
+          double thr(100*DBL_EPSILON*std::max(1.0,arma::abs(P[id]).max()));
+          if(arma::abs(P[id]-P[id](perm,perm)).max()>thr)
+            return false;
+        }
+        return true;
+      }
+
+      bool TwoDBasis::mirror_canonical(size_t jang, size_t kang) const {
+        return mval(jang)>0 || (mval(jang)==0 && mval(kang)>=0);
+      }
+
+      void TwoDBasis::mirror_fill(std::vector<arma::mat> & K) const {
+        arma::ivec mirror(shell_mirror());
+        size_t Nrad(radial.Nbf());
+        for(size_t jang=0;jang<lval.n_elem;jang++)
+          for(size_t kang=0;kang<lval.n_elem;kang++) {
+            if(mirror_canonical(jang,kang))
+              continue;
+            size_t jm(mirror(jang)), km(mirror(kang));
+            size_t nj(Nrad-pure_first(jang)), nk(Nrad-pure_first(kang));
+            for(size_t id=0;id<K.size();id++)
+              K[id].submat(pure_offset(jang),pure_offset(kang),pure_offset(jang)+nj-1,pure_offset(kang)+nk-1)=K[id].submat(pure_offset(jm),pure_offset(km),pure_offset(jm)+nj-1,pure_offset(km)+nk-1);
+          }
+      }
+
       arma::mat TwoDBasis::Shalf(bool chol, int sym) const {
         // Form overlap matrix
         arma::mat S(overlap());
@@ -602,18 +721,16 @@ namespace helfem {
           // Half-inverse is
           return arma::diagmat(bfinvnormlz) * arma::chol(S);
 
+        } else if(sym) {
+          // S is block diagonal in the symmetries
+          return arma::diagmat(bfinvnormlz)*scf::form_Shalf(S,get_sym_idx(sym));
+
         } else {
           arma::vec Sval;
           arma::mat Svec;
-          if(sym) {
-            // Symmetries
-            std::vector<arma::uvec> midx(get_sym_idx(sym));
-            scf::eig_sym_sub(Sval,Svec,S,midx);
-          } else {
-            if(!arma::eig_sym(Sval,Svec,S)) {
-              S.save("S.dat",arma::raw_ascii);
-              throw std::logic_error("Diagonalization of overlap matrix failed\n");
-            }
+          if(!arma::eig_sym(Sval,Svec,S)) {
+            S.save("S.dat",arma::raw_ascii);
+            throw std::logic_error("Diagonalization of overlap matrix failed\n");
           }
           printf("Smallest eigenvalue of overlap matrix is % e, condition number %e\n",Sval(0),Sval(Sval.n_elem-1)/Sval(0));
 
@@ -632,35 +749,77 @@ namespace helfem {
         if(sym==0) {
           return scf::form_Sinvh(S,chol);
         } else {
-          // Get basis function indices
-          std::vector<arma::uvec> midx(get_sym_idx(sym));
-          // Construct Sinvh in each subblock
-          arma::mat Sinvh(Nbf(),Nbf(),arma::fill::zeros);
-          size_t ioff=0;
-          for(size_t i=0;i<midx.size();i++) {
-            if(!midx[i].n_elem)
-              continue;
+          // Construct Sinvh in each subblock; the columns of the blocks
+          // are given by scf::block_columns
+          return scf::form_Sinvh(S,get_sym_idx(sym),chol);
+        }
+      }
 
-            // Column indices
-            arma::uvec cidx(arma::linspace<arma::uvec>(ioff,ioff+midx[i].n_elem-1,midx[i].n_elem));
-            Sinvh(midx[i],cidx)=scf::form_Sinvh(S(midx[i],midx[i]),chol);
-            // Increment offset
-            ioff += midx[i].n_elem;
-          }
-          return Sinvh;
+      void TwoDBasis::form_pure_offsets() {
+        pure_offset.zeros(lval.n_elem);
+        size_t ioff=0;
+        for(size_t iang=0;iang<lval.n_elem;iang++) {
+          pure_offset(iang)=ioff;
+          ioff+=radial.Nbf()-pure_first(iang);
+        }
+      }
+
+      size_t TwoDBasis::pure_first(size_t iang) const {
+        // The first function is dropped for m!=0
+        return (mval(iang)==0) ? 0 : 1;
+      }
+
+      arma::mat TwoDBasis::get_pure_sub(const arma::mat & M, size_t iang, size_t jang, size_t rfirst, size_t rlast, size_t cfirst, size_t clast) const {
+        arma::mat Msub(rlast-rfirst+1,clast-cfirst+1,arma::fill::zeros);
+        size_t r0(std::max(rfirst,pure_first(iang)));
+        size_t c0(std::max(cfirst,pure_first(jang)));
+        if(r0<=rlast && c0<=clast) {
+          size_t ioff(pure_offset(iang)-pure_first(iang));
+          size_t joff(pure_offset(jang)-pure_first(jang));
+          Msub.submat(r0-rfirst,c0-cfirst,rlast-rfirst,clast-cfirst)=M.submat(ioff+r0,joff+c0,ioff+rlast,joff+clast);
+        }
+        return Msub;
+      }
+
+      void TwoDBasis::add_pure_sub(arma::mat & M, size_t iang, size_t jang, size_t rfirst, size_t cfirst, const arma::mat & Msub) const {
+        size_t rlast(rfirst+Msub.n_rows-1);
+        size_t clast(cfirst+Msub.n_cols-1);
+        size_t r0(std::max(rfirst,pure_first(iang)));
+        size_t c0(std::max(cfirst,pure_first(jang)));
+        if(r0<=rlast && c0<=clast) {
+          size_t ioff(pure_offset(iang)-pure_first(iang));
+          size_t joff(pure_offset(jang)-pure_first(jang));
+          M.submat(ioff+r0,joff+c0,ioff+rlast,joff+clast)+=Msub.submat(r0-rfirst,c0-cfirst,rlast-rfirst,clast-cfirst);
         }
       }
 
       void TwoDBasis::set_sub(arma::mat & M, size_t iang, size_t jang, const arma::mat & Mrad) const {
-        M.submat(iang*radial.Nbf(),jang*radial.Nbf(),(iang+1)*radial.Nbf()-1,(jang+1)*radial.Nbf()-1)=Mrad;
+        size_t Nrad(radial.Nbf());
+        size_t fi(pure_first(iang)), fj(pure_first(jang));
+        M.submat(pure_offset(iang),pure_offset(jang),pure_offset(iang)+Nrad-fi-1,pure_offset(jang)+Nrad-fj-1)=Mrad.submat(fi,fj,Nrad-1,Nrad-1);
       }
 
       void TwoDBasis::add_sub(arma::mat & M, size_t iang, size_t jang, const arma::mat & Mrad) const {
-        M.submat(iang*radial.Nbf(),jang*radial.Nbf(),(iang+1)*radial.Nbf()-1,(jang+1)*radial.Nbf()-1)+=Mrad;
+        add_pure_sub(M,iang,jang,0,0,Mrad);
       }
 
       arma::mat TwoDBasis::get_sub(const arma::mat & M, size_t iang, size_t jang) const {
-        return M.submat(iang*radial.Nbf(),jang*radial.Nbf(),(iang+1)*radial.Nbf()-1,(jang+1)*radial.Nbf()-1);
+        return get_pure_sub(M,iang,jang,0,radial.Nbf()-1,0,radial.Nbf()-1);
+      }
+
+      const arma::mat & TwoDBasis::radial_matrix(int m, int n) const {
+        std::pair<int,int> key(m,n);
+        const arma::mat * ret;
+#ifdef _OPENMP
+#pragma omp critical(diatomic_radial_matrix)
+#endif
+        {
+          auto it(radint_cache.find(key));
+          if(it == radint_cache.end())
+            it=radint_cache.insert(std::make_pair(key,radial.radial_integral(m,n))).first;
+          ret=&(it->second);
+        }
+        return *ret;
       }
 
       arma::mat TwoDBasis::radial_integral(int Rexp) const {
@@ -676,18 +835,20 @@ namespace helfem {
 
       arma::mat TwoDBasis::overlap() const {
         // Build radial matrix elements
-        arma::mat I10(radial.radial_integral(1,0));
-        arma::mat I12(radial.radial_integral(1,2));
+        const arma::mat & I10(radial_matrix(1,0));
+        const arma::mat & I12(radial_matrix(1,2));
 
         // Full overlap matrix
-        arma::mat S(Ndummy(),Ndummy());
+        arma::mat S(Nbf(),Nbf());
         S.zeros();
         // Fill elements
+#ifdef _OPENMP
+#pragma omp parallel for collapse(2)
+#endif
         for(size_t iang=0;iang<lval.n_elem;iang++) {
-          int li(lval(iang));
-          int mi(mval(iang));
-
           for(size_t jang=0;jang<lval.n_elem;jang++) {
+            int li(lval(iang));
+            int mi(mval(iang));
             int lj(lval(jang));
             int mj(mval(jang));
 
@@ -707,7 +868,7 @@ namespace helfem {
         // Plug in prefactor
         S*=std::pow(Rhalf,3);
 
-        return remove_boundaries(S);
+        return S;
       }
 
       arma::mat TwoDBasis::overlap(const TwoDBasis & rh) const {
@@ -752,13 +913,16 @@ namespace helfem {
       arma::mat TwoDBasis::kinetic() const {
         // Build radial kinetic energy matrix
         arma::mat Trad(radial.kinetic());
-        arma::mat Ip1(radial.radial_integral(1,0));
-        arma::mat Im1(radial.radial_integral(-1,0));
+        const arma::mat & Ip1(radial_matrix(1,0));
+        const arma::mat & Im1(radial_matrix(-1,0));
 
         // Full kinetic energy matrix
-        arma::mat T(Ndummy(),Ndummy());
+        arma::mat T(Nbf(),Nbf());
         T.zeros();
         // Fill elements
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
         for(size_t iang=0;iang<lval.n_elem;iang++) {
           set_sub(T,iang,iang,Trad);
           if(lval(iang)!=0) {
@@ -774,24 +938,26 @@ namespace helfem {
         // Plug in prefactor
         T*=Rhalf/2.0;
 
-        return remove_boundaries(T);
+        return T;
       }
 
       arma::mat TwoDBasis::nuclear() const {
         // Build radial matrices
-        arma::mat I10(radial.radial_integral(1,0));
-        arma::mat I11(radial.radial_integral(1,1));
+        const arma::mat & I10(radial_matrix(1,0));
+        const arma::mat & I11(radial_matrix(1,1));
 
         // Full nuclear attraction matrix
-        arma::mat V(Ndummy(),Ndummy());
+        arma::mat V(Nbf(),Nbf());
         V.zeros();
 
         // Fill elements
+#ifdef _OPENMP
+#pragma omp parallel for collapse(2)
+#endif
         for(size_t iang=0;iang<lval.n_elem;iang++) {
-          int li(lval(iang));
-          int mi(mval(iang));
-
           for(size_t jang=0;jang<lval.n_elem;jang++) {
+            int li(lval(iang));
+            int mi(mval(iang));
             int lj(lval(jang));
             int mj(mval(jang));
 
@@ -813,24 +979,26 @@ namespace helfem {
         // Plug in prefactor
         V*=-std::pow(Rhalf,2);
 
-        return remove_boundaries(V);
+        return V;
       }
 
       arma::mat TwoDBasis::dipole_z() const {
         // Full electric couplings
-        arma::mat V(Ndummy(),Ndummy());
+        arma::mat V(Nbf(),Nbf());
         V.zeros();
 
         // Build radial matrix elements
-        arma::mat I11(radial.radial_integral(1,1));
-        arma::mat I13(radial.radial_integral(1,3));
+        const arma::mat & I11(radial_matrix(1,1));
+        const arma::mat & I13(radial_matrix(1,3));
 
         // Fill elements
+#ifdef _OPENMP
+#pragma omp parallel for collapse(2)
+#endif
         for(size_t iang=0;iang<lval.n_elem;iang++) {
-          int li(lval(iang));
-          int mi(mval(iang));
-
           for(size_t jang=0;jang<lval.n_elem;jang++) {
+            int li(lval(iang));
+            int mi(mval(iang));
             int lj(lval(jang));
             int mj(mval(jang));
 
@@ -852,25 +1020,27 @@ namespace helfem {
         // Plug in prefactors
         V*=std::pow(Rhalf,4);
 
-        return remove_boundaries(V);
+        return V;
       }
 
       arma::mat TwoDBasis::quadrupole_zz() const {
         // Full electric couplings
-        arma::mat V(Ndummy(),Ndummy());
+        arma::mat V(Nbf(),Nbf());
         V.zeros();
 
         // Build radial matrix elements
-        arma::mat I10(radial.radial_integral(1,0));
-        arma::mat I12(radial.radial_integral(1,2));
-        arma::mat I14(radial.radial_integral(1,4));
+        const arma::mat & I10(radial_matrix(1,0));
+        const arma::mat & I12(radial_matrix(1,2));
+        const arma::mat & I14(radial_matrix(1,4));
 
         // Fill elements
+#ifdef _OPENMP
+#pragma omp parallel for collapse(2)
+#endif
         for(size_t iang=0;iang<lval.n_elem;iang++) {
-          int li(lval(iang));
-          int mi(mval(iang));
-
           for(size_t jang=0;jang<lval.n_elem;jang++) {
+            int li(lval(iang));
+            int mi(mval(iang));
             int lj(lval(jang));
             int mj(mval(jang));
 
@@ -896,26 +1066,28 @@ namespace helfem {
         // Plug in prefactors
         V*=std::pow(Rhalf,5)/2;
 
-        return remove_boundaries(V);
+        return V;
       }
 
       arma::mat TwoDBasis::Bz_field(double B) const {
         // Full couplings
-        arma::mat V(Ndummy(),Ndummy());
+        arma::mat V(Nbf(),Nbf());
         V.zeros();
 
         // Build radial matrix elements
-        arma::mat I10(radial.radial_integral(1,0)*std::pow(Rhalf,3));
-        arma::mat I12(radial.radial_integral(1,2)*std::pow(Rhalf,3));
-        arma::mat I30(radial.radial_integral(3,0)*std::pow(Rhalf,5));
-        arma::mat I32(radial.radial_integral(3,2)*std::pow(Rhalf,5));
+        arma::mat I10(radial_matrix(1,0)*std::pow(Rhalf,3));
+        arma::mat I12(radial_matrix(1,2)*std::pow(Rhalf,3));
+        arma::mat I30(radial_matrix(3,0)*std::pow(Rhalf,5));
+        arma::mat I32(radial_matrix(3,2)*std::pow(Rhalf,5));
 
         // Fill elements
+#ifdef _OPENMP
+#pragma omp parallel for collapse(2)
+#endif
         for(size_t iang=0;iang<lval.n_elem;iang++) {
-          int li(lval(iang));
-          int mi(mval(iang));
-
           for(size_t jang=0;jang<lval.n_elem;jang++) {
+            int li(lval(iang));
+            int mi(mval(iang));
             int lj(lval(jang));
             int mj(mval(jang));
 
@@ -949,7 +1121,7 @@ namespace helfem {
           }
         }
 
-        return remove_boundaries(V);
+        return V;
       }
 
       arma::mat TwoDBasis::radial_moments(const arma::mat & P0) const {
@@ -966,16 +1138,13 @@ namespace helfem {
                      middle,
                      right};
 
-        // Extend to boundaries
-        arma::mat P(expand_boundaries(P0));
-
         // Build radial matrix elements
-        arma::mat I10(radial.radial_integral(1,0));
-        arma::mat I11(radial.radial_integral(1,1));
-        arma::mat I12(radial.radial_integral(1,2));
-        arma::mat I13(radial.radial_integral(1,3));
-        arma::mat I14(radial.radial_integral(1,4));
-        arma::mat I15(radial.radial_integral(1,5));
+        const arma::mat & I10(radial_matrix(1,0));
+        const arma::mat & I11(radial_matrix(1,1));
+        const arma::mat & I12(radial_matrix(1,2));
+        const arma::mat & I13(radial_matrix(1,3));
+        const arma::mat & I14(radial_matrix(1,4));
+        const arma::mat & I15(radial_matrix(1,5));
 
         // Fill elements
         for(size_t iang=0;iang<lval.n_elem;iang++) {
@@ -989,7 +1158,7 @@ namespace helfem {
             // Calculate coupling
             if(mi==mj) {
               // Radial submatrix
-              arma::mat Psub(P.submat(iang*radial.Nbf(),jang*radial.Nbf(),(iang+1)*radial.Nbf()-1,(jang+1)*radial.Nbf()-1));
+              arma::mat Psub(get_sub(P0,iang,jang));
 
               // <r^2> wrt center
               {
@@ -999,23 +1168,23 @@ namespace helfem {
                 double cpl4(gaunt.cosine4_coupling(lj,mj,li,mi));
                 double cpl24(cpl2-cpl4);
                 if(cpl24!=0.0)
-                  Rmat(two,middle)+=std::pow(Rhalf,5)*cpl24*arma::trace(Psub*I10);
+                  Rmat(two,middle)+=std::pow(Rhalf,5)*cpl24*scf::trace_product(Psub,I10);
 
                 // or the delta term
                 if(li==lj)
-                  Rmat(two,middle)+=std::pow(Rhalf,5)*arma::trace(Psub*(I14-I12));
+                  Rmat(two,middle)+=std::pow(Rhalf,5)*scf::trace_product(Psub,arma::mat(I14-I12));
               }
 
               // <r^-1>
               {
                 if(li==lj) {
-                  double tr(arma::trace(Psub*I11));
+                  double tr(scf::trace_product(Psub,I11));
                   Rmat(mone,left)+=std::pow(Rhalf,2)*tr;
                   Rmat(mone,right)+=std::pow(Rhalf,2)*tr;
                 }
                 double cpl(gaunt.cosine_coupling(lj,mj,li,mi));
                 if(cpl!=0.0) {
-                  double tr(arma::trace(Psub*I10));
+                  double tr(scf::trace_product(Psub,I10));
                   Rmat(mone,left)-=std::pow(Rhalf,2)*cpl*tr;
                   Rmat(mone,right)+=std::pow(Rhalf,2)*cpl*tr;
                 }
@@ -1024,25 +1193,25 @@ namespace helfem {
               // <r>
               {
                 if(li==lj) {
-                  double tr(arma::trace(Psub*I13));
+                  double tr(scf::trace_product(Psub,I13));
                   Rmat(one,left)+=std::pow(Rhalf,4)*tr;
                   Rmat(one,right)+=std::pow(Rhalf,4)*tr;
                 }
                 double cpl(gaunt.cosine_coupling(lj,mj,li,mi));
                 if(cpl!=0.0) {
-                  double tr(arma::trace(Psub*I12));
+                  double tr(scf::trace_product(Psub,I12));
                   Rmat(one,left)+=std::pow(Rhalf,4)*cpl*tr;
                   Rmat(one,right)-=std::pow(Rhalf,4)*cpl*tr;
                 }
                 double cpl2(gaunt.cosine2_coupling(lj,mj,li,mi));
                 if(cpl2!=0.0) {
-                  double tr(arma::trace(Psub*I11));
+                  double tr(scf::trace_product(Psub,I11));
                   Rmat(one,left)-=std::pow(Rhalf,4)*cpl2*tr;
                   Rmat(one,right)-=std::pow(Rhalf,4)*cpl2*tr;
                 }
                 double cpl3(gaunt.cosine3_coupling(lj,mj,li,mi));
                 if(cpl3!=0.0) {
-                  double tr(arma::trace(Psub*I10));
+                  double tr(scf::trace_product(Psub,I10));
                   Rmat(one,left)-=std::pow(Rhalf,4)*cpl3*tr;
                   Rmat(one,right)+=std::pow(Rhalf,4)*cpl3*tr;
                 }
@@ -1051,25 +1220,25 @@ namespace helfem {
               // <r^2>
               {
                 if(li==lj) {
-                  double tr(arma::trace(Psub*I14));
+                  double tr(scf::trace_product(Psub,I14));
                   Rmat(two,left)+=std::pow(Rhalf,5)*tr;
                   Rmat(two,right)+=std::pow(Rhalf,5)*tr;
                 }
                 double cpl(gaunt.cosine_coupling(lj,mj,li,mi));
                 if(cpl!=0.0) {
-                  double tr(arma::trace(Psub*I13));
+                  double tr(scf::trace_product(Psub,I13));
                   Rmat(two,left)+=2*std::pow(Rhalf,5)*cpl*tr;
                   Rmat(two,right)-=2*std::pow(Rhalf,5)*cpl*tr;
                 }
                 double cpl3(gaunt.cosine3_coupling(lj,mj,li,mi));
                 if(cpl3!=0.0) {
-                  double tr(arma::trace(Psub*I11));
+                  double tr(scf::trace_product(Psub,I11));
                   Rmat(two,left)-=2*std::pow(Rhalf,5)*cpl3*tr;
                   Rmat(two,right)+=2*std::pow(Rhalf,5)*cpl3*tr;
                 }
                 double cpl4(gaunt.cosine4_coupling(lj,mj,li,mi));
                 if(cpl4!=0.0) {
-                  double tr(arma::trace(Psub*I10));
+                  double tr(scf::trace_product(Psub,I10));
                   Rmat(two,left)-=std::pow(Rhalf,5)*cpl4*tr;
                   Rmat(two,right)-=std::pow(Rhalf,5)*cpl4*tr;
                 }
@@ -1078,37 +1247,37 @@ namespace helfem {
               // <r^3>
               {
                 if(li==lj) {
-                  double tr(arma::trace(Psub*I15));
+                  double tr(scf::trace_product(Psub,I15));
                   Rmat(three,left)+=std::pow(Rhalf,6)*tr;
                   Rmat(three,right)+=std::pow(Rhalf,6)*tr;
                 }
                 double cpl(gaunt.cosine_coupling(lj,mj,li,mi));
                 if(cpl!=0.0) {
-                  double tr(arma::trace(Psub*I14));
+                  double tr(scf::trace_product(Psub,I14));
                   Rmat(three,left)+=3*std::pow(Rhalf,6)*cpl*tr;
                   Rmat(three,right)-=3*std::pow(Rhalf,6)*cpl*tr;
                 }
                 double cpl2(gaunt.cosine2_coupling(lj,mj,li,mi));
                 if(cpl2!=0.0) {
-                  double tr(arma::trace(Psub*I13));
+                  double tr(scf::trace_product(Psub,I13));
                   Rmat(three,left)+=2*std::pow(Rhalf,6)*cpl2*tr;
                   Rmat(three,right)+=2*std::pow(Rhalf,6)*cpl2*tr;
                 }
                 double cpl3(gaunt.cosine3_coupling(lj,mj,li,mi));
                 if(cpl3!=0.0) {
-                  double tr(arma::trace(Psub*I12));
+                  double tr(scf::trace_product(Psub,I12));
                   Rmat(three,left)-=2*std::pow(Rhalf,6)*cpl3*tr;
                   Rmat(three,right)+=2*std::pow(Rhalf,6)*cpl3*tr;
                 }
                 double cpl4(gaunt.cosine4_coupling(lj,mj,li,mi));
                 if(cpl4!=0.0) {
-                  double tr(arma::trace(Psub*I11));
+                  double tr(scf::trace_product(Psub,I11));
                   Rmat(three,left)-=3*std::pow(Rhalf,6)*cpl4*tr;
                   Rmat(three,right)-=3*std::pow(Rhalf,6)*cpl4*tr;
                 }
                 double cpl5(gaunt.cosine5_coupling(lj,mj,li,mi));
                 if(cpl5!=0.0) {
-                  double tr(arma::trace(Psub*I10));
+                  double tr(scf::trace_product(Psub,I10));
                   Rmat(three,left)-=std::pow(Rhalf,6)*cpl5*tr;
                   Rmat(three,right)+=std::pow(Rhalf,6)*cpl5*tr;
                 }
@@ -1151,19 +1320,28 @@ namespace helfem {
       }
 
       size_t TwoDBasis::mem_2el_aux() const {
-        // Auxiliary integrals required up to
-        size_t N_LM(lm_map.size());
+        // Auxiliary integrals required up to; the (L,|M|) channels
+        // are distributed over the MPI ranks
+        size_t N_LM=0;
+        for(size_t ilm=0;ilm<lm_map.size();ilm++)
+          if(mpi::owns(ilm))
+            N_LM++;
         // Number of elements
         size_t Nel(radial.Nel());
         // Number of primitive functions per element
         size_t Nprim(radial.max_Nprim());
 
-        // No off-diagonal storage
-        return 4*N_LM*Nel*Nprim*Nprim*Nprim*Nprim*sizeof(double);
+        // Number of symmetric primitive pairs
+        size_t Nsym(utils::pair_count(Nprim,true));
+
+        // No off-diagonal storage. The four variants only live in the
+        // pair-symmetric subspace, and the exchange-ordered integrals
+        // are derived from them on the fly
+        return 4*N_LM*Nel*Nsym*Nsym*sizeof(double);
       }
 
 
-      void TwoDBasis::compute_tei(bool exchange) {
+      void TwoDBasis::compute_tei(bool verbose) {
         // Number of distinct L values is
         size_t Nel(radial.Nel());
 
@@ -1172,6 +1350,10 @@ namespace helfem {
         disjoint_P2.resize(Nel*lm_map.size());
         disjoint_Q0.resize(Nel*lm_map.size());
         disjoint_Q2.resize(Nel*lm_map.size());
+        // Table indices of the quadrature nodes in each element
+        std::vector<arma::uvec> legidx(Nel);
+        for(size_t iel=0;iel<Nel;iel++)
+          legidx[iel]=legtab.get_indices(radial.get_chmu(iel));
 #ifdef _OPENMP
 #pragma omp parallel for
 #endif
@@ -1179,126 +1361,359 @@ namespace helfem {
           int L(lm_map[ilm].first);
           int M(lm_map[ilm].second);
           for(size_t iel=0;iel<Nel;iel++) {
-            disjoint_P0[ilm*Nel+iel]=radial.Plm_integral(0,iel,L,M,legtab);
-            disjoint_P2[ilm*Nel+iel]=radial.Plm_integral(2,iel,L,M,legtab);
-            disjoint_Q0[ilm*Nel+iel]=radial.Qlm_integral(0,iel,L,M,legtab);
-            disjoint_Q2[ilm*Nel+iel]=radial.Qlm_integral(2,iel,L,M,legtab);
+            arma::vec plm(legtab.get_Plm(L,M,legidx[iel]));
+            arma::vec qlm(legtab.get_Qlm(L,M,legidx[iel]));
+            disjoint_P0[ilm*Nel+iel]=radial.legendre_integral(0,iel,plm);
+            disjoint_P2[ilm*Nel+iel]=radial.legendre_integral(2,iel,plm);
+            disjoint_Q0[ilm*Nel+iel]=radial.legendre_integral(0,iel,qlm);
+            disjoint_Q2[ilm*Nel+iel]=radial.legendre_integral(2,iel,qlm);
           }
         }
 
-        // Form primitive two-electron integrals
-        prim_tei00.resize(Nel*Nel*lm_map.size());
-        prim_tei02.resize(Nel*Nel*lm_map.size());
-        prim_tei20.resize(Nel*Nel*lm_map.size());
-        prim_tei22.resize(Nel*Nel*lm_map.size());
-
-        for(size_t ilm=0;ilm<lm_map.size();ilm++) {
-          int L(lm_map[ilm].first);
-          int M(lm_map[ilm].second);
-
+        // Form primitive two-electron integrals. Only the in-element
+        // integrals are stored, since the rest factorize. The four
+        // cosh-power variants are fused into a single block matrix
+        //   [ (00) -(02) ]
+        //   [ -(20) (22) ]
+        // which acts on the stacked (0, 2) density vector. Due to the
+        // i<->j and k<->l symmetry, only the pair-symmetric subspace
+        // is stored. The exchange routine unpacks the integrals one
+        // tile at a time.
+        printf("Primitive two-electron integrals are %s\n",scratch::storage_name(tei_storage).c_str());
+        fflush(stdout);
+        memory::set("TEI",tei_storage==scratch::TEI_INCORE ? mem_2el_aux() : 0);
+        prim_tei.clear();
+        prim_tei_single.clear();
+        memory::set("TEI single",0);
+        tei_map.reset();
+        partition_tei();
+        if(tei_storage==scratch::TEI_RECOMPUTE)
+          return;
+        if(tei_storage==scratch::TEI_MMAP) {
+          // The blocks are laid out element by element, which is the
+          // order in which they are streamed by the contractions
+          std::vector<size_t> offset(Nel*lm_map.size());
+          size_t ntot=0;
           for(size_t iel=0;iel<Nel;iel++) {
-            // Index in array
-            {
-              const size_t idx(Nel*Nel*ilm + iel*Nel + iel);
-
-              // In-element integrals
-              prim_tei00[idx]=radial.twoe_integral(0,0,iel,L,M,legtab);
-              prim_tei02[idx]=radial.twoe_integral(0,2,iel,L,M,legtab);
-              prim_tei20[idx]=radial.twoe_integral(2,0,iel,L,M,legtab);
-              prim_tei22[idx]=radial.twoe_integral(2,2,iel,L,M,legtab);
+            size_t Nsym(utils::pair_count(radial.Nprim(iel),true));
+            for(size_t ilm=0;ilm<lm_map.size();ilm++) {
+              offset[iel*lm_map.size()+ilm]=ntot;
+              if(mpi::owns(ilm))
+                ntot+=4*Nsym*Nsym;
             }
+          }
+          tei_map=std::make_shared<scratch::MappedFile>(tei_scratch,ntot);
 
-            /*
-            for(size_t jel=0;jel<Nel;jel++) {
-              // Index in disjoint array
-              const size_t iidx(ilm*Nel+iel);
-              const size_t jidx(ilm*Nel+jel);
-
-              // when r(iel)>r(jel), iel gets Q
-              const arma::mat & i0=(iel>jel) ? disjoint_Q0[iidx] : disjoint_P0[iidx];
-              const arma::mat & i2=(iel>jel) ? disjoint_Q2[iidx] : disjoint_P2[iidx];
-              // and jel gets P
-              const arma::mat & j0=(iel>jel) ? disjoint_P0[jidx] : disjoint_Q0[jidx];
-              const arma::mat & j2=(iel>jel) ? disjoint_P2[jidx] : disjoint_Q2[jidx];
-
-              // Store integrals
-              prim_tei00[idx]=utils::product_tei(i0,j0);
-              prim_tei02[idx]=utils::product_tei(i0,j2);
-              prim_tei20[idx]=utils::product_tei(i2,j0);
-              prim_tei22[idx]=utils::product_tei(i2,j2);
+          // The matrices are constructed in place so that they keep
+          // pointing to the mapped memory
+          prim_tei.reserve(Nel*lm_map.size());
+          for(size_t ilm=0;ilm<lm_map.size();ilm++)
+            for(size_t iel=0;iel<Nel;iel++) {
+              size_t Nsym(utils::pair_count(radial.Nprim(iel),true));
+              if(mpi::owns(ilm))
+                prim_tei.emplace_back(tei_map->memptr(offset[iel*lm_map.size()+ilm]),2*Nsym,2*Nsym,false,true);
+              else
+                prim_tei.emplace_back();
             }
-            */
-          }
-        }
+        } else
+          prim_tei.resize(Nel*lm_map.size());
 
-        // Make sure teis are symmetric
-        /*
+        // The cost of a task scales as Nprim^4 independently of
+        // (L,M), so the (L,M,iel) tasks are handed out largest first
+        // to minimize the idle tail
+        const size_t Ntask(lm_map.size()*Nel);
+        arma::vec cost(Ntask);
         for(size_t ilm=0;ilm<lm_map.size();ilm++)
           for(size_t iel=0;iel<Nel;iel++)
-            for(size_t jel=0;jel<Nel;jel++) {
-              size_t idx=Nel*Nel*ilm + iel*Nel + jel;
-              size_t Ni(radial.Nprim(iel));
-              size_t Nj(radial.Nprim(jel));
-              printf("ilm = %i, iel = %i, jel = %i\n",(int) ilm, (int) iel, (int) jel);
-              utils::check_tei_symmetry(prim_tei00[idx],Ni,Ni,Nj,Nj);
-              utils::check_tei_symmetry(prim_tei02[idx],Ni,Ni,Nj,Nj);
-              utils::check_tei_symmetry(prim_tei20[idx],Ni,Ni,Nj,Nj);
-              utils::check_tei_symmetry(prim_tei22[idx],Ni,Ni,Nj,Nj);
+            cost(ilm*Nel+iel)=std::pow((double) radial.Nprim(iel),4);
+        arma::uvec order(arma::stable_sort_index(cost,"descend"));
+        // Each MPI rank only computes the (L,|M|) channels it owns
+        if(mpi::size()>1) {
+          std::vector<arma::uword> owned;
+          for(size_t it=0;it<Ntask;it++)
+            if(mpi::owns(order(it)/Nel))
+              owned.push_back(order(it));
+          order=arma::conv_to<arma::uvec>::from(owned);
+        }
+#ifdef _OPENMP
+        arma::vec thrtime(omp_get_max_threads(),arma::fill::zeros);
+#else
+        arma::vec thrtime(1,arma::fill::zeros);
+#endif
+
+        if(tei_domains.size()) {
+          // Each element is computed, and so first touched, by the team
+          // of the domain that contracts it later on
+          const int nin(numa::team_size(tei_domains.size()));
+          arma::uvec domain(Nel);
+          for(size_t idom=0;idom<tei_domains.size();idom++)
+            domain(tei_domains[idom]).fill(idom);
+#ifdef _OPENMP
+#pragma omp parallel num_threads(tei_domains.size()) proc_bind(spread)
+#endif
+          {
+#ifdef _OPENMP
+            const size_t idom(omp_get_thread_num());
+#else
+            const size_t idom(0);
+#endif
+            // Tasks of the domain, largest first
+            std::vector<size_t> tasks;
+            for(size_t it=0;it<order.n_elem;it++)
+              if(domain(order(it)%Nel)==idom)
+                tasks.push_back(order(it));
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,1) num_threads(nin) proc_bind(close)
+#endif
+            for(size_t it=0;it<tasks.size();it++) {
+              const size_t ilm(tasks[it]/Nel);
+              const size_t iel(tasks[it]%Nel);
+              Timer ttask;
+              prim_tei[ilm*Nel+iel]=element_tei(ilm,iel);
+#ifdef _OPENMP
+              thrtime(idom*nin+omp_get_thread_num())+=ttask.get();
+#else
+              thrtime(0)+=ttask.get();
+#endif
             }
-        */
+          }
+        } else {
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,1)
+#endif
+          for(size_t it=0;it<order.n_elem;it++) {
+            const size_t ilm(order(it)/Nel);
+            const size_t iel(order(it)%Nel);
+            Timer ttask;
+            prim_tei[ilm*Nel+iel]=element_tei(ilm,iel);
+#ifdef _OPENMP
+            thrtime(omp_get_thread_num())+=ttask.get();
+#else
+            thrtime(0)+=ttask.get();
+#endif
+          }
+        }
+        if(verbose)
+          scf::print_load_balance("Primitive two-electron integrals",thrtime);
+      }
+
+      arma::mat TwoDBasis::element_tei(size_t ilm, size_t iel) const {
+        int L(lm_map[ilm].first);
+        int M(lm_map[ilm].second);
+
+        arma::mat tei00(radial.twoe_integral(0,0,iel,L,M,legtab));
+        arma::mat tei02(radial.twoe_integral(0,2,iel,L,M,legtab));
+        arma::mat tei20(radial.twoe_integral(2,0,iel,L,M,legtab));
+        arma::mat tei22(radial.twoe_integral(2,2,iel,L,M,legtab));
+
+        size_t Ni(radial.Nprim(iel));
+        arma::mat p00(utils::pair_pack_tei(tei00,Ni,true,true));
+        arma::mat p02(utils::pair_pack_tei(tei02,Ni,true,true));
+        arma::mat p20(utils::pair_pack_tei(tei20,Ni,true,true));
+        arma::mat p22(utils::pair_pack_tei(tei22,Ni,true,true));
+        return arma::join_cols(arma::join_rows(p00,-p02),arma::join_rows(-p20,p22));
+      }
+
+      void TwoDBasis::set_tei_single(bool single) {
+        prim_tei_single.clear();
+        memory::set("TEI single",0);
+        if(!single)
+          return;
+        if(tei_storage!=scratch::TEI_INCORE || !prim_tei.size()) {
+          printf("Single-precision integrals need in-core storage; staying in double precision\n");
+          return;
+        }
 
-        /*
-          The exchange matrix is given by
-          K(jk) = (ij|kl) P(il)
-          i.e. the complex conjugation hits i and l as
-          in the density matrix.
+        size_t nsingle=0;
+        prim_tei_single.resize(prim_tei.size());
+        for(size_t i=0;i<prim_tei.size();i++)
+          nsingle+=prim_tei[i].n_elem;
+        if(tei_domains.size()) {
+          // The copies are made by the team that contracts them
+          size_t Nel(radial.Nel());
+          const int nin(numa::team_size(tei_domains.size()));
+#ifdef _OPENMP
+#pragma omp parallel num_threads(tei_domains.size()) proc_bind(spread)
+#endif
+          {
+#ifdef _OPENMP
+            const size_t idom(omp_get_thread_num());
+#else
+            const size_t idom(0);
+#endif
+            const arma::uvec & elems(tei_domains[idom]);
+#ifdef _OPENMP
+#pragma omp parallel for collapse(2) schedule(dynamic,1) num_threads(nin) proc_bind(close)
+#endif
+            for(size_t ilm=0;ilm<lm_map.size();ilm++)
+              for(size_t i=0;i<elems.n_elem;i++) {
+                const size_t idx(ilm*Nel+elems(i));
+                if(prim_tei[idx].n_elem)
+                  prim_tei_single[idx]=arma::conv_to<arma::fmat>::from(prim_tei[idx]);
+              }
+          }
+        } else {
+          for(size_t i=0;i<prim_tei.size();i++)
+            if(prim_tei[i].n_elem)
+              prim_tei_single[i]=arma::conv_to<arma::fmat>::from(prim_tei[i]);
+        }
+        memory::set("TEI single",nsingle*sizeof(float));
+      }
 
-          To get this in the proper order, we permute the integrals
-          K(jk) = (jk;il) P(il)
-          so we don't have to reform the permutations in the exchange routine.
-        */
-        if(exchange) {
-          prim_ktei00.resize(prim_tei00.size());
-          prim_ktei02.resize(prim_tei02.size());
-          prim_ktei20.resize(prim_tei20.size());
-          prim_ktei22.resize(prim_tei22.size());
+      void TwoDBasis::set_numa(size_t ndom) {
+        tei_ndom=numa::setup(ndom);
+      }
+
+      void TwoDBasis::partition_tei() {
+        tei_domains.clear();
+        if(tei_ndom<2 || tei_storage!=scratch::TEI_INCORE)
+          return;
+
+        size_t Nel(radial.Nel());
+        arma::vec cost(Nel);
+        for(size_t iel=0;iel<Nel;iel++)
+          cost(iel)=std::pow((double) radial.Nprim(iel),4);
+        tei_domains=numa::partition(cost,tei_ndom);
+      }
+
+      void TwoDBasis::distribute_tei() {
+        partition_tei();
+        if(!tei_domains.size() || !prim_tei.size())
+          return;
+
+        // The blocks are copied into memory that is first touched by
+        // the team of their domain
+        size_t Nel(radial.Nel());
+        const int nin(numa::team_size(tei_domains.size()));
+#ifdef _OPENMP
+#pragma omp parallel num_threads(tei_domains.size()) proc_bind(spread)
+#endif
+        {
+#ifdef _OPENMP
+          const size_t idom(omp_get_thread_num());
+#else
+          const size_t idom(0);
+#endif
+          const arma::uvec & elems(tei_domains[idom]);
+#ifdef _OPENMP
+#pragma omp parallel for collapse(2) schedule(dynamic,1) num_threads(nin) proc_bind(close)
+#endif
           for(size_t ilm=0;ilm<lm_map.size();ilm++)
-            for(size_t iel=0;iel<Nel;iel++) {
-              // Diagonal integrals
-              {
-                size_t idx=Nel*Nel*ilm + iel*Nel + iel;
-                size_t Ni(radial.Nprim(iel));
-                size_t Nj(radial.Nprim(iel));
-                prim_ktei00[idx]=utils::exchange_tei(prim_tei00[idx],Ni,Ni,Nj,Nj);
-                prim_ktei02[idx]=utils::exchange_tei(prim_tei02[idx],Ni,Ni,Nj,Nj);
-                prim_ktei20[idx]=utils::exchange_tei(prim_tei20[idx],Ni,Ni,Nj,Nj);
-                prim_ktei22[idx]=utils::exchange_tei(prim_tei22[idx],Ni,Ni,Nj,Nj);
-              }
+            for(size_t i=0;i<elems.n_elem;i++) {
+              const size_t idx(ilm*Nel+elems(i));
+              arma::mat local(prim_tei[idx]);
+              prim_tei[idx].swap(local);
+            }
+        }
+      }
 
-              // Off-diagonal integrals (not used since faster to
-              // contract the integrals in factorized form)
-              /*
-                for(size_t jel=0;jel<iel;jel++) {
-                size_t idx=Nel*Nel*ilm + iel*Nel + jel;
-                size_t Ni(radial.Nprim(iel));
-                size_t Nj(radial.Nprim(jel));
-                prim_ktei00[idx]=utils::exchange_tei(prim_tei00[idx],Ni,Ni,Nj,Nj);
-                prim_ktei02[idx]=utils::exchange_tei(prim_tei02[idx],Ni,Ni,Nj,Nj);
-                prim_ktei20[idx]=utils::exchange_tei(prim_tei20[idx],Ni,Ni,Nj,Nj);
-                prim_ktei22[idx]=utils::exchange_tei(prim_tei22[idx],Ni,Ni,Nj,Nj);
-                }
-                for(size_t jel=iel+1;jel<Nel;jel++) {
-                size_t idx=Nel*Nel*ilm + iel*Nel + jel;
-                size_t Ni(radial.Nprim(iel));
-                size_t Nj(radial.Nprim(jel));
-                prim_ktei00[idx]=utils::exchange_tei(prim_tei00[idx],Ni,Ni,Nj,Nj);
-                prim_ktei02[idx]=utils::exchange_tei(prim_tei02[idx],Ni,Ni,Nj,Nj);
-                prim_ktei20[idx]=utils::exchange_tei(prim_tei20[idx],Ni,Ni,Nj,Nj);
-                prim_ktei22[idx]=utils::exchange_tei(prim_tei22[idx],Ni,Ni,Nj,Nj);
-                }
-              */
+      bool TwoDBasis::get_tei_single() const {
+        return prim_tei_single.size()>0;
+      }
+
+      std::vector<const arma::fmat *> TwoDBasis::element_tei_single(size_t iel) const {
+        std::vector<const arma::fmat *> ret;
+        if(!prim_tei_single.size())
+          return ret;
+
+        size_t Nel(radial.Nel());
+        ret.resize(lm_map.size());
+        for(size_t ilm=0;ilm<lm_map.size();ilm++)
+          ret[ilm]=&prim_tei_single[ilm*Nel+iel];
+        return ret;
+      }
+
+      std::vector<const arma::mat *> TwoDBasis::element_tei(size_t iel, std::vector<arma::mat> & work) const {
+        size_t Nel(radial.Nel());
+
+        std::vector<const arma::mat *> ret(lm_map.size());
+        if(prim_tei.size()) {
+          for(size_t ilm=0;ilm<lm_map.size();ilm++)
+            ret[ilm]=&prim_tei[ilm*Nel+iel];
+        } else {
+          // Recently used elements are reused from the cache
+          for(std::list< std::pair< size_t, std::vector<arma::mat> > >::iterator it=tei_lru.begin();it!=tei_lru.end();++it)
+            if(it->first==iel) {
+              tei_lru.splice(tei_lru.begin(),tei_lru,it);
+              for(size_t ilm=0;ilm<lm_map.size();ilm++)
+                ret[ilm]=&tei_lru.front().second[ilm];
+              return ret;
             }
+
+          // Recompute the integrals
+          work.resize(lm_map.size());
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,1)
+#endif
+          for(size_t ilm=0;ilm<lm_map.size();ilm++)
+            if(mpi::owns(ilm))
+              work[ilm]=element_tei(ilm,iel);
+          // Store in the cache, evicting the least recently used element
+          if(tei_ncache) {
+            tei_lru.push_front(std::make_pair(iel,std::vector<arma::mat>()));
+            std::swap(tei_lru.front().second,work);
+            while(tei_lru.size()>tei_ncache)
+              tei_lru.pop_back();
+            size_t ncached=0;
+            for(std::list< std::pair< size_t, std::vector<arma::mat> > >::const_iterator cit=tei_lru.begin();cit!=tei_lru.end();++cit)
+              for(size_t i=0;i<cit->second.size();i++)
+                ncached+=cit->second[i].n_elem;
+            memory::set("TEI cache",ncached*sizeof(double));
+            for(size_t ilm=0;ilm<lm_map.size();ilm++)
+              ret[ilm]=&tei_lru.front().second[ilm];
+            return ret;
+          }
+          for(size_t ilm=0;ilm<lm_map.size();ilm++)
+            ret[ilm]=&work[ilm];
+        }
+        return ret;
+      }
+
+      void TwoDBasis::set_tei_storage(size_t budget, const std::string & scratchdir, bool direct, size_t ncache) {
+        tei_budget=budget;
+        tei_scratch=scratchdir;
+        tei_storage=direct ? scratch::TEI_RECOMPUTE : scratch::choose_storage(mem_2el_aux(),tei_budget,tei_scratch);
+        tei_ncache=ncache;
+        tei_lru.clear();
+        memory::set("TEI cache",0);
+      }
+
+      void TwoDBasis::set_screening(double thr) {
+        screen_thr=std::max(thr,10*DBL_EPSILON);
+      }
+
+      void TwoDBasis::get_coulomb_channels(size_t & nactive, size_t & ntot) const {
+        nactive=coulomb_nactive;
+        ntot=coulomb_ntot;
+      }
+
+      arma::mat TwoDBasis::block_norms(const std::vector<arma::mat> & P, size_t first, size_t last) const {
+        arma::mat bdens(lval.n_elem,lval.n_elem,arma::fill::zeros);
+        for(size_t id=0;id<P.size();id++)
+          for(size_t iang=0;iang<lval.n_elem;iang++)
+            for(size_t lang=0;lang<lval.n_elem;lang++)
+              bdens(iang,lang)=std::max(bdens(iang,lang),arma::norm(get_pure_sub(P[id],iang,lang,first,last,first,last),"fro"));
+        return bdens;
+      }
+
+      arma::uvec TwoDBasis::element_order() const {
+        size_t Nel(radial.Nel());
+        arma::uvec order(Nel);
+        std::vector<bool> done(Nel,false);
+        size_t n=0;
+        // Cached elements first, so that they are used before they are evicted
+        for(std::list< std::pair< size_t, std::vector<arma::mat> > >::const_iterator it=tei_lru.begin();it!=tei_lru.end();++it) {
+          order(n++)=it->first;
+          done[it->first]=true;
         }
+        for(size_t iel=0;iel<Nel;iel++)
+          if(!done[iel])
+            order(n++)=iel;
+        return order;
+      }
+
+      scratch::tei_storage_t TwoDBasis::get_tei_storage() const {
+        return tei_storage;
       }
 
       size_t TwoDBasis::lmind(int L, int M, bool check) const {
@@ -1357,28 +1772,45 @@ namespace helfem {
       }
 
       arma::mat TwoDBasis::coulomb(const arma::mat & P0) const {
-        if(!prim_tei00.size())
+        return coulomb(std::vector<arma::mat>(1,P0))[0];
+      }
+
+      std::vector<arma::mat> TwoDBasis::coulomb(const std::vector<arma::mat> & P0) const {
+        profiler::Region prof("Coulomb");
+        if(!prim_tei.size() && tei_storage!=scratch::TEI_RECOMPUTE)
           throw std::logic_error("Primitive teis have not been computed!\n");
 
-        // Extend to boundaries
-        arma::mat P(expand_boundaries(P0));
+        // Number of densities
+        const size_t Nd(P0.size());
+        // The densities are used in the pure layout; the radial blocks
+        // are padded with zeros for the boundary functions as needed
+        const std::vector<arma::mat> & P(P0);
+        for(size_t id=0;id<Nd;id++)
+          if(P[id].n_rows != Nbf() || P[id].n_cols != Nbf())
+            throw std::logic_error("Density matrix does not have expected size!\n");
 
         // Number of radial elements
         size_t Nel(radial.Nel());
         // Number of radial functions
         size_t Nrad(radial.Nbf());
 
-        // Radial helper matrices
-        std::vector<arma::mat> Paux0(LM_map.size());
-        std::vector<arma::mat> Paux2(LM_map.size());
+        // Radial helper matrices; the slices hold the densities
+        std::vector<arma::cube> Paux0(LM_map.size());
+        std::vector<arma::cube> Paux2(LM_map.size());
         for(size_t i=0;i<Paux0.size();i++) {
-          Paux0[i].zeros(Nrad,Nrad);
-          Paux2[i].zeros(Nrad,Nrad);
+          Paux0[i].zeros(Nrad,Nrad,Nd);
+          Paux2[i].zeros(Nrad,Nrad,Nd);
         }
 
+        // Density block norms, maximized over the densities
+        arma::mat bdens(block_norms(P,0,Nrad-1));
+
         // Form radial helpers: contract ket
         for(size_t kang=0;kang<lval.n_elem;kang++) {
           for(size_t lang=0;lang<lval.n_elem;lang++) {
+            // Do we have any density in this block?
+            if(bdens(kang,lang)<screen_thr)
+              continue;
             // l and m values
             int lk(lval(kang));
             int mk(mval(kang));
@@ -1395,108 +1827,168 @@ namespace helfem {
               double cpl0(gaunt.mod_coeff(lk,mk,L,M,ll,ml));
               double cpl2(gaunt.coeff(lk,mk,L,M,ll,ml));
               // Increment
-              arma::mat Prad(P.submat(kang*Nrad,lang*Nrad,(kang+1)*Nrad-1,(lang+1)*Nrad-1));
-              if(cpl0!=0.0)
-                Paux0[iLM]+=cpl0*Prad;
-              if(cpl2!=0.0)
-                Paux2[iLM]+=cpl2*Prad;
+              for(size_t id=0;id<Nd;id++) {
+                arma::mat Prad(get_sub(P[id],kang,lang));
+                if(cpl0!=0.0)
+                  Paux0[iLM].slice(id)+=cpl0*Prad;
+                if(cpl2!=0.0)
+                  Paux2[iLM].slice(id)+=cpl2*Prad;
+              }
             }
           }
         }
 
+        // Channels whose density multipoles vanish do not contribute
+        arma::uvec chactive(LM_map.size());
+        for(size_t iLM=0;iLM<LM_map.size();iLM++)
+          chactive(iLM)=(std::max(arma::abs(arma::vectorise(Paux0[iLM])).max(),arma::abs(arma::vectorise(Paux2[iLM])).max())>=screen_thr);
+        coulomb_nactive=arma::accu(chactive);
+        coulomb_ntot=LM_map.size();
+
         // Coulomb helpers
-        std::vector<arma::mat> Jaux0(LM_map.size());
-        std::vector<arma::mat> Jaux2(LM_map.size());
+        std::vector<arma::cube> Jaux0(LM_map.size());
+        std::vector<arma::cube> Jaux2(LM_map.size());
         for(size_t i=0;i<Jaux0.size();i++) {
-          Jaux0[i].zeros(Nrad,Nrad);
-          Jaux2[i].zeros(Nrad,Nrad);
+          Jaux0[i].zeros(Nrad,Nrad,Nd);
+          Jaux2[i].zeros(Nrad,Nrad,Nd);
         }
-        for(size_t iLM=0;iLM<LM_map.size();iLM++) {
-          // Values of L and M
-          int L(LM_map[iLM].first);
-          int M(LM_map[iLM].second);
+        // Are the in-element integrals distributed over NUMA domains?
+        const bool distributed(tei_domains.size() && prim_tei.size());
+        // The input elements are looped over outermost so that
+        // out-of-core integrals are streamed sequentially, and
+        // recomputed integrals are only held for a single element
+        std::vector<arma::mat> teiwork;
+        arma::uvec elorder(element_order());
+        for(size_t ijel=0;ijel<Nel;ijel++) {
+          size_t jel(elorder(ijel));
+          size_t jfirst, jlast;
+          radial.get_idx(jel,jfirst,jlast);
+          size_t Nj(jlast-jfirst+1);
+          // Skip elements without density
+          if(block_norms(P,jfirst,jlast).max()<screen_thr)
+            continue;
+          std::vector<const arma::mat *> tei(element_tei(jel,teiwork));
+          std::vector<const arma::fmat *> teif(element_tei_single(jel));
+
+          for(size_t iLM=0;iLM<LM_map.size();iLM++) {
+            // Values of L and M
+            int L(LM_map[iLM].first);
+            int M(LM_map[iLM].second);
+
+            // Helpers
+            const size_t ilm(lmind(L,M));
+            // The channels are distributed over the MPI ranks along
+            // with the integrals
+            if(!chactive(iLM) || !mpi::owns(ilm))
+              continue;
+            const double LMfac(coulomb_prefactor(iLM));
+
+            // Stacked density submatrices of all densities, in the
+            // pair-symmetric subspace
+            const size_t Nsym(utils::pair_count(Nj,true));
+            arma::mat Psub(2*Nsym,Nd);
+            for(size_t id=0;id<Nd;id++) {
+              // Get density submatrices
+              arma::mat Psub0(Paux0[iLM].slice(id).submat(jfirst,jfirst,jlast,jlast));
+              arma::mat Psub2(Paux2[iLM].slice(id).submat(jfirst,jfirst,jlast,jlast));
+              Psub.submat(0,id,Nsym-1,id)=utils::pair_pack(arma::vectorise(Psub0),Nj,true);
+              Psub.submat(Nsym,id,2*Nsym-1,id)=utils::pair_pack(arma::vectorise(Psub2),Nj,true);
 
-          // Helpers
-          const size_t ilm(lmind(L,M));
-          const double LMfac(4.0*M_PI*std::pow(Rhalf,5)*std::pow(-1.0,M)/factorial_ratio(L+std::abs(M),L-std::abs(M)));
+              // Contract integrals
+              double jsmall0 = LMfac*scf::trace_product(disjoint_P0[ilm*Nel+jel],Psub0);
+              double jbig0 = LMfac*scf::trace_product(disjoint_Q0[ilm*Nel+jel],Psub0);
+              double jsmall2 = LMfac*scf::trace_product(disjoint_P2[ilm*Nel+jel],Psub2);
+              double jbig2 = LMfac*scf::trace_product(disjoint_Q2[ilm*Nel+jel],Psub2);
+
+              // Increment J: jel>iel
+              double ifac0(jbig0 - jbig2);
+              double ifac2(-jbig0 + jbig2);
+              for(size_t iel=0;iel<jel;iel++) {
+                size_t ifirst, ilast;
+                radial.get_idx(iel,ifirst,ilast);
 
-          // Loop over input elements
-          for(size_t jel=0;jel<Nel;jel++) {
-            size_t jfirst, jlast;
-            radial.get_idx(jel,jfirst,jlast);
-            size_t Nj(jlast-jfirst+1);
+                const arma::mat & iint0=disjoint_P0[ilm*Nel+iel];
+                const arma::mat & iint2=disjoint_P2[ilm*Nel+iel];
+                Jaux0[iLM].slice(id).submat(ifirst,ifirst,ilast,ilast)+=iint0*ifac0;
+                Jaux2[iLM].slice(id).submat(ifirst,ifirst,ilast,ilast)+=iint2*ifac2;
+              }
 
-            // Get density submatrices
-            arma::mat Psub0(Paux0[iLM].submat(jfirst,jfirst,jlast,jlast));
-            arma::mat Psub2(Paux2[iLM].submat(jfirst,jfirst,jlast,jlast));
-
-            // Contract integrals
-            double jsmall0 = LMfac*arma::trace(disjoint_P0[ilm*Nel+jel]*Psub0);
-            double jbig0 = LMfac*arma::trace(disjoint_Q0[ilm*Nel+jel]*Psub0);
-            double jsmall2 = LMfac*arma::trace(disjoint_P2[ilm*Nel+jel]*Psub2);
-            double jbig2 = LMfac*arma::trace(disjoint_Q2[ilm*Nel+jel]*Psub2);
-
-            // Increment J: jel>iel
-            double ifac0(jbig0 - jbig2);
-            double ifac2(-jbig0 + jbig2);
-            for(size_t iel=0;iel<jel;iel++) {
-              size_t ifirst, ilast;
-              radial.get_idx(iel,ifirst,ilast);
-
-              const arma::mat & iint0=disjoint_P0[ilm*Nel+iel];
-              const arma::mat & iint2=disjoint_P2[ilm*Nel+iel];
-              Jaux0[iLM].submat(ifirst,ifirst,ilast,ilast)+=iint0*ifac0;
-              Jaux2[iLM].submat(ifirst,ifirst,ilast,ilast)+=iint2*ifac2;
-            }
+              // Increment J: jel<iel
+              ifac0=jsmall0 - jsmall2;
+              ifac2=-jsmall0 + jsmall2;
+              for(size_t iel=jel+1;iel<Nel;iel++) {
+                size_t ifirst, ilast;
+                radial.get_idx(iel,ifirst,ilast);
 
-            // Increment J: jel<iel
-            ifac0=jsmall0 - jsmall2;
-            ifac2=-jsmall0 + jsmall2;
-            for(size_t iel=jel+1;iel<Nel;iel++) {
-              size_t ifirst, ilast;
-              radial.get_idx(iel,ifirst,ilast);
-
-              const arma::mat & iint0=disjoint_Q0[ilm*Nel+iel];
-              const arma::mat & iint2=disjoint_Q2[ilm*Nel+iel];
-              Jaux0[iLM].submat(ifirst,ifirst,ilast,ilast)+=iint0*ifac0;
-              Jaux2[iLM].submat(ifirst,ifirst,ilast,ilast)+=iint2*ifac2;
+                const arma::mat & iint0=disjoint_Q0[ilm*Nel+iel];
+                const arma::mat & iint2=disjoint_Q2[ilm*Nel+iel];
+                Jaux0[iLM].slice(id).submat(ifirst,ifirst,ilast,ilast)+=iint0*ifac0;
+                Jaux2[iLM].slice(id).submat(ifirst,ifirst,ilast,ilast)+=iint2*ifac2;
+              }
             }
 
-            // In-element contribution
-            {
-              size_t iel=jel;
-              size_t ifirst=jfirst;
-              size_t ilast=jlast;
-              size_t Ni=Nj;
+            // In-element contribution; distributed integrals are
+            // contracted by their domains below
+            if(!distributed)
+              coulomb_element(jel,iLM,tei,teif,Psub,Jaux0,Jaux2);
+          }
+        }
 
-              // Contract integrals
-              arma::mat Jsub0(Ni*Ni,1);
-              Jsub0.zeros();
-              arma::mat Jsub2(Ni*Ni,1);
-              Jsub2.zeros();
-
-              Psub0.reshape(Nj*Nj,1);
-              Psub2.reshape(Nj*Nj,1);
-
-              const size_t idx(Nel*Nel*ilm + iel*Nel + jel);
-              Jsub0+=LMfac*(prim_tei00[idx]*Psub0);
-              Jsub0-=LMfac*(prim_tei02[idx]*Psub2);
-              Jsub2-=LMfac*(prim_tei20[idx]*Psub0);
-              Jsub2+=LMfac*(prim_tei22[idx]*Psub2);
-
-              Jsub0.reshape(Ni,Ni);
-              Jsub2.reshape(Ni,Ni);
-
-              // Increment global Coulomb matrix
-              Jaux0[iLM].submat(ifirst,ifirst,ilast,ilast)+=Jsub0;
-              Jaux2[iLM].submat(ifirst,ifirst,ilast,ilast)+=Jsub2;
+        if(distributed) {
+          // The domains are threaded, so BLAS runs serially
+          threads::KernelPhase phase;
+          // Each domain contracts the elements it holds
+          const int nin(numa::team_size(tei_domains.size()));
+#ifdef _OPENMP
+#pragma omp parallel num_threads(tei_domains.size()) proc_bind(spread)
+#endif
+          {
+#ifdef _OPENMP
+            const size_t idom(omp_get_thread_num());
+#else
+            const size_t idom(0);
+#endif
+            for(size_t parity=0;parity<2;parity++) {
+              for(size_t i=0;i<tei_domains[idom].n_elem;i++) {
+                const size_t jel(tei_domains[idom](i));
+                if(jel%2!=parity)
+                  continue;
+                size_t jfirst, jlast;
+                radial.get_idx(jel,jfirst,jlast);
+                size_t Nj(jlast-jfirst+1);
+                if(block_norms(P,jfirst,jlast).max()<screen_thr)
+                  continue;
+                std::vector<arma::mat> teiwork;
+                std::vector<const arma::mat *> tei(element_tei(jel,teiwork));
+                std::vector<const arma::fmat *> teif(element_tei_single(jel));
+
+                // Each channel has its own radial helpers
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) num_threads(nin) proc_bind(close)
+#endif
+                for(size_t iLM=0;iLM<LM_map.size();iLM++) {
+                  if(!chactive(iLM) || !mpi::owns(lmind(LM_map[iLM].first,LM_map[iLM].second)))
+                    continue;
+                  const size_t Nsym(utils::pair_count(Nj,true));
+                  arma::mat Psub(2*Nsym,Nd);
+                  for(size_t id=0;id<Nd;id++) {
+                    Psub.submat(0,id,Nsym-1,id)=utils::pair_pack(arma::vectorise(Paux0[iLM].slice(id).submat(jfirst,jfirst,jlast,jlast)),Nj,true);
+                    Psub.submat(Nsym,id,2*Nsym-1,id)=utils::pair_pack(arma::vectorise(Paux2[iLM].slice(id).submat(jfirst,jfirst,jlast,jlast)),Nj,true);
+                  }
+                  coulomb_element(jel,iLM,tei,teif,Psub,Jaux0,Jaux2);
+                }
+              }
+#ifdef _OPENMP
+#pragma omp barrier
+#endif
             }
           }
         }
 
-        // Full Coulomb matrix
-        arma::mat J(Ndummy(),Ndummy());
-        J.zeros();
+        // Full Coulomb matrices
+        std::vector<arma::mat> J(Nd);
+        for(size_t id=0;id<Nd;id++)
+          J[id].zeros(Nbf(),Nbf());
         for(size_t iang=0;iang<lval.n_elem;iang++) {
           for(size_t jang=0;jang<lval.n_elem;jang++) {
             // l and m values
@@ -1515,35 +2007,170 @@ namespace helfem {
               // Couplings
               double cpl0(gaunt.mod_coeff(lj,mj,L,M,li,mi));
               if(cpl0!=0.0) {
-                J.submat(iang*Nrad,jang*Nrad,(iang+1)*Nrad-1,(jang+1)*Nrad-1)+=cpl0*Jaux0[iLM];
+                for(size_t id=0;id<Nd;id++)
+                  add_sub(J[id],iang,jang,cpl0*Jaux0[iLM].slice(id));
               }
 
               double cpl2(gaunt.coeff(lj,mj,L,M,li,mi));
               if(cpl2!=0.0) {
-                J.submat(iang*Nrad,jang*Nrad,(iang+1)*Nrad-1,(jang+1)*Nrad-1)+=cpl2*Jaux2[iLM];
+                for(size_t id=0;id<Nd;id++)
+                  add_sub(J[id],iang,jang,cpl2*Jaux2[iLM].slice(id));
               }
             }
           }
         }
 
-        return remove_boundaries(J);
+        // Sum the contributions of the channels of all the MPI ranks
+        mpi::allreduce(J);
+
+        return J;
+      }
+
+      double TwoDBasis::coulomb_prefactor(size_t iLM) const {
+        int L(LM_map[iLM].first);
+        int M(LM_map[iLM].second);
+        return 4.0*M_PI*std::pow(Rhalf,5)*std::pow(-1.0,M)/factorial_ratio(L+std::abs(M),L-std::abs(M));
+      }
+
+      void TwoDBasis::coulomb_element(size_t jel, size_t iLM, const std::vector<const arma::mat *> & tei, const std::vector<const arma::fmat *> & teif, const arma::mat & Psub, std::vector<arma::cube> & Jaux0, std::vector<arma::cube> & Jaux2) const {
+        const size_t Nd(Psub.n_cols);
+        const size_t ilm(lmind(LM_map[iLM].first,LM_map[iLM].second));
+        const double LMfac(coulomb_prefactor(iLM));
+
+        size_t ifirst, ilast;
+        radial.get_idx(jel,ifirst,ilast);
+        size_t Ni(ilast-ifirst+1);
+        const size_t Nsym(utils::pair_count(Ni,true));
+
+        // Contract all four variants of all densities at once
+        arma::mat Jsub;
+        if(teif.size())
+          Jsub=LMfac*arma::conv_to<arma::mat>::from((*teif[ilm])*arma::conv_to<arma::fmat>::from(Psub));
+        else
+          Jsub=LMfac*((*tei[ilm])*Psub);
+        arma::mat Jsub0(utils::pair_unpack(Jsub.rows(0,Nsym-1),Ni,true));
+        arma::mat Jsub2(utils::pair_unpack(Jsub.rows(Nsym,2*Nsym-1),Ni,true));
+
+        // Increment global Coulomb matrix
+        for(size_t id=0;id<Nd;id++) {
+          Jaux0[iLM].slice(id).submat(ifirst,ifirst,ilast,ilast)+=arma::reshape(Jsub0.col(id),Ni,Ni);
+          Jaux2[iLM].slice(id).submat(ifirst,ifirst,ilast,ilast)+=arma::reshape(Jsub2.col(id),Ni,Ni);
+        }
       }
 
       arma::mat TwoDBasis::exchange(const arma::mat & P0) const {
-        if(!prim_ktei00.size())
+        return exchange(std::vector<arma::mat>(1,P0))[0];
+      }
+
+      void TwoDBasis::exchange_rmat(const std::vector<arma::mat> & P, const arma::mat & bdens, size_t jang, size_t kang, size_t first, size_t last, std::vector<arma::cube> * Rmat, std::vector<bool> & couple) const {
+        // Number of densities
+        const size_t Nd(P.size());
+
+        int lj(lval(jang));
+        int mj(mval(jang));
+
+        int lk(lval(kang));
+        int mk(mval(kang));
+
+        // Reset the radial helpers
+        std::fill(couple.begin(),couple.end(),false);
+
+        // Perform angular sums
+        for(size_t iang=0;iang<lval.n_elem;iang++) {
+          int li(lval(iang));
+          int mi(mval(iang));
+
+          for(size_t lang=0;lang<lval.n_elem;lang++) {
+            int ll(lval(lang));
+            int ml(mval(lang));
+
+            // LH m value
+            int M(mj-mi);
+            // RH m value
+            int Mp(mk-ml);
+            if(M!=Mp)
+              continue;
+
+            // Do we have any density in this block?
+            if(bdens(iang,lang)<screen_thr)
+              continue;
+
+            // M values match. Loop over possible couplings
+            int Lmin=std::max(std::max(std::abs(li-lj),std::abs(lk-ll))-2,abs(M));
+            int Lmax=std::min(li+lj,lk+ll)+2;
+
+            for(int L=Lmin;L<=Lmax;L++) {
+              // Calculate total coupling coefficient
+              double cpl[4];
+              cpl[0]=gaunt.mod_coeff(lj,mj,L,M,li,mi)*gaunt.mod_coeff(lk,mk,L,M,ll,ml);
+              cpl[1]=-gaunt.mod_coeff(lj,mj,L,M,li,mi)*gaunt.coeff(lk,mk,L,M,ll,ml);
+              cpl[2]=-gaunt.coeff(lj,mj,L,M,li,mi)*gaunt.mod_coeff(lk,mk,L,M,ll,ml);
+              cpl[3]=gaunt.coeff(lj,mj,L,M,li,mi)*gaunt.coeff(lk,mk,L,M,ll,ml);
+
+              // Is there any coupling?
+              if(cpl[0]==0.0 && cpl[1]==0.0 && cpl[2]==0.0 && cpl[3]==0.0)
+                continue;
+
+              // Index in the L,|M| table
+              const size_t ilm(lmind(L,M));
+              const double LMfac(4.0*M_PI*std::pow(Rhalf,5)*std::pow(-1.0,M)/factorial_ratio(L+std::abs(M),L-std::abs(M)));
+
+              // First coupling to the channel initializes it
+              if(!couple[ilm]) {
+                for(size_t iv=0;iv<4;iv++)
+                  Rmat[iv][ilm].zeros(last-first+1,last-first+1,Nd);
+                couple[ilm]=true;
+              }
+
+              for(size_t id=0;id<Nd;id++) {
+                arma::mat Psub(get_pure_sub(P[id],iang,lang,first,last,first,last));
+                for(size_t iv=0;iv<4;iv++)
+                  Rmat[iv][ilm].slice(id)+=(LMfac*cpl[iv])*Psub;
+              }
+            }
+          }
+        }
+      }
+
+      std::vector<arma::mat> TwoDBasis::exchange(const std::vector<arma::mat> & P0) const {
+        profiler::Region prof("Exchange");
+        // The GEMMs are called from the threads, so BLAS runs serially
+        threads::KernelPhase phase;
+        if(!prim_tei.size() && tei_storage!=scratch::TEI_RECOMPUTE)
           throw std::logic_error("Primitive teis have not been computed!\n");
 
-        // Extend to boundaries
-        arma::mat P(expand_boundaries(P0));
+        // Number of densities
+        const size_t Nd(P0.size());
+        // The densities are used in the pure layout; the radial blocks
+        // are padded with zeros for the boundary functions as needed
+        const std::vector<arma::mat> & P(P0);
+        for(size_t id=0;id<Nd;id++)
+          if(P[id].n_rows != Nbf() || P[id].n_cols != Nbf())
+            throw std::logic_error("Density matrix does not have expected size!\n");
 
         // Number of radial elements
         size_t Nel(radial.Nel());
         // Number of radial basis functions
         size_t Nrad(radial.Nbf());
 
-        // Full exchange matrix
-        arma::mat K(Ndummy(),Ndummy());
-        K.zeros();
+        // Density block norms, maximized over the densities
+        arma::mat bdens(block_norms(P,0,Nrad-1));
+        // For densities that are invariant under m -> -m, so is the
+        // exchange matrix, and only half of the angular pairs are built
+        const bool mirrored(mirror_symmetric(P));
+
+        // Full exchange matrices
+        std::vector<arma::mat> K(Nd);
+        for(size_t id=0;id<Nd;id++)
+          K[id].zeros(Nbf(),Nbf());
+
+        // Angular pairs to build; the pairs are distributed over the
+        // MPI ranks
+        std::vector< std::pair<size_t,size_t> > pairs;
+        for(size_t jang=0;jang<lval.n_elem;jang++)
+          for(size_t kang=0;kang<lval.n_elem;kang++)
+            if((!mirrored || mirror_canonical(jang,kang)) && mpi::owns(jang*lval.n_elem+kang))
+              pairs.push_back(std::make_pair(jang,kang));
 
         // Helper memory
 #ifdef _OPENMP
@@ -1551,185 +2178,253 @@ namespace helfem {
 #else
         const int nth(1);
 #endif
-        std::vector<arma::vec> mem_Krad(nth);
         std::vector<arma::vec> mem_Ksub(nth);
         std::vector<arma::vec> mem_T(nth);
-        std::vector<arma::vec> mem_Psub(nth);
 
+        // Disjoint contributions of the pair (jang,kang) to the output
+        // element iel, from the radial helpers of the 00, 02, 20 and 22
+        // variants
+        auto pair_element = [&](size_t jang, size_t kang, size_t iel, const std::vector<arma::cube> * Rmat, const std::vector<bool> & couple, int ith) {
+          size_t ifirst, ilast;
+          radial.get_idx(iel,ifirst,ilast);
+
+          // Input
+          for(size_t jel=0;jel<Nel;jel++) {
+            // In-element blocks are handled separately below
+            if(iel == jel)
+              continue;
+
+            size_t jfirst, jlast;
+            radial.get_idx(jel,jfirst,jlast);
+
+            // Number of functions in the two elements
+            size_t Ni(ilast-ifirst+1);
+            size_t Nj(jlast-jfirst+1);
+
+            arma::mat T(mem_T[ith].memptr(),Ni*Nj,1,false,true);
+            for(size_t id=0;id<Nd;id++) {
+              arma::mat Ksub(mem_Ksub[ith].memptr(),Ni,Nj,false,true);
+              Ksub.zeros();
+              for(size_t ilm=0;ilm<lm_map.size();ilm++) {
+                if(!couple[ilm])
+                  continue;
+                // Disjoint integrals. When r(iel)>r(jel), iel gets Q, jel gets P.
+                const arma::mat & iint0=(iel>jel) ? disjoint_Q0[ilm*Nel+iel] : disjoint_P0[ilm*Nel+iel];
+                const arma::mat & iint2=(iel>jel) ? disjoint_Q2[ilm*Nel+iel] : disjoint_P2[ilm*Nel+iel];
+                const arma::mat & jint0=(iel>jel) ? disjoint_P0[ilm*Nel+jel] : disjoint_Q0[ilm*Nel+jel];
+                const arma::mat & jint2=(iel>jel) ? disjoint_P2[ilm*Nel+jel] : disjoint_Q2[ilm*Nel+jel];
+
+                // (Niel x Njel) = (Niel x Njel) x (Njel x Njel)
+                T=Rmat[0][ilm].slice(id).submat(ifirst,jfirst,ilast,jlast)*arma::trans(jint0) + Rmat[1][ilm].slice(id).submat(ifirst,jfirst,ilast,jlast)*arma::trans(jint2);
+                Ksub-=iint0*T;
+
+                T=Rmat[2][ilm].slice(id).submat(ifirst,jfirst,ilast,jlast)*arma::trans(jint0) + Rmat[3][ilm].slice(id).submat(ifirst,jfirst,ilast,jlast)*arma::trans(jint2);
+                Ksub-=iint2*T;
+              }
+
+              // Increment global exchange matrix
+              add_pure_sub(K[id],jang,kang,ifirst,jfirst,Ksub);
+            }
+          }
+        };
+
+        // With fewer angular pairs than threads, the output elements of
+        // the pairs are distributed over the threads as well
+        if(pairs.size() >= (size_t) nth) {
 #ifdef _OPENMP
 #pragma omp parallel
 #endif
-        {
+          {
 #ifdef _OPENMP
-          const int ith(omp_get_thread_num());
+            const int ith(omp_get_thread_num());
 #else
-          const int ith(0);
+            const int ith(0);
 #endif
-          // These are only small submatrices!
-          mem_Krad[ith].zeros(radial.Nbf()*radial.Nbf());
-          mem_Ksub[ith].zeros(radial.max_Nprim()*radial.max_Nprim());
-          mem_T[ith].zeros(radial.max_Nprim()*radial.max_Nprim());
-          mem_Psub[ith].zeros(Nrad*Nrad); // Used in agular sum
+            // These are only small submatrices!
+            mem_Ksub[ith].zeros(radial.max_Nprim()*radial.max_Nprim()*Nd);
+            mem_T[ith].zeros(radial.max_Nprim()*radial.max_Nprim()*radial.max_Nprim());
+
+            // Radial helpers, reused across the angular pairs; the
+            // slices hold the densities
+            std::vector<arma::cube> Rmat[4];
+            for(size_t iv=0;iv<4;iv++)
+              Rmat[iv].resize(lm_map.size());
+            // Is there a coupling to the channel?
+            std::vector<bool> couple(lm_map.size(),false);
 
-          // Increment
 #ifdef _OPENMP
-#pragma omp for collapse(2)
+#pragma omp for schedule(dynamic)
 #endif
-          for(size_t jang=0;jang<lval.n_elem;jang++) {
-            for(size_t kang=0;kang<lval.n_elem;kang++) {
-              int lj(lval(jang));
-              int mj(mval(jang));
+            for(size_t ip=0;ip<pairs.size();ip++) {
+              exchange_rmat(P,bdens,pairs[ip].first,pairs[ip].second,0,Nrad-1,Rmat,couple);
+              for(size_t iel=0;iel<Nel;iel++)
+                pair_element(pairs[ip].first,pairs[ip].second,iel,Rmat,couple,ith);
+            }
+          }
+        } else {
+          for(int ith=0;ith<nth;ith++) {
+            mem_Ksub[ith].zeros(radial.max_Nprim()*radial.max_Nprim()*Nd);
+            mem_T[ith].zeros(radial.max_Nprim()*radial.max_Nprim()*radial.max_Nprim());
+          }
 
-              int lk(lval(kang));
-              int mk(mval(kang));
-
-              // Form radial helpers
-              std::vector<arma::mat> Rmat00(lm_map.size());
-              std::vector<arma::mat> Rmat02(lm_map.size());
-              std::vector<arma::mat> Rmat20(lm_map.size());
-              std::vector<arma::mat> Rmat22(lm_map.size());
-              for(size_t i=0;i<lm_map.size();i++) {
-                Rmat00[i].zeros(Nrad,Nrad);
-                Rmat02[i].zeros(Nrad,Nrad);
-                Rmat20[i].zeros(Nrad,Nrad);
-                Rmat22[i].zeros(Nrad,Nrad);
+          // Radial helpers of all the pairs
+          std::vector< std::vector<arma::cube> > Rmat(4*pairs.size(),std::vector<arma::cube>(lm_map.size()));
+          std::vector< std::vector<bool> > couple(pairs.size(),std::vector<bool>(lm_map.size(),false));
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+          for(size_t ip=0;ip<pairs.size();ip++)
+            exchange_rmat(P,bdens,pairs[ip].first,pairs[ip].second,0,Nrad-1,&Rmat[4*ip],couple[ip]);
+
+          // Adjacent elements share a radial function, so the even
+          // elements are done before the odd ones to keep the updates
+          // disjoint
+          for(size_t parity=0;parity<2;parity++) {
+            const size_t ntask((Nel+1-parity)/2);
+#ifdef _OPENMP
+#pragma omp parallel for collapse(2) schedule(dynamic)
+#endif
+            for(size_t ip=0;ip<pairs.size();ip++)
+              for(size_t itask=0;itask<ntask;itask++) {
+#ifdef _OPENMP
+                const int ith(omp_get_thread_num());
+#else
+                const int ith(0);
+#endif
+                pair_element(pairs[ip].first,pairs[ip].second,2*itask+parity,&Rmat[4*ip],couple[ip],ith);
               }
-              // Is there a coupling to the channel?
-              std::vector<bool> couple(lm_map.size(),false);
-
-              // Perform angular sums
-              for(size_t iang=0;iang<lval.n_elem;iang++) {
-                int li(lval(iang));
-                int mi(mval(iang));
-
-                for(size_t lang=0;lang<lval.n_elem;lang++) {
-                  int ll(lval(lang));
-                  int ml(mval(lang));
-
-                  // LH m value
-                  int M(mj-mi);
-                  // RH m value
-                  int Mp(mk-ml);
-                  if(M!=Mp)
-                    continue;
+          }
+        }
 
-                  // Do we have any density in this block?
-                  double bdens(arma::norm(P.submat(iang*Nrad,lang*Nrad,(iang+1)*Nrad-1,(lang+1)*Nrad-1),"fro"));
-                  //printf("(%i %i) (%i %i) density block norm %e\n",li,mi,ll,ml,bdens);
-                  if(bdens<10*DBL_EPSILON)
-                    continue;
+        /*
+          In-element contributions. The elements are handled one at a
+          time so that out-of-core integrals are streamed sequentially,
+          and recomputed integrals are only held for a single element.
 
-                  // M values match. Loop over possible couplings
-                  int Lmin=std::max(std::max(std::abs(li-lj),std::abs(lk-ll))-2,abs(M));
-                  int Lmax=std::min(li+lj,lk+ll)+2;
-
-                  for(int L=Lmin;L<=Lmax;L++) {
-                    // Calculate total coupling coefficient
-                    double cpl00(gaunt.mod_coeff(lj,mj,L,M,li,mi)*gaunt.mod_coeff(lk,mk,L,M,ll,ml));
-                    double cpl02(-gaunt.mod_coeff(lj,mj,L,M,li,mi)*gaunt.coeff(lk,mk,L,M,ll,ml));
-                    double cpl20(-gaunt.coeff(lj,mj,L,M,li,mi)*gaunt.mod_coeff(lk,mk,L,M,ll,ml));
-                    double cpl22(gaunt.coeff(lj,mj,L,M,li,mi)*gaunt.coeff(lk,mk,L,M,ll,ml));
-
-                    // Is there any coupling?
-                    if(cpl00==0.0 && cpl02==0.0 && cpl20==0.0 && cpl22==0.0)
-                      continue;
-
-                    // Index in the L,|M| table
-                    const size_t ilm(lmind(L,M));
-                    const double LMfac(4.0*M_PI*std::pow(Rhalf,5)*std::pow(-1.0,M)/factorial_ratio(L+std::abs(M),L-std::abs(M)));
-
-                    arma::mat Psub(mem_Psub[ith].memptr(),Nrad,Nrad,false,true);
-                    Psub=P.submat(iang*Nrad,lang*Nrad,(iang+1)*Nrad-1,(lang+1)*Nrad-1);
-
-                    Rmat00[ilm]+=(LMfac*cpl00)*Psub;
-                    Rmat02[ilm]+=(LMfac*cpl02)*Psub;
-                    Rmat20[ilm]+=(LMfac*cpl20)*Psub;
-                    Rmat22[ilm]+=(LMfac*cpl22)*Psub;
-                    couple[ilm]=true;
-                  }
-                }
-              }
+          The exchange matrix is given by
+          K(jk) = (ij|kl) P(il)
+          i.e. the complex conjugation hits i and l as in the density
+          matrix. The in-element integrals are stored in Coulomb order
+          in the pair-symmetric subspace, fused as in compute_tei. The
+          00, 02, 20 and 22 variants are unpacked one l at a time to the
+          tile (ij,k), which contracts with the column P(i,l).
+        */
+        if(tei_domains.size() && prim_tei.size()) {
+          // Each domain contracts the elements it holds
+          const int nin(numa::team_size(tei_domains.size()));
+#ifdef _OPENMP
+#pragma omp parallel num_threads(tei_domains.size()) proc_bind(spread)
+#endif
+          {
+#ifdef _OPENMP
+            const size_t idom(omp_get_thread_num());
+#else
+            const size_t idom(0);
+#endif
+            std::vector<arma::mat> teiwork;
+            for(size_t parity=0;parity<2;parity++) {
+              for(size_t i=0;i<tei_domains[idom].n_elem;i++)
+                if(tei_domains[idom](i)%2==parity)
+                  exchange_element(P,tei_domains[idom](i),teiwork,mirrored,mem_T,idom*nin,K,nin);
+#ifdef _OPENMP
+#pragma omp barrier
+#endif
+            }
+          }
+        } else {
+          std::vector<arma::mat> teiwork;
+          arma::uvec elorder(element_order());
+          for(size_t iiel=0;iiel<Nel;iiel++)
+            exchange_element(P,elorder(iiel),teiwork,mirrored,mem_T,0,K,nth);
+        }
 
-              // Loop over elements: output
-              for(size_t iel=0;iel<Nel;iel++) {
-                size_t ifirst, ilast;
-                radial.get_idx(iel,ifirst,ilast);
+        // Sum the contributions of all the MPI ranks
+        mpi::allreduce(K);
 
-                // Input
-                for(size_t jel=0;jel<Nel;jel++) {
-                  size_t jfirst, jlast;
-                  radial.get_idx(jel,jfirst,jlast);
-
-                  // Number of functions in the two elements
-                  size_t Ni(ilast-ifirst+1);
-                  size_t Nj(jlast-jfirst+1);
-
-                  if(iel == jel) {
-                    /*
-                      The exchange matrix is given by
-                      K(jk) = (ij|kl) P(il)
-                      i.e. the complex conjugation hits i and l as
-                      in the density matrix.
-
-                      To get this in the proper order, we permute the integrals
-                      K(jk) = (jk;il) P(il)
-                    */
-
-                    // Exchange submatrix
-                    arma::mat Ksub(mem_Ksub[ith].memptr(),Ni*Nj,1,false,true);
-                    Ksub.zeros();
-
-                    for(size_t ilm=0;ilm<lm_map.size();ilm++) {
-                      if(!couple[ilm])
-                        continue;
-                      // Index in tei array
-                      size_t idx=Nel*Nel*ilm + iel*Nel + jel;
-                      Ksub+=prim_ktei00[idx]*arma::vectorise(Rmat00[ilm].submat(ifirst,jfirst,ilast,jlast));
-                      Ksub+=prim_ktei02[idx]*arma::vectorise(Rmat02[ilm].submat(ifirst,jfirst,ilast,jlast));
-                      Ksub+=prim_ktei20[idx]*arma::vectorise(Rmat20[ilm].submat(ifirst,jfirst,ilast,jlast));
-                      Ksub+=prim_ktei22[idx]*arma::vectorise(Rmat22[ilm].submat(ifirst,jfirst,ilast,jlast));
-                    }
+        // Pairs that were skipped are copied from their mirror images
+        if(mirrored)
+          mirror_fill(K);
 
-                    Ksub.reshape(Ni,Nj);
-
-                    // Increment global exchange matrix
-                    K.submat(jang*Nrad+ifirst,kang*Nrad+jfirst,jang*Nrad+ilast,kang*Nrad+jlast)-=Ksub;
-
-                    //arma::vec Ptgt(arma::vectorise(P.submat(jang*Nrad+ifirst,kang*Nrad+jfirst,jang*Nrad+ilast,kang*Nrad+jlast)));
-                    //printf("(%i %i) (%i %i) (%i %i) (%i %i) [%i %i]\n",li,mi,lj,mj,lk,mk,ll,ml,L,M);
-                    //printf("Element %i - %i contribution to exchange energy % .10e\n",(int) iel,(int) jel,-0.5*arma::dot(Ksub,Ptgt));
-
-                  } else {
-                    arma::mat Ksub(mem_Ksub[ith].memptr(),Ni,Nj,false,true);
-                    Ksub.zeros();
-                    arma::mat T(mem_T[ith].memptr(),Ni*Nj,1,false,true);
-                    for(size_t ilm=0;ilm<lm_map.size();ilm++) {
-                      if(!couple[ilm])
-                        continue;
-                      // Disjoint integrals. When r(iel)>r(jel), iel gets Q, jel gets P.
-                      const arma::mat & iint0=(iel>jel) ? disjoint_Q0[ilm*Nel+iel] : disjoint_P0[ilm*Nel+iel];
-                      const arma::mat & iint2=(iel>jel) ? disjoint_Q2[ilm*Nel+iel] : disjoint_P2[ilm*Nel+iel];
-                      const arma::mat & jint0=(iel>jel) ? disjoint_P0[ilm*Nel+jel] : disjoint_Q0[ilm*Nel+jel];
-                      const arma::mat & jint2=(iel>jel) ? disjoint_P2[ilm*Nel+jel] : disjoint_Q2[ilm*Nel+jel];
-
-                      // (Niel x Njel) = (Niel x Njel) x (Njel x Njel)
-                      T=Rmat00[ilm].submat(ifirst,jfirst,ilast,jlast)*arma::trans(jint0) + Rmat02[ilm].submat(ifirst,jfirst,ilast,jlast)*arma::trans(jint2);
-                      Ksub-=iint0*T;
-
-                      T=Rmat20[ilm].submat(ifirst,jfirst,ilast,jlast)*arma::trans(jint0) + Rmat22[ilm].submat(ifirst,jfirst,ilast,jlast)*arma::trans(jint2);
-                      Ksub-=iint2*T;
-                    }
+        return K;
+      }
+
+      void TwoDBasis::exchange_element(const std::vector<arma::mat> & P, size_t iel, std::vector<arma::mat> & teiwork, bool mirrored, std::vector<arma::vec> & mem_T, size_t ioff, std::vector<arma::mat> & K, int nthr) const {
+        const size_t Nd(P.size());
+
+        size_t ifirst, ilast;
+        radial.get_idx(iel,ifirst,ilast);
+        size_t Ni(ilast-ifirst+1);
+        const size_t Nsym(utils::pair_count(Ni,true));
+        // Density block norms within the element
+        arma::mat edens(block_norms(P,ifirst,ilast));
+        if(edens.max()<screen_thr)
+          return;
+        std::vector<const arma::mat *> tei(element_tei(iel,teiwork));
+        std::vector<const arma::fmat *> teif(element_tei_single(iel));
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads(nthr)
+#endif
+        {
+#ifdef _OPENMP
+          const size_t ith(ioff+omp_get_thread_num());
+#else
+          const size_t ith(ioff);
+#endif
+          // Element blocks of the radial helpers
+          std::vector<arma::cube> Rmat[4];
+          for(size_t iv=0;iv<4;iv++)
+            Rmat[iv].resize(lm_map.size());
+          std::vector<bool> couple(lm_map.size(),false);
+          arma::mat Ksub(Ni*Ni,Nd);
+          arma::mat Rsub(Ni*Ni,Nd);
+          arma::mat tile(mem_T[ith].memptr(),Ni*Ni,Ni,false,true);
+          arma::fmat tilef;
+          if(teif.size())
+            tilef.set_size(Ni*Ni,Ni);
 
-                    // Increment global exchange matrix
-                    K.submat(jang*Nrad+ifirst,kang*Nrad+jfirst,jang*Nrad+ilast,kang*Nrad+jlast)+=Ksub;
+#ifdef _OPENMP
+#pragma omp for collapse(2) schedule(dynamic)
+#endif
+          for(size_t jang=0;jang<lval.n_elem;jang++) {
+            for(size_t kang=0;kang<lval.n_elem;kang++) {
+              if(mirrored && !mirror_canonical(jang,kang))
+                continue;
+              exchange_rmat(P,edens,jang,kang,ifirst,ilast,Rmat,couple);
+
+              Ksub.zeros();
+              bool any=false;
+              for(size_t ilm=0;ilm<lm_map.size();ilm++) {
+                // The in-element integrals of the channel live on its MPI rank
+                if(!couple[ilm] || !mpi::owns(ilm))
+                  continue;
+                any=true;
+                for(size_t iv=0;iv<4;iv++) {
+                  // Variant (ab) lives in block (a,b) of the fused matrix
+                  const size_t ib(iv/2), jb(iv%2);
+                  const double fac((ib==jb) ? 1.0 : -1.0);
+                  for(size_t id=0;id<Nd;id++)
+                    Rsub.col(id)=arma::vectorise(Rmat[iv][ilm].slice(id));
+                  for(size_t l=0;l<Ni;l++) {
+                    if(teif.size()) {
+                      utils::pair_tei_tile(*teif[ilm],Ni,l,tilef,fac,ib*Nsym,jb*Nsym);
+                      Ksub+=arma::conv_to<arma::mat>::from(arma::trans(arma::fmat(tilef.memptr(),Ni,Ni*Ni,false,true))*arma::conv_to<arma::fmat>::from(Rsub.rows(l*Ni,(l+1)*Ni-1)));
+                    } else {
+                      utils::pair_tei_tile(*tei[ilm],Ni,l,tile,fac,ib*Nsym,jb*Nsym);
+                      Ksub+=arma::trans(arma::mat(tile.memptr(),Ni,Ni*Ni,false,true))*Rsub.rows(l*Ni,(l+1)*Ni-1);
+                    }
                   }
                 }
               }
+              if(!any)
+                continue;
+
+              // Increment global exchange matrices
+              for(size_t id=0;id<Nd;id++)
+                add_pure_sub(K[id],jang,kang,ifirst,ifirst,-arma::reshape(Ksub.col(id),Ni,Ni));
             }
           }
         }
-
-        return remove_boundaries(K);
       }
 
       arma::mat TwoDBasis::remove_boundaries(const arma::mat & Fnob) const {
@@ -1777,17 +2472,13 @@ namespace helfem {
           throw std::logic_error("Matrix has incorrect size!\n");
         if(M.n_cols != Nbf())
           throw std::logic_error("Matrix has incorrect size!\n");
-        M=expand_boundaries(M);
-
         // Number of functions in radial basis
         size_t Nrad=radial.Nbf();
 
         for(size_t iang=0;iang<lval.n_elem;iang++)
           for(size_t jang=0;jang<lval.n_elem;jang++)
             if(lval(iang)>lmax || lval(jang)>lmax)
-              M.submat(iang*Nrad,jang*Nrad,(iang+1)*Nrad-1,(jang+1)*Nrad-1).zeros();
-
-        M=remove_boundaries(M);
+              set_sub(M,iang,jang,arma::zeros<arma::mat>(Nrad,Nrad));
       }
 
       arma::cx_mat TwoDBasis::eval_bf(size_t iel, size_t irad, double cth, double phi) const {
@@ -1826,6 +2517,10 @@ namespace helfem {
       }
 
       arma::mat TwoDBasis::eval_bf(size_t iel, size_t irad, double cth, int m) const {
+        return eval_bf(iel,cth,m).rows(irad,irad);
+      }
+
+      arma::mat TwoDBasis::eval_bf(size_t iel, double cth, int m) const {
         // Figure out list of functions
         std::vector<arma::uword> flist;
         for(size_t i=0;i<mval.n_elem;i++)
@@ -1839,7 +2534,6 @@ namespace helfem {
 
         // Evaluate radial functions
         arma::mat rad(radial.get_bf(iel));
-        rad=rad.rows(irad,irad);
 
         // Form supermatrix
         arma::mat bf(rad.n_rows,flist.size()*rad.n_cols);
@@ -1887,6 +2581,60 @@ namespace helfem {
 	return bf(pure_indices());
       }
 
+      arma::cx_mat TwoDBasis::eval_bf(const arma::mat & points) const {
+        if(points.n_cols != 3) {
+          std::ostringstream oss;
+          oss << "Points should be given as rows of (mu, cth, phi), but " << points.n_cols << " columns were given!\n";
+          throw std::logic_error(oss.str());
+        }
+
+        // Sort the points into the radial elements
+        arma::vec bval(radial.get_bval());
+        const size_t Nel(bval.n_elem-1);
+        std::vector< std::vector<arma::uword> > elpts(Nel);
+        for(size_t ip=0;ip<points.n_rows;ip++) {
+          double mu(points(ip,0));
+          if(mu<bval(0) || mu>bval(Nel))
+            continue;
+          size_t iel(std::upper_bound(bval.begin(),bval.end(),mu)-bval.begin());
+          iel=std::min(iel-1,Nel-1);
+          elpts[iel].push_back(ip);
+        }
+
+        // Spherical harmonics at all the points
+        arma::cx_mat Y, dYth, dYphi;
+        ::spherical_harmonics(arma::max(lval),points.col(1),points.col(2),Y,dYth,dYphi,false);
+        arma::uvec shidx(lval.n_elem);
+        for(size_t i=0;i<lval.n_elem;i++)
+          shidx(i)=::spherical_harmonics_index(lval(i),mval(i));
+        arma::cx_mat sph(arma::strans(Y.rows(shidx)));
+
+        arma::cx_mat bf(points.n_rows,Ndummy(),arma::fill::zeros);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,1)
+#endif
+        for(size_t iel=0;iel<Nel;iel++) {
+          if(!elpts[iel].size())
+            continue;
+          arma::uvec idx(arma::conv_to<arma::uvec>::from(elpts[iel]));
+
+          // Primitive coordinates and radial functions
+          arma::vec mu(points.col(0));
+          arma::vec x(2.0*(mu(idx)-bval(iel))/(bval(iel+1)-bval(iel)) - 1.0);
+          arma::cx_mat rad(arma::conv_to<arma::cx_mat>::from(radial.get_bf(iel,x)));
+          arma::cx_mat sphsub(sph.rows(idx));
+
+          size_t ifirst, ilast;
+          radial.get_idx(iel,ifirst,ilast);
+          for(size_t i=0;i<lval.n_elem;i++) {
+            arma::uvec cols(arma::linspace<arma::uvec>(i*radial.Nbf()+ifirst,i*radial.Nbf()+ilast,ilast-ifirst+1));
+            bf.submat(idx,cols)=rad.each_col()%sphsub.col(i);
+          }
+        }
+
+        return bf.cols(pure_indices());
+      }
+
       void TwoDBasis::eval_df(size_t iel, size_t irad, double cth, double phi, arma::cx_mat & dr, arma::cx_mat & dth, arma::cx_mat & dphi) const {
         // Evaluate spherical harmonics
         arma::cx_vec sph(lval.n_elem);
@@ -1959,6 +2707,25 @@ namespace helfem {
         return arma::conv_to<arma::uvec>::from(mapidx);
       }
 
+      void TwoDBasis::dummy_to_pure(const arma::uvec & idx, arma::uvec & loc, arma::uvec & pure) const {
+        size_t Nrad(radial.Nbf());
+        std::vector<arma::uword> l, p;
+        l.reserve(idx.n_elem);
+        p.reserve(idx.n_elem);
+        for(size_t i=0;i<idx.n_elem;i++) {
+          size_t iang(idx(i)/Nrad);
+          size_t irad(idx(i)%Nrad);
+          if(iang>=lval.n_elem)
+            throw std::logic_error("Invalid index vector!\n");
+          if(irad<pure_first(iang))
+            continue;
+          l.push_back(i);
+          p.push_back(pure_offset(iang)+irad-pure_first(iang));
+        }
+        loc=arma::conv_to<arma::uvec>::from(l);
+        pure=arma::conv_to<arma::uvec>::from(p);
+      }
+
       arma::uvec TwoDBasis::bf_list_dummy(size_t iel) const {
         // Radial functions in element
         size_t ifirst, ilast;
@@ -2025,10 +2792,11 @@ namespace helfem {
         // List of functions in the first element
         arma::uvec fidx(bf_list_dummy(0));
 
-        // Expand density matrix to boundary conditions
-        arma::mat P(expand_boundaries(P0));
-        // and grab the contribution from the first element
-        P=P(fidx,fidx);
+        // Grab the contribution from the first element
+        arma::uvec floc, fpure;
+        dummy_to_pure(fidx,floc,fpure);
+        arma::mat P(fidx.n_elem,fidx.n_elem,arma::fill::zeros);
+        P(floc,floc)=P0(fpure,fpure);
 
         // Nucleus is at -1 on the primitive polynomial interval [-1,1]
         arma::vec x(1);
@@ -20,6 +20,11 @@
 #include "FiniteElementBasis.h"
 #include "../general/gaunt.h"
 #include "../general/legendretable.h"
+#include "../general/scratch.h"
+#include <list>
+#include <map>
+
+class Checkpoint;
 
 namespace helfem {
   namespace diatomic {
@@ -77,6 +82,10 @@ namespace helfem {
         /// Form overlap matrix
         arma::mat overlap(const RadialBasis & rh, int n) const;
 
+        /// Get cosh(mu) at the quadrature nodes of the element
+        arma::vec get_chmu(size_t iel) const;
+        /// Compute integral of sinh(mu) cosh^k(mu) f(mu) with f tabulated at the quadrature nodes by get_chmu
+        arma::mat legendre_integral(int k, size_t iel, const arma::vec & flm) const;
         /// Compute Plm integral
         arma::mat Plm_integral(int beta, size_t iel, int L, int M, const legendretable::LegendreTable & legtab) const;
         /// Compute Qlm integral
@@ -112,6 +121,9 @@ namespace helfem {
 
       /// Two-dimensional basis set
       class TwoDBasis {
+        /// Integral cache accesses the integral arrays
+        friend class ::Checkpoint;
+
         /// Nuclear charges
         int Z1, Z2;
         /// Half-bond distance
@@ -126,6 +138,10 @@ namespace helfem {
 
         /// Gaunt coefficient table
         gaunt::Gaunt gaunt;
+        /// Padding used in the Legendre function table
+        int lpad;
+        /// Tolerance for choosing the padding automatically, up to lpad
+        double lpadthr;
         /// Legendre function table
         legendretable::LegendreTable legtab;
 
@@ -137,17 +153,82 @@ namespace helfem {
         std::vector<arma::mat> disjoint_P0, disjoint_P2;
         /// Auxiliary integrals, Qlm
         std::vector<arma::mat> disjoint_Q0, disjoint_Q2;
-        /// Primitive two-electron integrals: <Nel^2 * N_L>
-        std::vector<arma::mat> prim_tei00, prim_tei02, prim_tei20, prim_tei22;
-        /// Primitive two-electron integrals: <Nel^2 * N_L> sorted for exchange
-        std::vector<arma::mat> prim_ktei00, prim_ktei02, prim_ktei20, prim_ktei22;
-
-        /// Add to radial submatrix
+        /// Primitive in-element two-electron integrals: <Nel * N_L> in the pair-symmetric subspace. The 00, 02, 20 and 22 variants are fused as [00 -02; -20 22]. With MPI, the blocks of the (L,|M|) channels owned by other ranks are empty
+        std::vector<arma::mat> prim_tei;
+        /// Single-precision copies of prim_tei, used in the early SCF iterations
+        std::vector<arma::fmat> prim_tei_single;
+        /// Storage of the primitive two-electron integrals
+        scratch::tei_storage_t tei_storage;
+        /// Memory budget for the primitive two-electron integrals in bytes, zero for unlimited
+        size_t tei_budget;
+        /// Scratch directory for out-of-core integrals
+        std::string tei_scratch;
+        /// Memory map backing out-of-core integrals
+        std::shared_ptr<scratch::MappedFile> tei_map;
+        /// Number of recomputed elements kept in the cache
+        size_t tei_ncache;
+        /// Cache of recomputed in-element integrals, most recently used element first
+        mutable std::list< std::pair< size_t, std::vector<arma::mat> > > tei_lru;
+        /// Order in which the elements are contracted: cached elements first
+        arma::uvec element_order() const;
+        /// Number of NUMA domains requested for the in-core integrals
+        size_t tei_ndom;
+        /// Elements whose integrals live in each NUMA domain; empty when the integrals are not distributed
+        std::vector<arma::uvec> tei_domains;
+        /// Form tei_domains for the current storage
+        void partition_tei();
+        /// Threshold for skipping density blocks in the Coulomb and exchange builds
+        double screen_thr;
+        /// Number of active and total (L,M) channels in the last Coulomb build
+        mutable size_t coulomb_nactive, coulomb_ntot;
+        /// Norms of the angular blocks of the pure-layout densities restricted to the radial functions first to last, maximized over the densities
+        arma::mat block_norms(const std::vector<arma::mat> & P, size_t first, size_t last) const;
+        /// Compute the fused in-element integrals of element iel for the (L,|M|) index ilm
+        arma::mat element_tei(size_t ilm, size_t iel) const;
+        /// Get the single-precision in-element integrals of element iel for all (L,|M|); empty if they are not in use
+        std::vector<const arma::fmat *> element_tei_single(size_t iel) const;
+        /// Get the in-element integrals of element iel for all (L,|M|), recomputing them into work if prim_tei is empty
+        std::vector<const arma::mat *> element_tei(size_t iel, std::vector<arma::mat> & work) const;
+
+        /// Offsets of the angular shells in the pure layout
+        arma::uvec pure_offset;
+        /// Form the offsets of the angular shells in the pure layout
+        void form_pure_offsets();
+        /// First radial function of shell iang that survives the boundary conditions
+        size_t pure_first(size_t iang) const;
+        /// Dummy-layout block of radial functions rfirst to rlast of shell iang and cfirst to clast of shell jang of a matrix in the pure layout; the functions removed by the boundary conditions give zeros
+        arma::mat get_pure_sub(const arma::mat & M, size_t iang, size_t jang, size_t rfirst, size_t rlast, size_t cfirst, size_t clast) const;
+        /// Add a dummy-layout block starting at radial functions rfirst of shell iang and cfirst of shell jang to a matrix in the pure layout; the functions removed by the boundary conditions are dropped
+        void add_pure_sub(arma::mat & M, size_t iang, size_t jang, size_t rfirst, size_t cfirst, const arma::mat & Msub) const;
+
+        /// Add to radial submatrix of a matrix in the pure layout
         void add_sub(arma::mat & M, size_t iang, size_t jang, const arma::mat & Msub) const;
-        /// Set radial submatrix
+        /// Set radial submatrix of a matrix in the pure layout. The (iang,jang) blocks do not overlap, so the fill loops over them run in parallel with every thread writing its own blocks
         void set_sub(arma::mat & M, size_t iang, size_t jang, const arma::mat & Msub) const;
-        /// Get radial submatrix
+        /// Get radial submatrix of a matrix in the pure layout
         arma::mat get_sub(const arma::mat & M, size_t iang, size_t jang) const;
+        /// Radial integrals sinh^m cosh^n computed so far; the one-electron matrices share them
+        mutable std::map< std::pair<int,int>, arma::mat > radint_cache;
+        /// Get the radial integral sinh^m cosh^n, computing it on first use
+        const arma::mat & radial_matrix(int m, int n) const;
+
+        /// Index of the shell with the same l and opposite m for every angular shell, -1 if the basis has no such shell
+        arma::ivec shell_mirror() const;
+        /// Are the pure-layout densities invariant under m -> -m?
+        bool mirror_symmetric(const std::vector<arma::mat> & P) const;
+        /// Is (jang,kang) the representative of its pair of exchange blocks related by m -> -m?
+        bool mirror_canonical(size_t jang, size_t kang) const;
+        /// Copy the exchange blocks of the pairs that are not representative from their mirror images
+        void mirror_fill(std::vector<arma::mat> & K) const;
+
+        /// Angular sums of the pure-layout exchange densities for the output pair (jang,kang), restricted to the radial functions first to last. Rmat holds the 00, 02, 20 and 22 variants
+        void exchange_rmat(const std::vector<arma::mat> & P, const arma::mat & bdens, size_t jang, size_t kang, size_t first, size_t last, std::vector<arma::cube> * Rmat, std::vector<bool> & couple) const;
+        /// Prefactor of the (L,M) channel iLM in the Coulomb matrix
+        double coulomb_prefactor(size_t iLM) const;
+        /// In-element Coulomb contribution of element jel to the radial helpers of channel iLM, given the stacked (0, 2) pair-symmetric densities Psub
+        void coulomb_element(size_t jel, size_t iLM, const std::vector<const arma::mat *> & tei, const std::vector<const arma::fmat *> & teif, const arma::mat & Psub, std::vector<arma::cube> & Jaux0, std::vector<arma::cube> & Jaux2) const;
+        /// In-element exchange contribution of element iel, using nthr threads whose work arrays start at mem_T[ioff]
+        void exchange_element(const std::vector<arma::mat> & P, size_t iel, std::vector<arma::mat> & teiwork, bool mirrored, std::vector<arma::vec> & mem_T, size_t ioff, std::vector<arma::mat> & K, int nthr) const;
 
         /// Find index in (L,|M|) table
         size_t lmind(int L, int M, bool check=true) const;
@@ -158,7 +239,7 @@ namespace helfem {
         // Dummy constructor
         TwoDBasis();
         /// Constructor
-        TwoDBasis(int Z1, int Z2, double Rhalf, const std::shared_ptr<const polynomial_basis::PolynomialBasis> &poly, int n_quad, const arma::vec & bval, const arma::ivec & lval, const arma::ivec & mval, int lpad=0, bool legendre=true);
+        TwoDBasis(int Z1, int Z2, double Rhalf, const std::shared_ptr<const polynomial_basis::PolynomialBasis> &poly, int n_quad, const arma::vec & bval, const arma::ivec & lval, const arma::ivec & mval, int lpad=0, bool legendre=true, double lpadthr=0.0);
         /// Destructor
         ~TwoDBasis();
 
@@ -168,6 +249,8 @@ namespace helfem {
         int get_Z2() const;
         /// Get Rhalf
         double get_Rhalf() const;
+        /// Change the bond length. Rhalf only enters the integrals as a prefactor, so the primitive integrals stay valid; the elements stay fixed in mu
+        void set_Rhalf(double Rhalf);
 
         /// Get l values
         arma::ivec get_lval() const;
@@ -201,8 +284,24 @@ namespace helfem {
         /// Memory for auxiliary two-electron integrals
         size_t mem_2el_aux() const;
 
-        /// Compute two-electron integrals
-        void compute_tei(bool exchange);
+        /// Set memory budget in bytes (zero for unlimited) and scratch directory for the primitive two-electron integrals. Direct mode always recomputes them, keeping the ncache most recently used elements
+        void set_tei_storage(size_t budget, const std::string & scratch, bool direct=false, size_t ncache=0);
+        /// Get storage of the primitive two-electron integrals
+        scratch::tei_storage_t get_tei_storage() const;
+        /// Set threshold for skipping density blocks in the Coulomb and exchange builds; the default is 10*DBL_EPSILON
+        void set_screening(double thr);
+        /// Get the number of (L,M) channels that survived the density screening in the last Coulomb build, and the total number
+        void get_coulomb_channels(size_t & nactive, size_t & ntot) const;
+        /// Compute two-electron integrals; verbose prints thread load balance
+        void compute_tei(bool verbose=false);
+        /// Contract the in-element integrals in single precision? Only available for in-core integrals, which are kept in both precisions while this is on
+        void set_tei_single(bool single);
+        /// Are the in-element integrals contracted in single precision?
+        bool get_tei_single() const;
+        /// Distribute the in-core integrals over ndom NUMA domains, zero for none; takes effect in compute_tei
+        void set_numa(size_t ndom);
+        /// Move the in-core integrals to the NUMA domains that contract them, e.g. after they have been read from disk
+        void distribute_tei();
 
         /// Number of basis functions
         size_t Nbf() const;
@@ -245,11 +344,17 @@ namespace helfem {
 
         /// Form Coulomb matrix
         arma::mat coulomb(const arma::mat & P) const;
+        /// Form Coulomb matrices of several densities in one pass over the integrals
+        std::vector<arma::mat> coulomb(const std::vector<arma::mat> & P) const;
         /// Form exchange matrix
         arma::mat exchange(const arma::mat & P) const;
+        /// Form exchange matrices of several densities in one pass over the integrals
+        std::vector<arma::mat> exchange(const std::vector<arma::mat> & P) const;
 
         /// Get primitive integrals
         std::vector<arma::mat> get_prim_tei() const;
+        /// Fingerprint of the parameters that determine the primitive integrals
+        std::string tei_fingerprint() const;
 
         /// Set elements to zero
         void set_zero(int lmax, arma::mat & M) const;
@@ -264,6 +369,10 @@ namespace helfem {
         arma::uvec m_indices(int m, bool odd) const;
         /// Get indices for wanted symmetry
         std::vector<arma::uvec> get_sym_idx(int isym) const;
+        /// Permutation taking every basis function to its partner with opposite m; empty if the basis is not closed under m -> -m
+        arma::uvec mirror_indices() const;
+        /// For every block of get_sym_idx(isym), the earlier block with opposite m whose orbitals it shares, or -1 if the block is solved itself
+        arma::ivec get_sym_mirror(int isym) const;
 
         /// Evaluate basis functions at quadrature points
         arma::cx_mat eval_bf(size_t iel, size_t irad, double cth, double phi) const;
@@ -271,14 +380,27 @@ namespace helfem {
         arma::cx_mat eval_bf(size_t iel, const arma::vec & x, double cth, double phi) const;
         /// Evaluate basis functions with m=m at quadrature point
         arma::mat eval_bf(size_t iel, size_t irad, double cth, int m) const;
+        /// Evaluate basis functions with m=m at all quadrature points in the element
+        arma::mat eval_bf(size_t iel, double cth, int m) const;
 
 	/// Evaluate basis functions at wanted point
 	arma::cx_vec eval_bf(double mu, double cth, double phi) const;
+        /**
+         * Evaluate basis functions at arbitrary points, given as rows of
+         * (mu, cos nu, phi). The points are sorted into radial elements
+         * with a binary search, and the functions in each element are
+         * evaluated at all of its points at once. Row i of the returned
+         * matrix holds the values at the i:th point; points outside the
+         * basis give zero rows.
+         */
+        arma::cx_mat eval_bf(const arma::mat & points) const;
 
         /// Evaluate basis functions derivatives at quadrature points
         void eval_df(size_t iel, size_t irad, double cth, double phi, arma::cx_mat & dr, arma::cx_mat & dth, arma::cx_mat & dphi) const;
         /// Translate dummy indices to real indices
         arma::uvec dummy_idx_to_real_idx(const arma::uvec & idx) const;
+        /// Map dummy indices to the pure layout: loc are the positions in idx of the functions that survive the boundary conditions, and pure are their indices in the pure layout
+        void dummy_to_pure(const arma::uvec & idx, arma::uvec & loc, arma::uvec & pure) const;
         /// Get list of basis function dummy indices in element
         arma::uvec bf_list_dummy(size_t iel) const;
         /// Get list of basis function dummy indices in element with m=m
@@ -80,72 +80,82 @@ int main(int argc, char **argv) {
   // Compute radial functions
   arma::vec r(arma::linspace<arma::vec>(0.0,100.0,1000));
 
-  for(size_t im=0;im<muni.size();im++) {
-    int m=muni(im);
-    for(int l=std::abs(m);l<=completeness;l++) {
-      arma::mat Plcao;
+  if(iprobe!=0 && iprobe!=1)
+    throw std::logic_error("Unknown probe\n");
 
-      static const std::string indices[]={"lh", "mid", "rh"};
-      static const helfem::diatomic::twodquad::probe_t probes[]={helfem::diatomic::twodquad::PROBE_LEFT, helfem::diatomic::twodquad::PROBE_MIDDLE, helfem::diatomic::twodquad::PROBE_RIGHT};
-      for(int icen=0;icen<3;icen++) {
-        // LCAO projection wrt <\alpha|FEM> in terms of orthonormal orbitals
-        std::string lcao;
-        if(iprobe==0) {
-          lcao="gto";
-          Plcao=qgrid.gto_projection(l, m, expn, probes[icen]);
-        } else if(iprobe==1) {
-          lcao="sto";
-          Plcao=qgrid.sto_projection(l, m, expn, probes[icen]);
-        } else
-          throw std::logic_error("Unknown probe\n");
+  // The (l,m) channels are independent
+  std::vector< std::pair<int,int> > lmlist;
+  for(size_t im=0;im<muni.size();im++)
+    for(int l=std::abs(muni(im));l<=completeness;l++)
+      lmlist.push_back(std::make_pair(l,(int) muni(im)));
 
-        // FEM completeness profile
-        arma::mat Y(arma::diagvec(Plcao*Sinv*arma::trans(Plcao)));
-        Y.insert_cols(0,expn);
-        
-        std::ostringstream oss;
-        oss << "fem_basis_" << lcao << "cpl_" << indices[icen] << "_" << l << "_" << m << ".dat";
-        Y.save(oss.str(),arma::raw_ascii);
-        
-        oss.str("");
-        
-        // Project GTO projection onto occupied orbitals
-        arma::mat Pa(Plcao*Ca.cols(0,nela-1));
-        Y.zeros(Y.n_rows,nela+2);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,1)
+#endif
+  for(size_t ilm=0;ilm<lmlist.size();ilm++) {
+    const int l(lmlist[ilm].first);
+    const int m(lmlist[ilm].second);
+    arma::mat Plcao;
+
+    static const std::string indices[]={"lh", "mid", "rh"};
+    static const helfem::diatomic::twodquad::probe_t probes[]={helfem::diatomic::twodquad::PROBE_LEFT, helfem::diatomic::twodquad::PROBE_MIDDLE, helfem::diatomic::twodquad::PROBE_RIGHT};
+    for(int icen=0;icen<3;icen++) {
+      // LCAO projection wrt <\alpha|FEM> in terms of orthonormal orbitals
+      std::string lcao;
+      if(iprobe==0) {
+        lcao="gto";
+        Plcao=qgrid.gto_projection(l, m, expn, probes[icen]);
+      } else {
+        lcao="sto";
+        Plcao=qgrid.sto_projection(l, m, expn, probes[icen]);
+      }
+
+      // FEM completeness profile
+      arma::mat Y(arma::sum((Plcao*Sinv)%Plcao,1));
+      Y.insert_cols(0,expn);
+      
+      std::ostringstream oss;
+      oss << "fem_basis_" << lcao << "cpl_" << indices[icen] << "_" << l << "_" << m << ".dat";
+      Y.save(oss.str(),arma::raw_ascii);
+      
+      oss.str("");
+      
+      // Project GTO projection onto occupied orbitals
+      arma::mat Pa(Plcao*Ca.cols(0,nela-1));
+      Y.zeros(Y.n_rows,nela+2);
+      Y.col(0)=expn;
+      for(int io=0;io<nela;io++)
+        Y.col(io+1)=arma::square(Pa.col(io));
+      Y.col(nela+1)=arma::sum(Y.cols(1,nela),1);
+      oss.str("");
+      oss << "fem_aocc_" << lcao << "cpl_" << indices[icen] << "_" << l << "_" << m << ".dat";
+      Y.save(oss.str(),arma::raw_ascii);
+
+      if(nelb>0) {
+        arma::mat Pb(Plcao*Cb.cols(0,nelb-1));
+        Y.zeros(Y.n_rows,nelb+2);
         Y.col(0)=expn;
-        for(int io=0;io<nela;io++)
-          Y.col(io+1)=arma::diagvec(Pa.col(io)*arma::trans(Pa.col(io)));
-        Y.col(nela+1)=arma::sum(Y.cols(1,nela),1);
+        for(int io=0;io<nelb;io++)
+          Y.col(io+1)=arma::square(Pb.col(io));
+        Y.col(nelb+1)=arma::sum(Y.cols(1,nelb),1);
         oss.str("");
-        oss << "fem_aocc_" << lcao << "cpl_" << indices[icen] << "_" << l << "_" << m << ".dat";
+        oss << "fem_bocc_" << lcao << "cpl_" << indices[icen] << "_" << l << "_" << m << ".dat";
         Y.save(oss.str(),arma::raw_ascii);
-
-        if(nelb>0) {
-          arma::mat Pb(Plcao*Cb.cols(0,nelb-1));
-          Y.zeros(Y.n_rows,nelb+2);
-          Y.col(0)=expn;
-          for(int io=0;io<nelb;io++)
-            Y.col(io+1)=arma::diagvec(Pb.col(io)*arma::trans(Pb.col(io)));
-          Y.col(nelb+1)=arma::sum(Y.cols(1,nelb),1);
-          oss.str("");
-          oss << "fem_bocc_" << lcao << "cpl_" << indices[icen] << "_" << l << "_" << m << ".dat";
-          Y.save(oss.str(),arma::raw_ascii);
-        }
-
-        /*
-        printf("*** l=%i m=%i ***\n",l,m);        
-        Slcao=qgrid.gto_overlap(l, m, expn, diatomic::twodquad::PROBE_LEFT);
-        Slcao.print("lh gto overlap");
-        Slcao=qgrid.gto_overlap(l, m, expn, diatomic::twodquad::PROBE_RIGHT);
-        Slcao.print("rh gto overlap");
-        
-        Slcao=qgrid.sto_overlap(l, m, expn, diatomic::twodquad::PROBE_LEFT);
-        Slcao.print("lh sto overlap");
-        Slcao=qgrid.sto_overlap(l, m, expn, diatomic::twodquad::PROBE_RIGHT);
-        Slcao.print("rh sto overlap");
-        printf("\n");
-        */
       }
+
+      /*
+      printf("*** l=%i m=%i ***\n",l,m);        
+      Slcao=qgrid.gto_overlap(l, m, expn, diatomic::twodquad::PROBE_LEFT);
+      Slcao.print("lh gto overlap");
+      Slcao=qgrid.gto_overlap(l, m, expn, diatomic::twodquad::PROBE_RIGHT);
+      Slcao.print("rh gto overlap");
+      
+      Slcao=qgrid.sto_overlap(l, m, expn, diatomic::twodquad::PROBE_LEFT);
+      Slcao.print("lh sto overlap");
+      Slcao=qgrid.sto_overlap(l, m, expn, diatomic::twodquad::PROBE_RIGHT);
+      Slcao.print("rh sto overlap");
+      printf("\n");
+      */
     }
   }
 
@@ -38,6 +38,8 @@ int main(int argc, char **argv) {
   parser.add<int>("lang", 0, "number of quadrature points in nu (automatic default)", false, -1);
   parser.add<int>("mang", 0, "number of quadrature points in phi (automatic default)", false, -1);
   parser.add<std::string>("output", 0, "save density to file", false, "density.hdf5");
+  parser.add<bool>("orbitals", 0, "save orbital values?", false, true);
+  parser.add<int>("compression", 0, "gzip compression level for the output, 0 for none", false, 0);
   parser.parse_check(argc, argv);
 
   // Get parameters
@@ -50,6 +52,8 @@ int main(int argc, char **argv) {
   int mang(parser.get<int>("mang"));
 
   std::string output(parser.get<std::string>("output"));
+  bool saveorb(parser.get<bool>("orbitals"));
+  int compression(parser.get<int>("compression"));
 
   // Load checkpoint
   Checkpoint loadchk(load,false);
@@ -104,131 +108,165 @@ int main(int argc, char **argv) {
     radbf[iel] = basis.get_rad_bf(iel);
   }
 
-  // Density arrays
-  arma::vec dena(Ngrid,arma::fill::zeros), denb(Ngrid,arma::fill::zeros), dV(Ngrid,arma::fill::zeros);
-  arma::mat orba(Ngrid,nela,arma::fill::zeros), orbb(Ngrid,nelb,arma::fill::zeros);
-
-  arma::vec mugrid(Ngrid,arma::fill::zeros);
-  arma::vec cthgrid(Ngrid,arma::fill::zeros);
-  arma::vec phigrid(Ngrid,arma::fill::zeros);
-  arma::cx_mat orbagrid(Ngrid,nela,arma::fill::zeros);
-  arma::cx_mat orbbgrid;
-  if(nelb)
-    orbbgrid.zeros(Ngrid,nelb);
-
   arma::cx_mat Sa(nela,nela,arma::fill::zeros), Sb;
   if(nelb>0)
     Sb.zeros(nelb,nelb);
 
-  size_t igrid=0;
-  // Loop over radial elements
+  // Number of radial points per element and grid points per element
+  const size_t Nradel(mu[0].n_elem);
+  const size_t Nelgrid(Nradel*wang.n_elem);
+
+  // Check the basis function indexing before going parallel
   for(size_t iel=0;iel<mu.size();iel++) {
-    // Get the list of basis functions in the element in the dummy
-    // indexing
+    size_t nfun=0;
+    for(size_t il=0;il<lval.n_elem;il++) {
+      size_t firstfun = ((iel==0) && (mval(il)!=0)) ? 1 : 0;
+      nfun += radbf[iel].n_cols-firstfun;
+    }
     arma::uvec bidx=basis.bf_list(iel);
+    if(nfun != bidx.n_elem || radbf[iel].n_rows != Nradel) {
+      printf("iel=%i nfun=%i bidx.n_elem=%i\n",(int) iel,(int) nfun,(int) bidx.n_elem);
+      fflush(stdout);
+      throw std::logic_error("Indexing problem!\n");
+    }
+  }
 
-    // Orbital submatrices
-    arma::mat Casub(Ca.cols(0,nela-1));
-    Casub = Casub.rows(bidx);
-    arma::mat Cbsub;
+  // The output is written element by element into chunked entries
+  Checkpoint savechk(output,true);
+  savechk.open();
+  const char *gridnames[]={"mu","dV","cth","phi","P","Pa","Pb"};
+  for(size_t i=0;i<sizeof(gridnames)/sizeof(gridnames[0]);i++)
+    savechk.create(gridnames[i],Ngrid,1,Nelgrid,compression);
+  if(saveorb) {
+    savechk.create("orba.re",Ngrid,nela,Nelgrid,compression);
+    savechk.create("orba.im",Ngrid,nela,Nelgrid,compression);
     if(nelb) {
-      Cbsub=Cb.cols(0,nelb-1);
-      Cbsub=Cbsub.rows(bidx);
+      savechk.create("orbb.re",Ngrid,nelb,Nelgrid,compression);
+      savechk.create("orbb.im",Ngrid,nelb,Nelgrid,compression);
     }
+  }
 
-    // Radial values
-    arma::vec r(mu[iel]);
-    arma::vec wr(wmu[iel]);
-
-    // Loop over angular output grid
-    for(size_t iang=0;iang<wang.n_elem;iang++) {
-      // Loop over radial points
-      for(size_t irad=0;irad<radbf[iel].n_rows;irad++) {
-        // Form matrix of basis function values
-        arma::cx_rowvec bf(bidx.n_elem);
-        {
-          size_t ioff=0;
-          // Loop over angular basis
-          for(size_t il=0;il<lval.n_elem;il++) {
-            // Loop over in-element radial functions
-            size_t firstfun = ((iel==0) && (mval(il)!=0)) ? 1 : 0;
-            for(size_t ifun=firstfun;ifun<radbf[iel].n_cols;ifun++) {
-              bf(ioff++) = sph(iang,il)*radbf[iel](irad,ifun);
-            }
-          }
-          if(ioff != bidx.n_elem) {
-            printf("iel=%i iang=%i ioff=%i bidx.n_elem=%i\n",(int) iel,(int) iang,(int) ioff,(int) bidx.n_elem);
-            fflush(stdout);
-            throw std::logic_error("Indexing problem!\n");
-          }
-        }
-
-        // Compute orbital values
-        arma::cx_rowvec orbaval = bf*Casub;
-        arma::cx_rowvec orbbval;
-        if(nelb)
-          orbbval = bf*Cbsub;
-
-        // Store result
-        dena(igrid)=std::real(arma::cdot(orbaval,orbaval));
-        denb(igrid)=nelb ? std::real(arma::cdot(orbbval,orbbval)) : 0.0;
-
-        // Store grid values
-        mugrid(igrid) = r(irad);
-        cthgrid(igrid) = cth(iang);
-        phigrid(igrid) = phi(iang);
-
-        // Volume element is
-        double shmu(sinh(r(irad)));
-        double chmu(cosh(r(irad)));
-        dV(igrid)=std::pow(basis.get_Rhalf(),3)*shmu*(chmu*chmu - cth(iang)*cth(iang))*wr(irad)*wang(iang);
-
-        // Orbital values
-        orbagrid.row(igrid) = orbaval;
-        if(nelb)
-          orbbgrid.row(igrid) = orbbval;
+  // Norms of the densities
+  double Panorm=0.0, Pbnorm=0.0;
+
+#ifdef _OPENMP
+#pragma omp parallel reduction(+:Panorm,Pbnorm)
+#endif
+  {
+    // Thread-local orbital overlaps
+    arma::cx_mat Sath(nela,nela,arma::fill::zeros), Sbth;
+    if(nelb>0)
+      Sbth.zeros(nelb,nelb);
+
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic,1)
+#endif
+    // Loop over radial elements
+    for(size_t iel=0;iel<mu.size();iel++) {
+      // Get the list of basis functions in the element in the dummy
+      // indexing
+      arma::uvec bidx=basis.bf_list(iel);
+
+      // Orbital submatrices
+      arma::mat Casub(Ca.cols(0,nela-1));
+      Casub = Casub.rows(bidx);
+      arma::mat Cbsub;
+      if(nelb) {
+        Cbsub=Cb.cols(0,nelb-1);
+        Cbsub=Cbsub.rows(bidx);
+      }
 
-        Sa += arma::trans(orbaval)*dV(igrid)*orbaval;
-        if(nelb)
-          Sb += arma::trans(orbbval)*dV(igrid)*orbbval;
+      // Radial values
+      arma::vec r(mu[iel]);
+      arma::vec wr(wmu[iel]);
+
+      // Grid points of the element run over angular points, and
+      // radial points within each angular point
+      const size_t ioff(iel*Nelgrid);
+      const size_t iend(ioff+Nelgrid-1);
+
+      // Basis function values on all points in the element
+      arma::cx_mat bf(Nelgrid,bidx.n_elem);
+      {
+        size_t ifun=0;
+        for(size_t il=0;il<lval.n_elem;il++) {
+          size_t firstfun = ((iel==0) && (mval(il)!=0)) ? 1 : 0;
+          for(size_t irfun=firstfun;irfun<radbf[iel].n_cols;irfun++)
+            bf.col(ifun++) = arma::kron(sph.col(il),arma::conv_to<arma::cx_vec>::from(radbf[iel].col(irfun)));
+        }
+      }
 
-        igrid++;
+      // Grid coordinates and volume element
+      arma::vec muel(arma::repmat(r,wang.n_elem,1));
+      arma::vec cthel(arma::kron(cth,arma::ones<arma::vec>(Nradel)));
+      arma::vec phiel(arma::kron(phi,arma::ones<arma::vec>(Nradel)));
+      arma::vec wel(arma::kron(wang,wr));
+      arma::vec chmu(arma::cosh(muel));
+      arma::vec dVel(std::pow(basis.get_Rhalf(),3)*arma::sinh(muel)%(chmu%chmu - cthel%cthel)%wel);
+
+      // Compute orbital values
+      arma::cx_mat orbaval(bf*Casub);
+      arma::vec denael(arma::sum(arma::real(arma::conj(orbaval)%orbaval),1));
+      arma::cx_vec cdVel(arma::conv_to<arma::cx_vec>::from(dVel));
+      Sath += arma::trans(orbaval)*(orbaval.each_col()%cdVel);
+
+      arma::cx_mat orbbval;
+      arma::vec denbel(Nelgrid,arma::fill::zeros);
+      if(nelb) {
+        orbbval = bf*Cbsub;
+        denbel = arma::sum(arma::real(arma::conj(orbbval)%orbbval),1);
+        Sbth += arma::trans(orbbval)*(orbbval.each_col()%cdVel);
+      }
+      Panorm += arma::dot(denael,dVel);
+      Pbnorm += arma::dot(denbel,dVel);
+
+      // HDF5 calls are serialized
+#ifdef _OPENMP
+#pragma omp critical(density_grid_write)
+#endif
+      {
+        savechk.write_rows("mu",ioff,muel);
+        savechk.write_rows("dV",ioff,dVel);
+        savechk.write_rows("cth",ioff,cthel);
+        savechk.write_rows("phi",ioff,phiel);
+        savechk.write_rows("P",ioff,denael+denbel);
+        savechk.write_rows("Pa",ioff,denael);
+        savechk.write_rows("Pb",ioff,denbel);
+        if(saveorb) {
+          savechk.write_rows("orba.re",ioff,arma::real(orbaval));
+          savechk.write_rows("orba.im",ioff,arma::imag(orbaval));
+          if(nelb) {
+            savechk.write_rows("orbb.re",ioff,arma::real(orbbval));
+            savechk.write_rows("orbb.im",ioff,arma::imag(orbbval));
+          }
+        }
       }
     }
-  }
-  if(igrid != dena.n_elem)
-    throw std::logic_error("Indexing error!\n");
 
-  // Total density
-  arma::vec den(dena+denb);
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+    {
+      Sa += Sath;
+      if(nelb)
+        Sb += Sbth;
+    }
+  }
 
-  printf("Norm of Pa on grid is %e\n",arma::sum(dena%dV));
-  printf("Norm of Pb on grid is %e\n",arma::sum(denb%dV));
-  printf("Norm of P on grid is %e\n",arma::sum(den%dV));
+  printf("Norm of Pa on grid is %e\n",Panorm);
+  printf("Norm of Pb on grid is %e\n",Pbnorm);
+  printf("Norm of P on grid is %e\n",Panorm+Pbnorm);
 
   printf("Alpha-alpha orbital non-orthonormality %e\n",arma::norm(Sa-arma::eye<arma::cx_mat>(Sa.n_rows,Sa.n_cols),"fro"));
   if(nelb)
     printf("Beta-beta   orbital non-orthonormality %e\n",arma::norm(Sb-arma::eye<arma::cx_mat>(Sb.n_rows,Sb.n_cols),"fro"));
 
-  Checkpoint savechk(output,true);
-  savechk.write("mu",mugrid);
-  savechk.write("dV",dV);
-  savechk.write("cth",cthgrid);
-  savechk.write("phi",phigrid);
-  savechk.write("P",den);
-  savechk.write("Pa",dena);
-  savechk.write("Pb",denb);
-  savechk.write("orba.re",arma::real(orbagrid));
-  savechk.write("orba.im",arma::imag(orbagrid));
-  if(nelb) {
-    savechk.write("orbb.re",arma::real(orbbgrid));
-    savechk.write("orbb.im",arma::imag(orbbgrid));
-  }
   savechk.write("Rh",basis.get_Rhalf());
   savechk.write("Z1",basis.get_Z1());
   savechk.write("Z2",basis.get_Z2());
   int mmax = arma::max(basis.get_mval());
   savechk.write("mmax",mmax);
+  savechk.close();
   printf("Saved density to file %s\n",output.c_str());
 
   return 0;
@@ -65,9 +65,8 @@ int main(int argc, char **argv) {
   const double phi(atan2(y,x));
   const double xysq(x*x+y*y);
 
-  // Densities
-  arma::mat den(Nz,4);
-  den.zeros();
+  // Coordinates of the points in the basis
+  arma::mat points(Nz,3);
   for(size_t iz=0;iz<z.n_elem;iz++) {
     // Compute distances of point from the two nuclei
     double ra(sqrt(std::pow(z(iz)+Rhalf,2)+xysq));
@@ -84,21 +83,21 @@ int main(int argc, char **argv) {
       eta=1.0;
 
     // so mu is
-    double mu(utils::arcosh(xi));
-
-    // Check range: is mu outside of basis set?
-    if(mu>basis.get_mumax())
-      continue;
+    points(iz,0)=utils::arcosh(xi);
+    points(iz,1)=eta;
+    points(iz,2)=phi;
+  }
 
-    // Evaluate basis functions
-    arma::cx_vec bf(basis.eval_bf(mu, eta, phi));
+  // Evaluate basis functions at all points; points outside the basis
+  // set give zero values
+  arma::cx_mat bf(basis.eval_bf(points));
 
-    // Evaluate density at the point
-    den(iz,0)=z(iz);
-    den(iz,1)=std::real(arma::as_scalar(bf.t()*Pa*bf));
-    den(iz,2)=std::real(arma::as_scalar(bf.t()*Pb*bf));
-    den(iz,3)=den(iz,1)+den(iz,2);
-  }
+  // Densities
+  arma::mat den(Nz,4);
+  den.col(0)=z;
+  den.col(1)=arma::sum(arma::real(arma::conj(bf)%(bf*Pa)),1);
+  den.col(2)=arma::sum(arma::real(arma::conj(bf)%(bf*Pb)),1);
+  den.col(3)=den.col(1)+den.col(2);
 
   printf("Saving density to file %s\n",savedens.c_str());
   den.save(savedens,arma::raw_ascii);
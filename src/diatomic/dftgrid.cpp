@@ -24,6 +24,8 @@
 #include "../general/dftfuncs.h"
 // Angular quadrature
 #include "../general/angular.h"
+#include "../general/profiler.h"
+#include "../general/mpi_helpers.h"
 
 // OpenMP parallellization for XC calculations
 #ifdef _OPENMP
@@ -33,10 +35,10 @@
 namespace helfem {
   namespace diatomic {
     namespace dftgrid {
-      DFTGridWorker::DFTGridWorker() {
+      DFTGridWorker::DFTGridWorker() : xcpool(NULL), lang(0), mang(0) {
       }
 
-      DFTGridWorker::DFTGridWorker(const helfem::diatomic::basis::TwoDBasis * basp_, int lang, int mang) : basp(basp_) {
+      DFTGridWorker::DFTGridWorker(const helfem::diatomic::basis::TwoDBasis * basp_, int lang_, int mang_) : basp(basp_), xcpool(NULL), lang(lang_), mang(mang_) {
         do_grad=false;
         do_tau=false;
         do_lapl=false;
@@ -48,12 +50,94 @@ namespace helfem {
       DFTGridWorker::~DFTGridWorker() {
       }
 
+      void DFTGridWorker::reserve(size_t nbf, size_t npts) {
+        // Sized for the largest element; the smaller ones reuse the memory
+        bf.set_size(nbf,npts);
+        Pel.set_size(nbf,nbf);
+        Pael.set_size(nbf,nbf);
+        Pbel.set_size(nbf,nbf);
+        Pv.set_size(nbf,npts);
+        Pav.set_size(nbf,npts);
+        Pbv.set_size(nbf,npts);
+        if(do_grad) {
+          bf_rho.set_size(nbf,npts);
+          bf_theta.set_size(nbf,npts);
+          bf_phi.set_size(nbf,npts);
+        }
+        if(do_tau) {
+          Pv_rho.set_size(nbf,npts);
+          Pv_theta.set_size(nbf,npts);
+          Pv_phi.set_size(nbf,npts);
+          Pav_rho.set_size(nbf,npts);
+          Pav_theta.set_size(nbf,npts);
+          Pav_phi.set_size(nbf,npts);
+          Pbv_rho.set_size(nbf,npts);
+          Pbv_theta.set_size(nbf,npts);
+          Pbv_phi.set_size(nbf,npts);
+        }
+
+        wtot.set_size(npts);
+        scale_r.set_size(npts);
+        scale_theta.set_size(npts);
+        scale_phi.set_size(npts);
+        rho.set_size(2,npts);
+        exc.set_size(npts);
+        exc_wrk.set_size(npts);
+        vxc.set_size(2,npts);
+        vxc_wrk.set_size(2,npts);
+        if(do_grad) {
+          grho.set_size(6,npts);
+          sigma.set_size(3,npts);
+          vsigma.set_size(3,npts);
+          vsigma_wrk.set_size(3,npts);
+        }
+        if(do_tau) {
+          tau.set_size(2,npts);
+          vtau.set_size(2,npts);
+          vtau_wrk.set_size(2,npts);
+        }
+      }
+
+      void DFTGridWorker::release_unused() {
+        if(!do_grad) {
+          bf_rho.reset();
+          bf_theta.reset();
+          bf_phi.reset();
+          grho.reset();
+          sigma.reset();
+          vsigma.reset();
+          vsigma_wrk.reset();
+        }
+        if(!do_tau) {
+          Pv_rho.reset();
+          Pv_theta.reset();
+          Pv_phi.reset();
+          Pav_rho.reset();
+          Pav_theta.reset();
+          Pav_phi.reset();
+          Pbv_rho.reset();
+          Pbv_theta.reset();
+          Pbv_phi.reset();
+          tau.reset();
+          vtau.reset();
+          vtau_wrk.reset();
+        }
+        if(!do_lapl) {
+          bf_lapl.reset();
+          lapl.reset();
+          vlapl.reset();
+          vlapl_wrk.reset();
+        }
+      }
+
       void DFTGridWorker::update_density(const arma::mat & P0) {
         // Update values of density
         if(!P0.n_elem) {
           throw std::runtime_error("Error - density matrix is empty!\n");
         }
-        arma::mat P(basp->expand_boundaries(P0)(bf_ind,bf_ind));
+        arma::mat & P(Pel);
+        P.zeros(bf_ind.n_elem,bf_ind.n_elem);
+        P(bf_loc,bf_loc)=P0(bf_pure,bf_pure);
 
         // Non-polarized calculation.
         polarized=false;
@@ -125,8 +209,12 @@ namespace helfem {
         polarized=true;
 
         // Update density vector
-        arma::mat Pa(basp->expand_boundaries(Pa0)(bf_ind,bf_ind));
-        arma::mat Pb(basp->expand_boundaries(Pb0)(bf_ind,bf_ind));
+        arma::mat & Pa(Pael);
+        arma::mat & Pb(Pbel);
+        Pa.zeros(bf_ind.n_elem,bf_ind.n_elem);
+        Pb.zeros(bf_ind.n_elem,bf_ind.n_elem);
+        Pa(bf_loc,bf_loc)=Pa0(bf_pure,bf_pure);
+        Pb(bf_loc,bf_loc)=Pb0(bf_pure,bf_pure);
 
         Pav=Pa*arma::conj(bf);
         Pbv=Pb*arma::conj(bf);
@@ -239,6 +327,21 @@ namespace helfem {
         return ekin;
       }
 
+      double DFTGridWorker::max_density() const {
+        if(!rho.n_elem)
+          return 0.0;
+        return arma::max(arma::sum(rho,0));
+      }
+
+      double DFTGridWorker::max_gradient() const {
+        if(!do_grad || !grho.n_elem)
+          return 0.0;
+        arma::mat g(grho.rows(0,2));
+        if(polarized)
+          g+=grho.rows(3,5);
+        return std::sqrt(arma::max(arma::sum(arma::square(g),0)));
+      }
+
       void DFTGridWorker::init_xc() {
         // Size of grid.
         const size_t N=wtot.n_elem;
@@ -357,12 +460,6 @@ namespace helfem {
         const size_t N=wtot.n_elem;
 
         // Work arrays - exchange and correlation are computed separately
-        arma::rowvec exc_wrk;
-        arma::mat vxc_wrk;
-        arma::mat vsigma_wrk;
-        arma::mat vlapl_wrk;
-        arma::mat vtau_wrk;
-
         if(has_exc(func_id))
           exc_wrk.zeros(exc.n_elem);
         if(pot) {
@@ -382,24 +479,10 @@ namespace helfem {
         else
           nspin=XC_POLARIZED;
 
-        // Initialize libxc worker
-        xc_func_type func;
-        if(xc_func_init(&func, func_id, nspin) != 0) {
-          std::ostringstream oss;
-          oss << "Functional "<<func_id<<" not found!";
-          throw std::runtime_error(oss.str());
-        }
-        // Set density threshold
-        xc_func_set_dens_threshold(&func, thr);
-
-        // Set parameters
-        if(p.n_elem) {
-          // Check sanity
-          if(p.n_elem != (arma::uword) xc_func_info_get_n_ext_params((xc_func_info_type *)func.info))
-            throw std::logic_error("Incompatible number of parameters!\n");
-          arma::vec phlp(p);
-          xc_func_set_ext_params(&func, phlp.memptr());
-        }
+        // Get libxc worker; functionals are kept in the pool between calls
+        XCFunctionalPool localpool;
+        XCFunctionalPool & pool(xcpool ? *xcpool : localpool);
+        xc_func_type *func(pool.get(func_id, nspin, thr, arma::conv_to< std::vector<double> >::from(p)));
 
         // Evaluate functionals.
         if(has_exc(func_id)) {
@@ -409,20 +492,20 @@ namespace helfem {
               double * taup = mgga_t ? tau.memptr() : NULL;
               double * vlaplp = mgga_l ? vlapl_wrk.memptr() : NULL;
               double * vtaup = mgga_t ? vtau_wrk.memptr() : NULL;
-              xc_mgga_exc_vxc(&func, N, rho.memptr(), sigma.memptr(), laplp, taup, exc_wrk.memptr(), vxc_wrk.memptr(), vsigma_wrk.memptr(), vlaplp, vtaup);
+              xc_mgga_exc_vxc(func, N, rho.memptr(), sigma.memptr(), laplp, taup, exc_wrk.memptr(), vxc_wrk.memptr(), vsigma_wrk.memptr(), vlaplp, vtaup);
             } else if(gga) // GGA
-              xc_gga_exc_vxc(&func, N, rho.memptr(), sigma.memptr(), exc_wrk.memptr(), vxc_wrk.memptr(), vsigma_wrk.memptr());
+              xc_gga_exc_vxc(func, N, rho.memptr(), sigma.memptr(), exc_wrk.memptr(), vxc_wrk.memptr(), vsigma_wrk.memptr());
             else // LDA
-              xc_lda_exc_vxc(&func, N, rho.memptr(), exc_wrk.memptr(), vxc_wrk.memptr());
+              xc_lda_exc_vxc(func, N, rho.memptr(), exc_wrk.memptr(), vxc_wrk.memptr());
           } else {
             if(mgga_t || mgga_l) { // meta-GGA
               double * laplp = mgga_l ? lapl.memptr() : NULL;
               double * taup = mgga_t ? tau.memptr() : NULL;
-              xc_mgga_exc(&func, N, rho.memptr(), sigma.memptr(), laplp, taup, exc_wrk.memptr());
+              xc_mgga_exc(func, N, rho.memptr(), sigma.memptr(), laplp, taup, exc_wrk.memptr());
             } else if(gga) // GGA
-              xc_gga_exc(&func, N, rho.memptr(), sigma.memptr(), exc_wrk.memptr());
+              xc_gga_exc(func, N, rho.memptr(), sigma.memptr(), exc_wrk.memptr());
             else // LDA
-              xc_lda_exc(&func, N, rho.memptr(), exc_wrk.memptr());
+              xc_lda_exc(func, N, rho.memptr(), exc_wrk.memptr());
           }
 
         } else {
@@ -432,17 +515,14 @@ namespace helfem {
               double * taup = mgga_t ? tau.memptr() : NULL;
               double * vlaplp = mgga_l ? vlapl_wrk.memptr() : NULL;
               double * vtaup = mgga_t ? vtau_wrk.memptr() : NULL;
-              xc_mgga_vxc(&func, N, rho.memptr(), sigma.memptr(), laplp, taup, vxc_wrk.memptr(), vsigma_wrk.memptr(), vlaplp, vtaup);
+              xc_mgga_vxc(func, N, rho.memptr(), sigma.memptr(), laplp, taup, vxc_wrk.memptr(), vsigma_wrk.memptr(), vlaplp, vtaup);
             } else if(gga) // GGA
-              xc_gga_vxc(&func, N, rho.memptr(), sigma.memptr(), vxc_wrk.memptr(), vsigma_wrk.memptr());
+              xc_gga_vxc(func, N, rho.memptr(), sigma.memptr(), vxc_wrk.memptr(), vsigma_wrk.memptr());
             else // LDA
-              xc_lda_vxc(&func, N, rho.memptr(), vxc_wrk.memptr());
+              xc_lda_vxc(func, N, rho.memptr(), vxc_wrk.memptr());
           }
         }
 
-        // Free functional
-        xc_func_end(&func);
-
         // Sum to total arrays containing both exchange and correlation
         if(has_exc(func_id))
           exc+=exc_wrk;
@@ -482,7 +562,7 @@ namespace helfem {
         S.zeros();
         increment_lda< std::complex<double> >(S,wtot,bf);
         // Increment
-        So.submat(bf_ind,bf_ind)+=S;
+        So.submat(bf_pure,bf_pure)+=S.submat(bf_loc,bf_loc);
       }
 
       void DFTGridWorker::eval_kinetic(arma::mat & To) const {
@@ -493,7 +573,7 @@ namespace helfem {
         increment_lda< std::complex<double> >(T,wtot/(scale_theta%scale_theta),bf_theta);
         increment_lda< std::complex<double> >(T,wtot/(scale_phi%scale_phi),bf_phi);
         // Increment
-        To.submat(bf_ind,bf_ind)+=0.5*T;
+        To.submat(bf_pure,bf_pure)+=0.5*T.submat(bf_loc,bf_loc);
       }
 
       void DFTGridWorker::eval_Fxc(arma::mat & Ho) const {
@@ -541,7 +621,7 @@ namespace helfem {
         if(do_mgga_l)
           throw std::logic_error("Laplacian not implemented!\n");
 
-        Ho(bf_ind,bf_ind)+=H;
+        Ho(bf_pure,bf_pure)+=H(bf_loc,bf_loc);
       }
 
       void DFTGridWorker::eval_Fxc(arma::mat & Hao, arma::mat & Hbo, bool beta) const {
@@ -626,9 +706,9 @@ namespace helfem {
           throw std::logic_error("Laplacian not implemented!\n");
         }
 
-        Hao(bf_ind,bf_ind)+=Ha;
+        Hao(bf_pure,bf_pure)+=Ha(bf_loc,bf_loc);
         if(beta)
-          Hbo(bf_ind,bf_ind)+=Hb;
+          Hbo(bf_pure,bf_pure)+=Hb(bf_loc,bf_loc);
       }
 
       void DFTGridWorker::check_grad_tau_lapl(int x_func, int c_func) {
@@ -652,6 +732,8 @@ namespace helfem {
           do_lapl=do_lapl || laplacian_needed(x_func);
         if(c_func>0)
           do_lapl=do_lapl || laplacian_needed(c_func);
+
+        release_unused();
       }
 
       void DFTGridWorker::get_grad_tau_lapl(bool & grad_, bool & tau_, bool & lap_) const {
@@ -660,15 +742,30 @@ namespace helfem {
         lap_=do_lapl;
       }
 
+      void DFTGridWorker::set_xcpool(XCFunctionalPool *pool) {
+        xcpool=pool;
+      }
+
       void DFTGridWorker::set_grad_tau_lapl(bool grad_, bool tau_, bool lap_) {
         do_grad=grad_;
         do_tau=tau_;
         do_lapl=lap_;
+        release_unused();
+      }
+
+      void DFTGridWorker::set_angular(int lang_, int mang_) {
+        if(lang_==lang && mang_==mang)
+          return;
+        lang=lang_;
+        mang=mang_;
+        helfem::angular::angular_chebyshev(lang,mang,cth,phi,wang);
       }
 
       void DFTGridWorker::compute_bf(size_t iel, size_t irad) {
+        profiler::Region prof("compute_bf");
         // Update function list
         bf_ind=basp->bf_list_dummy(iel);
+        basp->dummy_to_pure(bf_ind,bf_loc,bf_pure);
 
         // Get radial weights. Only do one radial quadrature point at a
         // time, since this is an easy way to save a lot of memory.
@@ -754,32 +851,193 @@ namespace helfem {
         }
       }
 
-      DFTGrid::DFTGrid() {
+      DFTGrid::DFTGrid() : adapt_tol(0.0), adapt_lmin(0), screen(false) {
       }
 
-      DFTGrid::DFTGrid(const helfem::diatomic::basis::TwoDBasis * basp_, int lang_, int mang_) : basp(basp_), lang(lang_), mang(mang_) {
+      DFTGrid::DFTGrid(const helfem::diatomic::basis::TwoDBasis * basp_, int lang_, int mang_) : basp(basp_), lang(lang_), mang(mang_), adapt_tol(0.0), adapt_lmin(0), screen(false) {
         arma::vec cth, phi, wang;
         helfem::angular::angular_chebyshev(lang,mang,cth,phi,wang);
         printf("DFT angular grid of order l=%i m=%i has %i points\n",lang,mang,(int) wang.n_elem);
       }
 
+      void DFTGrid::prepare_xcpools() {
+#ifdef _OPENMP
+        size_t nth(omp_get_max_threads());
+#else
+        size_t nth(1);
+#endif
+        while(xcpools.size()<nth)
+          xcpools.push_back(std::make_shared<XCFunctionalPool>());
+      }
+
+      XCFunctionalPool * DFTGrid::thread_xcpool() const {
+#ifdef _OPENMP
+        return xcpools[omp_get_thread_num()].get();
+#else
+        return xcpools[0].get();
+#endif
+      }
+
+      DFTGridWorker & DFTGrid::prepare_worker(int x_func, int c_func) {
+        if(!worker)
+          worker=std::make_shared<DFTGridWorker>(basp,lang,mang);
+        worker->set_xcpool(thread_xcpool());
+        worker->check_grad_tau_lapl(x_func,c_func);
+
+        // The points of a single radial quadrature node are handled at a time
+        size_t nbf=0;
+        for(size_t iel=0;iel<basp->get_rad_Nel();iel++)
+          nbf=std::max(nbf,(size_t) basp->bf_list_dummy(iel).n_elem);
+        arma::vec cth, phi, wang;
+        helfem::angular::angular_chebyshev(lang,mang,cth,phi,wang);
+        worker->reserve(nbf,wang.n_elem);
+
+        return *worker;
+      }
+
       DFTGrid::~DFTGrid() {
       }
 
+      void DFTGrid::set_adaptive(double tol, int lmin) {
+        adapt_tol=tol;
+        adapt_lmin=std::max(1,std::min(lmin,lang));
+        el_lang.clear();
+      }
+
+      int DFTGrid::element_lang(size_t iel) const {
+        return el_lang.n_elem ? el_lang(iel) : lang;
+      }
+
+      double DFTGrid::element_xc(DFTGridWorker & grid, int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, const arma::mat & P, size_t iel, int l, double thr, arma::mat & H, arma::mat & Hel) const {
+        arma::uvec loc, pure;
+        basp->dummy_to_pure(basp->bf_list_dummy(iel),loc,pure);
+
+        grid.set_angular(l,mang);
+        double exc=0.0;
+        for(size_t irad=0;irad<basp->get_r(iel).n_elem;irad++) {
+          grid.compute_bf(iel,irad);
+          grid.update_density(P);
+          grid.init_xc();
+          if(x_func>0)
+            grid.compute_xc(x_func, x_pars, thr);
+          if(c_func>0)
+            grid.compute_xc(c_func, c_pars, thr);
+          exc+=grid.eval_Exc();
+          grid.eval_Fxc(H);
+        }
+
+        // Only the element's block has been touched
+        Hel=H(pure,pure);
+        H(pure,pure).zeros();
+        return exc;
+      }
+
+      void DFTGrid::adapt_angular(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, const arma::mat & P, double thr) {
+        if(adapt_tol<=0.0 || el_lang.n_elem==basp->get_rad_Nel())
+          return;
+
+        el_lang.ones(basp->get_rad_Nel());
+        el_lang*=lang;
+
+        // Trial rules between lmin and the full rule
+        const int ntrial=4;
+        int dl(std::max(1,(lang-adapt_lmin)/ntrial));
+
+        prepare_xcpools();
+        DFTGridWorker & grid(prepare_worker(x_func,c_func));
+        arma::mat H(arma::zeros<arma::mat>(basp->Nbf(),basp->Nbf()));
+        for(size_t iel=0;iel<basp->get_rad_Nel();iel++) {
+          // Reference values with the full rule. The electron count
+          // is integrated exactly already by small rules, so the
+          // pruning is based on the functional instead
+          arma::mat Fref, F;
+          double Eref(element_xc(grid,x_func,x_pars,c_func,c_pars,P,iel,lang,thr,H,Fref));
+          // Use the smallest rule that reproduces both the energy and
+          // the Fock matrix block of the element
+          for(int l=adapt_lmin;l<lang;l+=dl) {
+            double E(element_xc(grid,x_func,x_pars,c_func,c_pars,P,iel,l,thr,H,F));
+            if(std::abs(E-Eref)<adapt_tol && arma::abs(F-Fref).max()<adapt_tol) {
+              el_lang(iel)=l;
+              break;
+            }
+          }
+        }
+
+        size_t nfull(0), npruned(0);
+        arma::vec cth, phi, wang;
+        helfem::angular::angular_chebyshev(lang,mang,cth,phi,wang);
+        size_t nang(wang.n_elem);
+        for(size_t iel=0;iel<basp->get_rad_Nel();iel++) {
+          helfem::angular::angular_chebyshev(el_lang(iel),mang,cth,phi,wang);
+          nfull+=basp->get_r(iel).n_elem*nang;
+          npruned+=basp->get_r(iel).n_elem*wang.n_elem;
+        }
+        printf("Angular pruning reduced the DFT grid from %i to %i points\n",(int) nfull,(int) npruned);
+        fflush(stdout);
+      }
+
+      void DFTGrid::set_screening(bool screen_) {
+        screen=screen_;
+        scr_rho.clear();
+        scr_grad.clear();
+        scr_pnorm.clear();
+      }
+
+      void DFTGrid::prepare_screening() {
+        if(!screen || scr_pnorm.n_elem==basp->get_rad_Nel())
+          return;
+        scr_rho.zeros(basp->get_rad_Nel());
+        scr_grad.zeros(basp->get_rad_Nel());
+        // Zero norm means no data are available
+        scr_pnorm.zeros(basp->get_rad_Nel());
+      }
+
+      double DFTGrid::density_norm(const arma::mat & P, size_t iel) const {
+        if(!screen)
+          return 0.0;
+        arma::uvec loc, pure;
+        basp->dummy_to_pure(basp->bf_list_dummy(iel),loc,pure);
+        return arma::abs(P(pure,pure)).max();
+      }
+
+      bool DFTGrid::skip_element(size_t iel, double pnorm, double thr) const {
+        if(!screen || scr_pnorm(iel)==0.0)
+          return false;
+        // Scale the old estimates by the change in the density matrix
+        double fac(pnorm/scr_pnorm(iel));
+        return fac*scr_rho(iel)<thr && fac*scr_grad(iel)<thr;
+      }
+
       void DFTGrid::eval_Fxc(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, const arma::mat & P, arma::mat & H, double & Exc, double & Nel, double & Ekin, double thr) {
-        H.zeros(basp->Ndummy(),basp->Ndummy());
+        profiler::Region prof("XC");
+        H.zeros(basp->Nbf(),basp->Nbf());
 
         double exc=0.0;
         double ekin=0.0;
         double nel=0.0;
+        size_t nscreen=0;
+        adapt_angular(x_func,x_pars,c_func,c_pars,P,thr);
+        prepare_screening();
+        prepare_xcpools();
         {
-          DFTGridWorker grid(basp,lang,mang);
-          grid.check_grad_tau_lapl(x_func,c_func);
+          DFTGridWorker & grid(prepare_worker(x_func,c_func));
 
           for(size_t iel=0;iel<basp->get_rad_Nel();iel++) {
+            // The elements are distributed over the MPI ranks
+            if(!mpi::owns(iel))
+              continue;
+            double pnorm(density_norm(P,iel));
+            if(skip_element(iel,pnorm,thr)) {
+              nscreen++;
+              continue;
+            }
+            double rhomax=0.0, gradmax=0.0;
+            grid.set_angular(element_lang(iel),mang);
             for(size_t irad=0;irad<basp->get_r(iel).n_elem;irad++) {
               grid.compute_bf(iel,irad);
               grid.update_density(P);
+              rhomax=std::max(rhomax,grid.max_density());
+              gradmax=std::max(gradmax,grid.max_gradient());
               nel+=grid.compute_Nel();
               ekin+=grid.compute_Ekin();
 
@@ -798,32 +1056,69 @@ namespace helfem {
               grid.save(oss.str());
 #endif
             }
+            if(screen) {
+              scr_rho(iel)=rhomax;
+              scr_grad(iel)=gradmax;
+              scr_pnorm(iel)=pnorm;
+            }
           }
         }
 
+        // Sum the contributions of the elements of all the MPI ranks
+        mpi::allreduce(H);
+        mpi::allreduce(exc);
+        mpi::allreduce(ekin);
+        mpi::allreduce(nel);
+        double nscr(nscreen);
+        mpi::allreduce(nscr);
+
+        if(screen) {
+          printf("%i of %i radial elements screened out\n",(int) nscr,(int) basp->get_rad_Nel());
+          fflush(stdout);
+        }
+
         // Save outputs
         Exc=exc;
         Ekin=ekin;
         Nel=nel;
 
-        H=basp->remove_boundaries(H);
       }
 
       void DFTGrid::eval_Fxc(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, const arma::mat & Pa, const arma::mat & Pb, arma::mat & Ha, arma::mat & Hb, double & Exc, double & Nel, double & Ekin, bool beta, double thr) {
-        Ha.zeros(basp->Ndummy(),basp->Ndummy());
-        Hb.zeros(basp->Ndummy(),basp->Ndummy());
+        profiler::Region prof("XC");
+        Ha.zeros(basp->Nbf(),basp->Nbf());
+        Hb.zeros(basp->Nbf(),basp->Nbf());
 
         double exc=0.0;
         double nel=0.0;
         double ekin=0.0;
+        size_t nscreen=0;
+        // The rules are chosen once, from the total density
+        adapt_angular(x_func,x_pars,c_func,c_pars,Pa+Pb,thr);
+        prepare_screening();
+        arma::mat Ptot;
+        if(screen)
+          Ptot=Pa+Pb;
+        prepare_xcpools();
         {
-          DFTGridWorker grid(basp,lang,mang);
-          grid.check_grad_tau_lapl(x_func,c_func);
+          DFTGridWorker & grid(prepare_worker(x_func,c_func));
 
           for(size_t iel=0;iel<basp->get_rad_Nel();iel++) {
+            // The elements are distributed over the MPI ranks
+            if(!mpi::owns(iel))
+              continue;
+            double pnorm(density_norm(Ptot,iel));
+            if(skip_element(iel,pnorm,thr)) {
+              nscreen++;
+              continue;
+            }
+            double rhomax=0.0, gradmax=0.0;
+            grid.set_angular(element_lang(iel),mang);
             for(size_t irad=0;irad<basp->get_r(iel).n_elem;irad++) {
               grid.compute_bf(iel,irad);
               grid.update_density(Pa,Pb);
+              rhomax=std::max(rhomax,grid.max_density());
+              gradmax=std::max(gradmax,grid.max_gradient());
               nel+=grid.compute_Nel();
               ekin+=grid.compute_Ekin();
 
@@ -842,21 +1137,36 @@ namespace helfem {
               grid.save(oss.str());
 #endif
             }
+            if(screen) {
+              scr_rho(iel)=rhomax;
+              scr_grad(iel)=gradmax;
+              scr_pnorm(iel)=pnorm;
+            }
           }
         }
 
+        // Sum the contributions of the elements of all the MPI ranks
+        mpi::allreduce(Ha);
+        mpi::allreduce(Hb);
+        mpi::allreduce(exc);
+        mpi::allreduce(ekin);
+        mpi::allreduce(nel);
+        double nscr(nscreen);
+        mpi::allreduce(nscr);
+
+        if(screen) {
+          printf("%i of %i radial elements screened out\n",(int) nscr,(int) basp->get_rad_Nel());
+          fflush(stdout);
+        }
+
         // Save outputs
         Exc=exc;
         Ekin=ekin;
         Nel=nel;
-
-        // Clean up matrices
-        Ha=basp->remove_boundaries(Ha);
-        Hb=basp->remove_boundaries(Hb);
       }
 
       arma::mat DFTGrid::eval_overlap() {
-        arma::mat S(basp->Ndummy(),basp->Ndummy());
+        arma::mat S(basp->Nbf(),basp->Nbf());
         S.zeros();
 
         {
@@ -871,12 +1181,11 @@ namespace helfem {
           }
         }
 
-        // Clean up matrices
-        return basp->remove_boundaries(S);
+        return S;
       }
 
       arma::mat DFTGrid::eval_kinetic() {
-        arma::mat T(basp->Ndummy(),basp->Ndummy());
+        arma::mat T(basp->Nbf(),basp->Nbf());
         T.zeros();
 
         {
@@ -891,8 +1200,7 @@ namespace helfem {
           }
         }
 
-        // Clean up matrices
-        return basp->remove_boundaries(T);
+        return T;
       }
     }
   }
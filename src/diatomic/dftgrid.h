@@ -18,6 +18,8 @@
 #define DFTGRID
 
 #include "basis.h"
+#include <memory>
+#include "../general/dftfuncs.h"
 
 namespace helfem {
   namespace diatomic {
@@ -28,7 +30,11 @@ namespace helfem {
       protected:
         /// Basis set
         const helfem::diatomic::basis::TwoDBasis *basp;
+        /// Pool of libxc functionals, optional
+        XCFunctionalPool *xcpool;
       
+        /// Angular rule
+        int lang, mang;
         /// Angular grid
         arma::vec cth, phi, wang;
         /// Total quadrature weight
@@ -39,6 +45,8 @@ namespace helfem {
 
         /// List of basis functions in element
         arma::uvec bf_ind;
+        /// Positions in bf_ind of the functions in the pure layout, and their pure indices
+        arma::uvec bf_loc, bf_pure;
         /// Values of important functions in grid points, Nbf * Ngrid
         arma::cx_mat bf;
         /// Radial gradient
@@ -55,6 +63,13 @@ namespace helfem {
         /// Same for spin-polarized
         arma::cx_mat Pav, Pav_rho, Pav_theta, Pav_phi;
         arma::cx_mat Pbv, Pbv_rho, Pbv_theta, Pbv_phi;
+        /// Density matrices in the functions of the element
+        arma::mat Pel, Pael, Pbel;
+        /// Work arrays for a single functional in compute_xc
+        arma::rowvec exc_wrk;
+        arma::mat vxc_wrk, vsigma_wrk, vlapl_wrk, vtau_wrk;
+        /// Release the arrays of quantities the functional does not need
+        void release_unused();
 
         /// Is gradient needed?
         bool do_grad;
@@ -117,11 +132,15 @@ namespace helfem {
         void get_grad_tau_lapl(bool & grad, bool & tau, bool & lapl) const;
         /// Set necessity of computing gradient and laplacians, necessary for compute_bf!
         void set_grad_tau_lapl(bool grad, bool tau, bool lapl);
+        /// Use the given libxc functional pool in compute_xc
+        void set_xcpool(XCFunctionalPool *pool);
+        /// Switch the angular rule, necessary for compute_bf!
+        void set_angular(int lang, int mang);
 
         /// Compute basis functions on grid points
         void compute_bf(size_t iel, size_t irad);
-        /// Free memory
-        void free();
+        /// Allocate the work arrays for elements with up to nbf functions and npts points
+        void reserve(size_t nbf, size_t npts);
         /// Save data
         void save(const std::string & info) const;
 
@@ -134,6 +153,10 @@ namespace helfem {
         double compute_Nel() const;
         /// Compute kinetic energy
         double compute_Ekin() const;
+        /// Maximum value of the total density on the grid
+        double max_density() const;
+        /// Maximum norm of the total density gradient on the grid
+        double max_gradient() const;
 
         /// Initialize XC arrays
         void init_xc();
@@ -164,9 +187,43 @@ namespace helfem {
       private:
         /// Pointer to basis set
         const helfem::diatomic::basis::TwoDBasis * basp;
+        /// libxc functional pools, one per thread
+        std::vector< std::shared_ptr<XCFunctionalPool> > xcpools;
+        /// Make sure there is a pool for every thread
+        void prepare_xcpools();
+        /// Get the pool of the calling thread
+        XCFunctionalPool * thread_xcpool() const;
+        /// Worker, kept between calls so that its work arrays are reused
+        std::shared_ptr<DFTGridWorker> worker;
+        /// Get the worker, set up for the functional
+        DFTGridWorker & prepare_worker(int x_func, int c_func);
         /// Angular rule
         int lang, mang;
 
+        /// Tolerance for adaptive angular pruning, zero to disable
+        double adapt_tol;
+        /// Smallest angular rule allowed in pruning
+        int adapt_lmin;
+        /// Theta rule in each radial element; empty before pruning
+        arma::ivec el_lang;
+        /// Choose the angular rule for each radial element from the convergence of its exchange-correlation energy and Fock matrix block
+        void adapt_angular(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, const arma::mat & P, double thr);
+        /// Exchange-correlation energy and Fock matrix block Hel of the element with the given rule; H is a zeroed full-size work matrix
+        double element_xc(DFTGridWorker & grid, int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, const arma::mat & P, size_t iel, int l, double thr, arma::mat & H, arma::mat & Hel) const;
+        /// Theta rule used in element
+        int element_lang(size_t iel) const;
+
+        /// Screen elements based on the density of the previous evaluation?
+        bool screen;
+        /// Maximum density, density gradient and density matrix element in each element at the last evaluation
+        arma::vec scr_rho, scr_grad, scr_pnorm;
+        /// Initialize screening data
+        void prepare_screening();
+        /// Maximum density matrix element in the element; P is in the dummy basis
+        double density_norm(const arma::mat & P, size_t iel) const;
+        /// Can the element be skipped?
+        bool skip_element(size_t iel, double pnorm, double thr) const;
+
       public:
         /// Dummy constructor
         DFTGrid();
@@ -180,6 +237,11 @@ namespace helfem {
         /// Compute Fock matrix, exchange-correlation energy and integrated electron density, unrestricted case
         void eval_Fxc(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, const arma::mat & Pa, const arma::mat & Pb, arma::mat & Ha, arma::mat & Hb, double & Exc, double & Nel, double & Ekin, bool beta, double thr);
 
+        /// Skip elements whose density was below the threshold in the previous call
+        void set_screening(bool screen);
+        /// Prune the theta rule per radial element, down to lmin, as long as the element's exchange-correlation energy and Fock matrix elements change less than tol
+        void set_adaptive(double tol, int lmin);
+
         /// Evaluate overlap
         arma::mat eval_overlap();
         /// Evaluate kinetic energy matrix
@@ -207,6 +269,17 @@ namespace helfem {
         H+=arma::real(fhlp*arma::trans(f));
       }
 
+      /**
+       * Complex basis functions: since the weights are real, the real
+       * part of f W f^H is Re(f) W Re(f)^T + Im(f) W Im(f)^T. Splitting
+       * the table takes two real matrix products instead of the four
+       * hidden in a complex one, half of which would be thrown away.
+       */
+      template<> inline void increment_lda< std::complex<double> >(arma::mat & H, const arma::rowvec & vxc, const arma::cx_mat & f) {
+        increment_lda<double>(H,vxc,arma::mat(arma::real(f)));
+        increment_lda<double>(H,vxc,arma::mat(arma::imag(f)));
+      }
+
       /// BLAS routine for GGA-type quadrature
       template<typename T> void increment_gga(arma::mat & H, const arma::mat & gn, const arma::Mat<T> & f, arma::Mat<T> f_x, arma::Mat<T> f_y, arma::Mat<T> f_z) {
         if(gn.n_cols!=3) {
@@ -252,6 +325,12 @@ namespace helfem {
         // Form Fock matrix
         H+=arma::real(gamma*arma::trans(f) + f*arma::trans(gamma));
       }
+
+      /// Complex basis functions: split into real and imaginary parts as in increment_lda
+      template<> inline void increment_gga< std::complex<double> >(arma::mat & H, const arma::mat & gn, const arma::cx_mat & f, arma::cx_mat f_x, arma::cx_mat f_y, arma::cx_mat f_z) {
+        increment_gga<double>(H,gn,arma::mat(arma::real(f)),arma::real(f_x),arma::real(f_y),arma::real(f_z));
+        increment_gga<double>(H,gn,arma::mat(arma::imag(f)),arma::imag(f_x),arma::imag(f_y),arma::imag(f_z));
+      }
     }
   }
 }
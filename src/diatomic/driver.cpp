@@ -0,0 +1,1861 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#include "driver.h"
+#include "../general/checkpoint.h"
+#include "../general/constants.h"
+#include "../general/diis.h"
+#include "../general/dftfuncs.h"
+#include "../general/timer.h"
+#include "../general/profiler.h"
+#include "../general/resume.h"
+#include "../general/telemetry.h"
+#include "../general/memtrack.h"
+#include "utils.h"
+#include "../general/elements.h"
+#include "../general/scf_helpers.h"
+#include "../general/soscf.h"
+#include "../general/threads.h"
+#include "../general/mpi_helpers.h"
+#include "../general/eigensolver.h"
+#include "../general/model_potential.h"
+#include "twodquadrature.h"
+#include <cfloat>
+#include <climits>
+#include <cstdio>
+#include <sstream>
+
+namespace helfem {
+  namespace diatomic {
+    /// Print out the symmetry of the orbitals
+    static void classify_orbitals(const arma::mat & C, const arma::ivec & mvals, const std::vector<arma::uvec> & mposidx, const std::vector<arma::uvec> & mnegidx) {
+      for(size_t io=0;io<C.n_cols;io++) {
+        arma::vec orb(C.col(io));
+
+        arma::vec opchar(mvals.n_elem), onchar(mvals.n_elem);
+        for(size_t c=0;c<mvals.n_elem;c++) {
+          opchar(c)=arma::norm(orb(mposidx[c]),"fro");
+          onchar(c)=arma::norm(orb(mnegidx[c]),"fro");
+        }
+
+        // Total character is
+        arma::vec ochar(opchar+onchar);
+
+        // Normalize
+        opchar/=arma::sum(ochar);
+        onchar/=arma::sum(ochar);
+        ochar/=arma::sum(ochar);
+
+        // Orbital symmetry is then
+        arma::uword oidx;
+        double stot=ochar.max(oidx);
+
+        // Symmetry threshold
+        double thr=0.999;
+
+        // Classification
+        std::ostringstream cl;
+
+        if(stot>=thr) {
+          // Orbital symmetry
+          char sym=' ';
+          if(opchar(oidx)>=thr)
+            sym='g';
+          else if(onchar(oidx)>=thr)
+            sym='u';
+
+          printf("Orbital %2i: m=%+i %c\n",(int) io+1,(int) mvals(oidx),sym);
+        } else {
+          printf("Orbital %2i: unknown\n",(int) io+1);
+        }
+      }
+    }
+
+    /// Scale the matrix elements by the basis function norms
+    static void normalize_matrix(arma::mat & M, const arma::vec & norm) {
+      if(M.n_rows != norm.n_elem) throw std::logic_error("Incompatible dimensions!\n");
+      if(M.n_cols != norm.n_elem) throw std::logic_error("Incompatible dimensions!\n");
+      for(size_t i=0;i<M.n_rows;i++)
+        for(size_t j=0;j<M.n_cols;j++)
+          M(i,j)*=norm(i)*norm(j);
+    }
+
+    /**
+     * Resolve the orbital symmetry used in the calculation. The basis
+     * functions are eigenfunctions of inversion with parity (-1)^l, so
+     * for a homonuclear molecule without external fields the Fock
+     * matrix is block diagonal in (m, parity); symm<0 picks the
+     * largest symmetry group that applies.
+     */
+    static int resolve_symmetry(int symm, int Z1, int Z2, double Ez, double Qzz, double Bz, bool verbose) {
+      bool fields=(Ez!=0.0 || Qzz!=0.0 || Bz!=0.0);
+      if(symm<0)
+        return (Z1==Z2 && !fields) ? 2 : 1;
+
+      if(symm==2 && Z1!=Z2) {
+        if(verbose)
+          printf("Warning - asked for homonuclear symmetry for heteronuclear molecule. Relaxing restriction.\n");
+        symm=1;
+      }
+      if(symm==2 && (Ez!=0.0 || Qzz!=0.0)) {
+        if(verbose)
+          printf("Warning - asked for full orbital symmetry in presence of electric field. Relaxing restriction.\n");
+        symm=1;
+      }
+      if(symm==2 && Bz!=0.0) {
+        if(verbose)
+          printf("Warning - asked for full orbital symmetry in presence of magnetic field. Relaxing restriction.\n");
+        symm=1;
+      }
+      return symm;
+    }
+
+    void Driver::add_options(cmdline::parser & parser) {
+      // full option name, no short option, description, argument required
+      parser.add<std::string>("Z1", 0, "first nuclear charge", true);
+      parser.add<std::string>("Z2", 0, "second nuclear charge", true);
+      parser.add<double>("Rbond", 0, "internuclear distance", true);
+      parser.add<bool>("angstrom", 0, "input distances in angstrom", false, false);
+      parser.add<int>("nela", 0, "number of alpha electrons", false, 0);
+      parser.add<int>("nelb", 0, "number of beta  electrons", false, 0);
+      parser.add<int>("Q", 0, "charge state", false, 0);
+      parser.add<int>("M", 0, "spin multiplicity", false, 0);
+      parser.add<std::string>("lmax", 0, "maximum l quantum number", true, "");
+      parser.add<int>("mmax", 0, "maximum m quantum number", false, -1);
+      parser.add<int>("lpad", 0, "padding for max l for more accurate Qlm recursion", false, 10);
+      parser.add<double>("lpadthr", 0, "relative tolerance for choosing the padding automatically for each set of quadrature points, with lpad as the largest padding; 0 to always use lpad", false, 0.0);
+      parser.add<double>("Rmax", 0, "practical infinity in au", false, 40.0);
+      parser.add<int>("grid", 0, "type of grid: 1 for linear, 2 for quadratic, 3 for polynomial, 4 for exponential", false, 4);
+      parser.add<double>("zexp", 0, "parameter in radial grid", false, 1.0);
+      parser.add<int>("nelem", 0, "number of elements", true);
+      parser.add<int>("nnodes", 0, "number of nodes per element", false, 15);
+      parser.add<int>("nquad", 0, "number of quadrature points", false, 0);
+      parser.add<int>("maxit", 0, "maximum number of iterations", false, 50);
+      parser.add<int>("incfock", 0, "build Coulomb and exchange from the density change, with a full rebuild every n iterations; 0 to disable", false, 0);
+      parser.add<double>("incthr", 0, "density block screening threshold in incremental Fock builds", false, 1e-10);
+      parser.add<double>("convthr", 0, "convergence threshold", false, 1e-7);
+      parser.add<double>("Ez", 0, "electric dipole field", false, 0.0);
+      parser.add<double>("Qzz", 0, "electric quadrupole field", false, 0.0);
+      parser.add<double>("Bz", 0, "magnetic dipole field", false, 0.0);
+      parser.add<bool>("diag", 0, "exact diagonalization", false, 1);
+      parser.add<int>("finitenuc", 0, "finite nuclear model", false, false);
+      parser.add<double>("Rrms1", 0, "nucleus 1 radius", false, 0.0);
+      parser.add<double>("Rrms2", 0, "nucleus 2 radius", false, 0.0);
+      parser.add<std::string>("method", 0, "method to use", false, "HF");
+      parser.add<int>("ldft", 0, "theta rule for dft quadrature (0 for auto)", false, 0);
+      parser.add<int>("mdft", 0, "phi rule for dft quadrature (0 for auto)", false, 0);
+      parser.add<double>("dftthr", 0, "density threshold for dft", false, 1e-12);
+      parser.add<double>("dftadapt", 0, "tolerance for the exchange-correlation energy and Fock matrix elements per radial element in adaptive angular pruning (0 to disable)", false, 0.0);
+      parser.add<bool>("dftscreen", 0, "skip radial elements whose density was below dftthr on the previous iteration", false, false);
+      parser.add<bool>("verbose", 0, "print additional timing and load balance information", false, false);
+      parser.add<int>("restricted", 0, "spin-restricted orbitals", false, -1);
+      parser.add<int>("symmetry", 0, "force orbital symmetry: 0 for none, 1 for m, 2 for m and parity, -1 for automatic", false, -1);
+      parser.add<bool>("blockdiis", 0, "store the DIIS history in the orbital symmetry blocks (always on with parity symmetry)", false, false);
+      parser.add<bool>("diissingle", 0, "store the DIIS history in single precision", false, false);
+      parser.add<double>("mixedthr", 0, "DIIS error below which the Coulomb and exchange builds switch from single- to double-precision integrals; 0 for double precision throughout", false, 0.0);
+      parser.add<std::string>("eigsolver", 0, "dense eigensolver for the large symmetry blocks: lapack or scalapack (over the MPI ranks)", false, "lapack");
+      parser.add<int>("eigmin", 0, "smallest symmetry block solved with the chosen eigensolver; smaller ones use LAPACK", false, 2000);
+      parser.add<int>("davidson", 0, "solve the orbitals with the Davidson method including n virtual orbitals; negative for full diagonalization", false, -1);
+      parser.add<double>("davidsonthr", 0, "residual threshold for the Davidson method", false, 1e-7);
+      parser.add<int>("primbas", 0, "primitive radial basis", false, 4);
+      parser.add<double>("diiseps", 0, "when to start mixing in diis", false, 1e-2);
+      parser.add<double>("diisthr", 0, "when to switch over fully to diis", false, 1e-3);
+      parser.add<int>("diisorder", 0, "length of diis history", false, 5);
+      parser.add<int>("soscf", 0, "switch to the second-order solver when the DIIS error has not improved in n iterations; 0 to disable", false, 0);
+      parser.add<int>("readocc", 0, "read occupations from file, use until nth build", false, 0);
+      parser.add<std::string>("occfile", 0, "file to read the occupations from", false, "occs.dat");
+      parser.add<std::string>("occscan", 0, "comma separated list of occupation files to run calculations with after the ground state, each starting from the ground state orbitals, all collected in the save checkpoint", false, "");
+      parser.add<double>("perturb", 0, "randomly perturb initial guess", false, 0.0);
+      parser.add<int>("seed", 0, "seed for random perturbation", false, 0);
+      parser.add<int>("iguess", 0, "guess: 0 for core, 1 for GSZ, 2 for SAP, 3 for TF", false, 2);
+      parser.add<std::string>("load", 0, "load guess from checkpoint", false, "");
+      parser.add<std::string>("bondscan", 0, "comma separated list of bond lengths to run calculations at, all collected in the save checkpoint", false, "");
+      parser.add<bool>("polarizability", 0, "compute the static dipole polarizability from the coupled-perturbed equations", false, false);
+      parser.add<double>("respthr", 0, "residual threshold for the response equations", false, 1e-7);
+      parser.add<std::string>("fieldscan", 0, "comma separated list of field values to run calculations at, all collected in the save checkpoint", false, "");
+      parser.add<std::string>("scanfield", 0, "field to scan: Ez, Qzz or Bz", false, "Ez");
+      parser.add<std::string>("save", 0, "save calculation to checkpoint, empty for none", false, "helfem.chk");
+      parser.add<std::string>("teicache", 0, "cache file for two-electron integrals", false, "");
+      parser.add<double>("mem_budget", 0, "memory budget for primitive two-electron integrals in GiB, 0 for unlimited", false, 0.0);
+      parser.add<double>("memory", 0, "total memory budget in GiB used to plan the TEI storage and DIIS history length; 0 to use the individual settings", false, 0.0);
+      parser.add<std::string>("scratch", 0, "scratch directory for out-of-core two-electron integrals", false, "");
+      parser.add<bool>("direct", 0, "recompute primitive two-electron integrals whenever they are needed", false, false);
+      parser.add<int>("tei_cache", 0, "number of recomputed elements of two-electron integrals to keep in memory", false, 0);
+      parser.add<int>("numa", 0, "number of NUMA domains over which the in-core two-electron integrals are distributed; 0 for none", false, 0);
+      parser.add<int>("threads_outer", 0, "number of OpenMP threads in the parallel kernels; 0 for the OpenMP default", false, 0);
+      parser.add<int>("threads_blas", 0, "number of BLAS threads in the serial phases, BLAS runs on one thread inside the parallel kernels; 0 for the BLAS default", false, 0);
+      parser.add<int>("chkpt_every", 0, "write SCF checkpoint every n iterations", false, 1);
+      parser.add<bool>("chkpt_minimal", 0, "only checkpoint the data needed for a restart", false, false);
+      parser.add<int>("chkpt_virtuals", 0, "number of virtual orbitals checkpointed on top of the occupied ones during the SCF, negative for all", false, -1);
+      parser.add<int>("chkpt_virtuals_final", 0, "number of virtual orbitals checkpointed on top of the occupied ones on convergence, negative for all", false, -1);
+      parser.add<std::string>("chkpt_final", 0, "comma separated list of SCF entries that are only checkpointed on convergence from P, Pa, Pb, J, Ka, Kb, XCa, XCb, Fa, Fb, Ca, Cb, Ea and Eb, or all", false, "");
+      parser.add<std::string>("resume", 0, "file for the resumable SCF snapshot; an existing snapshot is resumed from, and it is removed once the SCF loop ends", false, "");
+      parser.add<int>("resume_every", 0, "write the resumable SCF snapshot every n iterations", false, 1);
+      parser.add<std::string>("chkpt_codec", 0, "compression of checkpoint entries as a comma separated list of category=codec, with categories basis, scf and other and codecs none, deflate[:level] and zstd[:level] optionally prefixed by shuffle+", false, "");
+      parser.add<std::string>("chkpt_matrices", 0, "comma separated list of one-electron matrices to store in the checkpoint from S, T, Vnuc, Sinvh, Sh, dip, quad, Vel, Vmag and H0, or all", false, "");
+      parser.add<bool>("chkpt_inplace", 0, "overwrite checkpoint entries of unchanged shape in place, so that the file does not grow over the iterations", false, true);
+      parser.add<bool>("chkpt_skip", 0, "do not store the overlap, kinetic and nuclear attraction matrices in the checkpoint, they are recomputed from the basis set when read", false, false);
+      parser.add<std::string>("x_pars", 0, "file for parameters for exchange functional", false, "");
+      parser.add<std::string>("c_pars", 0, "file for parameters for correlation functional", false, "");
+      parser.add<bool>("maverage", 0, "average Fock matrix over m values", false, false);
+      parser.add<bool>("server", 0, "after the first job, read further jobs from stdin, one line of options each, reusing the basis set and integrals", false, false);
+      parser.add<std::string>("profile", 0, "write a profile of the run in the given file, CSV if it ends in .csv and JSON otherwise", false, "");
+      parser.add<std::string>("telemetry", 0, "append a JSON record of every SCF iteration to the given file", false, "");
+    }
+
+    /// Options that define the basis set and integrals
+    static const char * fixed_options[] = {"Z1", "Z2", "Rbond", "angstrom", "lmax", "mmax", "lpad", "lpadthr", "Rmax", "grid", "zexp", "nelem", "nnodes", "nquad", "primbas", "finitenuc", "Rrms1", "Rrms2", "diag", "symmetry", "ldft", "mdft", "teicache", "mem_budget", "memory", "scratch", "direct", "tei_cache", "numa", "threads_outer", "threads_blas", "server", "profile", "telemetry"};
+
+    bool Driver::changes_basis(const std::vector<std::string> & args, size_t istart, std::string & name) {
+      for(size_t i=istart;i<args.size();i++) {
+        if(args[i].compare(0,2,"--")!=0)
+          continue;
+        name=args[i].substr(2,args[i].find('=')-2);
+        for(size_t j=0;j<sizeof(fixed_options)/sizeof(fixed_options[0]);j++)
+          if(name==fixed_options[j])
+            return true;
+      }
+      return false;
+    }
+
+    Driver::Driver(const cmdline::parser & parser) {
+      // Get parameters of the basis set and the integrals
+      double Rmax(parser.get<double>("Rmax"));
+      int igrid(parser.get<int>("grid"));
+      double zexp(parser.get<double>("zexp"));
+      double Ez(parser.get<double>("Ez"));
+      double Qzz(parser.get<double>("Qzz"));
+      double Bz(parser.get<double>("Bz"));
+
+      bool diag(parser.get<bool>("diag"));
+      int symm(parser.get<int>("symmetry"));
+      bool diissingle(parser.get<bool>("diissingle"));
+      int diisorder=parser.get<int>("diisorder");
+
+      int primbas(parser.get<int>("primbas"));
+      // Number of elements
+      int Nelem(parser.get<int>("nelem"));
+      // Number of nodes
+      int Nnodes(parser.get<int>("nnodes"));
+      // Order of quadrature rule
+      int Nquad(parser.get<int>("nquad"));
+      // Angular grid
+      std::string lmax(parser.get<std::string>("lmax"));
+      int mmax(parser.get<int>("mmax"));
+      int lpad(parser.get<int>("lpad"));
+      double lpadthr(parser.get<double>("lpadthr"));
+
+      // DFT angular grid
+      int ldft(parser.get<int>("ldft"));
+      bool verbose(parser.get<bool>("verbose"));
+
+      // Nuclear charge
+      int Z1(get_Z(parser.get<std::string>("Z1")));
+      int Z2(get_Z(parser.get<std::string>("Z2")));
+      double Rbond(parser.get<double>("Rbond"));
+
+      // Finite nucleus
+      int finitenuc(parser.get<int>("finitenuc"));
+      double Rrms1(parser.get<double>("Rrms1"));
+      double Rrms2(parser.get<double>("Rrms2"));
+
+      std::string teicache(parser.get<std::string>("teicache"));
+      double mem_budget(parser.get<double>("mem_budget"));
+      double memory_budget(parser.get<double>("memory"));
+      std::string scratchdir(parser.get<std::string>("scratch"));
+      bool direct(parser.get<bool>("direct"));
+      int tei_cache(parser.get<int>("tei_cache"));
+      int numa(parser.get<int>("numa"));
+
+      if(parser.get<bool>("angstrom")) {
+        // Convert to atomic units
+        Rbond*=ANGSTROMINBOHR;
+      }
+
+      diatomic::basis::TwoDBasis & basis(setup.basis);
+      setup.plan_diisorder=0;
+
+      // Get primitive basis
+      auto poly(std::shared_ptr<const polynomial_basis::PolynomialBasis>(polynomial_basis::get_basis(primbas,Nnodes)));
+
+      if(Nquad==0)
+        // Set default value
+        Nquad=5*poly->get_nbf();
+      else if(Nquad<2*poly->get_nbf())
+        throw std::logic_error("Insufficient radial quadrature.\n");
+
+      printf("Using %i point quadrature rule.\n",Nquad);
+
+      arma::ivec lmmax;
+      if(mmax>=0) {
+        lmmax.ones(mmax+1);
+        lmmax*=atoi(lmax.c_str());
+      } else {
+        // Parse list of l values
+        std::vector<arma::uword> lmmaxv;
+        std::stringstream ss(lmax);
+        while( ss.good() ) {
+          std::string substr;
+          getline( ss, substr, ',' );
+          lmmaxv.push_back(atoi(substr.c_str()));
+        }
+        lmmax=arma::conv_to<arma::ivec>::from(lmmaxv);
+      }
+      // l and m values
+      arma::ivec lval, mval;
+      diatomic::basis::lm_to_l_m(lmmax,lval,mval);
+
+      double Rhalf(0.5*Rbond);
+      double mumax(utils::arcosh(Rmax/Rhalf));
+      arma::vec bval(atomic::basis::normal_grid(Nelem, mumax, igrid, zexp));
+
+      basis=diatomic::basis::TwoDBasis(Z1, Z2, Rhalf, poly, Nquad, bval, lval, mval, lpad, true, lpadthr);
+      printf("Basis set consists of %i angular shells composed of %i radial functions, totaling %i basis functions\n",(int) basis.Nang(), (int) basis.Nrad(), (int) basis.Nbf());
+
+      printf("One-electron matrix requires %s\n",scf::memory_size(basis.mem_1el()).c_str());
+      printf("Auxiliary one-electron integrals require %s\n",scf::memory_size(basis.mem_1el_aux()).c_str());
+      printf("Auxiliary two-electron integrals require %s\n",scf::memory_size(basis.mem_2el_aux()).c_str());
+      size_t tei_budget((size_t) (mem_budget*1024.0*1024.0*1024.0));
+      if(memory_budget>0.0) {
+        // Divide the memory between the subsystems. The DIIS history
+        // holds four matrices and the error vector per entry
+        memory::plan_t plan(memory::make_plan((size_t) (memory_budget*1024.0*1024.0*1024.0), 10*basis.mem_1el()+basis.mem_1el_aux(), basis.mem_2el_aux(), (diissingle ? 3 : 5)*basis.mem_1el(), diisorder, false));
+        memory::print_plan(plan);
+        // Any budget below the need keeps the integrals out of core
+        tei_budget = plan.tei_incore ? 0 : 1;
+        setup.plan_diisorder=plan.diisorder;
+      }
+      basis.set_tei_storage(tei_budget,scratchdir,direct,(size_t) std::max(tei_cache,0));
+      basis.set_numa((size_t) std::max(numa,0));
+
+      // The half-inverse is formed in the symmetry of the first job
+      symm=resolve_symmetry(symm,Z1,Z2,Ez,Qzz,Bz,false);
+
+      setup.Z1=Z1;
+      setup.Z2=Z2;
+      setup.Nelem=Nelem;
+      setup.lmmax=lmmax;
+      setup.diag=diag;
+      setup.symm=symm;
+      setup.ldft=ldft;
+      setup.mdft=parser.get<int>("mdft");
+      setup.finitenuc=finitenuc;
+      setup.Rrms1=Rrms1;
+      setup.Rrms2=Rrms2;
+      setup.teicache=teicache;
+      setup.verbose=verbose;
+
+      // Form the one-electron matrices
+      form_one_electron();
+
+      // The guess only needs the one-electron matrices
+      start_tei();
+    }
+
+    Driver::~Driver() {
+      // The worker refers to the basis set
+      if(teijob.valid())
+        teijob.wait();
+    }
+
+    void Driver::build_tei() {
+      diatomic::basis::TwoDBasis & basis(setup.basis);
+      profiler::Region ptei("Integrals");
+      // Out-of-core and recomputed integrals are not cached. Integrals
+      // distributed over MPI ranks are cached in a shard per rank, as
+      // long as all ranks keep theirs in core
+      double nincore(basis.get_tei_storage()==scratch::TEI_INCORE ? 1.0 : 0.0);
+      mpi::allreduce(nincore);
+      if(setup.teicache.size() && nincore==mpi::size()) {
+        // Integrals only depend on the radial basis, so they can be reused
+        Checkpoint teichk(setup.teicache,true,false);
+        if(teichk.read_tei(basis)) {
+          if(mpi::size()>1)
+            printf("Primitive integrals read from the %i shards of %s\n",mpi::size(),setup.teicache.c_str());
+          else
+            printf("Primitive integrals read from %s\n",setup.teicache.c_str());
+        } else {
+          basis.compute_tei(setup.verbose);
+          teichk.write_tei(basis);
+        }
+      } else {
+        basis.compute_tei(setup.verbose);
+      }
+    }
+
+    void Driver::start_tei() {
+      // The guess potential is cached in the same file, HDF5 is not
+      // thread safe, and MPI is only called from the main thread
+      if(setup.teicache.size() || mpi::size()>1) {
+        printf("Computing two-electron integrals\n");
+        fflush(stdout);
+        Timer timer;
+        build_tei();
+        printf("Done in %.6f\n",timer.get());
+        return;
+      }
+
+      printf("Computing two-electron integrals in the background\n");
+      fflush(stdout);
+      // A new thread starts out with the default team size
+      const int nth(threads::outer_threads());
+      teijob=std::async(std::launch::async,[this,nth]() {
+          threads::set_policy(nth,0);
+          Timer timer;
+          build_tei();
+          teitime=timer.get();
+        });
+    }
+
+    void Driver::wait_tei() {
+      if(!teijob.valid())
+        return;
+      Timer timer;
+      // Rethrows any error from the worker
+      teijob.get();
+      printf("Two-electron integrals formed in %.6f, waited %.6f for them\n",teitime,timer.get());
+      fflush(stdout);
+    }
+
+    void Driver::form_one_electron() {
+      diatomic::basis::TwoDBasis & basis(setup.basis);
+      const int Z1(setup.Z1), Z2(setup.Z2);
+      setup.Rhalf=basis.get_Rhalf();
+      setup.Rbond=2.0*setup.Rhalf;
+      setup.Enucr=Z1*Z2/setup.Rbond;
+      // The elements are fixed in mu, so the practical infinity scales with the bond length
+      setup.Rmax=setup.Rhalf*std::cosh(basis.get_mumax());
+      printf("Left- and right-hand nuclear charges are %i and %i at distance % .3f\n",Z1,Z2,setup.Rbond);
+      printf("Nuclear repulsion energy is %e\n",setup.Enucr);
+
+      Timer timer;
+
+      // The one-electron matrices are formed when first needed;
+      // declaring them again discards the ones of the old geometry
+      MatrixStore & mats(setup.matrices);
+      mats.declare("S",[&basis]() { return basis.overlap(); });
+      mats.declare("T",[&basis]() { return basis.kinetic(); });
+      mats.declare("Vnuc",[this]() { return nuclear_attraction(); });
+      mats.declare("dip",[&basis]() { return basis.dipole_z(); });
+      mats.declare("quad",[&basis]() { return basis.quadrupole_zz(); });
+      for(int iguess=0;iguess<4;iguess++)
+        mats.declare(guess_entry(iguess),[this,iguess]() { return guess_potential(iguess); });
+      const arma::mat & S(mats.get("S"));
+
+      // Get half-inverse
+      timer.set();
+      arma::mat & Sinvh(setup.Sinvh);
+      Sinvh=basis.Sinvh(!setup.diag,setup.symm);
+      printf("Half-inverse formed in %.6f\n",timer.get());
+      {
+        arma::mat Smo(Sinvh.t()*S*Sinvh);
+        Smo-=arma::eye<arma::mat>(Smo.n_rows,Smo.n_cols);
+        printf("Orbital orthonormality deviation is %e\n",arma::norm(Smo,"fro"));
+      }
+      arma::mat & Sh(setup.Sh);
+      Sh=basis.Shalf(!setup.diag,setup.symm);
+      printf("Half-overlap formed in %.6f\n",timer.get());
+      {
+        arma::mat Smo(Sh.t()*Sinvh);
+        Smo-=arma::eye<arma::mat>(Smo.n_rows,Smo.n_cols);
+        printf("Half-overlap error is %e\n",arma::norm(Smo,"fro"));
+      }
+
+      // The DFT grid depends on the bond length
+      setup.have_grid=false;
+    }
+
+    helfem::diatomic::twodquad::TwoDGrid Driver::model_grid() const {
+      const diatomic::basis::TwoDBasis & basis(setup.basis);
+      const arma::mat & S(setup.matrices.get("S"));
+      int lquad = (setup.ldft>0) ? setup.ldft : 4*arma::max(setup.lmmax)+12;
+      helfem::diatomic::twodquad::TwoDGrid qgrid;
+      qgrid=helfem::diatomic::twodquad::TwoDGrid(&basis,lquad);
+
+      arma::mat Squad(qgrid.overlap());
+      Squad-=S;
+      arma::vec bfnorm(arma::pow(arma::diagvec(S),-0.5));
+      normalize_matrix(Squad,bfnorm);
+
+      double Serr(arma::norm(Squad,"fro"));
+      printf("Error in overlap matrix evaluated on two-dimensional grid is %e\n",Serr);
+      fflush(stdout);
+
+      return qgrid;
+    }
+
+    arma::mat Driver::nuclear_attraction() const {
+      const diatomic::basis::TwoDBasis & basis(setup.basis);
+      if(setup.finitenuc==0)
+        return basis.nuclear();
+
+      modelpotential::ModelPotential *pot1(modelpotential::get_nuclear_model((modelpotential::nuclear_model_t) (setup.finitenuc-1),setup.Z1,setup.Rrms1));
+      modelpotential::ModelPotential *pot2(modelpotential::get_nuclear_model((modelpotential::nuclear_model_t) (setup.finitenuc-1),setup.Z2,setup.Rrms2));
+      arma::mat Vnuc(model_grid().model_potential(pot1,pot2));
+      delete pot1;
+      delete pot2;
+      return Vnuc;
+    }
+
+    std::string Driver::guess_entry(int iguess) {
+      static const char * names[] = {"guess_core", "guess_GSZ", "guess_SAP", "guess_TF"};
+      if(iguess<0 || iguess>3)
+        throw std::logic_error("Unsupported guess\n");
+      return names[iguess];
+    }
+
+    arma::mat Driver::guess_potential(int iguess) const {
+      const diatomic::basis::TwoDBasis & basis(setup.basis);
+
+      // The potential depends on the charges, the bond length and the
+      // angular quadrature in addition to the radial basis. The ranks
+      // would all access the same file, so the cache is only used in
+      // serial runs.
+      int lquad = (setup.ldft>0) ? setup.ldft : 4*arma::max(setup.lmmax)+12;
+      std::string key;
+      if(setup.teicache.size() && mpi::size()==1) {
+        arma::vec par({(double) setup.Z1, (double) setup.Z2, setup.Rhalf, (double) lquad});
+        key=basis.tei_fingerprint()+"_"+guess_entry(iguess)+"_"+utils::hash_data(par);
+      }
+      if(key.size() && file_exists(setup.teicache)) {
+        Checkpoint teichk(setup.teicache,false);
+        if(teichk.exist(key)) {
+          arma::mat V;
+          teichk.read(key,V);
+          printf("Guess potential read from %s\n",setup.teicache.c_str());
+          return V;
+        }
+      }
+
+      modelpotential::ModelPotential * p1, * p2;
+      switch(iguess) {
+      case(0):
+        p1 = new modelpotential::PointNucleus(setup.Z1);
+        p2 = new modelpotential::PointNucleus(setup.Z2);
+        break;
+      case(1):
+        p1 = new modelpotential::GSZAtom(setup.Z1);
+        p2 = new modelpotential::GSZAtom(setup.Z2);
+        break;
+      case(2):
+        p1 = new modelpotential::SAPAtom(setup.Z1);
+        p2 = new modelpotential::SAPAtom(setup.Z2);
+        break;
+      case(3):
+        p1 = new modelpotential::TFAtom(setup.Z1);
+        p2 = new modelpotential::TFAtom(setup.Z2);
+        break;
+      default:
+        throw std::logic_error("Unsupported guess\n");
+      }
+      arma::mat V(model_grid().model_potential(p1,p2));
+      delete p1;
+      delete p2;
+
+      if(key.size()) {
+        Checkpoint teichk(setup.teicache,true,false);
+        teichk.write(key,V);
+      }
+      return V;
+    }
+
+    void Driver::set_bond_length(double Rbond) {
+      wait_tei();
+      setup.basis.set_Rhalf(0.5*Rbond);
+      form_one_electron();
+
+      if(result.Ca.n_elem) {
+        // The basis functions follow the nuclei, so the orbitals of
+        // the previous geometry only need to be orthonormalized in
+        // the new metric
+        for(int is=0;is<2;is++) {
+          arma::mat & C(is ? result.Cb : result.Ca);
+          arma::vec oval;
+          arma::mat ovec;
+          arma::eig_sym(oval,ovec,arma::mat(C.t()*setup.matrices.get("S")*C));
+          C=C*ovec*arma::diagmat(arma::pow(oval,-0.5))*ovec.t();
+        }
+      }
+    }
+
+    void Driver::form_grid() {
+      if(setup.have_grid)
+        return;
+      const arma::ivec & lmmax(setup.lmmax);
+      const arma::mat & S(setup.matrices.get("S"));
+      const arma::mat & T(setup.matrices.get("T"));
+      int ldft(setup.ldft), mdft(setup.mdft);
+
+      if(ldft==0)
+        // Default value: we have 2*lmax from the bra and ket and 2 from
+        // the volume element, and allow for 2*lmax from the
+        // density/potential. Add in 10 more for a bit more accuracy.
+        ldft=4*arma::max(lmmax)+12;
+      if(ldft<(int) (2*arma::max(lmmax)+2))
+        throw std::logic_error("Increase ldft to guarantee accuracy of quadrature!\n");
+
+      if(mdft==0)
+        // Default value: we have 2*mmax from the bra and ket, and allow
+        // for 2*mmax from the density/potential. Add in 5 to make
+        // sure quadrature is still accurate for mmax=0
+        mdft=4*lmmax.n_elem+5;
+      if(mdft<(int) (2*lmmax.n_elem)) {
+        std::ostringstream oss;
+        oss << "Increase mdft at least to " << 2*lmmax.n_elem << " to guarantee accuracy of quadrature!\n";
+        throw std::logic_error(oss.str());
+      }
+
+      // Form grid
+      setup.grid=helfem::diatomic::dftgrid::DFTGrid(&setup.basis,ldft,mdft);
+      setup.have_grid=true;
+
+      // Basis function norms
+      arma::vec bfnorm(arma::pow(arma::diagvec(S),-0.5));
+
+      // Check accuracy of grid
+      double Sthr=1e-10;
+      double Tthr=1e-8;
+      bool inacc=false;
+      {
+        arma::mat Sdft(setup.grid.eval_overlap());
+        Sdft-=S;
+        normalize_matrix(Sdft,bfnorm);
+
+        double Serr(arma::norm(Sdft,"fro"));
+        printf("Error in overlap matrix evaluated through xc grid is %e\n",Serr);
+        fflush(stdout);
+        if(Serr>=Sthr)
+          inacc=true;
+      }
+      {
+        arma::mat Tdft(setup.grid.eval_kinetic());
+        // Compute relative error
+        for(size_t j=0;j<Tdft.n_cols;j++)
+          for(size_t i=0;i<Tdft.n_rows;i++)
+            Tdft(i,j)=std::abs(Tdft(i,j)-T(i,j))/(1+std::abs(T(i,j)));
+
+        double Terr(arma::norm(Tdft,"fro"));
+        printf("Relative error in kinetic matrix evaluated through xc grid is %e\n",Terr);
+        fflush(stdout);
+        if(Terr>=Tthr)
+          inacc=true;
+      }
+      if(inacc)
+        printf("Warning - possibly inaccurate quadrature!\n");
+      printf("\n");
+    }
+
+    double Driver::run(const cmdline::parser & parser, bool restart) {
+      result.converged=false;
+      result.alpha_zz=0.0;
+
+      // The basis set and the integrals are shared between the jobs
+      diatomic::basis::TwoDBasis & basis(setup.basis);
+      const int Z1(setup.Z1), Z2(setup.Z2);
+      const double Rbond(setup.Rbond), Rhalf(setup.Rhalf);
+      const double Enucr(setup.Enucr);
+      const arma::ivec & lmmax(setup.lmmax);
+      const arma::mat & S(setup.matrices.get("S"));
+      const arma::mat & T(setup.matrices.get("T"));
+      const arma::mat & Vnuc(setup.matrices.get("Vnuc"));
+      const arma::mat & dip(setup.matrices.get("dip"));
+      const arma::mat & quad(setup.matrices.get("quad"));
+
+      // Get parameters
+      double Ez(parser.get<double>("Ez"));
+      double Qzz(parser.get<double>("Qzz"));
+      double Bz(parser.get<double>("Bz"));
+
+      int maxit(parser.get<int>("maxit"));
+      int incfock(parser.get<int>("incfock"));
+      double incthr(parser.get<double>("incthr"));
+      double convthr(parser.get<double>("convthr"));
+
+      int restr(parser.get<int>("restricted"));
+      int symm(parser.get<int>("symmetry"));
+      bool blockdiis(parser.get<bool>("blockdiis"));
+      bool diissingle(parser.get<bool>("diissingle"));
+      double mixedthr(parser.get<double>("mixedthr"));
+      int soscfstall(parser.get<int>("soscf"));
+      scf::set_eig_backend(scf::parse_eig_backend(parser.get<std::string>("eigsolver")),(size_t) std::max(parser.get<int>("eigmin"),0));
+      int davidson(parser.get<int>("davidson"));
+      double davidsonthr(parser.get<double>("davidsonthr"));
+      int iguess(parser.get<int>("iguess"));
+      bool maverage(parser.get<bool>("maverage"));
+      bool polarizability(parser.get<bool>("polarizability"));
+      double respthr(parser.get<double>("respthr"));
+
+      double dftthr(parser.get<double>("dftthr"));
+      double dftadapt(parser.get<double>("dftadapt"));
+      bool dftscreen(parser.get<bool>("dftscreen"));
+
+      // Number of occupied states
+      int nela(parser.get<int>("nela"));
+      int nelb(parser.get<int>("nelb"));
+      int Q(parser.get<int>("Q"));
+      int M(parser.get<int>("M"));
+
+      double diiseps=parser.get<double>("diiseps");
+      double diisthr=parser.get<double>("diisthr");
+      int diisorder=parser.get<int>("diisorder");
+      if(setup.plan_diisorder>0)
+        diisorder=setup.plan_diisorder;
+
+      std::string method(parser.get<std::string>("method"));
+
+      double perturb=parser.get<double>("perturb");
+      int seed=parser.get<int>("seed");
+
+      std::string save(parser.get<std::string>("save"));
+      std::string load(parser.get<std::string>("load"));
+      int chkpt_every(parser.get<int>("chkpt_every"));
+      bool chkpt_minimal(parser.get<bool>("chkpt_minimal"));
+      int chkpt_virtuals(parser.get<int>("chkpt_virtuals"));
+      int chkpt_virtuals_final(parser.get<int>("chkpt_virtuals_final"));
+      std::string chkpt_final(parser.get<std::string>("chkpt_final"));
+      if(chkpt_every<1)
+        throw std::logic_error("chkpt_every must be positive!\n");
+      std::string resume(parser.get<std::string>("resume"));
+      int resume_every(parser.get<int>("resume_every"));
+      if(resume_every<1)
+        throw std::logic_error("resume_every must be positive!\n");
+
+      std::string xparf(parser.get<std::string>("x_pars"));
+      std::string cparf(parser.get<std::string>("c_pars"));
+
+      // Set parameters if necessary
+      arma::vec xpars, cpars;
+      if(xparf.size()) {
+        xpars = scf::parse_xc_params(xparf);
+        xpars.t().print("Exchange functional parameters");
+      }
+      if(cparf.size()) {
+        cpars = scf::parse_xc_params(cparf);
+        cpars.t().print("Correlation functional parameters");
+      }
+
+      // Open checkpoint in save mode
+      Checkpoint chkpt(save,true);
+      chkpt.set_codecs(parser.get<std::string>("chkpt_codec"));
+      chkpt.set_skip_regenerable(parser.get<bool>("chkpt_skip"));
+      chkpt.set_inplace(parser.get<bool>("chkpt_inplace"));
+      // One-electron matrices are only stored on request, since they
+      // are recomputed from the basis set
+      std::string chkmats(parser.get<std::string>("chkpt_matrices"));
+
+      // Read occupations from file?
+      int readocc=parser.get<int>("readocc");
+      if(readocc<0)
+        readocc=INT_MAX;
+      arma::imat occs;
+      if(readocc) {
+        std::string occfile(parser.get<std::string>("occfile"));
+        if(!occs.load(occfile,arma::raw_ascii)) {
+          std::ostringstream oss;
+          oss << "Could not read occupations from " << occfile << "!\n";
+          throw std::runtime_error(oss.str());
+        }
+        if(occs.n_cols < 3) {
+          throw std::logic_error("Must have at least three columns in occupation data.\n");
+        }
+      }
+
+      scf::parse_nela_nelb(nela,nelb,Q,M,Z1+Z2);
+      if(restr==-1) {
+        // If number of electrons differs then unrestrict
+        restr=(nela==nelb);
+      }
+      chkpt.write("nela",nela);
+      chkpt.write("nelb",nelb);
+
+      std::vector<std::string> rcalc(2);
+      rcalc[0]="unrestricted";
+      rcalc[1]="restricted";
+
+      printf("Running %s %s calculation with Rmax=%e and %i elements.\n",rcalc[restr].c_str(),method.c_str(),setup.Rmax,setup.Nelem);
+      printf("Number of electrons is %i %i\n",nela,nelb);
+
+      chkpt.write(basis);
+      if(MatrixStore::listed(chkmats,"S"))
+        chkpt.write_regenerable("S",S);
+      if(MatrixStore::listed(chkmats,"T"))
+        chkpt.write_regenerable("T",T);
+
+      // Collect basis function indices
+      arma::ivec mvals;
+      {
+        arma::ivec mv(basis.get_m());
+        arma::uvec idx(arma::find_unique(mv,true));
+        mvals=mv(idx);
+      }
+      std::vector<arma::uvec> midx(mvals.n_elem), mposidx(mvals.n_elem), mnegidx(mvals.n_elem);
+      for(size_t i=0;i<midx.size();i++) {
+        midx[i]=basis.m_indices(mvals(i));
+        mposidx[i]=basis.m_indices(mvals(i),false);
+        mnegidx[i]=basis.m_indices(mvals(i),true);
+      }
+
+      // Symmetry indices
+      std::vector<arma::uvec> dsym;
+      symm=resolve_symmetry(symm,Z1,Z2,Ez,Qzz,Bz,true);
+      if(symm==2)
+        printf("Orbitals are blocked by m and inversion parity\n");
+      if(symm)
+        dsym=basis.get_sym_idx(symm);
+      // With m averaging the Fock blocks of +m and -m coincide, so
+      // only one block of each pair is diagonalized. The ROHF update
+      // depends on the density and does not preserve this.
+      arma::ivec dmirror;
+      if(symm && maverage && !(restr && nela!=nelb)) {
+        dmirror=basis.get_sym_mirror(symm);
+        printf("%i symmetry blocks are mirrored from opposite m\n",(int) arma::sum(dmirror>=0));
+      }
+
+      // For m averaging
+      std::vector< std::vector<arma::uvec> > mavg_idx;
+      for(int m=0;m<=arma::max(arma::abs(basis.get_mval()));m++) {
+        // Construct set of indices to average over
+        std::vector<arma::uvec> entry;
+        entry.push_back(basis.m_indices(m));
+        if(m>0)
+          entry.push_back(basis.m_indices(-m));
+        mavg_idx.push_back(entry);
+      }
+
+      // Forced occupations?
+      arma::ivec occnuma, occnumb;
+      std::vector<arma::uvec> occsym;
+      if(readocc) {
+        // Number of occupied alpha orbitals is first column
+        occnuma=occs.col(0);
+        // Number of occupied beta orbitals is second column
+        occnumb=occs.col(1);
+
+        // Heteronuclear molecule?
+        if(Z1 != Z2 && occs.n_cols != 3)
+          throw std::logic_error("Heteronuclear molecule orbital occupations must have three columns.\n");
+        if(Z1 == Z2 && (occs.n_cols != 3) && (occs.n_cols != 4))
+          throw std::logic_error("Homonuclear molecule orbital occupations must have three or four columns.\n");
+
+        if(occs.n_cols == 3) {
+          // m value is third column
+          for(size_t i=0;i<occs.n_rows;i++)
+            occsym.push_back(basis.m_indices(occs(i,2)));
+        } else if(occs.n_cols == 4) {
+          if(symm!=2)
+            throw std::logic_error("For use of homonuclear orbital occupations, must turn on use of full symmetry.\n");
+          // m value is third column, parity is fourth column
+          for(size_t i=0;i<occs.n_rows;i++) {
+            if(occs(i,3)!=1 && occs(i,3)!=-1) {
+              std::ostringstream oss;
+              oss << "Error on line " << i+1 << " of orbital occupations: parity must be +1 or -1\n";
+              throw std::logic_error(oss.str());
+            }
+            occsym.push_back(basis.m_indices(occs(i,2),(occs(i,3)==-1)));
+          }
+        }
+
+        // Check consistency of values
+        if(arma::sum(occnuma) != nela) {
+          std::ostringstream oss;
+          oss << "Specified alpha occupations don't match wanted spin state.\n";
+          oss << "Occupying " << arma::sum(occnuma) << " orbitals but should have " << nela << " orbitals.\n";
+          throw std::logic_error(oss.str());
+        }
+        if(arma::sum(occnumb) != nelb) {
+          std::ostringstream oss;
+          oss << "Specified alpha occupations don't match wanted spin state.\n";
+          oss << "Occupying " << arma::sum(occnumb) << " orbitals but should have " << nelb << " orbitals.\n";
+          throw std::logic_error(oss.str());
+        }
+      }
+
+      // Functional
+      int x_func, c_func;
+      ::parse_xc_func(x_func, c_func, method);
+      ::print_info(x_func, c_func);
+      if(!is_supported(x_func))
+        throw std::logic_error("The specified exchange functional is not currently supported in HelFEM.\n");
+      if(!is_supported(c_func))
+        throw std::logic_error("The specified correlation functional is not currently supported in HelFEM.\n");
+
+      bool dft=(x_func>0 || c_func>0);
+      if(is_range_separated(x_func))
+        throw std::logic_error("Range separated functionals are not supported.\n");
+      // Fraction of exact exchange
+      double kfrac(exact_exchange(x_func));
+      if(kfrac!=0.0)
+        printf("\nUsing hybrid exchange with % .3f %% of exact exchange.\n",kfrac*100);
+      else
+        printf("\nA pure exchange functional used, no exact exchange.\n");
+
+      Timer timer;
+
+      // The DFT grid is formed on the first job that needs it
+      if(dft) {
+        form_grid();
+        setup.grid.set_screening(dftscreen);
+        setup.grid.set_adaptive(dftadapt,2*arma::max(lmmax)+2);
+      }
+      helfem::diatomic::dftgrid::DFTGrid & grid(setup.grid);
+
+      // The half-inverse overlap is formed in the orbital symmetry
+      arma::mat Sinvh(setup.Sinvh), Sh(setup.Sh);
+      if(symm!=setup.symm) {
+        Sinvh=basis.Sinvh(!setup.diag,symm);
+        Sh=basis.Shalf(!setup.diag,symm);
+      }
+      // The half-inverse is formed block by block, so the columns of
+      // each symmetry are known without scanning it
+      std::vector<arma::uvec> dcols;
+      if(symm)
+        dcols=scf::block_columns(dsym);
+      if(MatrixStore::listed(chkmats,"Sinvh")) {
+        chkpt.write_regenerable("Sinvh",Sinvh);
+        // Needed to form the same half-inverse again
+        chkpt.write("Sinvh_chol",!setup.diag);
+        chkpt.write("Sinvh_symm",symm);
+      }
+      if(MatrixStore::listed(chkmats,"Sh"))
+        chkpt.write("Sh",Sh);
+      // Finite nuclei are evaluated on a quadrature that is not
+      // stored with the basis set, so they are always stored
+      if(setup.finitenuc!=0)
+        chkpt.write("Vnuc",Vnuc);
+      else if(MatrixStore::listed(chkmats,"Vnuc"))
+        chkpt.write_regenerable("Vnuc",Vnuc);
+      if(MatrixStore::listed(chkmats,"dip"))
+        chkpt.write("dip",dip);
+      if(MatrixStore::listed(chkmats,"quad"))
+        chkpt.write("quad",quad);
+
+      // Nuclear dipole and quadrupole
+      const double nucdip=(Z2-Z1)*Rhalf;
+      const double nucquad=(Z1+Z2)*Rhalf*Rhalf;
+
+      // Electric field coupling (minus sign cancels one from charge)
+      const arma::mat Vel(Ez*dip + Qzz*quad/3.0);
+      if(MatrixStore::listed(chkmats,"Vel"))
+        chkpt.write("Vel",Vel);
+      // Magnetic field coupling
+      arma::mat Vmag(basis.Bz_field(Bz));
+      if(MatrixStore::listed(chkmats,"Vmag"))
+        chkpt.write("Vmag",Vmag);
+      const double Enucfield(-Ez*nucdip - Qzz*nucquad/3.0);
+
+      // Form Hamiltonian
+      const arma::mat H0(T+Vnuc+Vel+Vmag);
+      if(MatrixStore::listed(chkmats,"H0"))
+        chkpt.write("H0",H0);
+
+      printf("One-electron matrices formed in %.6f\n",timer.get());
+
+      // Occupied and virtual orbitals
+      arma::mat Caocc, Cbocc, Cavirt, Cbvirt;
+      arma::vec Ea, Eb;
+      // Number of eigenenergies to print
+      arma::uword nena(std::min((arma::uword) nela+4,Sinvh.n_cols));
+      arma::uword nenb(std::min((arma::uword) nelb+4,Sinvh.n_cols));
+
+      bool usediis=true, useadiis=true, diiscomb=false;
+      uDIIS diis(S,Sinvh,diiscomb,usediis,diiseps,diisthr,useadiis,true,diisorder);
+      // With parity the blocks are half the size of the m blocks, so the
+      // DIIS history is always stored in them
+      if((blockdiis && symm) || symm==2) {
+        // The Fock matrices are block diagonal in the symmetry
+        diis.set_blocks(dsym);
+        printf("DIIS history is stored in %i symmetry blocks\n",(int) dsym.size());
+      }
+      diis.set_single(diissingle);
+
+      // An interrupted calculation is resumed from its snapshot, which
+      // holds the orbitals, the DIIS history and the state of the loop
+      scf::resume_t rstate;
+      bool resuming=resume.size() && scf::read_resume(resume,rstate,diis,Sinvh.n_rows,nela,nelb);
+
+      // Guess orbitals
+      timer.set();
+      profiler::Region pguess("Guess");
+      {
+        arma::mat Ca, Cb;
+        if(resuming) {
+          printf("Resuming from iteration %i of snapshot %s\n",rstate.iter,resume.c_str());
+          Ca=rstate.Ca;
+          Cb=rstate.Cb;
+          Ea=rstate.Ea;
+          Eb=rstate.Eb;
+        } else if(restart && result.Ca.n_elem) {
+          printf("Guess orbitals from the previous calculation\n");
+          // The basis set is the same, so the orbitals can be used as such
+          Ca=result.Ca;
+          Cb=result.Cb;
+          Ea=result.Ea;
+          Eb=result.Eb;
+        } else if(load.size()) {
+          printf("Guess orbitals from checkpoint\n");
+
+          // Load checkpoint
+          Checkpoint loadchk(load,false);
+          // Old basis set
+          diatomic::basis::TwoDBasis oldbasis;
+          loadchk.read(oldbasis);
+
+          // Large matrices are only used read-only, so they don't need to be copied
+          const arma::mat oldSinvh(loadchk.map("Sinvh"));
+
+          // Interbasis overlap
+          arma::mat S12(basis.overlap(oldbasis));
+
+          switch(iguess) {
+          case(0):
+            printf("Guess orbitals from Fock matrix projection\n");
+    	{
+    	  // Convert to orthonormal basis
+    	  S12=arma::trans(Sinvh)*S12*oldSinvh;
+    	  // Helper
+    	  arma::mat SSinvh(S*Sinvh);
+
+    	  // Fock matrix
+    	  arma::mat F;
+
+    	  // Load Fock matrix and project onto the old orthogonal basis
+    	  F=arma::trans(oldSinvh)*loadchk.map("Fa")*oldSinvh;
+    	  // Project onto the new basis
+    	  F=S12*F*arma::trans(S12);
+    	  // Go back to original basis
+    	  F=SSinvh*F*arma::trans(SSinvh);
+    	  // Diagonalize
+    	  if(symm)
+    	    scf::eig_gsym_sub(Ea,Ca,F,Sinvh,dsym);
+    	  else
+    	    scf::eig_gsym(Ea,Ca,F,Sinvh);
+
+    	  // Load Fock matrix and project onto the old orthogonal basis
+    	  F=arma::trans(oldSinvh)*loadchk.map("Fb")*oldSinvh;
+    	  // Project onto the new basis
+    	  F=S12*F*arma::trans(S12);
+    	  // Go back to original basis
+    	  F=SSinvh*F*arma::trans(SSinvh);
+    	  // Diagonalize
+    	  if(symm)
+    	    scf::eig_gsym_sub(Eb,Cb,F,Sinvh,dsym);
+    	  else
+    	    scf::eig_gsym(Eb,Cb,F,Sinvh);
+    	}
+            break;
+
+          case(1):
+          default:
+            // Project lowest orbitals
+            printf("Guess orbitals from previous calculation\n");
+          {
+            // Projector
+            arma::mat P((Sinvh*arma::trans(Sinvh))*S12);
+
+            // Alpha orbitals; project onto new basis: C1 = S11^-1 S12 C2.
+            // The orbitals come with their energies, and virtuals that
+            // were not stored are recomputed
+            arma::mat Cold;
+            loadchk.read_orbitals("a",Cold,Ea);
+            Ca=P*Cold;
+
+            // Beta orbitals
+            loadchk.read_orbitals("b",Cold,Eb);
+            Cb=P*Cold;
+
+            // Run Gram-Schmidt to make sure orbitals are orthonormal
+            for(int ia=0;ia<nela;ia++) {
+              for(int ja=0;ja<ia;ja++)
+                Ca.col(ia)-= Ca.col(ja)*(arma::trans(Ca.col(ja))*S*Ca.col(ia));
+              Ca.col(ia) /= sqrt(arma::as_scalar(arma::trans(Ca.col(ia))*S*Ca.col(ia)));
+            }
+
+            for(int ib=0;ib<nelb;ib++) {
+              for(int jb=0;jb<ib;jb++)
+                Cb.col(ib) -= Cb.col(jb)*(arma::trans(Cb.col(jb))*S*Cb.col(ib));
+              Cb.col(ib) /= sqrt(arma::as_scalar(arma::trans(Cb.col(ib))*S*Cb.col(ib)));
+            }
+          }
+          break;
+          }
+        } else {
+          switch(iguess) {
+          case(0):
+            printf("Guess orbitals from core Hamiltonian\n");
+            break;
+          case(1):
+            printf("Guess orbitals from GSZ screened nucleus\n");
+            break;
+          case(2):
+            printf("Guess orbitals from SAP screened nucleus\n");
+            break;
+          case(3):
+            printf("Guess orbitals from Thomas-Fermi nucleus\n");
+            break;
+          default:
+            throw std::logic_error("Unsupported guess\n");
+          }
+          arma::mat Hguess(T+Vel+Vmag+setup.matrices.get(guess_entry(iguess)));
+
+          // Diagonalize
+          if(symm)
+            scf::eig_gsym_sub(Ea,Ca,Hguess,Sinvh,dsym);
+          else
+            scf::eig_gsym(Ea,Ca,Hguess,Sinvh);
+
+          // Beta guess is the same as the alpha guess
+          Cb=Ca;
+          Eb=Ea;
+
+          // Enforce occupation according to specified symmetry
+          if(readocc) {
+    	scf::enforce_occupations(Ca,Ea,S,occnuma,occsym);
+    	if(restr && nela==nelb)
+    	  Cb=Ca;
+    	else
+    	  scf::enforce_occupations(Cb,Eb,S,occnumb,occsym);
+          }
+        }
+
+        // Perturb guess
+        if(perturb && !resuming) {
+          // Generate norb x norb rotation matrix
+          arma::arma_rng::set_seed(seed);
+          Ca*=scf::perturbation_matrix(Ca.n_cols,perturb);
+          if(restr && nela==nelb) {
+            Cb=Ca;
+          } else {
+            Cb*=scf::perturbation_matrix(Cb.n_cols,perturb);
+          }
+          printf("Guess orbitals perturbed by %e\n",perturb);
+        }
+
+        // Alpha orbitals
+        Caocc=Ca.cols(0,nela-1);
+        if(Ca.n_cols>(size_t) nela)
+          Cavirt=Ca.cols(nela,Ca.n_cols-1);
+
+        // Beta guess
+        if(nelb)
+          Cbocc=Cb.cols(0,nelb-1);
+        if(Cb.n_cols>(size_t) nelb)
+          Cbvirt=Cb.cols(nelb,Cb.n_cols-1);
+
+        Ea.subvec(0,nena-1).t().print("Alpha orbital energies");
+        Eb.subvec(0,nenb-1).t().print("Beta  orbital energies");
+
+        printf("\n");
+        printf("Alpha orbital symmetries\n");
+        classify_orbitals(Caocc,mvals,mposidx,mnegidx);
+        if(nelb>0) {
+          printf("\n");
+          printf("Beta orbital symmetries\n");
+          classify_orbitals(Cbocc,mvals,mposidx,mnegidx);
+        }
+        printf("\n");
+      }
+      pguess.close();
+      printf("Initial guess performed in %.6f\n",timer.get());
+
+      // The first Fock build needs the integrals
+      wait_tei();
+
+      double Ekin=0.0, Epot=0.0, Ecoul=0.0, Exx=0.0, Exc=0.0, Eefield=0.0, Emfield=0.0, Etot=0.0;
+      double Eold=resuming ? rstate.Etot : 0.0;
+
+      // The early iterations contract single-precision integrals
+      if(resuming ? rstate.tei_single : mixedthr>0.0)
+        basis.set_tei_single(true);
+      // Is a full Fock build needed on the next iteration? The
+      // previous densities are not in the snapshot
+      bool fullbuild=resuming;
+
+      // Second-order solver, used once DIIS stalls
+      scf::SOSCF soscf;
+      double diisbest=resuming ? rstate.diisbest : DBL_MAX;
+      int nstall=resuming ? rstate.nstall : 0;
+      double diiserr;
+
+      // Density matrices
+      arma::mat P, Pa, Pb;
+      // Densities and Coulomb and exchange matrices of the previous iteration
+      arma::mat Pold, Paold, Pbold, Jold, Kaold, Kbold;
+
+      // SCF data is written out in the background
+      CheckpointWriter chkwriter(chkpt);
+      chkwriter.set_final(chkpt_final);
+
+      for(int i=resuming ? rstate.iter+1 : 1;i<=maxit;i++) {
+        printf("\n**** Iteration %i ****\n\n",i);
+        {
+          std::ostringstream phase;
+          phase << "iteration " << i;
+          profiler::mark(phase.str());
+        }
+        profiler::Region pscf("SCF");
+        // Timings for the telemetry
+        double tJ=0.0, tK=0.0, txc=0.0, tdiis=0.0, tdiag=0.0;
+        double tio(chkwriter.caller_time()), tiobg(chkwriter.io_time());
+        bool diissolved=false;
+        // Write checkpoint on this iteration?
+        bool chkiter=(i%chkpt_every==0) || (i==maxit);
+        // Write auxiliary matrices as well?
+        bool chkfull=chkiter && !chkpt_minimal;
+
+        // Form density matrix
+        scf::form_density(Pa,Caocc,nela);
+        scf::form_density(Pb,Cbocc,nelb);
+        if(Pb.n_rows == 0)
+          Pb.zeros(Pa.n_rows,Pa.n_cols);
+        P=Pa+Pb;
+
+        if(chkfull) {
+          chkwriter.write("P",P);
+          chkwriter.write("Pa",Pa);
+          chkwriter.write("Pb",Pb);
+        }
+
+        printf("Tr Pa = %f\n",scf::trace_symm(Pa,S));
+        if(nelb)
+          printf("Tr Pb = %f\n",scf::trace_symm(Pb,S));
+        fflush(stdout);
+
+        // The one-electron energies are evaluated in one pass over P
+        {
+          arma::vec Eone(scf::trace_symm(P,{&T,&Vnuc,&Vel,&Vmag}));
+          Ekin=Eone(0);
+          Epot=Eone(1);
+          Eefield=Eone(2);
+          Emfield=Eone(3)-Bz/2.0*(nela-nelb);
+        }
+
+        // In an incremental build only the change of the density is
+        // contracted, and its negligible blocks are skipped. A full build
+        // is done every incfock iterations to stop the errors from piling up
+        bool incbuild=(incfock>0) && ((i-1)%incfock!=0) && !fullbuild;
+        fullbuild=false;
+        basis.set_screening(incbuild ? incthr : 0.0);
+        arma::mat dP(incbuild ? arma::mat(P-Pold) : P);
+        arma::mat dPa(incbuild ? arma::mat(Pa-Paold) : Pa);
+        arma::mat dPb(incbuild ? arma::mat(Pb-Pbold) : Pb);
+        if(incbuild)
+          printf("Incremental Fock build\n");
+
+        profiler::Region pfock("Fock");
+        // Form Coulomb matrix
+        timer.set();
+        arma::mat J(basis.coulomb(dP));
+        if(incbuild)
+          J+=Jold;
+        tJ=timer.get();
+        Ecoul=0.5*scf::trace_symm(P,J);
+        printf("Coulomb energy %.10e % .6f\n",Ecoul,tJ);
+        {
+          size_t nactive, ntot;
+          basis.get_coulomb_channels(nactive,ntot);
+          if(nactive<ntot)
+            printf("%i of %i (L,M) channels active in the Coulomb build\n",(int) nactive,(int) ntot);
+        }
+        fflush(stdout);
+        if(chkfull)
+          chkwriter.write("J",J);
+
+        // Form exchange matrix
+        timer.set();
+        arma::mat Ka, Kb;
+        if(kfrac!=0.0) {
+          if(nelb && !(restr && nela==nelb)) {
+            // Contract both spin densities in a single pass
+            std::vector<arma::mat> Pab(2);
+            Pab[0]=dPa;
+            Pab[1]=dPb;
+            std::vector<arma::mat> Kab(basis.exchange(Pab));
+            Ka=kfrac*Kab[0];
+            Kb=kfrac*Kab[1];
+          } else {
+            Ka=kfrac*basis.exchange(dPa);
+            if(nelb)
+              Kb=Ka;
+            else
+              Kb.zeros(Cbocc.n_rows,Cbocc.n_rows);
+          }
+          if(incbuild) {
+            Ka+=Kaold;
+            Kb+=Kbold;
+          }
+          tK=timer.get();
+          Exx=0.5*scf::trace_symm(Pa,Ka);
+          if(Kb.n_rows == Pb.n_rows && Kb.n_cols == Pb.n_cols)
+            Exx+=0.5*scf::trace_symm(Pb,Kb);
+          printf("Exchange energy %.10e % .6f\n",Exx,tK);
+        } else {
+          Exx=0.0;
+        }
+        fflush(stdout);
+
+        // Store for the next incremental build
+        Pold=P;
+        Paold=Pa;
+        Pbold=Pb;
+        Jold=J;
+        Kaold=Ka;
+        Kbold=Kb;
+
+        if(chkfull) {
+          chkwriter.write("Ka",Ka);
+          chkwriter.write("Kb",Kb);
+        }
+
+        // Exchange-correlation
+        Exc=0.0;
+        arma::mat XCa, XCb;
+        if(dft) {
+          timer.set();
+          double nelnum;
+          double ekin;
+          if(restr && nela==nelb) {
+            grid.eval_Fxc(x_func, xpars, c_func, cpars, P, XCa, Exc, nelnum, ekin, dftthr);
+            XCb=XCa;
+          } else {
+            grid.eval_Fxc(x_func, xpars, c_func, cpars, Pa, Pb, XCa, XCb, Exc, nelnum, ekin, nelb>0, dftthr);
+          }
+          txc=timer.get();
+          printf("DFT energy %.10e % .6f\n",Exc,txc);
+          printf("Error in integrated number of electrons % e\n",nelnum-nela-nelb);
+          if(ekin!=0.0)
+            printf("Error in integral of kinetic energy density % e\n",ekin-Ekin);
+        }
+        fflush(stdout);
+
+        if(chkfull) {
+          chkwriter.write("XCa",XCa);
+          chkwriter.write("XCb",XCb);
+        }
+
+        pfock.close();
+
+        // Fock matrices
+        arma::mat Fa(H0+J);
+        arma::mat Fb(H0+J);
+        if(Ka.n_rows == Fa.n_rows) {
+          Fa+=Ka;
+        }
+        if(Kb.n_rows == Fb.n_rows) {
+          Fb+=Kb;
+        }
+        if(dft) {
+          Fa+=XCa;
+          if(nelb>0) {
+            Fb+=XCb;
+          }
+        }
+        if(Bz!=0.0) {
+          // Add in the B*Sz term
+          Fa-=Bz*S/2.0;
+          Fb+=Bz*S/2.0;
+        }
+
+        // m averaging?
+        if(maverage) {
+          Fa=scf::fock_symmetry_average(Fa,mavg_idx);
+          Fb=scf::fock_symmetry_average(Fb,mavg_idx);
+        }
+        // Enforce symmetry of Fock matrix
+        if(symm) {
+          Fa=scf::enforce_fock_symmetry(Fa,dsym);
+          Fb=scf::enforce_fock_symmetry(Fb,dsym);
+        }
+
+        // ROHF update to Fock matrix
+        if(restr && nela!=nelb)
+          scf::ROHF_update(Fa,Fb,P,Sh,Sinvh,nela,nelb);
+
+        // The Fock matrices are checkpointed together with the
+        // orbitals, but DIIS extrapolates them before convergence is
+        // known, so keep the current ones
+        arma::mat Fa_chk(Fa), Fb_chk(Fb);
+
+        // Update energy
+        Etot=Ekin+Epot+Eefield+Emfield+Ecoul+Exx+Exc+Enucr+Enucfield;
+        double dE=Etot-Eold;
+
+        printf("Total energy is % .10f\n",Etot);
+        if(i>1)
+          printf("Energy changed by %e\n",dE);
+        Eold=Etot;
+        fflush(stdout);
+
+        // Update DIIS
+        timer.set();
+        diis.update(Fa,Fb,Pa,Pb,Etot,diiserr);
+        tdiis=timer.get();
+        printf("DIIS error is %e, update done in %.6f\n",diiserr,tdiis);
+        fflush(stdout);
+
+        // Has DIIS stalled? The second-order solver needs all the
+        // virtual orbitals, and a Fock matrix that does not go through
+        // the ROHF update
+        if(soscfstall>0 && !soscf.active() && i>=readocc && davidson<0 && !(restr && nela!=nelb)) {
+          if(diiserr<diisbest) {
+            diisbest=diiserr;
+            nstall=0;
+          } else if(++nstall>=soscfstall) {
+            printf("DIIS error has not improved in %i iterations, switching to the second-order solver\n",nstall);
+            soscf.reset(arma::join_rows(Caocc,Cavirt),arma::join_rows(Cbocc,Cbvirt),nela,nelb,restr && nela==nelb);
+          }
+        }
+
+        // Solve DIIS to get Fock update
+        if(!soscf.active()) {
+          timer.set();
+          diis.solve_F(Fa,Fb);
+          diissolved=true;
+          tdiis+=timer.get();
+          printf("DIIS solution done in %.6f\n",timer.get());
+          fflush(stdout);
+        }
+
+        // Have we converged? Note that DIIS error is still wrt full space, not active space.
+        bool convd=(diiserr<convthr) && (std::abs(dE)<convthr);
+        // Switch to double precision once the DIIS error is small
+        // enough; the calculation can't converge before that
+        if(basis.get_tei_single() && (diiserr<mixedthr || convd)) {
+          printf("Switching to double-precision integrals\n");
+          basis.set_tei_single(false);
+          fullbuild=true;
+          convd=false;
+        }
+
+        // Diagonalize Fock matrix to get new orbitals
+        timer.set();
+        profiler::Region pdiag("Diagonalization");
+        arma::mat Ca, Cb;
+        // The Davidson solver is warm-started from the current orbitals;
+        // the full solution is needed while the occupations are enforced
+        bool iterdiag=(davidson>=0) && (i>=readocc);
+        // The second-order solver rotates the orbitals directly; on
+        // convergence the Fock matrix is diagonalized for canonical orbitals
+        bool sostep=soscf.active() && !convd;
+        if(sostep) {
+          soscf.step(Fa,Fb,Etot,Ca,Ea,Cb,Eb);
+        } else if(iterdiag) {
+          size_t neig(nela+davidson);
+          if(symm)
+            scf::eig_davidson_sub(Ea,Ca,Fa,S,Sinvh,dsym,dcols,arma::join_rows(Caocc,Cavirt),neig,3*neig,maxit,davidsonthr);
+          else
+            scf::eig_davidson(Ea,Ca,Fa,S,Sinvh,arma::join_rows(Caocc,Cavirt),neig,3*neig,maxit,davidsonthr);
+        } else if(symm)
+          scf::eig_gsym_sub(Ea,Ca,Fa,Sinvh,dsym,dcols,dmirror);
+        else
+          scf::eig_gsym(Ea,Ca,Fa,Sinvh);
+        // Enforce occupation according to specified symmetry
+        if(i<readocc) {
+          scf::enforce_occupations(Ca,Ea,S,occnuma,occsym);
+        }
+
+        if(sostep) {
+          // The beta orbitals were rotated along with the alpha orbitals
+        } else if(restr && nela==nelb) {
+          Eb=Ea;
+          Cb=Ca;
+        } else if(iterdiag) {
+          size_t neig(std::max(nelb,1)+davidson);
+          if(symm)
+            scf::eig_davidson_sub(Eb,Cb,Fb,S,Sinvh,dsym,dcols,arma::join_rows(Cbocc,Cbvirt),neig,3*neig,maxit,davidsonthr);
+          else
+            scf::eig_davidson(Eb,Cb,Fb,S,Sinvh,arma::join_rows(Cbocc,Cbvirt),neig,3*neig,maxit,davidsonthr);
+        } else {
+          if(symm)
+            scf::eig_gsym_sub(Eb,Cb,Fb,Sinvh,dsym,dcols,dmirror);
+          else
+            scf::eig_gsym(Eb,Cb,Fb,Sinvh);
+        }
+        // Enforce occupation according to specified symmetry
+        if(i<readocc) {
+          scf::enforce_occupations(Cb,Eb,S,occnumb,occsym);
+        }
+
+        pdiag.close();
+
+        // The orbitals are always saved on convergence. Restarts only
+        // need the occupied ones, and the missing virtuals are
+        // recomputed by Checkpoint::read_orbitals
+        if(chkiter || convd) {
+          const int nvirt(convd ? chkpt_virtuals_final : chkpt_virtuals);
+          chkwriter.write("Ca",scf::lowest_orbitals(Ca,nela,nvirt));
+          chkwriter.write("Cb",scf::lowest_orbitals(Cb,nelb,nvirt));
+          chkwriter.write("Ea",scf::lowest_orbitals(Ea,nela,nvirt));
+          chkwriter.write("Eb",scf::lowest_orbitals(Eb,nelb,nvirt));
+          chkwriter.write("Fa",std::move(Fa_chk));
+          chkwriter.write("Fb",std::move(Fb_chk));
+        }
+
+        Caocc=Ca.cols(0,nela-1);
+        if(Ca.n_cols>(size_t) nela)
+          Cavirt=Ca.cols(nela,Ca.n_cols-1);
+        if(nelb>0)
+          Cbocc=Cb.cols(0,nelb-1);
+        if(Cb.n_cols>(size_t) nelb)
+          Cbvirt=Cb.cols(nelb,Cb.n_cols-1);
+        tdiag=timer.get();
+        if(sostep)
+          printf("Second-order orbital update done in %.6f\n",timer.get());
+        else if(iterdiag)
+          printf("Davidson diagonalization done in %.6f\n",timer.get());
+        else if(symm)
+          printf("Subspace diagonalization done in %.6f\n",timer.get());
+        else
+          printf("Full diagonalization done in %.6f\n",timer.get());
+
+        if(Ea.n_elem>(size_t)nela)
+          printf("Alpha HOMO-LUMO gap is % .3f eV\n",(Ea(nela)-Ea(nela-1))*HARTREEINEV);
+        if(nelb && Eb.n_elem>(size_t)nelb)
+          printf("Beta  HOMO-LUMO gap is % .3f eV\n",(Eb(nelb)-Eb(nelb-1))*HARTREEINEV);
+        fflush(stdout);
+
+        printf("\n");
+        printf("Alpha orbital symmetries\n");
+        classify_orbitals(Caocc,mvals,mposidx,mnegidx);
+        if(nelb>0) {
+          printf("\n");
+          printf("Beta orbital symmetries\n");
+          classify_orbitals(Cbocc,mvals,mposidx,mnegidx);
+        }
+        printf("\n");
+
+        if(telemetry::enabled()) {
+          telemetry::Record rec("diatomic");
+          rec.add("iteration",i);
+          rec.add("energy",Etot);
+          rec.add("dE",dE);
+          rec.add("diis_error",diiserr);
+          if(diissolved) {
+            rec.add("diis_weights",diis.get_last_weights());
+            rec.add("diis_fraction",diis.get_last_diis_fraction());
+          }
+          rec.add("solver",sostep ? "soscf" : (iterdiag ? "davidson" : "diag"));
+          rec.add("incremental",incbuild);
+          rec.add("converged",convd);
+          rec.add("t_J",tJ);
+          rec.add("t_K",tK);
+          rec.add("t_XC",txc);
+          rec.add("t_diag",tdiag);
+          rec.add("t_DIIS",tdiis);
+          rec.add("t_IO",chkwriter.caller_time()-tio);
+          rec.add("t_IO_background",chkwriter.io_time()-tiobg);
+          rec.write();
+        }
+
+        // The snapshot is written synchronously, so that it is complete
+        // when the job is preempted
+        if(resume.size() && !convd && i%resume_every==0) {
+          timer.set();
+          rstate.iter=i;
+          rstate.Etot=Etot;
+          rstate.diisbest=diisbest;
+          rstate.nstall=nstall;
+          rstate.tei_single=basis.get_tei_single();
+          rstate.Ca=arma::join_rows(Caocc,Cavirt);
+          rstate.Cb=arma::join_rows(Cbocc,Cbvirt);
+          rstate.Ea=Ea;
+          rstate.Eb=Eb;
+          scf::write_resume(resume,rstate,diis,nela,nelb);
+          printf("Resumable snapshot written in %.6f\n",timer.get());
+          fflush(stdout);
+        }
+
+        result.converged=convd;
+        if(convd)
+          break;
+      }
+      // A calculation that has run to the end is not resumed
+      if(resume.size() && mpi::master())
+        std::remove(resume.c_str());
+      if(result.converged)
+        chkwriter.write_final();
+      chkwriter.wait();
+      profiler::mark("post-SCF");
+      basis.set_tei_single(false);
+
+      // Store the results
+      result.Etot=Etot;
+      result.Ea=Ea;
+      result.Eb=Eb;
+      result.Ca=arma::join_rows(Caocc,Cavirt);
+      result.Cb=arma::join_rows(Cbocc,Cbvirt);
+      result.Pa=Pa;
+      result.Pb=Pb;
+      result.eldip=-scf::trace_symm(dip,P);
+      result.elquad=-scf::trace_symm(quad,P);
+
+      printf("%-21s energy: % .16f\n","Kinetic",Ekin);
+      printf("%-21s energy: % .16f\n","Nuclear attraction",Epot);
+      printf("%-21s energy: % .16f\n","Nuclear repulsion",Enucr);
+      printf("%-21s energy: % .16f\n","Coulomb",Ecoul);
+      printf("%-21s energy: % .16f\n","Exact exchange",Exx);
+      printf("%-21s energy: % .16f\n","Exchange-correlation",Exc);
+      printf("%-21s energy: % .16f\n","Electric field",Eefield);
+      printf("%-21s energy: % .16f\n","Magnetic field",Emfield);
+      printf("%-21s energy: % .16f\n","Nucleus-field",Enucfield);
+      printf("%-21s energy: % .16f\n","Total",Etot);
+      printf("%-21s energy: % .16f\n","Virial ratio",-Etot/Ekin);
+
+      printf("%-21s  force: %e\n", "Hellmann-Feynman", (2*Ekin+Epot+Enucr+Ecoul+Exx+Exc)/Rbond);
+
+      double eldip=-scf::trace_symm(dip,P);
+      double elquad=-scf::trace_symm(quad,P);
+
+      printf("\n");
+      printf("Electronic dipole     moment % .16e\n",eldip);
+      printf("Nuclear    dipole     moment % .16e\n",nucdip);
+      printf("Total      dipole     moment % .16e\n",eldip+nucdip);
+      printf("Electronic quadrupole moment % .16e\n",elquad);
+      printf("Nuclear    quadrupole moment % .16e\n",nucquad);
+      printf("Total      quadrupole moment % .16e\n",elquad+nucquad);
+
+      if(polarizability) {
+        // Static dipole polarizability from the coupled-perturbed
+        // equations, solved with preconditioned conjugate gradients
+        profiler::Region presp("Response");
+        Timer tresp;
+        if(restr && nela!=nelb)
+          throw std::logic_error("The response equations are not implemented for restricted open-shell references.\n");
+        if(result.Ca.n_cols != Sinvh.n_cols || result.Cb.n_cols != Sinvh.n_cols)
+          throw std::logic_error("The response equations need all the orbitals; turn off the Davidson solver.\n");
+        // Closed-shell systems only need the alpha spin
+        bool same(restr && nela==nelb);
+        basis.set_screening(0.0);
+        if(dft)
+          grid.set_screening(false);
+
+        // Occupied and virtual orbitals
+        arma::mat Coa(result.Ca.cols(0,nela-1)), Cva(result.Ca.cols(nela,result.Ca.n_cols-1));
+        arma::mat Cob, Cvb(result.Cb.cols(nelb,result.Cb.n_cols-1));
+        if(nelb)
+          Cob=result.Cb.cols(0,nelb-1);
+        // Orbital energy differences
+        arma::mat Da(Cva.n_cols,Coa.n_cols), Db(Cvb.n_cols,Cob.n_cols);
+        for(size_t i=0;i<Da.n_cols;i++)
+          for(size_t a=0;a<Da.n_rows;a++)
+            Da(a,i)=result.Ea(nela+a)-result.Ea(i);
+        for(size_t i=0;i<Db.n_cols;i++)
+          for(size_t a=0;a<Db.n_rows;a++)
+            Db(a,i)=result.Eb(nelb+a)-result.Eb(i);
+
+        // Residuals for zero initial response, preconditioned residuals and search directions
+        arma::mat Ra(-Cva.t()*dip*Coa), Rb(-Cvb.t()*dip*Cob);
+        arma::mat Ua(arma::zeros<arma::mat>(Ra.n_rows,Ra.n_cols)), Ub(arma::zeros<arma::mat>(Rb.n_rows,Rb.n_cols));
+        arma::mat Za(Ra/Da), Zb(Rb/Db);
+        arma::mat Sa(Za), Sb(Zb);
+        double rz(arma::dot(Ra,Za)+(same ? 0.0 : arma::dot(Rb,Zb)));
+
+        int iresp;
+        double rnorm=0.0;
+        for(iresp=1;iresp<=maxit;iresp++) {
+          // Density change of the search direction
+          arma::mat P1a(Cva*Sa*Coa.t());
+          P1a+=arma::trans(P1a);
+          arma::mat P1b;
+          if(same) {
+            P1b=P1a;
+          } else {
+            P1b=Cvb*Sb*Cob.t();
+            P1b+=arma::trans(P1b);
+          }
+
+          // and the Fock matrix change it causes
+          arma::mat Ga(basis.coulomb(P1a+P1b));
+          arma::mat Gb(Ga);
+          if(kfrac!=0.0) {
+            arma::mat Ka(arma::zeros<arma::mat>(Ga.n_rows,Ga.n_cols)), Kb(arma::zeros<arma::mat>(Ga.n_rows,Ga.n_cols));
+            if(same) {
+            if(kfrac!=0.0)
+              Ka+=kfrac*basis.exchange(P1a);
+              Kb=Ka;
+            } else {
+              // Contract both spin densities in a single pass
+              std::vector<arma::mat> Pab(2);
+              Pab[0]=P1a;
+              Pab[1]=P1b;
+              if(kfrac!=0.0) {
+                std::vector<arma::mat> Kab(basis.exchange(Pab));
+                Ka+=kfrac*Kab[0];
+                Kb+=kfrac*Kab[1];
+              }
+            }
+            Ga+=Ka;
+            Gb+=Kb;
+          }
+          if(dft) {
+            // The exchange-correlation kernel is applied by central differences of the potential
+            double h(1e-4/std::max(1.0,arma::abs(P1a+P1b).max()));
+            double Exc0, nel0, ekin0;
+            arma::mat XCap, XCbp, XCam, XCbm;
+            if(same) {
+              grid.eval_Fxc(x_func, xpars, c_func, cpars, P+h*(P1a+P1b), XCap, Exc0, nel0, ekin0, dftthr);
+              grid.eval_Fxc(x_func, xpars, c_func, cpars, P-h*(P1a+P1b), XCam, Exc0, nel0, ekin0, dftthr);
+              XCbp=XCap;
+              XCbm=XCam;
+            } else {
+              grid.eval_Fxc(x_func, xpars, c_func, cpars, Pa+h*P1a, Pb+h*P1b, XCap, XCbp, Exc0, nel0, ekin0, nelb>0, dftthr);
+              grid.eval_Fxc(x_func, xpars, c_func, cpars, Pa-h*P1a, Pb-h*P1b, XCam, XCbm, Exc0, nel0, ekin0, nelb>0, dftthr);
+            }
+            Ga+=(XCap-XCam)/(2.0*h);
+            if(nelb)
+              Gb+=(XCbp-XCbm)/(2.0*h);
+          }
+
+          // Apply the orbital Hessian
+          arma::mat Aa(Da%Sa + Cva.t()*Ga*Coa);
+          arma::mat Ab;
+          if(!same)
+            Ab=Db%Sb + Cvb.t()*Gb*Cob;
+          double sAs(arma::dot(Sa,Aa)+(same ? 0.0 : arma::dot(Sb,Ab)));
+          double step(rz/sAs);
+
+          Ua+=step*Sa;
+          Ra-=step*Aa;
+          if(!same) {
+            Ub+=step*Sb;
+            Rb-=step*Ab;
+          }
+          rnorm=std::sqrt(arma::dot(Ra,Ra)+(same ? 0.0 : arma::dot(Rb,Rb)));
+          printf("Response iteration %3i: residual norm %e\n",iresp,rnorm);
+          fflush(stdout);
+          if(rnorm<respthr)
+            break;
+
+          // New search direction
+          Za=Ra/Da;
+          if(!same)
+            Zb=Rb/Db;
+          double rznew(arma::dot(Ra,Za)+(same ? 0.0 : arma::dot(Rb,Zb)));
+          Sa=Za+(rznew/rz)*Sa;
+          if(!same)
+            Sb=Zb+(rznew/rz)*Sb;
+          rz=rznew;
+        }
+        if(rnorm>=respthr)
+          printf("Warning - response equations did not converge in %i iterations!\n",maxit);
+
+        // First-order density
+        arma::mat P1a(Cva*Ua*Coa.t());
+        P1a+=arma::trans(P1a);
+        arma::mat P1b;
+        if(same) {
+          P1b=P1a;
+        } else {
+          P1b=Cvb*Ub*Cob.t();
+          P1b+=arma::trans(P1b);
+        }
+        result.alpha_zz=-scf::trace_symm(dip,arma::mat(P1a+P1b));
+        printf("\nStatic dipole polarizability alpha_zz % .16e\n",result.alpha_zz);
+        printf("Response equations solved in %.6f\n",tresp.get());
+      }
+
+      printf("\n");
+      printf("Nuclear electron densities\n");
+      arma::vec nucdena(basis.nuclear_density(Pa));
+      arma::vec nucdenb(basis.nuclear_density(Pb));
+      for(size_t i=0;i<nucdena.size();i++) {
+        int Z = (i==0) ? Z1 : Z2;
+        if(Z==0)
+          continue;
+        printf("%-2s: % .10e % .10e % .10e\n",element_symbols[Z].c_str(),nucdena(i),nucdenb(i),nucdena(i)+nucdenb(i));
+      }
+
+      // rms sizes
+      std::vector<arma::mat> orba, orbb;
+      for(int io=0;io<nela;io++)
+        orba.push_back(basis.radial_moments(Caocc.col(io)*arma::trans(Caocc.col(io))));
+      for(int io=0;io<nelb;io++)
+        orbb.push_back(basis.radial_moments(Cbocc.col(io)*arma::trans(Cbocc.col(io))));
+
+      for(int ic=0;ic<3;ic++) {
+        // Lh analysis only if lh atom exists
+        if(ic==0 && Z1==0)
+          continue;
+        // Middle analysis only if both atoms exist
+        if(ic==1 && (Z1==0 || Z2==0))
+          continue;
+        // Rh analysis only if rh atom exists
+        if(ic==2 && Z2==0)
+          continue;
+
+        if(ic==0)
+          printf("\nOccupied orbital analysis wrt left atom:\n");
+        else if(ic==1)
+          printf("\nOccupied orbital analysis wrt geometrical center:\n");
+        else
+          printf("\nOccupied orbital analysis wrt right atom:\n");
+
+        enum moment {mone,
+                     one,
+                     two,
+                     three};
+
+        if(ic==1) {
+          printf("Alpha orbitals\n");
+          printf("%2s %13s %12s\n","io","energy","sqrt(<r^2>)");
+          for(int io=0;io<nela;io++) {
+            printf("%2i % e %e\n",(int) io+1, Ea(io), sqrt(orba[io](two,ic)));
+          }
+          printf("Beta orbitals\n");
+          for(int io=0;io<nelb;io++) {
+            printf("%2i % e %e\n",(int) io+1, Eb(io), sqrt(orbb[io](two,ic)));
+          }
+        } else {
+          printf("Alpha orbitals\n");
+          printf("%2s %13s %12s %12s %12s %12s\n","io","energy","1/<r^-1>","<r>","sqrt(<r^2>)","cbrt(<r^3>)");
+          for(int io=0;io<nela;io++) {
+            printf("%2i % e %e %e %e %e\n",(int) io+1, Ea(io), 1.0/orba[io](mone,ic), orba[io](one,ic), sqrt(orba[io](two,ic)), cbrt(orba[io](three,ic)));
+          }
+          printf("Beta orbitals\n");
+          for(int io=0;io<nelb;io++) {
+            printf("%2i % e %e %e %e %e\n",(int) io+1, Eb(io), 1.0/orbb[io](mone,ic), orbb[io](one,ic), sqrt(orbb[io](two,ic)), cbrt(orbb[io](three,ic)));
+          }
+        }
+      }
+
+      /*
+      // Test orthonormality
+      arma::mat Smo(Ca.t()*S*Ca);
+      Smo-=arma::eye<arma::mat>(Smo.n_rows,Smo.n_cols);
+      printf("Alpha orthonormality deviation is %e\n",arma::norm(Smo,"fro"));
+      Smo=(Cb.t()*S*Cb);
+      Smo-=arma::eye<arma::mat>(Smo.n_rows,Smo.n_cols);
+      printf("Beta orthonormality deviation is %e\n",arma::norm(Smo,"fro"));
+      */
+
+      return Etot;
+    }
+
+    const scf_result_t & Driver::get_result() const {
+      return result;
+    }
+
+    void Driver::set_result(const scf_result_t & res) {
+      result=res;
+    }
+
+    const basis::TwoDBasis & Driver::get_basis() const {
+      return setup.basis;
+    }
+
+    const arma::mat & Driver::get_overlap() const {
+      return setup.matrices.get("S");
+    }
+  }
+}
@@ -14,69 +14,65 @@
  * of the License, or (at your option) any later version.
  */
 #include "quadrature.h"
+#include "FiniteElementBasis.h"
 #include "chebyshev.h"
 
 namespace helfem {
   namespace diatomic {
     namespace quadrature {
-      static arma::vec twoe_inner_integral_wrk(double mumin, double mumax, double mumin0, double mumax0, int l, const arma::vec & x, const arma::vec & wx, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, int L, int M, const legendretable::LegendreTable & tab) {
+      arma::mat twoe_inner_integral(double mumin, double mumax, int l, const arma::vec & x, const arma::vec & wx, const arma::mat & sbf, int L, int M, const legendretable::LegendreTable & tab) {
+        const size_t Nq(x.n_elem);
+        const size_t Nbf(sbf.n_cols);
         // Midpoint is at
         double mumid(0.5*(mumax+mumin));
         // and half-length of interval is
         double mulen(0.5*(mumax-mumin));
-        // mu values are then
-        arma::vec mu(mumid*arma::ones<arma::vec>(x.n_elem)+mulen*x);
-        arma::vec chmu(arma::cosh(mu));
-
-        // Midpoint of original interval is at
-        double mumid0(0.5*(mumax0+mumin0));
-        // and half-length of original interval is
-        double mulen0(0.5*(mumax0-mumin0));
-
-        // Calculate total weight per point
-        arma::vec wp(wx*mulen);
-        wp%=arma::sinh(mu);
+        // r values are then
+        arma::vec mu(mumid*arma::ones<arma::vec>(Nq)+mulen*x);
+
+        // mu values at the subinterval points
+        arma::vec musub(mumid*arma::ones<arma::vec>(Nq*Nq)+mulen*polynomial_basis::FiniteElementBasis::subinterval_points(x));
+        arma::vec chsub(arma::cosh(musub));
+        // Weight excluding the quadrature weight; the Legendre
+        // function is evaluated for all subintervals at once
+        arma::vec wsub(arma::sinh(musub));
         if(l!=0)
           // cosh term
-          wp%=arma::pow(chmu,l);
-        // Legendre polynomial
-        wp%=tab.get_Plm(L,M,chmu);
-
-        // Calculate x values the polynomials should be evaluated at
-        arma::vec xpoly((mu-mumid0*arma::ones<arma::vec>(x.n_elem))/mulen0);
-        // Evaluate the polynomials at these points
-        arma::mat bf(poly->eval_dnf(xpoly, 0, mulen0));
+          wsub%=arma::pow(chsub,l);
+        wsub%=tab.get_Plm(L,M,chsub);
 
-        // Put in weight
-        arma::mat wbf(bf);
-        for(size_t i=0;i<wbf.n_cols;i++)
-          wbf.col(i)%=wp;
-
-        // The integrals are then
-        arma::vec inner(arma::vectorise(arma::trans(wbf)*bf));
+        // Compute the "inner" integrals as function of r.
+        arma::mat inner(Nq,Nbf*Nbf);
+        // Every subinterval uses a fresh nquad points!
+        for(size_t ip=0;ip<Nq;ip++) {
+          double slo(ip ? mu(ip-1) : mumin);
+          double slen(0.5*(mu(ip)-slo));
+
+          // Calculate total weight per point
+          arma::vec wp(wx*slen);
+          wp%=wsub.subvec(ip*Nq,(ip+1)*Nq-1);
+
+          // Put in weight
+          const arma::mat ssub(sbf.rows(ip*Nq,(ip+1)*Nq-1));
+          arma::mat wbf(ssub);
+          for(size_t i=0;i<wbf.n_cols;i++)
+            wbf.col(i)%=wp;
+
+          inner.row(ip)=arma::trans(arma::vectorise(arma::trans(wbf)*ssub));
+          if(ip)
+            inner.row(ip)+=inner.row(ip-1);
+        }
 
         return inner;
       }
 
       arma::mat twoe_inner_integral(double mumin, double mumax, int l, const arma::vec & x, const arma::vec & wx, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, int L, int M, const legendretable::LegendreTable & tab) {
-        // Midpoint is at
-        double mumid(0.5*(mumax+mumin));
-        // and half-length of interval is
         double mulen(0.5*(mumax-mumin));
-        // r values are then
-        arma::vec mu(mumid*arma::ones<arma::vec>(x.n_elem)+mulen*x);
-
-        // Compute the "inner" integrals as function of r.
-        arma::mat inner(x.n_elem,std::pow(poly->get_nbf(),2));
-        inner.row(0)=arma::trans(twoe_inner_integral_wrk(mumin, mu(0), mumin, mumax, l, x, wx, poly, L, M, tab));
-        // Every subinterval uses a fresh nquad points!
-        for(size_t ip=1;ip<x.n_elem;ip++)
-          inner.row(ip)=inner.row(ip-1)+arma::trans(twoe_inner_integral_wrk(mu(ip-1), mu(ip), mumin, mumax, l, x, wx, poly, L, M, tab));
-
-        return inner;
+        arma::mat sbf(poly->eval_dnf(polynomial_basis::FiniteElementBasis::subinterval_points(x), 0, mulen));
+        return twoe_inner_integral(mumin, mumax, l, x, wx, sbf, L, M, tab);
       }
 
-      static arma::mat twoe_integral_wrk(double mumin, double mumax, int k, int l, const arma::vec & x, const arma::vec & wx, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, int L, int M, const legendretable::LegendreTable & tab) {
+      static arma::mat twoe_integral_wrk(double mumin, double mumax, int k, int l, const arma::vec & x, const arma::vec & wx, const arma::mat & bf, const arma::mat & sbf, int L, int M, const legendretable::LegendreTable & tab) {
 #ifndef ARMA_NO_DEBUG
         if(x.n_elem != wx.n_elem) {
           std::ostringstream oss;
@@ -93,10 +89,7 @@ namespace helfem {
         arma::vec chmu(arma::cosh(mu));
 
         // Compute the inner integrals
-        arma::mat inner(twoe_inner_integral(mumin, mumax, l, x, wx, poly, L, M, tab));
-
-        // Evaluate basis functions at quadrature points
-        arma::mat bf(poly->eval_dnf(x, 0, mulen));
+        arma::mat inner(twoe_inner_integral(mumin, mumax, l, x, wx, sbf, L, M, tab));
 
         // Product functions
         arma::mat bfprod(bf.n_rows,bf.n_cols*bf.n_cols);
@@ -120,7 +113,16 @@ namespace helfem {
       }
 
       arma::mat twoe_integral(double mumin, double mumax, int k, int l, const arma::vec & x, const arma::vec & wx, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, int L, int M, const legendretable::LegendreTable & tab) {
-        return twoe_integral_wrk(mumin,mumax,k,l,x,wx,poly,L,M,tab) + arma::trans(twoe_integral_wrk(mumin,mumax,l,k,x,wx,poly,L,M,tab));
+        double mulen(0.5*(mumax-mumin));
+        return twoe_integral(mumin, mumax, k, l, x, wx, poly->eval_dnf(x, 0, mulen), poly->eval_dnf(polynomial_basis::FiniteElementBasis::subinterval_points(x), 0, mulen), L, M, tab);
+      }
+
+      arma::mat twoe_integral(double mumin, double mumax, int k, int l, const arma::vec & x, const arma::vec & wx, const arma::mat & bf, const arma::mat & sbf, int L, int M, const legendretable::LegendreTable & tab) {
+        arma::mat ints(twoe_integral_wrk(mumin,mumax,k,l,x,wx,bf,sbf,L,M,tab));
+        // The mirrored term is the transpose for k=l
+        if(k==l)
+          return ints + arma::trans(ints);
+        return ints + arma::trans(twoe_integral_wrk(mumin,mumax,l,k,x,wx,bf,sbf,L,M,tab));
       }
     }
   }
@@ -29,6 +29,11 @@ namespace helfem {
        * \f$ \phi^{l,LM}(\mu) = \int_{0}^{\mu}d\mu'\cosh^{l}\mu'\sinh\mu'B_{\gamma}(\mu')B_{\delta}(\mu')P_{L,|M|}(\cosh\mu') \f$
        */
       arma::mat twoe_inner_integral(double mumin, double mumax, int l, const arma::vec & x, const arma::vec & wx, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, int L, int M, const legendretable::LegendreTable & tab);
+      /**
+       * Same as above, with the basis functions sbf tabulated at the
+       * subinterval points, see FiniteElementBasis::subinterval_points.
+       */
+      arma::mat twoe_inner_integral(double mumin, double mumax, int l, const arma::vec & x, const arma::vec & wx, const arma::mat & sbf, int L, int M, const legendretable::LegendreTable & tab);
 
       /**
        * Computes a primitive two-electron in-element integral.
@@ -36,6 +41,8 @@ namespace helfem {
        * Note that the routine needs the polynomial representation.
        */
       arma::mat twoe_integral(double rmin, double rmax, int k, int l, const arma::vec & x, const arma::vec & wx, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, int L, int M, const legendretable::LegendreTable & tab);
+      /// Same as above, with the basis functions bf tabulated at the quadrature points and sbf at the subinterval points
+      arma::mat twoe_integral(double rmin, double rmax, int k, int l, const arma::vec & x, const arma::vec & wx, const arma::mat & bf, const arma::mat & sbf, int L, int M, const legendretable::LegendreTable & tab);
     }
   }
 }
@@ -39,35 +39,43 @@ namespace helfem {
       }
 
       void TwoDGridWorker::compute_bf(size_t iel, size_t irad, int m_) {
+        // Only doing one radial quadrature point at a time is an easy
+        // way to save a lot of memory.
+        arma::uvec idx(1);
+        idx(0)=irad;
+        compute_bf(iel,idx,m_);
+      }
+
+      void TwoDGridWorker::compute_bf(size_t iel, int m_) {
+        compute_bf(iel,arma::regspace<arma::uvec>(0,basp->get_r(iel).n_elem-1),m_);
+      }
+
+      void TwoDGridWorker::compute_bf(size_t iel, const arma::uvec & irad, int m_) {
         // Store m
         m=m_;
         // Update function list
         bf_ind=basp->bf_list_dummy(iel,m);
+        basp->dummy_to_pure(bf_ind,bf_loc,bf_pure);
 
-        // Get radial weights. Only do one radial quadrature point at a
-        // time, since this is an easy way to save a lot of memory.
-        r.zeros(1);
-        r(0)=basp->get_r(iel)(irad);
-        wrad.zeros(1);
-        wrad(0)=basp->get_wrad(iel)(irad);
+        // Get radial points and weights
+        arma::vec rall(basp->get_r(iel));
+        arma::vec wall(basp->get_wrad(iel));
+        r=rall(irad);
+        wrad=arma::trans(wall(irad));
 
         double Rhalf(basp->get_Rhalf());
 
-        // Calculate helpers
-        arma::vec shmu(arma::sinh(r));
+        // Coordinates at the grid points, which run over the radial
+        // points within each angular point
+        arma::vec shmu_pt(arma::repmat(arma::sinh(r),cth.n_elem,1));
+        chmu_pt=arma::repmat(arma::cosh(r),cth.n_elem,1);
+        cth_pt=arma::kron(cth,arma::ones<arma::vec>(r.n_elem));
 
-        arma::vec sth(cth.n_elem);
-        for(size_t ia=0;ia<cth.n_elem;ia++)
-          sth(ia)=sqrt(1.0 - cth(ia)*cth(ia));
-
-        // Update total weights
-        wtot.zeros(wrad.n_elem*wang.n_elem);
-        for(size_t ia=0;ia<wang.n_elem;ia++)
-          for(size_t ir=0;ir<wrad.n_elem;ir++) {
-            size_t idx=ia*wrad.n_elem+ir;
-            // sin(th) is already contained within wang, but we don't want to divide by it since it may be zero. Phi integrals yield 2 pi
-            wtot(idx)=2.0*M_PI*wang(ia)*wrad(ir)*std::pow(Rhalf,3)*shmu(ir)*(std::pow(shmu(ir),2)+std::pow(sth(ia),2));
-          }
+        // Update total weights. sin(th) is already contained within
+        // wang, but we don't want to divide by it since it may be
+        // zero. Phi integrals yield 2 pi
+        arma::vec w(arma::kron(wang,arma::trans(wrad)));
+        wtot=arma::trans(2.0*M_PI*std::pow(Rhalf,3)*w%shmu_pt%(arma::square(shmu_pt)+1.0-arma::square(cth_pt)));
 
         // Compute basis function values
         bf.zeros(bf_ind.n_elem,wtot.n_elem);
@@ -77,7 +85,8 @@ namespace helfem {
 #endif
         for(size_t ia=0;ia<cth.n_elem;ia++) {
           // Evaluate basis functions at angular point
-          arma::mat abf(basp->eval_bf(iel, irad, cth(ia), m));
+          arma::mat abf(basp->eval_bf(iel, cth(ia), m));
+          abf=abf.rows(irad);
           if(abf.n_cols != bf_ind.n_elem) {
             std::ostringstream oss;
             oss << "Mismatch! Have " << bf_ind.n_elem << " basis function indices but " << abf.n_cols << " basis functions!\n";
@@ -88,25 +97,26 @@ namespace helfem {
         }
       }
 
-      void TwoDGridWorker::model_potential(const modelpotential::ModelPotential * p1, const modelpotential::ModelPotential * p2) {
+      arma::vec TwoDGridWorker::probe_distance(probe_t p) const {
         double Rhalf(basp->get_Rhalf());
-        arma::vec chmu(arma::cosh(r));
-
-        itg.zeros(1,wtot.n_elem);
-        for(size_t ia=0;ia<wang.n_elem;ia++)
-          for(size_t ir=0;ir<wrad.n_elem;ir++) {
-            size_t idx=ia*wrad.n_elem+ir;
-
-            double r1=Rhalf*(chmu(ir) + cth(ia));
-            double r2=Rhalf*(chmu(ir) - cth(ia));
-
-	    double V1(p1->V(r1));
-	    double V2(p2->V(r2));
-	    if(std::isnormal(V1))
-	      itg(idx)+=V1;
-	    if(std::isnormal(V2))
-	      itg(idx)+=V2;
-          }
+        if(p==PROBE_LEFT)
+          return Rhalf*(chmu_pt + cth_pt);
+        else if(p==PROBE_RIGHT)
+          return Rhalf*(chmu_pt - cth_pt);
+        else
+          return Rhalf*arma::sqrt(arma::square(chmu_pt) + arma::square(cth_pt) - 1.0);
+      }
+
+      void TwoDGridWorker::model_potential(const modelpotential::ModelPotential * p1, const modelpotential::ModelPotential * p2) {
+        // Evaluate the potentials in one batch
+        arma::vec V1, V2;
+        p1->V(probe_distance(PROBE_LEFT),V1);
+        p2->V(probe_distance(PROBE_RIGHT),V2);
+
+        // The potentials may be singular at the nuclei
+        V1.elem(arma::find_nonfinite(V1)).zeros();
+        V2.elem(arma::find_nonfinite(V2)).zeros();
+        itg=arma::trans(V1+V2);
       }
 
       void TwoDGridWorker::unit_pot() {
@@ -114,120 +124,43 @@ namespace helfem {
       }
 
       void TwoDGridWorker::multiply_Plm(int l, int m, probe_t p) {
-        arma::vec chmu(arma::cosh(r));
-        arma::vec shmu(arma::sinh(r));
-
-        if(p==PROBE_LEFT) {
-          for(size_t ia=0;ia<wang.n_elem;ia++)
-            for(size_t ir=0;ir<wrad.n_elem;ir++) {
-              size_t idx=ia*wrad.n_elem+ir;
-              double cthval = (1.0 + chmu(ir)*cth(ia))/(chmu(ir) + cth(ia));
-              double Plm = gsl_sf_legendre_sphPlm(l,std::abs(m),cthval);
-              for(size_t ix=0;ix<itg.n_rows;ix++)
-                itg(ix,idx)*=Plm;
-            }
-
-        } else if(p==PROBE_RIGHT) {
-          for(size_t ia=0;ia<wang.n_elem;ia++)
-            for(size_t ir=0;ir<wrad.n_elem;ir++) {
-              size_t idx=ia*wrad.n_elem+ir;
-              double cthval = (1.0 - chmu(ir)*cth(ia))/(chmu(ir) - cth(ia));
-              double Plm = gsl_sf_legendre_sphPlm(l,std::abs(m),cthval);
-              for(size_t ix=0;ix<itg.n_rows;ix++)
-                itg(ix,idx)*=Plm;
-            }
-
-        } else if(p==PROBE_MIDDLE) {
-          for(size_t ia=0;ia<wang.n_elem;ia++)
-            for(size_t ir=0;ir<wrad.n_elem;ir++) {
-              size_t idx=ia*wrad.n_elem+ir;
-              double cthval = cth(ia);
-              double Plm = gsl_sf_legendre_sphPlm(l,std::abs(m),cthval);
-              for(size_t ix=0;ix<itg.n_rows;ix++)
-                itg(ix,idx)*=Plm;
-            }
-        }
+        // cos(theta) seen from the probe center
+        arma::vec cthval;
+        if(p==PROBE_LEFT)
+          cthval = (1.0 + chmu_pt%cth_pt)/(chmu_pt + cth_pt);
+        else if(p==PROBE_RIGHT)
+          cthval = (1.0 - chmu_pt%cth_pt)/(chmu_pt - cth_pt);
+        else
+          cthval = cth_pt;
+
+        // Legendre polynomial at the grid points
+        arma::rowvec Plm(cthval.n_elem);
+        for(size_t idx=0;idx<cthval.n_elem;idx++)
+          Plm(idx) = gsl_sf_legendre_sphPlm(l,std::abs(m),cthval(idx));
+
+        itg.each_row() %= Plm;
       }
 
       void TwoDGridWorker::gto(int l, const arma::vec & expn, probe_t p) {
-        double Rhalf(basp->get_Rhalf());
-        arma::vec chmu(arma::cosh(r));
-
-        itg.zeros(expn.n_elem,wtot.n_elem);
-        if(p==PROBE_LEFT) {
-          for(size_t ia=0;ia<wang.n_elem;ia++)
-            for(size_t ir=0;ir<wrad.n_elem;ir++) {
-              size_t idx=ia*wrad.n_elem+ir;
-
-              double ra(Rhalf*(chmu(ir) + cth(ia)));
-              for(size_t ix=0;ix<expn.n_elem;ix++)
-                itg(ix,idx)=lcao::radial_GTO(ra,l,expn(ix));
-            }
-
-        } else if(p==PROBE_RIGHT) {
-          for(size_t ia=0;ia<wang.n_elem;ia++)
-            for(size_t ir=0;ir<wrad.n_elem;ir++) {
-              size_t idx=ia*wrad.n_elem+ir;
-
-              double rb(Rhalf*(chmu(ir) - cth(ia)));
-              for(size_t ix=0;ix<expn.n_elem;ix++)
-                itg(ix,idx)=lcao::radial_GTO(rb,l,expn(ix));
-            }
-
-        } else if(p==PROBE_MIDDLE) {
-          for(size_t ia=0;ia<wang.n_elem;ia++)
-            for(size_t ir=0;ir<wrad.n_elem;ir++) {
-              size_t idx=ia*wrad.n_elem+ir;
-
-              double rc(Rhalf*sqrt(std::pow(chmu(ir),2) + std::pow(cth(ia),2) -1.0));
-              for(size_t ix=0;ix<expn.n_elem;ix++)
-                itg(ix,idx)=lcao::radial_GTO(rc,l,expn(ix));
-            }
-        }
+        // All the exponents at once
+        itg=arma::trans(lcao::radial_GTO(probe_distance(p),l,expn));
       }
 
       void TwoDGridWorker::sto(int l, const arma::vec & expn, probe_t p) {
-        double Rhalf(basp->get_Rhalf());
-        arma::vec chmu(arma::cosh(r));
-
-        itg.zeros(expn.n_elem,wtot.n_elem);
-        if(p==PROBE_LEFT) {
-          for(size_t ia=0;ia<wang.n_elem;ia++)
-            for(size_t ir=0;ir<wrad.n_elem;ir++) {
-              size_t idx=ia*wrad.n_elem+ir;
-              double ra(Rhalf*(chmu(ir) + cth(ia)));
-              for(size_t ix=0;ix<expn.n_elem;ix++)
-                itg(ix,idx)=lcao::radial_STO(ra,l,expn(ix));
-            }
-
-        } else if(p==PROBE_RIGHT) {
-          for(size_t ia=0;ia<wang.n_elem;ia++)
-            for(size_t ir=0;ir<wrad.n_elem;ir++) {
-              size_t idx=ia*wrad.n_elem+ir;
-              double rb(Rhalf*(chmu(ir) - cth(ia)));
-              for(size_t ix=0;ix<expn.n_elem;ix++)
-                itg(ix,idx)=lcao::radial_STO(rb,l,expn(ix));
-            }
-
-        } else if(p==PROBE_MIDDLE) {
-          for(size_t ia=0;ia<wang.n_elem;ia++)
-            for(size_t ir=0;ir<wrad.n_elem;ir++) {
-              size_t idx=ia*wrad.n_elem+ir;
-              double rc(Rhalf*sqrt(std::pow(chmu(ir),2) + std::pow(cth(ia),2) -1.0));
-              for(size_t ix=0;ix<expn.n_elem;ix++)
-                itg(ix,idx)=lcao::radial_STO(rc,l,expn(ix));
-            }
-        }
+        // All the exponents at once
+        itg=arma::trans(lcao::radial_STO(probe_distance(p),l,expn));
       }
 
       void TwoDGridWorker::eval_pot(arma::mat & Vo) const {
         if(itg.n_rows != 1)
           throw std::logic_error("Should only have one column in integrand!\n");
-        Vo.submat(bf_ind,bf_ind)+=bf*arma::diagmat(itg%wtot)*arma::trans(bf);
+        arma::mat V(bf*arma::diagmat(itg%wtot)*arma::trans(bf));
+        Vo.submat(bf_pure,bf_pure)+=V.submat(bf_loc,bf_loc);
       }
 
       void TwoDGridWorker::eval_proj(arma::mat & Vo) const {
-        Vo.cols(bf_ind)+=itg*arma::diagmat(wtot)*arma::trans(bf);
+        arma::mat V(itg*arma::diagmat(wtot)*arma::trans(bf));
+        Vo.cols(bf_pure)+=V.cols(bf_loc);
       }
 
       void TwoDGridWorker::eval_proj_overlap(arma::mat & Vo) const {
@@ -245,126 +178,125 @@ namespace helfem {
 
       arma::mat TwoDGrid::model_potential(const modelpotential::ModelPotential * p1, const modelpotential::ModelPotential * p2) {
         arma::mat H;
-        H.zeros(basp->Ndummy(),basp->Ndummy());
+        H.zeros(basp->Nbf(),basp->Nbf());
 
         // Get unique m values in basis set
         arma::ivec muni(basp->get_mval());
         muni=muni(arma::find_unique(muni));
+        const size_t Nel(basp->get_rad_Nel());
+
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
         {
           TwoDGridWorker grid(basp,lang);
+          arma::mat Hth(arma::zeros<arma::mat>(H.n_rows,H.n_cols));
 
-          for(size_t im=0;im<muni.n_elem;im++) {
-            for(size_t iel=0;iel<basp->get_rad_Nel();iel++) {
-              for(size_t irad=0;irad<basp->get_r(iel).n_elem;irad++) {
-                grid.compute_bf(iel,irad,muni(im));
-                grid.model_potential(p1, p2);
-                grid.eval_pot(H);
-              }
-            }
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic,1)
+#endif
+          for(size_t iblock=0;iblock<muni.n_elem*Nel;iblock++) {
+            grid.compute_bf(iblock%Nel,muni(iblock/Nel));
+            grid.model_potential(p1, p2);
+            grid.eval_pot(Hth);
           }
-        }
 
-        H=basp->remove_boundaries(H);
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+          H+=Hth;
+        }
 
         return H;
       }
 
       arma::mat TwoDGrid::overlap() {
         arma::mat S;
-        S.zeros(basp->Ndummy(),basp->Ndummy());
+        S.zeros(basp->Nbf(),basp->Nbf());
 
         // Get unique m values in basis set
         arma::ivec muni(basp->get_mval());
         muni=muni(arma::find_unique(muni));
+        const size_t Nel(basp->get_rad_Nel());
+
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
         {
           TwoDGridWorker grid(basp,lang);
+          arma::mat Sth(arma::zeros<arma::mat>(S.n_rows,S.n_cols));
 
-          for(size_t im=0;im<muni.n_elem;im++) {
-            for(size_t iel=0;iel<basp->get_rad_Nel();iel++) {
-              for(size_t irad=0;irad<basp->get_r(iel).n_elem;irad++) {
-                grid.compute_bf(iel,irad,muni(im));
-                grid.unit_pot();
-                grid.eval_pot(S);
-              }
-            }
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic,1)
+#endif
+          for(size_t iblock=0;iblock<muni.n_elem*Nel;iblock++) {
+            grid.compute_bf(iblock%Nel,muni(iblock/Nel));
+            grid.unit_pot();
+            grid.eval_pot(Sth);
           }
-        }
 
-        S=basp->remove_boundaries(S);
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+          S+=Sth;
+        }
 
         return S;
       }
 
-      arma::mat TwoDGrid::gto_projection(int l, int m, const arma::vec & expn, probe_t p) {
+      arma::mat TwoDGrid::projection(int l, int m, const arma::vec & expn, probe_t p, bool sto, bool overlap) {
         arma::mat S;
-        S.zeros(expn.n_elem,basp->Ndummy());
-        TwoDGridWorker grid(basp,lang);
+        if(overlap)
+          S.zeros(expn.n_elem,expn.n_elem);
+        else
+          S.zeros(expn.n_elem,basp->Nbf());
 
-        for(size_t iel=0;iel<basp->get_rad_Nel();iel++) {
-          for(size_t irad=0;irad<basp->get_r(iel).n_elem;irad++) {
-            grid.compute_bf(iel,irad,m);
-            grid.gto(l, expn, p);
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+        {
+          TwoDGridWorker grid(basp,lang);
+          arma::mat Sth(arma::zeros<arma::mat>(S.n_rows,S.n_cols));
+
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic,1)
+#endif
+          for(size_t iel=0;iel<basp->get_rad_Nel();iel++) {
+            grid.compute_bf(iel,m);
+            if(sto)
+              grid.sto(l, expn, p);
+            else
+              grid.gto(l, expn, p);
             grid.multiply_Plm(l, m, p);
-            grid.eval_proj(S);
+            if(overlap)
+              grid.eval_proj_overlap(Sth);
+            else
+              grid.eval_proj(Sth);
           }
-        }
 
-        S=S.cols(basp->pure_indices());
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+          S+=Sth;
+        }
 
         return S;
       }
 
-      arma::mat TwoDGrid::gto_overlap(int l, int m, const arma::vec & expn, probe_t p) {
-        arma::mat S;
-        S.zeros(expn.n_elem,expn.n_elem);
-        TwoDGridWorker grid(basp,lang);
-
-        for(size_t iel=0;iel<basp->get_rad_Nel();iel++) {
-          for(size_t irad=0;irad<basp->get_r(iel).n_elem;irad++) {
-            grid.compute_bf(iel,irad,m);
-            grid.gto(l, expn, p);
-            grid.multiply_Plm(l, m, p);
-            grid.eval_proj_overlap(S);
-          }
-        }
+      arma::mat TwoDGrid::gto_projection(int l, int m, const arma::vec & expn, probe_t p) {
+        return projection(l,m,expn,p,false,false);
+      }
 
-        return S;
+      arma::mat TwoDGrid::gto_overlap(int l, int m, const arma::vec & expn, probe_t p) {
+        return projection(l,m,expn,p,false,true);
       }
 
       arma::mat TwoDGrid::sto_projection(int l, int m, const arma::vec & expn, probe_t p) {
-        arma::mat S;
-        S.zeros(expn.n_elem,basp->Ndummy());
-        TwoDGridWorker grid(basp,lang);
-
-        for(size_t iel=0;iel<basp->get_rad_Nel();iel++) {
-          for(size_t irad=0;irad<basp->get_r(iel).n_elem;irad++) {
-            grid.compute_bf(iel,irad,m);
-            grid.sto(l, expn, p);
-            grid.multiply_Plm(l, m, p);
-            grid.eval_proj(S);
-          }
-        }
-
-        S=S.cols(basp->pure_indices());
-
-        return S;
+        return projection(l,m,expn,p,true,false);
       }
 
       arma::mat TwoDGrid::sto_overlap(int l, int m, const arma::vec & expn, probe_t p) {
-        arma::mat S;
-        S.zeros(expn.n_elem,expn.n_elem);
-        TwoDGridWorker grid(basp,lang);
-
-        for(size_t iel=0;iel<basp->get_rad_Nel();iel++) {
-          for(size_t irad=0;irad<basp->get_r(iel).n_elem;irad++) {
-            grid.compute_bf(iel,irad,m);
-            grid.sto(l, expn, p);
-            grid.multiply_Plm(l, m, p);
-            grid.eval_proj_overlap(S);
-          }
-        }
-
-        return S;
+        return projection(l,m,expn,p,true,true);
       }
     }
   }
@@ -35,6 +35,11 @@ namespace helfem {
 
       /// Worker class
       class TwoDGridWorker {
+        /// Compute basis functions on the wanted radial points of the element
+        void compute_bf(size_t iel, const arma::uvec & irad, int m);
+        /// Compute distances of the grid points from the probe center
+        arma::vec probe_distance(probe_t p) const;
+
       protected:
         /// Basis set
         const helfem::diatomic::basis::TwoDBasis *basp;
@@ -47,11 +52,15 @@ namespace helfem {
         arma::rowvec wrad;
         /// Total quadrature weight
         arma::rowvec wtot;
+        /// cosh(mu) and cos(theta) at the grid points, Ngrid
+        arma::vec chmu_pt, cth_pt;
 
         /// Value of m
         int m;
         /// List of basis functions in element
         arma::uvec bf_ind;
+        /// Positions in bf_ind of the functions in the pure layout, and their pure indices
+        arma::uvec bf_loc, bf_pure;
         /// Values of important functions in grid points, Nbf * Ngrid
         arma::mat bf;
 
@@ -68,6 +77,8 @@ namespace helfem {
 
         /// Compute basis functions on grid points
         void compute_bf(size_t iel, size_t irad, int m);
+        /// Compute basis functions on all the grid points in the element
+        void compute_bf(size_t iel, int m);
         /// Free memory
         void free();
 
@@ -99,6 +110,9 @@ namespace helfem {
         /// Angular rule
         int lang;
 
+        /// Compute GTO or STO projection, or the projection's overlap
+        arma::mat projection(int l, int m, const arma::vec & expn, probe_t p, bool sto, bool overlap);
+
       public:
         /// Dummy constructor
         TwoDGrid();
@@ -0,0 +1,496 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#include "cmdline.h"
+#include "timer.h"
+#include "gaunt.h"
+#include "legendretable.h"
+#include "quadrature.h"
+#include "chebyshev.h"
+#include "utils.h"
+#include "PolynomialBasis.h"
+#include "FiniteElementBasis.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/**
+ * Micro-benchmarks of the computational kernels. Every case is run
+ * for a fixed number of repetitions after a warm-up; the number of
+ * kernel calls per repetition is calibrated once so that a
+ * repetition lasts at least the requested minimum time. All random
+ * input is generated from a fixed seed so that runs are comparable
+ * across builds, and the per-call timings are written out as JSON.
+ */
+
+using namespace helfem;
+
+/// Accumulated results to keep the compiler from eliding the kernels
+static volatile double sink;
+
+/// Parse a comma separated list of integers
+static std::vector<int> parse_list(const std::string & str) {
+  std::vector<int> ret;
+  std::istringstream iss(str);
+  std::string entry;
+  while(std::getline(iss,entry,',')) {
+    if(!entry.size())
+      continue;
+    std::istringstream ess(entry);
+    int val;
+    if(!(ess >> val)) {
+      std::ostringstream oss;
+      oss << "Could not parse \"" << entry << "\" as an integer!\n";
+      throw std::logic_error(oss.str());
+    }
+    ret.push_back(val);
+  }
+  return ret;
+}
+
+/// Name of the primitive basis
+static std::string basis_name(int primbas) {
+  switch(primbas) {
+  case(0):
+  case(1):
+  case(2):
+    return "bernstein";
+  case(3):
+    return "legendre";
+  case(4):
+    return "lip";
+  case(5):
+    return "hip";
+  default:
+    return "ghip";
+  }
+}
+
+/// Radial weight used in the matrix element benchmark
+static double r_squared(double r) {
+  return r*r;
+}
+
+/// A benchmark case
+class Benchmark {
+ protected:
+  /// Parameters of the case as (name, value) pairs
+  std::vector< std::pair<std::string, std::string> > params;
+  /// Add a parameter
+  void add_param(const std::string & name, int value) {
+    std::ostringstream oss;
+    oss << value;
+    params.push_back(std::make_pair(name,oss.str()));
+  }
+  void add_param(const std::string & name, const std::string & value) {
+    params.push_back(std::make_pair(name,"\""+value+"\""));
+  }
+
+ public:
+  /// Destructor
+  virtual ~Benchmark() {}
+  /// Name of the kernel
+  virtual std::string name() const=0;
+  /// Call the kernel once
+  virtual void run()=0;
+
+  /// Full label of the case
+  std::string label() const {
+    std::ostringstream oss;
+    oss << name();
+    for(size_t i=0;i<params.size();i++)
+      oss << (i ? "," : "/") << params[i].first << "=" << params[i].second;
+    std::string ret(oss.str());
+    ret.erase(std::remove(ret.begin(),ret.end(),'"'),ret.end());
+    return ret;
+  }
+  /// Parameters as a JSON object
+  std::string json_params() const {
+    std::ostringstream oss;
+    oss << "{";
+    for(size_t i=0;i<params.size();i++)
+      oss << (i ? ", " : "") << "\"" << params[i].first << "\": " << params[i].second;
+    oss << "}";
+    return oss.str();
+  }
+};
+
+/// PolynomialBasis::eval_dnf
+class EvalDnfBenchmark : public Benchmark {
+  std::shared_ptr<const polynomial_basis::PolynomialBasis> poly;
+  arma::vec x;
+  int nder;
+  arma::mat dnf;
+ public:
+  EvalDnfBenchmark(int primbas, int nnodes, int nquad, int nder_) : nder(nder_) {
+    poly=std::shared_ptr<const polynomial_basis::PolynomialBasis>(polynomial_basis::get_basis(primbas,nnodes));
+    arma::vec w;
+    chebyshev::chebyshev(nquad,x,w);
+    add_param("basis",basis_name(primbas));
+    add_param("primbas",primbas);
+    add_param("nnodes",nnodes);
+    add_param("nquad",nquad);
+    add_param("nder",nder);
+  }
+  std::string name() const { return "eval_dnf"; }
+  void run() {
+    poly->eval_dnf(x,dnf,nder,1.0);
+    sink+=dnf(0,0);
+  }
+};
+
+/// FiniteElementBasis::matrix_element
+class MatrixElementBenchmark : public Benchmark {
+  polynomial_basis::FiniteElementBasis fem;
+  arma::vec xq, wq;
+  int nder;
+ public:
+  MatrixElementBenchmark(int primbas, int nnodes, int nelem, int nquad, int nder_) : nder(nder_) {
+    std::shared_ptr<const polynomial_basis::PolynomialBasis> poly(polynomial_basis::get_basis(primbas,nnodes));
+    fem=polynomial_basis::FiniteElementBasis(poly,arma::linspace<arma::vec>(0.0,40.0,nelem+1),true,false,false,false);
+    chebyshev::chebyshev(nquad,xq,wq);
+    add_param("basis",basis_name(primbas));
+    add_param("primbas",primbas);
+    add_param("nnodes",nnodes);
+    add_param("nelem",nelem);
+    add_param("nquad",nquad);
+    add_param("nder",nder);
+  }
+  std::string name() const { return "matrix_element"; }
+  void run() {
+    arma::mat S(fem.matrix_element(nder,nder,xq,wq,r_squared));
+    sink+=S(0,0);
+  }
+};
+
+/// quadrature::twoe_integral
+class TwoeIntegralBenchmark : public Benchmark {
+  std::shared_ptr<const polynomial_basis::PolynomialBasis> poly;
+  arma::vec xq, wq;
+  int L;
+ public:
+  TwoeIntegralBenchmark(int primbas, int nnodes, int nquad, int L_) : L(L_) {
+    poly=std::shared_ptr<const polynomial_basis::PolynomialBasis>(polynomial_basis::get_basis(primbas,nnodes));
+    chebyshev::chebyshev(nquad,xq,wq);
+    add_param("basis",basis_name(primbas));
+    add_param("primbas",primbas);
+    add_param("nnodes",nnodes);
+    add_param("nquad",nquad);
+    add_param("L",L);
+  }
+  std::string name() const { return "twoe_integral"; }
+  void run() {
+    arma::mat tei(quadrature::twoe_integral(0.5,1.5,xq,wq,poly,L));
+    sink+=tei(0,0);
+  }
+};
+
+/// quadrature::erfc_integral, in-element case
+class ErfcIntegralBenchmark : public Benchmark {
+  arma::vec xi, wi, xk, wk;
+  arma::mat ibf, kbf;
+  double rmin, rmax;
+  int L;
+ public:
+  ErfcIntegralBenchmark(int primbas, int nnodes, int nquad, int L_) : L(L_) {
+    std::shared_ptr<const polynomial_basis::PolynomialBasis> poly(polynomial_basis::get_basis(primbas,nnodes));
+    polynomial_basis::FiniteElementBasis fem(poly,arma::linspace<arma::vec>(0.0,2.0,3),true,false,false,false);
+    chebyshev::chebyshev(nquad,xi,wi);
+    ibf=fem.eval_f(xi,1);
+    // The rh points are subdivided as in RadialBasis::erfc_integral
+    xk.zeros(nquad*nquad);
+    wk.zeros(nquad*nquad);
+    for(int ii=0;ii<nquad;ii++) {
+      double istart=ii*2.0/nquad-1.0;
+      double iend=(ii+1)*2.0/nquad-1.0;
+      xk.subvec(ii*nquad,(ii+1)*nquad-1)=0.5*(iend+istart)*arma::ones<arma::vec>(nquad)+xi*0.5*(iend-istart);
+      wk.subvec(ii*nquad,(ii+1)*nquad-1)=wi*0.5*(iend-istart);
+    }
+    kbf=fem.eval_f(xk,1);
+    rmin=fem.element_begin(1);
+    rmax=fem.element_end(1);
+    add_param("basis",basis_name(primbas));
+    add_param("primbas",primbas);
+    add_param("nnodes",nnodes);
+    add_param("nquad",nquad);
+    add_param("L",L);
+  }
+  std::string name() const { return "erfc_integral"; }
+  void run() {
+    arma::mat tei(quadrature::erfc_integral(rmin,rmax,ibf,xi,wi,rmin,rmax,kbf,xk,wk,L,0.4));
+    sink+=tei(0,0);
+  }
+};
+
+/// LegendreTable::compute on a fresh table
+class LegendreBenchmark : public Benchmark {
+  arma::vec xi;
+  int lmax, mmax;
+ public:
+  LegendreBenchmark(int lmax_, int npts) : lmax(lmax_), mmax(lmax_) {
+    xi=arma::linspace<arma::vec>(1.0,50.0,npts+1).subvec(1,npts);
+    add_param("lmax",lmax);
+    add_param("npts",npts);
+  }
+  std::string name() const { return "legendre_compute"; }
+  void run() {
+    legendretable::LegendreTable tab(lmax+2,lmax,mmax);
+    tab.compute(xi);
+    sink+=tab.get_Plm(0,0,xi(0));
+  }
+};
+
+/// Gaunt table construction
+class GauntBenchmark : public Benchmark {
+  int lmax;
+ public:
+  GauntBenchmark(int lmax_) : lmax(lmax_) {
+    add_param("lmax",lmax);
+  }
+  std::string name() const { return "gaunt"; }
+  void run() {
+    gaunt::Gaunt gnt(2*lmax,lmax,lmax);
+    sink+=gnt.coeff(0,0,0,0,0,0);
+  }
+};
+
+/// utils::exchange_tei
+class ExchangeTeiBenchmark : public Benchmark {
+  arma::mat tei;
+  size_t N;
+ public:
+  ExchangeTeiBenchmark(int N_) : N(N_) {
+    tei.randn(N*N,N*N);
+    add_param("nbf",N_);
+  }
+  std::string name() const { return "exchange_tei"; }
+  void run() {
+    arma::mat ktei(utils::exchange_tei(tei,N,N,N,N));
+    sink+=ktei(0,0);
+  }
+};
+
+/// utils::exchange_tei into storage that is reused between calls
+class ExchangeTeiIntoBenchmark : public Benchmark {
+  arma::mat tei, ktei;
+  size_t N;
+ public:
+  ExchangeTeiIntoBenchmark(int N_) : N(N_) {
+    tei.randn(N*N,N*N);
+    add_param("nbf",N_);
+  }
+  std::string name() const { return "exchange_tei_into"; }
+  void run() {
+    utils::exchange_tei(tei,N,N,N,N,ktei);
+    sink+=ktei(0,0);
+  }
+};
+
+/// The element-wise permutation loops exchange_tei used to run, for comparison
+class ExchangeTeiLoopBenchmark : public Benchmark {
+  arma::mat tei;
+  size_t N;
+ public:
+  ExchangeTeiLoopBenchmark(int N_) : N(N_) {
+    tei.randn(N*N,N*N);
+    add_param("nbf",N_);
+  }
+  std::string name() const { return "exchange_tei_loops"; }
+  void run() {
+    arma::mat ktei(N*N,N*N,arma::fill::zeros);
+    for(size_t ii=0;ii<N;ii++)
+      for(size_t jj=0;jj<N;jj++)
+        for(size_t kk=0;kk<N;kk++)
+          for(size_t ll=0;ll<N;ll++)
+            ktei(kk*N+jj,ll*N+ii)=tei(jj*N+ii,ll*N+kk);
+    sink+=ktei(0,0);
+  }
+};
+
+/// utils::product_tei into storage that is reused between calls
+class ProductTeiBenchmark : public Benchmark {
+  arma::mat big, small, tei;
+ public:
+  ProductTeiBenchmark(int N) {
+    big.randn(N,N);
+    small.randn(N,N);
+    add_param("nbf",N);
+  }
+  std::string name() const { return "product_tei"; }
+  void run() {
+    utils::product_tei(big,small,tei);
+    sink+=tei(0,0);
+  }
+};
+
+/// Statistics of a benchmark
+struct bench_result_t {
+  /// Label
+  std::string label;
+  /// Kernel
+  std::string name;
+  /// Parameters
+  std::string params;
+  /// Kernel calls per repetition
+  size_t ncalls;
+  /// Time per call in each repetition
+  arma::vec t;
+};
+
+/// Run a benchmark
+static bench_result_t measure(Benchmark & bench, int nrep, int nwarm, double mintime) {
+  bench_result_t res;
+  res.label=bench.label();
+  res.name=bench.name();
+  res.params=bench.json_params();
+
+  // Warm up caches and lazily initialized data
+  for(int i=0;i<nwarm;i++)
+    bench.run();
+
+  // Calibrate the number of calls per repetition
+  res.ncalls=1;
+  while(true) {
+    Timer t;
+    for(size_t i=0;i<res.ncalls;i++)
+      bench.run();
+    double dt(t.get());
+    if(dt>=mintime)
+      break;
+    size_t next(dt>0.0 ? (size_t) std::ceil(1.2*res.ncalls*mintime/dt) : 10*res.ncalls);
+    res.ncalls=std::max(next,2*res.ncalls);
+  }
+
+  res.t.zeros(nrep);
+  for(int irep=0;irep<nrep;irep++) {
+    Timer t;
+    for(size_t i=0;i<res.ncalls;i++)
+      bench.run();
+    res.t(irep)=t.get()/res.ncalls;
+  }
+
+  return res;
+}
+
+/// Write out the results
+static void write_json(const std::string & fname, const std::vector<bench_result_t> & results, int nrep, int nwarm, double mintime, int seed) {
+  FILE *out=fopen(fname.c_str(),"w");
+  if(!out) {
+    std::ostringstream oss;
+    oss << "Could not open " << fname << " for writing!\n";
+    throw std::logic_error(oss.str());
+  }
+
+  int nthreads=1;
+#ifdef _OPENMP
+  nthreads=omp_get_max_threads();
+#endif
+  Timer t;
+  fprintf(out,"{\n");
+  fprintf(out,"  \"context\": {\"date\": \"%s\", \"threads\": %i, \"repetitions\": %i, \"warmup\": %i, \"mintime\": %e, \"seed\": %i},\n",t.current_time().c_str(),nthreads,nrep,nwarm,mintime,seed);
+  fprintf(out,"  \"benchmarks\": [\n");
+  for(size_t i=0;i<results.size();i++) {
+    const bench_result_t & r(results[i]);
+    fprintf(out,"    {\"label\": \"%s\", \"name\": \"%s\", \"params\": %s, \"calls\": %i,\n",r.label.c_str(),r.name.c_str(),r.params.c_str(),(int) r.ncalls);
+    fprintf(out,"     \"min\": %.6e, \"median\": %.6e, \"mean\": %.6e, \"stddev\": %.6e, \"max\": %.6e,\n",arma::min(r.t),arma::median(r.t),arma::mean(r.t),r.t.n_elem>1 ? arma::stddev(r.t) : 0.0,arma::max(r.t));
+    fprintf(out,"     \"times\": [");
+    for(size_t j=0;j<r.t.n_elem;j++)
+      fprintf(out,"%s%.6e",j ? ", " : "",r.t(j));
+    fprintf(out,"]}%s\n",(i+1<results.size()) ? "," : "");
+  }
+  fprintf(out,"  ]\n}\n");
+  fclose(out);
+}
+
+int main(int argc, char **argv) {
+  cmdline::parser parser;
+  parser.add<std::string>("output", 0, "JSON file for the results", false, "helfem_bench.json");
+  parser.add<std::string>("filter", 0, "only run cases whose label contains this string", false, "");
+  parser.add<int>("repetitions", 0, "number of timed repetitions", false, 10);
+  parser.add<int>("warmup", 0, "number of untimed warm-up calls", false, 2);
+  parser.add<double>("mintime", 0, "minimum duration of a repetition in seconds", false, 0.05);
+  parser.add<int>("seed", 0, "seed for the random input", false, 1);
+  parser.add<std::string>("primbas", 0, "primitive basis types", false, "3,4,5");
+  parser.add<std::string>("nnodes", 0, "numbers of nodes", false, "5,10,15");
+  parser.add<int>("nelem", 0, "number of elements in matrix element benchmarks", false, 10);
+  parser.add<int>("L", 0, "angular momentum in the two-electron benchmarks", false, 2);
+  parser.add<std::string>("lmax", 0, "angular momenta for the Legendre and Gaunt benchmarks", false, "4,8,16");
+  parser.add<int>("nleg", 0, "number of points in the Legendre benchmarks", false, 1000);
+  parser.add<std::string>("nbf", 0, "element sizes in the exchange benchmarks", false, "5,10,15");
+  parser.parse_check(argc, argv);
+
+  std::string output(parser.get<std::string>("output"));
+  std::string filter(parser.get<std::string>("filter"));
+  int nrep(parser.get<int>("repetitions"));
+  int nwarm(parser.get<int>("warmup"));
+  double mintime(parser.get<double>("mintime"));
+  int seed(parser.get<int>("seed"));
+  std::vector<int> primbas(parse_list(parser.get<std::string>("primbas")));
+  std::vector<int> nnodes(parse_list(parser.get<std::string>("nnodes")));
+  int nelem(parser.get<int>("nelem"));
+  int L(parser.get<int>("L"));
+  std::vector<int> lmax(parse_list(parser.get<std::string>("lmax")));
+  int nleg(parser.get<int>("nleg"));
+  std::vector<int> nbf(parse_list(parser.get<std::string>("nbf")));
+
+  if(nrep<1)
+    throw std::logic_error("Need at least one repetition!\n");
+  arma::arma_rng::set_seed(seed);
+
+  std::vector< std::shared_ptr<Benchmark> > benchmarks;
+  for(size_t ip=0;ip<primbas.size();ip++)
+    for(size_t in=0;in<nnodes.size();in++) {
+      // Quadrature used in the basis set routines
+      int nquad(5*nnodes[in]);
+      for(int nder=0;nder<=2;nder++)
+        benchmarks.push_back(std::shared_ptr<Benchmark>(new EvalDnfBenchmark(primbas[ip],nnodes[in],nquad,nder)));
+      for(int nder=0;nder<=1;nder++)
+        benchmarks.push_back(std::shared_ptr<Benchmark>(new MatrixElementBenchmark(primbas[ip],nnodes[in],nelem,nquad,nder)));
+      benchmarks.push_back(std::shared_ptr<Benchmark>(new TwoeIntegralBenchmark(primbas[ip],nnodes[in],nquad,L)));
+      benchmarks.push_back(std::shared_ptr<Benchmark>(new ErfcIntegralBenchmark(primbas[ip],nnodes[in],nquad,L)));
+    }
+  for(size_t il=0;il<lmax.size();il++) {
+    benchmarks.push_back(std::shared_ptr<Benchmark>(new LegendreBenchmark(lmax[il],nleg)));
+    benchmarks.push_back(std::shared_ptr<Benchmark>(new GauntBenchmark(lmax[il])));
+  }
+  for(size_t in=0;in<nbf.size();in++) {
+    benchmarks.push_back(std::shared_ptr<Benchmark>(new ExchangeTeiBenchmark(nbf[in])));
+    benchmarks.push_back(std::shared_ptr<Benchmark>(new ExchangeTeiIntoBenchmark(nbf[in])));
+    benchmarks.push_back(std::shared_ptr<Benchmark>(new ExchangeTeiLoopBenchmark(nbf[in])));
+    benchmarks.push_back(std::shared_ptr<Benchmark>(new ProductTeiBenchmark(nbf[in])));
+  }
+
+  std::vector<bench_result_t> results;
+  for(size_t i=0;i<benchmarks.size();i++) {
+    std::string label(benchmarks[i]->label());
+    if(filter.size() && label.find(filter)==std::string::npos)
+      continue;
+    results.push_back(measure(*benchmarks[i],nrep,nwarm,mintime));
+    const arma::vec & t(results.back().t);
+    printf("%-60s median %.3e s min %.3e s stddev %.1f%%\n",label.c_str(),arma::median(t),arma::min(t),t.n_elem>1 ? 100.0*arma::stddev(t)/arma::mean(t) : 0.0);
+    fflush(stdout);
+  }
+
+  write_json(output,results,nrep,nwarm,mintime,seed);
+  printf("Results of %i benchmarks written to %s\n",(int) results.size(),output.c_str());
+
+  return 0;
+}
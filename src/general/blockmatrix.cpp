@@ -0,0 +1,209 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#include "blockmatrix.h"
+#include <sstream>
+#include <stdexcept>
+
+namespace helfem {
+  namespace blockmatrix {
+    block_idx_t block_idx(const std::vector<arma::uvec> & idx) {
+      if(!idx.size())
+        return block_idx_t();
+      return std::make_shared< const std::vector<arma::uvec> >(idx);
+    }
+
+    block_idx_t slice_idx(size_t N, size_t nblocks) {
+      std::vector<arma::uvec> idx(nblocks);
+      for(size_t i=0;i<nblocks;i++)
+        idx[i]=arma::regspace<arma::uvec>(i*N,(i+1)*N-1);
+      return block_idx(idx);
+    }
+
+    BlockMatrix::BlockMatrix() : N(0) {
+    }
+
+    BlockMatrix::BlockMatrix(const arma::mat & M, const block_idx_t & idx_) : N(M.n_rows), idx(idx_) {
+      if(M.n_rows != M.n_cols) {
+        std::ostringstream oss;
+        oss << "Block matrix must be square, got " << M.n_rows << " x " << M.n_cols << "!\n";
+        throw std::logic_error(oss.str());
+      }
+      if(!idx) {
+        blocks.push_back(M);
+        return;
+      }
+      blocks.resize(idx->size());
+      size_t ntot=0;
+      for(size_t i=0;i<idx->size();i++) {
+        blocks[i]=M((*idx)[i],(*idx)[i]);
+        ntot+=(*idx)[i].n_elem;
+      }
+      if(ntot != N) {
+        std::ostringstream oss;
+        oss << "Blocks cover " << ntot << " indices but the matrix has " << N << " rows!\n";
+        throw std::logic_error(oss.str());
+      }
+    }
+
+    BlockMatrix::BlockMatrix(const arma::cube & M, const block_idx_t & idx_) : N(M.n_rows*M.n_slices), idx(idx_) {
+      if(M.n_rows != M.n_cols) {
+        std::ostringstream oss;
+        oss << "Block matrix must be square, got " << M.n_rows << " x " << M.n_cols << " slices!\n";
+        throw std::logic_error(oss.str());
+      }
+      if(!idx || idx->size() != M.n_slices) {
+        std::ostringstream oss;
+        oss << "Cube has " << M.n_slices << " slices but " << (idx ? idx->size() : 0) << " blocks were given!\n";
+        throw std::logic_error(oss.str());
+      }
+      blocks.resize(M.n_slices);
+      for(size_t i=0;i<M.n_slices;i++) {
+        if((*idx)[i].n_elem != M.n_rows)
+          throw std::logic_error("Block sizes do not match the slices of the cube!\n");
+        blocks[i]=M.slice(i);
+      }
+    }
+
+    BlockMatrix::~BlockMatrix() {
+    }
+
+    void BlockMatrix::to_single() {
+      if(fblocks.size())
+        return;
+      fblocks.resize(blocks.size());
+      for(size_t i=0;i<blocks.size();i++)
+        fblocks[i]=arma::conv_to<arma::fmat>::from(blocks[i]);
+      blocks.clear();
+    }
+
+    bool BlockMatrix::is_single() const {
+      return fblocks.size()>0;
+    }
+
+    void BlockMatrix::check_shape(const BlockMatrix & rhs) const {
+      if(N != rhs.N || idx != rhs.idx)
+        throw std::logic_error("Block matrices have a different block structure!\n");
+    }
+
+    size_t BlockMatrix::n_rows() const {
+      return N;
+    }
+
+    size_t BlockMatrix::n_blocks() const {
+      return is_single() ? fblocks.size() : blocks.size();
+    }
+
+    arma::mat BlockMatrix::block(size_t iblk) const {
+      if(is_single())
+        return arma::conv_to<arma::mat>::from(fblocks[iblk]);
+      return blocks[iblk];
+    }
+
+    const arma::uvec & BlockMatrix::block_indices(size_t iblk) const {
+      return (*idx)[iblk];
+    }
+
+    size_t BlockMatrix::memory() const {
+      size_t n=0;
+      for(size_t i=0;i<blocks.size();i++)
+        n+=blocks[i].n_elem*sizeof(double);
+      for(size_t i=0;i<fblocks.size();i++)
+        n+=fblocks[i].n_elem*sizeof(float);
+      return n;
+    }
+
+    arma::mat BlockMatrix::dense() const {
+      arma::mat M(N,N,arma::fill::zeros);
+      add_to(M);
+      return M;
+    }
+
+    void BlockMatrix::add_to(arma::mat & M, double fac) const {
+      if(!idx) {
+        if(n_blocks())
+          M+=fac*block(0);
+        return;
+      }
+      for(size_t i=0;i<n_blocks();i++)
+        M((*idx)[i],(*idx)[i])+=fac*block(i);
+    }
+
+    void BlockMatrix::add_to(arma::cube & M, double fac) const {
+      if(M.n_slices != n_blocks())
+        throw std::logic_error("Number of slices does not match the number of blocks!\n");
+      for(size_t i=0;i<n_blocks();i++)
+        M.slice(i)+=fac*block(i);
+    }
+
+    double BlockMatrix::dot(const BlockMatrix & rhs) const {
+      check_shape(rhs);
+      double tr=0.0;
+      for(size_t i=0;i<n_blocks();i++)
+        tr+=arma::accu(block(i)%arma::trans(rhs.block(i)));
+      return tr;
+    }
+
+    BlockMatrix BlockMatrix::operator+(const BlockMatrix & rhs) const {
+      check_shape(rhs);
+      BlockMatrix ret(double_copy());
+      for(size_t i=0;i<ret.blocks.size();i++)
+        ret.blocks[i]+=rhs.block(i);
+      return ret;
+    }
+
+    BlockMatrix BlockMatrix::operator-(const BlockMatrix & rhs) const {
+      check_shape(rhs);
+      BlockMatrix ret(double_copy());
+      for(size_t i=0;i<ret.blocks.size();i++)
+        ret.blocks[i]-=rhs.block(i);
+      return ret;
+    }
+
+    BlockMatrix BlockMatrix::operator*(const BlockMatrix & rhs) const {
+      check_shape(rhs);
+      BlockMatrix ret(double_copy());
+      for(size_t i=0;i<ret.blocks.size();i++)
+        ret.blocks[i]=ret.blocks[i]*rhs.block(i);
+      return ret;
+    }
+
+    BlockMatrix BlockMatrix::operator*(double fac) const {
+      BlockMatrix ret(double_copy());
+      for(size_t i=0;i<ret.blocks.size();i++)
+        ret.blocks[i]*=fac;
+      return ret;
+    }
+
+    BlockMatrix BlockMatrix::t() const {
+      BlockMatrix ret(double_copy());
+      for(size_t i=0;i<ret.blocks.size();i++)
+        ret.blocks[i]=arma::trans(ret.blocks[i]);
+      return ret;
+    }
+
+    BlockMatrix BlockMatrix::double_copy() const {
+      if(!is_single())
+        return *this;
+      BlockMatrix ret;
+      ret.N=N;
+      ret.idx=idx;
+      ret.blocks.resize(fblocks.size());
+      for(size_t i=0;i<fblocks.size();i++)
+        ret.blocks[i]=block(i);
+      return ret;
+    }
+  }
+}
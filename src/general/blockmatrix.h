@@ -0,0 +1,103 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#ifndef BLOCKMATRIX_H
+#define BLOCKMATRIX_H
+
+#include <armadillo>
+#include <memory>
+#include <vector>
+
+namespace helfem {
+  namespace blockmatrix {
+    /// Index sets of the diagonal blocks
+    typedef std::shared_ptr< const std::vector<arma::uvec> > block_idx_t;
+
+    /// Form block index sets; an empty list gives a single dense block
+    block_idx_t block_idx(const std::vector<arma::uvec> & idx);
+    /// Form index sets of nblocks consecutive blocks of size N, one for every slice of a cube
+    block_idx_t slice_idx(size_t N, size_t nblocks);
+
+    /**
+     * Square matrix that is block diagonal in a symmetry, e.g. m in
+     * cylindrically symmetric systems. Only the diagonal blocks are
+     * stored; a matrix without index sets is stored densely. The
+     * blocks can be compressed to single precision, in which case
+     * they are converted back to double precision for arithmetic.
+     */
+    class BlockMatrix {
+      /// Number of rows and columns
+      size_t N;
+      /// Index sets of the blocks
+      block_idx_t idx;
+      /// Diagonal blocks
+      std::vector<arma::mat> blocks;
+      /// Diagonal blocks in single precision
+      std::vector<arma::fmat> fblocks;
+
+      /// Check that the matrices have the same block structure
+      void check_shape(const BlockMatrix & rhs) const;
+      /// Copy in double precision
+      BlockMatrix double_copy() const;
+
+    public:
+      /// Empty matrix
+      BlockMatrix();
+      /// Extract the diagonal blocks of M; elements outside the blocks are dropped
+      BlockMatrix(const arma::mat & M, const block_idx_t & idx);
+      /// Matrix whose diagonal blocks are the slices of M; idx must be the matching slice_idx
+      BlockMatrix(const arma::cube & M, const block_idx_t & idx);
+      /// Destructor
+      ~BlockMatrix();
+
+      /// Number of rows and columns
+      size_t n_rows() const;
+      /// Number of blocks
+      size_t n_blocks() const;
+      /// Get block
+      arma::mat block(size_t iblk) const;
+      /// Get indices of block
+      const arma::uvec & block_indices(size_t iblk) const;
+      /// Memory used by the blocks in bytes
+      size_t memory() const;
+      /// Store the blocks in single precision
+      void to_single();
+      /// Are the blocks stored in single precision?
+      bool is_single() const;
+
+      /// Form the dense matrix
+      arma::mat dense() const;
+      /// Increment the dense matrix M by fac times this matrix
+      void add_to(arma::mat & M, double fac=1.0) const;
+      /// Increment the slices of M by fac times the blocks of this matrix
+      void add_to(arma::cube & M, double fac=1.0) const;
+      /// Compute tr(this*rhs) without forming the product
+      double dot(const BlockMatrix & rhs) const;
+
+      /// Sum
+      BlockMatrix operator+(const BlockMatrix & rhs) const;
+      /// Difference
+      BlockMatrix operator-(const BlockMatrix & rhs) const;
+      /// Product
+      BlockMatrix operator*(const BlockMatrix & rhs) const;
+      /// Scaling
+      BlockMatrix operator*(double fac) const;
+      /// Transpose
+      BlockMatrix t() const;
+    };
+  }
+}
+
+#endif
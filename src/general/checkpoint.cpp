@@ -16,19 +16,68 @@
 
 #include "checkpoint.h"
 #include "PolynomialBasis.h"
+#include "utils.h"
+#include "matrixstore.h"
+#include "memtrack.h"
+#include "mpi_helpers.h"
+#include "profiler.h"
+#include "timer.h"
+#include <algorithm>
 #include <istream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 // Helper macros
 #define CHECK_OPEN() {if(!opend) {throw std::runtime_error("Cannot access checkpoint file that has not been opened!\n");}}
-#define CHECK_WRITE() {if(!writemode) {throw std::runtime_error("Cannot write to checkpoint file that was opened for reading only!\n");}}
+// Writes to a checkpoint without a file name are discarded
+#define CHECK_WRITE() {if(!writemode) {throw std::runtime_error("Cannot write to checkpoint file that was opened for reading only!\n");} if(filename.empty()) return;}
 #define CHECK_EXIST() {if(!exist(name)) { std::ostringstream oss; oss << "The entry " << name << " does not exist in the checkpoint file!\n"; throw std::runtime_error(oss.str()); } }
 
-Checkpoint::Checkpoint(const std::string & fname, bool writem, bool trunc) {
+#ifndef H5Z_FILTER_ZSTD
+/// Filter ID of zstd registered with the HDF Group, provided by a plugin
+#define H5Z_FILTER_ZSTD 32015
+#endif
+/// Target size of chunks of compressed entries in bytes
+#define CHUNK_SIZE (1<<20)
+
+/// Category of an entry for the compression settings
+static std::string entry_category(const std::string & name) {
+  // One-electron matrices
+  static const char * basis[] = {"S", "T", "Vnuc", "Vuc", "Sinvh", "Sh", "H0", "Vel", "Vmag", "dip", "quad"};
+  // SCF data, possibly with a numeric suffix in field scans
+  static const char * scf[] = {"P", "Pa", "Pb", "J", "Ka", "Kb", "XCa", "XCb", "Fa", "Fb", "Ca", "Cb", "Ea", "Eb"};
+
+  std::string base(name.substr(0,name.find('_')));
+  for(size_t i=0;i<sizeof(basis)/sizeof(basis[0]);i++)
+    if(name==basis[i])
+      return "basis";
+  for(size_t i=0;i<sizeof(scf)/sizeof(scf[0]);i++)
+    if(base==scf[i])
+      return "scf";
+  return "other";
+}
+
+/// Can the entry be recomputed from the basis set?
+static bool regenerable(const std::string & name) {
+  // Vuc is the name used for the nuclear attraction in atomic checkpoints
+  return name=="S" || name=="T" || name=="Vnuc" || name=="Vuc" || name=="Sinvh";
+}
+
+Checkpoint::Checkpoint(const std::string & fname, bool writem, bool trunc, bool allranks) {
   writemode=writem;
   filename=fname;
+  fullname=fname;
   opend=false;
-
-  if(writemode && (trunc || !file_exists(fname))) {
+  skip_regen=false;
+  inplace=false;
+  // Only the first MPI rank writes, the others hold the same data
+  if(writemode && !allranks && !helfem::mpi::master())
+    filename.clear();
+
+  if(writemode && filename.empty()) {
+    // Nothing is written
+  } else if(writemode && (trunc || !file_exists(fname))) {
     // Truncate existing file, using default creation and access properties.
     file=H5Fcreate(fname.c_str(),H5F_ACC_TRUNC,H5P_DEFAULT,H5P_DEFAULT);
     opend=true;
@@ -44,6 +93,8 @@ Checkpoint::Checkpoint(const std::string & fname, bool writem, bool trunc) {
 Checkpoint::~Checkpoint() {
   if(opend)
     close();
+  for(size_t i=0;i<maps.size();i++)
+    munmap(maps[i].first,maps[i].second);
 }
 
 void Checkpoint::open() {
@@ -97,6 +148,145 @@ bool Checkpoint::exist(const std::string & name) {
   return ret;
 }
 
+void Checkpoint::set_codec(const std::string & category, const std::string & codec) {
+  if(category!="basis" && category!="scf" && category!="other" && category!="all") {
+    std::ostringstream oss;
+    oss << "Unknown checkpoint entry category " << category << "!\n";
+    throw std::logic_error(oss.str());
+  }
+
+  chk_codec_t c;
+  c.filter=0;
+  c.level=0;
+  c.shuffle=false;
+
+  std::string spec(codec);
+  if(spec.compare(0,8,"shuffle+")==0) {
+    c.shuffle=true;
+    spec=spec.substr(8);
+  }
+  std::string filter(spec.substr(0,spec.find(':')));
+  if(filter!=spec) {
+    std::istringstream iss(spec.substr(filter.size()+1));
+    if(!(iss >> c.level) || c.level<0) {
+      std::ostringstream oss;
+      oss << "Invalid compression level in " << codec << "!\n";
+      throw std::logic_error(oss.str());
+    }
+  }
+
+  if(filter=="none") {
+    c.filter=0;
+    c.shuffle=false;
+  } else if(filter=="deflate") {
+    c.filter=1;
+    if(!c.level)
+      c.level=4;
+    c.level=std::min(c.level,9);
+    if(H5Zfilter_avail(H5Z_FILTER_DEFLATE)<=0)
+      throw std::runtime_error("The HDF5 library does not support deflate compression!\n");
+  } else if(filter=="zstd") {
+    c.filter=2;
+    if(!c.level)
+      c.level=3;
+    c.level=std::min(c.level,22);
+    if(H5Zfilter_avail(H5Z_FILTER_ZSTD)<=0)
+      throw std::runtime_error("The zstd filter plugin for HDF5 is not available; check HDF5_PLUGIN_PATH!\n");
+  } else {
+    std::ostringstream oss;
+    oss << "Unknown compression codec " << codec << "!\n";
+    throw std::logic_error(oss.str());
+  }
+
+  if(category=="all") {
+    codecs["basis"]=c;
+    codecs["scf"]=c;
+    codecs["other"]=c;
+  } else
+    codecs[category]=c;
+}
+
+void Checkpoint::set_codecs(const std::string & spec) {
+  std::istringstream iss(spec);
+  std::string entry;
+  while(std::getline(iss,entry,',')) {
+    if(!entry.size())
+      continue;
+    size_t ieq(entry.find('='));
+    if(ieq==std::string::npos)
+      set_codec("all",entry);
+    else
+      set_codec(entry.substr(0,ieq),entry.substr(ieq+1));
+  }
+}
+
+void Checkpoint::set_skip_regenerable(bool skip) {
+  skip_regen=skip;
+}
+
+void Checkpoint::set_inplace(bool inplace_) {
+  inplace=inplace_;
+}
+
+bool Checkpoint::overwrite(const std::string & name, hid_t memtype, int rank, const hsize_t * dims, hid_t plist, const void * data) {
+  if(!inplace || !H5Lexists(file, name.c_str(), H5P_DEFAULT))
+    return false;
+
+  hid_t dataset=H5Dopen(file,name.c_str(),H5P_DEFAULT);
+  if(dataset<0)
+    return false;
+  hid_t datatype=H5Dget_type(dataset);
+  hid_t dataspace=H5Dget_space(dataset);
+
+  // Same type and dimensions?
+  bool match=(H5Tequal(datatype,memtype)>0 && H5Sget_simple_extent_ndims(dataspace)==rank);
+  if(match && rank>0) {
+    std::vector<hsize_t> olddims(rank);
+    H5Sget_simple_extent_dims(dataspace,olddims.data(),NULL);
+    for(int i=0;i<rank;i++)
+      match=match && (olddims[i]==dims[i]);
+  }
+  // A change of the compression settings needs a new entry
+  if(match && plist>=0) {
+    hid_t oldplist=H5Dget_create_plist(dataset);
+    match=(H5Pget_layout(oldplist)==H5Pget_layout(plist)) && (H5Pget_nfilters(oldplist)==H5Pget_nfilters(plist));
+    H5Pclose(oldplist);
+  }
+
+  if(match)
+    H5Dwrite(dataset, memtype, H5S_ALL, H5S_ALL, H5P_DEFAULT, data);
+
+  H5Sclose(dataspace);
+  H5Tclose(datatype);
+  H5Dclose(dataset);
+  return match;
+}
+
+hid_t Checkpoint::creation_plist(const std::string & name, size_t nrows, size_t ncols) const {
+  std::map<std::string, chk_codec_t>::const_iterator it(codecs.find(entry_category(name)));
+  if(it==codecs.end() || it->second.filter==0 || nrows*ncols==0)
+    return H5Pcreate(H5P_DATASET_CREATE);
+  const chk_codec_t & c(it->second);
+
+  // Chunks span whole columns of the matrix, which are the rows of
+  // the transposed layout in the file
+  hsize_t chunk[2];
+  chunk[1]=nrows;
+  chunk[0]=std::max<size_t>(1,std::min<size_t>(ncols,CHUNK_SIZE/(sizeof(double)*nrows)));
+
+  hid_t plist=H5Pcreate(H5P_DATASET_CREATE);
+  H5Pset_chunk(plist,2,chunk);
+  if(c.shuffle)
+    H5Pset_shuffle(plist);
+  if(c.filter==1) {
+    H5Pset_deflate(plist,c.level);
+  } else {
+    unsigned int level(c.level);
+    H5Pset_filter(plist,H5Z_FILTER_ZSTD,H5Z_FLAG_OPTIONAL,1,&level);
+  }
+  return plist;
+}
+
 void Checkpoint::remove(const std::string & name) {
   CHECK_WRITE();
 
@@ -123,13 +313,21 @@ void Checkpoint::write(const std::string & name, const arma::mat & m) {
     cl=true;
   }
 
-  // Remove possible existing entry
-  remove(name);
-
   // Dimensions of the matrix
   hsize_t dims[2];
   dims[1]=m.n_rows;
   dims[0]=m.n_cols;
+  // Chunking and compression of the category of the entry
+  hid_t plist=creation_plist(name,m.n_rows,m.n_cols);
+
+  if(overwrite(name,H5T_NATIVE_DOUBLE,2,dims,plist,m.memptr())) {
+    H5Pclose(plist);
+    if(cl) close();
+    return;
+  }
+
+  // Remove possible existing entry
+  remove(name);
 
   // Create a dataspace.
   hid_t dataspace=H5Screate_simple(2,dims,NULL);
@@ -137,26 +335,87 @@ void Checkpoint::write(const std::string & name, const arma::mat & m) {
   // Create a datatype.
   hid_t datatype=H5Tcopy(H5T_NATIVE_DOUBLE);
 
-  // Create the dataset using the defined dataspace and datatype, and
-  // default dataset creation properties.
-  hid_t dataset=H5Dcreate(file,name.c_str(),datatype,dataspace,H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+  // Create the dataset using the defined dataspace and datatype
+  hid_t dataset=H5Dcreate(file,name.c_str(),datatype,dataspace,H5P_DEFAULT, plist, H5P_DEFAULT);
 
   // Write the data to the file.
   H5Dwrite(dataset, datatype, H5S_ALL, H5S_ALL, H5P_DEFAULT, m.memptr());
 
   // Close everything.
   H5Dclose(dataset);
+  H5Pclose(plist);
   H5Tclose(datatype);
   H5Sclose(dataspace);
   if(cl) close();
 }
 
+void Checkpoint::write_regenerable(const std::string & name, const arma::mat & m) {
+  if(!regenerable(name)) {
+    std::ostringstream oss;
+    oss << "The entry " << name << " can not be recomputed from the basis set!\n";
+    throw std::logic_error(oss.str());
+  }
+  if(skip_regen)
+    // Make sure an old copy is not read back instead
+    remove(name);
+  else
+    write(name,m);
+}
+
+bool Checkpoint::regenerate(const std::string & name, arma::mat & m) {
+  if(!regenerable(name) || !exist("HelFEM_ID"))
+    return false;
+
+  // The half-inverse is formed with the settings of the run
+  bool chol=false;
+  int symm=0;
+  if(name=="Sinvh") {
+    if(!exist("Sinvh_chol") || !exist("Sinvh_symm"))
+      return false;
+    read("Sinvh_chol",chol);
+    read("Sinvh_symm",symm);
+  }
+
+  int id;
+  read("HelFEM_ID",id);
+  if(id==1) {
+    helfem::atomic::basis::TwoDBasis basis;
+    read(basis);
+    if(name=="S")
+      m=basis.overlap();
+    else if(name=="T")
+      m=basis.kinetic();
+    else if(name=="Sinvh")
+      m=basis.Sinvh(chol,symm);
+    else
+      m=basis.nuclear();
+  } else if(id==2) {
+    helfem::diatomic::basis::TwoDBasis basis;
+    read(basis);
+    if(name=="S")
+      m=basis.overlap();
+    else if(name=="T")
+      m=basis.kinetic();
+    else if(name=="Sinvh")
+      m=basis.Sinvh(chol,symm);
+    else
+      m=basis.nuclear();
+  } else
+    return false;
+
+  return true;
+}
+
 void Checkpoint::read(const std::string & name, arma::mat & m) {
   bool cl=false;
   if(!opend) {
     open();
     cl=true;
   }
+  if(!exist(name) && regenerate(name,m)) {
+    if(cl) close();
+    return;
+  }
   CHECK_EXIST();
 
   // Open the dataset.
@@ -202,6 +461,202 @@ void Checkpoint::read(const std::string & name, arma::mat & m) {
   if(cl) close();
 }
 
+arma::mat Checkpoint::map(const std::string & name) {
+  bool cl=false;
+  if(!opend) {
+    open();
+    cl=true;
+  }
+  if(!exist(name)) {
+    arma::mat m;
+    if(regenerate(name,m)) {
+      if(cl) close();
+      return m;
+    }
+  }
+  CHECK_EXIST();
+
+  // Make sure everything is on disk
+  flush();
+
+  // Open the dataset.
+  hid_t dataset = H5Dopen (file, name.c_str(), H5P_DEFAULT);
+  hid_t datatype = H5Dget_type(dataset);
+  hid_t dataspace = H5Dget_space(dataset);
+  int ndim = H5Sget_simple_extent_ndims(dataspace);
+
+  // Offset of the data in the file; undefined for chunked datasets
+  haddr_t offset = H5Dget_offset(dataset);
+  bool native = H5Tequal(datatype, H5T_NATIVE_DOUBLE)>0;
+
+  hsize_t dims[2]={0,0};
+  if(ndim==2)
+    H5Sget_simple_extent_dims(dataspace,dims,NULL);
+
+  H5Sclose(dataspace);
+  H5Tclose(datatype);
+  H5Dclose(dataset);
+
+  // Map the dataset
+  void *ptr = MAP_FAILED;
+  size_t length = 0, delta = 0;
+  if(ndim==2 && native && offset!=HADDR_UNDEF && dims[0]*dims[1]>0) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if(fd>=0) {
+      // Mappings must start at a page boundary
+      size_t pagesize = sysconf(_SC_PAGE_SIZE);
+      delta = offset % pagesize;
+      length = delta + dims[0]*dims[1]*sizeof(double);
+      ptr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, offset-delta);
+      ::close(fd);
+    }
+  }
+
+  if(ptr == MAP_FAILED) {
+    // Fall back to a normal read
+    arma::mat m;
+    read(name,m);
+    if(cl) close();
+    return m;
+  }
+
+  maps.push_back(std::make_pair(ptr,length));
+  if(cl) close();
+
+  return arma::mat((double *) ((char *) ptr + delta), dims[1], dims[0], false, true);
+}
+
+void Checkpoint::read_orbitals(const std::string & spin, arma::mat & C, arma::vec & E) {
+  if(spin!="a" && spin!="b")
+    throw std::logic_error("Spin must be a or b!\n");
+  bool cl=false;
+  if(!opend) {
+    open();
+    cl=true;
+  }
+  read("C"+spin,C);
+  read("E"+spin,E);
+  if(E.n_elem>C.n_cols)
+    E=E.subvec(0,C.n_cols-1);
+
+  if(C.n_cols<C.n_rows) {
+    arma::mat S, Sinvh, F;
+    read("S",S);
+    read("Sinvh",Sinvh);
+    if(exist("F"+spin)) {
+      read("F"+spin,F);
+    } else {
+      arma::mat V;
+      read("T",F);
+      read("Vnuc",V);
+      F+=V;
+    }
+
+    if(C.n_cols<Sinvh.n_cols) {
+      // Orthogonal complement of the stored orbitals
+      arma::mat Q(Sinvh-C*(C.t()*S*Sinvh));
+      arma::vec qval;
+      arma::mat qvec;
+      arma::eig_sym(qval,qvec,arma::mat(Q.t()*S*Q));
+      // The stored orbitals take up as many directions, whose
+      // eigenvalues vanish
+      size_t nvirt(Sinvh.n_cols-C.n_cols);
+      arma::mat X(Q*qvec.tail_cols(nvirt)*arma::diagmat(arma::pow(qval.tail(nvirt),-0.5)));
+
+      arma::vec Ev;
+      arma::mat Cv;
+      arma::eig_sym(Ev,Cv,arma::mat(X.t()*F*X));
+      printf("%i virtual %s orbitals recomputed for the %i read in from %s\n",(int) nvirt,spin=="a" ? "alpha" : "beta",(int) C.n_cols,fullname.c_str());
+      C=arma::join_rows(C,X*Cv);
+      E=arma::join_cols(E,Ev);
+    }
+  }
+
+  if(cl) close();
+}
+
+void Checkpoint::create(const std::string & name, size_t nrows, size_t ncols, size_t chunkrows, int compression) {
+  CHECK_WRITE();
+
+  bool cl=false;
+  if(!opend) {
+    open();
+    cl=true;
+  }
+
+  // Remove possible existing entry
+  remove(name);
+
+  // Dimensions of the matrix; the data is stored transposed as in write()
+  hsize_t dims[2];
+  dims[1]=nrows;
+  dims[0]=ncols;
+  hid_t dataspace=H5Screate_simple(2,dims,NULL);
+  hid_t datatype=H5Tcopy(H5T_NATIVE_DOUBLE);
+
+  // Chunks cover all columns of a block of rows
+  hsize_t chunk[2];
+  chunk[1]=std::max<size_t>(std::min(chunkrows,nrows),1);
+  chunk[0]=std::max<size_t>(ncols,1);
+  hid_t plist=H5Pcreate(H5P_DATASET_CREATE);
+  H5Pset_chunk(plist,2,chunk);
+  if(compression>0)
+    H5Pset_deflate(plist,std::min(compression,9));
+
+  hid_t dataset=H5Dcreate(file,name.c_str(),datatype,dataspace,H5P_DEFAULT,plist,H5P_DEFAULT);
+  if(dataset<0) {
+    std::ostringstream oss;
+    oss << "Could not create entry " << name << " in the checkpoint file!\n";
+    throw std::runtime_error(oss.str());
+  }
+
+  H5Dclose(dataset);
+  H5Pclose(plist);
+  H5Tclose(datatype);
+  H5Sclose(dataspace);
+  if(cl) close();
+}
+
+void Checkpoint::write_rows(const std::string & name, size_t irow, const arma::mat & m) {
+  CHECK_WRITE();
+
+  bool cl=false;
+  if(!opend) {
+    open();
+    cl=true;
+  }
+  CHECK_EXIST();
+
+  hid_t dataset=H5Dopen(file,name.c_str(),H5P_DEFAULT);
+  hid_t filespace=H5Dget_space(dataset);
+  hsize_t dims[2];
+  H5Sget_simple_extent_dims(filespace,dims,NULL);
+  if(dims[0]!=m.n_cols || irow+m.n_rows>dims[1]) {
+    H5Sclose(filespace);
+    H5Dclose(dataset);
+    std::ostringstream oss;
+    oss << "Cannot write rows " << irow << "-" << irow+m.n_rows << " of a " << m.n_cols << "-column block into " << name << " that has " << dims[1] << " rows and " << dims[0] << " columns!\n";
+    throw std::logic_error(oss.str());
+  }
+
+  // The block is stored in column-major order, which is the
+  // transposed layout used in the file
+  hsize_t start[2], count[2];
+  start[1]=irow;
+  start[0]=0;
+  count[1]=m.n_rows;
+  count[0]=m.n_cols;
+  H5Sselect_hyperslab(filespace,H5S_SELECT_SET,start,NULL,count,NULL);
+  hid_t memspace=H5Screate_simple(2,count,NULL);
+
+  H5Dwrite(dataset,H5T_NATIVE_DOUBLE,memspace,filespace,H5P_DEFAULT,m.memptr());
+
+  H5Sclose(memspace);
+  H5Sclose(filespace);
+  H5Dclose(dataset);
+  if(cl) close();
+}
+
 void Checkpoint::cwrite(const std::string & name, const arma::cx_mat & m) {
   arma::mat mreal=arma::real(m);
   arma::mat mim=arma::imag(m);
@@ -474,6 +929,68 @@ void Checkpoint::read(const std::string & name, std::vector<hsize_t> & v) {
   if(cl) close();
 }
 
+void Checkpoint::write(const std::string & name, const std::vector<arma::mat> & m) {
+  CHECK_WRITE();
+  bool cl=false;
+  if(!opend) {
+    open();
+    cl=true;
+  }
+
+  // Matrix dimensions
+  std::vector<hsize_t> dims(2*m.size());
+  size_t ntot=0;
+  for(size_t i=0;i<m.size();i++) {
+    dims[2*i]=m[i].n_rows;
+    dims[2*i+1]=m[i].n_cols;
+    ntot+=m[i].n_elem;
+  }
+
+  // Pack the data
+  std::vector<double> data;
+  data.reserve(ntot);
+  for(size_t i=0;i<m.size();i++)
+    data.insert(data.end(),m[i].begin(),m[i].end());
+
+  write(name+"_dims",dims);
+  if(data.size())
+    write(name,data);
+  else
+    remove(name);
+
+  if(cl) close();
+}
+
+void Checkpoint::read(const std::string & name, std::vector<arma::mat> & m) {
+  bool cl=false;
+  if(!opend) {
+    open();
+    cl=true;
+  }
+
+  std::vector<hsize_t> dims;
+  read(name+"_dims",dims);
+  std::vector<double> data;
+  if(exist(name))
+    read(name,data);
+
+  // Unpack the data
+  m.resize(dims.size()/2);
+  size_t ioff=0;
+  for(size_t i=0;i<m.size();i++) {
+    size_t n(dims[2*i]*dims[2*i+1]);
+    if(ioff+n>data.size()) {
+      std::ostringstream oss;
+      oss << "Error - " << name << " has too little data for the stored dimensions!\n";
+      throw std::runtime_error(oss.str());
+    }
+    m[i]=arma::mat(data.data()+ioff,dims[2*i],dims[2*i+1]);
+    ioff+=n;
+  }
+
+  if(cl) close();
+}
+
 void Checkpoint::write(const helfem::atomic::basis::TwoDBasis & basis) {
   CHECK_WRITE();
   bool cl=false;
@@ -498,6 +1015,10 @@ void Checkpoint::write(const helfem::atomic::basis::TwoDBasis & basis) {
   write("n_quad",basis.get_nquad());
   write("poly_id",basis.get_poly_id());
   write("poly_nnodes",basis.get_poly_nnodes());
+  if(!basis.uniform_poly()) {
+    write("el_poly_id",basis.get_element_poly_id());
+    write("el_poly_nnodes",basis.get_element_poly_nnodes());
+  }
   write("zeroder",basis.get_zeroder());
   write("taylor_order",basis.get_taylor_order());
 
@@ -551,8 +1072,28 @@ void Checkpoint::read(helfem::atomic::basis::TwoDBasis & basis) {
   read("lval", lval);
   read("mval", mval);
 
-  auto poly(std::shared_ptr<const helfem::polynomial_basis::PolynomialBasis>(helfem::polynomial_basis::get_basis(poly_id,poly_nnodes)));
-  basis=helfem::atomic::basis::TwoDBasis(Z, (helfem::modelpotential::nuclear_model_t) finitenuc, Rrms, poly, zeroder, n_quad, bval, taylor_order, lval, mval, Zl, Zr, Rhalf);
+  // Polynomial bases of the elements, if they vary
+  arma::ivec el_poly_id(bval.n_elem-1), el_poly_nnodes(bval.n_elem-1);
+  el_poly_id.fill(poly_id);
+  el_poly_nnodes.fill(poly_nnodes);
+  if(exist("el_poly_nnodes")) {
+    read("el_poly_id",el_poly_id);
+    read("el_poly_nnodes",el_poly_nnodes);
+  }
+  // The main basis comes first
+  std::vector<std::shared_ptr<const helfem::polynomial_basis::PolynomialBasis>> polys(1,std::shared_ptr<const helfem::polynomial_basis::PolynomialBasis>(helfem::polynomial_basis::get_basis(poly_id,poly_nnodes)));
+  std::vector<std::pair<int,int>> polykeys(1,std::pair<int,int>(poly_id,poly_nnodes));
+  arma::uvec el_poly(el_poly_id.n_elem);
+  for(size_t iel=0;iel<el_poly_id.n_elem;iel++) {
+    std::pair<int,int> key(el_poly_id(iel),el_poly_nnodes(iel));
+    size_t ip=std::find(polykeys.begin(),polykeys.end(),key)-polykeys.begin();
+    if(ip==polykeys.size()) {
+      polykeys.push_back(key);
+      polys.push_back(std::shared_ptr<const helfem::polynomial_basis::PolynomialBasis>(helfem::polynomial_basis::get_basis(key.first,key.second)));
+    }
+    el_poly(iel)=ip;
+  }
+  basis=helfem::atomic::basis::TwoDBasis(Z, (helfem::modelpotential::nuclear_model_t) finitenuc, Rrms, polys, el_poly, zeroder, n_quad, bval, taylor_order, lval, mval, Zl, Zr, Rhalf);
   
   if(cl) close();
 }
@@ -624,6 +1165,210 @@ void Checkpoint::read(helfem::diatomic::basis::TwoDBasis & basis) {
   if(cl) close();
 }
 
+void Checkpoint::write_tei(const helfem::atomic::basis::TwoDBasis & basis) {
+  CHECK_WRITE();
+  bool cl=false;
+  if(!opend) {
+    open();
+    cl=true;
+  }
+
+  std::string key(basis.tei_fingerprint());
+  write(key+"_disjoint_L",basis.disjoint_L);
+  write(key+"_disjoint_m1L",basis.disjoint_m1L);
+  write(key+"_prim_teis",basis.prim_tei);
+
+  if(cl) close();
+}
+
+bool Checkpoint::read_tei(helfem::atomic::basis::TwoDBasis & basis) {
+  bool cl=false;
+  if(!opend) {
+    open();
+    cl=true;
+  }
+
+  std::string key(basis.tei_fingerprint());
+  bool found=exist(key+"_prim_teis_dims");
+  if(found) {
+    read(key+"_disjoint_L",basis.disjoint_L);
+    read(key+"_disjoint_m1L",basis.disjoint_m1L);
+    read(key+"_prim_teis",basis.prim_tei);
+    basis.distribute_tei();
+  }
+
+  if(cl) close();
+
+  return found;
+}
+
+std::string Checkpoint::rs_tei_key(const helfem::atomic::basis::TwoDBasis & basis, bool yukawa, double lambda, double thr) const {
+  // The screening threshold only affects the error function integrals
+  arma::vec par(yukawa ? 1 : 2);
+  par(0)=lambda;
+  if(!yukawa)
+    par(1)=thr;
+  return basis.tei_fingerprint() + (yukawa ? "_yukawa_" : "_erfc_") + helfem::utils::hash_data(par);
+}
+
+void Checkpoint::write_rs_tei(const helfem::atomic::basis::TwoDBasis & basis) {
+  CHECK_WRITE();
+  bool cl=false;
+  if(!opend) {
+    open();
+    cl=true;
+  }
+
+  std::string key(rs_tei_key(basis,basis.yukawa,basis.lambda,basis.rs_thr));
+  write(key+"_disjoint_iL",basis.disjoint_iL);
+  write(key+"_disjoint_kL",basis.disjoint_kL);
+  write(key+"_rs_teis",basis.rs_tei);
+  write(key+"_rs_lowrank_a",basis.rs_lowrank_a);
+  write(key+"_rs_lowrank_b",basis.rs_lowrank_b);
+
+  if(cl) close();
+}
+
+bool Checkpoint::read_rs_tei(helfem::atomic::basis::TwoDBasis & basis, bool yukawa, double lambda, double thr) {
+  bool cl=false;
+  if(!opend) {
+    open();
+    cl=true;
+  }
+
+  std::string key(rs_tei_key(basis,yukawa,lambda,thr));
+  bool found=exist(key+"_rs_teis_dims") && exist(key+"_rs_lowrank_a_dims");
+  if(found) {
+    read(key+"_disjoint_iL",basis.disjoint_iL);
+    read(key+"_disjoint_kL",basis.disjoint_kL);
+    read(key+"_rs_teis",basis.rs_tei);
+    read(key+"_rs_lowrank_a",basis.rs_lowrank_a);
+    read(key+"_rs_lowrank_b",basis.rs_lowrank_b);
+    basis.yukawa=yukawa;
+    basis.lambda=lambda;
+    basis.rs_thr=yukawa ? 0.0 : thr;
+  }
+
+  if(cl) close();
+
+  return found;
+}
+
+std::string Checkpoint::shard_name(int rank) const {
+  std::ostringstream oss;
+  oss << fullname << ".shard" << rank;
+  return oss.str();
+}
+
+void Checkpoint::write_tei(const helfem::diatomic::basis::TwoDBasis & basis) {
+  if(!writemode)
+    throw std::runtime_error("Cannot write to checkpoint file that was opened for reading only!\n");
+  if(fullname.empty())
+    return;
+
+  std::string key(basis.tei_fingerprint());
+  const int nranks(helfem::mpi::size());
+  if(nranks>1) {
+    // The channels owned by a rank depend on the number of ranks, so
+    // it is stored along with the rank. The disjoint integrals are
+    // small and replicated in every shard, so that a rank only ever
+    // opens its own file.
+    Checkpoint shard(shard_name(helfem::mpi::rank()),true,true,true);
+    shard.open();
+    shard.write(key+"_nranks",nranks);
+    shard.write(key+"_rank",helfem::mpi::rank());
+    shard.write(key+"_disjoint_P0",basis.disjoint_P0);
+    shard.write(key+"_disjoint_P2",basis.disjoint_P2);
+    shard.write(key+"_disjoint_Q0",basis.disjoint_Q0);
+    shard.write(key+"_disjoint_Q2",basis.disjoint_Q2);
+    shard.write(key+"_prim_teifs",basis.prim_tei);
+    shard.close();
+  }
+
+  CHECK_WRITE();
+  bool cl=false;
+  if(!opend) {
+    open();
+    cl=true;
+  }
+
+  if(nranks>1) {
+    // Index of the shards
+    write(key+"_shards",nranks);
+    for(int irank=0;irank<nranks;irank++) {
+      std::ostringstream oss;
+      oss << key << "_shard" << irank;
+      write(oss.str(),shard_name(irank));
+    }
+  } else {
+    write(key+"_disjoint_P0",basis.disjoint_P0);
+    write(key+"_disjoint_P2",basis.disjoint_P2);
+    write(key+"_disjoint_Q0",basis.disjoint_Q0);
+    write(key+"_disjoint_Q2",basis.disjoint_Q2);
+    write(key+"_prim_teifs",basis.prim_tei);
+  }
+
+  if(cl) close();
+}
+
+bool Checkpoint::read_tei_shard(helfem::diatomic::basis::TwoDBasis & basis) {
+  std::string name(shard_name(helfem::mpi::rank()));
+  if(!file_exists(name))
+    return false;
+
+  Checkpoint shard(name,false);
+  std::string key(basis.tei_fingerprint());
+  if(!shard.exist(key+"_prim_teifs_dims"))
+    return false;
+  int nranks, rank;
+  shard.read(key+"_nranks",nranks);
+  shard.read(key+"_rank",rank);
+  if(nranks!=helfem::mpi::size() || rank!=helfem::mpi::rank())
+    return false;
+
+  shard.read(key+"_disjoint_P0",basis.disjoint_P0);
+  shard.read(key+"_disjoint_P2",basis.disjoint_P2);
+  shard.read(key+"_disjoint_Q0",basis.disjoint_Q0);
+  shard.read(key+"_disjoint_Q2",basis.disjoint_Q2);
+  shard.read(key+"_prim_teifs",basis.prim_tei);
+  return true;
+}
+
+bool Checkpoint::read_tei(helfem::diatomic::basis::TwoDBasis & basis) {
+  bool found;
+  if(helfem::mpi::size()>1) {
+    // Every rank reads its own shard; the index in the main file is
+    // only used by the first rank, which is the one that writes it
+    found=read_tei_shard(basis);
+    double nfound(found ? 1.0 : 0.0);
+    helfem::mpi::allreduce(nfound);
+    // The integrals are recomputed on every rank unless all shards are usable
+    found=(nfound==helfem::mpi::size());
+  } else {
+    bool cl=false;
+    if(!opend) {
+      open();
+      cl=true;
+    }
+
+    std::string key(basis.tei_fingerprint());
+    found=exist(key+"_prim_teifs_dims");
+    if(found) {
+      read(key+"_disjoint_P0",basis.disjoint_P0);
+      read(key+"_disjoint_P2",basis.disjoint_P2);
+      read(key+"_disjoint_Q0",basis.disjoint_Q0);
+      read(key+"_disjoint_Q2",basis.disjoint_Q2);
+      read(key+"_prim_teifs",basis.prim_tei);
+    }
+
+    if(cl) close();
+  }
+
+  if(found)
+    basis.distribute_tei();
+  return found;
+}
+
 void Checkpoint::write(const std::string & name, double val) {
   CHECK_WRITE();
   bool cl=false;
@@ -632,6 +1377,11 @@ void Checkpoint::write(const std::string & name, double val) {
     cl=true;
   }
 
+  if(overwrite(name,H5T_NATIVE_DOUBLE,0,NULL,-1,&val)) {
+    if(cl) close();
+    return;
+  }
+
   // Remove possible existing entry
   remove(name);
 
@@ -706,6 +1456,11 @@ void Checkpoint::write(const std::string & name, int val) {
     cl=true;
   }
 
+  if(overwrite(name,H5T_NATIVE_INT,0,NULL,-1,&val)) {
+    if(cl) close();
+    return;
+  }
+
   // Remove possible existing entry
   remove(name);
 
@@ -776,6 +1531,11 @@ void Checkpoint::write(const std::string & name, hsize_t val) {
     cl=true;
   }
 
+  if(overwrite(name,H5T_NATIVE_HSIZE,0,NULL,-1,&val)) {
+    if(cl) close();
+    return;
+  }
+
   // Remove possible existing entry
   remove(name);
 
@@ -1003,6 +1763,122 @@ void Checkpoint::read(const std::string & name, std::string & val) {
   if(cl) close();
 }
 
+CheckpointWriter::CheckpointWriter(Checkpoint & chkpt_) : chkpt(chkpt_), busy(false), done(false), tcaller(0.0), tio(0.0) {
+  worker=std::thread(&CheckpointWriter::run,this);
+}
+
+CheckpointWriter::~CheckpointWriter() {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    done=true;
+  }
+  // Entries that were held back for write_final() are dropped
+  for(std::map<std::string, arma::mat>::const_iterator it=held.begin();it!=held.end();++it)
+    helfem::memory::release("Checkpoint buffers",it->second.n_elem*sizeof(double));
+  cv_work.notify_one();
+  worker.join();
+}
+
+void CheckpointWriter::write(const std::string & name, const arma::mat & m) {
+  // The copy is the only cost paid by the caller
+  helfem::profiler::Region prof("Checkpoint");
+  Timer t;
+  write(name,arma::mat(m));
+  std::lock_guard<std::mutex> lock(mtx);
+  tcaller+=t.get();
+}
+
+void CheckpointWriter::write(const std::string & name, arma::mat && m) {
+  if(helfem::MatrixStore::listed(final_list,name)) {
+    arma::mat & entry(held[name]);
+    helfem::memory::release("Checkpoint buffers",entry.n_elem*sizeof(double));
+    helfem::memory::allocate("Checkpoint buffers",m.n_elem*sizeof(double));
+    entry=std::move(m);
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    // Replaces any older version that has not been written yet
+    arma::mat & entry(pending[name]);
+    helfem::memory::release("Checkpoint buffers",entry.n_elem*sizeof(double));
+    helfem::memory::allocate("Checkpoint buffers",m.n_elem*sizeof(double));
+    entry=std::move(m);
+  }
+  cv_work.notify_one();
+}
+
+void CheckpointWriter::set_final(const std::string & list) {
+  final_list=list;
+}
+
+void CheckpointWriter::write_final() {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    for(std::map<std::string, arma::mat>::iterator it=held.begin();it!=held.end();++it) {
+      arma::mat & entry(pending[it->first]);
+      helfem::memory::release("Checkpoint buffers",entry.n_elem*sizeof(double));
+      entry=std::move(it->second);
+    }
+    held.clear();
+  }
+  cv_work.notify_one();
+}
+
+void CheckpointWriter::wait() {
+  helfem::profiler::Region prof("Checkpoint");
+  Timer t;
+  std::unique_lock<std::mutex> lock(mtx);
+  cv_idle.wait(lock,[this]{return pending.empty() && !busy;});
+  tcaller+=t.get();
+}
+
+double CheckpointWriter::caller_time() {
+  std::lock_guard<std::mutex> lock(mtx);
+  return tcaller;
+}
+
+double CheckpointWriter::io_time() {
+  std::lock_guard<std::mutex> lock(mtx);
+  return tio;
+}
+
+void CheckpointWriter::run() {
+  while(true) {
+    std::map<std::string, arma::mat> work;
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      cv_work.wait(lock,[this]{return done || !pending.empty();});
+      if(pending.empty() && done)
+        break;
+      work.swap(pending);
+      busy=true;
+    }
+
+    // Write out the entries
+    Timer t;
+    bool cl=false;
+    if(!chkpt.is_open()) {
+      chkpt.open();
+      cl=true;
+    }
+    size_t nwritten=0;
+    for(std::map<std::string, arma::mat>::const_iterator it=work.begin();it!=work.end();++it) {
+      chkpt.write(it->first,it->second);
+      nwritten+=it->second.n_elem;
+    }
+    chkpt.flush();
+    if(cl) chkpt.close();
+    helfem::memory::release("Checkpoint buffers",nwritten*sizeof(double));
+
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      busy=false;
+      tio+=t.get();
+    }
+    cv_idle.notify_all();
+  }
+}
+
 bool file_exists(const std::string & name) {
   std::ifstream file(name.c_str());
   return file.good();
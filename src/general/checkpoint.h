@@ -18,6 +18,10 @@
 #define CHECKPOINT_H
 
 #include <armadillo>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
 #include "../atomic/basis.h"
 #include "../diatomic/basis.h"
 
@@ -29,10 +33,22 @@ extern "C" {
 /// Length of symbol
 #define SYMLEN 10
 
+/// Compression of checkpoint entries
+typedef struct {
+  /// Filter: 0 for none, 1 for deflate, 2 for zstd
+  int filter;
+  /// Compression level
+  int level;
+  /// Shuffle the bytes of the values before compressing?
+  bool shuffle;
+} chk_codec_t;
+
 /// Checkpointing class.
 class Checkpoint {
   /// Name of the file
   std::string filename;
+  /// Name of the file, also on the MPI ranks that don't write it
+  std::string fullname;
   /// Is file open for writing?
   bool writemode;
 
@@ -40,6 +56,14 @@ class Checkpoint {
   bool opend;
   /// The checkpoint file
   hid_t file;
+  /// Memory maps handed out by map(): address and length
+  std::vector< std::pair<void *, size_t> > maps;
+  /// Compression of the categories of entries
+  std::map<std::string, chk_codec_t> codecs;
+  /// Are entries that can be recomputed from the basis set skipped?
+  bool skip_regen;
+  /// Are existing entries of the same shape overwritten in place?
+  bool inplace;
 
   // *** Helper functions ***
 
@@ -47,10 +71,22 @@ class Checkpoint {
   void write_hbool(const std::string & name, hbool_t val);
   /// Read value
   void read_hbool(const std::string & name, hbool_t & val);
+  /// Cache key for range-separated integrals
+  std::string rs_tei_key(const helfem::atomic::basis::TwoDBasis & basis, bool yukawa, double lambda, double thr) const;
+  /// Name of the file holding the data of an MPI rank
+  std::string shard_name(int rank) const;
+  /// Load the integrals of this rank from its shard, returns false if they are not there
+  bool read_tei_shard(helfem::diatomic::basis::TwoDBasis & basis);
+  /// Dataset creation properties for a matrix entry of the given size
+  hid_t creation_plist(const std::string & name, size_t nrows, size_t ncols) const;
+  /// Recompute an entry that was skipped by write_regenerable(); returns false if it can't be
+  bool regenerate(const std::string & name, arma::mat & mat);
+  /// Write the data over an existing entry of the same type, dimensions and layout (plist, or none for scalars); returns false if there is no such entry
+  bool overwrite(const std::string & name, hid_t memtype, int rank, const hsize_t * dims, hid_t plist, const void * data);
 
  public:
-  /// Create checkpoint file
-  Checkpoint(const std::string & filename, bool write, bool trunc=true);
+  /// Create checkpoint file; in write mode, an empty file name discards all writes. Only the first MPI rank writes, unless allranks is set, e.g. for a file of the rank's own
+  Checkpoint(const std::string & filename, bool write, bool trunc=true, bool allranks=false);
   /// Destructor
   ~Checkpoint();
 
@@ -66,6 +102,29 @@ class Checkpoint {
   /// Does the entry exist in the file?
   bool exist(const std::string & name);
 
+  /**
+   * Set the compression of a category of entries: "basis" for the
+   * one-electron matrices, "scf" for the orbitals, densities and Fock
+   * matrices, "other" for the rest, or "all". The codec is "none",
+   * "deflate" or "zstd", optionally followed by the level as
+   * "deflate:4" and preceded by "shuffle+" to shuffle the bytes
+   * before compression. Compressed entries are chunked, and are read
+   * back transparently.
+   */
+  void set_codec(const std::string & category, const std::string & codec);
+  /// Set the compression from a comma separated list of category=codec pairs; a codec without category applies to all
+  void set_codecs(const std::string & spec);
+  /// Skip the entries written with write_regenerable()?
+  void set_skip_regenerable(bool skip);
+  /**
+   * Overwrite existing matrix and scalar entries in place when the
+   * new value has the same shape, instead of removing and recreating
+   * them. Since the space of removed entries is not reclaimed, this
+   * keeps the file from growing when the same entries are written
+   * on every iteration.
+   */
+  void set_inplace(bool inplace);
+
   /**
    * Remove entry if exists. File needs to be opened beforehand. HDF5
    * doesn't reclaim any used space after the file has been closed, so
@@ -82,8 +141,41 @@ class Checkpoint {
 
   /// Save matrix
   void write(const std::string & name, const arma::mat & mat);
+  /**
+   * Save the overlap (S), kinetic (T), nuclear attraction (Vnuc) or
+   * half-inverse overlap (Sinvh) matrix of the basis set in the
+   * file. With set_skip_regenerable() nothing is stored. Missing
+   * entries of these kinds are recomputed by read() and map() from
+   * the basis set in the file; Sinvh also needs the Sinvh_chol and
+   * Sinvh_symm entries it was formed with.
+   */
+  void write_regenerable(const std::string & name, const arma::mat & mat);
   /// Read matrix
   void read(const std::string & name, arma::mat & mat);
+  /**
+   * Read matrix without copying. Contiguous datasets are memory
+   * mapped copy-on-write, and the returned matrix is a fixed-size
+   * view into the map that stays valid until the checkpoint object is
+   * destroyed. Chunked or compressed datasets are read normally.
+   */
+  arma::mat map(const std::string & name);
+  /**
+   * Read the orbitals C and orbital energies E of spin "a" or "b". If
+   * only the lowest orbitals were stored, the set is padded with
+   * virtuals from one diagonalization of the Fock matrix in the
+   * orthogonal complement of the stored orbitals; the core
+   * Hamiltonian is used if the Fock matrix is not in the file.
+   */
+  void read_orbitals(const std::string & spin, arma::mat & C, arma::vec & E);
+
+  /**
+   * Create a chunked matrix entry of the given size that is filled in
+   * blocks of rows with write_rows(). Chunks span chunkrows rows, and
+   * a nonzero compression level turns on gzip compression.
+   */
+  void create(const std::string & name, size_t nrows, size_t ncols, size_t chunkrows, int compression=0);
+  /// Write a block of rows starting at irow into an entry made with create()
+  void write_rows(const std::string & name, size_t irow, const arma::mat & mat);
 
   /// Save complex matrix
   void cwrite(const std::string & name, const arma::cx_mat & mat);
@@ -105,6 +197,11 @@ class Checkpoint {
   /// Load array
   void read(const std::string & name, std::vector<hsize_t> & v);
 
+  /// Save array of matrices
+  void write(const std::string & name, const std::vector<arma::mat> & m);
+  /// Load array of matrices
+  void read(const std::string & name, std::vector<arma::mat> & m);
+
   /// Save basis set
   void write(const helfem::atomic::basis::TwoDBasis & basis);
   /// Save basis set
@@ -114,6 +211,25 @@ class Checkpoint {
   /// Save basis set
   void read(helfem::diatomic::basis::TwoDBasis & basis);
 
+  /// Save primitive two-electron integrals in the integral cache
+  void write_tei(const helfem::atomic::basis::TwoDBasis & basis);
+  /// Load primitive two-electron integrals from the integral cache, returns false if they are not in the file
+  bool read_tei(helfem::atomic::basis::TwoDBasis & basis);
+  /// Save range-separated two-electron integrals in the integral cache
+  void write_rs_tei(const helfem::atomic::basis::TwoDBasis & basis);
+  /// Load range-separated two-electron integrals from the integral cache, returns false if they are not in the file
+  bool read_rs_tei(helfem::atomic::basis::TwoDBasis & basis, bool yukawa, double lambda, double thr=0.0);
+  /**
+   * Save primitive two-electron integrals in the integral cache. When
+   * the integrals are distributed over MPI ranks, every rank writes
+   * the channels it owns in a shard file of its own next to the
+   * cache, and the cache only holds the index of the shards. All
+   * ranks need to call this.
+   */
+  void write_tei(const helfem::diatomic::basis::TwoDBasis & basis);
+  /// Load primitive two-electron integrals from the integral cache, returns false if they are not in the file. With MPI, every rank reads its own shard, and the integrals are only used if all ranks found theirs
+  bool read_tei(helfem::diatomic::basis::TwoDBasis & basis);
+
   /// Save value
   void write(const std::string & name, double val);
   /// Read value
@@ -140,6 +256,65 @@ class Checkpoint {
   void read(const std::string & name, std::string & val);
 };
 
+/**
+ * Writes matrices to a checkpoint file in a background thread. Only
+ * the latest version of each entry is written, so entries that are
+ * updated faster than they can be written are coalesced. The
+ * checkpoint file must not be accessed by other means while the
+ * writer is alive.
+ */
+class CheckpointWriter {
+  /// The checkpoint file
+  Checkpoint & chkpt;
+  /// Entries waiting to be written
+  std::map<std::string, arma::mat> pending;
+  /// Is the worker writing?
+  bool busy;
+  /// Should the worker stop?
+  bool done;
+  /// Lock for the above
+  std::mutex mtx;
+  /// Signal for the worker
+  std::condition_variable cv_work;
+  /// Signal for wait()
+  std::condition_variable cv_idle;
+  /// Worker thread
+  std::thread worker;
+  /// Entries that are only written by write_final()
+  std::string final_list;
+  /// and their latest versions
+  std::map<std::string, arma::mat> held;
+  /// Time the callers have spent queueing and waiting
+  double tcaller;
+  /// Time the worker has spent writing
+  double tio;
+
+  /// Worker loop
+  void run();
+
+ public:
+  /// Constructor
+  CheckpointWriter(Checkpoint & chkpt);
+  /// Destructor, finishes all pending writes
+  ~CheckpointWriter();
+
+  /// Queue a copy of the matrix for writing
+  void write(const std::string & name, const arma::mat & mat);
+  /// Queue the matrix for writing, taking over its memory
+  void write(const std::string & name, arma::mat && mat);
+  /// Hold back the entries in the comma separated list, or all, until write_final() is called
+  void set_final(const std::string & list);
+  /// Queue the latest versions of the held back entries
+  void write_final();
+  /// Wait until all queued entries have been written
+  void wait();
+
+  /// Total time the callers have spent in write() and wait()
+  double caller_time();
+  /// Total time spent writing in the background
+  double io_time();
+};
+
 /// Check for existence of file
 bool file_exists(const std::string & name);
 
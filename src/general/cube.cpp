@@ -0,0 +1,254 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+
+#include "cmdline.h"
+#include "checkpoint.h"
+#include "timer.h"
+#include "utils.h"
+#include "../atomic/TwoDBasis.h"
+#include "../diatomic/basis.h"
+#include <cfloat>
+#include <cstdio>
+
+using namespace helfem;
+
+/// What is plotted
+typedef struct {
+  /// Density matrix, or empty if orbital is plotted
+  arma::mat P;
+  /// Orbital coefficients
+  arma::vec C;
+} plotdata_t;
+
+/// Converts Cartesian points to spherical coordinates (r, cos theta, phi)
+static arma::mat spherical_coordinates(const arma::mat & xyz) {
+  arma::mat pts(xyz.n_rows,3);
+  pts.col(0)=arma::sqrt(arma::sum(arma::square(xyz),1));
+  for(size_t i=0;i<xyz.n_rows;i++) {
+    pts(i,1) = (pts(i,0)>0.0) ? xyz(i,2)/pts(i,0) : 1.0;
+    pts(i,2) = std::atan2(xyz(i,1),xyz(i,0));
+  }
+  return pts;
+}
+
+/// Converts Cartesian points to prolate spheroidal coordinates (mu, cos nu, phi) for nuclei at z = -Rhalf and z = Rhalf
+static arma::mat prolate_coordinates(const arma::mat & xyz, double Rhalf) {
+  arma::vec rhosq(arma::square(xyz.col(0))+arma::square(xyz.col(1)));
+  arma::vec ra(arma::sqrt(arma::square(xyz.col(2)+Rhalf)+rhosq));
+  arma::vec rb(arma::sqrt(arma::square(xyz.col(2)-Rhalf)+rhosq));
+
+  arma::vec xi(arma::clamp((ra+rb)/(2*Rhalf),1.0,DBL_MAX));
+  arma::vec eta(arma::clamp((ra-rb)/(2*Rhalf),-1.0,1.0));
+
+  arma::mat pts(xyz.n_rows,3);
+  pts.col(0)=utils::arcosh(xi);
+  pts.col(1)=eta;
+  for(size_t i=0;i<xyz.n_rows;i++)
+    pts(i,2) = std::atan2(xyz(i,1),xyz(i,0));
+  return pts;
+}
+
+/// Evaluates the wanted quantity at the basis function values
+static arma::vec evaluate(const arma::cx_mat & bf, const plotdata_t & data) {
+  if(data.P.n_elem)
+    return arma::sum(arma::real(arma::conj(bf)%(bf*data.P)),1);
+  else
+    return arma::real(bf*data.C);
+}
+
+int main(int argc, char **argv) {
+  cmdline::parser parser;
+
+  // full option name, no short option, description, argument required
+  parser.add<std::string>("load", 0, "load calculation from checkpoint", true, "");
+  parser.add<std::string>("output", 0, "output file; a .hdf5 or .h5 ending gives HDF5 output, otherwise a Gaussian cube file", false, "density.cube");
+  parser.add<std::string>("plot", 0, "what to plot: density, spin, alpha, beta, or orbital", false, "density");
+  parser.add<int>("orbital", 0, "orbital to plot (starting from 1)", false, 1);
+  parser.add<std::string>("spin", 0, "spin of orbital to plot: a or b", false, "a");
+  parser.add<double>("xmin", 0, "x min", false, -5.0);
+  parser.add<double>("xmax", 0, "x max", false, 5.0);
+  parser.add<double>("ymin", 0, "y min", false, -5.0);
+  parser.add<double>("ymax", 0, "y max", false, 5.0);
+  parser.add<double>("zmin", 0, "z min", false, -5.0);
+  parser.add<double>("zmax", 0, "z max", false, 5.0);
+  parser.add<int>("Nx", 0, "number of points in x", false, 81);
+  parser.add<int>("Ny", 0, "number of points in y", false, 81);
+  parser.add<int>("Nz", 0, "number of points in z", false, 81);
+  parser.add<int>("tile", 0, "number of points evaluated at once by a thread", false, 4096);
+  parser.parse_check(argc, argv);
+
+  // Get parameters
+  std::string load(parser.get<std::string>("load"));
+  std::string output(parser.get<std::string>("output"));
+  std::string plot(parser.get<std::string>("plot"));
+  int iorb(parser.get<int>("orbital"));
+  std::string spin(parser.get<std::string>("spin"));
+  const arma::vec x(arma::linspace<arma::vec>(parser.get<double>("xmin"),parser.get<double>("xmax"),parser.get<int>("Nx")));
+  const arma::vec y(arma::linspace<arma::vec>(parser.get<double>("ymin"),parser.get<double>("ymax"),parser.get<int>("Ny")));
+  const arma::vec z(arma::linspace<arma::vec>(parser.get<double>("zmin"),parser.get<double>("zmax"),parser.get<int>("Nz")));
+  int tile(parser.get<int>("tile"));
+  if(!x.n_elem || !y.n_elem || !z.n_elem)
+    throw std::logic_error("Need at least one point in each direction!\n");
+  if(tile<1)
+    throw std::logic_error("Tile size must be positive!\n");
+
+  // Load checkpoint
+  Checkpoint loadchk(load,false);
+  int id;
+  loadchk.read("HelFEM_ID",id);
+
+  atomic::basis::TwoDBasis abasis;
+  diatomic::basis::TwoDBasis dbasis;
+  // Nuclei: charge and z coordinate
+  std::vector< std::pair<int,double> > nuclei;
+  if(id==1) {
+    loadchk.read(abasis);
+    nuclei.push_back(std::make_pair(abasis.get_Z(),0.0));
+    if(abasis.get_Zl())
+      nuclei.push_back(std::make_pair(abasis.get_Zl(),-abasis.get_Rhalf()));
+    if(abasis.get_Zr())
+      nuclei.push_back(std::make_pair(abasis.get_Zr(),abasis.get_Rhalf()));
+  } else if(id==2) {
+    loadchk.read(dbasis);
+    nuclei.push_back(std::make_pair(dbasis.get_Z1(),-dbasis.get_Rhalf()));
+    nuclei.push_back(std::make_pair(dbasis.get_Z2(),dbasis.get_Rhalf()));
+  } else {
+    std::ostringstream oss;
+    oss << "Unknown calculation type " << id << " in checkpoint!\n";
+    throw std::logic_error(oss.str());
+  }
+
+  // Form the quantity to plot
+  plotdata_t data;
+  if(plot=="orbital") {
+    // Virtuals that were not stored are recomputed
+    arma::mat C;
+    arma::vec E;
+    loadchk.read_orbitals(spin,C,E);
+    if(iorb<1 || iorb>(int) C.n_cols) {
+      std::ostringstream oss;
+      oss << "Orbital " << iorb << " does not exist, there are " << C.n_cols << " orbitals!\n";
+      throw std::logic_error(oss.str());
+    }
+    data.C=C.col(iorb-1);
+  } else {
+    arma::mat Pa, Pb;
+    loadchk.read("Pa",Pa);
+    loadchk.read("Pb",Pb);
+    if(plot=="density")
+      data.P=Pa+Pb;
+    else if(plot=="spin")
+      data.P=Pa-Pb;
+    else if(plot=="alpha")
+      data.P=Pa;
+    else if(plot=="beta")
+      data.P=Pb;
+    else
+      throw std::logic_error("Unknown quantity " + plot + " to plot!\n");
+  }
+
+  // Output
+  const bool hdf5(output.size()>3 && (output.substr(output.size()-3)==".h5" || (output.size()>5 && output.substr(output.size()-5)==".hdf5")));
+  const size_t Nplane(y.n_elem*z.n_elem);
+  const size_t Ntot(x.n_elem*Nplane);
+  const double dx(x.n_elem>1 ? x(1)-x(0) : 0.0);
+  const double dy(y.n_elem>1 ? y(1)-y(0) : 0.0);
+  const double dz(z.n_elem>1 ? z(1)-z(0) : 0.0);
+
+  FILE *out=NULL;
+  Checkpoint *savechk=NULL;
+  if(hdf5) {
+    savechk=new Checkpoint(output,true);
+    savechk->open();
+    // Values run over z fastest, then y, then x as in cube files
+    savechk->create("values",Ntot,1,Nplane);
+    savechk->write("x",x);
+    savechk->write("y",y);
+    savechk->write("z",z);
+    arma::mat nuc(nuclei.size(),2);
+    for(size_t i=0;i<nuclei.size();i++) {
+      nuc(i,0)=nuclei[i].first;
+      nuc(i,1)=nuclei[i].second;
+    }
+    savechk->write("nuclei",nuc);
+  } else {
+    out=fopen(output.c_str(),"w");
+    if(!out)
+      throw std::runtime_error("Error opening " + output + " for writing!\n");
+    fprintf(out,"HelFEM %s from %s\n",plot.c_str(),load.c_str());
+    fprintf(out,"Outer loop over x, middle over y, inner over z\n");
+    fprintf(out,"%5i % 12.6f % 12.6f % 12.6f\n",(int) nuclei.size(),x(0),y(0),z(0));
+    fprintf(out,"%5i % 12.6f % 12.6f % 12.6f\n",(int) x.n_elem,dx,0.0,0.0);
+    fprintf(out,"%5i % 12.6f % 12.6f % 12.6f\n",(int) y.n_elem,0.0,dy,0.0);
+    fprintf(out,"%5i % 12.6f % 12.6f % 12.6f\n",(int) z.n_elem,0.0,0.0,dz);
+    for(size_t i=0;i<nuclei.size();i++)
+      fprintf(out,"%5i % 12.6f % 12.6f % 12.6f % 12.6f\n",nuclei[i].first,(double) nuclei[i].first,0.0,0.0,nuclei[i].second);
+  }
+
+  Timer t;
+  const size_t Ntile((Nplane+tile-1)/tile);
+  for(size_t ix=0;ix<x.n_elem;ix++) {
+    // Values in the x plane
+    arma::vec val(Nplane);
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,1)
+#endif
+    for(size_t it=0;it<Ntile;it++) {
+      const size_t ifirst(it*tile);
+      const size_t ilast(std::min(ifirst+tile,Nplane)-1);
+
+      // Cartesian coordinates of the points in the tile
+      arma::mat xyz(ilast-ifirst+1,3);
+      for(size_t ip=ifirst;ip<=ilast;ip++) {
+        xyz(ip-ifirst,0)=x(ix);
+        xyz(ip-ifirst,1)=y(ip/z.n_elem);
+        xyz(ip-ifirst,2)=z(ip%z.n_elem);
+      }
+
+      arma::cx_mat bf;
+      if(id==1)
+        bf=abasis.eval_bf(spherical_coordinates(xyz));
+      else
+        bf=dbasis.eval_bf(prolate_coordinates(xyz,dbasis.get_Rhalf()));
+      val.subvec(ifirst,ilast)=evaluate(bf,data);
+    }
+
+    if(hdf5) {
+      savechk->write_rows("values",ix*Nplane,val);
+    } else {
+      for(size_t iy=0;iy<y.n_elem;iy++) {
+        for(size_t iz=0;iz<z.n_elem;iz++) {
+          fprintf(out," % 12.5e",val(iy*z.n_elem+iz));
+          if(iz%6==5)
+            fprintf(out,"\n");
+        }
+        if(z.n_elem%6!=0)
+          fprintf(out,"\n");
+      }
+    }
+  }
+
+  if(hdf5) {
+    savechk->close();
+    delete savechk;
+  } else
+    fclose(out);
+
+  printf("Evaluated %s at %i points in %.3f s, saved to %s\n",plot.c_str(),(int) Ntot,t.get(),output.c_str());
+
+  return 0;
+}
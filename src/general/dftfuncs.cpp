@@ -707,3 +707,54 @@ bool has_exc(int func_id) {
 
   return ans;
 }
+
+XCFunctionalPool::XCFunctionalPool() {
+}
+
+XCFunctionalPool::~XCFunctionalPool() {
+  clear();
+}
+
+xc_func_type * XCFunctionalPool::get(int func_id, int nspin, double thr, const std::vector<double> & pars) {
+  for(size_t i=0;i<funcs.size();i++)
+    if(funcs[i]->func_id==func_id && funcs[i]->nspin==nspin && funcs[i]->thr==thr && funcs[i]->pars==pars)
+      return &(funcs[i]->func);
+
+  entry_t *e = new entry_t;
+  e->func_id=func_id;
+  e->nspin=nspin;
+  e->thr=thr;
+  e->pars=pars;
+
+  if(xc_func_init(&(e->func), func_id, nspin) != 0) {
+    delete e;
+    std::ostringstream oss;
+    oss << "Functional "<<func_id<<" not found!";
+    throw std::runtime_error(oss.str());
+  }
+  // Set density threshold
+  xc_func_set_dens_threshold(&(e->func), thr);
+
+  // Set parameters
+  if(pars.size()) {
+    // Check sanity
+    if(pars.size() != (size_t) xc_func_info_get_n_ext_params((xc_func_info_type *) e->func.info)) {
+      xc_func_end(&(e->func));
+      delete e;
+      throw std::logic_error("Incompatible number of parameters!\n");
+    }
+    std::vector<double> phlp(pars);
+    xc_func_set_ext_params(&(e->func), phlp.data());
+  }
+
+  funcs.push_back(e);
+  return &(e->func);
+}
+
+void XCFunctionalPool::clear() {
+  for(size_t i=0;i<funcs.size();i++) {
+    xc_func_end(&(funcs[i]->func));
+    delete funcs[i];
+  }
+  funcs.clear();
+}
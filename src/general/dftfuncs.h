@@ -18,6 +18,12 @@
 #define ERKALE_DFTFUNCS
 
 #include <string>
+#include <vector>
+
+// LibXC
+extern "C" {
+#include <xc.h>
+}
 
 /// Struct for a functional
 typedef struct {
@@ -77,4 +83,43 @@ bool laplacian_needed(int func);
 /// Does functional have energy density implemented?
 bool has_exc(int func);
 
+/**
+ * Initialized libxc functionals that are kept around for reuse, so
+ * that repeated evaluations don't pay for xc_func_init and
+ * xc_func_end. The pool is not thread safe: use one per thread.
+ */
+class XCFunctionalPool {
+ private:
+  /// Initialized functional
+  typedef struct {
+    /// Functional id
+    int func_id;
+    /// Spin treatment
+    int nspin;
+    /// Density threshold
+    double thr;
+    /// External parameters
+    std::vector<double> pars;
+    /// libxc handle
+    xc_func_type func;
+  } entry_t;
+  /// Initialized functionals; pointers keep the handles at fixed addresses
+  std::vector<entry_t *> funcs;
+
+  /// Copying is not allowed
+  XCFunctionalPool(const XCFunctionalPool &);
+  XCFunctionalPool & operator=(const XCFunctionalPool &);
+
+ public:
+  /// Constructor
+  XCFunctionalPool();
+  /// Destructor
+  ~XCFunctionalPool();
+
+  /// Get a functional, initializing it on first use
+  xc_func_type * get(int func_id, int nspin, double thr, const std::vector<double> & pars);
+  /// Free all functionals
+  void clear();
+};
+
 #endif
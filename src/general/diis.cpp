@@ -17,8 +17,13 @@
 
 
 #include <cfloat>
+#include <sstream>
+#include <stdexcept>
 #include "diis.h"
 #include "lbfgs.h"
+#include "profiler.h"
+#include "memtrack.h"
+#include "checkpoint.h"
 
 // Maximum allowed absolute weight for a Fock matrix
 #define MAXWEIGHT 10.0
@@ -48,17 +53,100 @@ DIIS::DIIS(const arma::mat & S_, const arma::mat & Sinvh_, bool usediis_, double
 
   // No cooloff
   cooloff=0;
+  diiswlast=0.0;
+  // Full precision
+  single=false;
+}
+
+DIIS::DIIS(const arma::cube & S_, const arma::cube & Sinvh_, bool usediis_, double diiseps_, double diisthr_, bool useadiis_, bool verbose_, size_t imax_) {
+  usediis=usediis_;
+  useadiis=useadiis_;
+  verbose=verbose_;
+  imax=imax_;
+  diiseps=diiseps_;
+  diisthr=diisthr_;
+  cooloff=0;
+  diiswlast=0.0;
+  single=false;
+
+  if(S_.n_slices != Sinvh_.n_slices || S_.n_rows != Sinvh_.n_rows)
+    throw std::logic_error("Overlap and half-inverse overlap cubes are not compatible!\n");
+
+  // The dense matrices are never formed; each slice is its own block
+  blocks=helfem::blockmatrix::slice_idx(S_.n_rows,S_.n_slices);
+  Sblk=helfem::blockmatrix::BlockMatrix(S_,blocks);
+  Sinvh_blk.resize(Sinvh_.n_slices);
+  for(size_t i=0;i<Sinvh_.n_slices;i++)
+    Sinvh_blk[i]=Sinvh_.slice(i);
 }
 
 rDIIS::rDIIS(const arma::mat & S_, const arma::mat & Sinvh_, bool usediis_, double diiseps_, double diisthr_, bool useadiis_, bool verbose_, size_t imax_) : DIIS(S_,Sinvh_,usediis_,diiseps_,diisthr_,useadiis_,verbose_,imax_) {
 }
 
+rDIIS::rDIIS(const arma::cube & S_, const arma::cube & Sinvh_, bool usediis_, double diiseps_, double diisthr_, bool useadiis_, bool verbose_, size_t imax_) : DIIS(S_,Sinvh_,usediis_,diiseps_,diisthr_,useadiis_,verbose_,imax_) {
+}
+
 uDIIS::uDIIS(const arma::mat & S_, const arma::mat & Sinvh_, bool combine_, bool usediis_, double diiseps_, double diisthr_, bool useadiis_, bool verbose_, size_t imax_) : DIIS(S_,Sinvh_,usediis_,diiseps_,diisthr_,useadiis_,verbose_,imax_), combine(combine_) {
 }
 
+uDIIS::uDIIS(const arma::cube & S_, const arma::cube & Sinvh_, bool combine_, bool usediis_, double diiseps_, double diisthr_, bool useadiis_, bool verbose_, size_t imax_) : DIIS(S_,Sinvh_,usediis_,diiseps_,diisthr_,useadiis_,verbose_,imax_), combine(combine_) {
+}
+
 DIIS::~DIIS() {
 }
 
+void DIIS::set_single(bool single_) {
+  single=single_;
+}
+
+void DIIS::set_blocks(const std::vector<arma::uvec> & idx) {
+  if(S.empty())
+    throw std::logic_error("Symmetry blocks can only be set when the dense overlap matrix is known!\n");
+  clear();
+  blocks=helfem::blockmatrix::block_idx(idx);
+  Sblk=helfem::blockmatrix::BlockMatrix(S,blocks);
+  Sinvh_blk.clear();
+  if(!blocks)
+    return;
+
+  // Orthonormal vectors of each symmetry
+  for(size_t isym=0;isym<idx.size();isym++) {
+    arma::mat Scmp(Sinvh.rows(idx[isym]));
+    arma::vec Snrm(Scmp.n_cols);
+    for(size_t i=0;i<Snrm.n_elem;i++)
+      Snrm(i)=arma::norm(Scmp.col(i),"fro");
+    Sinvh_blk.push_back(Scmp.cols(arma::find(Snrm)));
+  }
+}
+
+arma::vec DIIS::error_vector(const helfem::blockmatrix::BlockMatrix & F, const helfem::blockmatrix::BlockMatrix & P) const {
+  if(!blocks) {
+    // Compute error matrix
+    arma::mat errmat(F.block(0)*P.block(0)*S);
+    // FPS - SPF
+    errmat-=arma::trans(errmat);
+    // and transform it to the orthonormal basis (1982 paper, page 557)
+    return arma::vectorise(arma::trans(Sinvh)*errmat*Sinvh);
+  }
+
+  // Same in the symmetry blocks
+  helfem::blockmatrix::BlockMatrix FPS(F*P*Sblk);
+  FPS=FPS-FPS.t();
+  size_t nerr=0;
+  for(size_t i=0;i<Sinvh_blk.size();i++)
+    nerr+=Sinvh_blk[i].n_cols*Sinvh_blk[i].n_cols;
+  arma::vec err(nerr);
+  size_t ioff=0;
+  for(size_t i=0;i<Sinvh_blk.size();i++) {
+    size_t n(Sinvh_blk[i].n_cols*Sinvh_blk[i].n_cols);
+    if(!n)
+      continue;
+    err.subvec(ioff,ioff+n-1)=arma::vectorise(arma::trans(Sinvh_blk[i])*FPS.block(i)*Sinvh_blk[i]);
+    ioff+=n;
+  }
+  return err;
+}
+
 rDIIS::~rDIIS() {
 }
 
@@ -67,38 +155,185 @@ uDIIS::~uDIIS() {
 
 void rDIIS::clear() {
   stack.clear();
+  PF.reset();
+  track_memory();
 }
 
 void uDIIS::clear() {
   stack.clear();
+  PF.reset();
+  track_memory();
+}
+
+void rDIIS::write(Checkpoint & chkpt, const std::string & prefix) const {
+  chkpt.write(prefix+"_n",(int) stack.size());
+  chkpt.write(prefix+"_cooloff",cooloff);
+  chkpt.write(prefix+"_E",arma::mat(get_energies()));
+  for(size_t i=0;i<stack.size();i++) {
+    std::ostringstream id;
+    id << prefix << "_" << i << "_";
+    chkpt.write(id.str()+"F",stack[i].F.dense());
+    chkpt.write(id.str()+"P",stack[i].P.dense());
+  }
+}
+
+void rDIIS::read(Checkpoint & chkpt, const std::string & prefix) {
+  int n;
+  chkpt.read(prefix+"_n",n);
+  arma::mat E;
+  chkpt.read(prefix+"_E",E);
+  if(E.n_elem != (size_t) n) {
+    std::ostringstream oss;
+    oss << "DIIS history " << prefix << " has " << E.n_elem << " energies for " << n << " entries!\n";
+    throw std::runtime_error(oss.str());
+  }
+
+  // Push the entries in their original order, as in uDIIS::read
+  clear();
+  for(int i=0;i<n;i++) {
+    std::ostringstream id;
+    id << prefix << "_" << i << "_";
+    arma::mat F, P;
+    chkpt.read(id.str()+"F",F);
+    chkpt.read(id.str()+"P",P);
+    double error;
+    update(F,P,E(i),error);
+  }
+  chkpt.read(prefix+"_cooloff",cooloff);
+}
+
+void uDIIS::write(Checkpoint & chkpt, const std::string & prefix) const {
+  chkpt.write(prefix+"_n",(int) stack.size());
+  chkpt.write(prefix+"_cooloff",cooloff);
+  chkpt.write(prefix+"_E",arma::mat(get_energies()));
+  for(size_t i=0;i<stack.size();i++) {
+    std::ostringstream id;
+    id << prefix << "_" << i << "_";
+    chkpt.write(id.str()+"Fa",stack[i].Fa.dense());
+    chkpt.write(id.str()+"Fb",stack[i].Fb.dense());
+    chkpt.write(id.str()+"Pa",stack[i].Pa.dense());
+    chkpt.write(id.str()+"Pb",stack[i].Pb.dense());
+  }
+}
+
+void uDIIS::read(Checkpoint & chkpt, const std::string & prefix) {
+  int n;
+  chkpt.read(prefix+"_n",n);
+  arma::mat E;
+  chkpt.read(prefix+"_E",E);
+  if(E.n_elem != (size_t) n) {
+    std::ostringstream oss;
+    oss << "DIIS history " << prefix << " has " << E.n_elem << " energies for " << n << " entries!\n";
+    throw std::runtime_error(oss.str());
+  }
+
+  // The entries are pushed in their original order, which recomputes
+  // the error vectors and the ADIIS products without any Fock builds
+  clear();
+  for(int i=0;i<n;i++) {
+    std::ostringstream id;
+    id << prefix << "_" << i << "_";
+    arma::mat Fa, Fb, Pa, Pb;
+    chkpt.read(id.str()+"Fa",Fa);
+    chkpt.read(id.str()+"Fb",Fb);
+    chkpt.read(id.str()+"Pa",Pa);
+    chkpt.read(id.str()+"Pb",Pb);
+    double error;
+    update(Fa,Fb,Pa,Pb,E(i),error);
+  }
+  chkpt.read(prefix+"_cooloff",cooloff);
+}
+
+void rDIIS::track_memory() const {
+  size_t n=0;
+  for(size_t i=0;i<stack.size();i++)
+    n+=stack[i].F.memory()+stack[i].P.memory()+stack[i].err.n_elem*sizeof(double);
+  helfem::memory::set("DIIS",n);
+}
+
+void uDIIS::track_memory() const {
+  size_t n=0;
+  for(size_t i=0;i<stack.size();i++)
+    n+=stack[i].Fa.memory()+stack[i].Fb.memory()+stack[i].Pa.memory()+stack[i].Pb.memory()+stack[i].err.n_elem*sizeof(double);
+  helfem::memory::set("DIIS",n);
 }
 
 void rDIIS::erase_last() {
-  stack.erase(stack.begin());
+  stack.pop_front();
+  PF_erase_first();
 }
 
 void uDIIS::erase_last() {
-  stack.erase(stack.begin());
+  stack.pop_front();
+  PF_erase_first();
+}
+
+double rDIIS::trPF(size_t i, size_t j) const {
+  return stack[i].P.dot(stack[j].F);
+}
+
+double uDIIS::trPF(size_t i, size_t j) const {
+  return stack[i].Pa.dot(stack[j].Fa) + stack[i].Pb.dot(stack[j].Fb);
+}
+
+void DIIS::PF_add() {
+  // Only the products with the newest entry need to be computed
+  size_t n(PF.n_rows);
+  PF.resize(n+1,n+1);
+  for(size_t i=0;i<=n;i++)
+    PF(i,n)=trPF(i,n);
+  for(size_t j=0;j<n;j++)
+    PF(n,j)=trPF(n,j);
+}
+
+void DIIS::PF_erase_first() {
+  if(PF.n_rows>1)
+    PF=PF.submat(1,1,PF.n_rows-1,PF.n_cols-1);
+  else
+    PF.reset();
+}
+
+void DIIS::PiF_update() {
+  const size_t n(PF.n_rows-1);
+
+  // < P_i - P_n | F_n >
+  PiF.zeros(PF.n_rows);
+  for(size_t i=0;i<PF.n_rows;i++)
+    PiF(i)=PF(i,n)-PF(n,n);
+
+  // < P_i - P_n | F_j - F_n >
+  PiFj.zeros(PF.n_rows,PF.n_rows);
+  for(size_t i=0;i<PF.n_rows;i++)
+    for(size_t j=0;j<PF.n_rows;j++)
+      PiFj(i,j)=PF(i,j)-PF(i,n)-PF(n,j)+PF(n,n);
 }
 
 void rDIIS::update(const arma::mat & F, const arma::mat & P, double E, double & error) {
+  helfem::profiler::Region prof("DIIS/update");
+  // New entry
+  diis_unpol_entry_t hlp;
+  hlp.F=helfem::blockmatrix::BlockMatrix(F,blocks);
+  hlp.P=helfem::blockmatrix::BlockMatrix(P,blocks);
+  hlp.E=E;
+  push(hlp,error);
+}
+
+void rDIIS::update(const arma::cube & F, const arma::cube & P, double E, double & error) {
+  helfem::profiler::Region prof("DIIS/update");
   // New entry
   diis_unpol_entry_t hlp;
-  hlp.F=F;
-  hlp.P=P;
+  hlp.F=helfem::blockmatrix::BlockMatrix(F,blocks);
+  hlp.P=helfem::blockmatrix::BlockMatrix(P,blocks);
   hlp.E=E;
+  push(hlp,error);
+}
 
-  // Compute error matrix
-  arma::mat errmat(F*P*S);
-  // FPS - SPF
-  errmat-=arma::trans(errmat);
-  // and transform it to the orthonormal basis (1982 paper, page 557)
-  errmat=arma::trans(Sinvh)*errmat*Sinvh;
-  // and store it
-  hlp.err=arma::vectorise(errmat);
+void rDIIS::push(diis_unpol_entry_t & hlp, double & error) {
+  // Compute and store error
+  hlp.err=error_vector(hlp.F,hlp.P);
 
   // DIIS error is
-  error=arma::max(arma::max(arma::abs(errmat)));
+  error=arma::max(arma::abs(hlp.err));
 
   // Is stack full?
   if(stack.size()==imax) {
@@ -108,49 +343,53 @@ void rDIIS::update(const arma::mat & F, const arma::mat & P, double E, double &
   stack.push_back(hlp);
 
   // Update ADIIS helpers
+  PF_add();
   PiF_update();
-}
-
-void rDIIS::PiF_update() {
-  const arma::mat & Fn=stack[stack.size()-1].F;
-  const arma::mat & Pn=stack[stack.size()-1].P;
-
-  // Update matrices
-  PiF.zeros(stack.size());
-  for(size_t i=0;i<stack.size();i++)
-    PiF(i)=arma::trace((stack[i].P-Pn)*Fn);
 
-  PiFj.zeros(stack.size(),stack.size());
-  for(size_t i=0;i<stack.size();i++)
-    for(size_t j=0;j<stack.size();j++)
-      PiFj(i,j)=arma::trace((stack[i].P-Pn)*(stack[j].F-Fn));
+  // The products with the new entry have been computed in full
+  // precision, so it can now be compressed
+  if(single) {
+    stack.back().F.to_single();
+    stack.back().P.to_single();
+  }
+  track_memory();
 }
 
 void uDIIS::update(const arma::mat & Fa, const arma::mat & Fb, const arma::mat & Pa, const arma::mat & Pb, double E, double & error) {
+  helfem::profiler::Region prof("DIIS/update");
+  // New entry
+  diis_pol_entry_t hlp;
+  hlp.Fa=helfem::blockmatrix::BlockMatrix(Fa,blocks);
+  hlp.Fb=helfem::blockmatrix::BlockMatrix(Fb,blocks);
+  hlp.Pa=helfem::blockmatrix::BlockMatrix(Pa,blocks);
+  hlp.Pb=helfem::blockmatrix::BlockMatrix(Pb,blocks);
+  hlp.E=E;
+  push(hlp,error);
+}
+
+void uDIIS::update(const arma::cube & Fa, const arma::cube & Fb, const arma::cube & Pa, const arma::cube & Pb, double E, double & error) {
+  helfem::profiler::Region prof("DIIS/update");
   // New entry
   diis_pol_entry_t hlp;
-  hlp.Fa=Fa;
-  hlp.Fb=Fb;
-  hlp.Pa=Pa;
-  hlp.Pb=Pb;
+  hlp.Fa=helfem::blockmatrix::BlockMatrix(Fa,blocks);
+  hlp.Fb=helfem::blockmatrix::BlockMatrix(Fb,blocks);
+  hlp.Pa=helfem::blockmatrix::BlockMatrix(Pa,blocks);
+  hlp.Pb=helfem::blockmatrix::BlockMatrix(Pb,blocks);
   hlp.E=E;
+  push(hlp,error);
+}
 
-  // Compute error matrices
-  arma::mat errmata(Fa*Pa*S);
-  arma::mat errmatb(Fb*Pb*S);
-  // FPS - SPF
-  errmata-=arma::trans(errmata);
-  errmatb-=arma::trans(errmatb);
-  // and transform them to the orthonormal basis (1982 paper, page 557)
-  errmata=arma::trans(Sinvh)*errmata*Sinvh;
-  errmatb=arma::trans(Sinvh)*errmatb*Sinvh;
-  // and store it
+void uDIIS::push(diis_pol_entry_t & hlp, double & error) {
+  // Compute error vectors
+  arma::vec erra(error_vector(hlp.Fa,hlp.Pa));
+  arma::vec errb(error_vector(hlp.Fb,hlp.Pb));
+  // and store them
   if(combine) {
-    hlp.err=arma::vectorise(errmata+errmatb);
+    hlp.err=erra+errb;
   } else {
-    hlp.err.zeros(errmata.n_elem+errmatb.n_elem);
-    hlp.err.subvec(0,errmata.n_elem-1)=arma::vectorise(errmata);
-    hlp.err.subvec(errmata.n_elem,hlp.err.n_elem-1)=arma::vectorise(errmatb);
+    hlp.err.zeros(erra.n_elem+errb.n_elem);
+    hlp.err.subvec(0,erra.n_elem-1)=erra;
+    hlp.err.subvec(erra.n_elem,hlp.err.n_elem-1)=errb;
   }
 
   // DIIS error is
@@ -164,24 +403,18 @@ void uDIIS::update(const arma::mat & Fa, const arma::mat & Fb, const arma::mat &
   stack.push_back(hlp);
 
   // Update ADIIS helpers
+  PF_add();
   PiF_update();
-}
-
-void uDIIS::PiF_update() {
-  const arma::mat & Fan=stack[stack.size()-1].Fa;
-  const arma::mat & Fbn=stack[stack.size()-1].Fb;
-  const arma::mat & Pan=stack[stack.size()-1].Pa;
-  const arma::mat & Pbn=stack[stack.size()-1].Pb;
 
-  // Update matrices
-  PiF.zeros(stack.size());
-  for(size_t i=0;i<stack.size();i++)
-    PiF(i)=arma::trace((stack[i].Pa-Pan)*Fan) + arma::trace((stack[i].Pb-Pbn)*Fbn);
-
-  PiFj.zeros(stack.size(),stack.size());
-  for(size_t i=0;i<stack.size();i++)
-    for(size_t j=0;j<stack.size();j++)
-      PiFj(i,j)=arma::trace((stack[i].Pa-Pan)*(stack[j].Fa-Fan))+arma::trace((stack[i].Pb-Pbn)*(stack[j].Fb-Fbn));
+  // The products with the new entry have been computed in full
+  // precision, so it can now be compressed
+  if(single) {
+    stack.back().Fa.to_single();
+    stack.back().Fb.to_single();
+    stack.back().Pa.to_single();
+    stack.back().Pb.to_single();
+  }
+  track_memory();
 }
 
 arma::vec rDIIS::get_energies() const {
@@ -221,6 +454,7 @@ arma::vec DIIS::get_w() {
 
   if(useadiis && !usediis) {
     w=get_w_adiis();
+    diiswlast=0.0;
     if(verbose) {
       printf("ADIIS weights\n");
       w.t().print();
@@ -231,6 +465,7 @@ arma::vec DIIS::get_w() {
       throw std::runtime_error("DIIS error too large for only DIIS to converge wave function.\n");
 
     w=get_w_diis();
+    diiswlast=1.0;
 
     if(verbose) {
       printf("DIIS weights\n");
@@ -256,6 +491,7 @@ arma::vec DIIS::get_w() {
     }
 
     w.zeros(de.n_cols);
+    diiswlast=diisw;
 
     // DIIS and ADIIS weights
     arma::vec wd, wa;
@@ -286,9 +522,18 @@ arma::vec DIIS::get_w() {
   } else
     throw std::runtime_error("Nor DIIS or ADIIS has been turned on.\n");
 
+  wlast=w;
   return w;
 }
 
+const arma::vec & DIIS::get_last_weights() const {
+  return wlast;
+}
+
+double DIIS::get_last_diis_fraction() const {
+  return diiswlast;
+}
+
 arma::vec DIIS::get_w_diis() const {
   arma::mat errs=get_diis_error();
   return get_w_diis_wrk(errs);
@@ -371,81 +616,105 @@ arma::vec DIIS::get_w_diis_wrk(const arma::mat & errs) const {
   return sol;
 }
 
-void rDIIS::solve_F(arma::mat & F) {
+arma::vec DIIS::get_w_solve() {
   arma::vec sol;
   while(true) {
     sol=get_w();
     if(std::abs(sol(sol.n_elem-1))<=sqrt(DBL_EPSILON)) {
-      if(verbose) printf("Weight on last matrix too small, reducing to %i matrices.\n",(int) stack.size()-1);
+      if(verbose) printf("Weight on last matrix too small, reducing to %i matrices.\n",(int) sol.n_elem-1);
       erase_last();
       PiF_update();
     } else
       break;
   }
+  return sol;
+}
+
+void rDIIS::solve_F(arma::mat & F) {
+  helfem::profiler::Region prof("DIIS/solve");
+  arma::vec sol(get_w_solve());
 
   // Form weighted Fock matrix
   F.zeros();
   for(size_t i=0;i<stack.size();i++)
-    F+=sol(i)*stack[i].F;
+    stack[i].F.add_to(F,sol(i));
 }
 
 void uDIIS::solve_F(arma::mat & Fa, arma::mat & Fb) {
-  arma::vec sol;
-  while(true) {
-    sol=get_w();
-    if(std::abs(sol(sol.n_elem-1))<=sqrt(DBL_EPSILON)) {
-      if(verbose) printf("Weight on last matrix too small, reducing to %i matrices.\n",(int) stack.size()-1);
-      erase_last();
-      PiF_update();
-    } else
-      break;
-  }
+  helfem::profiler::Region prof("DIIS/solve");
+  arma::vec sol(get_w_solve());
 
   // Form weighted Fock matrix
   Fa.zeros();
   Fb.zeros();
   for(size_t i=0;i<stack.size();i++) {
-    Fa+=sol(i)*stack[i].Fa;
-    Fb+=sol(i)*stack[i].Fb;
+    stack[i].Fa.add_to(Fa,sol(i));
+    stack[i].Fb.add_to(Fb,sol(i));
   }
 }
 
 void rDIIS::solve_P(arma::mat & P) {
-  arma::vec sol;
-  while(true) {
-    sol=get_w();
-    if(std::abs(sol(sol.n_elem-1))<=sqrt(DBL_EPSILON)) {
-      if(verbose) printf("Weight on last matrix too small, reducing to %i matrices.\n",(int) stack.size()-1);
-      erase_last();
-      PiF_update();
-    } else
-      break;
-  }
+  arma::vec sol(get_w_solve());
 
   // Form weighted density matrix
   P.zeros();
   for(size_t i=0;i<stack.size();i++)
-    P+=sol(i)*stack[i].P;
+    stack[i].P.add_to(P,sol(i));
 }
 
 void uDIIS::solve_P(arma::mat & Pa, arma::mat & Pb) {
-  arma::vec sol;
-  while(true) {
-    sol=get_w();
-    if(std::abs(sol(sol.n_elem-1))<=sqrt(DBL_EPSILON)) {
-      if(verbose) printf("Weight on last matrix too small, reducing to %i matrices.\n",(int) stack.size()-1);
-      erase_last();
-      PiF_update();
-    } else
-      break;
-  }
+  arma::vec sol(get_w_solve());
 
   // Form weighted density matrix
   Pa.zeros();
   Pb.zeros();
   for(size_t i=0;i<stack.size();i++) {
-    Pa+=sol(i)*stack[i].Pa;
-    Pb+=sol(i)*stack[i].Pb;
+    stack[i].Pa.add_to(Pa,sol(i));
+    stack[i].Pb.add_to(Pb,sol(i));
+  }
+}
+
+void rDIIS::solve_F(arma::cube & F) {
+  helfem::profiler::Region prof("DIIS/solve");
+  arma::vec sol(get_w_solve());
+
+  // Form weighted Fock matrix slice by slice
+  F.zeros();
+  for(size_t i=0;i<stack.size();i++)
+    stack[i].F.add_to(F,sol(i));
+}
+
+void uDIIS::solve_F(arma::cube & Fa, arma::cube & Fb) {
+  helfem::profiler::Region prof("DIIS/solve");
+  arma::vec sol(get_w_solve());
+
+  // Form weighted Fock matrix slice by slice
+  Fa.zeros();
+  Fb.zeros();
+  for(size_t i=0;i<stack.size();i++) {
+    stack[i].Fa.add_to(Fa,sol(i));
+    stack[i].Fb.add_to(Fb,sol(i));
+  }
+}
+
+void rDIIS::solve_P(arma::cube & P) {
+  arma::vec sol(get_w_solve());
+
+  // Form weighted density matrix slice by slice
+  P.zeros();
+  for(size_t i=0;i<stack.size();i++)
+    stack[i].P.add_to(P,sol(i));
+}
+
+void uDIIS::solve_P(arma::cube & Pa, arma::cube & Pb) {
+  arma::vec sol(get_w_solve());
+
+  // Form weighted density matrix slice by slice
+  Pa.zeros();
+  Pb.zeros();
+  for(size_t i=0;i<stack.size();i++) {
+    stack[i].Pa.add_to(Pa,sol(i));
+    stack[i].Pb.add_to(Pb,sol(i));
   }
 }
 
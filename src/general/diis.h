@@ -19,18 +19,22 @@
 #define ERKALE_DIIS
 
 #include <armadillo>
+#include <deque>
 #include <vector>
+#include "blockmatrix.h"
+
+class Checkpoint;
 
 /// Spin-polarized entry
 typedef struct {
   /// Alpha density matrix
-  arma::mat Pa;
+  helfem::blockmatrix::BlockMatrix Pa;
   /// Alpha Fock matrix
-  arma::mat Fa;
+  helfem::blockmatrix::BlockMatrix Fa;
   /// Beta density matrix
-  arma::mat Pb;
+  helfem::blockmatrix::BlockMatrix Pb;
   /// Beta Fock matrix
-  arma::mat Fb;
+  helfem::blockmatrix::BlockMatrix Fb;
   /// Energy
   double E;
 
@@ -41,9 +45,9 @@ typedef struct {
 /// Spin-unpolarized entry
 typedef struct {
   /// Density matrix
-  arma::mat P;
+  helfem::blockmatrix::BlockMatrix P;
   /// Fock matrix
-  arma::mat F;
+  helfem::blockmatrix::BlockMatrix F;
   /// Energy
   double E;
 
@@ -106,6 +110,18 @@ class DIIS {
   /// Half-inverse overlap matrix
   arma::mat Sinvh;
 
+  /// Store the history in single precision?
+  bool single;
+  /// Symmetry blocks of the matrices; empty for dense storage
+  helfem::blockmatrix::block_idx_t blocks;
+  /// Overlap matrix in the symmetry blocks
+  helfem::blockmatrix::BlockMatrix Sblk;
+  /// Half-inverse overlap matrix in the symmetry blocks; the columns are the orthonormal vectors of the symmetry
+  std::vector<arma::mat> Sinvh_blk;
+
+  /// Compute the error vector FPS - SPF in the orthonormal basis
+  arma::vec error_vector(const helfem::blockmatrix::BlockMatrix & F, const helfem::blockmatrix::BlockMatrix & P) const;
+
   /// Use DIIS?
   bool usediis;
   /// Use ADIIS?
@@ -119,6 +135,10 @@ class DIIS {
   double diisthr;
   /// Counter for not using DIIS
   int cooloff;
+  /// Weights of the last extrapolation
+  arma::vec wlast;
+  /// Fraction of DIIS, as opposed to ADIIS, in the last extrapolation
+  double diiswlast;
 
   /// Maximum amount of matrices to store
   size_t imax;
@@ -130,6 +150,16 @@ class DIIS {
   virtual void erase_last()=0;
 
   // Helpers for speeding up ADIIS evaluation
+  /// Cached < P_i | F_j >   or   < Pa_i | Fa_j > + < Pb_i | Fb_j > over the stack
+  arma::mat PF;
+  /// Compute < P_i | F_j >   or   < Pa_i | Fa_j > + < Pb_i | Fb_j >
+  virtual double trPF(size_t i, size_t j) const=0;
+  /// Add the row and column of the newest entry to the cached products
+  void PF_add();
+  /// Remove the oldest entry from the cached products
+  void PF_erase_first();
+  /// ADIIS update from the cached products
+  void PiF_update();
   /// < P_i - P_n | F(D_n) >   or   < Pa_i - Pa_n | Fa(P_n) > + < Pb_i - Pb_n | Fb(P_n) >
   arma::vec PiF;
   /// < P_i - P_n | F(D_j) - F(D_n) >   or    < Pa_i - Pa_n | Fa(P_j) - Fa(P_n) > + < Pb_i - Pb_n | Fb(P_j) - Fb(P_n) >
@@ -137,6 +167,8 @@ class DIIS {
 
   /// Compute weights
   arma::vec get_w();
+  /// Compute weights, dropping old matrices until the newest one has a significant weight
+  arma::vec get_w_solve();
   /// Compute DIIS weights
   arma::vec get_w_diis() const;
   /// Compute DIIS weights, worker routine
@@ -150,22 +182,38 @@ class DIIS {
  public:
   /// Constructor
   DIIS(const arma::mat & S, const arma::mat & Sinvh, bool usediis, double diiseps, double diisthr, bool useadiis, bool verbose, size_t imax);
+  /// Constructor for matrices that are block diagonal in the slices of a cube, e.g. the l channels of an atom
+  DIIS(const arma::cube & S, const arma::cube & Sinvh, bool usediis, double diiseps, double diisthr, bool useadiis, bool verbose, size_t imax);
   /// Destructor
   virtual ~DIIS();
 
   /// Clear Fock matrices and errors
   virtual void clear()=0;
+  /// Write the history into a checkpoint under the given prefix
+  virtual void write(Checkpoint & chkpt, const std::string & prefix) const=0;
+  /// Read the history from a checkpoint under the given prefix
+  virtual void read(Checkpoint & chkpt, const std::string & prefix)=0;
+
+  /// Store the matrices in the given symmetry blocks, in which they must be block diagonal. This clears the stack
+  void set_blocks(const std::vector<arma::uvec> & idx);
+  /// Store the Fock and density matrices of the history in single precision
+  void set_single(bool single);
 
   /// Compute energy with contraction coefficients \f$ c_i = x_i^2 / \left[ \sum_j x_j^2 \right] \f$
   double get_E_adiis(const arma::vec & x) const;
   /// Compute derivative of energy wrt contraction coefficients
   arma::vec get_dEdx_adiis(const arma::vec & x) const;
+
+  /// Get the weights of the last extrapolation, newest entry last
+  const arma::vec & get_last_weights() const;
+  /// Get the fraction of DIIS in the last extrapolation; the rest is ADIIS
+  double get_last_diis_fraction() const;
 };
 
 /// Spin-restricted DIIS
 class rDIIS: protected DIIS {
   /// Fock matrices in AO basis
-  std::vector<diis_unpol_entry_t> stack;
+  std::deque<diis_unpol_entry_t> stack;
 
   /// Get energies
   arma::vec get_energies() const;
@@ -173,32 +221,58 @@ class rDIIS: protected DIIS {
   arma::mat get_diis_error() const;
   /// Reduce size of stack by one
   void erase_last();
-  /// ADIIS update
-  void PiF_update();
+  /// Compute < P_i | F_j >
+  double trPF(size_t i, size_t j) const;
+  /// Record the memory used by the history
+  void track_memory() const;
+  /// Add entry to stack
+  void push(diis_unpol_entry_t & hlp, double & error);
 
  public:
   /// Constructor
   rDIIS(const arma::mat & S, const arma::mat & Sinvh, bool usediis, double diiseps, double diisthr, bool useadiis, bool verbose, size_t imax);
+  /// Constructor for slice-blocked matrices
+  rDIIS(const arma::cube & S, const arma::cube & Sinvh, bool usediis, double diiseps, double diisthr, bool useadiis, bool verbose, size_t imax);
   /// Destructor
   ~rDIIS();
 
   /// Add matrices to stack
   void update(const arma::mat & F, const arma::mat & P, double E, double & error);
+  /// Add slice-blocked matrices to stack
+  void update(const arma::cube & F, const arma::cube & P, double E, double & error);
 
   /// Compute new Fock matrix
   void solve_F(arma::mat & F);
+  /// Compute new slice-blocked Fock matrix
+  void solve_F(arma::cube & F);
 
   /// Compute new density matrix
   void solve_P(arma::mat & P);
+  /// Compute new slice-blocked density matrix
+  void solve_P(arma::cube & P);
 
   /// Clear Fock matrices and errors
   void clear();
+
+  /// Write the history into a checkpoint under the given prefix
+  void write(Checkpoint & chkpt, const std::string & prefix) const;
+  /// Read the history from a checkpoint; the errors and the ADIIS helpers are recomputed from the stored matrices
+  void read(Checkpoint & chkpt, const std::string & prefix);
+
+  /// Store the matrices in symmetry blocks
+  using DIIS::set_blocks;
+  /// Store the matrices in single precision
+  using DIIS::set_single;
+  /// Weights of the last extrapolation
+  using DIIS::get_last_weights;
+  /// Fraction of DIIS in the last extrapolation
+  using DIIS::get_last_diis_fraction;
 };
 
 /// Spin-unrestricted DIIS
 class uDIIS: protected DIIS {
   /// Fock matrices in AO basis - spin polarized
-  std::vector<diis_pol_entry_t> stack;
+  std::deque<diis_pol_entry_t> stack;
 
   /// Get energies
   arma::vec get_energies() const;
@@ -206,8 +280,12 @@ class uDIIS: protected DIIS {
   arma::mat get_diis_error() const;
   /// Reduce size of stack by one
   void erase_last();
-  /// ADIIS update
-  void PiF_update();
+  /// Compute < Pa_i | Fa_j > + < Pb_i | Fb_j >
+  double trPF(size_t i, size_t j) const;
+  /// Record the memory used by the history
+  void track_memory() const;
+  /// Add entry to stack
+  void push(diis_pol_entry_t & hlp, double & error);
 
   /// Combine alpha and beta errors?
   bool combine;
@@ -215,20 +293,42 @@ class uDIIS: protected DIIS {
  public:
   /// Constructor
   uDIIS(const arma::mat & S, const arma::mat & Sinvh, bool combine, bool usediis, double diiseps, double diisthr, bool useadiis, bool verbose, size_t imax);
+  /// Constructor for slice-blocked matrices
+  uDIIS(const arma::cube & S, const arma::cube & Sinvh, bool combine, bool usediis, double diiseps, double diisthr, bool useadiis, bool verbose, size_t imax);
   /// Destructor
   ~uDIIS();
 
   /// Add matrices to stack
   void update(const arma::mat & Fa, const arma::mat & Fb, const arma::mat & Pa, const arma::mat & Pb, double E, double & error);
+  /// Add slice-blocked matrices to stack
+  void update(const arma::cube & Fa, const arma::cube & Fb, const arma::cube & Pa, const arma::cube & Pb, double E, double & error);
 
   /// Compute new Fock matrix
   void solve_F(arma::mat & Fa, arma::mat & Fb);
+  /// Compute new slice-blocked Fock matrix
+  void solve_F(arma::cube & Fa, arma::cube & Fb);
 
   /// Compute new density matrix
   void solve_P(arma::mat & Pa, arma::mat & Pb);
+  /// Compute new slice-blocked density matrix
+  void solve_P(arma::cube & Pa, arma::cube & Pb);
 
   /// Clear Fock matrices and errors
   void clear();
+
+  /// Write the history into a checkpoint under the given prefix
+  void write(Checkpoint & chkpt, const std::string & prefix) const;
+  /// Read the history from a checkpoint; the errors and the ADIIS helpers are recomputed from the stored matrices
+  void read(Checkpoint & chkpt, const std::string & prefix);
+
+  /// Store the matrices in symmetry blocks
+  using DIIS::set_blocks;
+  /// Store the matrices in single precision
+  using DIIS::set_single;
+  /// Weights of the last extrapolation
+  using DIIS::get_last_weights;
+  /// Fraction of DIIS in the last extrapolation
+  using DIIS::get_last_diis_fraction;
 };
 
 #endif
@@ -0,0 +1,146 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#include "eigensolver.h"
+#include "mpi_helpers.h"
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#ifdef HELFEM_SCALAPACK
+extern "C" {
+  void Cblacs_get(int context, int request, int * value);
+  void Cblacs_gridinit(int * context, const char * order, int nprow, int npcol);
+  void Cblacs_gridinfo(int context, int * nprow, int * npcol, int * myrow, int * mycol);
+  void Cblacs_gridexit(int context);
+  int numroc_(const int * n, const int * nb, const int * iproc, const int * isrcproc, const int * nprocs);
+  void descinit_(int * desc, const int * m, const int * n, const int * mb, const int * nb, const int * irsrc, const int * icsrc, const int * ictxt, const int * lld, int * info);
+  void pdsyevd_(const char * jobz, const char * uplo, const int * n, double * a, const int * ia, const int * ja, const int * desca, double * w, double * z, const int * iz, const int * jz, const int * descz, double * work, const int * lwork, int * iwork, const int * liwork, int * info);
+}
+#endif
+
+namespace helfem {
+  namespace scf {
+    /// Chosen backend
+    static eig_backend_t eig_backend=EIG_LAPACK;
+    /// Smallest dimension solved with the backend
+    static size_t eig_nmin=0;
+
+    eig_backend_t parse_eig_backend(const std::string & name) {
+      if(name=="lapack")
+        return EIG_LAPACK;
+      if(name=="scalapack") {
+#ifndef HELFEM_SCALAPACK
+        throw std::logic_error("HelFEM has been compiled without ScaLAPACK support.\n");
+#endif
+        return EIG_SCALAPACK;
+      }
+      std::ostringstream oss;
+      oss << "Unknown eigensolver " << name << "!\n";
+      throw std::logic_error(oss.str());
+    }
+
+    void set_eig_backend(eig_backend_t backend, size_t nmin) {
+      eig_backend=backend;
+      eig_nmin=nmin;
+    }
+
+    bool eig_distributed(size_t n) {
+      return eig_backend==EIG_SCALAPACK && mpi::size()>1 && n>=eig_nmin;
+    }
+
+#ifdef HELFEM_SCALAPACK
+    /// Solve the replicated matrix A with pdsyevd on a square-ish process grid; the eigenpairs are replicated on all ranks on return
+    static bool eig_scalapack(arma::vec & E, arma::mat & C, const arma::mat & A) {
+      const int N(A.n_rows);
+      const int nb(64);
+      const int izero(0), ione(1);
+
+      // Largest grid that fits in the ranks; the ranks left over
+      // only take part in the reductions
+      int nprow((int) std::sqrt((double) mpi::size()));
+      int npcol(mpi::size()/nprow);
+      int ctxt;
+      Cblacs_get(0,0,&ctxt);
+      Cblacs_gridinit(&ctxt,"Row",nprow,npcol);
+      int myrow=-1, mycol=-1;
+      if(mpi::rank()<nprow*npcol)
+        Cblacs_gridinfo(ctxt,&nprow,&npcol,&myrow,&mycol);
+
+      E.zeros(N);
+      C.zeros(N,N);
+      double info_sum=0.0;
+      if(myrow>=0) {
+        // Local parts of the block-cyclic distribution. Every rank
+        // already holds the whole matrix, so no scatter is needed.
+        const int locr(numroc_(&N,&nb,&myrow,&izero,&nprow));
+        const int locc(numroc_(&N,&nb,&mycol,&izero,&npcol));
+        const int lld(std::max(1,locr));
+        int desc[9];
+        int info;
+        descinit_(desc,&N,&N,&nb,&nb,&izero,&izero,&ctxt,&lld,&info);
+
+        arma::mat Aloc(lld,std::max(1,locc));
+        arma::mat Zloc(lld,std::max(1,locc));
+        std::vector<size_t> grow(locr), gcol(locc);
+        for(int li=0;li<locr;li++)
+          grow[li]=(size_t) ((li/nb)*nb*nprow + myrow*nb + li%nb);
+        for(int lj=0;lj<locc;lj++)
+          gcol[lj]=(size_t) ((lj/nb)*nb*npcol + mycol*nb + lj%nb);
+        for(int lj=0;lj<locc;lj++)
+          for(int li=0;li<locr;li++)
+            Aloc(li,lj)=A(grow[li],gcol[lj]);
+
+        // Workspace query
+        arma::vec w(N);
+        double lwork_opt;
+        int liwork_opt;
+        const int mone(-1);
+        pdsyevd_("V","U",&N,Aloc.memptr(),&ione,&ione,desc,w.memptr(),Zloc.memptr(),&ione,&ione,desc,&lwork_opt,&mone,&liwork_opt,&mone,&info);
+        int lwork((int) lwork_opt);
+        int liwork(liwork_opt);
+        std::vector<double> work(std::max(1,lwork));
+        std::vector<int> iwork(std::max(1,liwork));
+        pdsyevd_("V","U",&N,Aloc.memptr(),&ione,&ione,desc,w.memptr(),Zloc.memptr(),&ione,&ione,desc,work.data(),&lwork,iwork.data(),&liwork,&info);
+        info_sum=std::abs((double) info);
+
+        // Assemble the eigenvectors; the eigenvalues are known to
+        // the whole grid, so they are only contributed once
+        for(int lj=0;lj<locc;lj++)
+          for(int li=0;li<locr;li++)
+            C(grow[li],gcol[lj])=Zloc(li,lj);
+        if(myrow==0 && mycol==0)
+          E=w;
+        Cblacs_gridexit(ctxt);
+      }
+
+      mpi::allreduce(C);
+      mpi::allreduce(E);
+      mpi::allreduce(info_sum);
+      return info_sum==0.0;
+    }
+#endif
+
+    bool eig_sym_dense(arma::vec & E, arma::mat & C, const arma::mat & A) {
+#ifdef HELFEM_SCALAPACK
+      if(eig_distributed(A.n_rows))
+        return eig_scalapack(E,C,A);
+#endif
+      return arma::eig_sym(E,C,A);
+    }
+  }
+}
@@ -0,0 +1,44 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#ifndef EIGENSOLVER_H
+#define EIGENSOLVER_H
+
+#include <armadillo>
+#include <string>
+
+namespace helfem {
+  namespace scf {
+    /// Backends for dense symmetric eigenproblems
+    enum eig_backend_t {
+      /// LAPACK through Armadillo on every process
+      EIG_LAPACK,
+      /// ScaLAPACK pdsyevd over all the MPI ranks
+      EIG_SCALAPACK
+    };
+
+    /// Parse the name of a backend
+    eig_backend_t parse_eig_backend(const std::string & name);
+    /// Set the backend used for matrices of dimension nmin or more; smaller ones are always solved with LAPACK
+    void set_eig_backend(eig_backend_t backend, size_t nmin);
+    /// Is a matrix of dimension n solved with the distributed backend? All MPI ranks have to call eig_sym_dense for such matrices in the same order, from outside parallel regions
+    bool eig_distributed(size_t n);
+
+    /// Full eigendecomposition of the symmetric matrix A with the chosen backend, eigenvalues in ascending order. Returns false if it failed
+    bool eig_sym_dense(arma::vec & E, arma::mat & C, const arma::mat & A);
+  }
+}
+
+#endif
@@ -15,6 +15,11 @@
  */
 #include <cstdio>
 #include <cmath>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <sstream>
+#include <stdexcept>
 #include "gaunt.h"
 
 extern "C" {
@@ -67,88 +72,228 @@ namespace helfem {
       return const0*cpl0+const2*cpl2;
     }
 
-    Gaunt::Gaunt() {
+    /// Schulten-Gordon recursion coefficient A(j1)
+    static double sg_A(int j1, int j2, int j3, int m1) {
+      return std::sqrt(((double) (j1*j1-(j2-j3)*(j2-j3)))*((double) ((j2+j3+1)*(j2+j3+1)-j1*j1))*((double) (j1*j1-m1*m1)));
     }
 
-    Gaunt::Gaunt(int Lmax, int lmax, int lpmax) {
-      // Allocate storage
-      mlimit=false;
-      table=arma::cube(genind(Lmax,Lmax)+1,genind(lmax,lmax)+1,genind(lpmax,lpmax)+1);
+    /// Schulten-Gordon recursion coefficient B(j1)
+    static double sg_B(int j1, int j2, int j3, int m1, int m2, int m3) {
+      return -(2.0*j1+1.0)*(((double) j2*(j2+1)-(double) j3*(j3+1))*m1 - ((double) j1*(j1+1))*(m3-m2));
+    }
 
-      // Compute coefficients
-#ifdef _OPENMP
-#pragma omp parallel for collapse(3)
-#endif
-      for(int L=0;L<=Lmax;L++)
-	  for(int l=0;l<=lmax;l++)
-            for(int lp=0;lp<=lpmax;lp++)
-              for(int M=-L;M<=L;M++)
-                for(int m=-l;m<=l;m++)
-                  for(int mp=-lp;mp<=lp;mp++)
-                    table(genind(L,M),genind(l,m),genind(lp,mp))=gaunt_coefficient(L,M,l,m,lp,mp);
+    void threej_range(int j2, int j3, int m2, int m3, int & j1min, arma::vec & f) {
+      const int m1(-m2-m3);
+      j1min=std::max(std::abs(j2-j3),std::abs(m1));
+      const int j1max(j2+j3);
+      if(std::abs(m2)>j2 || std::abs(m3)>j3 || j1max<j1min) {
+        f.reset();
+        return;
+      }
+      const int n(j1max-j1min+1);
+
+      // Backward recursion from j1max, where A(j1max+1) vanishes
+      arma::vec g(n+1,arma::fill::zeros);
+      g(n-1)=1.0;
+      for(int i=n-1;i>0;i--) {
+        int j1(j1min+i);
+        g(i-1)=-(sg_B(j1,j2,j3,m1,m2,m3)*g(i) + j1*sg_A(j1+1,j2,j3,m1)*g(i+1))/((j1+1)*sg_A(j1,j2,j3,m1));
+      }
+      f=g.subvec(0,n-1);
+
+      // The backward recursion loses accuracy in the classically
+      // forbidden region at small j1, where the forward recursion from
+      // j1min is stable. It can't be started from j1min=0, though.
+      const int imid(n/2);
+      if(j1min>0 && imid>0) {
+        arma::vec h(std::min(imid+2,n),arma::fill::zeros);
+        h(0)=1.0;
+        h(1)=-sg_B(j1min,j2,j3,m1,m2,m3)*h(0)/(j1min*sg_A(j1min+1,j2,j3,m1));
+        for(int i=1;i+1<(int) h.n_elem;i++) {
+          int j1(j1min+i);
+          h(i+1)=-(sg_B(j1,j2,j3,m1,m2,m3)*h(i) + (j1+1)*sg_A(j1,j2,j3,m1)*h(i-1))/(j1*sg_A(j1+1,j2,j3,m1));
+        }
+        // Match the solutions around the midpoint; some of the
+        // values may vanish by symmetry
+        double hh=0.0, hg=0.0;
+        for(int i=std::max(imid-1,0);i<(int) h.n_elem;i++) {
+          hh+=h(i)*h(i);
+          hg+=h(i)*g(i);
+        }
+        if(hh>0.0)
+          f.subvec(0,imid)=h.subvec(0,imid)*(hg/hh);
+      }
+
+      // Normalize
+      double norm=0.0;
+      for(int i=0;i<n;i++)
+        norm+=(2.0*(j1min+i)+1.0)*f(i)*f(i);
+      f/=std::sqrt(norm);
+      // and fix the phase: the sign of the j1max symbol is (-1)^(j2-j3-m1)
+      if(((j2-j3-m1)%2==0) != (f(n-1)>0.0))
+        f*=-1.0;
     }
 
-    Gaunt::Gaunt(int Lmax, int Mmax_, int lmax, int mmax_, int lpmax, int mpmax_) : Mmax(Mmax_), mmax(mmax_), mpmax(mpmax_) {
-      // Allocate storage
-      mlimit=true;
-      table=arma::cube(LMind(Lmax,Mmax)+1,lmind(lmax,mmax)+1,lpmpind(lpmax,mpmax)+1);
+    NonzeroIterator::NonzeroIterator(const double * val_, int L_, int M_) : val(val_), L(L_), M(M_) {
+    }
 
-      // Compute coefficients
-#ifdef _OPENMP
-#pragma omp parallel for collapse(3)
-#endif
-      for(int L=0;L<=Lmax;L++)
-	  for(int l=0;l<=lmax;l++)
-            for(int lp=0;lp<=lpmax;lp++)
-              for(int M=-Mmax;M<=Mmax;M++)
-                for(int m=-mmax;m<=mmax;m++)
-                  for(int mp=-mpmax;mp<=mpmax;mp++)
-                    table(LMind(L,M),lmind(l,m),lpmpind(lp,mp))=gaunt_coefficient(L,M,l,m,lp,mp);
+    nonzero_t NonzeroIterator::operator*() const {
+      nonzero_t ret;
+      ret.L=L;
+      ret.M=M;
+      ret.c=*val;
+      return ret;
+    }
+
+    NonzeroIterator & NonzeroIterator::operator++() {
+      val++;
+      L+=2;
+      return *this;
+    }
+
+    bool NonzeroIterator::operator!=(const NonzeroIterator & rhs) const {
+      return val!=rhs.val;
+    }
+
+    NonzeroRange::NonzeroRange(const double * val_, int Lmin_, size_t n_, int M_) : val(val_), Lmin(Lmin_), n(n_), M(M_) {
+    }
+
+    NonzeroIterator NonzeroRange::begin() const {
+      return NonzeroIterator(val,Lmin,M);
+    }
+
+    NonzeroIterator NonzeroRange::end() const {
+      return NonzeroIterator(val+n,Lmin+2*n,M);
+    }
+
+    size_t NonzeroRange::size() const {
+      return n;
+    }
+
+    Gaunt::Gaunt() : mlimit(false), Lmax(-1), lmax(-1), lpmax(-1), Mmax(0), mmax(0), mpmax(0) {
+    }
+
+    Gaunt::Gaunt(int Lmax_, int lmax_, int lpmax_) : mlimit(false), Lmax(Lmax_), lmax(lmax_), lpmax(lpmax_), Mmax(Lmax_), mmax(lmax_), mpmax(lpmax_) {
+      fill();
+    }
+
+    Gaunt::Gaunt(int Lmax_, int Mmax_, int lmax_, int mmax_, int lpmax_, int mpmax_) : mlimit(true), Lmax(Lmax_), lmax(lmax_), lpmax(lpmax_), Mmax(Mmax_), mmax(mmax_), mpmax(mpmax_) {
+      fill();
     }
 
     Gaunt::~Gaunt() {
     }
 
+    size_t Gaunt::pair_index(int l, int m, int lp, int mp) const {
+      if(mlimit)
+        return lmind(l,m)*(lpmpind(lpmax,mpmax)+1) + lpmpind(lp,mp);
+      else
+        return genind(l,m)*(genind(lpmax,lpmax)+1) + genind(lp,mp);
+    }
+
+    int Gaunt::Lmin(int l, int m, int lp, int mp) const {
+      int L(std::max(std::abs(l-lp),std::abs(m+mp)));
+      // (L l l' | 0 0 0) vanishes unless L+l+l' is even
+      if((L+l+lp)%2)
+        L++;
+      return L;
+    }
+
+    void Gaunt::fill() {
+      // Count the allowed coefficients
+      offset.assign(pair_index(lmax,mlimit ? mmax : lmax,lpmax,mlimit ? mpmax : lpmax)+2,0);
+      for(int l=0;l<=lmax;l++)
+        for(int m=(mlimit ? -mmax : -l);m<=(mlimit ? mmax : l);m++)
+          for(int lp=0;lp<=lpmax;lp++)
+            for(int mp=(mlimit ? -mpmax : -lp);mp<=(mlimit ? mpmax : lp);mp++) {
+              if(std::abs(m)>l || std::abs(mp)>lp || std::abs(m+mp)>Mmax)
+                continue;
+              int L0(Lmin(l,m,lp,mp));
+              int L1(std::min(l+lp,Lmax));
+              if(L1>=L0)
+                offset[pair_index(l,m,lp,mp)+1]=(L1-L0)/2+1;
+            }
+      for(size_t i=1;i<offset.size();i++)
+        offset[i]+=offset[i-1];
+      values.assign(offset.back(),0.0);
+
+      // Compute the coefficients by recursion over L
+#ifdef _OPENMP
+#pragma omp parallel for collapse(2) schedule(dynamic,1)
+#endif
+      for(int l=0;l<=lmax;l++)
+        for(int lp=0;lp<=lpmax;lp++) {
+          // (L l l' | 0 0 0)
+          int L00;
+          arma::vec f00;
+          threej_range(l,lp,0,0,L00,f00);
+
+          arma::vec fM;
+          for(int m=(mlimit ? -mmax : -l);m<=(mlimit ? mmax : l);m++)
+            for(int mp=(mlimit ? -mpmax : -lp);mp<=(mlimit ? mpmax : lp);mp++) {
+              size_t ip(pair_index(l,m,lp,mp));
+              size_t n(offset[ip+1]-offset[ip]);
+              if(!n)
+                continue;
+
+              // (L l l' | -M m m')
+              int M(m+mp);
+              int LM0;
+              threej_range(l,lp,m,mp,LM0,fM);
+
+              int L0(Lmin(l,m,lp,mp));
+              for(size_t i=0;i<n;i++) {
+                int L(L0+2*i);
+                double res=sqrt((2*L+1)*(2*l+1)*(2*lp+1)/(4.0*M_PI));
+                res*=f00(L-L00)*fM(L-LM0);
+                if(M%2)
+                  res=-res;
+                values[offset[ip]+i]=res;
+              }
+            }
+        }
+    }
+
     double Gaunt::coeff(int L, int M, int l, int m, int lp, int mp) const {
       if(std::abs(M)>L) return 0.0;
       if(std::abs(m)>l) return 0.0;
       if(std::abs(mp)>lp) return 0.0;
 
-      size_t irow, icol, islice;
-      if(mlimit) {
-        irow=LMind(L,M);
-        icol=lmind(l,m);
-        islice=lpmpind(lp,mp);
-      } else {
-        irow=genind(L,M);
-        icol=genind(l,m);
-        islice=genind(lp,mp);
-      }
-
 #ifndef ARMA_NO_DEBUG
-      if(irow>table.n_rows) {
+      if(L>Lmax || l>lmax || lp>lpmax || (mlimit && (std::abs(M)>Mmax || std::abs(m)>mmax || std::abs(mp)>mpmax))) {
         std::ostringstream oss;
-        oss << "Row index overflow for coeff(" << L << "," << M << "," << l << "," << m << "," << lp << "," << mp << ")!\n";
-        oss << "Wanted element at (" << irow << "," << icol << "," << islice << ") but table is " << table.n_rows << " x " << table.n_cols << " x " << table.n_slices << "\n";
+        oss << "Index overflow for coeff(" << L << "," << M << "," << l << "," << m << "," << lp << "," << mp << ")!\n";
+        oss << "Table has Lmax = " << Lmax << ", lmax = " << lmax << ", lpmax = " << lpmax;
+        if(mlimit)
+          oss << ", Mmax = " << Mmax << ", mmax = " << mmax << ", mpmax = " << mpmax;
+        oss << "\n";
         throw std::logic_error(oss.str());
       }
+#endif
 
-      if(icol>table.n_cols) {
-        std::ostringstream oss;
-        oss << "Column index overflow for coeff(" << L << "," << M << "," << l << "," << m << "," << lp << "," << mp << ")!\n";
-        oss << "Wanted element at (" << irow << "," << icol << "," << islice << ") but table is " << table.n_rows << " x " << table.n_cols << " x " << table.n_slices << "\n";
-        throw std::logic_error(oss.str());
-      }
+      // Selection rules
+      if(M != m+mp)
+        return 0.0;
+      int L0(Lmin(l,m,lp,mp));
+      if(L<L0 || (L-L0)%2)
+        return 0.0;
 
-      if(islice>table.n_slices) {
-        std::ostringstream oss;
-        oss << "Slice index overflow for coeff(" << L << "," << M << "," << l << "," << m << "," << lp << "," << mp << ")!\n";
-        oss << "Wanted element at (" << irow << "," << icol << "," << islice << ") but table is " << table.n_rows << " x " << table.n_cols << " x " << table.n_slices << "\n";
-        throw std::logic_error(oss.str());
-      }
-#endif
+      size_t ip(pair_index(l,m,lp,mp));
+      size_t i((L-L0)/2);
+      if(offset[ip]+i>=offset[ip+1])
+        return 0.0;
+      return values[offset[ip]+i];
+    }
+
+    NonzeroRange Gaunt::nonzero(int l, int m, int lp, int mp) const {
+      if(std::abs(m)>l || std::abs(mp)>lp || l>lmax || lp>lpmax || (mlimit && (std::abs(m)>mmax || std::abs(mp)>mpmax)))
+        return NonzeroRange(NULL,0,0,m+mp);
+      size_t ip(pair_index(l,m,lp,mp));
+      return NonzeroRange(values.data()+offset[ip],Lmin(l,m,lp,mp),offset[ip+1]-offset[ip],m+mp);
+    }
 
-      return table(irow,icol,islice);
+    size_t Gaunt::size() const {
+      return values.size();
     }
 
     double Gaunt::cosine_coupling(int lj, int mj, int li, int mi) const {
@@ -216,5 +361,18 @@ namespace helfem {
       static const double const4(-16.0/105.0*sqrt(M_PI));
       return const0*coeff(lj,mj,0,0,li,mi) + const2*coeff(lj,mj,2,0,li,mi) + const4*coeff(lj,mj,4,0,li,mi);
     }
+
+    std::shared_ptr<const Gaunt> shared_table(int Lmax, int lmax, int lpmax) {
+      // The sparse tables are small, so they are kept for the
+      // lifetime of the process
+      static std::map< std::tuple<int,int,int>, std::shared_ptr<const Gaunt> > cache;
+      static std::mutex cache_lock;
+
+      std::lock_guard<std::mutex> lock(cache_lock);
+      std::shared_ptr<const Gaunt> & entry(cache[std::make_tuple(Lmax,lmax,lpmax)]);
+      if(!entry)
+        entry=std::make_shared<const Gaunt>(Lmax,lmax,lpmax);
+      return entry;
+    }
   }
 }
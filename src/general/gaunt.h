@@ -17,6 +17,8 @@
 #define GAUNT
 
 #include <armadillo>
+#include <memory>
+#include <vector>
 
 namespace helfem {
   namespace gaunt {
@@ -29,15 +31,86 @@ namespace helfem {
     /// Get "modified" Gaunt coefficient (interim coupling through cos^2)
     double modified_gaunt_coefficient(int L, int M, int l, int m, int lp, int mp);
 
-    /// Table of Gaunt coefficients
+    /**
+     * Computes the 3j symbols \f$ \begin{pmatrix} j_1 & j_2 & j_3 \\ m_1 & m_2 & m_3 \end{pmatrix} \f$
+     * with \f$ m_1 = -m_2 - m_3 \f$ for all allowed \f$ j_1 \f$ by the
+     * Schulten-Gordon recursion. On return f(i) holds the symbol for
+     * \f$ j_1 = j_{1,\rm min} + i \f$.
+     */
+    void threej_range(int j2, int j3, int m2, int m3, int & j1min, arma::vec & f);
+
+    /// Nonzero Gaunt coefficient
+    typedef struct {
+      /// L value
+      int L;
+      /// M value
+      int M;
+      /// Coefficient
+      double c;
+    } nonzero_t;
+
+    /// Iterator over the nonzero Gaunt coefficients for fixed (l,m,l',m')
+    class NonzeroIterator {
+      /// Pointer to the coefficient
+      const double * val;
+      /// Current L
+      int L;
+      /// M value
+      int M;
+    public:
+      /// Constructor
+      NonzeroIterator(const double * val, int L, int M);
+      /// Get the entry
+      nonzero_t operator*() const;
+      /// Advance to the next coefficient
+      NonzeroIterator & operator++();
+      /// Comparison
+      bool operator!=(const NonzeroIterator & rhs) const;
+    };
+
+    /// Range of the nonzero Gaunt coefficients for fixed (l,m,l',m')
+    class NonzeroRange {
+      /// First coefficient
+      const double * val;
+      /// First L
+      int Lmin;
+      /// Number of coefficients
+      size_t n;
+      /// M value
+      int M;
+    public:
+      /// Constructor
+      NonzeroRange(const double * val, int Lmin, size_t n, int M);
+      /// Start of range
+      NonzeroIterator begin() const;
+      /// End of range
+      NonzeroIterator end() const;
+      /// Number of nonzero coefficients
+      size_t size() const;
+    };
+
+    /// Table of Gaunt coefficients. Only the coefficients allowed by
+    /// the selection rules are stored: for fixed (l,m,l',m') these
+    /// are M=m+m' and L=Lmin, Lmin+2, ..., l+l'.
     class Gaunt {
-      /// Table of coefficients
-      arma::cube table;
+      /// Nonzero coefficients
+      std::vector<double> values;
+      /// Offset of the coefficients of the (l,m,l',m') pairs
+      std::vector<size_t> offset;
       /// Limited m set
       bool mlimit;
+      /// Maximum l values
+      int Lmax, lmax, lpmax;
       /// Maximum m values
       int Mmax, mmax, mpmax;
 
+      /// Index of the (l,m) and (l',m') pair
+      size_t pair_index(int l, int m, int lp, int mp) const;
+      /// Smallest L that couples to (l,m,l',m')
+      int Lmin(int l, int m, int lp, int mp) const;
+      /// Fill in the table
+      void fill();
+
     public:
       /// Dummy constructor
       Gaunt();
@@ -52,6 +125,10 @@ namespace helfem {
       double coeff(int L, int M, int l, int m, int lp, int mp) const;
       /// Get "modified" Gaunt coefficient (interim coupling through cos^2)
       double mod_coeff(int L, int M, int l, int m, int lp, int mp) const;
+      /// Get the nonzero coefficients for fixed (l,m,l',m')
+      NonzeroRange nonzero(int l, int m, int lp, int mp) const;
+      /// Number of stored coefficients
+      size_t size() const;
 
       /// Get cosine type coupling
       double cosine_coupling(int lj, int mj, int li, int mi) const;
@@ -69,6 +146,9 @@ namespace helfem {
       /// Get cosine^2 sine^2 type coupling
       double cosine2_sine2_coupling(int lj, int mj, int li, int mi) const;
     };
+
+    /// Get a table from the process-wide cache, so that tables of the same size are built only once
+    std::shared_ptr<const Gaunt> shared_table(int Lmax, int lmax, int lpmax);
   }
 }
 
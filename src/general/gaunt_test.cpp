@@ -1,4 +1,5 @@
 #include <cfloat>
+#include <gsl/gsl_sf_coupling.h>
 #include "gaunt.h"
 
 int main(void) {
@@ -1653,5 +1654,49 @@ int main(void) {
   val=helfem::gaunt::modified_gaunt_coefficient(10,0,4,0,4,0);
   ref=5.8774027291321862e-02;
   if(std::abs(val-ref)>=DBL_EPSILON*(1.0+std::abs(ref))) printf("mod_coeff(10,0,4,0,4,0) value %e reference %e error %e\n",val,ref,val-ref);
-return 0;
+
+  // The table is built by the 3j recursion; compare it against the
+  // closed-form coefficients over all small (L,M), (l,m), (l',m')
+  int nfail=0;
+  const int lmax=4;
+  helfem::gaunt::Gaunt table(2*lmax,lmax,lmax);
+  for(int l=0;l<=lmax;l++)
+    for(int m=-l;m<=l;m++)
+      for(int lp=0;lp<=lmax;lp++)
+        for(int mp=-lp;mp<=lp;mp++)
+          for(int L=0;L<=2*lmax;L++)
+            for(int M=-L;M<=L;M++) {
+              val=table.coeff(L,M,l,m,lp,mp);
+              ref=helfem::gaunt::gaunt_coefficient(L,M,l,m,lp,mp);
+              if(std::abs(val-ref)>=10*DBL_EPSILON*(1.0+std::abs(ref))) {
+                printf("table(%i,%i,%i,%i,%i,%i) value %e reference %e error %e\n",L,M,l,m,lp,mp,val,ref,val-ref);
+                nfail++;
+              }
+            }
+
+  // 3j symbols from the recursion against the closed form
+  for(int j2=0;j2<=lmax;j2++)
+    for(int j3=0;j3<=lmax;j3++)
+      for(int m2=-j2;m2<=j2;m2++)
+        for(int m3=-j3;m3<=j3;m3++) {
+          int j1min;
+          arma::vec f;
+          helfem::gaunt::threej_range(j2,j3,m2,m3,j1min,f);
+          for(size_t i=0;i<f.n_elem;i++) {
+            int j1(j1min+(int) i);
+            val=f(i);
+            ref=gsl_sf_coupling_3j(2*j1,2*j2,2*j3,-2*(m2+m3),2*m2,2*m3);
+            if(std::abs(val-ref)>=10*DBL_EPSILON*(1.0+std::abs(ref))) {
+              printf("threej(%i,%i,%i,%i,%i,%i) value %e reference %e error %e\n",j1,j2,j3,-m2-m3,m2,m3,val,ref,val-ref);
+              nfail++;
+            }
+          }
+        }
+
+  if(nfail) {
+    printf("%i table entries differ from the closed form!\n",nfail);
+    return 1;
+  }
+  printf("Gaunt table and 3j recursion agree with the closed form.\n");
+  return 0;
 }
@@ -37,10 +37,7 @@ namespace helfem {
     }
 
     arma::vec Z_GSZ(const arma::vec & r, double Z, double d_Z, double H_Z) {
-      arma::vec Zv(r.n_elem);
-      for(size_t i=0;i<r.n_elem;i++)
-        Zv[i]=Z_GSZ(r(i),Z,d_Z,H_Z);
-      return Zv;
+      return 1.0 + (Z-1)/(1.0 + (arma::exp(r/d_Z) - 1.0)*H_Z);
     }
 
     arma::vec Z_GSZ(const arma::vec & r, int Z) {
@@ -59,11 +56,13 @@ namespace helfem {
     }
 
     arma::vec Z_thomasfermi(const arma::vec & r, int Z) {
-      arma::vec Zeff(r.n_elem);
-      for(size_t i=0;i<r.n_elem;i++) {
-        Zeff(i)=Z_thomasfermi(r(i),Z);
-      }
-      return Zeff;
+      // Same as above, with the square root evaluated once per point
+      const double alpha = 0.7280642371;
+      const double beta = -0.5430794693;
+      const double gamma = 0.3612163121;
+      arma::vec x(r*cbrt(128*Z/(9.0*M_PI*M_PI)));
+      arma::vec sx(arma::sqrt(x));
+      return Z*arma::square(1 + alpha*sx + beta*x%arma::exp(-gamma*sx))%arma::exp(-2*alpha*sx);
     }
 
   }
@@ -17,29 +17,60 @@
  */
 
 #include "lbfgs.h"
+#include <cfloat>
+#include <stdexcept>
 
-LBFGS::LBFGS(size_t nmax_) : nmax(nmax_) {
+LBFGS::LBFGS(size_t nmax_) : nmax(nmax_), npair(0), inew(0) {
 }
 
 LBFGS::~LBFGS() {
 }
 
-void LBFGS::update(const arma::vec & x, const arma::vec & g) {
-  xk.push_back(x);
-  gk.push_back(g);
+size_t LBFGS::slot(size_t i) const {
+  const size_t ncap(Smat.n_cols);
+  return (inew+ncap+1-npair+i)%ncap;
+}
 
-  if(xk.size()>nmax) {
-    xk.erase(xk.begin());
-    gk.erase(gk.begin());
+void LBFGS::update(const arma::vec & x, const arma::vec & g) {
+  if(x.n_elem != g.n_elem)
+    throw std::logic_error("LBFGS: coordinates and gradient have different lengths!\n");
+  if(xlast.n_elem && xlast.n_elem != x.n_elem)
+    throw std::logic_error("LBFGS: dimension of the problem changed; the history needs to be cleared!\n");
+
+  const size_t ncap(nmax>1 ? nmax-1 : 0);
+  if(xlast.n_elem && ncap) {
+    arma::vec s(x-xlast);
+    arma::vec y(g-glast);
+    // Pairs without positive curvature would make the update
+    // indefinite, and are not stored
+    if(arma::dot(s,y) > DBL_EPSILON*arma::norm(s,2)*arma::norm(y,2)) {
+      if(!Smat.n_cols) {
+        Smat.zeros(x.n_elem,ncap);
+        Ymat.zeros(x.n_elem,ncap);
+        SY.zeros(ncap,ncap);
+        inew=ncap-1;
+      }
+      // The oldest pair is overwritten once the buffer is full
+      inew=(inew+1)%ncap;
+      Smat.col(inew)=s;
+      Ymat.col(inew)=y;
+      npair=std::min(npair+1,ncap);
+
+      // Only the row and column of the new pair change
+      SY.row(inew)=arma::trans(arma::trans(Ymat)*s);
+      SY.col(inew)=arma::trans(Smat)*y;
+    }
   }
+
+  xlast=x;
+  glast=g;
 }
 
 arma::vec LBFGS::apply_diagonal_hessian(const arma::vec & q) const {
-  if(xk.size()>=2) {
-    arma::vec s=xk[xk.size()-1]-xk[xk.size()-2];
-    arma::vec y=gk[gk.size()-1]-gk[gk.size()-2];
-
-    return arma::dot(s,y)/arma::dot(y,y)*q;
+  if(npair) {
+    double sy(SY(inew,inew));
+    double yy(arma::dot(Ymat.col(inew),Ymat.col(inew)));
+    return sy/yy*q;
 
   } else
     // Unit diagonal Hessian
@@ -47,45 +78,66 @@ arma::vec LBFGS::apply_diagonal_hessian(const arma::vec & q) const {
 }
 
 arma::vec LBFGS::solve() const {
-  // Algorithm 9.1 in Nocedal's book
-  size_t k=gk.size()-1;
-  arma::vec q(gk[k]);
-
-  std::vector<arma::vec> sk(k);
-  for(size_t i=0;i<k;i++)
-    sk[i]=xk[i+1]-xk[i];
-  std::vector<arma::vec> yk(k);
-  for(size_t i=0;i<k;i++)
-    yk[i]=gk[i+1]-gk[i];
-
-  // Alpha_i
-  std::vector<double> alphai(k);
-
-  // First part
-  for(size_t i=k-1;i<k;i--) {
-    // Alpha_i
-    alphai[i]=arma::dot(sk[i],q)/arma::dot(yk[i],sk[i]);
-    // Update q
-    q-=alphai[i]*yk[i];
+  /*
+    Compact representation of the inverse Hessian (Byrd, Nocedal and
+    Schnabel, Math. Program. 63, 129 (1994), eq. 2.6)
+
+    H = H0 + [S H0Y] [ R^-T (D + Y^T H0 Y) R^-1   -R^-T ] [ S^T    ]
+                     [ -R^-1                          0 ] [ Y^T H0 ]
+
+    where R is the upper triangle of S^T Y and D its diagonal. The
+    history only enters through products with the whole ring buffers,
+    and S^T Y is kept up to date by update().
+  */
+  const arma::vec & g(glast);
+  arma::vec r(apply_diagonal_hessian(g));
+  if(!npair)
+    return r;
+
+  // The first m columns of the ring buffers hold the pairs
+  const size_t m(npair);
+  // Pairs from oldest to newest
+  arma::uvec ord(m);
+  for(size_t i=0;i<m;i++)
+    ord(i)=slot(i);
+
+  arma::vec p1, p2;
+  arma::mat YHY(m,m);
+  {
+    arma::vec Sg(arma::trans(Smat.head_cols(m))*g);
+    arma::vec YHg(arma::trans(Ymat.head_cols(m))*r);
+    p1=Sg(ord);
+    p2=YHg(ord);
+    for(size_t j=0;j<m;j++) {
+      arma::vec hy(apply_diagonal_hessian(Ymat.col(ord(j))));
+      arma::vec yhy(arma::trans(Ymat.head_cols(m))*hy);
+      YHY.col(j)=yhy(ord);
+    }
   }
 
-  // Apply diagonal Hessian
-  arma::vec r(apply_diagonal_hessian(q));
+  arma::mat SYo(SY(ord,ord));
+  arma::mat R(arma::trimatu(SYo));
+  arma::vec D(arma::diagvec(SYo));
 
-  // Second part
-  for(size_t i=0;i<k;i++) {
-    // Beta
-    double beta=arma::dot(yk[i],r)/arma::dot(yk[i],sk[i]);
-    // Update r
-    r+=sk[i]*(alphai[i]-beta);
-  }
+  // t = R^-1 p1, u = R^-T ((D + Y^T H0 Y) t - p2)
+  arma::vec t(arma::solve(arma::trimatu(R),p1));
+  arma::vec u(arma::solve(arma::trimatl(arma::trans(R)),(arma::diagmat(D)+YHY)*t-p2));
+
+  // r = H0 g + S u - H0 Y t, with the coefficients in ring order
+  arma::vec uslot(m), tslot(m);
+  uslot(ord)=u;
+  tslot(ord)=t;
+  r+=Smat.head_cols(m)*uslot-apply_diagonal_hessian(Ymat.head_cols(m)*tslot);
 
   return r;
 }
 
 void LBFGS::clear() {
-  xk.clear();
-  gk.clear();
+  Smat.clear();
+  Ymat.clear();
+  SY.clear();
+  npair=0;
+  inew=0;
+  xlast.clear();
+  glast.clear();
 }
-
-
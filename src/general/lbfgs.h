@@ -23,14 +23,22 @@
 
 class LBFGS {
  protected:
-  /// Maximum number of matrices
+  /// Maximum number of points; the history holds the differences of nmax-1 pairs
   size_t nmax;
 
-  /// Coordinates x_k
-  std::vector<arma::vec> xk;
-  /// Gradients g_k
-  std::vector<arma::vec> gk;
-
+  /// Ring buffers of the coordinate and gradient differences s_i and y_i, one pair per column
+  arma::mat Smat, Ymat;
+  /// Inner products s_i^T y_j between the columns of the ring buffers
+  arma::mat SY;
+  /// Number of stored pairs
+  size_t npair;
+  /// Column of the newest pair
+  size_t inew;
+  /// Coordinates x_k and gradient g_k of the last update
+  arma::vec xlast, glast;
+
+  /// Column of the i:th oldest pair
+  size_t slot(size_t i) const;
   /// Apply diagonal Hessian: r = H_0 q
   virtual arma::vec apply_diagonal_hessian(const arma::vec & q) const;
 
@@ -14,7 +14,9 @@
  * of the License, or (at your option) any later version.
  */
 #include "lcao.h"
+#include <cfloat>
 #include <cmath>
+#include <limits>
 
 // For factorials
 extern "C" {
@@ -30,16 +32,86 @@ namespace helfem {
       return gsl_sf_fact(n);
     }
 
+    /// Largest argument for which exp(-x) does not underflow to zero
+    static const double exp_cutoff(-std::log(std::numeric_limits<double>::denorm_min()));
+
+    /// Integer power of the radii by repeated multiplication
+    static arma::vec radial_power(const arma::vec & r, int l) {
+      arma::vec rl(arma::ones<arma::vec>(r.n_elem));
+      for(int i=0;i<l;i++)
+        rl%=r;
+      return rl;
+    }
+
+    /// Step of the exponents if they form an increasing arithmetic progression, zero otherwise
+    static double arithmetic_step(const arma::vec & a) {
+      if(a.n_elem<3)
+        return 0.0;
+      double d((a(a.n_elem-1)-a(0))/(a.n_elem-1));
+      if(d<=0.0)
+        return 0.0;
+      double tol(16*DBL_EPSILON*arma::max(arma::abs(a)));
+      for(size_t k=1;k<a.n_elem;k++)
+        if(std::abs(a(k)-a(0)-k*d)>tol)
+          return 0.0;
+      return d;
+    }
+
+    /** Evaluates exp(-x_i a_k) for all points and exponents. For an
+        arithmetic progression of exponents, exp(-x a_k) = exp(-x a_0)
+        exp(-x d)^k so two exponentials per point suffice; the values
+        decrease along the recursion, which is therefore stable. For
+        other sets, e.g. even-tempered ones, the exponents are visited
+        in increasing order, and the evaluation stops at the first one
+        for which the exponential underflows.
+    */
+    static arma::mat exp_table(const arma::vec & x, const arma::vec & a) {
+      arma::mat E(x.n_elem,a.n_elem);
+      if(!a.n_elem)
+        return E;
+
+      double d(arithmetic_step(a));
+      if(d>0.0) {
+        arma::vec step(arma::exp(-d*x));
+        E.col(0)=arma::exp(-a(0)*x);
+        for(size_t k=1;k<a.n_elem;k++)
+          E.col(k)=E.col(k-1)%step;
+        return E;
+      }
+
+      arma::uvec order(arma::sort_index(a));
+      E.zeros();
+      for(size_t k=0;k<order.n_elem;k++) {
+        const double ak(a(order(k)));
+        double * Ek(E.colptr(order(k)));
+        size_t nactive(0);
+        for(size_t i=0;i<x.n_elem;i++) {
+          double arg(ak*x(i));
+          if(arg<exp_cutoff) {
+            Ek[i]=std::exp(-arg);
+            nactive++;
+          }
+        }
+        // The remaining exponents are even larger
+        if(!nactive)
+          break;
+      }
+      return E;
+    }
+
     /// Evaluate radial GTO
     double radial_GTO(double r, int l, double alpha) {
       return std::pow(2,l+2) * std::pow(alpha,(2*l+3)/4.0) * std::pow(r,l) * exp(-alpha*r*r) / ( std::pow(2.0*M_PI,0.25) * sqrt(double_factorial(2*l+1)));
     }
 
     arma::mat radial_GTO(const arma::vec & r, int l, const arma::vec & alpha) {
-      arma::mat gto(r.n_elem, alpha.n_elem);
-      for(size_t j=0;j<alpha.n_elem;j++)
-        for(size_t i=0;i<r.n_elem;i++)
-          gto(i,j)=radial_GTO(r(i),l,alpha(j));
+      // Normalization factors
+      arma::rowvec norm(arma::trans(std::pow(2,l+2) * arma::pow(alpha,(2*l+3)/4.0) / ( std::pow(2.0*M_PI,0.25) * sqrt(double_factorial(2*l+1)))));
+
+      arma::mat gto(exp_table(arma::square(r),alpha));
+      if(l>0)
+        gto.each_col() %= radial_power(r,l);
+      gto.each_row() %= norm;
       return gto;
     }
 
@@ -48,12 +120,15 @@ namespace helfem {
       return std::pow(2*zeta,l+1.5)/sqrt(factorial(2*l+2)) * std::pow(r,l) * exp(-zeta*r);
     }
 
-    arma::mat radial_STO(const arma::vec & r, int l, const arma::vec & alpha) {
-      arma::mat gto(r.n_elem, alpha.n_elem);
-      for(size_t j=0;j<alpha.n_elem;j++)
-        for(size_t i=0;i<r.n_elem;i++)
-          gto(i,j)=radial_STO(r(i),l,alpha(j));
-      return gto;
+    arma::mat radial_STO(const arma::vec & r, int l, const arma::vec & zeta) {
+      // Normalization factors
+      arma::rowvec norm(arma::trans(arma::pow(2*zeta,l+1.5)/sqrt(factorial(2*l+2))));
+
+      arma::mat sto(exp_table(r,zeta));
+      if(l>0)
+        sto.each_col() %= radial_power(r,l);
+      sto.each_row() %= norm;
+      return sto;
     }
   }
 }
@@ -15,121 +15,298 @@
  */
 #include "legendretable.h"
 #include <algorithm>
+#include <cfloat>
 #include "../legendre/Legendre_Wrapper.h"
 
+// Smallest padding tried when it is chosen automatically
+#define MINPAD 4
+// Arguments from which on the Legendre functions are evaluated from
+// the series; the terms decrease at least as fast as 1/xi^2 once k
+// exceeds about l+m over xi^2
+#define QASYM_XI 3.0
+// Maximal number of terms in the series
+#define QASYM_MAXTERMS 500
+
 namespace helfem {
   namespace legendretable {
-    bool operator<(const legendre_table_t & lh, const legendre_table_t & rh) {
-      return lh.xi < rh.xi;
+    void regular_Plm(double xi, int Lmax, int Mmax, arma::mat & P) {
+      P.zeros(Lmax+1,Mmax+1);
+      const double sxi(std::sqrt(xi*xi-1.0));
+      // P_mm = (2m-1)!! (xi^2-1)^(m/2)
+      double Pmm(1.0);
+      for(int m=0;m<=std::min(Mmax,Lmax);m++) {
+        if(m>0)
+          Pmm*=(2*m-1)*sxi;
+        P(m,m)=Pmm;
+        if(m<Lmax)
+          P(m+1,m)=(2*m+1)*xi*Pmm;
+        // (l+1-m) P_(l+1)m = (2l+1) xi P_lm - (l+m) P_(l-1)m, which is
+        // stable upwards for xi>1
+        for(int l=m+1;l<Lmax;l++)
+          P(l+1,m)=((2*l+1)*xi*P(l,m)-(l+m)*P(l-1,m))/(l+1-m);
+      }
+    }
+
+    bool asymptotic_Qlm(double xi, int Lmax, int Mmax, arma::mat & Q) {
+      /*
+        Q_lm(xi) = (-1)^m sqrt(pi) Gamma(l+m+1) / (2^(l+1) Gamma(l+3/2))
+                   xi^(-l-m-1) (xi^2-1)^(m/2)
+                   2F1((l+m+2)/2, (l+m+1)/2; l+3/2; 1/xi^2),
+        see DLMF 14.3.7. All the terms of the hypergeometric series
+        are positive, so the sum is free of cancellation, and the
+        prefactor is built up by products so that it does not
+        overflow before the value does.
+      */
+      Q.zeros(Lmax+1,Mmax+1);
+      const double xinv(1.0/xi);
+      const double xinv2(xinv*xinv);
+      const double s(std::sqrt(1.0-xinv2));
+
+      // Prefactor for m=0: (l!/(2l+1)!!) xi^(-l-1)
+      double pref0(xinv);
+      for(int l=0;l<=Lmax;l++) {
+        if(l>0)
+          pref0*=l*xinv/(2*l+1);
+        double pref(pref0);
+        for(int m=0;m<=Mmax;m++) {
+          if(m>0)
+            pref*=-(l+m)*s;
+          const double a(0.5*(l+m+2)), b(0.5*(l+m+1)), c(l+1.5);
+          double term(1.0), sum(1.0);
+          int k;
+          for(k=0;k<QASYM_MAXTERMS;k++) {
+            term*=(a+k)*(b+k)/((c+k)*(k+1))*xinv2;
+            sum+=term;
+            // Once the terms decrease, the tail is bounded by a
+            // geometric series
+            double ratio((a+k+1)*(b+k+1)/((c+k+1)*(k+2))*xinv2);
+            if(ratio<1.0 && term < 0.1*DBL_EPSILON*(1.0-ratio)*sum)
+              break;
+          }
+          if(k==QASYM_MAXTERMS)
+            return false;
+          Q(l,m)=pref*sum;
+        }
+      }
+      return true;
+    }
+
+    double asymptotic_threshold() {
+      return QASYM_XI;
+    }
+
+    /// Compute Plm and Qlm up to Lcalc for npts arguments
+    static void compute_block(const double * xi, size_t npts, int Lcalc, arma::cube & P, arma::cube & Q) {
+      P.set_size(Lcalc+1,Lcalc+1,npts);
+      Q.set_size(Lcalc+1,Lcalc+1,npts);
+      ::calc_PQlm_arr(P.memptr(),Q.memptr(),Lcalc,Lcalc,xi,npts);
+    }
+
+    /// Check whether the values up to Lmax, Mmax agree to the relative tolerance
+    static bool block_converged(const arma::cube & oldv, const arma::cube & newv, int Lmax, int Mmax, double tol) {
+      for(size_t i=0;i<newv.n_slices;i++)
+        for(int M=0;M<=Mmax;M++)
+          for(int L=0;L<=Lmax;L++) {
+            double o(std::isnormal(oldv(L,M,i)) ? oldv(L,M,i) : 0.0);
+            double n(std::isnormal(newv(L,M,i)) ? newv(L,M,i) : 0.0);
+            if(std::abs(n-o) > tol*std::abs(n))
+              return false;
+          }
+      return true;
     }
 
     LegendreTable::LegendreTable() {
       Lpad=-1;
       Lmax=-1;
       Mmax=-1;
+      padtol=0.0;
+      padused=0;
     }
 
-    LegendreTable::LegendreTable(int Lpad_, int Lmax_, int Mmax_) : Lpad(Lpad_), Lmax(Lmax_), Mmax(Mmax_) {
+    LegendreTable::LegendreTable(int Lpad_, int Lmax_, int Mmax_, double padtol_) : Lpad(Lpad_), Lmax(Lmax_), Mmax(Mmax_), padtol(padtol_), padused(0) {
     }
 
     LegendreTable::~LegendreTable() {
     }
 
     size_t LegendreTable::get_index(double xi, bool check) const {
-      legendre_table_t p;
-      p.xi=xi;
-
-      std::vector<legendre_table_t>::const_iterator low(std::lower_bound(stor.begin(),stor.end(),p));
-      if(check && low == stor.end()) {
+      const double * low(std::lower_bound(xitab.memptr(),xitab.memptr()+xitab.n_elem,xi));
+      if(check && low == xitab.memptr()+xitab.n_elem) {
         std::ostringstream oss;
         oss << "Could not find xi=" << xi << " on the list!\n";
         throw std::logic_error(oss.str());
       }
 
       // Index is
-      size_t idx(low-stor.begin());
-      if(check && (stor[idx].xi != xi)) {
+      size_t idx(low-xitab.memptr());
+      if(check && (xitab(idx) != xi)) {
         std::ostringstream oss;
-        oss << "Map error: tried to get xi = " << xi << " but got xi = " << stor[idx].xi << "!\n";
+        oss << "Map error: tried to get xi = " << xi << " but got xi = " << xitab(idx) << "!\n";
         throw std::logic_error(oss.str());
       }
 
       return idx;
     }
 
+    size_t LegendreTable::get_index_hint(double xi, size_t hint) const {
+      // Quadrature points are usually looked up in order
+      if(hint+1<xitab.n_elem && xitab(hint+1)==xi)
+        return hint+1;
+      if(hint<xitab.n_elem && xitab(hint)==xi)
+        return hint;
+      if(hint>0 && hint-1<xitab.n_elem && xitab(hint-1)==xi)
+        return hint-1;
+      return get_index(xi);
+    }
+
     void LegendreTable::compute(double xi) {
+      compute(arma::vec({xi}));
+    }
+
+    void LegendreTable::compute(const arma::vec & xi) {
+      // New points
+      arma::vec newxi(arma::unique(xi));
+      if(xitab.n_elem) {
+        std::vector<double> add;
+        for(size_t i=0;i<newxi.n_elem;i++) {
+          const double * low(std::lower_bound(xitab.memptr(),xitab.memptr()+xitab.n_elem,newxi(i)));
+          if(low == xitab.memptr()+xitab.n_elem || *low != newxi(i))
+            add.push_back(newxi(i));
+        }
+        newxi=arma::conv_to<arma::vec>::from(add);
+      }
+      if(!newxi.n_elem)
+        return;
+
+      arma::cube newP(Lmax+1,Mmax+1,newxi.n_elem);
+      arma::cube newQ(Lmax+1,Mmax+1,newxi.n_elem);
+      // The points are handled in blocks, with one library call per block
+      const size_t blocksize(64);
+      const size_t nblocks((newxi.n_elem+blocksize-1)/blocksize);
+      // Padding used for each block
+      arma::ivec blockpad(nblocks);
 #ifdef _OPENMP
-#pragma omp critical
+#pragma omp parallel for schedule(dynamic,1)
 #endif
-      {
-        legendre_table_t entry;
-
-        // Allocate memory
-        entry.xi=xi;
-        entry.Plm.zeros(Lpad+1,Lpad+1);
-        entry.Qlm.zeros(Lpad+1,Lpad+1);
-
-        // Compute
-        if(xi!=1.0) {
-          ::calc_Plm_arr(entry.Plm.memptr(),Lpad,Lpad,xi);
-          ::calc_Qlm_arr(entry.Qlm.memptr(),Lpad,Lpad,xi);
-        }
+      for(size_t iblock=0;iblock<nblocks;iblock++) {
+        const size_t ifirst(iblock*blocksize);
+        const size_t ilast(std::min(ifirst+blocksize,(size_t) newxi.n_elem)-1);
+        const size_t npts(ilast-ifirst+1);
 
-        // Store only 0 to lmax
-        entry.Plm=entry.Plm.submat(0,0,Lmax,Mmax);
-        entry.Qlm=entry.Qlm.submat(0,0,Lmax,Mmax);
-
-        // Get rid of any non-normal entries
-        for(int L=0;L<=Lmax;L++)
-          for(int M=0;M<=Mmax;M++) {
-            if(!std::isnormal(entry.Plm(L,M)))
-              entry.Plm(L,M)=0.0;
-            if(!std::isnormal(entry.Qlm(L,M)))
-              entry.Qlm(L,M)=0.0;
+        // Far from the foci the series is faster than the continued
+        // fractions of the library and needs no padding; the points
+        // are in ascending order, so the whole block is far
+        if(newxi(ifirst) >= QASYM_XI) {
+          arma::mat P, Q;
+          bool ok=true;
+          for(size_t i=0;i<npts && ok;i++) {
+            ok=asymptotic_Qlm(newxi(ifirst+i),Lmax,Mmax,Q);
+            if(!ok)
+              break;
+            regular_Plm(newxi(ifirst+i),Lmax,Mmax,P);
+            for(int M=0;M<=Mmax;M++)
+              for(int L=0;L<=Lmax;L++) {
+                newP(L,M,ifirst+i) = std::isnormal(P(L,M)) ? P(L,M) : 0.0;
+                newQ(L,M,ifirst+i) = std::isnormal(Q(L,M)) ? Q(L,M) : 0.0;
+              }
+          }
+          if(ok) {
+            blockpad(iblock)=0;
+            continue;
           }
+        }
+
+        // The downward recursion for Qlm converges slowest close to
+        // xi=1, so the padding is only increased where it is needed
+        const int maxpad(std::max(Lpad-Lmax,0));
+        int pad(padtol>0.0 ? std::min(MINPAD,maxpad) : maxpad);
+        arma::cube P, Q;
+        compute_block(newxi.memptr()+ifirst,npts,Lmax+pad,P,Q);
+        while(pad<maxpad) {
+          int newpad(std::min(2*pad,maxpad));
+          arma::cube newP, newQ;
+          compute_block(newxi.memptr()+ifirst,npts,Lmax+newpad,newP,newQ);
+          bool converged(block_converged(P,newP,Lmax,Mmax,padtol) && block_converged(Q,newQ,Lmax,Mmax,padtol));
+          P=newP;
+          Q=newQ;
+          pad=newpad;
+          if(converged)
+            break;
+        }
+        blockpad(iblock)=pad;
 
-        if(!stor.size())
-          stor.push_back(entry);
-        else
-          // Insert at lower bound
-          stor.insert(stor.begin()+get_index(xi,false),entry);
+        // Store only 0 to lmax, and get rid of any non-normal entries
+        for(size_t i=0;i<npts;i++)
+          for(int M=0;M<=Mmax;M++)
+            for(int L=0;L<=Lmax;L++) {
+              newP(L,M,ifirst+i) = std::isnormal(P(L,M,i)) ? P(L,M,i) : 0.0;
+              newQ(L,M,ifirst+i) = std::isnormal(Q(L,M,i)) ? Q(L,M,i) : 0.0;
+            }
       }
+
+      padused=std::max(padused,(int) arma::max(blockpad));
+
+      if(!xitab.n_elem) {
+        xitab=newxi;
+        Plm=newP;
+        Qlm=newQ;
+        return;
+      }
+
+      // Merge into the existing table
+      arma::vec allxi(arma::join_cols(xitab,newxi));
+      arma::uvec order(arma::stable_sort_index(allxi));
+      arma::cube allP(arma::join_slices(Plm,newP));
+      arma::cube allQ(arma::join_slices(Qlm,newQ));
+
+      xitab=allxi(order);
+      Plm.set_size(Lmax+1,Mmax+1,order.n_elem);
+      Qlm.set_size(Lmax+1,Mmax+1,order.n_elem);
+      for(size_t i=0;i<order.n_elem;i++) {
+        Plm.slice(i)=allP.slice(order(i));
+        Qlm.slice(i)=allQ.slice(order(i));
+      }
+    }
+
+    int LegendreTable::get_padding() const {
+      return padused;
     }
 
     double LegendreTable::get_Plm(int l, int m, double xi) const {
-#ifndef ARMA_NO_DEBUG
-      if(get_index(xi)>stor.size()) {
-        std::ostringstream oss;
-        oss << "Error in get_Plm(" << l << "," << m << "," << xi << "): index " << get_index(xi) << " greater than array size " << stor.size() << "!\n";
-        throw std::logic_error(oss.str());
-      }
-#endif
-      return stor[get_index(xi)].Plm(l,m);
+      return Plm(l,m,get_index(xi));
     }
 
     double LegendreTable::get_Qlm(int l, int m, double xi) const {
-#ifndef ARMA_NO_DEBUG
-      if(get_index(xi)>stor.size()) {
-        std::ostringstream oss;
-        oss << "Error in get_Qlm(" << l << "," << m << "," << xi << "): index " << get_index(xi) << " greater than array size " << stor.size() << "!\n";
-        throw std::logic_error(oss.str());
-      }
-#endif
-      return stor[get_index(xi)].Qlm(l,m);
+      return Qlm(l,m,get_index(xi));
     }
 
-    arma::vec LegendreTable::get_Plm(int l, int m, const arma::vec & xi) const {
-      arma::vec plm(xi.n_elem);
+    arma::uvec LegendreTable::get_indices(const arma::vec & xi) const {
+      arma::uvec idx(xi.n_elem);
       for(size_t i=0;i<xi.n_elem;i++)
-        plm(i)=get_Plm(l,m,xi(i));
+        idx(i) = i ? get_index_hint(xi(i),idx(i-1)) : get_index(xi(i));
+      return idx;
+    }
+
+    arma::vec LegendreTable::get_Plm(int l, int m, const arma::uvec & idx) const {
+      arma::vec plm(idx.n_elem);
+      for(size_t i=0;i<idx.n_elem;i++)
+        plm(i)=Plm(l,m,idx(i));
       return plm;
     }
 
-    arma::vec LegendreTable::get_Qlm(int l, int m, const arma::vec & xi) const {
-      arma::vec qlm(xi.n_elem);
-      for(size_t i=0;i<xi.n_elem;i++)
-        qlm(i)=get_Qlm(l,m,xi(i));
+    arma::vec LegendreTable::get_Qlm(int l, int m, const arma::uvec & idx) const {
+      arma::vec qlm(idx.n_elem);
+      for(size_t i=0;i<idx.n_elem;i++)
+        qlm(i)=Qlm(l,m,idx(i));
       return qlm;
     }
+
+    arma::vec LegendreTable::get_Plm(int l, int m, const arma::vec & xi) const {
+      return get_Plm(l,m,get_indices(xi));
+    }
+
+    arma::vec LegendreTable::get_Qlm(int l, int m, const arma::vec & xi) const {
+      return get_Qlm(l,m,get_indices(xi));
+    }
   }
 }
@@ -21,40 +21,56 @@
 
 namespace helfem {
   namespace legendretable {
-    typedef struct {
-      /// Value of argument
-      double xi;
-      /// Plm values
-      arma::mat Plm;
-      /// Qlm values
-      arma::mat Qlm;
-    } legendre_table_t;
-
-    bool operator<(const legendre_table_t & lh, const legendre_table_t & rh);
+    /// Regular Legendre functions P_lm(xi) for xi>1 by upward recursion in l; the entries with l<m are zero
+    void regular_Plm(double xi, int Lmax, int Mmax, arma::mat & P);
+    /// Irregular Legendre functions Q_lm(xi) for xi>1 from their convergent series in 1/xi^2; returns false if the series did not converge
+    bool asymptotic_Qlm(double xi, int Lmax, int Mmax, arma::mat & Q);
+    /// Smallest argument for which LegendreTable uses the series instead of the Legendre library
+    double asymptotic_threshold();
 
     class LegendreTable {
     private:
-      /// Storage array
-      std::vector<legendre_table_t> stor;
+      /// Arguments in ascending order
+      arma::vec xitab;
+      /// Plm values, (Lmax+1) x (Mmax+1) x Nxi
+      arma::cube Plm;
+      /// Qlm values, (Lmax+1) x (Mmax+1) x Nxi
+      arma::cube Qlm;
       /// Maximum L value used in the actual computation
       int Lpad;
       /// Maximum L value
       int Lmax;
       /// Maximum M value
       int Mmax;
+      /// Tolerance for the padding; 0 to always pad up to Lpad
+      double padtol;
+      /// Largest padding used in the computation
+      int padused;
 
       /// Find index in array
       size_t get_index(double xi, bool check=true) const;
+      /// Find index in array, trying the neighbours of hint first
+      size_t get_index_hint(double xi, size_t hint) const;
 
     public:
       /// Dummy constructor
       LegendreTable();
-      /// Constructor
-      LegendreTable(int Lpad, int Lmax, int Mmax);
+      /**
+       * Constructor. The values are computed with the recursion started
+       * at Lpad. With a positive tolerance, Lpad is the largest
+       * starting point instead, and the padding above Lmax is doubled
+       * for each block of arguments until the values change by less
+       * than the relative tolerance.
+       */
+      LegendreTable(int Lpad, int Lmax, int Mmax, double padtol=0.0);
       /// Destructor
       ~LegendreTable();
       /// Add value to table
       void compute(double xi);
+      /// Add values to table
+      void compute(const arma::vec & xi);
+      /// Largest padding above Lmax used so far
+      int get_padding() const;
 
       /// Get value from table
       double get_Plm(int l, int m, double xi) const;
@@ -65,6 +81,13 @@ namespace helfem {
       arma::vec get_Plm(int l, int m, const arma::vec & xi) const;
       /// Get value from table
       arma::vec get_Qlm(int l, int m, const arma::vec & xi) const;
+
+      /// Get indices of the arguments in the table
+      arma::uvec get_indices(const arma::vec & xi) const;
+      /// Get values from table by index
+      arma::vec get_Plm(int l, int m, const arma::uvec & idx) const;
+      /// Get values from table by index
+      arma::vec get_Qlm(int l, int m, const arma::uvec & idx) const;
     };
   }
 }
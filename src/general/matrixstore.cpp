@@ -0,0 +1,73 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#include "matrixstore.h"
+#include <sstream>
+#include <stdexcept>
+
+namespace helfem {
+  MatrixStore::MatrixStore() {
+  }
+
+  MatrixStore::~MatrixStore() {
+  }
+
+  void MatrixStore::declare(const std::string & name, const std::function<arma::mat()> & make) {
+    makers[name]=make;
+    cache.erase(name);
+  }
+
+  bool MatrixStore::has(const std::string & name) const {
+    return makers.find(name)!=makers.end();
+  }
+
+  bool MatrixStore::formed(const std::string & name) const {
+    return cache.find(name)!=cache.end();
+  }
+
+  const arma::mat & MatrixStore::get(const std::string & name) const {
+    std::map<std::string, arma::mat>::const_iterator it(cache.find(name));
+    if(it!=cache.end())
+      return it->second;
+
+    std::map< std::string, std::function<arma::mat()> >::const_iterator mit(makers.find(name));
+    if(mit==makers.end()) {
+      std::ostringstream oss;
+      oss << "Matrix " << name << " has not been declared!\n";
+      throw std::logic_error(oss.str());
+    }
+    return cache[name]=mit->second();
+  }
+
+  void MatrixStore::release(const std::string & name) {
+    cache.erase(name);
+  }
+
+  size_t MatrixStore::memory() const {
+    size_t mem=0;
+    for(std::map<std::string, arma::mat>::const_iterator it=cache.begin();it!=cache.end();++it)
+      mem+=it->second.n_elem*sizeof(double);
+    return mem;
+  }
+
+  bool MatrixStore::listed(const std::string & list, const std::string & name) {
+    std::istringstream iss(list);
+    std::string entry;
+    while(std::getline(iss,entry,','))
+      if(entry==name || entry=="all")
+        return true;
+    return false;
+  }
+}
@@ -0,0 +1,61 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#ifndef MATRIXSTORE_H
+#define MATRIXSTORE_H
+
+#include <armadillo>
+#include <functional>
+#include <map>
+#include <string>
+
+namespace helfem {
+  /**
+   * Matrices that are formed on first access and kept in memory
+   * afterwards, e.g. the one-electron matrices of a basis set. Every
+   * entry is declared with the function that forms it, so matrices
+   * that are never used are not formed at all.
+   */
+  class MatrixStore {
+    /// Functions that form the entries
+    std::map< std::string, std::function<arma::mat()> > makers;
+    /// Entries formed so far
+    mutable std::map<std::string, arma::mat> cache;
+
+  public:
+    /// Constructor
+    MatrixStore();
+    /// Destructor
+    ~MatrixStore();
+
+    /// Declare an entry with the function that forms it; an entry formed earlier is discarded
+    void declare(const std::string & name, const std::function<arma::mat()> & make);
+    /// Is the entry declared?
+    bool has(const std::string & name) const;
+    /// Has the entry been formed?
+    bool formed(const std::string & name) const;
+    /// Get an entry, forming it if necessary. The reference stays valid until the entry is redeclared or released
+    const arma::mat & get(const std::string & name) const;
+    /// Release the memory of an entry; it is formed again on the next access
+    void release(const std::string & name);
+    /// Memory used by the formed entries in bytes
+    size_t memory() const;
+
+    /// Is name in the comma separated list? The list "all" contains every name
+    static bool listed(const std::string & list, const std::string & name);
+  };
+}
+
+#endif
@@ -0,0 +1,143 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#include "memtrack.h"
+#include "scf_helpers.h"
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <mutex>
+
+namespace helfem {
+  namespace memory {
+    /// Usage of a subsystem
+    typedef struct {
+      /// Current usage
+      size_t current;
+      /// Peak usage
+      size_t peak;
+    } usage_t;
+
+    /// Usage of the subsystems
+    static std::map<std::string, usage_t> usage;
+    /// Lock for the above
+    static std::mutex usage_lock;
+
+    /// Get the entry for the subsystem; the lock must be held
+    static usage_t & entry(const std::string & sys) {
+      std::map<std::string, usage_t>::iterator it(usage.find(sys));
+      if(it==usage.end()) {
+        usage_t u;
+        u.current=u.peak=0;
+        it=usage.insert(std::make_pair(sys,u)).first;
+      }
+      return it->second;
+    }
+
+    void allocate(const std::string & sys, size_t bytes) {
+      std::lock_guard<std::mutex> lock(usage_lock);
+      usage_t & u(entry(sys));
+      u.current+=bytes;
+      u.peak=std::max(u.peak,u.current);
+    }
+
+    void release(const std::string & sys, size_t bytes) {
+      std::lock_guard<std::mutex> lock(usage_lock);
+      usage_t & u(entry(sys));
+      u.current-=std::min(u.current,bytes);
+    }
+
+    void set(const std::string & sys, size_t bytes) {
+      std::lock_guard<std::mutex> lock(usage_lock);
+      usage_t & u(entry(sys));
+      u.current=bytes;
+      u.peak=std::max(u.peak,u.current);
+    }
+
+    size_t current(const std::string & sys) {
+      std::lock_guard<std::mutex> lock(usage_lock);
+      return entry(sys).current;
+    }
+
+    size_t peak(const std::string & sys) {
+      std::lock_guard<std::mutex> lock(usage_lock);
+      return entry(sys).peak;
+    }
+
+    void print_peaks() {
+      std::lock_guard<std::mutex> lock(usage_lock);
+      printf("\nPeak memory usage\n");
+      for(std::map<std::string, usage_t>::const_iterator it=usage.begin();it!=usage.end();++it)
+        printf("%-20s %s\n",it->first.c_str(),scf::memory_size(it->second.peak).c_str());
+      fflush(stdout);
+    }
+
+    plan_t make_plan(size_t budget, size_t onee, size_t tei, size_t diis_entry, int diisorder, bool grid) {
+      plan_t plan;
+      plan.budget=budget;
+      plan.onee=onee;
+      plan.tei=tei;
+      plan.diis_entry=diis_entry;
+
+      if(budget==0) {
+        // Unlimited memory
+        plan.tei_incore=true;
+        plan.diisorder=diisorder;
+        plan.grid=0;
+        return plan;
+      }
+
+      // Minimal usable DIIS history
+      const int mindiis(std::min(diisorder,3));
+      size_t left(budget>onee ? budget-onee : 0);
+      size_t diismin(mindiis*diis_entry);
+      left-=std::min(left,diismin);
+
+      plan.tei_incore=(tei<=left);
+      if(plan.tei_incore)
+        left-=tei;
+
+      // Extend the DIIS history
+      plan.diisorder=mindiis;
+      if(diis_entry) {
+        size_t nextra(left/diis_entry);
+        plan.diisorder+=(int) std::min(nextra,(size_t) (diisorder-mindiis));
+      } else {
+        plan.diisorder=diisorder;
+      }
+      left-=(plan.diisorder-mindiis)*diis_entry;
+
+      plan.grid=grid ? left : 0;
+
+      return plan;
+    }
+
+    void print_plan(const plan_t & plan) {
+      printf("\nMemory plan\n");
+      if(plan.budget)
+        printf("%-40s %s\n","Budget",scf::memory_size(plan.budget).c_str());
+      else
+        printf("%-40s %s\n","Budget","unlimited");
+      printf("%-40s %s\n","One-electron matrices",scf::memory_size(plan.onee).c_str());
+      printf("%-40s %s, %s\n","Two-electron integrals",scf::memory_size(plan.tei).c_str(),plan.tei_incore ? "in core" : "not in core");
+      printf("%-40s %i entries of %s\n","DIIS history",plan.diisorder,scf::memory_size(plan.diis_entry).c_str());
+      if(plan.grid)
+        printf("%-40s %s\n","DFT basis function cache",scf::memory_size(plan.grid).c_str());
+      else
+        printf("%-40s %s\n","DFT basis function cache","recomputed");
+      fflush(stdout);
+    }
+  }
+}
@@ -0,0 +1,67 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#ifndef MEMTRACK_H
+#define MEMTRACK_H
+
+#include <cstddef>
+#include <string>
+
+namespace helfem {
+  namespace memory {
+    /// Record allocation of bytes in the subsystem
+    void allocate(const std::string & sys, size_t bytes);
+    /// Record release of bytes in the subsystem
+    void release(const std::string & sys, size_t bytes);
+    /// Set the current usage of the subsystem
+    void set(const std::string & sys, size_t bytes);
+    /// Current usage of the subsystem
+    size_t current(const std::string & sys);
+    /// Peak usage of the subsystem
+    size_t peak(const std::string & sys);
+    /// Print out the peak usage of all subsystems
+    void print_peaks();
+
+    /// Memory plan for the SCF
+    typedef struct {
+      /// Total budget in bytes
+      size_t budget;
+      /// Fixed need of the one-electron matrices
+      size_t onee;
+      /// Need of the primitive two-electron integrals
+      size_t tei;
+      /// Are the two-electron integrals kept in core?
+      bool tei_incore;
+      /// Size of a single DIIS entry
+      size_t diis_entry;
+      /// Length of the DIIS history
+      int diisorder;
+      /// Budget for the DFT basis function cache, zero if nothing is cached
+      size_t grid;
+    } plan_t;
+
+    /// Divide the budget (zero for unlimited) between the
+    /// subsystems. The one-electron matrices and a minimal DIIS
+    /// history are always kept; the two-electron integrals are kept
+    /// in core if they fit, after which the DIIS history is extended
+    /// up to diisorder, and whatever is left over is used to cache
+    /// basis function values on the DFT grid (if grid is true).
+    plan_t make_plan(size_t budget, size_t onee, size_t tei, size_t diis_entry, int diisorder, bool grid);
+    /// Print out the plan
+    void print_plan(const plan_t & plan);
+  }
+}
+
+#endif
@@ -39,6 +39,10 @@ namespace helfem {
       return -GSZ::Z_thomasfermi(r,Z)/r;
     }
 
+    void TFAtom::V(const arma::vec & r, arma::vec & out) const {
+      out = -GSZ::Z_thomasfermi(r,Z)/r;
+    }
+
     GSZAtom::GSZAtom(int Z_) : Z(Z_) {
       GSZ::GSZ_parameters(Z,dz,Hz);
     }
@@ -53,6 +57,10 @@ namespace helfem {
       return -GSZ::Z_GSZ(r,Z,dz,Hz)/r;
     }
 
+    void GSZAtom::V(const arma::vec & r, arma::vec & out) const {
+      out = -GSZ::Z_GSZ(r,Z,dz,Hz)/r;
+    }
+
     SAPAtom::SAPAtom(int Z_) : Z(Z_) {
     }
 
@@ -62,5 +70,9 @@ namespace helfem {
     double SAPAtom::V(double r) const {
       return -::sap_effective_charge(Z,r)/r;
     }
+
+    void SAPAtom::V(const arma::vec & r, arma::vec & out) const {
+      out = -::sap_effective_charge(Z,r)/r;
+    }
   }
 }
@@ -37,6 +37,8 @@ namespace helfem {
       ~TFAtom();
       /// Potential
       double V(double r) const override;
+      /// Potential on a batch of points
+      void V(const arma::vec & r, arma::vec & out) const override;
     };
 
     /// Green-Sellin-Zachor atom
@@ -54,6 +56,8 @@ namespace helfem {
       ~GSZAtom();
       /// Potential
       double V(double r) const override;
+      /// Potential on a batch of points
+      void V(const arma::vec & r, arma::vec & out) const override;
     };
 
     /// Superposition of atomic potentials
@@ -67,6 +71,8 @@ namespace helfem {
       ~SAPAtom();
       /// Potential
       double V(double r) const override;
+      /// Potential on a batch of points
+      void V(const arma::vec & r, arma::vec & out) const override;
     };
   }
 }
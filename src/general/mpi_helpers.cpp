@@ -0,0 +1,106 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#include "mpi_helpers.h"
+#include <cstdio>
+#ifdef HELFEM_MPI
+#include <mpi.h>
+#endif
+
+namespace helfem {
+  namespace mpi {
+    /// Rank of this process and number of processes, cached so that
+    /// the task distribution can be queried from any thread
+    static int myrank=0, nranks=1;
+
+#ifdef HELFEM_MPI
+    /// Is MPI running?
+    static bool running() {
+      int init, fin;
+      MPI_Initialized(&init);
+      MPI_Finalized(&fin);
+      return init && !fin;
+    }
+#endif
+
+    void init(int & argc, char **& argv) {
+#ifdef HELFEM_MPI
+      // The ranks are single-threaded as far as MPI is concerned
+      int provided;
+      MPI_Init_thread(&argc,&argv,MPI_THREAD_FUNNELED,&provided);
+      MPI_Comm_rank(MPI_COMM_WORLD,&myrank);
+      MPI_Comm_size(MPI_COMM_WORLD,&nranks);
+      if(!master())
+        if(!freopen("/dev/null","w",stdout))
+          fprintf(stderr,"Could not silence the output of rank %i\n",rank());
+      if(size()>1) {
+        printf("Running on %i MPI ranks\n",size());
+        fflush(stdout);
+      }
+#else
+      (void) argc;
+      (void) argv;
+#endif
+    }
+
+    void finalize() {
+#ifdef HELFEM_MPI
+      if(running())
+        MPI_Finalize();
+#endif
+      myrank=0;
+      nranks=1;
+    }
+
+    int rank() {
+      return myrank;
+    }
+
+    int size() {
+      return nranks;
+    }
+
+    bool master() {
+      return rank()==0;
+    }
+
+    bool owns(size_t i) {
+      return (int) (i%size())==rank();
+    }
+
+    void allreduce(arma::mat & M) {
+#ifdef HELFEM_MPI
+      if(size()>1 && M.n_elem)
+        MPI_Allreduce(MPI_IN_PLACE,M.memptr(),(int) M.n_elem,MPI_DOUBLE,MPI_SUM,MPI_COMM_WORLD);
+#else
+      (void) M;
+#endif
+    }
+
+    void allreduce(std::vector<arma::mat> & M) {
+      for(size_t i=0;i<M.size();i++)
+        allreduce(M[i]);
+    }
+
+    void allreduce(double & x) {
+#ifdef HELFEM_MPI
+      if(size()>1)
+        MPI_Allreduce(MPI_IN_PLACE,&x,1,MPI_DOUBLE,MPI_SUM,MPI_COMM_WORLD);
+#else
+      (void) x;
+#endif
+    }
+  }
+}
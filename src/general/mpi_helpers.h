@@ -0,0 +1,55 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#ifndef MPI_HELPERS_H
+#define MPI_HELPERS_H
+
+#include <armadillo>
+#include <vector>
+
+namespace helfem {
+  namespace mpi {
+    /**
+     * Thin layer over MPI, which is only used when HelFEM is compiled
+     * with USE_MPI. Without it, or before init has been called, there
+     * is a single rank and the reductions do nothing. Tasks are handed
+     * out round-robin, so every rank can tell which ones it owns
+     * without communication.
+     */
+
+    /// Initialize MPI; output of all but the first rank is discarded
+    void init(int & argc, char **& argv);
+    /// Finalize MPI
+    void finalize();
+
+    /// Rank of this process
+    int rank();
+    /// Number of processes
+    int size();
+    /// Is this the first rank?
+    bool master();
+    /// Does this rank handle task i of a round-robin distribution?
+    bool owns(size_t i);
+
+    /// Sum the matrix over the ranks
+    void allreduce(arma::mat & M);
+    /// Sum the matrices over the ranks
+    void allreduce(std::vector<arma::mat> & M);
+    /// Sum the value over the ranks
+    void allreduce(double & x);
+  }
+}
+
+#endif
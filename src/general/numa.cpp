@@ -0,0 +1,81 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#include "numa.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace helfem {
+  namespace numa {
+    size_t setup(size_t ndom) {
+      if(ndom<2)
+        return 0;
+#ifdef _OPENMP
+      const int nth(omp_get_max_threads());
+      if(nth<2) {
+        printf("Only one thread in use; integrals are not distributed over NUMA domains\n");
+        fflush(stdout);
+        return 0;
+      }
+      ndom=std::min(ndom,(size_t) nth);
+      // The domain teams are nested in the per-domain region
+      omp_set_max_active_levels(std::max(omp_get_max_active_levels(),2));
+      printf("Integrals are distributed over %i NUMA domains with %i threads each\n",(int) ndom,team_size(ndom));
+#if _OPENMP >= 201307
+      if(omp_get_proc_bind()==omp_proc_bind_false)
+        printf("Warning: threads are not pinned, so the integrals may not stay in the domain that uses them. Set OMP_PLACES=cores and OMP_PROC_BIND=spread,close.\n");
+#endif
+      fflush(stdout);
+      return ndom;
+#else
+      printf("NUMA distribution of the integrals needs OpenMP; ignored\n");
+      fflush(stdout);
+      return 0;
+#endif
+    }
+
+    int team_size(size_t ndom) {
+#ifdef _OPENMP
+      return std::max(omp_get_max_threads()/(int) std::max(ndom,(size_t) 1),1);
+#else
+      return 1;
+#endif
+    }
+
+    std::vector<arma::uvec> partition(const arma::vec & cost, size_t ndom) {
+      std::vector<arma::uvec> ret(ndom);
+      if(!ndom || !cost.n_elem)
+        return ret;
+
+      // Each element goes to the domain that holds the midpoint of its
+      // cost; this is monotonic, so the ranges are contiguous
+      arma::vec cum(arma::cumsum(cost));
+      const double tot(cum(cum.n_elem-1));
+      arma::uvec dom(cost.n_elem);
+      for(size_t iel=0;iel<cost.n_elem;iel++) {
+        double mid(tot>0.0 ? (cum(iel)-0.5*cost(iel))/tot : (iel+0.5)/cost.n_elem);
+        dom(iel)=std::min((size_t) std::floor(mid*ndom),ndom-1);
+      }
+      for(size_t idom=0;idom<ndom;idom++)
+        ret[idom]=arma::find(dom==idom);
+
+      return ret;
+    }
+  }
+}
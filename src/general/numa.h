@@ -0,0 +1,49 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <armadillo>
+#include <vector>
+
+namespace helfem {
+  namespace numa {
+    /**
+     * Element blocks of the integrals can be distributed over the NUMA
+     * domains of the machine: each domain gets a contiguous range of
+     * elements and a team of threads. A block is first touched by its
+     * team in compute_tei, and the same team later contracts it in the
+     * Coulomb and exchange builds, so that the reads stay on the
+     * socket. The teams are nested parallel regions, which keep their
+     * placement when the threads are pinned with OMP_PLACES=cores and
+     * OMP_PROC_BIND=spread,close.
+     */
+
+    /// Set up nested parallelism for ndom domain teams; returns the number of domains in use, which is zero if there is nothing to distribute
+    size_t setup(size_t ndom);
+    /// Number of threads in the team of each of the ndom domains
+    int team_size(size_t ndom);
+    /**
+     * Split the elements into ndom contiguous ranges of about equal
+     * cost. Adjacent elements share a radial function, so a team
+     * contracts the even elements of its range before the odd ones to
+     * keep the updates disjoint.
+     */
+    std::vector<arma::uvec> partition(const arma::vec & cost, size_t ndom);
+  }
+}
+
+#endif
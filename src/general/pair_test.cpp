@@ -0,0 +1,107 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#include "utils.h"
+#include <cstdio>
+
+using namespace helfem;
+
+/**
+ * Test of the pair-symmetric storage of the in-element two-electron
+ * integrals: packing has to be undone by unpacking, pair_index has to
+ * follow the ordering of pair_pack, and the exchange matrix formed
+ * from the tiles of the packed integrals has to agree with the one
+ * from the dense exchange_tei.
+ */
+
+/// Random (N^2 x N^2) integral block with the i<->j and k<->l symmetries
+static arma::mat random_tei(size_t N) {
+  arma::mat tei(N*N,N*N,arma::fill::randu);
+  // Permutation ij -> ji, which symmetrizes the rows and columns
+  arma::mat perm(N*N,N*N,arma::fill::zeros);
+  for(size_t jj=0;jj<N;jj++)
+    for(size_t ii=0;ii<N;ii++)
+      perm(jj*N+ii,ii*N+jj)=1.0;
+  tei=0.5*(tei+perm*tei);
+  tei=0.5*(tei+tei*perm);
+  return tei;
+}
+
+int main(void) {
+  const size_t N=5;
+  arma::arma_rng::set_seed(0);
+  double maxdiff=0.0;
+
+  // Round trip of the symmetric and antisymmetric pairs
+  arma::mat tei(random_tei(N));
+  arma::mat anti(N*N,N*N,arma::fill::randu);
+  for(size_t jj=0;jj<N;jj++)
+    for(size_t ii=0;ii<=jj;ii++) {
+      if(ii==jj)
+        anti.row(jj*N+ii).zeros();
+      else
+        anti.row(ii*N+jj)=-anti.row(jj*N+ii);
+    }
+  double dsym(arma::abs(utils::pair_unpack(utils::pair_pack(tei,N,true),N,true)-tei).max());
+  double danti(arma::abs(utils::pair_unpack(utils::pair_pack(anti,N,false),N,false)-anti).max());
+  double dtei(arma::abs(utils::pair_unpack(arma::trans(utils::pair_unpack(arma::trans(utils::pair_pack_tei(tei,N,true,true)),N,true)),N,true)-tei).max());
+  printf("Pack and unpack: symmetric %e, antisymmetric %e, integrals %e\n",dsym,danti,dtei);
+  maxdiff=std::max(maxdiff,std::max(dsym,std::max(danti,dtei)));
+
+  // The pair (i,j) lands in the row given by pair_index
+  size_t nwrong=0;
+  for(int isym=0;isym<2;isym++) {
+    bool sym(isym==0);
+    for(size_t jj=0;jj<N;jj++)
+      for(size_t ii=0;ii<N;ii++) {
+        if(!sym && ii==jj)
+          continue;
+        arma::mat unit(N*N,1,arma::fill::zeros);
+        unit(jj*N+ii)=1.0;
+        arma::mat P(utils::pair_pack(unit,N,sym));
+        arma::uword imax(arma::index_max(arma::abs(arma::vectorise(P))));
+        if(imax != utils::pair_index(ii,jj,N,sym))
+          nwrong++;
+      }
+  }
+  printf("Pairs out of place in pair_index: %i\n",(int) nwrong);
+
+  // Exchange from the tiles of the packed integrals versus the dense permutation
+  arma::mat Pd(N,N,arma::fill::randu);
+  arma::mat K(arma::reshape(utils::exchange_tei(tei,N,N,N,N)*arma::vectorise(Pd),N,N));
+  arma::mat packed(utils::pair_pack_tei(tei,N,true,true));
+  arma::mat Kt(N*N,1,arma::fill::zeros);
+  arma::mat tile(N*N,N);
+  for(size_t ll=0;ll<N;ll++) {
+    utils::pair_tei_tile(packed,N,ll,tile);
+    // tile(i+j*N,k) = (ij|kl) is the (i, j+k*N) matrix of the (jk|il)
+    const arma::mat T(tile.memptr(),N,N*N,false,true);
+    Kt+=arma::trans(T)*Pd.col(ll);
+  }
+  double dK(arma::abs(arma::reshape(Kt,N,N)-K).max());
+  arma::fmat ftile(N*N,N);
+  utils::pair_tei_tile(arma::conv_to<arma::fmat>::from(packed),N,0,ftile);
+  utils::pair_tei_tile(packed,N,0,tile);
+  double dsingle(arma::abs(arma::conv_to<arma::mat>::from(ftile)-tile).max());
+  printf("Exchange from the pair tiles: %e, single precision tile %e\n",dK,dsingle);
+  maxdiff=std::max(maxdiff,dK);
+
+  if(nwrong || maxdiff>1e-12 || dsingle>1e-6) {
+    printf("Pair-symmetric integral storage failed!\n");
+    return 1;
+  }
+  printf("Pair-symmetric integral storage agrees with the dense layout.\n");
+  return 0;
+}
@@ -0,0 +1,314 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#include "profiler.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <list>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace helfem {
+  namespace profiler {
+    /// Accumulated data of a region
+    typedef struct {
+      /// Time spent
+      double time;
+      /// Number of calls
+      size_t calls;
+      /// Bytes moved
+      double bytes;
+      /// Floating point operations
+      double flops;
+    } entry_t;
+
+    /// Data of a single thread
+    typedef struct {
+      /// Thread index
+      int tid;
+      /// Paths of the open regions
+      std::vector<std::string> stack;
+      /// Accumulated data
+      std::map<std::string, entry_t> acc;
+    } thread_t;
+
+    /// Is profiling on?
+    static bool on=false;
+    /// File to write the results in
+    static std::string outfile;
+    /// Data of all the threads
+    static std::list<thread_t> threads;
+    /// Lock for the thread list
+    static std::mutex threads_lock;
+    /// Data of this thread
+    static thread_local thread_t * self=NULL;
+    /// Innermost region open outside parallel sections
+    static std::string parallel_prefix;
+
+    static bool in_parallel() {
+#ifdef _OPENMP
+      return omp_in_parallel();
+#else
+      return false;
+#endif
+    }
+
+    static thread_t & this_thread() {
+      if(!self) {
+        std::lock_guard<std::mutex> lock(threads_lock);
+        threads.push_back(thread_t());
+        self=&threads.back();
+#ifdef _OPENMP
+        self->tid=omp_get_thread_num();
+#else
+        self->tid=0;
+#endif
+      }
+      return *self;
+    }
+
+    static void dump_at_exit() {
+      print();
+      try {
+        dump(outfile);
+        printf("Profile written to %s\n",outfile.c_str());
+      } catch(std::runtime_error & err) {
+        printf("%s",err.what());
+      }
+      fflush(stdout);
+    }
+
+    void enable(const std::string & fname) {
+      if(!on) {
+        outfile=fname;
+        on=true;
+        std::atexit(dump_at_exit);
+      }
+    }
+
+    bool enabled() {
+      return on;
+    }
+
+    /// Summed data of a region
+    typedef struct {
+      /// Accumulated data over all threads
+      entry_t total;
+      /// Time spent in each thread
+      std::map<int, double> thread_time;
+    } summary_t;
+
+    static std::map<std::string, summary_t> collect() {
+      std::map<std::string, summary_t> ret;
+      std::lock_guard<std::mutex> lock(threads_lock);
+      for(std::list<thread_t>::const_iterator th=threads.begin();th!=threads.end();++th) {
+        for(std::map<std::string, entry_t>::const_iterator it=th->acc.begin();it!=th->acc.end();++it) {
+          std::map<std::string, summary_t>::iterator sit(ret.find(it->first));
+          if(sit==ret.end()) {
+            summary_t s;
+            s.total.time=s.total.bytes=s.total.flops=0.0;
+            s.total.calls=0;
+            sit=ret.insert(std::make_pair(it->first,s)).first;
+          }
+          sit->second.total.time+=it->second.time;
+          sit->second.total.calls+=it->second.calls;
+          sit->second.total.bytes+=it->second.bytes;
+          sit->second.total.flops+=it->second.flops;
+          sit->second.thread_time[th->tid]+=it->second.time;
+        }
+      }
+      return ret;
+    }
+
+    /// Labels of the phases
+    static std::vector<std::string> phase_labels;
+    /// Totals of the regions at the start of each phase
+    static std::vector< std::map<std::string, entry_t> > phase_start;
+
+    /// Totals of the regions summed over the threads
+    static std::map<std::string, entry_t> totals(const std::map<std::string, summary_t> & prof) {
+      std::map<std::string, entry_t> ret;
+      for(std::map<std::string, summary_t>::const_iterator it=prof.begin();it!=prof.end();++it)
+        ret[it->first]=it->second.total;
+      return ret;
+    }
+
+    void mark(const std::string & label) {
+      if(!on)
+        return;
+      if(in_parallel())
+        throw std::logic_error("profiler::mark called inside a parallel section!\n");
+      phase_labels.push_back(label);
+      phase_start.push_back(totals(collect()));
+    }
+
+    /// Longest time spent in a single thread
+    static double max_time(const summary_t & s) {
+      double tmax=0.0;
+      for(std::map<int, double>::const_iterator it=s.thread_time.begin();it!=s.thread_time.end();++it)
+        tmax=std::max(tmax,it->second);
+      return tmax;
+    }
+
+    /// Quote a string for JSON
+    static std::string quote(const std::string & str) {
+      std::string ret("\"");
+      for(size_t i=0;i<str.size();i++) {
+        if(str[i]=='"' || str[i]=='\\')
+          ret+='\\';
+        ret+=str[i];
+      }
+      ret+='"';
+      return ret;
+    }
+
+    void dump(const std::string & fname) {
+      std::map<std::string, summary_t> prof(collect());
+
+      std::ofstream out(fname.c_str());
+      if(!out.good()) {
+        std::ostringstream oss;
+        oss << "Could not open profile file " << fname << " for writing!\n";
+        throw std::runtime_error(oss.str());
+      }
+      out.precision(9);
+
+      bool csv(fname.size()>=4 && fname.compare(fname.size()-4,4,".csv")==0);
+      if(csv) {
+        out << "region,calls,threads,time,max_thread_time,bytes,flops\n";
+        for(std::map<std::string, summary_t>::const_iterator it=prof.begin();it!=prof.end();++it)
+          out << it->first << "," << it->second.total.calls << "," << it->second.thread_time.size() << "," << it->second.total.time << "," << max_time(it->second) << "," << it->second.total.bytes << "," << it->second.total.flops << "\n";
+      } else {
+        out << "{\n  \"regions\": [";
+        for(std::map<std::string, summary_t>::const_iterator it=prof.begin();it!=prof.end();++it) {
+          if(it!=prof.begin())
+            out << ",";
+          out << "\n    {\"name\": " << quote(it->first) << ", \"calls\": " << it->second.total.calls << ", \"time\": " << it->second.total.time << ", \"max_thread_time\": " << max_time(it->second) << ", \"bytes\": " << it->second.total.bytes << ", \"flops\": " << it->second.total.flops << ", \"thread_time\": {";
+          for(std::map<int, double>::const_iterator tit=it->second.thread_time.begin();tit!=it->second.thread_time.end();++tit) {
+            if(tit!=it->second.thread_time.begin())
+              out << ", ";
+            out << "\"" << tit->first << "\": " << tit->second;
+          }
+          out << "}}";
+        }
+        out << "\n  ]";
+
+        if(phase_labels.size()) {
+          // Region totals at the phase boundaries
+          std::vector< std::map<std::string, entry_t> > bounds;
+          bounds.push_back(std::map<std::string, entry_t>());
+          bounds.insert(bounds.end(),phase_start.begin(),phase_start.end());
+          bounds.push_back(totals(prof));
+
+          out << ",\n  \"phases\": [";
+          for(size_t ip=0;ip+1<bounds.size();ip++) {
+            if(ip)
+              out << ",";
+            out << "\n    {\"label\": " << quote(ip ? phase_labels[ip-1] : std::string("setup")) << ", \"regions\": {";
+            bool first=true;
+            for(std::map<std::string, entry_t>::const_iterator it=bounds[ip+1].begin();it!=bounds[ip+1].end();++it) {
+              std::map<std::string, entry_t>::const_iterator old(bounds[ip].find(it->first));
+              size_t calls(it->second.calls);
+              double time(it->second.time);
+              if(old!=bounds[ip].end()) {
+                calls-=old->second.calls;
+                time-=old->second.time;
+              }
+              if(!calls)
+                continue;
+              if(!first)
+                out << ", ";
+              first=false;
+              out << quote(it->first) << ": {\"calls\": " << calls << ", \"time\": " << time << "}";
+            }
+            out << "}}";
+          }
+          out << "\n  ]";
+        }
+        out << "\n}\n";
+      }
+    }
+
+    void print() {
+      std::map<std::string, summary_t> prof(collect());
+
+      printf("\n%-50s %10s %8s %12s %12s\n","Profiling region","calls","threads","time (s)","max (s)");
+      for(std::map<std::string, summary_t>::const_iterator it=prof.begin();it!=prof.end();++it)
+        printf("%-50s %10i %8i %12.3f %12.3f\n",it->first.c_str(),(int) it->second.total.calls,(int) it->second.thread_time.size(),it->second.total.time,max_time(it->second));
+      fflush(stdout);
+    }
+
+    Region::Region(const std::string & name) : nbytes(0.0), nflops(0.0), active(on) {
+      if(!active)
+        return;
+
+      thread_t & th(this_thread());
+      bool par(in_parallel());
+      // Parent region
+      const std::string & parent(th.stack.size() ? th.stack.back() : (par ? parallel_prefix : std::string()));
+      path = parent.size() ? parent + "/" + name : name;
+      th.stack.push_back(path);
+      if(!par)
+        parallel_prefix=path;
+
+      t.set();
+    }
+
+    Region::~Region() {
+      close();
+    }
+
+    void Region::close() {
+      if(!active)
+        return;
+      active=false;
+
+      double tel(t.get());
+      thread_t & th(this_thread());
+      th.stack.pop_back();
+      if(!in_parallel())
+        parallel_prefix = th.stack.size() ? th.stack.back() : std::string();
+
+      std::map<std::string, entry_t>::iterator it(th.acc.find(path));
+      if(it==th.acc.end()) {
+        entry_t e;
+        e.time=e.bytes=e.flops=0.0;
+        e.calls=0;
+        it=th.acc.insert(std::make_pair(path,e)).first;
+      }
+      it->second.time+=tel;
+      it->second.calls++;
+      it->second.bytes+=nbytes;
+      it->second.flops+=nflops;
+    }
+
+    void Region::add_bytes(double n) {
+      nbytes+=n;
+    }
+
+    void Region::add_flops(double n) {
+      nflops+=n;
+    }
+  }
+}
@@ -0,0 +1,78 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <string>
+#include "timer.h"
+
+namespace helfem {
+  namespace profiler {
+    /// Turn on profiling; the results are written in fname at exit
+    /// (CSV if the name ends in .csv, JSON otherwise)
+    void enable(const std::string & fname);
+    /// Is profiling on?
+    bool enabled();
+
+    /// Start a new phase of the run, such as an SCF iteration. The
+    /// JSON profile then also breaks the regions down by phase; the
+    /// work before the first mark is reported as the phase "setup".
+    /// Must be called outside parallel sections.
+    void mark(const std::string & label);
+
+    /// Write out the accumulated profile
+    void dump(const std::string & fname);
+    /// Print out the accumulated profile
+    void print();
+
+    /// Scoped profiling region. Regions nest into paths such as
+    /// SCF/Fock/Coulomb; regions opened inside OpenMP parallel
+    /// sections are placed under the region enclosing the parallel
+    /// section, and are accumulated separately for every thread.
+    class Region {
+      /// Timer
+      Timer t;
+      /// Full path of the region
+      std::string path;
+      /// Number of bytes moved
+      double nbytes;
+      /// Number of floating point operations
+      double nflops;
+      /// Is the region active?
+      bool active;
+
+      /// Not copyable
+      Region(const Region &);
+      /// Not copyable
+      Region & operator=(const Region &);
+
+    public:
+      /// Open region
+      Region(const std::string & name);
+      /// Close region
+      ~Region();
+      /// Close region before it goes out of scope
+      void close();
+
+      /// Add to the byte counter
+      void add_bytes(double n);
+      /// Add to the FLOP counter
+      void add_flops(double n);
+    };
+  }
+}
+
+#endif
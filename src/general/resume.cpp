@@ -0,0 +1,86 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#include "resume.h"
+#include "checkpoint.h"
+#include "mpi_helpers.h"
+#include <cstdio>
+#include <sstream>
+#include <stdexcept>
+
+namespace helfem {
+  namespace scf {
+    void write_resume(const std::string & fname, const resume_t & state, const uDIIS & diis, int nela, int nelb) {
+      const std::string tmpname(fname+".tmp");
+      {
+        Checkpoint chkpt(tmpname,true);
+        chkpt.write("nela",nela);
+        chkpt.write("nelb",nelb);
+        chkpt.write("iter",state.iter);
+        chkpt.write("Etot",state.Etot);
+        chkpt.write("diisbest",state.diisbest);
+        chkpt.write("nstall",state.nstall);
+        chkpt.write("tei_single",state.tei_single);
+        chkpt.write("Ca",state.Ca);
+        chkpt.write("Cb",state.Cb);
+        chkpt.write("Ea",arma::mat(state.Ea));
+        chkpt.write("Eb",arma::mat(state.Eb));
+        diis.write(chkpt,"DIIS");
+      }
+      // The other ranks don't write
+      if(!mpi::master())
+        return;
+      if(std::rename(tmpname.c_str(),fname.c_str())!=0) {
+        std::ostringstream oss;
+        oss << "Could not replace the snapshot " << fname << " with " << tmpname << "!\n";
+        throw std::runtime_error(oss.str());
+      }
+    }
+
+    bool read_resume(const std::string & fname, resume_t & state, uDIIS & diis, size_t Nbf, int nela, int nelb) {
+      if(!file_exists(fname))
+        return false;
+
+      Checkpoint chkpt(fname,false);
+      int na, nb;
+      chkpt.read("nela",na);
+      chkpt.read("nelb",nb);
+      if(na!=nela || nb!=nelb) {
+        std::ostringstream oss;
+        oss << "Snapshot " << fname << " is for " << na << " alpha and " << nb << " beta electrons instead of " << nela << " and " << nelb << "!\n";
+        throw std::logic_error(oss.str());
+      }
+      chkpt.read("iter",state.iter);
+      chkpt.read("Etot",state.Etot);
+      chkpt.read("diisbest",state.diisbest);
+      chkpt.read("nstall",state.nstall);
+      chkpt.read("tei_single",state.tei_single);
+      chkpt.read("Ca",state.Ca);
+      chkpt.read("Cb",state.Cb);
+      if(state.Ca.n_rows!=Nbf || state.Cb.n_rows!=Nbf) {
+        std::ostringstream oss;
+        oss << "Snapshot " << fname << " has " << state.Ca.n_rows << " basis functions instead of " << Nbf << "!\n";
+        throw std::logic_error(oss.str());
+      }
+      arma::mat E;
+      chkpt.read("Ea",E);
+      state.Ea=arma::vectorise(E);
+      chkpt.read("Eb",E);
+      state.Eb=arma::vectorise(E);
+      diis.read(chkpt,"DIIS");
+      return true;
+    }
+  }
+}
@@ -0,0 +1,59 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#ifndef RESUME_H
+#define RESUME_H
+
+#include <armadillo>
+#include <string>
+#include "diis.h"
+
+namespace helfem {
+  namespace scf {
+    /// State of an SCF calculation after an iteration, from which it can be resumed
+    typedef struct {
+      /// Last completed iteration
+      int iter;
+      /// Total energy of the iteration
+      double Etot;
+      /// Lowest DIIS error so far
+      double diisbest;
+      /// Number of iterations the DIIS error has not improved for
+      int nstall;
+      /// Were the integrals still contracted in single precision?
+      bool tei_single;
+      /// Alpha orbitals
+      arma::mat Ca;
+      /// Beta orbitals
+      arma::mat Cb;
+      /// Alpha orbital energies
+      arma::vec Ea;
+      /// Beta orbital energies
+      arma::vec Eb;
+    } resume_t;
+
+    /**
+     * Write the state and the DIIS history into a snapshot. The
+     * snapshot is written into a temporary file, which then replaces
+     * the old snapshot, so that a job that is killed while writing
+     * leaves the previous snapshot intact.
+     */
+    void write_resume(const std::string & fname, const resume_t & state, const uDIIS & diis, int nela, int nelb);
+    /// Read the state and the DIIS history for Nbf basis functions; returns false if there is no snapshot
+    bool read_resume(const std::string & fname, resume_t & state, uDIIS & diis, size_t Nbf, int nela, int nelb);
+  }
+}
+
+#endif
@@ -29,22 +29,23 @@
 
 #include "sap.h"
 #include <stddef.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
 
 /* Number of elements supported by the implementation + 1 */
 #define SAP_NELEM 119
 /* Radial points in the table */
 #define SAP_NRAD 751
 
-/* Use linear interpolation since points are closely spaced and higher
-order schemes may result in instabilities */
-#define LIP_ORDER 2
+/* Linear interpolation is used since points are closely spaced and
+higher order schemes may result in instabilities */
 
 /* Returns the cutoff radius in bohr */
 double sap_cutoff_radius() { return 3.99999995751228e+01; }
 
-/* Return the effective charge at radius x */
-double sap_effective_charge(int Z, double x) {
-  static const double Zeff[SAP_NELEM][SAP_NRAD] = {
+/* Tabulated effective charges; the first row holds the radii */
+static const double Zeff[SAP_NELEM][SAP_NRAD] = {
       {0.00000000000000e+00, 7.74564534039568e-10, 2.47256327461087e-08,
        1.86997862087340e-07, 7.83531011839395e-07, 2.37369448442132e-06,
        5.85385578447464e-06, 1.25192693640128e-05, 2.41120079015646e-05,
@@ -29914,76 +29915,105 @@ double sap_effective_charge(int Z, double x) {
        5.68434188608080e-14, 5.68434188608080e-14, 5.68434188608080e-14,
        4.26325641456060e-14, 7.10542735760100e-14, 5.68434188608080e-14,
        5.68434188608080e-14}};
-  /* Array lookup */
-  {
-    /* Table lookup helpers */
-    size_t posleft, posright, posmiddle;
-    /* Storage for data points */
-    double xi[LIP_ORDER];
-    double yi[LIP_ORDER];
-    /* Loop index */
-    int i;
-
-    /* Sanity check nucleus */
-    if (Z < 1)
-      return 0.0;
-    if (Z >= SAP_NELEM)
-      return 0.0;
-    /* Sanity check for radius */
-    if (x <= 0.0)
-      return Zeff[Z][0];
-    if (x >= Zeff[0][SAP_NRAD - 1])
-      return Zeff[Z][SAP_NRAD - 1];
 
-    /* Figure out where we are in the x array using a binary search */
-    posleft = 0;
-    posright = SAP_NRAD - 1;
-    while (1) {
-      posmiddle = (posleft + posright) / 2;
-      if (Zeff[0][posmiddle] < x)
-        posleft = posmiddle;
-      else if (Zeff[0][posmiddle] > x)
-        posright = posmiddle;
-      else if (Zeff[0][posmiddle] == x)
-        return Zeff[Z][posmiddle];
+/* Number of buckets in the radial lookup table */
+#define SAP_NBUCKET 1024
 
-      if (posleft + 1 == posright)
-        break;
-    }
+/* Lookup table for the radial grid: bucket b, uniform in log r between
+   the first nonzero and the last radius, starts at table index
+   first[b]. The radii are not evenly spaced in any simple variable,
+   so the buckets are used to narrow down the search. */
+typedef struct {
+  /* log of the smallest nonzero radius */
+  double lmin;
+  /* inverse bucket width */
+  double ilw;
+  /* first table index in each bucket */
+  size_t first[SAP_NBUCKET + 1];
+} sap_lookup_t;
 
-    /* Obtain result with a Lagrange interpolating polynomial.
-       Do we have an array overrun? */
-    if (posleft + LIP_ORDER - 1 >= SAP_NRAD)
-      posleft -= (posleft + LIP_ORDER) - SAP_NRAD;
+static sap_lookup_t sap_form_lookup() {
+  sap_lookup_t lookup;
+  const double lmax = std::log(Zeff[0][SAP_NRAD - 1]);
+  lookup.lmin = std::log(Zeff[0][1]);
+  lookup.ilw = SAP_NBUCKET / (lmax - lookup.lmin);
 
-    /* Copy data */
-    for (i = 0; i < LIP_ORDER; i++) {
-      xi[i] = Zeff[0][posleft + i];
-      yi[i] = Zeff[Z][posleft + i];
-    }
+  size_t pos = 0;
+  for (size_t b = 0; b <= SAP_NBUCKET; b++) {
+    /* Smallest radius in the bucket */
+    double rb = std::exp(lookup.lmin + b / lookup.ilw);
+    while (pos + 1 < SAP_NRAD && Zeff[0][pos + 1] <= rb)
+      pos++;
+    lookup.first[b] = pos;
+  }
+  return lookup;
+}
 
-    /* Lagrange interpolation */
-    {
-      /* Lagrange polynomial */
-      double li;
-      /* Loop indices */
-      size_t i, j;
-      /* Result */
-      double y = 0.0;
-      /* Loop over polynomials */
-      for (i = 0; i < LIP_ORDER; i++) {
-        /* Evaluate the polynomial */
-        li = 1.0;
-        for (j = 0; j < LIP_ORDER; j++) {
-          if (i == j)
-            continue;
-          li *= (x - xi[j]) / (xi[i] - xi[j]);
-        }
-        /* Increment function value */
-        y += yi[i] * li;
-      }
+/* Find posleft such that Zeff[0][posleft] <= x < Zeff[0][posleft+1];
+   the radius must be within the table */
+static size_t sap_locate(double x) {
+  static const sap_lookup_t lookup(sap_form_lookup());
 
-      return y;
-    }
+  size_t posleft = 0, posright = SAP_NRAD - 1;
+  if (x >= Zeff[0][1]) {
+    double u = (std::log(x) - lookup.lmin) * lookup.ilw;
+    size_t b = std::min((size_t) u, (size_t) SAP_NBUCKET - 1);
+    posleft = lookup.first[b];
+    posright = std::min(lookup.first[b + 1] + 1, (size_t) SAP_NRAD - 1);
+  } else {
+    posright = 1;
   }
+  /* Bisect within the bucket */
+  while (posleft + 1 < posright) {
+    size_t posmiddle = (posleft + posright) / 2;
+    if (Zeff[0][posmiddle] <= x)
+      posleft = posmiddle;
+    else
+      posright = posmiddle;
+  }
+  /* Guard against rounding in the bucket index */
+  while (posleft > 0 && Zeff[0][posleft] > x)
+    posleft--;
+  while (posleft + 2 < SAP_NRAD && Zeff[0][posleft + 1] <= x)
+    posleft++;
+  return posleft;
+}
+
+/* Linear interpolation in the table */
+static inline double sap_interpolate(int Z, double x, size_t pos) {
+  double t = (x - Zeff[0][pos]) / (Zeff[0][pos + 1] - Zeff[0][pos]);
+  return (1.0 - t) * Zeff[Z][pos] + t * Zeff[Z][pos + 1];
+}
+
+/* Return the effective charge at radius x */
+double sap_effective_charge(int Z, double x) {
+  /* Sanity check nucleus */
+  if (Z < 1)
+    return 0.0;
+  if (Z >= SAP_NELEM)
+    return 0.0;
+  /* Sanity check for radius */
+  if (x <= 0.0)
+    return Zeff[Z][0];
+  if (x >= Zeff[0][SAP_NRAD - 1])
+    return Zeff[Z][SAP_NRAD - 1];
+
+  return sap_interpolate(Z, x, sap_locate(x));
+}
+
+arma::vec sap_effective_charge(int Z, const arma::vec & r) {
+  arma::vec Zr(r.n_elem, arma::fill::zeros);
+  if (Z < 1 || Z >= SAP_NELEM)
+    return Zr;
+
+  /* Locate the points first, so that the interpolation loop is
+     branch-free */
+  std::vector<size_t> pos(r.n_elem);
+  arma::vec x(arma::clamp(r, 0.0, Zeff[0][SAP_NRAD - 1]));
+  for (size_t i = 0; i < r.n_elem; i++)
+    pos[i] = std::min(sap_locate(x(i)), (size_t) SAP_NRAD - 2);
+  for (size_t i = 0; i < r.n_elem; i++)
+    Zr(i) = sap_interpolate(Z, x(i), pos[i]);
+
+  return Zr;
 }
@@ -14,18 +14,76 @@
  * of the License, or (at your option) any later version.
  */
 #include "scf_helpers.h"
+#include "eigensolver.h"
 #include "timer.h"
 #include <cfloat>
+#include <sstream>
+
+extern "C" {
+  void dsyrk_(const char * uplo, const char * trans, const int * n, const int * k, const double * alpha, const double * a, const int * lda, const double * beta, double * c, const int * ldc);
+}
 
 namespace helfem {
   namespace scf {
+    /// P = alpha A A^T for the k columns of the column-major n x k matrix A; only the lower triangle is computed
+    static void syrk_density(arma::mat & P, const double * A, size_t n, size_t k, size_t lda, double alpha) {
+      P.set_size(n,n);
+      if(k==0 || n==0) {
+        P.zeros();
+        return;
+      }
+      const int nn(n), kk(k), ll(lda);
+      const double beta(0.0);
+      dsyrk_("L","N",&nn,&kk,&alpha,A,&ll,&beta,P.memptr(),&nn);
+      for(size_t j=1;j<n;j++)
+        for(size_t i=0;i<j;i++)
+          P(i,j)=P(j,i);
+    }
+
     arma::mat form_density(const arma::mat & C, size_t nocc) {
+      arma::mat P;
+      form_density(P,C,nocc);
+      return P;
+    }
+
+    void form_density(arma::mat & P, const arma::mat & C, size_t nocc) {
       if(C.n_cols<nocc)
         throw std::logic_error("Not enough orbitals!\n");
-      else if(nocc>0)
-        return C.cols(0,nocc-1)*arma::trans(C.cols(0,nocc-1));
-      else // nocc=0
-        return arma::zeros<arma::mat>(C.n_rows,C.n_rows);
+      // The occupied orbitals are the leading columns of C, so they
+      // are passed to BLAS in place
+      syrk_density(P,C.memptr(),C.n_rows,nocc,C.n_rows,1.0);
+    }
+
+    void form_density(arma::mat & P, const arma::mat & C, const arma::vec & occ) {
+      if(C.n_cols<occ.n_elem)
+        throw std::logic_error("Not enough orbitals!\n");
+      if(occ.n_elem && arma::min(occ)<0.0)
+        throw std::logic_error("Negative occupation numbers!\n");
+
+      // Equal occupations only need an overall scale
+      if(!occ.n_elem || arma::all(occ==occ(0))) {
+        syrk_density(P,C.memptr(),C.n_rows,occ.n_elem,C.n_rows,occ.n_elem ? occ(0) : 1.0);
+        return;
+      }
+      arma::mat Cw(C.cols(0,occ.n_elem-1));
+      for(size_t io=0;io<occ.n_elem;io++)
+        Cw.col(io)*=std::sqrt(occ(io));
+      syrk_density(P,Cw.memptr(),Cw.n_rows,Cw.n_cols,Cw.n_rows,1.0);
+    }
+
+    arma::mat lowest_orbitals(const arma::mat & C, size_t nocc, int nvirt) {
+      // At least one orbital is kept, so that the entry is not empty
+      size_t n(std::max<size_t>(nocc+nvirt,1));
+      if(nvirt<0 || n>=C.n_cols)
+        return C;
+      return C.cols(0,n-1);
+    }
+
+    arma::vec lowest_orbitals(const arma::vec & E, size_t nocc, int nvirt) {
+      size_t n(std::max<size_t>(nocc+nvirt,1));
+      if(nvirt<0 || n>=E.n_elem)
+        return E;
+      return E.subvec(0,n-1);
     }
 
     void enforce_occupations(arma::mat & C, arma::vec & E, const arma::mat & S, const arma::ivec & nocc, const std::vector<arma::uvec> & m_idx) {
@@ -132,7 +190,7 @@ namespace helfem {
       // Form matrix in orthonormal basis
       arma::mat Forth(Sinvh.t()*F*Sinvh);
 
-      if(!arma::eig_sym(E,C,Forth))
+      if(!eig_sym_dense(E,C,Forth))
         throw std::logic_error("Eigendecomposition failed!\n");
 
       // Return to non-orthonormal basis
@@ -140,13 +198,13 @@ namespace helfem {
     }
 
     void eig_gsym_sub(arma::vec & E, arma::mat & C, const arma::mat & F, const arma::mat & Sinvh, const std::vector<arma::uvec> & m_idx, bool verbose) {
-      E.zeros(F.n_rows);
-      C.zeros(F.n_rows,F.n_rows);
+      eig_gsym_sub(E,C,F,Sinvh,m_idx,arma::ivec(),verbose);
+    }
 
-      size_t iidx=0;
-      // Loop over symmetries
+    /// Find the orthonormal vectors that belong to each symmetry
+    static std::vector<arma::uvec> sinvh_columns(const arma::mat & Sinvh, const std::vector<arma::uvec> & m_idx) {
+      std::vector<arma::uvec> S_idx(m_idx.size());
       for(size_t isym=0;isym<m_idx.size();isym++) {
-        // Find basis vectors that belong to this symmetry
         arma::mat Scmp(Sinvh.rows(m_idx[isym]));
 
         arma::vec Snrm(Scmp.n_cols);
@@ -154,24 +212,29 @@ namespace helfem {
           Snrm(i)=arma::norm(Scmp.col(i),"fro");
 
         // Column indices of Sinvh that have non-zero elements
-        arma::uvec Sind(arma::find(Snrm));
-
-        // Solve subproblem
-        arma::vec Esub;
-        arma::mat Csub;
-        eig_gsym(Esub,Csub,F,Sinvh.cols(Sind));
+        S_idx[isym]=arma::find(Snrm);
+      }
+      return S_idx;
+    }
 
-        // Store solutions
-        E.subvec(iidx,iidx+Esub.n_elem-1)=Esub;
-        C.cols(iidx,iidx+Esub.n_elem-1)=Csub;
+    void eig_gsym_sub(arma::vec & E, arma::mat & C, const arma::mat & F, const arma::mat & Sinvh, const std::vector<arma::uvec> & m_idx, const arma::ivec & mirror, bool verbose) {
+      eig_gsym_sub(E,C,F,Sinvh,m_idx,sinvh_columns(Sinvh,m_idx),mirror,verbose);
+    }
 
-#if 0
-        printf("Symmetry %i\n",isym);
-        Esub.t().print();
-#endif
+    void eig_gsym_sub(arma::vec & E, arma::mat & C, const arma::mat & F, const arma::mat & Sinvh, const std::vector<arma::uvec> & m_idx, const std::vector<arma::uvec> & S_idx, const arma::ivec & mirror, bool verbose) {
+      if(mirror.n_elem && mirror.n_elem != m_idx.size())
+        throw std::logic_error("Mirror map does not match the symmetry blocks!\n");
+      if(S_idx.size() != m_idx.size())
+        throw std::logic_error("Orthogonalizer columns do not match the symmetry blocks!\n");
+      E.zeros(F.n_rows);
+      C.zeros(F.n_rows,F.n_rows);
 
-        // Increment offset
-        iidx+=Esub.n_elem;
+      // Offsets of the orbitals of each symmetry
+      arma::uvec offset(m_idx.size());
+      size_t iidx=0;
+      for(size_t isym=0;isym<m_idx.size();isym++) {
+        offset(isym)=iidx;
+        iidx+=S_idx[isym].n_elem;
       }
       if(iidx!=F.n_rows) {
         std::ostringstream oss;
@@ -179,6 +242,86 @@ namespace helfem {
         throw std::logic_error(oss.str());
       }
 
+      // Since the symmetries don't mix, Sinvh is block diagonal and
+      // the blocks can be solved independently. The blocks are handed
+      // out largest first to minimize the idle tail
+      arma::vec cost(m_idx.size());
+      for(size_t isym=0;isym<m_idx.size();isym++)
+        cost(isym)=std::pow((double) S_idx[isym].n_elem,3);
+      arma::uvec order(arma::stable_sort_index(cost,"descend"));
+
+      // Is the block solved by its mirror image?
+      std::vector<bool> mirrored(m_idx.size(),false);
+      for(size_t isym=0;isym<mirror.n_elem;isym++)
+        if(mirror(isym)>=0) {
+          if(S_idx[mirror(isym)].n_elem != S_idx[isym].n_elem || m_idx[mirror(isym)].n_elem != m_idx[isym].n_elem)
+            throw std::logic_error("Mirrored symmetry blocks have different dimensions!\n");
+          // The subspace eigenvectors are only transferable if the
+          // orthogonalizers of the two blocks coincide element by element
+          arma::mat Si(Sinvh(m_idx[isym],S_idx[isym]));
+          arma::mat Sj(Sinvh(m_idx[mirror(isym)],S_idx[mirror(isym)]));
+          if(Si.n_elem && arma::abs(Si-Sj).max() > 1e-10*std::max(1.0,arma::abs(Sj).max()))
+            throw std::logic_error("Mirrored symmetry blocks have different orthogonalizers!\n");
+          mirrored[isym]=true;
+        }
+      // Subspace eigenvectors of the blocks that are solved
+      std::vector<arma::mat> Csol(m_idx.size());
+
+      bool fail=false;
+      // The blocks that are large enough for the distributed solver
+      // go first, one at a time on all the MPI ranks; the rest are
+      // solved in parallel on every rank
+      for(int pass=0;pass<2;pass++) {
+        const bool distpass(pass==0);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,1) if(!distpass)
+#endif
+        for(size_t io=0;io<order.n_elem;io++) {
+          size_t isym(order(io));
+          size_t Nsub(S_idx[isym].n_elem);
+          if(!Nsub || mirrored[isym] || eig_distributed(Nsub)!=distpass)
+            continue;
+
+          // Symmetry blocks of the orthogonalizing matrix and the Fock matrix
+          arma::mat Ssub(Sinvh(m_idx[isym],S_idx[isym]));
+          arma::mat Forth(Ssub.t()*F(m_idx[isym],m_idx[isym])*Ssub);
+
+          // Solve subproblem
+          arma::vec Esub;
+          arma::mat Csub;
+          if(!eig_sym_dense(Esub,Csub,Forth)) {
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+            fail=true;
+            continue;
+          }
+
+          // Store solutions; the blocks write to distinct columns
+          arma::uvec cidx(arma::linspace<arma::uvec>(offset(isym),offset(isym)+Nsub-1,Nsub));
+          E(cidx)=Esub;
+          C(m_idx[isym],cidx)=Ssub*Csub;
+          if(mirror.n_elem)
+            Csol[isym]=Csub;
+        }
+      }
+      if(fail)
+        throw std::logic_error("Eigendecomposition failed!\n");
+
+      // The mirrored blocks reuse the subspace eigenvectors
+      for(size_t isym=0;isym<m_idx.size();isym++) {
+        if(!mirrored[isym])
+          continue;
+        size_t jsym(mirror(isym));
+        size_t Nsub(S_idx[isym].n_elem);
+        if(!Nsub)
+          continue;
+        arma::uvec cidx(arma::linspace<arma::uvec>(offset(isym),offset(isym)+Nsub-1,Nsub));
+        arma::uvec jidx(arma::linspace<arma::uvec>(offset(jsym),offset(jsym)+Nsub-1,Nsub));
+        E(cidx)=E(jidx);
+        C(m_idx[isym],cidx)=Sinvh(m_idx[isym],S_idx[isym])*Csol[jsym];
+      }
+
       // Sort energies
       arma::uvec Eord=arma::sort_index(E,"ascend");
       E=E(Eord);
@@ -419,6 +562,215 @@ namespace helfem {
         Cvirt.clear();
     }
 
+    void eig_davidson(arma::vec & E, arma::mat & C, const arma::mat & F, const arma::mat & S, const arma::mat & Sinvh, const arma::mat & Cguess, size_t neig, size_t nsub, int maxit, double convthr, bool verbose) {
+      // Dimension of the orthonormal basis
+      const size_t North(Sinvh.n_cols);
+      if(neig>North)
+        neig=North;
+      // Small problems are solved directly
+      nsub=std::max(nsub,2*neig);
+      if(nsub>=North) {
+        arma::mat Call;
+        eig_gsym(E,Call,F,Sinvh);
+        E=E.subvec(0,neig-1);
+        C=Call.cols(0,neig-1);
+        return;
+      }
+
+      // Diagonal of Sinvh^T F Sinvh estimated from the diagonal of F,
+      // used as the preconditioner
+      arma::vec Fdiag(arma::trans(arma::square(Sinvh))*F.diag());
+
+      // Starting vectors: the previous orbitals in the orthonormal
+      // basis, completed by unit vectors on the lowest diagonal elements
+      arma::mat V;
+      if(Cguess.n_cols)
+        V=arma::orth(arma::trans(Sinvh)*(S*Cguess.cols(0,std::min((size_t) Cguess.n_cols,neig)-1)));
+      arma::uvec dord(arma::sort_index(Fdiag,"ascend"));
+      for(size_t iu=0;V.n_cols<neig && iu<North;iu++) {
+        arma::vec u(North,arma::fill::zeros);
+        u(dord(iu))=1.0;
+        for(int ig=0;ig<2;ig++)
+          if(V.n_cols)
+            u-=V*(arma::trans(V)*u);
+        double unrm(arma::norm(u,2));
+        if(unrm>1e-6)
+          V=arma::join_rows(V,u/unrm);
+      }
+
+      // Matrix-free application of the Fock matrix in the orthonormal basis
+      arma::mat AV(arma::trans(Sinvh)*(F*(Sinvh*V)));
+
+      arma::vec theta;
+      arma::mat X, AX;
+      int iit;
+      for(iit=0;iit<maxit;iit++) {
+        // Rayleigh-Ritz in the subspace
+        arma::mat H(arma::trans(V)*AV);
+        H=0.5*(H+arma::trans(H));
+        arma::vec hval;
+        arma::mat hvec;
+        if(!arma::eig_sym(hval,hvec,H))
+          throw std::logic_error("Eigendecomposition failed!\n");
+        theta=hval.subvec(0,neig-1);
+        X=V*hvec.cols(0,neig-1);
+        AX=AV*hvec.cols(0,neig-1);
+
+        // Residuals
+        arma::mat R(AX-X*arma::diagmat(theta));
+        arma::rowvec rnorm(arma::sqrt(arma::sum(arma::square(R),0)));
+        double rmax(arma::max(rnorm));
+        if(verbose)
+          printf("Davidson iteration %i: subspace %i, max residual %e\n",iit,(int) V.n_cols,rmax);
+        if(rmax<convthr)
+          break;
+
+        // Preconditioned corrections of the unconverged vectors
+        arma::uvec unconv(arma::find(rnorm>=convthr));
+        arma::mat T(North,unconv.n_elem);
+        for(size_t i=0;i<unconv.n_elem;i++) {
+          size_t k(unconv(i));
+          arma::vec denom(theta(k)-Fdiag);
+          for(size_t j=0;j<denom.n_elem;j++)
+            if(std::abs(denom(j))<1e-8)
+              denom(j)=(denom(j)<0.0) ? -1e-8 : 1e-8;
+          T.col(i)=R.col(k)/denom;
+        }
+
+        // Restart from the Ritz vectors if the subspace grows too large
+        if(V.n_cols+T.n_cols>nsub) {
+          V=X;
+          AV=AX;
+        }
+
+        // Orthogonalize the corrections to the subspace twice for stability
+        for(int ig=0;ig<2;ig++)
+          T-=V*(arma::trans(V)*T);
+        arma::vec tnorm(arma::trans(arma::sqrt(arma::sum(arma::square(T),0))));
+        T=T.cols(arma::find(tnorm>1e-10));
+        if(!T.n_cols)
+          break;
+        T=arma::orth(T);
+
+        // Extend the subspace
+        V=arma::join_rows(V,T);
+        AV=arma::join_rows(AV,arma::trans(Sinvh)*(F*(Sinvh*T)));
+      }
+      if(iit==maxit)
+        throw std::runtime_error("Davidson solver did not converge!\n");
+
+      // Go back to non-orthogonal basis
+      E=theta;
+      C=Sinvh*X;
+    }
+
+    void eig_davidson_sub(arma::vec & E, arma::mat & C, const arma::mat & F, const arma::mat & S, const arma::mat & Sinvh, const std::vector<arma::uvec> & m_idx, const arma::mat & Cguess, size_t neig, size_t nsub, int maxit, double convthr) {
+      eig_davidson_sub(E,C,F,S,Sinvh,m_idx,sinvh_columns(Sinvh,m_idx),Cguess,neig,nsub,maxit,convthr);
+    }
+
+    void eig_davidson_sub(arma::vec & E, arma::mat & C, const arma::mat & F, const arma::mat & S, const arma::mat & Sinvh, const std::vector<arma::uvec> & m_idx, const std::vector<arma::uvec> & S_idx, const arma::mat & Cguess, size_t neig, size_t nsub, int maxit, double convthr) {
+      if(S_idx.size() != m_idx.size())
+        throw std::logic_error("Orthogonalizer columns do not match the symmetry blocks!\n");
+      std::vector<arma::vec> Esub(m_idx.size());
+      std::vector<arma::mat> Csub(m_idx.size());
+      size_t ntot=0;
+      for(size_t isym=0;isym<m_idx.size();isym++) {
+        const arma::uvec & idx(m_idx[isym]);
+        const arma::uvec & Sind(S_idx[isym]);
+        if(!Sind.n_elem)
+          continue;
+
+        // Guess orbitals of the symmetry
+        arma::mat Cg;
+        if(Cguess.n_cols) {
+          arma::mat Gcmp(Cguess.rows(idx));
+          arma::vec Gnrm(Gcmp.n_cols);
+          for(size_t i=0;i<Gnrm.n_elem;i++)
+            Gnrm(i)=arma::norm(Gcmp.col(i),"fro");
+          Cg=Gcmp.cols(arma::find(Gnrm>sqrt(DBL_EPSILON)));
+        }
+
+        arma::vec Eblk;
+        arma::mat Cblk;
+        eig_davidson(Eblk,Cblk,F(idx,idx),S(idx,idx),Sinvh(idx,Sind),Cg,neig,nsub,maxit,convthr,false);
+
+        Esub[isym]=Eblk;
+        Csub[isym].zeros(F.n_rows,Cblk.n_cols);
+        Csub[isym].rows(idx)=Cblk;
+        ntot+=Eblk.n_elem;
+      }
+
+      // Collect the solutions
+      E.zeros(ntot);
+      C.zeros(F.n_rows,ntot);
+      size_t iidx=0;
+      for(size_t isym=0;isym<m_idx.size();isym++) {
+        if(!Esub[isym].n_elem)
+          continue;
+        E.subvec(iidx,iidx+Esub[isym].n_elem-1)=Esub[isym];
+        C.cols(iidx,iidx+Esub[isym].n_elem-1)=Csub[isym];
+        iidx+=Esub[isym].n_elem;
+      }
+
+      // Sort energies
+      arma::uvec Eord=arma::sort_index(E,"ascend");
+      E=E(Eord);
+      C=C.cols(Eord);
+    }
+
+    double trace_product(const arma::mat & A, const arma::mat & B) {
+      if(A.n_cols != B.n_rows || A.n_rows != B.n_cols) {
+        std::ostringstream oss;
+        oss << "Can't form the trace of a " << A.n_rows << " x " << A.n_cols << " times a " << B.n_rows << " x " << B.n_cols << " matrix!\n";
+        throw std::logic_error(oss.str());
+      }
+      // Tr(A B) = sum_ij A_ij B_ji
+      return arma::accu(A % B.t());
+    }
+
+    double trace_symm(const arma::mat & A, const arma::mat & B) {
+      return trace_symm(A,std::vector<const arma::mat *>({&B}))(0);
+    }
+
+    arma::vec trace_symm(const arma::mat & P, const std::vector<const arma::mat *> & M) {
+      const size_t N(P.n_rows);
+      for(size_t k=0;k<M.size();k++)
+        if(P.n_rows != P.n_cols || M[k]->n_rows != N || M[k]->n_cols != N) {
+          std::ostringstream oss;
+          oss << "Can't form the trace of a " << P.n_rows << " x " << P.n_cols << " times a " << M[k]->n_rows << " x " << M[k]->n_cols << " matrix!\n";
+          throw std::logic_error(oss.str());
+        }
+
+      // Tr(P M) = sum_ij P_ij M_ij for symmetric matrices; the strictly
+      // lower triangle is contiguous in every column and counts twice
+      arma::vec tr(M.size(),arma::fill::zeros);
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+      {
+        arma::vec wrk(M.size(),arma::fill::zeros);
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic,16)
+#endif
+        for(size_t j=0;j<N;j++) {
+          const double * Pj(P.colptr(j));
+          for(size_t k=0;k<M.size();k++) {
+            const double * Mj(M[k]->colptr(j));
+            double s(0.5*Pj[j]*Mj[j]);
+            for(size_t i=j+1;i<N;i++)
+              s+=Pj[i]*Mj[i];
+            wrk(k)+=s;
+          }
+        }
+#ifdef _OPENMP
+#pragma omp critical(trace_symm_sum)
+#endif
+        tr+=wrk;
+      }
+
+      return 2.0*tr;
+    }
+
     arma::mat perturbation_matrix(size_t N, double ampl) {
       arma::mat R(N,N);
       // Uniform distribution
@@ -467,6 +819,179 @@ namespace helfem {
       NO_to_AO=arma::trans(Sh*Pv);
     }
 
+    arma::mat form_Sinvh(const arma::mat & S, const std::vector<arma::uvec> & m_idx, bool chol) {
+      std::vector<arma::uvec> cidx(block_columns(m_idx));
+      arma::mat Sinvh(S.n_rows,S.n_cols,arma::fill::zeros);
+
+      // The blocks are independent, and are handed out largest first
+      // to minimize the idle tail
+      arma::vec cost(m_idx.size());
+      for(size_t i=0;i<m_idx.size();i++)
+        cost(i)=std::pow((double) m_idx[i].n_elem,3);
+      arma::uvec order(arma::stable_sort_index(cost,"descend"));
+      // Extremal eigenvalues of the normalized blocks
+      arma::vec Smin(m_idx.size()), Scond(m_idx.size());
+      Smin.fill(DBL_MAX);
+      Scond.zeros();
+
+      bool fail=false;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,1)
+#endif
+      for(size_t io=0;io<order.n_elem;io++) {
+        size_t i(order(io));
+        if(!m_idx[i].n_elem)
+          continue;
+
+        arma::mat Ssub(S(m_idx[i],m_idx[i]));
+        arma::vec bfnormlz(arma::pow(arma::diagvec(Ssub),-0.5));
+        Ssub=arma::diagmat(bfnormlz)*Ssub*arma::diagmat(bfnormlz);
+
+        arma::mat Sblk;
+        if(chol) {
+          arma::mat R;
+          if(!arma::chol(R,Ssub) || !arma::inv(Sblk,arma::trimatu(R))) {
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+            fail=true;
+            continue;
+          }
+        } else {
+          arma::vec Sval;
+          arma::mat Svec;
+          if(!arma::eig_sym(Sval,Svec,Ssub)) {
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+            fail=true;
+            continue;
+          }
+          Smin(i)=Sval(0);
+          Scond(i)=Sval(Sval.n_elem-1)/Sval(0);
+          Sblk=Svec*arma::diagmat(arma::pow(Sval,-0.5))*arma::trans(Svec);
+        }
+        // The blocks write to distinct rows and columns
+        Sinvh(m_idx[i],cidx[i])=arma::diagmat(bfnormlz)*Sblk;
+      }
+      if(fail)
+        throw std::logic_error("Orthogonalization of the overlap matrix failed\n");
+      if(!chol)
+        printf("Smallest eigenvalue of overlap matrix is % e, largest condition number of the %i blocks %e\n",arma::min(Smin),(int) m_idx.size(),arma::max(Scond));
+
+      return Sinvh;
+    }
+
+    arma::mat form_Shalf(const arma::mat & S, const std::vector<arma::uvec> & m_idx) {
+      arma::mat Shalf(S.n_rows,S.n_cols,arma::fill::zeros);
+
+      arma::vec cost(m_idx.size());
+      for(size_t i=0;i<m_idx.size();i++)
+        cost(i)=std::pow((double) m_idx[i].n_elem,3);
+      arma::uvec order(arma::stable_sort_index(cost,"descend"));
+      arma::vec Smin(m_idx.size()), Scond(m_idx.size());
+      Smin.fill(DBL_MAX);
+      Scond.zeros();
+
+      bool fail=false;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,1)
+#endif
+      for(size_t io=0;io<order.n_elem;io++) {
+        size_t i(order(io));
+        if(!m_idx[i].n_elem)
+          continue;
+
+        arma::mat Ssub(S(m_idx[i],m_idx[i]));
+        arma::vec bfnormlz(arma::pow(arma::diagvec(Ssub),-0.5));
+        arma::vec bfinvnormlz(arma::pow(arma::diagvec(Ssub),0.5));
+        Ssub=arma::diagmat(bfnormlz)*Ssub*arma::diagmat(bfnormlz);
+
+        arma::vec Sval;
+        arma::mat Svec;
+        if(!arma::eig_sym(Sval,Svec,Ssub)) {
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+          fail=true;
+          continue;
+        }
+        Smin(i)=Sval(0);
+        Scond(i)=Sval(Sval.n_elem-1)/Sval(0);
+        Shalf(m_idx[i],m_idx[i])=arma::diagmat(bfinvnormlz)*Svec*arma::diagmat(arma::pow(Sval,0.5))*arma::trans(Svec);
+      }
+      if(fail)
+        throw std::logic_error("Diagonalization of overlap matrix failed\n");
+      printf("Smallest eigenvalue of overlap matrix is % e, largest condition number of the %i blocks %e\n",arma::min(Smin),(int) m_idx.size(),arma::max(Scond));
+
+      return Shalf;
+    }
+
+    /// Arnoldi approximation of exp(-i H dt) v; the error estimate is returned in err
+    static arma::cx_vec expm_krylov_vec(const arma::cx_mat & H, const arma::cx_vec & v, double dt, size_t m, double & err) {
+      const double beta(arma::norm(v,2));
+      err=0.0;
+      if(beta==0.0)
+        return v;
+
+      m=std::min(m,(size_t) H.n_rows);
+      arma::cx_mat V(H.n_rows,m+1,arma::fill::zeros);
+      arma::cx_mat h(m+1,m,arma::fill::zeros);
+      V.col(0)=v/beta;
+      size_t k;
+      for(k=0;k<m;k++) {
+        arma::cx_vec w(H*V.col(k));
+        // Modified Gram-Schmidt, repeated once for stability
+        for(int ipass=0;ipass<2;ipass++)
+          for(size_t i=0;i<=k;i++) {
+            std::complex<double> c(arma::cdot(V.col(i),w));
+            h(i,k)+=c;
+            w-=c*V.col(i);
+          }
+        h(k+1,k)=arma::norm(w,2);
+        if(std::abs(h(k+1,k))<=DBL_EPSILON*beta) {
+          // The subspace is invariant, so the result is exact
+          k++;
+          return beta*V.cols(0,k-1)*arma::expmat(arma::cx_mat(std::complex<double>(0.0,-dt)*h.submat(0,0,k-1,k-1))).col(0);
+        }
+        V.col(k+1)=w/h(k+1,k);
+      }
+
+      arma::cx_vec y(arma::expmat(arma::cx_mat(std::complex<double>(0.0,-dt)*h.submat(0,0,m-1,m-1))).col(0));
+      // The residual is carried by the last basis vector
+      err=beta*std::abs(h(m,m-1))*std::abs(y(m-1));
+      return beta*V.cols(0,m-1)*y;
+    }
+
+    int expm_krylov(const arma::cx_mat & H, arma::cx_mat & C, double dt, size_t m, double thr) {
+      for(int nsub=1;;nsub*=2) {
+        double err(0.0);
+        arma::cx_mat Cnew(C);
+        for(int isub=0;isub<nsub;isub++)
+          for(size_t i=0;i<Cnew.n_cols;i++) {
+            double e;
+            Cnew.col(i)=expm_krylov_vec(H,Cnew.col(i),dt/nsub,m,e);
+            err=std::max(err,e);
+          }
+        if(err<=thr || nsub>=1024) {
+          C=Cnew;
+          return nsub;
+        }
+      }
+    }
+
+    std::vector<arma::uvec> block_columns(const std::vector<arma::uvec> & m_idx) {
+      std::vector<arma::uvec> cidx(m_idx.size());
+      size_t ioff=0;
+      for(size_t i=0;i<m_idx.size();i++) {
+        if(!m_idx[i].n_elem)
+          continue;
+        cidx[i]=arma::linspace<arma::uvec>(ioff,ioff+m_idx[i].n_elem-1,m_idx[i].n_elem);
+        ioff+=m_idx[i].n_elem;
+      }
+      return cidx;
+    }
+
     void ROHF_update(arma::mat & Fa_AO, arma::mat & Fb_AO, const arma::mat & P_AO, const arma::mat & Sh, const arma::mat & Sinvh, int nocca, int noccb) {
       /*
        * T. Tsuchimochi and G. E. Scuseria, "Constrained active space
@@ -525,6 +1050,16 @@ namespace helfem {
     }
 
 
+    void print_load_balance(const std::string & label, const arma::vec & thrtime) {
+      if(!thrtime.n_elem)
+        return;
+      double tmean(arma::mean(thrtime));
+      double tmax(arma::max(thrtime));
+      double imbalance(tmean>0.0 ? (tmax/tmean-1.0)*100.0 : 0.0);
+      printf("%s: thread busy time min %.3f mean %.3f max %.3f s, imbalance %.1f%%\n",label.c_str(),arma::min(thrtime),tmean,tmax,imbalance);
+      fflush(stdout);
+    }
+
     std::string memory_size(size_t size) {
       std::ostringstream ret;
 
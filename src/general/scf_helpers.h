@@ -22,6 +22,14 @@ namespace helfem {
   namespace scf {
     /// Form density matrix
     arma::mat form_density(const arma::mat & C, size_t nocc);
+    /// Form the density matrix of the first nocc orbitals into P with a symmetric rank-k update; P keeps its memory if it already has the right size
+    void form_density(arma::mat & P, const arma::mat & C, size_t nocc);
+    /// Form the density matrix of the first occ.n_elem orbitals weighted by the (fractional) occupations occ into P
+    void form_density(arma::mat & P, const arma::mat & C, const arma::vec & occ);
+    /// The lowest nocc+nvirt orbitals, or all of them for negative nvirt
+    arma::mat lowest_orbitals(const arma::mat & C, size_t nocc, int nvirt);
+    /// The lowest nocc+nvirt orbital energies, or all of them for negative nvirt
+    arma::vec lowest_orbitals(const arma::vec & E, size_t nocc, int nvirt);
     /// Enforce occupation of wanted symmetries
     void enforce_occupations(arma::mat & C, arma::vec & E, const arma::mat & S, const arma::ivec & nocc, const std::vector<arma::uvec> & m_idx);
 
@@ -34,6 +42,17 @@ namespace helfem {
     void eig_gsym(arma::vec & E, arma::mat & C, const arma::mat & F, const arma::mat & Sinvh);
     /// Solve generalized eigenvalue problem in subspaces
     void eig_gsym_sub(arma::vec & E, arma::mat & C, const arma::mat & F, const arma::mat & Sinvh, const std::vector<arma::uvec> & m_idx, bool verbose=true);
+    /**
+     * Solve generalized eigenvalue problem in subspaces. The blocks
+     * with mirror(isym)>=0 reuse the eigenvectors of block
+     * mirror(isym), so the rows m_idx and the columns of Sinvh of the
+     * two blocks must be listed in the same order of partner
+     * functions, with equal blocks of F and Sinvh. The Sinvh blocks
+     * are checked.
+     */
+    void eig_gsym_sub(arma::vec & E, arma::mat & C, const arma::mat & F, const arma::mat & Sinvh, const std::vector<arma::uvec> & m_idx, const arma::ivec & mirror, bool verbose=true);
+    /// Solve generalized eigenvalue problem in subspaces, given the columns S_idx of Sinvh that belong to each block
+    void eig_gsym_sub(arma::vec & E, arma::mat & C, const arma::mat & F, const arma::mat & Sinvh, const std::vector<arma::uvec> & m_idx, const std::vector<arma::uvec> & S_idx, const arma::ivec & mirror, bool verbose=true);
     /// Solve eigenvalue problem in subspaces
     void eig_sym_sub(arma::vec & E, arma::mat & C, const arma::mat & F, const std::vector<arma::uvec> & m_idx);
 
@@ -46,6 +65,19 @@ namespace helfem {
 
     /// Iterative eigenvalue solver
     void eig_iter(arma::vec & E, arma::mat & Cocc, arma::mat & Cvirt, const arma::mat & F, const arma::mat & Sinvh, size_t nocc, size_t neig, size_t nsub, int maxit, double convthr);
+    /// Block Davidson solver for the neig lowest orbitals, warm-started from the orbitals Cguess. F is only applied to vectors
+    void eig_davidson(arma::vec & E, arma::mat & C, const arma::mat & F, const arma::mat & S, const arma::mat & Sinvh, const arma::mat & Cguess, size_t neig, size_t nsub, int maxit, double convthr, bool verbose=true);
+    /// Block Davidson solver in symmetry subspaces; neig orbitals are solved in each subspace
+    void eig_davidson_sub(arma::vec & E, arma::mat & C, const arma::mat & F, const arma::mat & S, const arma::mat & Sinvh, const std::vector<arma::uvec> & m_idx, const arma::mat & Cguess, size_t neig, size_t nsub, int maxit, double convthr);
+    /// Block Davidson solver in symmetry subspaces, given the columns S_idx of Sinvh that belong to each block
+    void eig_davidson_sub(arma::vec & E, arma::mat & C, const arma::mat & F, const arma::mat & S, const arma::mat & Sinvh, const std::vector<arma::uvec> & m_idx, const std::vector<arma::uvec> & S_idx, const arma::mat & Cguess, size_t neig, size_t nsub, int maxit, double convthr);
+
+    /// Trace Tr(A B) in O(N^2), without forming the product
+    double trace_product(const arma::mat & A, const arma::mat & B);
+    /// Trace Tr(A B) of symmetric matrices; only the lower triangles are read
+    double trace_symm(const arma::mat & A, const arma::mat & B);
+    /// Traces Tr(P M[k]) of symmetric matrices in a single pass over the lower triangle of P
+    arma::vec trace_symm(const arma::mat & P, const std::vector<const arma::mat *> & M);
 
     /// Random perturbation
     arma::mat perturbation_matrix(size_t N, double ampl);
@@ -56,12 +88,28 @@ namespace helfem {
     inline arma::mat form_Sinvh(arma::mat S, bool chol=false) {
       return utils::invh(S, chol);
     }
+    /// Form half-inverse overlap of a block diagonal S block by block; the columns of each block follow those of the earlier ones, see block_columns
+    arma::mat form_Sinvh(const arma::mat & S, const std::vector<arma::uvec> & m_idx, bool chol=false);
+    /// Form half overlap of a block diagonal S block by block
+    arma::mat form_Shalf(const arma::mat & S, const std::vector<arma::uvec> & m_idx);
+    /// Columns of the blocks of a half-inverse overlap formed block by block
+    std::vector<arma::uvec> block_columns(const std::vector<arma::uvec> & m_idx);
 
     /// ROHF update to Fock matrices
     void ROHF_update(arma::mat & Fa_AO, arma::mat & Fb_AO, const arma::mat & P_AO, const arma::mat & Sh, const arma::mat & Sinvh, int nocca, int noccb);
 
+    /**
+     * Apply the propagator exp(-i H dt) to the columns of C. The
+     * exponential of each column is formed in a Krylov subspace of
+     * dimension at most m; if its error estimate exceeds thr, the
+     * step is split into substeps. Returns the number of substeps.
+     */
+    int expm_krylov(const arma::cx_mat & H, arma::cx_mat & C, double dt, size_t m, double thr);
+
     /// Human readable memory size
     std::string memory_size(size_t size);
+    /// Print statistics of per-thread busy times in a parallel loop
+    void print_load_balance(const std::string & label, const arma::vec & thrtime);
     /// Parse number of alpha and beta electrons
     void parse_nela_nelb(int & nela, int & nelb, int & Q, int & M, int Z);
 
@@ -0,0 +1,103 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#include "scratch.h"
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+}
+
+namespace helfem {
+  namespace scratch {
+    tei_storage_t choose_storage(size_t need, size_t budget, const std::string & dir) {
+      if(budget==0 || need<=budget)
+        return TEI_INCORE;
+      if(dir.size())
+        return TEI_MMAP;
+      return TEI_RECOMPUTE;
+    }
+
+    std::string storage_name(tei_storage_t storage) {
+      switch(storage) {
+      case(TEI_INCORE):
+        return "in core";
+      case(TEI_MMAP):
+        return "out of core";
+      case(TEI_RECOMPUTE):
+        return "recomputed on the fly";
+      }
+      return "unknown";
+    }
+
+    MappedFile::MappedFile(const std::string & dir, size_t ndouble) : data(NULL), ndata(ndouble) {
+      // Create the file
+      std::string templ(dir + "/helfem_teiXXXXXX");
+      std::vector<char> fname(templ.begin(),templ.end());
+      fname.push_back('\0');
+      int fd=mkstemp(fname.data());
+      if(fd<0) {
+        std::ostringstream oss;
+        oss << "Could not create scratch file in " << dir << ": " << strerror(errno) << "!\n";
+        throw std::runtime_error(oss.str());
+      }
+      // The file is freed when the mapping goes away
+      unlink(fname.data());
+
+      size_t nbytes(ndata*sizeof(double));
+      if(nbytes && ftruncate(fd,nbytes)!=0) {
+        std::ostringstream oss;
+        oss << "Could not reserve " << nbytes << " bytes of scratch in " << dir << ": " << strerror(errno) << "!\n";
+        close(fd);
+        throw std::runtime_error(oss.str());
+      }
+      if(nbytes) {
+        void * ptr=mmap(NULL,nbytes,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+        if(ptr==MAP_FAILED) {
+          std::ostringstream oss;
+          oss << "Could not map scratch file in " << dir << ": " << strerror(errno) << "!\n";
+          close(fd);
+          throw std::runtime_error(oss.str());
+        }
+        data=(double *) ptr;
+      }
+      close(fd);
+    }
+
+    MappedFile::~MappedFile() {
+      if(data)
+        munmap(data,ndata*sizeof(double));
+    }
+
+    double * MappedFile::memptr(size_t offset) const {
+      if(offset>ndata) {
+        std::ostringstream oss;
+        oss << "Offset " << offset << " is out of bounds for scratch file of " << ndata << " doubles!\n";
+        throw std::logic_error(oss.str());
+      }
+      return data+offset;
+    }
+
+    size_t MappedFile::size() const {
+      return ndata;
+    }
+  }
+}
@@ -0,0 +1,66 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#ifndef SCRATCH_H
+#define SCRATCH_H
+
+#include <cstddef>
+#include <string>
+
+namespace helfem {
+  namespace scratch {
+    /// Storage of the primitive two-electron integrals
+    enum tei_storage_t {
+      /// Kept in memory
+      TEI_INCORE,
+      /// Kept in a memory-mapped scratch file
+      TEI_MMAP,
+      /// Recomputed whenever they are needed
+      TEI_RECOMPUTE
+    };
+
+    /// Pick the storage given the memory need and budget in bytes (zero for unlimited) and the scratch directory
+    tei_storage_t choose_storage(size_t need, size_t budget, const std::string & dir);
+    /// Name of the storage
+    std::string storage_name(tei_storage_t storage);
+
+    /// Scratch file mapped into memory. The file is unlinked right
+    /// away, so it disappears once the mapping is released.
+    class MappedFile {
+      /// Mapped memory
+      double * data;
+      /// Number of doubles
+      size_t ndata;
+
+      /// Not copyable
+      MappedFile(const MappedFile &);
+      /// Not copyable
+      MappedFile & operator=(const MappedFile &);
+
+    public:
+      /// Create a file for ndouble doubles in directory dir
+      MappedFile(const std::string & dir, size_t ndouble);
+      /// Destructor
+      ~MappedFile();
+
+      /// Get pointer to the data at offset
+      double * memptr(size_t offset=0) const;
+      /// Number of doubles
+      size_t size() const;
+    };
+  }
+}
+
+#endif
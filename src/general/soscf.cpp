@@ -0,0 +1,203 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#include "soscf.h"
+#include <cmath>
+#include <cstdio>
+
+namespace helfem {
+  namespace scf {
+    OrbitalLBFGS::OrbitalLBFGS(size_t nmax) : LBFGS(nmax) {
+    }
+
+    void OrbitalLBFGS::set_diagonal(const arma::vec & H) {
+      Hdiag=H;
+    }
+
+    arma::vec OrbitalLBFGS::apply_diagonal_hessian(const arma::vec & q) const {
+      if(Hdiag.n_elem != q.n_elem)
+        return LBFGS::apply_diagonal_hessian(q);
+      return q/Hdiag;
+    }
+
+    SOSCF::SOSCF(size_t nhist, double trust_) : bfgs(nhist), trust(trust_), trust0(trust_), nocca(0), noccb(0), restricted(false), active_(false), Eold(0.0), dEpred(0.0), have_old(false) {
+    }
+
+    arma::mat SOSCF::rotate(const arma::mat & C0, size_t nocc, const arma::vec & x) {
+      const size_t Nmo(C0.n_cols);
+      if(!nocc || nocc>=Nmo)
+        return C0;
+      const size_t nvirt(Nmo-nocc);
+
+      // Antisymmetric generator
+      arma::mat K(Nmo,Nmo,arma::fill::zeros);
+      arma::mat X(arma::reshape(x,nvirt,nocc));
+      K.submat(nocc,0,Nmo-1,nocc-1)=X;
+      K.submat(0,nocc,nocc-1,Nmo-1)=-arma::trans(X);
+
+      // K^2 = -V diag(theta^2) V^T, so that
+      // exp(K) = V cos(theta) V^T + V sinc(theta) V^T K
+      arma::vec theta2;
+      arma::mat V;
+      arma::eig_sym(theta2,V,-K*K);
+      arma::vec cth(theta2.n_elem), sth(theta2.n_elem);
+      for(size_t i=0;i<theta2.n_elem;i++) {
+        double th(std::sqrt(std::max(theta2(i),0.0)));
+        cth(i)=std::cos(th);
+        sth(i)=(th>1e-8) ? std::sin(th)/th : 1.0-th*th/6.0;
+      }
+      arma::mat U(V*arma::diagmat(cth)*arma::trans(V) + V*arma::diagmat(sth)*arma::trans(V)*K);
+
+      return C0*U;
+    }
+
+    arma::vec SOSCF::gradient(const arma::mat & F, const arma::mat & C, size_t nocc, double fac, arma::vec & g, arma::vec & H) {
+      // Smallest orbital energy difference in the diagonal Hessian
+      const double Hmin(0.1);
+
+      arma::mat Fmo(arma::trans(C)*F*C);
+      const size_t Nmo(C.n_cols);
+      if(!nocc || nocc>=Nmo) {
+        g.clear();
+        H.clear();
+        return arma::diagvec(Fmo);
+      }
+
+      const size_t nvirt(Nmo-nocc);
+      g=fac*arma::vectorise(Fmo.submat(nocc,0,Nmo-1,nocc-1));
+      H.zeros(nvirt*nocc);
+      for(size_t i=0;i<nocc;i++)
+        for(size_t a=0;a<nvirt;a++)
+          H(i*nvirt+a)=fac*std::max(Fmo(nocc+a,nocc+a)-Fmo(i,i),Hmin);
+
+      return arma::diagvec(Fmo);
+    }
+
+    void SOSCF::orbitals(const arma::vec & xv, arma::mat & Ca, arma::mat & Cb) const {
+      const size_t na((C0a.n_cols>nocca) ? (C0a.n_cols-nocca)*nocca : 0);
+      Ca=rotate(C0a,nocca,xv.head(na));
+      if(restricted)
+        Cb=Ca;
+      else
+        Cb=rotate(C0b,noccb,xv.tail(xv.n_elem-na));
+    }
+
+    void SOSCF::reset(const arma::mat & Ca, const arma::mat & Cb, size_t nela, size_t nelb, bool restricted_) {
+      C0a=Ca;
+      C0b=Cb;
+      nocca=nela;
+      noccb=nelb;
+      restricted=restricted_;
+
+      size_t nx((C0a.n_cols>nocca) ? (C0a.n_cols-nocca)*nocca : 0);
+      if(!restricted && C0b.n_cols>noccb)
+        nx+=(C0b.n_cols-noccb)*noccb;
+      x.zeros(nx);
+      xold.zeros(nx);
+      bfgs.clear();
+      trust=trust0;
+      have_old=false;
+      dEpred=0.0;
+      active_=true;
+    }
+
+    bool SOSCF::active() const {
+      return active_;
+    }
+
+    void SOSCF::stop() {
+      active_=false;
+      bfgs.clear();
+    }
+
+    void SOSCF::step(const arma::mat & Fa, const arma::mat & Fb, double E, arma::mat & Ca, arma::vec & Ea, arma::mat & Cb, arma::vec & Eb) {
+      // Orbitals at the current point
+      arma::mat Cca, Ccb;
+      orbitals(x,Cca,Ccb);
+
+      // Energy test of the previous step
+      if(have_old) {
+        double dE(E-Eold);
+        if(dE>0.0) {
+          // Backtrack: halve the step and the trust radius
+          arma::vec p(x-xold);
+          trust=0.5*arma::norm(p,2);
+          x=xold+0.5*p;
+          dEpred=0.0;
+          printf("Second-order step raised the energy by %e, backtracking to trust radius %e\n",dE,trust);
+
+          orbitals(x,Ca,Cb);
+          Ea=arma::diagvec(arma::trans(Ca)*Fa*Ca);
+          Eb=restricted ? Ea : arma::vec(arma::diagvec(arma::trans(Cb)*Fb*Cb));
+          return;
+        }
+
+        // Adapt the trust radius to the quality of the model
+        if(dEpred<0.0) {
+          double ratio(dE/dEpred);
+          if(ratio<0.25)
+            trust*=0.5;
+          else if(ratio>0.75 && arma::norm(x-xold,2)>=0.99*trust)
+            trust=std::min(2.0*trust,4.0*trust0);
+        }
+      }
+
+      // The gradient is evaluated in the current orbitals, which is
+      // only accurate to first order in x; a rotation that has grown
+      // large is absorbed into the reference orbitals
+      if(arma::norm(x,2)>1.0) {
+        C0a=Cca;
+        C0b=Ccb;
+        x.zeros();
+        bfgs.clear();
+      }
+
+      // Gradient and diagonal Hessian
+      arma::vec ga, Ha, gb, Hb;
+      gradient(Fa,Cca,nocca,restricted ? 4.0 : 2.0,ga,Ha);
+      if(!restricted)
+        gradient(Fb,Ccb,noccb,2.0,gb,Hb);
+      arma::vec g(arma::join_cols(ga,gb));
+      arma::vec H(arma::join_cols(Ha,Hb));
+
+      // Quasi-Newton step
+      bfgs.set_diagonal(H);
+      bfgs.update(x,g);
+      arma::vec p(-bfgs.solve());
+      if(arma::dot(p,g)>=0.0) {
+        // Not a descent direction; restart from the diagonal Hessian
+        bfgs.clear();
+        bfgs.update(x,g);
+        p=-g/H;
+      }
+      double plen(arma::norm(p,2));
+      if(plen>trust) {
+        p*=trust/plen;
+        plen=trust;
+      }
+      dEpred=arma::dot(g,p)+0.5*arma::dot(p,H%p);
+      printf("Second-order step: gradient norm %e, step length %e, trust radius %e\n",arma::norm(g,2),plen,trust);
+
+      xold=x;
+      Eold=E;
+      have_old=true;
+      x+=p;
+
+      orbitals(x,Ca,Cb);
+      Ea=arma::diagvec(arma::trans(Ca)*Fa*Ca);
+      Eb=restricted ? Ea : arma::vec(arma::diagvec(arma::trans(Cb)*Fb*Cb));
+    }
+  }
+}
@@ -0,0 +1,99 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#ifndef SOSCF_H
+#define SOSCF_H
+
+#include <armadillo>
+#include "lbfgs.h"
+
+namespace helfem {
+  namespace scf {
+    /// LBFGS with the orbital energy differences as the diagonal Hessian
+    class OrbitalLBFGS : public LBFGS {
+      /// Diagonal Hessian
+      arma::vec Hdiag;
+      /// Apply the inverse of the diagonal Hessian
+      arma::vec apply_diagonal_hessian(const arma::vec & q) const;
+    public:
+      /// Constructor
+      OrbitalLBFGS(size_t nmax=10);
+      /// Set the diagonal Hessian
+      void set_diagonal(const arma::vec & H);
+    };
+
+    /**
+     * Second-order SCF solver for the occupied-virtual orbital
+     * rotations, C = C0 exp(K(x)). The quasi-Newton step is formed by
+     * LBFGS, which is preconditioned with the orbital energy
+     * differences, so that the gradient history of the preceding Fock
+     * builds refines the diagonal Hessian without extra builds. The
+     * step is kept within a trust radius that is adapted from the
+     * ratio of the actual and predicted energy changes, and steps that
+     * raise the energy are backtracked.
+     */
+    class SOSCF {
+      /// Quasi-Newton accelerator
+      OrbitalLBFGS bfgs;
+      /// Trust radius
+      double trust;
+      /// Initial trust radius
+      double trust0;
+      /// Reference orbitals
+      arma::mat C0a, C0b;
+      /// Number of occupied orbitals
+      size_t nocca, noccb;
+      /// Are the alpha and beta orbitals the same?
+      bool restricted;
+      /// Is the solver in use?
+      bool active_;
+
+      /// Current rotation parameters and those of the last accepted step
+      arma::vec x, xold;
+      /// Energy of the last accepted step, and the predicted change of the energy
+      double Eold, dEpred;
+      /// Has a step been taken?
+      bool have_old;
+
+      /// Rotated orbitals C0 exp(K(x)) of one spin channel; x holds the virtual-occupied block
+      static arma::mat rotate(const arma::mat & C0, size_t nocc, const arma::vec & x);
+      /// Gradient and diagonal Hessian of one spin channel in the orbitals C; returns the diagonal of the MO Fock matrix
+      static arma::vec gradient(const arma::mat & F, const arma::mat & C, size_t nocc, double fac, arma::vec & g, arma::vec & H);
+      /// Orbitals of both spin channels for the parameters x
+      void orbitals(const arma::vec & x, arma::mat & Ca, arma::mat & Cb) const;
+
+    public:
+      /// Constructor
+      SOSCF(size_t nhist=10, double trust=0.5);
+
+      /// Start from the orbitals Ca and Cb; their first nela and nelb columns are occupied
+      void reset(const arma::mat & Ca, const arma::mat & Cb, size_t nela, size_t nelb, bool restricted);
+      /// Is the solver in use?
+      bool active() const;
+      /// Stop using the solver
+      void stop();
+
+      /**
+       * Take a step. Fa and Fb are the Fock matrices of the orbitals
+       * returned by the previous call (or given to reset), and E is
+       * their energy. On return, Ca and Cb hold the new orbitals, and
+       * Ea and Eb the diagonals of the MO Fock matrices.
+       */
+      void step(const arma::mat & Fa, const arma::mat & Fb, double E, arma::mat & Ca, arma::vec & Ea, arma::mat & Cb, arma::vec & Eb);
+    };
+  }
+}
+
+#endif
@@ -17,6 +17,7 @@
 #include "spherical_harmonics.h"
 #include <cmath>
 #include <cfloat>
+#include <stdexcept>
 extern "C" {
 // Legendre polynomials
 #include <gsl/gsl_sf_legendre.h>
@@ -39,3 +40,74 @@ std::complex<double> spherical_harmonics(int l, int m, double cth, double phi) {
 
   return ylm;
 }
+
+void spherical_harmonics(int lmax, const arma::vec & cth, const arma::vec & phi, arma::cx_mat & Y, arma::cx_mat & dYth, arma::cx_mat & dYphi, bool deriv) {
+  if(cth.n_elem != phi.n_elem)
+    throw std::logic_error("cth and phi have different lengths!\n");
+  const size_t Nlm(spherical_harmonics_index(lmax,lmax)+1);
+  const size_t Np(cth.n_elem);
+
+  // Normalized associated Legendre functions, including the
+  // Condon-Shortley phase, for m>=0
+  arma::mat Plm(Nlm,Np,arma::fill::zeros);
+  for(size_t ip=0;ip<Np;ip++) {
+    const double x(cth(ip));
+    const double sx(std::sqrt(std::max(0.0,1.0-x*x)));
+    double * P(Plm.colptr(ip));
+
+    // Sectoral terms
+    P[0]=1.0/std::sqrt(4.0*M_PI);
+    for(int m=1;m<=lmax;m++)
+      P[spherical_harmonics_index(m,m)]=-std::sqrt((2.0*m+1.0)/(2.0*m))*sx*P[spherical_harmonics_index(m-1,m-1)];
+    // and the rest by upward recursion in l
+    for(int m=0;m<lmax;m++) {
+      P[spherical_harmonics_index(m+1,m)]=std::sqrt(2.0*m+3.0)*x*P[spherical_harmonics_index(m,m)];
+      for(int l=m+2;l<=lmax;l++) {
+        double a(std::sqrt((4.0*l*l-1.0)/(l*l-m*m)));
+        double b(std::sqrt(((l-1.0)*(l-1.0)-m*m)/(4.0*(l-1.0)*(l-1.0)-1.0)));
+        P[spherical_harmonics_index(l,m)]=a*(x*P[spherical_harmonics_index(l-1,m)]-b*P[spherical_harmonics_index(l-2,m)]);
+      }
+    }
+  }
+
+  // Azimuthal factors
+  Y.zeros(Nlm,Np);
+  for(size_t ip=0;ip<Np;ip++) {
+    const std::complex<double> eiphi(std::exp(std::complex<double>(0.0,phi(ip))));
+    std::complex<double> eimphi(1.0,0.0);
+    for(int m=0;m<=lmax;m++) {
+      for(int l=m;l<=lmax;l++) {
+        std::complex<double> ylm(Plm(spherical_harmonics_index(l,m),ip)*eimphi);
+        Y(spherical_harmonics_index(l,m),ip)=ylm;
+        // Y_l^{-m} = (-1)^m conj(Y_l^m)
+        if(m>0)
+          Y(spherical_harmonics_index(l,-m),ip)=(m%2 ? -1.0 : 1.0)*std::conj(ylm);
+      }
+      eimphi*=eiphi;
+    }
+  }
+
+  if(!deriv) {
+    dYth.reset();
+    dYphi.reset();
+    return;
+  }
+
+  // d/dphi Y_l^m = i m Y_l^m, and
+  // d/dth Y_l^m = m cot th Y_l^m + sqrt((l-m)(l+m+1)) exp(-i phi) Y_l^{m+1}
+  dYth.zeros(Nlm,Np);
+  dYphi.zeros(Nlm,Np);
+  for(size_t ip=0;ip<Np;ip++) {
+    const double cotth(cth(ip)/std::sqrt(1.0-cth(ip)*cth(ip)));
+    const std::complex<double> emiphi(std::exp(std::complex<double>(0.0,-phi(ip))));
+    for(int l=0;l<=lmax;l++)
+      for(int m=-l;m<=l;m++) {
+        size_t idx(spherical_harmonics_index(l,m));
+        dYphi(idx,ip)=std::complex<double>(0.0,m)*Y(idx,ip);
+        std::complex<double> d(m*cotth*Y(idx,ip));
+        if(m<l)
+          d+=std::sqrt((double) (l-m)*(l+m+1))*emiphi*Y(spherical_harmonics_index(l,m+1),ip);
+        dYth(idx,ip)=d;
+      }
+  }
+}
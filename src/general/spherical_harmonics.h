@@ -17,9 +17,24 @@
 #ifndef ERKALE_SPHHARM
 #define ERKALE_SPHHARM
 
+#include <armadillo>
 #include <complex>
 
 /// Calculate value of \f$ Y_{l}^{m} (\cos \theta, \phi) = (-1)^m \sqrt{ \frac {2l +1} {4 \pi} \frac {(l-m)!} {(l+m)!} } P_l^m (\cos \theta) e^{i m \phi} \f$
 std::complex<double> spherical_harmonics(int l, int m, double cth, double phi);
 
+/// Index of \f$ Y_l^m \f$ in the tables of spherical_harmonics(): l^2 + l + m
+inline size_t spherical_harmonics_index(int l, int m) {
+  return (size_t) (l*l+l+m);
+}
+
+/**
+ * Calculate all \f$ Y_{l}^{m} \f$ with \f$ l \le l_{\rm max} \f$ at
+ * the points (cth(i), phi(i)) by the three-term recurrences of the
+ * normalized associated Legendre functions. Y(spherical_harmonics_index(l,m),i)
+ * holds the value at the i:th point. If wanted, the derivatives with
+ * respect to theta and phi are formed as well.
+ */
+void spherical_harmonics(int lmax, const arma::vec & cth, const arma::vec & phi, arma::cx_mat & Y, arma::cx_mat & dYth, arma::cx_mat & dYphi, bool deriv);
+
 #endif
@@ -0,0 +1,151 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#include "telemetry.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <stdexcept>
+#include <sys/resource.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace helfem {
+  namespace telemetry {
+    /// Output stream
+    static FILE *out=NULL;
+    /// Lock for the output, since the atomic solvers may run in parallel
+    static std::mutex out_lock;
+
+    static void close_at_exit() {
+      if(out)
+        fclose(out);
+      out=NULL;
+    }
+
+    void open(const std::string & fname) {
+      std::lock_guard<std::mutex> lock(out_lock);
+      if(out)
+        return;
+      out=fopen(fname.c_str(),"a");
+      if(!out) {
+        std::ostringstream oss;
+        oss << "Could not open telemetry file " << fname << " for writing!\n";
+        throw std::runtime_error(oss.str());
+      }
+      std::atexit(close_at_exit);
+    }
+
+    bool enabled() {
+      return out!=NULL;
+    }
+
+    size_t peak_rss() {
+      struct rusage usage;
+      if(getrusage(RUSAGE_SELF,&usage))
+        return 0;
+#ifdef __APPLE__
+      // macOS reports bytes
+      return usage.ru_maxrss;
+#else
+      // Linux reports kilobytes
+      return ((size_t) usage.ru_maxrss)*1024;
+#endif
+    }
+
+    /// Quote a string for JSON
+    static std::string quote(const std::string & str) {
+      std::string ret("\"");
+      for(size_t i=0;i<str.size();i++) {
+        if(str[i]=='"' || str[i]=='\\')
+          ret+='\\';
+        ret+=str[i];
+      }
+      ret+='"';
+      return ret;
+    }
+
+    /// Print out a number; JSON has no infinities or NaNs
+    static std::string number(double val) {
+      if(!std::isfinite(val))
+        return "null";
+      char buf[32];
+      snprintf(buf,sizeof(buf),"%.16e",val);
+      return buf;
+    }
+
+    Record::Record(const std::string & source) : nfields(0) {
+      add("source",source);
+    }
+
+    Record::~Record() {
+    }
+
+    void Record::key(const std::string & name) {
+      fields << (nfields++ ? ", " : "") << quote(name) << ": ";
+    }
+
+    void Record::add(const std::string & name, double val) {
+      key(name);
+      fields << number(val);
+    }
+
+    void Record::add(const std::string & name, int val) {
+      key(name);
+      fields << val;
+    }
+
+    void Record::add(const std::string & name, bool val) {
+      key(name);
+      fields << (val ? "true" : "false");
+    }
+
+    void Record::add(const std::string & name, const std::string & val) {
+      key(name);
+      fields << quote(val);
+    }
+
+    void Record::add(const std::string & name, const char * val) {
+      add(name,std::string(val));
+    }
+
+    void Record::add(const std::string & name, const arma::vec & val) {
+      key(name);
+      fields << "[";
+      for(size_t i=0;i<val.n_elem;i++)
+        fields << (i ? ", " : "") << number(val(i));
+      fields << "]";
+    }
+
+    void Record::write() {
+      if(!out)
+        return;
+
+      int nthreads=1;
+#ifdef _OPENMP
+      nthreads=omp_get_max_threads();
+#endif
+      add("threads",nthreads);
+      add("peak_rss",(double) peak_rss());
+
+      std::lock_guard<std::mutex> lock(out_lock);
+      fprintf(out,"{%s}\n",fields.str().c_str());
+      fflush(out);
+    }
+  }
+}
@@ -0,0 +1,69 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <armadillo>
+#include <sstream>
+#include <string>
+
+namespace helfem {
+  namespace telemetry {
+    /// Turn on the telemetry stream; the records are appended to
+    /// fname, one JSON object per line
+    void open(const std::string & fname);
+    /// Is the stream on?
+    bool enabled();
+    /// Peak resident set size of the process in bytes
+    size_t peak_rss();
+
+    /// A record of the stream, e.g. a single SCF iteration. The
+    /// thread count and the peak resident set size are added to
+    /// every record when it is written out.
+    class Record {
+      /// Fields written so far
+      std::ostringstream fields;
+      /// Number of fields
+      size_t nfields;
+      /// Start a new field
+      void key(const std::string & name);
+
+    public:
+      /// Start a record of the given source, e.g. the program
+      Record(const std::string & source);
+      /// Destructor
+      ~Record();
+
+      /// Add a number
+      void add(const std::string & name, double val);
+      /// Add an integer
+      void add(const std::string & name, int val);
+      /// Add a boolean
+      void add(const std::string & name, bool val);
+      /// Add a string
+      void add(const std::string & name, const std::string & val);
+      /// Add a string
+      void add(const std::string & name, const char * val);
+      /// Add a vector as a JSON array
+      void add(const std::string & name, const arma::vec & val);
+
+      /// Write out the record
+      void write();
+    };
+  }
+}
+
+#endif
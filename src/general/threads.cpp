@@ -0,0 +1,123 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#include "threads.h"
+#include <cstdio>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// The BLAS thread controls are looked up as weak symbols, so that the
+// code links against any BLAS library
+#if defined(__GNUC__)
+#define HELFEM_WEAK __attribute__((weak))
+extern "C" {
+  void openblas_set_num_threads(int num_threads) HELFEM_WEAK;
+  int openblas_get_num_threads(void) HELFEM_WEAK;
+  void MKL_Set_Num_Threads(int nth) HELFEM_WEAK;
+  int MKL_Get_Max_Threads(void) HELFEM_WEAK;
+}
+#endif
+
+namespace helfem {
+  namespace threads {
+    /// Number of BLAS threads in the serial phases, zero if not set
+    static int serial_blas=0;
+
+    /// Get the current number of BLAS threads, zero if it cannot be controlled
+    static int get_blas() {
+#if defined(__GNUC__)
+      if(openblas_get_num_threads)
+        return openblas_get_num_threads();
+      if(MKL_Get_Max_Threads)
+        return MKL_Get_Max_Threads();
+#endif
+      return 0;
+    }
+
+    /// Set the number of BLAS threads
+    static void set_blas(int n) {
+      if(n<1)
+        return;
+#if defined(__GNUC__)
+      if(openblas_set_num_threads)
+        openblas_set_num_threads(n);
+      else if(MKL_Set_Num_Threads)
+        MKL_Set_Num_Threads(n);
+#endif
+    }
+
+    void set_policy(int outer, int blas) {
+#ifdef _OPENMP
+      if(outer>0)
+        omp_set_num_threads(outer);
+#else
+      (void) outer;
+#endif
+      if(blas>0) {
+        serial_blas=blas;
+        set_blas(blas);
+      }
+    }
+
+    int outer_threads() {
+#ifdef _OPENMP
+      return omp_get_max_threads();
+#else
+      return 1;
+#endif
+    }
+
+    int blas_threads() {
+      if(serial_blas>0)
+        return serial_blas;
+      return get_blas();
+    }
+
+    std::string blas_library() {
+#if defined(__GNUC__)
+      if(openblas_set_num_threads)
+        return "OpenBLAS";
+      if(MKL_Set_Num_Threads)
+        return "MKL";
+#endif
+      return "";
+    }
+
+    void print_policy() {
+      std::string lib(blas_library());
+      if(lib.size())
+        printf("Thread policy: %i OpenMP threads in the parallel kernels with single-threaded %s, %i %s threads in the serial phases\n",outer_threads(),lib.c_str(),blas_threads(),lib.c_str());
+      else
+        printf("Thread policy: %i OpenMP threads in the parallel kernels; the BLAS threads are not controlled\n",outer_threads());
+      fflush(stdout);
+    }
+
+    KernelPhase::KernelPhase() : nblas(0) {
+#ifdef _OPENMP
+      if(omp_in_parallel())
+        return;
+#endif
+      nblas=blas_threads();
+      if(nblas>1)
+        set_blas(1);
+    }
+
+    KernelPhase::~KernelPhase() {
+      if(nblas>1)
+        set_blas(nblas);
+    }
+  }
+}
@@ -0,0 +1,62 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#ifndef THREADS_H
+#define THREADS_H
+
+#include <string>
+
+namespace helfem {
+  namespace threads {
+    /**
+     * Thread policy of the OpenMP kernels and the threaded BLAS.
+     * Kernels such as the exchange build call BLAS from inside OpenMP
+     * parallel regions, where threaded BLAS oversubscribes the cores,
+     * while the eigensolvers and the DIIS products call BLAS from
+     * serial code, where it should use all of them. The BLAS thread
+     * count is switched per phase with openblas_set_num_threads or
+     * MKL_Set_Num_Threads, whichever is linked in; with other BLAS
+     * libraries only the OpenMP thread count is controlled.
+     */
+
+    /// Set the number of OpenMP threads of the parallel kernels and the number of BLAS threads in the serial phases; zero keeps the current setting
+    void set_policy(int outer, int blas);
+    /// Get the number of OpenMP threads of the parallel kernels
+    int outer_threads();
+    /// Get the number of BLAS threads in the serial phases
+    int blas_threads();
+    /// Name of the BLAS library whose threads are controlled, empty if none
+    std::string blas_library();
+    /// Print out the policy
+    void print_policy();
+
+    /// Scoped phase with OpenMP parallel kernels, in which BLAS runs on a single thread
+    class KernelPhase {
+      /// Number of BLAS threads to restore
+      int nblas;
+      /// Not copyable
+      KernelPhase(const KernelPhase &);
+      /// Not copyable
+      KernelPhase & operator=(const KernelPhase &);
+    public:
+      /// Enter phase; must be called outside parallel sections
+      KernelPhase();
+      /// Restore the serial BLAS threads
+      ~KernelPhase();
+    };
+  }
+}
+
+#endif
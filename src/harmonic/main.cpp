@@ -36,9 +36,31 @@ arma::mat kinetic(const helfem::polynomial_basis::FiniteElementBasis & fem, cons
   return fem.matrix_element(true, true, x, wx, nullptr);
 }
 
+/// Solve the lowest eigenpairs in banded storage
+void solve_banded(const helfem::polynomial_basis::FiniteElementBasis & fem, const arma::vec & xq, const arma::vec & wq, size_t neig) {
+  helfem::polynomial_basis::BandedMatrix S(fem.matrix_element_banded(false, false, xq, wq, nullptr));
+  helfem::polynomial_basis::BandedMatrix H(fem.matrix_element_banded(true, true, xq, wq, nullptr));
+  H+=fem.matrix_element_banded(false, false, xq, wq, square_potential);
+  printf("Banded matrices with bandwidth %i use %e bytes\n",(int) S.get_bandwidth(),(double) (S.memory_size()+H.memory_size()));
+
+  arma::vec E;
+  arma::mat C;
+  helfem::polynomial_basis::eig_gsym_banded(E,C,H,S,neig);
+
+  printf("Eigenvalues\n");
+  for(size_t i=0;i<E.n_elem;i++)
+    printf("%i % 10.6f % 10.6f\n",(int) i, E(i),E(i)-(2*i+1));
+
+  // Test orthonormality
+  arma::mat Smo(C.t()*(S*C));
+  Smo-=arma::eye<arma::mat>(Smo.n_rows,Smo.n_cols);
+  printf("Orbital orthonormality devation is %e\n",arma::norm(Smo,"fro"));
+}
+
 int main(int argc, char **argv) {
-  if(argc!=6) {
-    printf("Usage: %s xmax Nel Nnode primbas Nquad\n",argv[0]);
+  if(argc!=6 && argc!=7) {
+    printf("Usage: %s xmax Nel Nnode primbas Nquad (Neig)\n",argv[0]);
+    printf("With Neig>0 the Neig lowest states are solved in banded storage.\n");
     return 1;
   }
 
@@ -53,6 +75,8 @@ int main(int argc, char **argv) {
   int primbas=atoi(argv[4]);
   // Order of quadrature rule
   int Nquad=atoi(argv[5]);
+  // Number of states for the banded solver
+  int Neig=(argc==7) ? atoi(argv[6]) : 0;
 
   printf("Running calculation with xmax=%e and %i elements.\n",xmax,Nelem);
   printf("Using %i point quadrature rule.\n",Nquad);
@@ -85,6 +109,12 @@ int main(int argc, char **argv) {
   size_t Nbf(fem.get_nbf());
   printf("Basis set contains %i functions\n",(int) Nbf);
 
+  if(Neig>0) {
+    // The dense matrices are never formed
+    solve_banded(fem, xq, wq, Neig);
+    return 0;
+  }
+
   // Form overlap matrix
   arma::mat S(overlap(fem, xq, wq));
   // Form potential matrix
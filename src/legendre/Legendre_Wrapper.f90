@@ -189,6 +189,54 @@ contains
     deallocate(Qlm)
   end subroutine calc_Qlm_arr
 
+  ! C interface: calculate the arrays of both Plm and Qlm at many points
+  ! at once. The work arrays are allocated only once for all the points.
+  subroutine calc_PQlm_arr(P,Q,lmax,mmax,xi,nxi) bind(C,name='calc_PQlm_arr')
+    integer(kind=c_int), value :: lmax
+    integer(kind=c_int), value :: mmax
+    integer(kind=c_int), value :: nxi
+    real(kind=c_double) :: P(0:lmax,0:mmax,nxi)
+    real(kind=c_double) :: Q(0:lmax,0:mmax,nxi)
+    real(kind=c_double), intent(in) :: xi(nxi)
+
+    integer :: ip, lreg, lirr
+
+    lreg = max(lmax,mmax)
+    lirr = max(lreg,1) ! Libray has problems with l_max=0
+    m_min = 0
+    m_max = mmax
+    Leg%D%A%Dir = 'Miller'
+
+    allocate(x(1))
+    allocate(Leg%R_LM%F(0:lreg,0:mmax))
+    allocate(Leg%I_LM%F(0:lirr,0:mmax))
+    do ip=1,nxi
+       ! The irregular functions are singular at xi=1
+       if(xi(ip) == 1.0d0) then
+          P(:,:,ip) = 0.0d0
+          Q(:,:,ip) = 0.0d0
+          cycle
+       end if
+       x(1)=xi(ip)
+
+       ! The recursions don't touch the entries with l < m
+       directive = 'regular'
+       l_max = lreg
+       Leg%R_LM%F = 0.0d0
+       call Legendre( R_LM=Leg%R_LM )
+       P(:,:,ip) = Leg%R_LM%F(0:lmax,:)
+
+       directive = 'irregular'
+       l_max = lirr
+       Leg%I_LM%F = 0.0d0
+       call Legendre( I_LM=Leg%I_LM )
+       Q(:,:,ip) = Leg%I_LM%F(0:lmax,:)
+    end do
+    deallocate(Leg%R_LM%F)
+    deallocate(Leg%I_LM%F)
+    deallocate(x)
+  end subroutine calc_PQlm_arr
+
   ! C interfaces: calculate values
   function calc_Plm_val(l,m,xi) result(R) bind(C,name='calc_Plm_val')
     integer(kind=c_int), value :: l
@@ -64,6 +64,16 @@ double calc_Qlm_val(int l, int m, double xi);
  */
 void calc_Qlm_arr(double *Qlm, int lmax, int mmax, double xi);
 
+/**
+ * Calculates the regular and irregular Legendre functions at nxi
+ * points at once. Plm and Qlm should be arrays of size
+ * (lmax+1)*(mmax+1)*nxi, and the values for the i:th point are stored
+ * in Fortran order starting at offset i*(lmax+1)*(mmax+1). The values
+ * at xi=1 are set to zero. The library keeps its work variables
+ * thread-private, so this can be called by several threads at once.
+ */
+void calc_PQlm_arr(double *Plm, double *Qlm, int lmax, int mmax, const double *xi, int nxi);
+
 #ifdef __cplusplus
 }
 #endif
@@ -199,6 +199,13 @@ MODULE Special_Functions
 !                                                                   
   TYPE(Legendre_Functions)                :: Leg
 !
+!                 The work variables are private to each thread, so that
+!                 the library can be called from several threads at once.
+!$omp threadprivate(x, y, m_max, m_min, l_max, n_points, normalized, Derivative,      &
+!$omp&              norm, arg, scale_factor, log_factor, wron, Factor, l, m, m_sign,  &
+!$omp&              s_fac, step, row_label, col_label, title, Control, recur,         &
+!$omp&              Directive, Leg)
+!
 !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
 !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
 END MODULE Special_Functions
@@ -1,5 +1,6 @@
 #include "Legendre_Wrapper.h"
 #include "../general/spherical_harmonics.h"
+#include "../general/legendretable.h"
 #include <armadillo>
 
 void get_coord(double Rh, double mu, double eta, double phi, double & x, double & y, double & z) {
@@ -96,5 +97,33 @@ int main(void) {
   }
   printf("%21s % .16f\n","Exact energy",Eex);
 
+  // Check the series used by the Legendre tables far from the foci
+  // against the library
+  double maxdiff=0.0;
+  for(double xi=helfem::legendretable::asymptotic_threshold();xi<=1e3;xi*=2.0) {
+    arma::mat Plib(get_Plm(Lmax,Lmax,xi));
+    arma::mat Qlib(get_Qlm(Lmax,Lmax,xi));
+    arma::mat Pser, Qser;
+    helfem::legendretable::regular_Plm(xi,Lmax,Lmax,Pser);
+    if(!helfem::legendretable::asymptotic_Qlm(xi,Lmax,Lmax,Qser)) {
+      printf("Series for Qlm did not converge at xi = %e\n",xi);
+      return 1;
+    }
+    double dP=0.0, dQ=0.0;
+    for(int M=0;M<=Lmax;M++)
+      for(int L=M;L<=Lmax;L++) {
+        if(std::isnormal(Plib(L,M)))
+          dP=std::max(dP,std::abs(Pser(L,M)/Plib(L,M)-1.0));
+        if(std::isnormal(Qlib(L,M)))
+          dQ=std::max(dQ,std::abs(Qser(L,M)/Qlib(L,M)-1.0));
+      }
+    printf("xi = %e: maximal relative difference in Plm %e, in Qlm %e\n",xi,dP,dQ);
+    maxdiff=std::max(maxdiff,std::max(dP,dQ));
+  }
+  if(maxdiff > thr) {
+    printf("Series and library disagree!\n");
+    return 1;
+  }
+
   return 0.0;
 }
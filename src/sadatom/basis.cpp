@@ -21,6 +21,7 @@
 #include "utils.h"
 #include "../general/scf_helpers.h"
 #include "../general/dftfuncs.h"
+#include <algorithm>
 #include <cassert>
 #include <cfloat>
 
@@ -55,6 +56,10 @@ namespace helfem {
       TwoDBasis::~TwoDBasis() {
       }
 
+      int TwoDBasis::get_Z() const {
+        return Z;
+      }
+
       size_t TwoDBasis::Nbf() const {
         return radial.Nbf();
       }
@@ -165,24 +170,37 @@ namespace helfem {
         size_t N_L(2*arma::max(lval)+1);
         size_t Nel(radial.Nel());
 
-        // Compute disjoint integrals
+        std::shared_ptr<tei_t> ints(std::make_shared<tei_t>());
+        std::vector<arma::mat> & disjoint_L(ints->disjoint_L);
+        std::vector<arma::mat> & disjoint_m1L(ints->disjoint_m1L);
+        std::vector<arma::mat> & prim_tei(ints->prim_tei);
+        std::vector<arma::mat> & prim_ktei(ints->prim_ktei);
+
+        // Compute disjoint integrals, all L values of an element at once
         disjoint_L.resize(Nel*N_L);
         disjoint_m1L.resize(Nel*N_L);
-        for(size_t L=0;L<N_L;L++)
-          for(size_t iel=0;iel<Nel;iel++) {
-            disjoint_L[L*Nel+iel]=radial.radial_integral(L,iel);
-            disjoint_m1L[L*Nel+iel]=radial.radial_integral(-L-1,iel);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,1)
+#endif
+        for(size_t iel=0;iel<Nel;iel++) {
+          std::vector<arma::mat> rL, rm1L;
+          radial.radial_moments(N_L-1,iel,rL,rm1L);
+          for(size_t L=0;L<N_L;L++) {
+            disjoint_L[L*Nel+iel]=rL[L];
+            disjoint_m1L[L*Nel+iel]=rm1L[L];
           }
+        }
 
-        // Form two-electron integrals
+        // Form two-electron integrals, all L values of an element at once
         prim_tei.resize(Nel*Nel*N_L);
 #ifdef _OPENMP
-#pragma omp parallel for collapse(2)
+#pragma omp parallel for schedule(dynamic)
 #endif
-        for(size_t L=0;L<N_L;L++) {
-          for(size_t iel=0;iel<Nel;iel++) {
+        for(size_t iel=0;iel<Nel;iel++) {
+          std::vector<arma::mat> tei(radial.twoe_integrals(N_L-1,iel));
+          for(size_t L=0;L<N_L;L++) {
             // In-element integral
-            prim_tei[Nel*Nel*L + iel*Nel + iel]=radial.twoe_integral(L,iel);
+            prim_tei[Nel*Nel*L + iel*Nel + iel]=tei[L];
           }
         }
 
@@ -195,26 +213,58 @@ namespace helfem {
           for(size_t iel=0;iel<Nel;iel++) {
             // Diagonal integrals
             size_t Ni(radial.Nprim(iel));
-            prim_ktei[Nel*Nel*L + iel*Nel + iel]=utils::exchange_tei(prim_tei[Nel*Nel*L + iel*Nel + iel],Ni,Ni,Ni,Ni);
+            utils::exchange_tei(prim_tei[Nel*Nel*L + iel*Nel + iel],Ni,Ni,Ni,Ni,prim_ktei[Nel*Nel*L + iel*Nel + iel]);
           }
+
+        tei=ints;
+      }
+
+      std::shared_ptr<const tei_t> TwoDBasis::get_tei() const {
+        return tei;
+      }
+
+      void TwoDBasis::set_tei(const std::shared_ptr<const tei_t> & tei_) {
+        if(!tei_)
+          throw std::logic_error("Primitive teis have not been computed!\n");
+
+        // Check that the integrals match the radial basis
+        size_t N_L(2*arma::max(lval)+1);
+        size_t Nel(radial.Nel());
+        bool match(tei_->prim_tei.size() == Nel*Nel*N_L && tei_->disjoint_L.size() == Nel*N_L);
+        for(size_t iel=0;match && iel<Nel;iel++) {
+          size_t Ni(radial.Nprim(iel));
+          match = (tei_->prim_tei[iel*Nel+iel].n_rows == Ni*Ni);
+        }
+        if(!match)
+          throw std::logic_error("Two-electron integrals were computed in an incompatible radial basis!\n");
+
+        tei=tei_;
       }
 
       void TwoDBasis::compute_yukawa(double lambda_) {
         lambda=lambda_;
         yukawa=true;
+        rs_lowrank_a.clear();
+        rs_lowrank_b.clear();
 
         // Number of distinct L values is
         size_t N_L(2*arma::max(lval)+1);
         size_t Nel(radial.Nel());
 
-        // Compute disjoint integrals
+        // Compute disjoint integrals, all L values of an element at once
         disjoint_iL.resize(Nel*N_L);
         disjoint_kL.resize(Nel*N_L);
-        for(size_t L=0;L<N_L;L++)
-          for(size_t iel=0;iel<Nel;iel++) {
-            disjoint_iL[L*Nel+iel]=radial.bessel_il_integral(L,lambda,iel);
-            disjoint_kL[L*Nel+iel]=radial.bessel_kl_integral(L,lambda,iel);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,1)
+#endif
+        for(size_t iel=0;iel<Nel;iel++) {
+          std::vector<arma::mat> iL, kL;
+          radial.bessel_integrals(N_L-1,lambda,iel,iL,kL);
+          for(size_t L=0;L<N_L;L++) {
+            disjoint_iL[L*Nel+iel]=iL[L];
+            disjoint_kL[L*Nel+iel]=kL[L];
           }
+        }
 
         /*
           The exchange matrix is given by
@@ -234,11 +284,11 @@ namespace helfem {
           for(size_t iel=0;iel<Nel;iel++) {
             // Diagonal integrals
             size_t Ni(radial.Nprim(iel));
-            rs_ktei[Nel*Nel*L + iel*Nel + iel]=utils::exchange_tei(radial.yukawa_integral(L,lambda,iel),Ni,Ni,Ni,Ni);
+            utils::exchange_tei(radial.yukawa_integral(L,lambda,iel),Ni,Ni,Ni,Ni,rs_ktei[Nel*Nel*L + iel*Nel + iel]);
           }
       }
 
-      void TwoDBasis::compute_erfc(double mu) {
+      void TwoDBasis::compute_erfc(double mu, double thr) {
         lambda=mu;
         yukawa=false;
 
@@ -259,25 +309,39 @@ namespace helfem {
           To get this in the proper order, we permute the integrals
           K(jk) = (jk;il) P(il)
           so we don't have to reform the permutations in the exchange routine.
+
+          Element pairs whose integrals are estimated to be below the
+          threshold are skipped, and pairs of elements that do not
+          touch are stored in low-rank form when that is smaller.
         */
-        rs_ktei.resize(Nel*Nel*N_L);
+        rs_ktei.assign(Nel*Nel*N_L,arma::mat());
+        rs_lowrank_a.assign(Nel*Nel*N_L,arma::mat());
+        rs_lowrank_b.assign(Nel*Nel*N_L,arma::mat());
 #ifdef _OPENMP
-#pragma omp parallel for collapse(2)
+#pragma omp parallel for collapse(2) schedule(dynamic)
 #endif
         for(size_t L=0;L<N_L;L++)
           for(size_t iel=0;iel<Nel;iel++) {
             for(size_t kel=0;kel<Nel;kel++) {
-              // Diagonal integrals
               size_t Ni(radial.Nprim(iel));
               size_t Nk(radial.Nprim(kel));
-              rs_ktei[Nel*Nel*L + iel*Nel + kel]=utils::exchange_tei(radial.erfc_integral(L,lambda,iel,kel),Ni,Ni,Nk,Nk);
+              const size_t idx(Nel*Nel*L + iel*Nel + kel);
+              if(iel != kel && thr>0.0 && radial.erfc_integral_bound(L,lambda,iel,kel)<thr)
+                continue;
+              arma::mat tei(radial.erfc_integral(L,lambda,iel,kel));
+              if(std::abs((int) iel - (int) kel)>1 && utils::lowrank_tei(tei,thr,rs_lowrank_a[idx],rs_lowrank_b[idx]))
+                continue;
+              utils::exchange_tei(tei,Ni,Ni,Nk,Nk,rs_ktei[idx]);
             }
           }
       }
 
       arma::mat TwoDBasis::coulomb(const arma::mat & P) const {
-        if(!prim_tei.size())
+        if(!tei)
           throw std::logic_error("Primitive teis have not been computed!\n");
+        const std::vector<arma::mat> & disjoint_L(tei->disjoint_L);
+        const std::vector<arma::mat> & disjoint_m1L(tei->disjoint_m1L);
+        const std::vector<arma::mat> & prim_tei(tei->prim_tei);
 
         // Number of radial elements
         size_t Nel(radial.Nel());
@@ -296,8 +360,8 @@ namespace helfem {
             arma::mat Psub(P.submat(jfirst,jfirst,jlast,jlast));
 
             // Contract integrals
-            double jsmall = Lfac*arma::trace(disjoint_L[L*Nel+jel]*Psub);
-            double jbig = Lfac*arma::trace(disjoint_m1L[L*Nel+jel]*Psub);
+            double jsmall = Lfac*scf::trace_product(disjoint_L[L*Nel+jel],Psub);
+            double jbig = Lfac*scf::trace_product(disjoint_m1L[L*Nel+jel],Psub);
 
             // Increment J: jel>iel
             for(size_t iel=0;iel<jel;iel++) {
@@ -340,12 +404,15 @@ namespace helfem {
       }
 
       arma::cube TwoDBasis::exchange(const arma::cube & P) const {
-        if(!prim_ktei.size())
+        if(!tei)
           throw std::logic_error("Primitive teis have not been computed!\n");
+        const std::vector<arma::mat> & disjoint_L(tei->disjoint_L);
+        const std::vector<arma::mat> & disjoint_m1L(tei->disjoint_m1L);
+        const std::vector<arma::mat> & prim_ktei(tei->prim_ktei);
 
         // Gaunt coefficient table
         int gmax(arma::max(lval));
-        gaunt::Gaunt gaunt(gmax,2*gmax,gmax);
+        const gaunt::Gaunt & gaunt(*gaunt::shared_table(gmax,2*gmax,gmax));
 
         if(P.n_slices != (arma::uword) gmax+1)
           throw std::logic_error("Density matrix am does not match basis set!\n");
@@ -361,6 +428,63 @@ namespace helfem {
         arma::cube K(Nrad,Nrad,gmax+1);
         K.zeros();
 
+        // Radial density helpers of every output angular momentum; a
+        // channel is overwritten instead of cleared on its first coupling
+        std::vector<arma::cube> Prad(gmax+1);
+        // Do we have a coupling
+        std::vector< std::vector<bool> > coupling(gmax+1,std::vector<bool>(2*gmax+1,false));
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+        // Loop over angular momentum of output
+        for(int lout=0;lout<=gmax;lout++) {
+          Prad[lout].set_size(Nrad,Nrad,2*gmax+1);
+
+          // Do angular sums: loop over input angular momentum
+          for(int lin=0;lin<=gmax;lin++) {
+            // Skip if nothing to do
+            if(arma::norm(P.slice(lin),2)==0.0)
+              continue;
+
+            // Possible couplings (lin,lout) => L
+            int Lmin=std::abs(lin-lout);
+            int Lmax=lin+lout;
+
+            arma::vec totcoup;
+            totcoup.zeros(Lmax+1);
+            // Sum over m values: output indices
+            for(int mout=-lout;mout<=lout;mout++) {
+              // and input indices
+              for(int min=-lin;min<=lin;min++) {
+                // LH m value
+                int M(mout-min);
+                for(int L=Lmin;L<=Lmax;L++) {
+                  // Calculate total coupling coefficient
+                  double cpl(gaunt.coeff(lout,mout,L,M,lin,min)*gaunt.coeff(lout,mout,L,M,lin,min));
+                  totcoup(L)+=cpl;
+                }
+              }
+            }
+            // Averaging wrt output
+            totcoup /= 2*lout+1;
+
+            // Increment radial density matrix
+            for(int L=Lmin;L<=Lmax;L++) {
+              // Check if coupling exists
+              if(totcoup(L)==0.0)
+                continue;
+
+              // Form density matrix
+              double Lfac=4.0*M_PI/(2*L+1);
+              if(coupling[lout][L])
+                Prad[lout].slice(L)+=(Lfac*totcoup(L))*P.slice(lin);
+              else
+                Prad[lout].slice(L)=(Lfac*totcoup(L))*P.slice(lin);
+              coupling[lout][L]=true;
+            }
+          }
+        }
+
         // Helper memory
 #ifdef _OPENMP
         const int nth(omp_get_max_threads());
@@ -370,133 +494,97 @@ namespace helfem {
         std::vector<arma::vec> mem_Ksub(nth);
         std::vector<arma::vec> mem_Psub(nth);
         std::vector<arma::vec> mem_T(nth);
-
-#ifdef _OPENMP
-#pragma omp parallel
-#endif
-        {
-#ifdef _OPENMP
-          const int ith(omp_get_thread_num());
-#else
-          const int ith(0);
-#endif
-          // These are only small submatrices!
+        // These are only small submatrices!
+        for(int ith=0;ith<nth;ith++) {
           mem_Psub[ith].zeros(radial.max_Nprim()*radial.max_Nprim());
           mem_Ksub[ith].zeros(radial.max_Nprim()*radial.max_Nprim());
           mem_T[ith].zeros(radial.max_Nprim()*radial.max_Nprim());
+        }
 
-          // Increment
+        // With fewer output angular momenta than threads, the output
+        // elements are distributed over the threads as well. This is
+        // done in two passes over the even and the odd elements, since
+        // adjacent elements share a radial function.
+        const bool split(gmax+1<nth);
+        const size_t npass(split ? 2 : 1);
+        for(size_t pass=0;pass<npass;pass++) {
+          // Number of tasks per angular momentum
+          const size_t ntask(split ? (Nel+1-pass)/2 : 1);
 #ifdef _OPENMP
-#pragma omp for
+#pragma omp parallel for collapse(2) schedule(dynamic)
 #endif
-          // Loop over angular momentum of output
-          for(int lout=0;lout<=gmax;lout++) {
-            // Initialize memory
-            arma::cube Prad;
-            Prad.zeros(Nrad,Nrad,2*gmax+1);
-            // Do we have a coupling
-            std::vector<bool> coupling(2*gmax+1,false);
-
-            // Do angular sums: loop over input angular momentum
-            for(int lin=0;lin<=gmax;lin++) {
-              // Skip if nothing to do
-              if(arma::norm(P.slice(lin),2)==0.0)
-                continue;
-
-              // Possible couplings (lin,lout) => L
-              int Lmin=std::abs(lin-lout);
-              int Lmax=lin+lout;
-
-              arma::vec totcoup;
-              totcoup.zeros(Lmax+1);
-              // Sum over m values: output indices
-              for(int mout=-lout;mout<=lout;mout++) {
-                // and input indices
-                for(int min=-lin;min<=lin;min++) {
-                  // LH m value
-                  int M(mout-min);
-                  for(int L=Lmin;L<=Lmax;L++) {
-                    // Calculate total coupling coefficient
-                    double cpl(gaunt.coeff(lout,mout,L,M,lin,min)*gaunt.coeff(lout,mout,L,M,lin,min));
-                    totcoup(L)+=cpl;
-                  }
-                }
-              }
-              // Averaging wrt output
-              totcoup /= 2*lout+1;
+          for(size_t iout=0;iout<(size_t) gmax+1;iout++) {
+            for(size_t itask=0;itask<ntask;itask++) {
+#ifdef _OPENMP
+              const int ith(omp_get_thread_num());
+#else
+              const int ith(0);
+#endif
+              const int lout(iout);
+              // Output elements of the task
+              const size_t ielbeg(split ? 2*itask+pass : 0);
+              const size_t ielend(split ? ielbeg+1 : Nel);
 
-              // Increment radial density matrix
-              for(int L=Lmin;L<=Lmax;L++) {
-                // Check if coupling exists
-                if(totcoup(L)==0.0)
+              for(size_t L=0;L<coupling[lout].size();L++) {
+                if(!coupling[lout][L])
                   continue;
 
-                // Form density matrix
-                double Lfac=4.0*M_PI/(2*L+1);
-                Prad.slice(L)+=(Lfac*totcoup(L))*P.slice(lin);
-                coupling[L]=true;
-              }
-            }
-
-            for(size_t L=0;L<coupling.size();L++) {
-              if(!coupling[L])
-                continue;
-
-              // Radial matrix
-              arma::mat P_L(Prad.slice(L));
-
-              // Loop over elements: output
-              for(size_t iel=0;iel<Nel;iel++) {
-                size_t ifirst, ilast;
-                radial.get_idx(iel,ifirst,ilast);
-
-                // Input
-                for(size_t jel=0;jel<Nel;jel++) {
-                  size_t jfirst, jlast;
-                  radial.get_idx(jel,jfirst,jlast);
-
-                  // Number of functions in the two elements
-                  size_t Ni(ilast-ifirst+1);
-                  size_t Nj(jlast-jfirst+1);
-
-                  if(iel == jel) {
-                    /*
-                      The exchange matrix is given by
-                      K(jk) = (ij|kl) P(il)
-                      i.e. the complex conjugation hits i and l as
-                      in the density matrix.
-
-                      To get this in the proper order, we permute the integrals
-                      K(jk) = (jk;il) P(il)
-                    */
-
-                    // Exchange submatrix
-                    arma::mat Ksub(mem_Ksub[ith].memptr(),Ni*Nj,1,false,true);
-                    Ksub=prim_ktei[Nel*Nel*L + iel*Nel + jel]*arma::vectorise(P_L.submat(ifirst,jfirst,ilast,jlast));
-                    Ksub.reshape(Ni,Nj);
-
-                    // Increment global exchange matrix
-                    K.slice(lout).submat(ifirst,jfirst,ilast,jlast)-=Ksub;
-
-                  } else {
-                    // Disjoint integrals. When r(iel)>r(jel), iel gets -1-L, jel gets L.
-                    const arma::mat & iint=(iel>jel) ? disjoint_m1L[L*Nel+iel] : disjoint_L[L*Nel+iel];
-                    const arma::mat & jint=(iel>jel) ? disjoint_L[L*Nel+jel] : disjoint_m1L[L*Nel+jel];
-
-                    // Get density submatrix (Niel x Njel)
-                    arma::mat Psub(mem_Psub[ith].memptr(),Ni,Nj,false,true);
-                    Psub=P_L.submat(ifirst,jfirst,ilast,jlast);
-
-                    // Calculate helper
-                    arma::mat T(mem_T[ith].memptr(),Ni,Nj,false,true);
-                    // (Niel x Njel) = (Niel x Njel) x (Njel x Njel)
-                    T=Psub*arma::trans(jint);
-                    // Exchange submatrix
-                    arma::mat Ksub(mem_Ksub[ith].memptr(),Ni,Nj,false,true);
-                    Ksub=iint*T;
-
-                    // Increment global exchange matrix
-                    K.slice(lout).submat(ifirst,jfirst,ilast,jlast)-=Ksub;
+                // Radial matrix
+                const arma::mat P_L(Prad[lout].slice(L).memptr(),Nrad,Nrad,false,true);
+
+                // Loop over elements: output
+                for(size_t iel=ielbeg;iel<ielend;iel++) {
+                  size_t ifirst, ilast;
+                  radial.get_idx(iel,ifirst,ilast);
+
+                  // Input
+                  for(size_t jel=0;jel<Nel;jel++) {
+                    size_t jfirst, jlast;
+                    radial.get_idx(jel,jfirst,jlast);
+
+                    // Number of functions in the two elements
+                    size_t Ni(ilast-ifirst+1);
+                    size_t Nj(jlast-jfirst+1);
+
+                    if(iel == jel) {
+                      /*
+                        The exchange matrix is given by
+                        K(jk) = (ij|kl) P(il)
+                        i.e. the complex conjugation hits i and l as
+                        in the density matrix.
+
+                        To get this in the proper order, we permute the integrals
+                        K(jk) = (jk;il) P(il)
+                      */
+
+                      // Exchange submatrix
+                      arma::mat Ksub(mem_Ksub[ith].memptr(),Ni*Nj,1,false,true);
+                      Ksub=prim_ktei[Nel*Nel*L + iel*Nel + jel]*arma::vectorise(P_L.submat(ifirst,jfirst,ilast,jlast));
+                      Ksub.reshape(Ni,Nj);
+
+                      // Increment global exchange matrix
+                      K.slice(lout).submat(ifirst,jfirst,ilast,jlast)-=Ksub;
+
+                    } else {
+                      // Disjoint integrals. When r(iel)>r(jel), iel gets -1-L, jel gets L.
+                      const arma::mat & iint=(iel>jel) ? disjoint_m1L[L*Nel+iel] : disjoint_L[L*Nel+iel];
+                      const arma::mat & jint=(iel>jel) ? disjoint_L[L*Nel+jel] : disjoint_m1L[L*Nel+jel];
+
+                      // Get density submatrix (Niel x Njel)
+                      arma::mat Psub(mem_Psub[ith].memptr(),Ni,Nj,false,true);
+                      Psub=P_L.submat(ifirst,jfirst,ilast,jlast);
+
+                      // Calculate helper
+                      arma::mat T(mem_T[ith].memptr(),Ni,Nj,false,true);
+                      // (Niel x Njel) = (Niel x Njel) x (Njel x Njel)
+                      T=Psub*arma::trans(jint);
+                      // Exchange submatrix
+                      arma::mat Ksub(mem_Ksub[ith].memptr(),Ni,Nj,false,true);
+                      Ksub=iint*T;
+
+                      // Increment global exchange matrix
+                      K.slice(lout).submat(ifirst,jfirst,ilast,jlast)-=Ksub;
+                    }
                   }
                 }
               }
@@ -513,7 +601,7 @@ namespace helfem {
 
         // Gaunt coefficient table
         int gmax(arma::max(lval));
-        gaunt::Gaunt gaunt(gmax,2*gmax,gmax);
+        const gaunt::Gaunt & gaunt(*gaunt::shared_table(gmax,2*gmax,gmax));
 
         if(P.n_slices != (arma::uword) gmax+1)
           throw std::logic_error("Density matrix am does not match basis set!\n");
@@ -529,6 +617,63 @@ namespace helfem {
         arma::cube K(Nrad,Nrad,gmax+1);
         K.zeros();
 
+        // Radial density helpers of every output angular momentum; a
+        // channel is overwritten instead of cleared on its first coupling
+        std::vector<arma::cube> Prad(gmax+1);
+        // Do we have a coupling
+        std::vector< std::vector<bool> > coupling(gmax+1,std::vector<bool>(2*gmax+1,false));
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+        // Loop over angular momentum of output
+        for(int lout=0;lout<=gmax;lout++) {
+          Prad[lout].set_size(Nrad,Nrad,2*gmax+1);
+
+          // Do angular sums: loop over input angular momentum
+          for(int lin=0;lin<=gmax;lin++) {
+            // Skip if nothing to do
+            if(arma::norm(P.slice(lin),2)==0.0)
+              continue;
+
+            // Possible couplings (lin,lout) => L
+            int Lmin=std::abs(lin-lout);
+            int Lmax=lin+lout;
+
+            arma::vec totcoup;
+            totcoup.zeros(Lmax+1);
+            // Sum over m values: output indices
+            for(int mout=-lout;mout<=lout;mout++) {
+              // and input indices
+              for(int min=-lin;min<=lin;min++) {
+                // LH m value
+                int M(mout-min);
+                for(int L=Lmin;L<=Lmax;L++) {
+                  // Calculate total coupling coefficient
+                  double cpl(gaunt.coeff(lout,mout,L,M,lin,min)*gaunt.coeff(lout,mout,L,M,lin,min));
+                  totcoup(L)+=cpl;
+                }
+              }
+            }
+            // Averaging wrt output
+            totcoup /= 2*lout+1;
+
+            // Increment radial density matrix
+            for(int L=Lmin;L<=Lmax;L++) {
+              // Check if coupling exists
+              if(totcoup(L)==0.0)
+                continue;
+
+              // Form density matrix
+              double Lfac = yukawa ? 4.0*M_PI*lambda :  4.0*M_PI*lambda/(2*L+1);
+              if(coupling[lout][L])
+                Prad[lout].slice(L)+=(Lfac*totcoup(L))*P.slice(lin);
+              else
+                Prad[lout].slice(L)=(Lfac*totcoup(L))*P.slice(lin);
+              coupling[lout][L]=true;
+            }
+          }
+        }
+
         // Helper memory
 #ifdef _OPENMP
         const int nth(omp_get_max_threads());
@@ -538,133 +683,103 @@ namespace helfem {
         std::vector<arma::vec> mem_Ksub(nth);
         std::vector<arma::vec> mem_Psub(nth);
         std::vector<arma::vec> mem_T(nth);
-
-#ifdef _OPENMP
-#pragma omp parallel
-#endif
-        {
-#ifdef _OPENMP
-          const int ith(omp_get_thread_num());
-#else
-          const int ith(0);
-#endif
-          // These are only small submatrices!
+        // These are only small submatrices!
+        for(int ith=0;ith<nth;ith++) {
           mem_Psub[ith].zeros(radial.max_Nprim()*radial.max_Nprim());
           mem_Ksub[ith].zeros(radial.max_Nprim()*radial.max_Nprim());
           mem_T[ith].zeros(radial.max_Nprim()*radial.max_Nprim());
+        }
 
-          // Increment
+        // With fewer output angular momenta than threads, the output
+        // elements are distributed over the threads as well. This is
+        // done in two passes over the even and the odd elements, since
+        // adjacent elements share a radial function.
+        const bool split(gmax+1<nth);
+        const size_t npass(split ? 2 : 1);
+        for(size_t pass=0;pass<npass;pass++) {
+          // Number of tasks per angular momentum
+          const size_t ntask(split ? (Nel+1-pass)/2 : 1);
 #ifdef _OPENMP
-#pragma omp for
+#pragma omp parallel for collapse(2) schedule(dynamic)
 #endif
-          // Loop over angular momentum of output
-          for(int lout=0;lout<=gmax;lout++) {
-            // Initialize memory
-            arma::cube Prad;
-            Prad.zeros(Nrad,Nrad,2*gmax+1);
-            // Do we have a coupling
-            std::vector<bool> coupling(2*gmax+1,false);
-
-            // Do angular sums: loop over input angular momentum
-            for(int lin=0;lin<=gmax;lin++) {
-              // Skip if nothing to do
-              if(arma::norm(P.slice(lin),2)==0.0)
-                continue;
-
-              // Possible couplings (lin,lout) => L
-              int Lmin=std::abs(lin-lout);
-              int Lmax=lin+lout;
-
-              arma::vec totcoup;
-              totcoup.zeros(Lmax+1);
-              // Sum over m values: output indices
-              for(int mout=-lout;mout<=lout;mout++) {
-                // and input indices
-                for(int min=-lin;min<=lin;min++) {
-                  // LH m value
-                  int M(mout-min);
-                  for(int L=Lmin;L<=Lmax;L++) {
-                    // Calculate total coupling coefficient
-                    double cpl(gaunt.coeff(lout,mout,L,M,lin,min)*gaunt.coeff(lout,mout,L,M,lin,min));
-                    totcoup(L)+=cpl;
-                  }
-                }
-              }
-              // Averaging wrt output
-              totcoup /= 2*lout+1;
+          for(size_t iout=0;iout<(size_t) gmax+1;iout++) {
+            for(size_t itask=0;itask<ntask;itask++) {
+#ifdef _OPENMP
+              const int ith(omp_get_thread_num());
+#else
+              const int ith(0);
+#endif
+              const int lout(iout);
+              // Output elements of the task
+              const size_t ielbeg(split ? 2*itask+pass : 0);
+              const size_t ielend(split ? ielbeg+1 : Nel);
 
-              // Increment radial density matrix
-              for(int L=Lmin;L<=Lmax;L++) {
-                // Check if coupling exists
-                if(totcoup(L)==0.0)
+              for(size_t L=0;L<coupling[lout].size();L++) {
+                if(!coupling[lout][L])
                   continue;
 
-                // Form density matrix
-                double Lfac = yukawa ? 4.0*M_PI*lambda :  4.0*M_PI*lambda/(2*L+1);
-                Prad.slice(L)+=(Lfac*totcoup(L))*P.slice(lin);
-                coupling[L]=true;
-              }
-            }
-
-            for(size_t L=0;L<coupling.size();L++) {
-              if(!coupling[L])
-                continue;
-
-              // Radial matrix
-              arma::mat P_L(Prad.slice(L));
-
-              // Loop over elements: output
-              for(size_t iel=0;iel<Nel;iel++) {
-                size_t ifirst, ilast;
-                radial.get_idx(iel,ifirst,ilast);
-
-                // Input
-                for(size_t jel=0;jel<Nel;jel++) {
-                  size_t jfirst, jlast;
-                  radial.get_idx(jel,jfirst,jlast);
-
-                  // Number of functions in the two elements
-                  size_t Ni(ilast-ifirst+1);
-                  size_t Nj(jlast-jfirst+1);
-
-                  if(!yukawa || iel == jel) {
-                    /*
-                      The exchange matrix is given by
-                      K(jk) = (ij|kl) P(il)
-                      i.e. the complex conjugation hits i and l as
-                      in the density matrix.
-
-                      To get this in the proper order, we permute the integrals
-                      K(jk) = (jk;il) P(il)
-                    */
-
-                    // Exchange submatrix
-                    arma::mat Ksub(mem_Ksub[ith].memptr(),Ni*Nj,1,false,true);
-                    Ksub=rs_ktei[Nel*Nel*L + iel*Nel + jel]*arma::vectorise(P_L.submat(ifirst,jfirst,ilast,jlast));
-                    Ksub.reshape(Ni,Nj);
-
-                    // Increment global exchange matrix
-                    K.slice(lout).submat(ifirst,jfirst,ilast,jlast)-=Ksub;
-
-                  } else {
-                    // Disjoint integrals. When r(iel)>r(jel), iel gets -1-L, jel gets L.
-                    const arma::mat & iint=(iel>jel) ? disjoint_kL[L*Nel+iel] : disjoint_iL[L*Nel+iel];
-                    const arma::mat & jint=(iel>jel) ? disjoint_iL[L*Nel+jel] : disjoint_kL[L*Nel+jel];
-
-                    // Get density submatrix (Niel x Njel)
-                    arma::mat Psub(mem_Psub[ith].memptr(),Ni,Nj,false,true);
-                    Psub=P_L.submat(ifirst,jfirst,ilast,jlast);
-
-                    // Calculate helper
-                    arma::mat T(mem_T[ith].memptr(),Ni,Nj,false,true);
-                    // (Niel x Njel) = (Niel x Njel) x (Njel x Njel)
-                    T=Psub*arma::trans(jint);
-                    // Exchange submatrix
-                    arma::mat Ksub(mem_Ksub[ith].memptr(),Ni,Nj,false,true);
-                    Ksub=iint*T;
-
-                    // Increment global exchange matrix
-                    K.slice(lout).submat(ifirst,jfirst,ilast,jlast)-=Ksub;
+                // Radial matrix
+                const arma::mat P_L(Prad[lout].slice(L).memptr(),Nrad,Nrad,false,true);
+
+                // Loop over elements: output
+                for(size_t iel=ielbeg;iel<ielend;iel++) {
+                  size_t ifirst, ilast;
+                  radial.get_idx(iel,ifirst,ilast);
+
+                  // Input
+                  for(size_t jel=0;jel<Nel;jel++) {
+                    size_t jfirst, jlast;
+                    radial.get_idx(jel,jfirst,jlast);
+
+                    // Number of functions in the two elements
+                    size_t Ni(ilast-ifirst+1);
+                    size_t Nj(jlast-jfirst+1);
+
+                    if(!yukawa || iel == jel) {
+                      /*
+                        The exchange matrix is given by
+                        K(jk) = (ij|kl) P(il)
+                        i.e. the complex conjugation hits i and l as
+                        in the density matrix.
+
+                        To get this in the proper order, we permute the integrals
+                        K(jk) = (jk;il) P(il)
+                      */
+
+                      const size_t idx(Nel*Nel*L + iel*Nel + jel);
+                      if(rs_ktei[idx].n_elem) {
+                        // Exchange submatrix
+                        arma::mat Ksub(mem_Ksub[ith].memptr(),Ni*Nj,1,false,true);
+                        Ksub=rs_ktei[idx]*arma::vectorise(P_L.submat(ifirst,jfirst,ilast,jlast));
+                        Ksub.reshape(Ni,Nj);
+
+                        // Increment global exchange matrix
+                        K.slice(lout).submat(ifirst,jfirst,ilast,jlast)-=Ksub;
+                      } else if(!yukawa && rs_lowrank_a[idx].n_cols) {
+                        K.slice(lout).submat(ifirst,jfirst,ilast,jlast)-=utils::lowrank_exchange(rs_lowrank_a[idx],rs_lowrank_b[idx],P_L.submat(ifirst,jfirst,ilast,jlast));
+                      }
+                      // otherwise the pair has been screened out
+
+                    } else {
+                      // Disjoint integrals. When r(iel)>r(jel), iel gets -1-L, jel gets L.
+                      const arma::mat & iint=(iel>jel) ? disjoint_kL[L*Nel+iel] : disjoint_iL[L*Nel+iel];
+                      const arma::mat & jint=(iel>jel) ? disjoint_iL[L*Nel+jel] : disjoint_kL[L*Nel+jel];
+
+                      // Get density submatrix (Niel x Njel)
+                      arma::mat Psub(mem_Psub[ith].memptr(),Ni,Nj,false,true);
+                      Psub=P_L.submat(ifirst,jfirst,ilast,jlast);
+
+                      // Calculate helper
+                      arma::mat T(mem_T[ith].memptr(),Ni,Nj,false,true);
+                      // (Niel x Njel) = (Niel x Njel) x (Njel x Njel)
+                      T=Psub*arma::trans(jint);
+                      // Exchange submatrix
+                      arma::mat Ksub(mem_Ksub[ith].memptr(),Ni,Nj,false,true);
+                      Ksub=iint*T;
+
+                      // Increment global exchange matrix
+                      K.slice(lout).submat(ifirst,jfirst,ilast,jlast)-=Ksub;
+                    }
                   }
                 }
               }
@@ -676,7 +791,9 @@ namespace helfem {
       }
 
       std::vector<arma::mat> TwoDBasis::get_prim_tei() const {
-        return prim_tei;
+        if(!tei)
+          return std::vector<arma::mat>();
+        return tei->prim_tei;
       }
 
       arma::mat TwoDBasis::eval_bf(size_t iel) const {
@@ -768,8 +885,8 @@ namespace helfem {
           arma::mat Psub(Prad.submat(ifirst,ifirst,ilast,ilast));
           arma::mat zm(radial.radial_integral(0,iel));
           arma::mat mo(radial.radial_integral(-1,iel));
-          zero(iel)=arma::trace(Psub*zm);
-          minusone(iel)=arma::trace(Psub*mo);
+          zero(iel)=scf::trace_product(Psub,zm);
+          minusone(iel)=scf::trace_product(Psub,mo);
         }
         // Sum zero potentials together
         for(size_t iel=1;iel<radial.Nel();iel++)
@@ -895,137 +1012,184 @@ namespace helfem {
         return n;
       }
 
-      double TwoDBasis::electron_density_maximum(const arma::mat & Prad, double eps) const {
-        // Evaluate the density in each quadrature point and take
-        // their maximum
-        arma::vec den(radial.Nel());
-        bool rsqweight = true;
-
-        for(size_t iel=0;iel<radial.Nel();iel++) {
-          den(iel)=arma::max(electron_density(iel, Prad, rsqweight));
+      /// Chebyshev series of r^2 rho in an element, which holds its derivatives as well
+      class ElementDensity {
+        /// Coefficients of the function and its first two derivatives
+        arma::vec c, dc, d2c;
+
+        /// Coefficients of the derivative of a Chebyshev series
+        static arma::vec derivative(const arma::vec & cf) {
+          size_t n(cf.n_elem);
+          arma::vec d(n,arma::fill::zeros);
+          if(n<2)
+            return d;
+          d(n-2)=2.0*(n-1)*cf(n-1);
+          for(size_t j=n-2;j-- > 0;)
+            d(j)=(j+2<n ? d(j+2) : 0.0) + 2.0*(j+1)*cf(j+1);
+          return d;
         }
 
-        // Quadrature points
-        arma::vec xq = radial.get_xq();
-
-        // Find the element with the maximum density
-        arma::uword iel;
-        den.max(iel);
-
-        // Evaluate the density in that element
-        arma::vec del = electron_density(xq, iel, Prad, rsqweight);
-
-        // Find the maximum value
-        arma::uword imax;
-        del.max(imax);
-
-        // Refine the location of the maximum in the element
-        double rmax=0.0;
-        {
-          // Primitive coordinates
-          arma::vec a(1), b(1);
-
-          if(imax == 0) {
-            a(0) = -1.0;
-            b(0) = xq(imax+1);
-          } else if(imax == xq.n_elem-1) {
-            a(0) = xq(imax-1);
-            b(0) = 1.0;
-          } else {
-            a(0) = xq(imax-1);
-            b(0) = xq(imax+1);
+        /// Evaluate a Chebyshev series by Clenshaw's recurrence
+        static double clenshaw(const arma::vec & cf, double x) {
+          double b1=0.0, b2=0.0;
+          for(size_t j=cf.n_elem;j-- > 1;) {
+            double tmp(2.0*x*b1 - b2 + cf(j));
+            b2=b1;
+            b1=tmp;
           }
+          return x*b1 - b2 + 0.5*cf(0);
+        }
 
-          // Golden ratio search
-          double golden_ratio = 0.5*(sqrt(5.0)+1.0);
-          while(arma::norm(a-b,"inf")>=eps) {
-            arma::vec c = b - (b-a)/golden_ratio;
-            arma::vec d = a + (b-a)/golden_ratio;
-            double density_c = arma::as_scalar(electron_density(c, iel, Prad, rsqweight));
-            double density_d = arma::as_scalar(electron_density(d, iel, Prad, rsqweight));
-            if(density_c > density_d) {
-              b = d;
-            } else {
-              a = c;
-            }
+      public:
+        /**
+         * Constructor. In primitive coordinates r^2 rho is a
+         * polynomial whose degree is at most twice that of the basis
+         * functions, so the series at nprim*2 points is exact, and the
+         * basis functions don't need to be evaluated again.
+         */
+        ElementDensity(const TwoDBasis & basis, size_t iel, const arma::mat & Prad, size_t nprim) {
+          const size_t n(2*nprim);
+          arma::vec theta(n), x(n);
+          for(size_t k=0;k<n;k++) {
+            theta(k)=M_PI*(k+0.5)/n;
+            x(k)=std::cos(theta(k));
           }
-          arma::vec cen=((a+b)/2);
-          double dmax = arma::as_scalar(electron_density(cen, iel, Prad, rsqweight));
-          if(dmax < del(imax)) {
-            std::ostringstream oss;
-            oss << "Density maximization failed! Quadrature max " << del(imax) << " optimized max " << dmax << " difference " << dmax-del(imax) << "!\n";
-            throw std::logic_error(oss.str());
+          arma::vec g(basis.electron_density(x, iel, Prad, true));
+          c.zeros(n);
+          for(size_t j=0;j<n;j++)
+            c(j)=2.0/n*arma::dot(g,arma::cos(j*theta));
+          dc=derivative(c);
+          d2c=derivative(dc);
+        }
+
+        /// Value of r^2 rho
+        double f(double x) const {
+          return clenshaw(c,x);
+        }
+        /// First derivative
+        double df(double x) const {
+          return clenshaw(dc,x);
+        }
+        /// Second derivative
+        double d2f(double x) const {
+          return clenshaw(d2c,x);
+        }
+      };
+
+      /// Find a root of fun in [a,b] by Newton steps starting from x, falling back to bisection whenever a step would leave the bracket; fun returns the value and the derivative
+      template<typename F> static double bracketed_newton(const F & fun, double a, double b, double x, double eps) {
+        double fa, fb, dfx;
+        fun(a,fa,dfx);
+        fun(b,fb,dfx);
+        // No sign change: the closest endpoint is the answer
+        if(fa*fb>0.0)
+          return std::abs(fa)<std::abs(fb) ? a : b;
+
+        for(int iter=0;iter<100 && b-a>=eps;iter++) {
+          double fx;
+          fun(x,fx,dfx);
+          if(fx==0.0)
+            return x;
+          // Shrink the bracket
+          if((fx<0.0) == (fa<0.0)) {
+            a=x;
+            fa=fx;
+          } else {
+            b=x;
           }
-          // Position of maximum is
-          rmax = arma::as_scalar(radial.get_r((a+b)/2,iel));
+          double xn(dfx!=0.0 ? x-fx/dfx : a);
+          if(!(xn>a && xn<b))
+            xn=0.5*(a+b);
+          if(std::abs(xn-x)<eps)
+            return xn;
+          x=xn;
         }
+        return x;
+      }
+
+      double TwoDBasis::electron_density_maximum(const arma::mat & Prad, double eps) const {
+        // The density and the radii at all the quadrature points are
+        // formed in one pass
+        radial_properties_t prop(radial_properties(Prad));
+        arma::vec den(prop.rho%arma::square(prop.r));
+        const size_t Npts(radial.get_nquad());
+
+        // Find the quadrature point with the maximum density, skipping
+        // the nucleus
+        arma::uword ipt;
+        den.subvec(1,den.n_elem-1).max(ipt);
+        size_t iel(ipt/Npts);
+        size_t imax(ipt%Npts);
+        double quadmax(den(1+ipt));
 
-        return rmax;
+        // Quadrature points
+        arma::vec xq = radial.get_xq();
+        double a(imax==0 ? -1.0 : xq(imax-1));
+        double b(imax==xq.n_elem-1 ? 1.0 : xq(imax+1));
+
+        // The maximum is where the derivative of the series vanishes
+        size_t ifirst, ilast;
+        radial.get_idx(iel,ifirst,ilast);
+        ElementDensity g(*this, iel, Prad, ilast-ifirst+1);
+        auto dg = [&g](double x, double & f, double & df) {
+          f=g.df(x);
+          df=g.d2f(x);
+        };
+        double xmax(bracketed_newton(dg, a, b, xq(imax), eps));
+
+        double dmax(g.f(xmax));
+        if(dmax < quadmax*(1.0-10*DBL_EPSILON*Npts)) {
+          std::ostringstream oss;
+          oss << "Density maximization failed! Quadrature max " << quadmax << " optimized max " << dmax << " difference " << dmax-quadmax << "!\n";
+          throw std::logic_error(oss.str());
+        }
+        // Position of maximum is
+        return arma::as_scalar(radial.get_r(arma::vec({xmax}),iel));
       }
 
       double TwoDBasis::vdw_radius(const arma::mat & Prad, double thr, double eps) const {
         // Need to multiply output of electron_density by this factor to get the point-wise density
         double angfac=1.0/(4.0*M_PI);
 
-        // Evaluate the density in each quadrature point and take
-        // their maximum
-        bool rsqweight = false;
+        // The density at all the quadrature points is formed in one pass
+        radial_properties_t prop(radial_properties(Prad));
+        const size_t Npts(radial.get_nquad());
+
+        // Find the last element where the density exceeds the threshold
         size_t iel;
         for(iel=radial.Nel()-1;iel<radial.Nel();iel--) {
-          arma::vec den(angfac*electron_density(iel, Prad, rsqweight));
-          if(arma::max(den)>thr) {
+          if(angfac*arma::max(prop.rho.subvec(1+iel*Npts,(iel+1)*Npts))>thr) {
             // We found the element
             break;
           }
         }
-
-        // Now find the position in the element where the density is = eps.
-        // Evaluate the difference in density from eps.
-        // Quadrature points
+        // Nothing exceeds the threshold: the radius is at the nucleus
+        if(iel>=radial.Nel())
+          return 0.0;
+
+        // The density crosses the threshold after the last quadrature
+        // point where it exceeds it
+        arma::vec den(angfac*prop.rho.subvec(1+iel*Npts,(iel+1)*Npts));
+        size_t k(arma::max(arma::find(den>thr)));
         arma::vec xq = radial.get_xq();
-        arma::vec diff = angfac*electron_density(xq, iel, Prad, rsqweight);
-        diff-=thr*arma::ones<arma::vec>(diff.n_elem);
-        diff=arma::abs(diff);
-
-        // Find the smallest value
-        arma::uword imax;
-        diff.min(imax);
-
-        // Refine the position.
+        double a(xq(k));
+        double b(k+1<xq.n_elem ? xq(k+1) : 1.0);
 
-        double rvdw=0.0;
-        {
-          // Primitive coordinates
-          arma::vec a(1), b(1);
-
-          if(imax == 0) {
-            a(0) = -1.0;
-            b(0) = xq(imax+1);
-          } else if(imax == xq.n_elem-1) {
-            a(0) = xq(imax-1);
-            b(0) = 1.0;
-          } else {
-            a(0) = xq(imax-1);
-            b(0) = xq(imax+1);
-          }
-
-          // Bisection
-          while(arma::norm(a-b,"inf")>=eps) {
-            arma::vec m = a + (b-a)/2.0;
-            double density_m = angfac*arma::as_scalar(electron_density(m, iel, Prad, rsqweight));
-            if(density_m < eps) {
-              b = m;
-            } else {
-              a = m;
-            }
-          }
-          // Coordinate is
-          arma::vec cen=((a+b)/2);
-          // Position of maximum is
-          rvdw = arma::as_scalar(radial.get_r(cen,iel));
-        }
-
-        return rvdw;
+        // Solve r^2 rho / 4 pi = thr r^2, which is a polynomial in the
+        // primitive coordinate
+        size_t ifirst, ilast;
+        radial.get_idx(iel,ifirst,ilast);
+        ElementDensity g(*this, iel, Prad, ilast-ifirst+1);
+        const double rmid(arma::as_scalar(radial.get_r(arma::vec({0.0}),iel)));
+        const double rscale(arma::as_scalar(radial.get_r(arma::vec({1.0}),iel))-rmid);
+        auto h = [&](double x, double & f, double & df) {
+          double r(rmid+rscale*x);
+          f=angfac*g.f(x) - thr*r*r;
+          df=angfac*g.df(x) - 2.0*thr*r*rscale;
+        };
+        double xvdw(bracketed_newton(h, a, b, 0.5*(a+b), eps));
+
+        return arma::as_scalar(radial.get_r(arma::vec({xvdw}),iel));
       }
 
       arma::vec TwoDBasis::electron_density_gradient(const arma::mat & Prad) const {
@@ -1134,6 +1298,77 @@ namespace helfem {
         return tn;
       }
 
+      radial_properties_t TwoDBasis::radial_properties(const arma::mat & Prad, const arma::cube & Pl0) const {
+        // The kinetic energy density uses the l-resolved density
+        bool dotau(Pl0.n_elem>0);
+        arma::mat P, Pl;
+        if(dotau) {
+          P.zeros(Pl0.n_rows, Pl0.n_cols);
+          Pl.zeros(Pl0.n_rows, Pl0.n_cols);
+          for(size_t l=0; l<Pl0.n_slices; l++) {
+            P += Pl0.slice(l);
+            Pl += l*(l+1)*Pl0.slice(l);
+          }
+        }
+
+        const size_t Nel(radial.Nel());
+        const size_t Npts(radial.get_nquad());
+        radial_properties_t prop;
+        prop.r.zeros(Nel*Npts+1);
+        prop.rho.zeros(Nel*Npts+1);
+        prop.grad.zeros(Nel*Npts+1);
+        prop.lapl.zeros(Nel*Npts+1);
+        if(dotau)
+          prop.tau.zeros(Nel*Npts+1);
+
+        // Only the density is known at the nucleus
+        prop.rho(0)=4.0*M_PI*nuclear_density(Prad);
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,1)
+#endif
+        for(size_t iel=0;iel<Nel;iel++) {
+          // Radial functions in element
+          size_t ifirst, ilast;
+          radial.get_idx(iel,ifirst,ilast);
+          arma::mat Psub(Prad.submat(ifirst,ifirst,ilast,ilast));
+
+          // The basis functions are evaluated once for all the properties
+          arma::mat bf(radial.get_bf(iel));
+          arma::mat df(radial.get_df(iel));
+          arma::mat lf(radial.get_lf(iel));
+          arma::vec r(radial.get_r(iel));
+
+          // Only the diagonals of the products are needed
+          arma::mat bP(bf*Psub);
+          arma::mat dP(df*Psub);
+          arma::vec bb(arma::sum(bP%bf,1));
+          arma::vec bd(arma::sum(bP%df,1));
+          arma::vec dd(arma::sum(dP%df,1));
+          arma::vec bl(arma::sum(bP%lf,1));
+
+          const size_t i0(1+iel*Npts), i1((iel+1)*Npts);
+          prop.r.subvec(i0,i1)=r;
+          prop.rho.subvec(i0,i1)=bb;
+          prop.grad.subvec(i0,i1)=2.0*bd;
+          // Laplacian is df^2/dr^2 + 2/r df/dr
+          prop.lapl.subvec(i0,i1)=2.0*(dd+bl) + 4.0*bd/r;
+
+          if(dotau) {
+            arma::mat Ptsub(P.submat(ifirst,ifirst,ilast,ilast));
+            arma::mat Plsub(Pl.submat(ifirst,ifirst,ilast,ilast));
+            arma::vec term1(arma::sum((df*Ptsub)%df,1));
+            arma::vec term2(arma::sum((bf*Plsub)%bf,1)/arma::square(r));
+            // Only s orbitals contribute at the nucleus, and their
+            // contribution is killed off by the l(l+1) factor
+            term2(arma::find(term2<0.0)).zeros();
+            prop.tau.subvec(i0,i1)=0.5*(term1+term2);
+          }
+        }
+
+        return prop;
+      }
+
       std::vector< std::pair<int, arma::mat> > TwoDBasis::Rmatrices() const {
         std::vector< std::pair<int, arma::mat> > rmat;
         for(int i=-2;i<=3;i++) {
@@ -1145,23 +1380,29 @@ namespace helfem {
       }
 
       arma::vec TwoDBasis::xc_screening(const arma::mat & Prad, int x_func, int c_func) const {
-        arma::mat v(xc_screening(Prad/2,Prad/2,x_func,c_func));
+        // Both spins have the same density
+        radial_properties_t prop(radial_properties(Prad/2));
+        arma::mat v(xc_screening(prop,prop,x_func,c_func));
         return 0.5*(v.col(0)+v.col(1));
       }
 
       arma::mat TwoDBasis::xc_screening(const arma::mat & Parad, const arma::mat & Pbrad, int x_func, int c_func) const {
+        return xc_screening(radial_properties(Parad),radial_properties(Pbrad),x_func,c_func);
+      }
+
+      arma::mat TwoDBasis::xc_screening(const radial_properties_t & propa, const radial_properties_t & propb, int x_func, int c_func) const {
         const double angfac=4.0*M_PI;
         // Get the electron density
-        arma::vec rhoa(electron_density(Parad)/angfac);
-        arma::vec rhob(electron_density(Pbrad)/angfac);
+        arma::vec rhoa(propa.rho/angfac);
+        arma::vec rhob(propb.rho/angfac);
         // and the density gradient
-        arma::vec grada(electron_density_gradient(Parad)/angfac);
-        arma::vec gradb(electron_density_gradient(Pbrad)/angfac);
+        arma::vec grada(propa.grad/angfac);
+        arma::vec gradb(propb.grad/angfac);
         // and the density Laplacian
-        arma::vec lapla(electron_density_laplacian(Parad)/angfac);
-        arma::vec laplb(electron_density_laplacian(Pbrad)/angfac);
+        arma::vec lapla(propa.lapl/angfac);
+        arma::vec laplb(propb.lapl/angfac);
         // Radial coordinates
-        arma::vec r(radii());
+        const arma::vec & r(propa.r);
         size_t Npoints(r.n_elem);
 
         // and pack it for libxc
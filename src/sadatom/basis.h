@@ -22,6 +22,30 @@
 namespace helfem {
   namespace sadatom {
     namespace basis {
+      /// Two-electron integrals that only depend on the radial grid, not on the nuclear charge
+      struct tei_t {
+        /// Auxiliary integrals
+        std::vector<arma::mat> disjoint_L, disjoint_m1L;
+        /// Primitive two-electron integrals: <Nel^2 * (2L+1)>
+        std::vector<arma::mat> prim_tei;
+        /// Primitive two-electron exchange integrals
+        std::vector<arma::mat> prim_ktei;
+      };
+
+      /// Radial properties of a density on the quadrature grid, with the nucleus as the first point
+      struct radial_properties_t {
+        /// Radii
+        arma::vec r;
+        /// Electron density
+        arma::vec rho;
+        /// Density gradient
+        arma::vec grad;
+        /// Density Laplacian
+        arma::vec lapl;
+        /// Kinetic energy density, only formed if the l-resolved density was given
+        arma::vec tau;
+      };
+
       /// Two-dimensional basis set
       class TwoDBasis {
         /// Nuclear charge
@@ -41,16 +65,14 @@ namespace helfem {
         /// Angular basis set: function l values
         arma::ivec lval;
 
-        /// Auxiliary integrals
-        std::vector<arma::mat> disjoint_L, disjoint_m1L;
+        /// Two-electron integrals, shared between copies
+        std::shared_ptr<const tei_t> tei;
         /// Auxiliary integrals, Yukawa
         std::vector<arma::mat> disjoint_iL, disjoint_kL;
-        /// Primitive two-electron integrals: <Nel^2 * (2L+1)>
-        std::vector<arma::mat> prim_tei;
-        /// Primitive two-electron exchange integrals
-        std::vector<arma::mat> prim_ktei;
         /// Primitive two-electron exchange integrals, range separation
         std::vector<arma::mat> rs_ktei;
+        /// Low-rank factors of the off-diagonal range-separated integrals not stored in rs_ktei; element pairs with neither are screened out
+        std::vector<arma::mat> rs_lowrank_a, rs_lowrank_b;
 
       public:
         TwoDBasis();
@@ -59,12 +81,19 @@ namespace helfem {
         /// Destructor
         ~TwoDBasis();
 
+        /// Get the nuclear charge
+        int get_Z() const;
+
         /// Compute two-electron integrals
         void compute_tei();
+        /// Get the two-electron integrals
+        std::shared_ptr<const tei_t> get_tei() const;
+        /// Reuse two-electron integrals computed in a basis on the same radial grid
+        void set_tei(const std::shared_ptr<const tei_t> & tei);
         /// Compute two-electron integrals
         void compute_yukawa(double lambda);
-        /// Compute two-electron integrals
-        void compute_erfc(double mu);
+        /// Compute two-electron integrals; element pairs below thr are skipped, and distant pairs are stored in low-rank form
+        void compute_erfc(double mu, double thr=1e-12);
 
         /// Number of basis functions
         size_t Nbf() const;
@@ -150,11 +179,15 @@ namespace helfem {
         arma::vec electron_density_laplacian(const arma::mat & Prad) const;
         /// Compute the kinetic energy density
         arma::vec kinetic_energy_density(const arma::cube & Pl0) const;
+        /// Compute the density, its gradient and Laplacian, and the kinetic energy density if Pl0 is given, evaluating the basis functions once per element
+        radial_properties_t radial_properties(const arma::mat & Prad, const arma::cube & Pl0=arma::cube()) const;
 
         /// Compute the exchange-correlation screening
         arma::vec xc_screening(const arma::mat & Prad, int x_func, int c_func) const;
         /// Compute the exchange-correlation screening
         arma::mat xc_screening(const arma::mat & Parad, const arma::mat & Pbrad, int x_func, int c_func) const;
+        /// Compute the exchange-correlation screening from the radial properties of the spin densities
+        arma::mat xc_screening(const radial_properties_t & propa, const radial_properties_t & propb, int x_func, int c_func) const;
       };
     }
   }
@@ -15,6 +15,10 @@
  */
 
 #include "configurations.h"
+#include <cctype>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
 #include <vector>
 #include <string>
 
@@ -213,5 +217,69 @@ namespace helfem {
 
       return config;
     }
+
+    ConfigurationCache::ConfigurationCache() {
+    }
+
+    ConfigurationCache::ConfigurationCache(const std::string & file_) : file(file_) {
+      std::ifstream in(file.c_str());
+      std::string line;
+      while(std::getline(in,line)) {
+        std::istringstream iss(line);
+        std::string k;
+        if(!(iss >> k) || k[0]=='#')
+          continue;
+        std::vector<arma::sword> occ;
+        arma::sword n;
+        while(iss >> n)
+          occ.push_back(n);
+        if(occ.size())
+          entries[k]=arma::ivec(occ);
+      }
+    }
+
+    bool ConfigurationCache::enabled() const {
+      return file.size()>0;
+    }
+
+    std::string ConfigurationCache::key(int Z, int Q, const std::string & method, bool restricted, const std::string & gridclass) {
+      std::ostringstream oss;
+      oss << "Z" << Z << "_Q" << Q << "_" << method << "_" << (restricted ? "R" : "U") << "_" << gridclass;
+      // The key is a single token in the file
+      std::string k(oss.str());
+      for(size_t i=0;i<k.size();i++)
+        if(isspace(k[i]))
+          k[i]='_';
+      return k;
+    }
+
+    bool ConfigurationCache::lookup(const std::string & k, arma::ivec & occs) const {
+      std::map<std::string, arma::ivec>::const_iterator it(entries.find(k));
+      if(it==entries.end())
+        return false;
+      occs=it->second;
+      return true;
+    }
+
+    void ConfigurationCache::store(const std::string & k, const arma::ivec & occs) {
+      std::map<std::string, arma::ivec>::const_iterator it(entries.find(k));
+      if(it!=entries.end() && it->second.n_elem==occs.n_elem && arma::all(it->second==occs))
+        return;
+      entries[k]=occs;
+      if(!enabled())
+        return;
+
+      FILE *out=fopen(file.c_str(),"a");
+      if(!out) {
+        std::ostringstream oss;
+        oss << "Error opening configuration cache " << file << " for writing!\n";
+        throw std::runtime_error(oss.str());
+      }
+      fprintf(out,"%s",k.c_str());
+      for(size_t i=0;i<occs.n_elem;i++)
+        fprintf(out," %i",(int) occs(i));
+      fprintf(out,"\n");
+      fclose(out);
+    }
   }
 }
@@ -18,6 +18,8 @@
 #define HELFEM_CONFIGURATION_H
 
 #include <armadillo>
+#include <map>
+#include <string>
 
 namespace helfem {
   namespace sadatom {
@@ -30,6 +32,34 @@ namespace helfem {
      * Data and Nuclear Data Tables 95 (2009) 836-870.
      */
     arma::ivec get_configuration(int Z);
+
+    /**
+     * Persistent cache of converged ground-state occupations per
+     * angular momentum. The file has one line per entry with the key
+     * followed by the occupations; new entries are appended, and a
+     * later line for the same key overrides an earlier one.
+     */
+    class ConfigurationCache {
+      /// File the cache is kept in
+      std::string file;
+      /// Cached occupations
+      std::map<std::string, arma::ivec> entries;
+
+    public:
+      /// Dummy constructor, no persistent storage
+      ConfigurationCache();
+      /// Read the cache from the file, if it exists
+      ConfigurationCache(const std::string & file);
+      /// Is the cache backed by a file?
+      bool enabled() const;
+
+      /// Form the key of a calculation; gridclass identifies the radial and angular basis
+      static std::string key(int Z, int Q, const std::string & method, bool restricted, const std::string & gridclass);
+      /// Look up the occupations; returns false if there is no entry
+      bool lookup(const std::string & key, arma::ivec & occs) const;
+      /// Store the occupations, appending them to the file
+      void store(const std::string & key, const arma::ivec & occs);
+    };
   }
 }
 
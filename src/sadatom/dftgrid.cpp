@@ -22,6 +22,7 @@
 
 #include "dftgrid.h"
 #include "../general/dftfuncs.h"
+#include "../general/profiler.h"
 
 // OpenMP parallellization for XC calculations
 #ifdef _OPENMP
@@ -31,10 +32,10 @@
 namespace helfem {
   namespace sadatom {
     namespace dftgrid {
-      DFTGridWorker::DFTGridWorker() {
+      DFTGridWorker::DFTGridWorker() : xcpool(NULL) {
       }
 
-      DFTGridWorker::DFTGridWorker(const helfem::sadatom::basis::TwoDBasis * basp_) : basp(basp_) {
+      DFTGridWorker::DFTGridWorker(const helfem::sadatom::basis::TwoDBasis * basp_) : basp(basp_), xcpool(NULL) {
         do_grad=false;
         do_tau=false;
         do_lapl=false;
@@ -43,78 +44,146 @@ namespace helfem {
       DFTGridWorker::~DFTGridWorker() {
       }
 
-      void DFTGridWorker::update_density(const arma::cube & Pc0) {
-        // In-element cube
-        arma::cube Pc(bf_ind.n_elem, bf_ind.n_elem, Pc0.n_slices);
-        for(size_t islice=0; islice<Pc0.n_slices;islice++) {
-          Pc.slice(islice) = Pc0.slice(islice)(bf_ind, bf_ind);
+      void DFTGridWorker::reserve(size_t nbf, size_t npts) {
+        // Shrinking a matrix does not reallocate it, so this only
+        // needs to be done once
+        bf.set_size(nbf,npts);
+        Pel.set_size(nbf,nbf);
+        Pael.set_size(nbf,nbf);
+        Pbel.set_size(nbf,nbf);
+        Pslice.set_size(nbf,nbf);
+        Pv.set_size(nbf,npts);
+        Pav.set_size(nbf,npts);
+        Pbv.set_size(nbf,npts);
+        if(do_grad || do_lapl)
+          bf_rho.set_size(nbf,npts);
+        if(do_lapl)
+          bf_rho2.set_size(nbf,npts);
+        if(do_tau || do_lapl) {
+          Pv_rho.set_size(nbf,npts);
+          Pav_rho.set_size(nbf,npts);
+          Pbv_rho.set_size(nbf,npts);
+        }
+        if(do_tau) {
+          Plel.set_size(nbf,nbf);
+          Palel.set_size(nbf,nbf);
+          Pblel.set_size(nbf,nbf);
+          Plv.set_size(nbf,npts);
+          Palv.set_size(nbf,npts);
+          Pblv.set_size(nbf,npts);
+        }
+
+        r.set_size(npts);
+        wrad.set_size(npts);
+        wtot.set_size(npts);
+        rho.set_size(2,npts);
+        exc.set_size(npts);
+        exc_wrk.set_size(npts);
+        vxc.set_size(2,npts);
+        vxc_wrk.set_size(2,npts);
+        if(do_grad) {
+          grho.set_size(2,npts);
+          sigma.set_size(3,npts);
+          vsigma.set_size(3,npts);
+          vsigma_wrk.set_size(3,npts);
+        }
+        if(do_tau) {
+          tau.set_size(2,npts);
+          vtau.set_size(2,npts);
+          vtau_wrk.set_size(2,npts);
+        }
+        if(do_lapl) {
+          lapl.set_size(2,npts);
+          vlapl.set_size(2,npts);
+          vlapl_wrk.set_size(2,npts);
+        }
+      }
+
+      void DFTGridWorker::release_unused() {
+        if(!do_grad) {
+          grho.reset();
+          sigma.reset();
+          vsigma.reset();
+          vsigma_wrk.reset();
+        }
+        if(!do_grad && !do_lapl)
+          bf_rho.reset();
+        if(!do_tau && !do_lapl) {
+          Pv_rho.reset();
+          Pav_rho.reset();
+          Pbv_rho.reset();
+        }
+        if(!do_tau) {
+          Plel.reset();
+          Palel.reset();
+          Pblel.reset();
+          Plv.reset();
+          Palv.reset();
+          Pblv.reset();
+          tau.reset();
+          vtau.reset();
+          vtau_wrk.reset();
         }
-        // Total density matrix
-        arma::mat P(bf_ind.n_elem, bf_ind.n_elem, arma::fill::zeros);
-        for(size_t islice=0; islice<Pc.n_slices;islice++) {
-          P += Pc.slice(islice);
+        if(!do_lapl) {
+          bf_rho2.reset();
+          lapl.reset();
+          vlapl.reset();
+          vlapl_wrk.reset();
         }
-        // and the one multiplied by l(l+1)
-        arma::mat Pl(bf_ind.n_elem, bf_ind.n_elem, arma::fill::zeros);
-        for(size_t islice=0; islice<Pc.n_slices;islice++) {
-          Pl += islice*(islice+1)*Pc.slice(islice);
+      }
+
+      void DFTGridWorker::update_density(const arma::cube & Pc0) {
+        // Total in-element density matrix
+        arma::mat & P(Pel);
+        P.zeros(bf_ind.n_elem, bf_ind.n_elem);
+        for(size_t islice=0; islice<Pc0.n_slices;islice++) {
+          P += Pc0.slice(islice)(bf_ind, bf_ind);
         }
 
         // Non-polarized calculation.
         polarized=false;
 
         // Update density vector
-        Pv=P*arma::conj(bf);
+        Pv=P*bf;
 
-        // Calculate density
-        rho.zeros(1,wtot.n_elem);
-        for(size_t ip=0;ip<wtot.n_elem;ip++)
-          rho(0,ip)=arma::dot(Pv.col(ip),bf.col(ip));
+        // The density is spherical, so all quantities are radial and
+        // reduce to column sums over the contiguous basis function
+        // values in each quadrature point
+        rho=arma::sum(Pv%bf,0);
 
         // Calculate gradient
+        arma::rowvec Pv_bf_rho;
+        if(do_grad || do_lapl)
+          Pv_bf_rho=arma::sum(Pv%bf_rho,0);
         if(do_grad) {
-          grho.zeros(1,wtot.n_elem);
-          sigma.zeros(1,wtot.n_elem);
-          for(size_t ip=0;ip<wtot.n_elem;ip++) {
-            // Calculate values
-            double g_rad=grho(0,ip)=2.0*arma::dot(Pv.col(ip),bf_rho.col(ip));
-            // Compute sigma as well
-            sigma(0,ip)=g_rad*g_rad;
-          }
+          grho=2.0*Pv_bf_rho;
+          sigma=arma::square(grho);
         }
 
         // Calculate kinetic energy density
         if(do_tau || do_lapl) {
-          arma::mat Pvp(P*arma::conj(bf_rho));
+          Pv_rho=P*bf_rho;
+          arma::rowvec term1(arma::sum(Pv_rho%bf_rho,0));
 
           if(do_tau) {
-            arma::mat Plv(Pl*arma::conj(bf));
-            tau.zeros(1,wtot.n_elem);
-            for(size_t ip=0;ip<wtot.n_elem;ip++) {
-              // First term: P(u,v) * \chi_u' \chi_v'
-              double term1 = arma::dot(Pvp.col(ip), bf_rho.col(ip));
-              // Second term: l(l+1) Pl(u,v) \chi_u \chi_v / r^2
-              double term2 = arma::dot(Plv.col(ip), bf.col(ip))/(r(ip)*r(ip));
-              // The second term is ill-behaved near the nucleus since
-              // only s orbitals contribute to density but that gets
-              // killed by the l(l+1) factor
-              tau(0,ip) = 0.5*(term1 + std::max(term2, 0.0));
+            // and the density matrix multiplied by l(l+1)
+            arma::mat & Pl(Plel);
+            Pl.zeros(bf_ind.n_elem, bf_ind.n_elem);
+            for(size_t islice=1; islice<Pc0.n_slices;islice++) {
+              Pl += islice*(islice+1)*Pc0.slice(islice)(bf_ind, bf_ind);
             }
+            // Second term: l(l+1) Pl(u,v) \chi_u \chi_v / r^2. It
+            // is ill-behaved near the nucleus since only s orbitals
+            // contribute to density but that gets killed by the
+            // l(l+1) factor
+            Plv=Pl*bf;
+            arma::rowvec term2(arma::sum(Plv%bf,0)/arma::square(r));
+            tau=0.5*(term1 + arma::clamp(term2, 0.0, DBL_MAX));
           }
 
           if(do_lapl) {
-            lapl.zeros(1,wtot.n_elem);
-            for(size_t ip=0;ip<wtot.n_elem;ip++) {
-              // First term: P(u,v) * \chi_u' \chi_v'
-              double term1 = 2.0*arma::dot(Pvp.col(ip), bf_rho.col(ip));
-              // Second term: P(u,v) \chi_u \chi_v''
-              double term2 = 2.0*arma::dot(Pv.col(ip), bf_rho2.col(ip));
-              // Third term: P(u,v) * \chi_u \chi_v' / r
-              double term3 = 4.0*arma::dot(Pv.col(ip), bf_rho.col(ip))/r(ip);
-
-              // Store values
-              lapl(0,ip)=term1+term2+term3;
-            }
+            // P(u,v) * (2 \chi_u' \chi_v' + 2 \chi_u \chi_v'' + 4 \chi_u \chi_v' / r)
+            lapl=2.0*term1 + 2.0*arma::sum(Pv%bf_rho2,0) + 4.0*Pv_bf_rho/r;
           }
         }
       }
@@ -124,71 +193,66 @@ namespace helfem {
           throw std::runtime_error("Error - density matrix is empty!\n");
         }
 
-        // In-element cube
-        arma::cube Pac(bf_ind.n_elem, bf_ind.n_elem, Pac0.n_slices);
+        // Total in-element density matrices, and the ones multiplied by
+        // l(l+1) which are only needed for tau
+        arma::mat & Pa(Pael);
+        arma::mat & Pb(Pbel);
+        arma::mat & Pal(Palel);
+        arma::mat & Pbl(Pblel);
+        Pa.zeros(bf_ind.n_elem, bf_ind.n_elem);
+        Pb.zeros(bf_ind.n_elem, bf_ind.n_elem);
+        if(do_tau) {
+          Pal.zeros(bf_ind.n_elem, bf_ind.n_elem);
+          Pbl.zeros(bf_ind.n_elem, bf_ind.n_elem);
+        }
         for(size_t islice=0; islice<Pac0.n_slices;islice++) {
-          Pac.slice(islice) = Pac0.slice(islice)(bf_ind, bf_ind);
+          Pslice = Pac0.slice(islice)(bf_ind, bf_ind);
+          Pa += Pslice;
+          if(do_tau)
+            Pal += islice*(islice+1)*Pslice;
         }
-        arma::cube Pbc(bf_ind.n_elem, bf_ind.n_elem, Pbc0.n_slices);
         for(size_t islice=0; islice<Pbc0.n_slices;islice++) {
-          Pbc.slice(islice) = Pbc0.slice(islice)(bf_ind, bf_ind);
-        }
-        // Total density matrix
-        arma::mat Pa(bf_ind.n_elem, bf_ind.n_elem, arma::fill::zeros);
-        for(size_t islice=0; islice<Pac.n_slices;islice++) {
-          Pa += Pac.slice(islice);
-        }
-        arma::mat Pb(bf_ind.n_elem, bf_ind.n_elem, arma::fill::zeros);
-        for(size_t islice=0; islice<Pbc.n_slices;islice++) {
-          Pb += Pbc.slice(islice);
-        }
-        // and the one multiplied by l(l+1)
-        arma::mat Pal(bf_ind.n_elem, bf_ind.n_elem, arma::fill::zeros);
-        for(size_t islice=0; islice<Pac.n_slices;islice++) {
-          Pal += islice*(islice+1)*Pac.slice(islice);
-        }
-        arma::mat Pbl(bf_ind.n_elem, bf_ind.n_elem, arma::fill::zeros);
-        for(size_t islice=0; islice<Pbc.n_slices;islice++) {
-          Pbl += islice*(islice+1)*Pbc.slice(islice);
+          Pslice = Pbc0.slice(islice)(bf_ind, bf_ind);
+          Pb += Pslice;
+          if(do_tau)
+            Pbl += islice*(islice+1)*Pslice;
         }
 
         // Polarized calculation.
         polarized=true;
 
         // Update density vector
-        Pav=Pa*arma::conj(bf);
-        Pbv=Pb*arma::conj(bf);
+        Pav=Pa*bf;
+        Pbv=Pb*bf;
 
-        // Calculate density
+        // Calculate density as column sums, see the restricted case
         rho.zeros(2,wtot.n_elem);
-        for(size_t ip=0;ip<wtot.n_elem;ip++) {
-          rho(0,ip)=arma::dot(Pav.col(ip),bf.col(ip));
-          rho(1,ip)=arma::dot(Pbv.col(ip),bf.col(ip));
-        }
+        rho.row(0)=arma::sum(Pav%bf,0);
+        rho.row(1)=arma::sum(Pbv%bf,0);
 
         // Calculate gradient
         if(do_grad) {
           grho.zeros(2,wtot.n_elem);
           sigma.zeros(3,wtot.n_elem);
-          for(size_t ip=0;ip<wtot.n_elem;ip++) {
-            double ga_rad=grho(0,ip)=2.0*arma::dot(Pav.col(ip),bf_rho.col(ip));
-            double gb_rad=grho(1,ip)=2.0*arma::dot(Pbv.col(ip),bf_rho.col(ip));
-
-            // Compute sigma as well
-            sigma(0,ip)=ga_rad*ga_rad;
-            sigma(1,ip)=ga_rad*gb_rad;
-            sigma(2,ip)=gb_rad*gb_rad;
-          }
+          grho.row(0)=2.0*arma::sum(Pav%bf_rho,0);
+          grho.row(1)=2.0*arma::sum(Pbv%bf_rho,0);
+
+          // Compute sigma as well
+          sigma.row(0)=arma::square(grho.row(0));
+          sigma.row(1)=grho.row(0)%grho.row(1);
+          sigma.row(2)=arma::square(grho.row(1));
         }
 
         // Calculate kinetic energy density
         if(do_tau || do_lapl) {
-          arma::mat Pavp(Pa*arma::conj(bf_rho));
-          arma::mat Pbvp(Pb*arma::conj(bf_rho));
+          arma::mat & Pavp(Pav_rho);
+          arma::mat & Pbvp(Pbv_rho);
+          Pavp=Pa*bf_rho;
+          Pbvp=Pb*bf_rho;
 
           if(do_tau) {
-            arma::mat Palv(Pal*arma::conj(bf));
-            arma::mat Pblv(Pbl*arma::conj(bf));
+            Palv=Pal*bf;
+            Pblv=Pbl*bf;
             tau.zeros(2,wtot.n_elem);
             for(size_t ip=0;ip<wtot.n_elem;ip++) {
               // First term: P(u,v) * \chi_u' \chi_v'
@@ -320,12 +384,6 @@ namespace helfem {
         const size_t N=wtot.n_elem;
 
         // Work arrays - exchange and correlation are computed separately
-        arma::rowvec exc_wrk;
-        arma::mat vxc_wrk;
-        arma::mat vsigma_wrk;
-        arma::mat vlapl_wrk;
-        arma::mat vtau_wrk;
-
         if(has_exc(func_id))
           exc_wrk.zeros(exc.n_elem);
         if(pot) {
@@ -345,24 +403,10 @@ namespace helfem {
         else
           nspin=XC_POLARIZED;
 
-        // Initialize libxc worker
-        xc_func_type func;
-        if(xc_func_init(&func, func_id, nspin) != 0) {
-          std::ostringstream oss;
-          oss << "Functional "<<func_id<<" not found!";
-          throw std::runtime_error(oss.str());
-        }
-        // Set density threshold
-        xc_func_set_dens_threshold(&func, thr);
-
-        // Set parameters
-        if(p.n_elem) {
-          // Check sanity
-          if(p.n_elem != (arma::uword) xc_func_info_get_n_ext_params(func.info))
-            throw std::logic_error("Incompatible number of parameters!\n");
-          arma::vec phlp(p);
-          xc_func_set_ext_params(&func, phlp.memptr());
-        }
+        // Get libxc worker; functionals are kept in the pool between calls
+        XCFunctionalPool localpool;
+        XCFunctionalPool & pool(xcpool ? *xcpool : localpool);
+        xc_func_type *func(pool.get(func_id, nspin, thr, arma::conv_to< std::vector<double> >::from(p)));
 
         // Evaluate functionals.
         if(has_exc(func_id)) {
@@ -372,20 +416,20 @@ namespace helfem {
               double * taup = mgga_t ? tau.memptr() : NULL;
               double * vlaplp = mgga_l ? vlapl_wrk.memptr() : NULL;
               double * vtaup = mgga_t ? vtau_wrk.memptr() : NULL;
-              xc_mgga_exc_vxc(&func, N, rho.memptr(), sigma.memptr(), laplp, taup, exc_wrk.memptr(), vxc_wrk.memptr(), vsigma_wrk.memptr(), vlaplp, vtaup);
+              xc_mgga_exc_vxc(func, N, rho.memptr(), sigma.memptr(), laplp, taup, exc_wrk.memptr(), vxc_wrk.memptr(), vsigma_wrk.memptr(), vlaplp, vtaup);
             } else if(gga) // GGA
-              xc_gga_exc_vxc(&func, N, rho.memptr(), sigma.memptr(), exc_wrk.memptr(), vxc_wrk.memptr(), vsigma_wrk.memptr());
+              xc_gga_exc_vxc(func, N, rho.memptr(), sigma.memptr(), exc_wrk.memptr(), vxc_wrk.memptr(), vsigma_wrk.memptr());
             else // LDA
-              xc_lda_exc_vxc(&func, N, rho.memptr(), exc_wrk.memptr(), vxc_wrk.memptr());
+              xc_lda_exc_vxc(func, N, rho.memptr(), exc_wrk.memptr(), vxc_wrk.memptr());
           } else {
             if(mgga_t || mgga_l) { // meta-GGA
               double * laplp = mgga_l ? lapl.memptr() : NULL;
               double * taup = mgga_t ? tau.memptr() : NULL;
-              xc_mgga_exc(&func, N, rho.memptr(), sigma.memptr(), laplp, taup, exc_wrk.memptr());
+              xc_mgga_exc(func, N, rho.memptr(), sigma.memptr(), laplp, taup, exc_wrk.memptr());
             } else if(gga) // GGA
-              xc_gga_exc(&func, N, rho.memptr(), sigma.memptr(), exc_wrk.memptr());
+              xc_gga_exc(func, N, rho.memptr(), sigma.memptr(), exc_wrk.memptr());
             else // LDA
-              xc_lda_exc(&func, N, rho.memptr(), exc_wrk.memptr());
+              xc_lda_exc(func, N, rho.memptr(), exc_wrk.memptr());
           }
 
         } else {
@@ -395,11 +439,11 @@ namespace helfem {
               double * taup = mgga_t ? tau.memptr() : NULL;
               double * vlaplp = mgga_l ? vlapl_wrk.memptr() : NULL;
               double * vtaup = mgga_t ? vtau_wrk.memptr() : NULL;
-              xc_mgga_vxc(&func, N, rho.memptr(), sigma.memptr(), laplp, taup, vxc_wrk.memptr(), vsigma_wrk.memptr(), vlaplp, vtaup);
+              xc_mgga_vxc(func, N, rho.memptr(), sigma.memptr(), laplp, taup, vxc_wrk.memptr(), vsigma_wrk.memptr(), vlaplp, vtaup);
             } else if(gga) // GGA
-              xc_gga_vxc(&func, N, rho.memptr(), sigma.memptr(), vxc_wrk.memptr(), vsigma_wrk.memptr());
+              xc_gga_vxc(func, N, rho.memptr(), sigma.memptr(), vxc_wrk.memptr(), vsigma_wrk.memptr());
             else // LDA
-              xc_lda_vxc(&func, N, rho.memptr(), vxc_wrk.memptr());
+              xc_lda_vxc(func, N, rho.memptr(), vxc_wrk.memptr());
           }
         }
 
@@ -480,9 +524,6 @@ namespace helfem {
             vsigma+=vsigma_wrk;
           vxc+=vxc_wrk;
         }
-
-        // Free functional
-        xc_func_end(&func);
       }
 
       void DFTGridWorker::get_pot(arma::mat & pot) const {
@@ -621,33 +662,23 @@ namespace helfem {
         Hl.zeros();
 
         {
-          // LDA potential
-          arma::rowvec vrho(vxc.row(0));
-          // Multiply weights into potential
-          vrho%=wtot;
-          // Increment matrix
-          increment_lda<double>(H,vrho,bf);
-        }
-        if(H.has_nan())
-          fprintf(stderr,"NaN in Hamiltonian after LDA!\n");
-
-        if(do_gga) {
-          // Get vsigma
-          arma::rowvec vs(vsigma.row(0));
-          // Get grad rho
-          arma::uvec idx(arma::linspace<arma::uvec>(0,0,1));
-          arma::mat gr(arma::trans(grho.rows(idx)));
-          // Multiply grad rho by vsigma and the weights
-          gr.col(0)%=2.0*(wtot%vs).t();
-          // If we also have laplacian dependence, we get an extra term
-          if(do_mgga_l) {
-            gr.col(0)+=(2.0*vlapl.row(0)%r%(wrad*4.0*M_PI)).t();
+          // The LDA and GGA terms are assembled in a single pass as
+          // H += X bf^T + bf X^T with X = (v_rho/2) bf + g bf_rho
+          arma::rowvec vrho(0.5*vxc.row(0)%wtot);
+          arma::mat X(bf.each_row()%vrho);
+          if(do_gga) {
+            // Multiply grad rho by vsigma and the weights
+            arma::rowvec gr(2.0*grho.row(0)%wtot%vsigma.row(0));
+            // If we also have laplacian dependence, we get an extra term
+            if(do_mgga_l)
+              gr+=2.0*vlapl.row(0)%r%(wrad*4.0*M_PI);
+            X+=bf_rho.each_row()%gr;
           }
-          // Increment matrix
-          increment_gga<double>(H,gr,bf,bf_rho);
-          if(H.has_nan())
-            fprintf(stderr,"NaN in Hamiltonian after GGA!\n");
+          arma::mat XF(X*bf.t());
+          H+=XF+XF.t();
         }
+        if(H.has_nan())
+          fprintf(stderr,"NaN in Hamiltonian after LDA/GGA!\n");
 
         if(do_mgga_t || do_mgga_l) {
           arma::rowvec vtl(wtot.n_elem, arma::fill::zeros);
@@ -825,6 +856,8 @@ namespace helfem {
           do_lapl=do_lapl || laplacian_needed(x_func);
         if(c_func>0)
           do_lapl=do_lapl || laplacian_needed(c_func);
+
+        release_unused();
       }
 
       void DFTGridWorker::get_grad_tau_lapl(bool & grad_, bool & tau_, bool & lap_) const {
@@ -833,13 +866,19 @@ namespace helfem {
         lap_=do_lapl;
       }
 
+      void DFTGridWorker::set_xcpool(XCFunctionalPool *pool) {
+        xcpool=pool;
+      }
+
       void DFTGridWorker::set_grad_tau_lapl(bool grad_, bool tau_, bool lap_) {
         do_grad=grad_;
         do_tau=tau_;
         do_lapl=lap_;
+        release_unused();
       }
 
       void DFTGridWorker::compute_bf(size_t iel) {
+        profiler::Region prof("compute_bf");
         // Update function list
         bf_ind=basp->bf_list(iel);
         // Get radii
@@ -868,23 +907,71 @@ namespace helfem {
       DFTGrid::DFTGrid(const helfem::sadatom::basis::TwoDBasis * basp_) : basp(basp_) {
       }
 
+      void DFTGrid::prepare_xcpools() {
+#ifdef _OPENMP
+        size_t nth(omp_get_max_threads());
+#else
+        size_t nth(1);
+#endif
+        while(xcpools.size()<nth)
+          xcpools.push_back(std::make_shared<XCFunctionalPool>());
+      }
+
+      XCFunctionalPool * DFTGrid::thread_xcpool() const {
+#ifdef _OPENMP
+        return xcpools[omp_get_thread_num()].get();
+#else
+        return xcpools[0].get();
+#endif
+      }
+
+      void DFTGrid::prepare_workers(int x_func, int c_func) {
+#ifdef _OPENMP
+        size_t nth(omp_get_max_threads());
+#else
+        size_t nth(1);
+#endif
+        while(workers.size()<nth)
+          workers.push_back(std::make_shared<DFTGridWorker>(basp));
+
+        // Size of the largest element
+        size_t nbf=0, npts=0;
+        for(size_t iel=0;iel<basp->get_rad_Nel();iel++) {
+          nbf=std::max(nbf,(size_t) basp->bf_list(iel).n_elem);
+          npts=std::max(npts,(size_t) basp->get_r(iel).n_elem);
+        }
+        for(size_t ith=0;ith<workers.size();ith++) {
+          workers[ith]->check_grad_tau_lapl(x_func,c_func);
+          workers[ith]->reserve(nbf,npts);
+        }
+      }
+
+      DFTGridWorker & DFTGrid::thread_worker() {
+#ifdef _OPENMP
+        return *workers[omp_get_thread_num()];
+#else
+        return *workers[0];
+#endif
+      }
+
       DFTGrid::~DFTGrid() {
       }
 
       void DFTGrid::eval_Fxc(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, const arma::cube & P, arma::cube & H, double & Exc, double & Nel, double thr) {
+        profiler::Region prof("XC");
         H.zeros(P.n_rows,P.n_rows,P.n_slices);
 
         double exc=0.0;
         double nel=0.0;
-        double tau=0.0;
-        double lapl=0.0;
 
+        prepare_xcpools();
+        prepare_workers(x_func,c_func);
 #ifdef _OPENMP
-#pragma omp parallel reduction(+:exc,nel,tau,lapl)
+#pragma omp parallel reduction(+:exc,nel)
 #endif
         {
-          DFTGridWorker grid(basp);
-          grid.check_grad_tau_lapl(x_func,c_func);
+          DFTGridWorker & grid(thread_worker());
+          grid.set_xcpool(thread_xcpool());
 
 #ifdef _OPENMP
 #pragma omp for
@@ -893,8 +980,6 @@ namespace helfem {
             grid.compute_bf(iel);
             grid.update_density(P);
             nel+=grid.compute_Nel();
-            tau+=grid.compute_tau();
-            lapl+=grid.compute_lapl();
 
             grid.init_xc();
             if(x_func>0)
@@ -912,8 +997,6 @@ namespace helfem {
             grid.compute_bf(iel);
             grid.update_density(P);
             nel+=grid.compute_Nel();
-            tau+=grid.compute_tau();
-            lapl+=grid.compute_lapl();
 
             grid.init_xc();
             if(x_func>0)
@@ -929,27 +1012,23 @@ namespace helfem {
         // Save outputs
         Exc=exc;
         Nel=nel;
-
-#if 0
-        if(tau!=0.0)
-          printf("Tau integral %.10e\n",tau);
-        if(lapl!=0.0)
-          printf("Laplacian integral %.10e\n",lapl);
-#endif
       }
 
       void DFTGrid::eval_Fxc(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, const arma::cube & Pa, const arma::cube & Pb, arma::cube & Ha, arma::cube & Hb, double & Exc, double & Nel, bool beta, double thr) {
+        profiler::Region prof("XC");
         Ha.zeros(Pa.n_rows,Pa.n_rows,Pa.n_slices);
         Hb.zeros(Pb.n_rows,Pb.n_rows,Pb.n_slices);
 
         double exc=0.0;
         double nel=0.0;
+        prepare_xcpools();
+        prepare_workers(x_func,c_func);
 #ifdef _OPENMP
 #pragma omp parallel reduction(+:exc,nel)
 #endif
         {
-          DFTGridWorker grid(basp);
-          grid.check_grad_tau_lapl(x_func,c_func);
+          DFTGridWorker & grid(thread_worker());
+          grid.set_xcpool(thread_xcpool());
 
 #ifdef _OPENMP
 #pragma omp for
@@ -1029,12 +1108,14 @@ namespace helfem {
         // exc vxca vxcb vsigmaaa vsigmaab vsigmabb vlapla vlaplb vtaua vtaub
         pot.zeros(11, Nquad*Nelem);
 
+        prepare_xcpools();
+        prepare_workers(x_func,c_func);
 #ifdef _OPENMP
 #pragma omp parallel
 #endif
         {
-          DFTGridWorker grid(basp);
-          grid.check_grad_tau_lapl(x_func,c_func);
+          DFTGridWorker & grid(thread_worker());
+          grid.set_xcpool(thread_xcpool());
 
 #ifdef _OPENMP
 #pragma omp for
@@ -1066,12 +1147,14 @@ namespace helfem {
         // exc vxca vxcb vsigmaaa vsigmaab vsigmabb vlapla vlaplb vtaua vtaub
         pot.zeros(11, Nquad*Nelem);
 
+        prepare_xcpools();
+        prepare_workers(x_func,c_func);
 #ifdef _OPENMP
 #pragma omp parallel
 #endif
         {
-          DFTGridWorker grid(basp);
-          grid.check_grad_tau_lapl(x_func,c_func);
+          DFTGridWorker & grid(thread_worker());
+          grid.set_xcpool(thread_xcpool());
 
 #ifdef _OPENMP
 #pragma omp for
@@ -1103,12 +1186,14 @@ namespace helfem {
         // rhoa rhob sigmaaa sigmaab sigmabb lapla laplb taua taub
         ing.zeros(10, Nquad*Nelem);
 
+        prepare_xcpools();
+        prepare_workers(x_func,c_func);
 #ifdef _OPENMP
 #pragma omp parallel
 #endif
         {
-          DFTGridWorker grid(basp);
-          grid.check_grad_tau_lapl(x_func,c_func);
+          DFTGridWorker & grid(thread_worker());
+          grid.set_xcpool(thread_xcpool());
 
 #ifdef _OPENMP
 #pragma omp for
@@ -1141,12 +1226,14 @@ namespace helfem {
         // rhoa rhob sigmaaa sigmaab sigmabb lapla laplb taua taub
         ing.zeros(10, Nquad*Nelem);
 
+        prepare_xcpools();
+        prepare_workers(x_func,c_func);
 #ifdef _OPENMP
 #pragma omp parallel
 #endif
         {
-          DFTGridWorker grid(basp);
-          grid.check_grad_tau_lapl(x_func,c_func);
+          DFTGridWorker & grid(thread_worker());
+          grid.set_xcpool(thread_xcpool());
 
 #ifdef _OPENMP
 #pragma omp for
@@ -18,6 +18,8 @@
 #define SADATOM_DFTGRID_H
 
 #include "basis.h"
+#include <memory>
+#include "../general/dftfuncs.h"
 
 namespace helfem {
   namespace sadatom {
@@ -28,6 +30,8 @@ namespace helfem {
       protected:
         /// Basis set
         const helfem::sadatom::basis::TwoDBasis *basp;
+        /// Pool of libxc functionals, optional
+        XCFunctionalPool *xcpool;
 
         /// Distance from nucleus
         arma::rowvec r;
@@ -50,6 +54,17 @@ namespace helfem {
         /// Same for spin-polarized
         arma::mat Pav, Pav_rho;
         arma::mat Pbv, Pbv_rho;
+        /// Density matrices in the functions of the element, and the ones weighted by l(l+1)
+        arma::mat Pel, Pael, Pbel, Plel, Palel, Pblel;
+        /// Angular momentum block of the density matrix in the element
+        arma::mat Pslice;
+        /// The l(l+1) weighted density matrices times the basis functions
+        arma::mat Plv, Palv, Pblv;
+        /// Work arrays for a single functional in compute_xc
+        arma::rowvec exc_wrk;
+        arma::mat vxc_wrk, vsigma_wrk, vlapl_wrk, vtau_wrk;
+        /// Release the arrays of quantities the functional does not need
+        void release_unused();
 
         /// Is gradient needed?
         bool do_grad;
@@ -112,11 +127,13 @@ namespace helfem {
         void get_grad_tau_lapl(bool & grad, bool & tau, bool & lapl) const;
         /// Set necessity of computing gradient and laplacians, necessary for compute_bf!
         void set_grad_tau_lapl(bool grad, bool tau, bool lapl);
+        /// Use the given libxc functional pool in compute_xc
+        void set_xcpool(XCFunctionalPool *pool);
 
         /// Compute basis functions on grid points
         void compute_bf(size_t iel);
-        /// Free memory
-        void free();
+        /// Allocate the work arrays for elements with up to nbf functions and npts points
+        void reserve(size_t nbf, size_t npts);
 
         /// Update values of density, restricted calculation
         void update_density(const arma::cube & P);
@@ -159,6 +176,18 @@ namespace helfem {
       private:
         /// Pointer to basis set
         const helfem::sadatom::basis::TwoDBasis * basp;
+        /// libxc functional pools, one per thread
+        std::vector< std::shared_ptr<XCFunctionalPool> > xcpools;
+        /// Make sure there is a pool for every thread
+        void prepare_xcpools();
+        /// Get the pool of the calling thread
+        XCFunctionalPool * thread_xcpool() const;
+        /// Workers, one per thread, kept between calls so that their work arrays are reused
+        std::vector< std::shared_ptr<DFTGridWorker> > workers;
+        /// Make sure every thread has a worker, set up for the functional
+        void prepare_workers(int x_func, int c_func);
+        /// Get the worker of the calling thread
+        DFTGridWorker & thread_worker();
 
       public:
         /// Dummy constructor
@@ -18,11 +18,14 @@
 #include "../general/dftfuncs.h"
 #include "../general/elements.h"
 #include "../general/scf_helpers.h"
+#include "../general/profiler.h"
+#include "../general/telemetry.h"
 #include "utils.h"
 #include "dftgrid.h"
 #include "solver.h"
 #include "configurations.h"
 #include <cfloat>
+#include <algorithm>
 
 arma::ivec initial_occs(int Z, int lmax) {
   // Guess occupations
@@ -94,11 +97,192 @@ arma::irowvec translate_occs(const arma::irowvec & occin) {
   return occs;
 }
 
+/// Add the configuration to the candidates unless it has already been studied
+template<typename T> void add_candidate(const std::vector<T> & studied, std::vector<T> & candidates, const T & conf) {
+  if(std::find(studied.begin(), studied.end(), conf) != studied.end())
+    return;
+  if(std::find(candidates.begin(), candidates.end(), conf) != candidates.end())
+    return;
+  candidates.push_back(conf);
+}
+
+/// Occupation-weighted sum of orbital energies of the configuration
+double orbital_energy_sum(const sadatom::solver::rconf_t & conf) {
+  return conf.orbs.OrbitalEnergySum();
+}
+/// Occupation-weighted sum of orbital energies of the configuration
+double orbital_energy_sum(const sadatom::solver::uconf_t & conf) {
+  return conf.orbsa.OrbitalEnergySum()+conf.orbsb.OrbitalEnergySum();
+}
+
+/**
+ * Screen a candidate obtained by moving electrons in the parent
+ * configuration. To first order in the occupation changes, the energy
+ * changes by the sum of the orbital energies of the moved electrons
+ * (Janak's theorem); candidates estimated to lie more than Escreen
+ * above the parent are discarded. Escreen <= 0 disables the screen.
+ */
+template<typename T> bool screen_candidate(const T & parent, const T & conf, double Escreen) {
+  if(Escreen<=0.0)
+    return false;
+  return orbital_energy_sum(conf)-orbital_energy_sum(parent) > Escreen;
+}
+
+/// Solve the candidate configurations concurrently, with a copy of the solver for every thread
+template<typename T> void solve_configurations(const sadatom::solver::SCFSolver & solver, std::vector<T> & candidates) {
+  if(!candidates.size())
+    return;
+
+#ifdef _OPENMP
+#pragma omp parallel if(candidates.size()>1)
+#endif
+  {
+    sadatom::solver::SCFSolver thsolver(solver);
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic,1)
+#endif
+    for(size_t i=0;i<candidates.size();i++)
+      candidates[i].Econf=thsolver.Solve(candidates[i]);
+  }
+}
+
+sadatom::solver::rconf_t initial_configuration(sadatom::solver::SCFSolver & solver, arma::sword numel, int lmax, int iguess) {
+  sadatom::solver::rconf_t initial;
+  initial.orbs=sadatom::solver::OrbitalChannel(true);
+  solver.Initialize(initial.orbs,iguess);
+  initial.orbs.SetOccs(initial_occs(numel,lmax));
+  if(initial.orbs.Nel()) {
+    initial.Econf=solver.Solve(initial);
+  } else {
+    initial.Econf=0.0;
+  }
+  return initial;
+}
+
+/// Candidate ground-state occupations for the search: the cached configuration, and Saito's Hartree-Fock one for neutral atoms
+std::vector<arma::ivec> seed_configurations(const sadatom::ConfigurationCache & cache, const std::string & key, int Z, int Q, int lmax) {
+  std::vector<arma::ivec> seeds;
+  arma::ivec occs;
+  if(cache.lookup(key,occs) && occs.n_elem==(arma::uword) (lmax+1) && arma::sum(occs)==Z-Q)
+    seeds.push_back(occs);
+  if(Q==0) {
+    arma::ivec hf(sadatom::get_configuration(Z));
+    occs.zeros(lmax+1);
+    size_t nl(std::min(hf.n_elem,occs.n_elem));
+    occs.subvec(0,nl-1)=hf.subvec(0,nl-1);
+    if(arma::sum(occs)==Z && (!seeds.size() || arma::any(seeds[0]!=occs)))
+      seeds.push_back(occs);
+  }
+  return seeds;
+}
+
+std::vector<sadatom::solver::rconf_t> restricted_search(sadatom::solver::SCFSolver & solver, const sadatom::solver::rconf_t & initial, arma::sword numel, int Q, double Escreen, const std::vector<arma::ivec> & seeds) {
+  // List of configurations
+  std::vector<sadatom::solver::rconf_t> rlist;
+
+  // Restricted calculation
+  sadatom::solver::rconf_t conf(initial);
+  if(seeds.size()) {
+    // Start from the known candidates, so that the search below
+    // only has to verify that none of their neighbors is lower
+    for(size_t i=0;i<seeds.size();i++) {
+      conf.orbs.SetOccs(seeds[i]);
+      rlist.push_back(conf);
+    }
+    solve_configurations(solver,rlist);
+    printf("Search started from %i known configurations\n",(int) seeds.size());
+  } else {
+    conf.Econf=solver.Solve(conf);
+    if(Q!=0) {
+      // Initial occupations are wrong for the state
+      conf.orbs.AufbauOccupations(numel);
+      conf.Econf=solver.Solve(conf);
+    }
+    rlist.push_back(conf);
+  }
+
+  // Brute force search for the lowest state
+  while(true) {
+    // Find the lowest energy configuration
+    std::sort(rlist.begin(),rlist.end());
+
+    // Do we have an Aufbau ground state?
+    conf.orbs=rlist[0].orbs;
+    conf.orbs.AufbauOccupations(numel);
+    while(std::find(rlist.begin(), rlist.end(), conf) == rlist.end()) {
+      conf.Econf=solver.Solve(conf);
+      rlist.push_back(conf);
+      conf.orbs.AufbauOccupations(numel);
+    }
+    printf("Aufbau search finished\n");
+
+    // Find the lowest energy configuration
+    std::sort(rlist.begin(),rlist.end());
+
+    // Generate new configurations
+    std::vector<sadatom::solver::OrbitalChannel> newconfs(rlist[0].orbs.MoveElectrons());
+
+    // The candidates are warm started from the parent's data
+    std::vector<sadatom::solver::rconf_t> candidates;
+    size_t nscreened=0;
+    conf=rlist[0];
+    for(size_t i=0;i<newconfs.size();i++) {
+      conf.orbs=newconfs[i];
+      if(screen_candidate(rlist[0],conf,Escreen)) {
+        nscreened++;
+        continue;
+      }
+      add_candidate(rlist,candidates,conf);
+    }
+    if(nscreened)
+      printf("%i candidates screened out by first-order energy estimate\n",(int) nscreened);
+    solve_configurations(solver,candidates);
+    rlist.insert(rlist.end(), candidates.begin(), candidates.end());
+    printf("Exhaustive search finished\n");
+    if(!candidates.size()) {
+      break;
+    }
+  }
+
+  return rlist;
+}
+
+std::vector<int> parse_Zlist(const std::string & str) {
+  std::vector<int> list;
+  std::istringstream iss(str);
+  std::string entry;
+  while(std::getline(iss,entry,',')) {
+    if(!entry.size())
+      continue;
+    // Ranges are given as first-last
+    size_t dash(entry.find('-'));
+    if(dash==std::string::npos) {
+      list.push_back(get_Z(entry));
+    } else {
+      int first(get_Z(entry.substr(0,dash)));
+      int last(get_Z(entry.substr(dash+1)));
+      if(last<first) {
+        std::ostringstream oss;
+        oss << "Invalid range \"" << entry << "\" in Z list.\n";
+        throw std::logic_error(oss.str());
+      }
+      for(int Z=first;Z<=last;Z++)
+        list.push_back(Z);
+    }
+  }
+  if(!list.size())
+    throw std::logic_error("Empty Z list!\n");
+
+  return list;
+}
+
 int main(int argc, char **argv) {
   cmdline::parser parser;
 
   // full option name, no short option, description, argument required
-  parser.add<std::string>("Z", 0, "nuclear charge", true);
+  parser.add<std::string>("Z", 0, "nuclear charge", false, "");
+  parser.add<std::string>("Zlist", 0, "comma separated list of nuclear charges or ranges like 1-118 to tabulate the restricted effective charge for in one run", false, "");
+  parser.add<std::string>("table", 0, "file to stream the effective charge table into in Zlist mode", false, "saptable.dat");
   parser.add<double>("Rmax", 0, "practical infinity in au", false, 40.0);
   parser.add<int>("grid", 0, "type of grid: 1 for linear, 2 for quadratic, 3 for polynomial, 4 for exponential", false, 4);
   parser.add<int>("grid0", 0, "type of grid: 1 for linear, 2 for quadratic, 3 for polynomial, 4 for exponential", false, 4);
@@ -118,6 +302,8 @@ int main(int argc, char **argv) {
   parser.add<std::string>("method", 0, "method to use", false, "lda_x");
   parser.add<std::string>("pot", 0, "method to use to compute potential", false, "none");
   parser.add<std::string>("occs", 0, "occupations to use", false, "auto");
+  parser.add<std::string>("kinetic", 0, "kinetic energy functional for an orbital-free calculation of the density, none to solve for the orbitals", false, "none");
+  parser.add<double>("vwfrac", 0, "fraction of von Weizsacker kinetic energy added to the kinetic functional in orbital-free calculations", false, 1.0/9.0);
   parser.add<double>("dftthr", 0, "density threshold for dft", false, 1e-12);
   parser.add<int>("iguess", 0, "guess: 0 for core, 1 for GSZ, 2 for SAP, 3 for TF", false, 2);
   parser.add<int>("restricted", 0, "spin-restricted orbitals", false, -1);
@@ -125,6 +311,8 @@ int main(int argc, char **argv) {
   parser.add<double>("diiseps", 0, "when to start mixing in diis", false, 1e-2);
   parser.add<double>("diisthr", 0, "when to switch over fully to diis", false, 1e-3);
   parser.add<int>("diisorder", 0, "length of diis history", false, 10);
+  parser.add<std::string>("confcache", 0, "file caching the ground-state configurations found by the automatic search, used to start later searches; empty to disable", false, "");
+  parser.add<double>("Escreen", 0, "discard trial configurations whose first-order energy estimate lies this much above the parent configuration, 0 to disable", false, 0.0);
   parser.add<int>("taylor_order", 0, "order of Taylor expansion near the nucleus", false, -1);
   parser.add<bool>("saveorb", 0, "save radial orbitals to disk?", false, false);
   parser.add<bool>("savepot", 0, "save xc potential to disk?", false, false);
@@ -133,8 +321,14 @@ int main(int argc, char **argv) {
   parser.add<std::string>("x_pars", 0, "file for parameters for exchange functional", false, "");
   parser.add<std::string>("c_pars", 0, "file for parameters for correlation functional", false, "");
   parser.add<double>("vdwthr", 0, "Density threshold for van der Waals radius", false, 0.0015);
+  parser.add<std::string>("profile", 0, "write a profile of the run in the given file, CSV if it ends in .csv and JSON otherwise", false, "");
+  parser.add<std::string>("telemetry", 0, "append a JSON record of every SCF iteration to the given file", false, "");
   if(!parser.parse(argc, argv))
     throw std::logic_error("Error parsing arguments!\n");
+  if(parser.get<std::string>("profile").size())
+    profiler::enable(parser.get<std::string>("profile"));
+  if(parser.get<std::string>("telemetry").size())
+    telemetry::open(parser.get<std::string>("telemetry"));
 
   // Get parameters
   double Rmax(parser.get<double>("Rmax"));
@@ -165,10 +359,17 @@ int main(int argc, char **argv) {
 
   // Nuclear charge
   int Q(parser.get<int>("Q"));
-  int Z(get_Z(parser.get<std::string>("Z")));
+  std::string Zliststr(parser.get<std::string>("Zlist"));
+  if(!parser.get<std::string>("Z").size() && !Zliststr.size())
+    throw std::logic_error("Must specify either Z or Zlist!\n");
+  std::vector<int> Zlist;
+  if(Zliststr.size())
+    Zlist=parse_Zlist(Zliststr);
+  int Z(Zlist.size() ? Zlist[0] : get_Z(parser.get<std::string>("Z")));
   double diiseps=parser.get<double>("diiseps");
   double diisthr=parser.get<double>("diisthr");
   int diisorder=parser.get<int>("diisorder");
+  double Escreen=parser.get<double>("Escreen");
   int iguess(parser.get<int>("iguess"));
 
   double vdw_thr=parser.get<double>("vdwthr");
@@ -176,6 +377,8 @@ int main(int argc, char **argv) {
   std::string method(parser.get<std::string>("method"));
   std::string potmethod(parser.get<std::string>("pot"));
   std::string occstr(parser.get<std::string>("occs"));
+  std::string kinetic(parser.get<std::string>("kinetic"));
+  double vwfrac(parser.get<double>("vwfrac"));
   bool saveorb(parser.get<bool>("saveorb"));
   bool savepot(parser.get<bool>("savepot"));
   bool saveing(parser.get<bool>("saveing"));
@@ -183,6 +386,17 @@ int main(int argc, char **argv) {
 
   std::string xparf(parser.get<std::string>("x_pars"));
   std::string cparf(parser.get<std::string>("c_pars"));
+  std::string tablef(parser.get<std::string>("table"));
+
+  // Ground-state configurations depend on the functional and, in
+  // marginal cases, on the basis
+  sadatom::ConfigurationCache confcache(parser.get<std::string>("confcache"));
+  std::string gridclass;
+  {
+    std::ostringstream oss;
+    oss << "l" << lmax << "_b" << primbas << "_n" << Nnodes << "_e" << Nelem << "_g" << igrid;
+    gridclass=oss.str();
+  }
 
   std::vector<std::string> rcalc(2);
   rcalc[0]="unrestricted";
@@ -217,6 +431,13 @@ int main(int argc, char **argv) {
   if(!is_supported(c_func))
     throw std::logic_error("The specified correlation functional is not currently supported in HelFEM.\n");
 
+  // Kinetic energy functional of an orbital-free calculation
+  int k_func(::find_func(kinetic));
+  if(k_func>0) {
+    printf("Orbital-free calculation with %.6f of von Weizsacker kinetic energy and kinetic energy functional %s, ",vwfrac,get_keyword(k_func).c_str());
+    ::print_info(k_func);
+  }
+
   // Potential
   int xp_func, cp_func;
   ::parse_xc_func(xp_func, cp_func, potmethod);
@@ -239,12 +460,9 @@ int main(int argc, char **argv) {
       throw std::logic_error("Optimized effective potential is not implemented in the spherically symmetric program.\n");
   }
 
-  // Radial basis
+  // Radial basis; the grid does not depend on the nuclear charge
   arma::vec bval=atomic::basis::form_grid((modelpotential::nuclear_model_t) finitenuc, Rrms, Nelem, Rmax, igrid, zexp, Nelem0, igrid0, zexp0, Z, 0, 0, 0.0);
 
-  // Initialize solver
-  sadatom::solver::SCFSolver solver(Z, finitenuc, Rrms, lmax, poly, zeroder, Nquad, bval, taylor_order, x_func, c_func, maxit, shift, convthr, dftthr, diiseps, diisthr, diisorder);
-
   // Set parameters if necessary
   arma::vec xpars, cpars;
   if(xparf.size()) {
@@ -255,8 +473,153 @@ int main(int argc, char **argv) {
     cpars = scf::parse_xc_params(cparf);
     cpars.t().print("Correlation functional parameters");
   }
+
+  if(Zlist.size()) {
+    if(k_func<=0 && (restr!=1 || helfem::utils::stricmp(occstr,"auto")!=0))
+      throw std::logic_error("Zlist mode requires restricted=1 and occs=auto.\n");
+
+    // The two-electron integrals only depend on the radial grid, so
+    // they are computed once and shared by all the elements
+    sadatom::basis::TwoDBasis teibasis(Z, (modelpotential::nuclear_model_t) (finitenuc), Rrms, poly, zeroder, Nquad, bval, taylor_order, lmax);
+    teibasis.compute_tei();
+    std::shared_ptr<const sadatom::basis::tei_t> tei(teibasis.get_tei());
+
+    // The table is streamed in the order the elements finish; the
+    // first entry on every line is the nuclear charge, and the line
+    // with zero charge holds the radii
+    FILE *table=fopen(tablef.c_str(),"w");
+    if(!table) {
+      std::ostringstream oss;
+      oss << "Error opening " << tablef << " for writing!\n";
+      throw std::runtime_error(oss.str());
+    }
+    bool radii_written=false;
+    size_t nfailed=0;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,1)
+#endif
+    for(size_t iz=0;iz<Zlist.size();iz++) {
+      int Zi(Zlist[iz]);
+      try {
+        sadatom::solver::SCFSolver solver(Zi, finitenuc, Rrms, lmax, poly, zeroder, Nquad, bval, taylor_order, x_func, c_func, maxit, shift, convthr, dftthr, diiseps, diisthr, diisorder, tei);
+        solver.set_params(xpars,cpars);
+
+        arma::sword numeli=Zi-Q;
+        arma::mat pot;
+        std::string characterization;
+        double Econf;
+        bool converged;
+        if(k_func>0) {
+          // The orbital-free density skips the configuration search
+          solver.set_kinetic(k_func,arma::vec(),vwfrac);
+          sadatom::solver::ofconf_t ofconf;
+          solver.Initialize(ofconf,numeli,iguess);
+          solver.Solve(ofconf);
+
+          if(xp_func > 0 || cp_func > 0)
+            solver.set_func(xp_func, cp_func);
+          pot=solver.RestrictedPotential(ofconf);
+          characterization="orbital-free";
+          Econf=ofconf.Econf;
+          converged=ofconf.converged;
+        } else {
+          std::string cachekey(sadatom::ConfigurationCache::key(Zi,Q,method,true,gridclass));
+          std::vector<arma::ivec> seeds;
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+          seeds=seed_configurations(confcache,cachekey,Zi,Q,lmax);
+          sadatom::solver::rconf_t initial(initial_configuration(solver,numeli,lmax,iguess));
+          std::vector<sadatom::solver::rconf_t> rlist(restricted_search(solver,initial,numeli,Q,Escreen,seeds));
+          sadatom::solver::rconf_t & conf(rlist[0]);
+          if(conf.converged) {
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+            confcache.store(cachekey,conf.orbs.Occs());
+          }
+
+          if(xp_func > 0 || cp_func > 0)
+            solver.set_func(xp_func, cp_func);
+          pot=solver.RestrictedPotential(conf);
+          characterization=conf.orbs.Characterize();
+          Econf=conf.Econf;
+          converged=conf.converged;
+        }
+
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+        {
+          if(!radii_written) {
+            fprintf(table,"%3i",0);
+            for(size_t ir=0;ir<pot.n_rows;ir++)
+              fprintf(table," %.16e",pot(ir,0));
+            fprintf(table,"\n");
+            radii_written=true;
+          }
+          fprintf(table,"%3i",Zi);
+          for(size_t ir=0;ir<pot.n_rows;ir++)
+            fprintf(table," %.16e",pot(ir,8));
+          fprintf(table,"\n");
+          fflush(table);
+
+          printf("%-2s: %s, E = % .10f%s\n",element_symbols[Zi].c_str(),characterization.c_str(),Econf,converged ? "" : ", convergence failure");
+          fflush(stdout);
+        }
+      } catch(std::exception & e) {
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+        {
+          printf("Calculation on %s failed: %s",element_symbols[Zi].c_str(),e.what());
+          fflush(stdout);
+          nfailed++;
+        }
+      }
+    }
+    fclose(table);
+
+    printf("\nEffective charges for %i elements written to %s\n",(int) (Zlist.size()-nfailed),tablef.c_str());
+    if(nfailed) {
+      std::ostringstream oss;
+      oss << nfailed << " of the calculations failed!\n";
+      throw std::runtime_error(oss.str());
+    }
+    return 0;
+  }
+
+  // Initialize solver
+  sadatom::solver::SCFSolver solver(Z, finitenuc, Rrms, lmax, poly, zeroder, Nquad, bval, taylor_order, x_func, c_func, maxit, shift, convthr, dftthr, diiseps, diisthr, diisorder);
   solver.set_params(xpars,cpars);
 
+  if(k_func>0) {
+    solver.set_kinetic(k_func,arma::vec(),vwfrac);
+    sadatom::solver::ofconf_t ofconf;
+    solver.Initialize(ofconf,numel,iguess);
+    solver.Solve(ofconf);
+
+    printf("\nOrbital-free result\n");
+    printf("Etot  = % 18.9f\n",ofconf.Econf);
+    printf("Ekin  = % 18.9f\n",ofconf.Ekin);
+    printf("Ecoul = % 18.9f\n",ofconf.Ecoul);
+    printf("Eenuc = % 18.9f\n",ofconf.Epot);
+    printf("Exc   = % 18.9f\n",ofconf.Exc);
+    printf("Chemical potential % .10f\n",ofconf.mu);
+
+    // Get the effective potential
+    if(xp_func > 0 || cp_func > 0) {
+      solver.set_func(xp_func, cp_func);
+      arma::mat pot(solver.RestrictedPotential(ofconf));
+
+      std::ostringstream oss;
+      oss << "result_" << element_symbols[Z] << ".dat";
+      pot.save(oss.str(),arma::raw_ascii);
+    }
+    return 0;
+  }
+
   // Final configuration (restricted case)
   helfem::sadatom::solver::rconf_t rconf;
   // Final configuration (unrestricted case)
@@ -264,65 +627,17 @@ int main(int argc, char **argv) {
 
   if(helfem::utils::stricmp(occstr,"auto")==0) {
     // Initialize with a sensible guess occupation
-    sadatom::solver::rconf_t initial;
-    initial.orbs=sadatom::solver::OrbitalChannel(true);
-    solver.Initialize(initial.orbs,iguess);
-    initial.orbs.SetOccs(initial_occs(numel,lmax));
-    if(initial.orbs.Nel()) {
-      initial.Econf=solver.Solve(initial);
-    } else {
-      initial.Econf=0.0;
-    }
+    sadatom::solver::rconf_t initial(initial_configuration(solver,numel,lmax,iguess));
+
+    // Known ground states short-circuit the search
+    std::string cachekey(sadatom::ConfigurationCache::key(Z,Q,method,restr==1,gridclass));
+    std::vector<arma::ivec> seeds(seed_configurations(confcache,cachekey,Z,Q,lmax));
 
     if(restr==1) {
       // List of configurations
-      std::vector<sadatom::solver::rconf_t> rlist;
-
-      // Restricted calculation
-      sadatom::solver::rconf_t conf(initial);
-      conf.Econf=solver.Solve(conf);
-      if(Q!=0) {
-        // Initial occupations are wrong for the state
-        conf.orbs.AufbauOccupations(numel);
-        conf.Econf=solver.Solve(conf);
-      }
-      rlist.push_back(conf);
-
-      // Brute force search for the lowest state
-      while(true) {
-        // Find the lowest energy configuration
-        std::sort(rlist.begin(),rlist.end());
-
-        // Do we have an Aufbau ground state?
-        conf.orbs=rlist[0].orbs;
-        conf.orbs.AufbauOccupations(numel);
-        while(std::find(rlist.begin(), rlist.end(), conf) == rlist.end()) {
-          conf.Econf=solver.Solve(conf);
-          rlist.push_back(conf);
-          conf.orbs.AufbauOccupations(numel);
-        }
-        printf("Aufbau search finished\n");
-
-        // Find the lowest energy configuration
-        std::sort(rlist.begin(),rlist.end());
-
-        // Generate new configurations
-        std::vector<sadatom::solver::OrbitalChannel> newconfs(rlist[0].orbs.MoveElectrons());
-
-        bool newconf=false;
-        for(size_t i=0;i<newconfs.size();i++) {
-          conf.orbs=newconfs[i];
-          if(std::find(rlist.begin(), rlist.end(), conf) == rlist.end()) {
-            newconf=true;
-            conf.Econf=solver.Solve(conf);
-            rlist.push_back(conf);
-          }
-        }
-        printf("Exhaustive search finished\n");
-        if(!newconf) {
-          break;
-        }
-      }
+      std::vector<sadatom::solver::rconf_t> rlist(restricted_search(solver,initial,numel,Q,Escreen,seeds));
+      if(rlist[0].converged)
+        confcache.store(cachekey,rlist[0].orbs.Occs());
 
       // Print occupations
       printf("\nMinimal energy configurations for %s\n",element_symbols[Z].c_str());
@@ -368,6 +683,19 @@ int main(int argc, char **argv) {
       }
       ulist.push_back(conf);
 
+      // The known candidates are warm started from the initial state
+      {
+        std::vector<sadatom::solver::uconf_t> candidates;
+        sadatom::solver::OrbitalChannel helper(restrict_configuration(ulist[0]));
+        for(size_t i=0;i<seeds.size();i++) {
+          helper.SetOccs(seeds[i]);
+          unrestrict_occupations(helper,conf);
+          add_candidate(ulist,candidates,conf);
+        }
+        solve_configurations(solver,candidates);
+        ulist.insert(ulist.end(), candidates.begin(), candidates.end());
+      }
+
       // Brute force search for the lowest state
       while(true) {
         // Find the lowest energy configuration
@@ -398,17 +726,24 @@ int main(int argc, char **argv) {
         helper=restrict_configuration(ulist[0]);
         std::vector<sadatom::solver::OrbitalChannel> newconfs(helper.MoveElectrons());
 
-        bool newconf=false;
+        // The candidates are warm started from the parent's data
+        std::vector<sadatom::solver::uconf_t> candidates;
+        size_t nscreened=0;
+        conf=ulist[0];
         for(size_t i=0;i<newconfs.size();i++) {
           unrestrict_occupations(newconfs[i],conf);
-          if(std::find(ulist.begin(), ulist.end(), conf) == ulist.end()) {
-            newconf=true;
-            conf.Econf=solver.Solve(conf);
-            ulist.push_back(conf);
+          if(screen_candidate(ulist[0],conf,Escreen)) {
+            nscreened++;
+            continue;
           }
+          add_candidate(ulist,candidates,conf);
         }
+        if(nscreened)
+          printf("%i candidates screened out by first-order energy estimate\n",(int) nscreened);
+        solve_configurations(solver,candidates);
+        ulist.insert(ulist.end(), candidates.begin(), candidates.end());
         printf("Exhaustive search finished\n");
-        if(!newconf) {
+        if(!candidates.size()) {
           break;
         }
       }
@@ -433,6 +768,8 @@ int main(int argc, char **argv) {
 
       // Save final configuration
       uconf=ulist[0];
+      if(uconf.converged)
+        confcache.store(cachekey,restrict_configuration(uconf).Occs());
 
     } else {
       // List of configurations
@@ -482,20 +819,27 @@ int main(int argc, char **argv) {
           std::vector<sadatom::solver::OrbitalChannel> newconfa(ulist[0].orbsa.MoveElectrons());
           std::vector<sadatom::solver::OrbitalChannel> newconfb(ulist[0].orbsb.MoveElectrons());
 
-          bool newconf=false;
+          // The candidates are warm started from the parent's data
+          std::vector<sadatom::solver::uconf_t> candidates;
+          size_t nscreened=0;
+          conf=ulist[0];
           for(size_t i=0;i<newconfa.size();i++) {
             for(size_t j=0;j<newconfb.size();j++) {
               conf.orbsa=newconfa[i];
               conf.orbsb=newconfb[j];
-              if(std::find(ulist.begin(), ulist.end(), conf) == ulist.end()) {
-                newconf=true;
-                conf.Econf=solver.Solve(conf);
-                ulist.push_back(conf);
+              if(screen_candidate(ulist[0],conf,Escreen)) {
+                nscreened++;
+                continue;
               }
+              add_candidate(ulist,candidates,conf);
             }
           }
+          if(nscreened)
+            printf("%i candidates screened out by first-order energy estimate\n",(int) nscreened);
+          solve_configurations(solver,candidates);
+          ulist.insert(ulist.end(), candidates.begin(), candidates.end());
           printf("Exhaustive search finished\n");
-          if(!newconf) {
+          if(!candidates.size()) {
             break;
           }
         }
@@ -19,6 +19,9 @@
 #include "../general/dftfuncs.h"
 #include "../general/scf_helpers.h"
 #include "../general/diis.h"
+#include "../general/telemetry.h"
+#include "../general/timer.h"
+#include <cfloat>
 
 // Shell types
 static const char shtype[]="spdfgh";
@@ -111,6 +114,14 @@ namespace helfem {
         return occlist;
       }
 
+      double OrbitalChannel::OrbitalEnergySum() const {
+        std::vector<shell_occupation_t> occlist(GetOccupied());
+        double Esum=0.0;
+        for(size_t i=0;i<occlist.size();i++)
+          Esum+=occlist[i].nocc*occlist[i].E;
+        return Esum;
+      }
+
       arma::vec OrbitalChannel::GetGap() const {
         arma::vec gap(E.n_cols);
         for(size_t l=0;l<E.n_cols;l++) {
@@ -174,7 +185,7 @@ namespace helfem {
           // loop over r matrices
           arma::vec rpos(rmat.size());
           for(size_t ir=0;ir<rmat.size();ir++) {
-            rpos(ir)=std::pow(arma::trace(P*rmat[ir].second),1.0/rmat[ir].first);
+            rpos(ir)=std::pow(helfem::scf::trace_symm(P,rmat[ir].second),1.0/rmat[ir].first);
             printf(" %e",rpos(ir));
           }
 
@@ -361,17 +372,18 @@ namespace helfem {
       }
 
       void OrbitalChannel::UpdateDensity(arma::cube & Pl) const {
-        Pl.zeros(C.n_rows,C.n_rows,lmax+1);
+        Pl.set_size(C.n_rows,C.n_rows,lmax+1);
         for(int l=0;l<=lmax;l++) {
-          // Number of electrons to put in
+          // Occupations of the shells, filled from the bottom
           arma::sword numl = occs(l);
-          for(size_t io=0;io<C.n_cols;io++) {
+          std::vector<double> w;
+          for(size_t io=0;io<C.n_cols && numl>0;io++) {
             arma::sword nocc = std::min(ShellCapacity(l), numl);
             numl -= nocc;
-            Pl.slice(l) += nocc * C.slice(l).col(io) * C.slice(l).col(io).t();
-            if(nocc == 0)
-              break;
+            w.push_back(nocc);
           }
+          // Only the occupied orbitals enter the rank-k update
+          helfem::scf::form_density(Pl.slice(l),C.slice(l),arma::vec(w));
         }
       }
 
@@ -597,7 +609,7 @@ namespace helfem {
         return lh.Econf < rh.Econf;
       }
 
-      SCFSolver::SCFSolver(int Z, int finitenuc, double Rrms, int lmax_, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, bool zeroder, int Nquad, const arma::vec & bval, int taylor_order, int x_func_, int c_func_, int maxit_, double shift_, double convthr_, double dftthr_, double diiseps_, double diisthr_, int diisorder_) : lmax(lmax_), maxit(maxit_), shift(shift_), convthr(convthr_), dftthr(dftthr_), diiseps(diiseps_), diisthr(diisthr_), diisorder(diisorder_) {
+      SCFSolver::SCFSolver(int Z, int finitenuc, double Rrms, int lmax_, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, bool zeroder, int Nquad, const arma::vec & bval, int taylor_order, int x_func_, int c_func_, int maxit_, double shift_, double convthr_, double dftthr_, double diiseps_, double diisthr_, int diisorder_, const std::shared_ptr<const basis::tei_t> & tei) : lmax(lmax_), k_func(0), vwfrac(1.0), maxit(maxit_), shift(shift_), convthr(convthr_), dftthr(dftthr_), diiseps(diiseps_), diisthr(diisthr_), diisorder(diisorder_) {
 
         // Construct the angular basis
         arma::ivec lval, mval;
@@ -624,7 +636,10 @@ namespace helfem {
         grid=helfem::sadatom::dftgrid::DFTGrid(&basis);
 
         // Compute two-electron integrals
-        basis.compute_tei();
+        if(tei)
+          basis.set_tei(tei);
+        else
+          basis.compute_tei();
         // Range separation?
         set_func(x_func_, c_func_);
 
@@ -632,6 +647,40 @@ namespace helfem {
         verbose = false;
       }
 
+      SCFSolver::SCFSolver(const SCFSolver & other) {
+        *this = other;
+      }
+
+      SCFSolver & SCFSolver::operator=(const SCFSolver & other) {
+        lmax=other.lmax;
+        basis=other.basis;
+        // The grid must refer to our copy of the basis, and the libxc
+        // pools of the grid must not be shared between solvers
+        grid=helfem::sadatom::dftgrid::DFTGrid(&basis);
+        x_func=other.x_func;
+        x_pars=other.x_pars;
+        c_func=other.c_func;
+        c_pars=other.c_pars;
+        k_func=other.k_func;
+        k_pars=other.k_pars;
+        vwfrac=other.vwfrac;
+        S=other.S;
+        Sinvh=other.Sinvh;
+        T=other.T;
+        Tl=other.Tl;
+        Vnuc=other.Vnuc;
+        H0=other.H0;
+        maxit=other.maxit;
+        shift=other.shift;
+        convthr=other.convthr;
+        dftthr=other.dftthr;
+        diiseps=other.diiseps;
+        diisthr=other.diisthr;
+        diisorder=other.diisorder;
+        verbose=other.verbose;
+        return *this;
+      }
+
       SCFSolver::~SCFSolver() {
       }
 
@@ -672,6 +721,21 @@ namespace helfem {
         verbose = verbose_;
       }
 
+      void SCFSolver::set_kinetic(int k_func_, const arma::vec & k_pars_, double vwfrac_) {
+        if(k_func_>0) {
+          if(!is_kinetic(k_func_)) {
+            std::ostringstream oss;
+            oss << "Functional " << get_keyword(k_func_) << " is not a kinetic energy functional.\n";
+            throw std::logic_error(oss.str());
+          }
+          if(tau_needed(k_func_) || laplacian_needed(k_func_))
+            throw std::logic_error("Meta-GGA kinetic energy functionals are not supported in the orbital-free solver.\n");
+        }
+        k_func=k_func_;
+        k_pars=k_pars_;
+        vwfrac=vwfrac_;
+      }
+
       arma::mat SCFSolver::TotalDensity(const arma::cube & Pl) const {
         arma::mat P(Pl.slice(0));
         for(size_t l=1;l<Pl.n_slices;l++)
@@ -720,6 +784,26 @@ namespace helfem {
         }
       }
 
+      void SCFSolver::Initialize(ofconf_t & conf, arma::sword numel, int iguess) const {
+        OrbitalChannel orbs(true);
+        Initialize(orbs,iguess);
+        orbs.AufbauOccupations(numel);
+        arma::cube Pl;
+        orbs.UpdateDensity(Pl);
+
+        // The density matrix in the orthonormal basis is positive
+        // semidefinite, so its leading eigenvector is the sign-definite
+        // radial function whose square is closest to the density
+        arma::mat SX(S*Sinvh);
+        arma::mat Po(SX.t()*TotalDensity(Pl)*SX);
+        arma::vec pval;
+        arma::mat pvec;
+        arma::eig_sym(pval,pvec,Po);
+        conf.x=pvec.col(pvec.n_cols-1);
+        conf.Nel=numel;
+        conf.converged=false;
+      }
+
       bool is_meta(int x_func, int c_func) {
         bool ggax, mggatx, mggalx;
         is_gga_mgga(x_func, ggax, mggatx, mggalx);
@@ -733,7 +817,7 @@ namespace helfem {
         conf.orbs.UpdateDensity(conf.Pl);
         arma::mat P(TotalDensity(conf.Pl));
         if(verbose) {
-          printf("Tr P = %f\n",arma::trace(P*S));
+          printf("Tr P = %f\n",helfem::scf::trace_symm(P,S));
           fflush(stdout);
         }
 
@@ -743,10 +827,13 @@ namespace helfem {
         arma::cube kc(KineticCube());
 
         // Compute energy
-        conf.Ekin=arma::trace(P*T);
+        {
+          arma::vec Eone(helfem::scf::trace_symm(P,{&T,&Vnuc}));
+          conf.Ekin=Eone(0);
+          conf.Epot=Eone(1);
+        }
         for(arma::sword l=0;l<=lmax;l++)
-          conf.Ekin+=arma::trace(conf.Pl.slice(l)*kc.slice(l));
-        conf.Epot=arma::trace(P*Vnuc);
+          conf.Ekin+=helfem::scf::trace_symm(conf.Pl.slice(l),kc.slice(l));
         if(verbose) {
           printf("Kinetic energy %.10e\n",conf.Ekin);
           printf("Nuclear attraction energy %.10e\n",conf.Epot);
@@ -755,7 +842,7 @@ namespace helfem {
 
         // Form Coulomb matrix
         arma::mat J(basis.coulomb(P/angfac));
-        conf.Ecoul=0.5*arma::trace(P*J);
+        conf.Ecoul=0.5*helfem::scf::trace_symm(P,J);
         if(verbose) {
           printf("Coulomb energy %.10e\n",conf.Ecoul);
           fflush(stdout);
@@ -791,7 +878,7 @@ namespace helfem {
 
           double Exx=0.0;
           for(int l=0;l<=lmax;l++)
-            Exx += 0.5*arma::trace(K.slice(l)*conf.Pl.slice(l));
+            Exx += 0.5*helfem::scf::trace_symm(K.slice(l),conf.Pl.slice(l));
           if(verbose) {
             printf("Exact exchange energy %.10e\n",Exx);
             fflush(stdout);
@@ -829,14 +916,17 @@ namespace helfem {
         arma::cube kc(KineticCube());
 
         // Compute energy
-        conf.Ekin=arma::trace(P*T);
+        {
+          arma::vec Eone(helfem::scf::trace_symm(P,{&T,&Vnuc}));
+          conf.Ekin=Eone(0);
+          conf.Epot=Eone(1);
+        }
         for(arma::sword l=0;l<=lmax;l++)
-          conf.Ekin+=arma::trace(Pl.slice(l)*kc.slice(l));
-        conf.Epot=arma::trace(P*Vnuc);
+          conf.Ekin+=helfem::scf::trace_symm(Pl.slice(l),kc.slice(l));
 
         // Form Coulomb matrix
         arma::mat J(basis.coulomb(P/angfac));
-        conf.Ecoul=0.5*arma::trace(P*J);
+        conf.Ecoul=0.5*helfem::scf::trace_symm(P,J);
         if(verbose) {
           printf("Coulomb energy %.10e\n",conf.Ecoul);
           fflush(stdout);
@@ -875,7 +965,7 @@ namespace helfem {
 
           double Exx=0.0;
           for(int l=0;l<=lmax;l++)
-            Exx += 0.5*arma::trace(Ka.slice(l)*conf.Pal.slice(l)) + 0.5*arma::trace(Kb.slice(l)*conf.Pbl.slice(l));
+            Exx += 0.5*helfem::scf::trace_symm(Ka.slice(l),conf.Pal.slice(l)) + 0.5*helfem::scf::trace_symm(Kb.slice(l),conf.Pbl.slice(l));
           if(verbose) {
             printf("Exact exchange energy %.10e\n",Exx);
             fflush(stdout);
@@ -901,13 +991,58 @@ namespace helfem {
         return conf.Econf;
       }
 
-      arma::mat SCFSolver::SuperMat(const arma::mat & M) const {
-        arma::mat superM(M.n_rows*(lmax+1),M.n_cols*(lmax+1));
-        superM.zeros();
-        for(int l=0;l<=lmax;l++) {
-          superM.submat(l*M.n_rows,l*M.n_cols,(l+1)*M.n_rows-1,(l+1)*M.n_cols-1)=M;
+      double SCFSolver::FockBuild(ofconf_t & conf) {
+        // Form density
+        arma::vec c(Sinvh*conf.x);
+        conf.P=conf.Nel*c*c.t();
+        arma::cube Pl(conf.P.n_rows,conf.P.n_cols,1);
+        Pl.slice(0)=conf.P;
+
+        // Angular factor
+        double angfac(4.0*M_PI);
+
+        // The von Weizsacker kinetic energy is the kinetic energy of phi
+        {
+          arma::vec Eone(helfem::scf::trace_symm(conf.P,{&T,&Vnuc}));
+          conf.Ekin=vwfrac*Eone(0);
+          conf.Epot=Eone(1);
+        }
+        conf.F=vwfrac*T+Vnuc;
+
+        // Coulomb
+        arma::mat J(basis.coulomb(conf.P/angfac));
+        conf.Ecoul=0.5*helfem::scf::trace_symm(conf.P,J);
+        conf.F+=J;
+
+        // Kinetic energy functional
+        double nelnum;
+        if(k_func>0) {
+          arma::cube Kl;
+          double Ek;
+          grid.eval_Fxc(k_func, k_pars, 0, arma::vec(), Pl/angfac, Kl, Ek, nelnum, dftthr);
+          conf.Ekin+=Ek;
+          conf.F+=Kl.slice(0)/angfac;
         }
-        return superM;
+
+        // Exchange-correlation
+        conf.Exc=0.0;
+        if(x_func>0 || c_func>0) {
+          arma::cube XC;
+          grid.eval_Fxc(x_func, x_pars, c_func, c_pars, Pl/angfac, XC, conf.Exc, nelnum, dftthr);
+          conf.F+=XC.slice(0)/angfac;
+        }
+        if(verbose) {
+          printf("Kinetic energy %.10e\n",conf.Ekin);
+          printf("Nuclear attraction energy %.10e\n",conf.Epot);
+          printf("Coulomb energy %.10e\n",conf.Ecoul);
+          printf("DFT energy %.10e\n",conf.Exc);
+          fflush(stdout);
+        }
+
+        conf.mu=arma::as_scalar(c.t()*conf.F*c);
+        conf.Econf=conf.Ekin+conf.Epot+conf.Ecoul+conf.Exc;
+
+        return conf.Econf;
       }
 
       arma::cube SCFSolver::ReplicateCube(const arma::mat & M) const {
@@ -928,22 +1063,21 @@ namespace helfem {
         return Tc;
       }
 
-      arma::mat SCFSolver::SuperCube(const arma::cube & M) const {
-        arma::mat Msuper(M.n_rows*(lmax+1),M.n_cols*(lmax+1));
-        Msuper.zeros();
-        for(int l=0;l<=lmax;l++) {
-          Msuper.submat(l*M.n_rows,l*M.n_cols,(l+1)*M.n_rows-1,(l+1)*M.n_cols-1)=M.slice(l);
-        }
-        return Msuper;
-      }
-
-      arma::cube SCFSolver::MiniMat(const arma::mat & Msuper) const {
-        arma::cube M(Msuper.n_rows/(lmax+1),Msuper.n_cols/(lmax+1),lmax+1);
-        M.zeros();
-        for(int l=0;l<=lmax;l++) {
-          M.slice(l)=Msuper.submat(l*M.n_rows,l*M.n_cols,(l+1)*M.n_rows-1,(l+1)*M.n_cols-1);
-        }
-        return M;
+      void SCFSolver::WriteTelemetry(const arma::ivec & occs, int iscf, double E, double dE, double diiserr, const arma::vec & w, double diisfrac, bool converged, double tfock, double tdiis, double tdiag) const {
+        telemetry::Record rec("gensap");
+        rec.add("Z",basis.get_Z());
+        rec.add("occupations",arma::conv_to<arma::vec>::from(occs));
+        rec.add("iteration",iscf);
+        rec.add("energy",E);
+        rec.add("dE",dE);
+        rec.add("diis_error",diiserr);
+        rec.add("diis_weights",w);
+        rec.add("diis_fraction",diisfrac);
+        rec.add("converged",converged);
+        rec.add("t_Fock",tfock);
+        rec.add("t_diag",tdiag);
+        rec.add("t_DIIS",tdiis);
+        rec.write();
       }
 
       double SCFSolver::Solve(rconf_t & conf) {
@@ -961,7 +1095,7 @@ namespace helfem {
 
         // DIIS object. ADIIS doesn't work for (significant) fractional occupation
         bool usediis=true, useadiis=true;
-        ::rDIIS diis(SuperMat(S),SuperMat(Sinvh),usediis,diiseps,diisthr,useadiis,verbose,diisorder);
+        ::rDIIS diis(ReplicateCube(S),ReplicateCube(Sinvh),usediis,diiseps,diisthr,useadiis,verbose,diisorder);
         double diiserr;
 
         double E=0.0, Eold;
@@ -973,8 +1107,10 @@ namespace helfem {
           }
 
           // Form Fock matrix
+          Timer timer;
           Eold=E;
           E=FockBuild(conf);
+          double tfock(timer.get());
 
           double dE=E-Eold;
           if(verbose) {
@@ -984,13 +1120,10 @@ namespace helfem {
             fflush(stdout);
           }
 
-          // Since Fock operator depends on the l channel, we need to create
-          // a supermatrix for DIIS.
-          arma::mat Fsuper(SuperCube(conf.Fl));
-          // Need density for DIIS as well
-          arma::mat Psuper(SuperCube(conf.Pl));
-          // Update DIIS
-          diis.update(Fsuper,Psuper,E,diiserr);
+          // Since Fock operator depends on the l channel, DIIS works
+          // on the l channel blocks of the Fock and density cubes
+          timer.set();
+          diis.update(conf.Fl,conf.Pl,E,diiserr);
           if(verbose) {
             printf("DIIS error is %e\n",diiserr);
             fflush(stdout);
@@ -999,16 +1132,19 @@ namespace helfem {
           conf.converged=(diiserr<convthr) && (std::abs(dE)<convthr);
 
           // Solve DIIS to get Fock update
-          diis.solve_F(Fsuper);
-          conf.Fl=MiniMat(Fsuper);
+          diis.solve_F(conf.Fl);
+          double tdiis(timer.get());
 
           // Update orbitals and density
+          timer.set();
           if(diiserr > diisthr) {
             // Since ADIIS is unreliable, we also use a level shift.
             conf.orbs.UpdateOrbitalsShifted(conf.Fl,Sinvh,S,shift);
           } else {
             conf.orbs.UpdateOrbitals(conf.Fl,Sinvh);
           }
+          if(telemetry::enabled())
+            WriteTelemetry(conf.orbs.Occs(),iscf,E,dE,diiserr,diis.get_last_weights(),diis.get_last_diis_fraction(),conf.converged,tfock,tdiis,timer.get());
 
           if(conf.converged)
             break;
@@ -1067,7 +1203,7 @@ namespace helfem {
 
         // DIIS object. ADIIS doesn't work for (significant) fractional occupation
         bool combine=false, usediis=true, useadiis=true;
-        uDIIS diis(SuperMat(S),SuperMat(Sinvh),combine, usediis,diiseps,diisthr,useadiis,verbose,diisorder);
+        uDIIS diis(ReplicateCube(S),ReplicateCube(Sinvh),combine, usediis,diiseps,diisthr,useadiis,verbose,diisorder);
         double diiserr;
 
         arma::sword iscf;
@@ -1076,8 +1212,10 @@ namespace helfem {
             printf("\n**** Iteration %i ****\n\n",(int) iscf);
           }
 
+          Timer timer;
           Eold=E;
           E=FockBuild(conf);
+          double tfock(timer.get());
           double dE=E-Eold;
 
           if(verbose) {
@@ -1087,13 +1225,10 @@ namespace helfem {
             fflush(stdout);
           }
 
-          // Since Fock operator depends on the l channel, we need to create
-          // a supermatrix for DIIS.
-          arma::mat Fasuper(SuperCube(conf.Fal)), Fbsuper(SuperCube(conf.Fbl));
-          arma::mat Pasuper(SuperCube(conf.Pal));
-          arma::mat Pbsuper(SuperCube(conf.Pbl));
-          // Update DIIS
-          diis.update(Fasuper,Fbsuper,Pasuper,Pbsuper,E,diiserr);
+          // Since Fock operator depends on the l channel, DIIS works
+          // on the l channel blocks of the Fock and density cubes
+          timer.set();
+          diis.update(conf.Fal,conf.Fbl,conf.Pal,conf.Pbl,E,diiserr);
           if(verbose) {
             printf("DIIS error is %e\n",diiserr);
             fflush(stdout);
@@ -1103,11 +1238,11 @@ namespace helfem {
           conf.converged=(diiserr<convthr) && (std::abs(dE)<convthr);
 
           // Solve DIIS to get Fock update
-          diis.solve_F(Fasuper,Fbsuper);
-          conf.Fal=MiniMat(Fasuper);
-          conf.Fbl=MiniMat(Fbsuper);
+          diis.solve_F(conf.Fal,conf.Fbl);
+          double tdiis(timer.get());
 
           // Update orbitals and density
+          timer.set();
           if(diiserr > diisthr) {
             // Since ADIIS is unreliable, we also use a level shift
             conf.orbsa.UpdateOrbitalsShifted(conf.Fal,Sinvh,S,shift);
@@ -1116,6 +1251,8 @@ namespace helfem {
             conf.orbsa.UpdateOrbitals(conf.Fal,Sinvh);
             conf.orbsb.UpdateOrbitals(conf.Fbl,Sinvh);
           }
+          if(telemetry::enabled())
+            WriteTelemetry(arma::join_cols(conf.orbsa.Occs(),conf.orbsb.Occs()),iscf,E,dE,diiserr,diis.get_last_weights(),diis.get_last_diis_fraction(),conf.converged,tfock,tdiis,timer.get());
           if(conf.converged)
             break;
         }
@@ -1151,21 +1288,151 @@ namespace helfem {
         return E;
       }
 
+      double SCFSolver::Solve(ofconf_t & conf) {
+        if(!conf.x.n_elem)
+          throw std::logic_error("Orbital-free density not initialized!\n");
+        {
+          double kfrac, kshort, omega;
+          range_separation(x_func, omega, kfrac, kshort);
+          if(kfrac!=0.0 || kshort!=0.0)
+            throw std::logic_error("Exact exchange is not available in the orbital-free solver.\n");
+        }
+
+        // The energy is minimized over the unit sphere of x, on which the
+        // gradient is orthogonal to x
+        const arma::mat Sinvht(Sinvh.t());
+        auto gradient = [&](const ofconf_t & cf) {
+          arma::vec Fx(Sinvht*(cf.F*(Sinvh*cf.x)));
+          return arma::vec(2.0*cf.Nel*(Fx-cf.mu*cf.x));
+        };
+
+        // The kinetic energy dominates the Hessian at high momenta, so
+        // the search direction is preconditioned with (T+1)^-1
+        arma::vec tval;
+        arma::mat tvec;
+        arma::eig_sym(tval,tvec,Sinvht*T*Sinvh);
+        auto precondition = [&](const arma::vec & g) {
+          return arma::vec(tvec*((tvec.t()*g)/(tval+1.0)));
+        };
+
+        // L-BFGS history
+        const size_t nhist(std::max(diisorder,1));
+        std::vector<arma::vec> shist, yhist;
+
+        double E(FockBuild(conf));
+        arma::vec g(gradient(conf));
+        conf.converged=false;
+        int iter;
+        for(iter=1;iter<=maxit;iter++) {
+          double gnorm(arma::norm(g,2));
+          if(gnorm<convthr) {
+            conf.converged=true;
+            break;
+          }
+
+          // Two-loop recursion
+          arma::vec q(g);
+          arma::vec alpha(shist.size());
+          for(size_t i=shist.size();i-->0;) {
+            alpha(i)=arma::dot(shist[i],q)/arma::dot(yhist[i],shist[i]);
+            q-=alpha(i)*yhist[i];
+          }
+          arma::vec d(precondition(q));
+          for(size_t i=0;i<shist.size();i++) {
+            double beta(arma::dot(yhist[i],d)/arma::dot(yhist[i],shist[i]));
+            d+=(alpha(i)-beta)*shist[i];
+          }
+          d=-d;
+          d-=arma::dot(conf.x,d)*conf.x;
+          if(arma::dot(d,g)>=0.0) {
+            // Not a descent direction; restart from steepest descent
+            shist.clear();
+            yhist.clear();
+            d=-precondition(g);
+            d-=arma::dot(conf.x,d)*conf.x;
+          }
+
+          // Backtracking line search
+          double step(1.0);
+          double dg(arma::dot(d,g));
+          ofconf_t trial(conf);
+          double Etrial;
+          bool accepted=false;
+          for(int ils=0;ils<30;ils++) {
+            trial.x=arma::normalise(conf.x+step*d);
+            Etrial=FockBuild(trial);
+            if(Etrial<=E+1e-4*step*dg) {
+              accepted=true;
+              break;
+            }
+            step*=0.5;
+          }
+          if(!accepted) {
+            // The energy can no longer be lowered to numerical precision
+            if(verbose) {
+              printf("Line search failed, gradient norm %e\n",gnorm);
+              fflush(stdout);
+            }
+            break;
+          }
+
+          arma::vec gtrial(gradient(trial));
+          arma::vec s(trial.x-conf.x), y(gtrial-g);
+          if(arma::dot(s,y)>DBL_EPSILON*arma::norm(s,2)*arma::norm(y,2)) {
+            shist.push_back(s);
+            yhist.push_back(y);
+            if(shist.size()>nhist) {
+              shist.erase(shist.begin());
+              yhist.erase(yhist.begin());
+            }
+          }
+
+          if(verbose) {
+            printf("Orbital-free iteration %3i: E = % .16f, dE = % e, gradient norm %e, step %e\n",iter,Etrial,Etrial-E,gnorm,step);
+            fflush(stdout);
+          }
+          conf=trial;
+          E=Etrial;
+          g=gtrial;
+        }
+
+        if(conf.converged)
+          printf("Orbital-free energy % .16f converged in %i iterations, chemical potential % .10f\n",E,iter,conf.mu);
+        else
+          printf("Orbital-free energy % .16f did not converge, gradient norm %e\n",E,arma::norm(g,2));
+        fflush(stdout);
+
+        return E;
+      }
+
       arma::mat SCFSolver::RestrictedPotential(rconf_t & conf) {
         if(!conf.orbs.OrbitalsInitialized())
           throw std::logic_error("No orbitals!\n");
+        return RadialPotential(conf.Pl);
+      }
 
-        arma::mat P=TotalDensity(conf.Pl);
+      arma::mat SCFSolver::RestrictedPotential(ofconf_t & conf) {
+        if(!conf.P.n_elem)
+          throw std::logic_error("No orbital-free density!\n");
+        arma::cube Pl(conf.P.n_rows,conf.P.n_cols,1);
+        Pl.slice(0)=conf.P;
+        return RadialPotential(Pl);
+      }
 
-        arma::vec r(basis.radii());
+      arma::mat SCFSolver::RadialPotential(const arma::cube & Pl) const {
+        arma::mat P=TotalDensity(Pl);
+
+        // All the density properties are formed in one pass
+        sadatom::basis::radial_properties_t prop(basis.radial_properties(P,Pl));
+        const arma::vec & r(prop.r);
         arma::vec wt(basis.quadrature_weights());
         arma::vec vcoul(basis.coulomb_screening(P));
         arma::vec vxc(basis.xc_screening(P,x_func,c_func));
         arma::vec Zeff(vcoul+vxc);
-        arma::vec rho(basis.electron_density(P));
-        arma::vec grho(basis.electron_density_gradient(P));
-        arma::vec lrho(basis.electron_density_laplacian(P));
-        arma::vec tau(basis.kinetic_energy_density(conf.Pl));
+        const arma::vec & rho(prop.rho);
+        const arma::vec & grho(prop.grad);
+        const arma::vec & lrho(prop.lapl);
+        const arma::vec & tau(prop.tau);
 
         arma::mat result(Zeff.n_rows,9);
         result.col(0)=r;
@@ -1197,17 +1464,19 @@ namespace helfem {
         // Total density
         arma::cube Pl(conf.Pal+conf.Pbl);
 
-        arma::vec r(basis.radii());
+        // All the density properties are formed in one pass
+        sadatom::basis::radial_properties_t prop(basis.radial_properties(P,Pl));
+        const arma::vec & r(prop.r);
         arma::vec wt(basis.quadrature_weights());
         arma::vec vcoul(basis.coulomb_screening(P));
         arma::mat vxcm(basis.xc_screening(Pa,Pb,x_func,c_func));
         // Averaged potential
         arma::vec vxc=arma::mean(vxcm,1);
         arma::vec Zeff(vcoul+vxc);
-        arma::vec rho(basis.electron_density(P));
-        arma::vec grho(basis.electron_density_gradient(P));
-        arma::vec lrho(basis.electron_density_laplacian(P));
-        arma::vec tau(basis.kinetic_energy_density(Pl));
+        const arma::vec & rho(prop.rho);
+        const arma::vec & grho(prop.grad);
+        const arma::vec & lrho(prop.lapl);
+        const arma::vec & tau(prop.tau);
 
         arma::mat result(r.n_elem,9);
         result.col(0)=r;
@@ -1241,11 +1510,13 @@ namespace helfem {
         arma::vec vxc(basis.xc_screening(P,x_func,c_func));
         arma::vec Zeff(vcoul+vxc);
 
-        arma::vec r(basis.radii());
-        arma::vec rho(basis.electron_density(P));
-        arma::vec grho(basis.electron_density_gradient(P));
-        arma::vec lrho(basis.electron_density_laplacian(P));
-        arma::vec tau(basis.kinetic_energy_density(conf.Pal+conf.Pbl));
+        // All the density properties are formed in one pass
+        sadatom::basis::radial_properties_t prop(basis.radial_properties(P,conf.Pal+conf.Pbl));
+        const arma::vec & r(prop.r);
+        const arma::vec & rho(prop.rho);
+        const arma::vec & grho(prop.grad);
+        const arma::vec & lrho(prop.lapl);
+        const arma::vec & tau(prop.tau);
 
         arma::mat result(Zeff.n_rows,9);
         result.col(0)=r;
@@ -1271,18 +1542,22 @@ namespace helfem {
         arma::mat Pb=TotalDensity(conf.Pbl);
         arma::mat P(Pa+Pb);
 
-        arma::vec r(basis.radii());
+        // The spin densities are evaluated once, and their properties
+        // are also used for the exchange-correlation screening
+        sadatom::basis::radial_properties_t propa(basis.radial_properties(Pa,conf.Pal));
+        sadatom::basis::radial_properties_t propb(basis.radial_properties(Pb,conf.Pbl));
+        const arma::vec & r(propa.r);
         arma::vec wt(basis.quadrature_weights());
         arma::vec vcoul(basis.coulomb_screening(P));
-        arma::mat vxcm(basis.xc_screening(Pa,Pb,x_func,c_func));
-        arma::vec rhoa(basis.electron_density(Pa));
-        arma::vec grhoa(basis.electron_density_gradient(Pa));
-        arma::vec lrhoa(basis.electron_density_laplacian(Pa));
-        arma::vec rhob(basis.electron_density(Pb));
-        arma::vec grhob(basis.electron_density_gradient(Pb));
-        arma::vec lrhob(basis.electron_density_laplacian(Pb));
-        arma::vec taua(basis.kinetic_energy_density(conf.Pal));
-        arma::vec taub(basis.kinetic_energy_density(conf.Pbl));
+        arma::mat vxcm(basis.xc_screening(propa,propb,x_func,c_func));
+        const arma::vec & rhoa(propa.rho);
+        const arma::vec & grhoa(propa.grad);
+        const arma::vec & lrhoa(propa.lapl);
+        const arma::vec & rhob(propb.rho);
+        const arma::vec & grhob(propb.grad);
+        const arma::vec & lrhob(propb.lapl);
+        const arma::vec & taua(propa.tau);
+        const arma::vec & taub(propb.tau);
 
         // Averaged potential
         arma::vec vxc((vxcm.col(0)%rhoa + vxcm.col(1)%rhob)/(rhoa+rhob));
@@ -1320,14 +1595,16 @@ namespace helfem {
         arma::vec wt(basis.quadrature_weights());
         arma::vec vcoul(basis.coulomb_screening(Pcoul));
         arma::mat vxc(basis.xc_screening(Pxc,x_func,c_func));
-        arma::vec rhoa(basis.electron_density(Pa));
-        arma::vec grhoa(basis.electron_density_gradient(Pa));
-        arma::vec lrhoa(basis.electron_density_laplacian(Pa));
-        arma::vec rhob(basis.electron_density(Pb));
-        arma::vec grhob(basis.electron_density_gradient(Pb));
-        arma::vec lrhob(basis.electron_density_laplacian(Pb));
-        arma::vec taua(basis.kinetic_energy_density(conf.Pal));
-        arma::vec taub(basis.kinetic_energy_density(conf.Pbl));
+        sadatom::basis::radial_properties_t propa(basis.radial_properties(Pa,conf.Pal));
+        sadatom::basis::radial_properties_t propb(basis.radial_properties(Pb,conf.Pbl));
+        const arma::vec & rhoa(propa.rho);
+        const arma::vec & grhoa(propa.grad);
+        const arma::vec & lrhoa(propa.lapl);
+        const arma::vec & rhob(propb.rho);
+        const arma::vec & grhob(propb.grad);
+        const arma::vec & lrhob(propb.lapl);
+        const arma::vec & taua(propa.tau);
+        const arma::vec & taub(propb.tau);
         arma::vec Zeff(vcoul+vxc);
 
         arma::mat result(Zeff.n_rows,9);
@@ -1359,14 +1636,16 @@ namespace helfem {
         arma::vec wt(basis.quadrature_weights());
         arma::vec vcoul(basis.coulomb_screening(Pcoul));
         arma::mat vxc(basis.xc_screening(Pxc,x_func,c_func));
-        arma::vec rhoa(basis.electron_density(Pa));
-        arma::vec grhoa(basis.electron_density_gradient(Pa));
-        arma::vec lrhoa(basis.electron_density_laplacian(Pa));
-        arma::vec rhob(basis.electron_density(Pb));
-        arma::vec grhob(basis.electron_density_gradient(Pb));
-        arma::vec lrhob(basis.electron_density_laplacian(Pb));
-        arma::vec taua(basis.kinetic_energy_density(conf.Pal));
-        arma::vec taub(basis.kinetic_energy_density(conf.Pbl));
+        sadatom::basis::radial_properties_t propa(basis.radial_properties(Pa,conf.Pal));
+        sadatom::basis::radial_properties_t propb(basis.radial_properties(Pb,conf.Pbl));
+        const arma::vec & rhoa(propa.rho);
+        const arma::vec & grhoa(propa.grad);
+        const arma::vec & lrhoa(propa.lapl);
+        const arma::vec & rhob(propb.rho);
+        const arma::vec & grhob(propb.grad);
+        const arma::vec & lrhob(propb.lapl);
+        const arma::vec & taua(propa.tau);
+        const arma::vec & taub(propb.tau);
         arma::vec Zeff(vcoul+vxc);
 
         arma::mat result(Zeff.n_rows,9);
@@ -90,6 +90,8 @@ namespace helfem {
 
         /// Get HOMO-LUMO gaps
         arma::vec GetGap() const;
+        /// Sum of the occupied orbital energies, weighted by the occupations
+        double OrbitalEnergySum() const;
 
         /// Characterizes the configuration
         std::string Characterize() const;
@@ -171,6 +173,32 @@ namespace helfem {
       /// Orders configurations in energy
       bool operator<(const uconf_t & lh, const uconf_t & rh);
 
+      /// Orbital-free solution: the density is N phi^2 with a single radial function phi
+      typedef struct {
+        /// Coefficients of phi in the orthonormal basis, normalized to unity
+        arma::vec x;
+        /// Number of electrons
+        double Nel;
+        /// Density matrix
+        arma::mat P;
+        /// Effective potential matrix, the functional derivative of the energy
+        arma::mat F;
+        /// Chemical potential
+        double mu;
+        /// Total energy
+        double Econf;
+        /// Kinetic energy
+        double Ekin;
+        /// Potential energy
+        double Epot;
+        /// Coulomb repulsion energy
+        double Ecoul;
+        /// Exchange-correlation energy
+        double Exc;
+        /// Converged?
+        bool converged;
+      } ofconf_t;
+
       /// SCF Solver
       class SCFSolver {
       protected:
@@ -190,6 +218,12 @@ namespace helfem {
         int c_func;
         /// Correlation functional parameters
         arma::vec c_pars;
+        /// Kinetic energy functional of the orbital-free solver
+        int k_func;
+        /// Kinetic energy functional parameters
+        arma::vec k_pars;
+        /// Fraction of von Weizsacker kinetic energy in the orbital-free solver
+        double vwfrac;
 
         /// Overlap matrix
         arma::mat S;
@@ -224,20 +258,20 @@ namespace helfem {
         /// Verbose operation?
         bool verbose;
 
-        /// Form supermatrix
-        arma::mat SuperMat(const arma::mat & M) const;
-        /// Form supermatrix from cube
-        arma::mat SuperCube(const arma::cube & M) const;
-        /// Form cube from supermatrix
-        arma::cube MiniMat(const arma::mat & Msuper) const;
         /// Form l(l+1)/r^2 cube
         arma::cube KineticCube() const;
         /// Replicate matrix into a cube
         arma::cube ReplicateCube(const arma::mat & M) const;
+        /// Tabulate the density and the effective charge, see RestrictedPotential
+        arma::mat RadialPotential(const arma::cube & Pl) const;
 
       public:
-        /// Constructor
-        SCFSolver(int Z, int finitenuc, double Rrms, int lmax, const std::shared_ptr<const polynomial_basis::PolynomialBasis> &poly, bool zeroder, int Nquad, const arma::vec & bval, int taylor_order, int x_func_, int c_func_, int maxit_, double shift_, double convthr_, double dftthr_, double diiseps_, double diisthr_, int diisorder_);
+        /// Constructor; two-electron integrals from a solver on the same grid are reused if given
+        SCFSolver(int Z, int finitenuc, double Rrms, int lmax, const std::shared_ptr<const polynomial_basis::PolynomialBasis> &poly, bool zeroder, int Nquad, const arma::vec & bval, int taylor_order, int x_func_, int c_func_, int maxit_, double shift_, double convthr_, double dftthr_, double diiseps_, double diisthr_, int diisorder_, const std::shared_ptr<const basis::tei_t> & tei = std::shared_ptr<const basis::tei_t>());
+        /// Copy constructor; the copy gets its own integration grid so that copies can be used concurrently
+        SCFSolver(const SCFSolver & other);
+        /// Assignment operator, see copy constructor
+        SCFSolver & operator=(const SCFSolver & other);
         /// Destructor
         ~SCFSolver();
 
@@ -247,24 +281,36 @@ namespace helfem {
         void set_params(const arma::vec & px, const arma::vec & pc);
         /// Set verbosity
         void set_verbose(bool verbose);
+        /// Set the kinetic energy functional and the fraction of von Weizsacker kinetic energy for the orbital-free solver
+        void set_kinetic(int k_func_, const arma::vec & k_pars_, double vwfrac_);
 
         /// Build total density
         arma::mat TotalDensity(const arma::cube & Pl) const;
 
         /// Initialize orbitals
         void Initialize(OrbitalChannel & orbs, int iguess) const;
+        /// Initialize the orbital-free density from the best rank-one fit to the aufbau density of the orbital guess
+        void Initialize(ofconf_t & conf, arma::sword numel, int iguess) const;
         /// Build the Fock operator, return the energy
         double FockBuild(rconf_t & conf);
         /// Build the Fock operator, return the energy
         double FockBuild(uconf_t & conf);
+        /// Build the orbital-free effective potential, return the energy
+        double FockBuild(ofconf_t & conf);
 
+        /// Write out a telemetry record of an SCF iteration
+        void WriteTelemetry(const arma::ivec & occs, int iscf, double E, double dE, double diiserr, const arma::vec & w, double diisfrac, bool converged, double tfock, double tdiis, double tdiag) const;
         /// Solve the SCF problem, return the energy
         double Solve(rconf_t & conf);
         /// Solve the SCF problem, return the energy
         double Solve(uconf_t & conf);
+        /// Minimize the orbital-free energy with preconditioned L-BFGS, return the energy
+        double Solve(ofconf_t & conf);
 
         /// Compute the spin-restricted effective potential
         arma::mat RestrictedPotential(rconf_t & conf);
+        /// Compute the effective potential of the orbital-free density
+        arma::mat RestrictedPotential(ofconf_t & conf);
         /// Compute the effective potential as the mean of spin-unrestricted potentials
         arma::mat UnrestrictedPotential(uconf_t & conf);
         /// Compute the effective potential as the spin-restricted potential of the average density